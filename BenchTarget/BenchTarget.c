@@ -0,0 +1,183 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - benchmark target
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Firmware for a second ATmegaXU4 board acting as a fast, predictable I2C target, so two boards make a test rig
+ *  for i2c-bench whose numbers don't depend on whatever target happens to be on the bus. The TWI answers from its
+ *  interrupt with a register file in SRAM: it ACKs every byte, never stretches unless told to and holds known
+ *  content, byte n being (n ^ (n >> 8)) at power up. There is no USB, the board only draws its power from it.
+ *
+ *  Wire SDA to SDA, SCL to SCL and GND to GND; the adapter's pull-ups serve both boards.
+ */
+
+#define  __INCLUDE_FROM_BENCHTARGET_C
+#include "BenchTarget.h"
+
+static uint8_t Bench_Registers[BENCH_REGISTERS];
+static volatile BenchControl_t Bench_Control = { .StretchUs = BENCH_STRETCH_US };
+
+// Transfer state: register or control block offset of the next byte, pointer bytes still expected and whether the
+// current transaction is with the control block
+static uint16_t Bench_Pointer;
+static uint8_t  Bench_Selecting;
+static bool     Bench_IsControl;
+
+/** Main program entry point. Everything happens in the TWI interrupt, the main loop only sleeps and restores the
+ *  register file when asked to.
+ */
+int main(void)
+{
+	SetupHardware();
+
+	sei();
+
+	for (;;)
+	{
+		if (Bench_Control.Flags & BENCH_FLAG_RESTORE)
+		{
+			Bench_Fill();
+			Bench_Control.Flags &= ~BENCH_FLAG_RESTORE;
+		}
+
+		sleep_mode();
+	}
+}
+
+/** Configures the clock, fills the register file and has the TWI listen on both addresses. */
+void SetupHardware(void)
+{
+	/* Disable watchdog if enabled by bootloader/fuses */
+	MCUSR &= ~(1 << WDRF);
+	wdt_disable();
+
+	/* Disable clock division */
+	clock_prescale_set(clock_div_1);
+
+	/* Only the TWI is needed */
+	power_adc_disable();
+	power_spi_disable();
+	power_timer0_disable();
+	power_timer1_disable();
+	power_timer3_disable();
+	power_usart1_disable();
+	power_usb_disable();
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
+	Bench_Fill();
+
+	// The address mask makes the TWI answer to BENCH_ADDRESS + 1 as well, TWDR tells the two apart
+	TWAR  = BENCH_ADDRESS << 1;
+	TWAMR = 1 << 1;
+	TWCR  = (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+}
+
+/** Fills the register file with its power up pattern. */
+static void Bench_Fill(void)
+{
+	for (uint16_t i = 0; i < BENCH_REGISTERS; i++)
+		Bench_Registers[i] = i ^ (i >> 8);
+}
+
+ISR(TWI_vect, ISR_BLOCK)
+{
+	switch (TW_STATUS) {
+		case TW_SR_SLA_ACK:
+		case TW_SR_ARB_LOST_SLA_ACK:
+			// TWDR holds the address byte that matched
+			Bench_IsControl = (TWDR & (1 << 1));
+			Bench_Selecting = Bench_IsControl ? 1 : BENCH_POINTER_BYTES;
+			Bench_Pointer   = 0;
+			if (!Bench_IsControl)
+				Bench_Control.Transactions++;
+			break;
+
+		case TW_SR_DATA_ACK:
+			if (Bench_IsControl) {
+				if (Bench_Selecting) {
+					Bench_Pointer   = TWDR & BENCH_CONTROL_MASK;
+					Bench_Selecting = 0;
+				} else {
+					Bench_Control.Bytes[Bench_Pointer] = TWDR;
+					Bench_Pointer = (Bench_Pointer + 1) & BENCH_CONTROL_MASK;
+				}
+				break;
+			}
+
+			Bench_Control.BytesIn++;
+			if (Bench_Selecting) {
+				Bench_Pointer = ((Bench_Pointer << 8) | TWDR) & BENCH_REGISTER_MASK;
+				Bench_Selecting--;
+			} else {
+				Bench_Registers[Bench_Pointer] = TWDR;
+				Bench_Pointer = (Bench_Pointer + 1) & BENCH_REGISTER_MASK;
+			}
+			break;
+
+		case TW_ST_SLA_ACK:
+		case TW_ST_ARB_LOST_SLA_ACK:
+			// A read goes on from wherever the last transfer left the pointer
+			Bench_IsControl = (TWDR & (1 << 1));
+			if (!Bench_IsControl)
+				Bench_Control.Transactions++;
+			/* Fall through */
+		case TW_ST_DATA_ACK:
+			if (Bench_IsControl) {
+				TWDR = Bench_Control.Bytes[Bench_Pointer];
+				Bench_Pointer = (Bench_Pointer + 1) & BENCH_CONTROL_MASK;
+				break;
+			}
+
+			if (TW_STATUS == TW_ST_DATA_ACK)
+				Bench_Control.BytesOut++;
+			TWDR = Bench_Registers[Bench_Pointer];
+			Bench_Pointer = (Bench_Pointer + 1) & BENCH_REGISTER_MASK;
+			break;
+
+		case TW_ST_DATA_NACK:
+		case TW_ST_LAST_DATA:
+			// The master is done reading, the TWI goes back to listening
+			if (!Bench_IsControl)
+				Bench_Control.BytesOut++;
+			break;
+
+		case TW_BUS_ERROR:
+			TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+			return;
+
+		default:
+			// TW_SR_STOP: STOP or repeated START, the pointer stays for a read to follow
+			break;
+	}
+
+	// The TWI holds SCL low until TWINT is cleared
+	for (uint16_t us = Bench_Control.StretchUs; us; us--)
+		_delay_loop_2((F_CPU / 4000000) - 1);
+
+	TWCR = (1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+}
@@ -0,0 +1,122 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - benchmark target
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for BenchTarget.c.
+ */
+
+#ifndef _BENCH_TARGET_H_
+#define _BENCH_TARGET_H_
+
+	/* Includes: */
+		#include <avr/io.h>
+		#include <avr/wdt.h>
+		#include <avr/power.h>
+		#include <avr/sleep.h>
+		#include <avr/interrupt.h>
+		#include <util/twi.h>
+		#include <util/delay_basic.h>
+		#include <stdbool.h>
+		#include <stdint.h>
+
+	/* Macros: */
+		/** 7-bit address of the register file; the one above it is the control block, see \ref BenchControl_t. */
+		#ifndef BENCH_ADDRESS
+			#define BENCH_ADDRESS        0x50
+		#endif
+
+		/** Size of the register file in SRAM, a power of two. Transfers wrap around at its end. */
+		#ifndef BENCH_REGISTERS
+			#if defined(__AVR_ATmega16U4__)
+				#define BENCH_REGISTERS  1024
+			#else
+				#define BENCH_REGISTERS  2048
+			#endif
+		#endif
+
+		/** Number of pointer bytes a write starts with, most significant first: 1 like a sensor, 2 like a
+		 *  24C32 and up EEPROM.
+		 */
+		#ifndef BENCH_POINTER_BYTES
+			#define BENCH_POINTER_BYTES  1
+		#endif
+
+		/** Clock stretching after each byte in microseconds at power up, see \ref BenchControl_t. */
+		#ifndef BENCH_STRETCH_US
+			#define BENCH_STRETCH_US     0
+		#endif
+
+		/** Mask for register numbers wrapping around the register file. */
+		#define BENCH_REGISTER_MASK      (BENCH_REGISTERS - 1)
+
+		/** Mask for offsets wrapping around the control block. */
+		#define BENCH_CONTROL_MASK       (sizeof(BenchControl_t) - 1)
+
+		/** Bit of \ref BenchControl_t.Flags that fills the register file with its power up pattern again. */
+		#define BENCH_FLAG_RESTORE       (1 << 0)
+
+		#if (BENCH_ADDRESS & 1) || (BENCH_ADDRESS < 0x08) || (BENCH_ADDRESS > 0x76)
+			#error BENCH_ADDRESS must be an even 7-bit address from 0x08 to 0x76
+		#endif
+
+		#if (BENCH_REGISTERS & (BENCH_REGISTERS - 1)) || (BENCH_REGISTERS > 2048)
+			#error BENCH_REGISTERS must be a power of two up to 2048
+		#endif
+
+		#if (BENCH_POINTER_BYTES != 1) && (BENCH_POINTER_BYTES != 2)
+			#error BENCH_POINTER_BYTES must be 1 or 2
+		#endif
+
+	/* Type Defines: */
+		/** Type define for the control block at BENCH_ADDRESS + 1. A write sets the offset with its first byte and
+		 *  stores the rest from there on, a read returns the block from the offset on, so the host can set the
+		 *  stretching and read or clear the counters with plain I2C transfers.
+		 */
+		typedef union
+		{
+			struct
+			{
+				uint16_t StretchUs;     /**< Microseconds SCL is held low after each byte, 0 for none */
+				uint8_t  Flags;         /**< BENCH_FLAG_* bits, cleared once done */
+				uint8_t  Reserved;
+				uint32_t Transactions;  /**< Times the register file was addressed */
+				uint32_t BytesIn;       /**< Bytes written to the register file, pointer bytes included */
+				uint32_t BytesOut;      /**< Bytes read from the register file */
+			};
+			uint8_t Bytes[16];
+		} BenchControl_t;
+
+	/* Function Prototypes: */
+		void SetupHardware(void);
+
+		#if defined(__INCLUDE_FROM_BENCHTARGET_C)
+			static void Bench_Fill(void);
+		#endif
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *  \brief Application Configuration Header File
+ *
+ *  This is a header file which is used to configure some of
+ *  the application's compile time options, as an alternative to
+ *  specifying the compile time constants supplied through a
+ *  makefile or build system. Each option can also be overridden
+ *  from the makefile via CC_FLAGS.
+ */
+
+#ifndef _APP_CONFIG_H_
+#define _APP_CONFIG_H_
+
+	/** Factor the default depths of the queues, caches and buffers below are scaled by, from the SRAM of the part
+	 *  picked with MCU in the makefile: 1 for the 2.5 KiB of the ATmega32U4 and ATmega32U6, 2 for the 4 KiB of the
+	 *  AT90USB64x and 4 for the 8 KiB of the AT90USB128x. Sizes set explicitly are left alone.
+	 */
+	#if !defined(BUFFER_SCALE)
+		#define BUFFER_SCALE        (((RAMEND - RAMSTART + 1) >= 8192) ? 4 : ((RAMEND - RAMSTART + 1) >= 4096) ? 2 : 1)
+	#endif
+
+	/** Number of banks for each vendor bulk endpoint, 1 or 2. With two banks the host can send the next
+	 *  command packet while the current one is being worked on, and a full response packet is sent off
+	 *  while the next one is being filled. The xU4 DPRAM has room for both endpoints double banked.
+	 */
+	#if !defined(VENDOR_IO_EPBANKS)
+		#define VENDOR_IO_EPBANKS   2
+	#endif
+
+	/** Set to 0 to compile out the service time counters behind CMD_GET_STATS. */
+	#if !defined(STATS_SUPPORT)
+		#define STATS_SUPPORT       1
+	#endif
+
+	/** Number of targets the per-address counters behind CMD_GET_ADDR_STATS keep track of, 20 bytes of SRAM
+	 *  each. Only with \ref STATS_SUPPORT.
+	 */
+	#if !defined(ADDR_STATS_ENTRIES)
+		#define ADDR_STATS_ENTRIES  (8 * BUFFER_SCALE)
+	#endif
+
+	/** Set to 1 to compile the per-byte transfer loops with -O2 while the rest stays size optimized. Costs some
+	 *  flash for fewer calls and register spills between bytes, see ATTR_HOT_PATH.
+	 */
+	#if !defined(SPEED_HOT_PATHS)
+		#define SPEED_HOT_PATHS     0
+	#endif
+
+	/** Set to 1 to record bus and USB events in a RAM ring buffer for CMD_GET_TRACE, \ref TRACE_ENTRIES records
+	 *  of 5 bytes each.
+	 */
+	#if !defined(TRACE_SUPPORT)
+		#define TRACE_SUPPORT       0
+	#endif
+
+	/** Number of records in the trace buffer, up to 255. */
+	#if !defined(TRACE_ENTRIES)
+		#define TRACE_ENTRIES       ((BUFFER_SCALE < 4) ? (64 * BUFFER_SCALE) : 255)
+	#endif
+
+	/** Set to 1 to drive the debug probe pins in Lib/Probe.h for timing the transfer paths on a scope. */
+	#if !defined(PROBE_SUPPORT)
+		#define PROBE_SUPPORT       0
+	#endif
+
+	/** Port registers of the probe pins. Port F is A0 to A5 on a Leonardo and otherwise unused, the ADC is off. */
+	#if !defined(PROBE_PORT)
+		#define PROBE_PORT          PORTF
+		#define PROBE_DDR           DDRF
+		#define PROBE_PIN           PINF
+	#endif
+
+	/** Pins of \ref GPIO_PORT that the GPIO operations of BULK_OP_GPIO and of BATCH segments may use, as a mask.
+	 *  Port F has PF0, PF1 and PF4 to PF7; the probe pins are taken out when \ref PROBE_SUPPORT is on. PF4 to PF7
+	 *  are the JTAG pins, which needs the JTAGEN fuse cleared. A pin also used by an ADC poll entry reads as analog.
+	 */
+	#if !defined(GPIO_PINS)
+		#define GPIO_PINS           (PROBE_SUPPORT ? 0x01 : 0xF3)
+	#endif
+
+	/** Port registers of the GPIO operations. */
+	#if !defined(GPIO_PORT)
+		#define GPIO_PORT           PORTF
+		#define GPIO_DDR            DDRF
+		#define GPIO_PIN            PINF
+	#endif
+
+	/** Set to 1 for CMD_CLOCK_METER, which measures the bus clock and the gaps between bytes on the wire. It needs SCL
+	 *  (PD0, D3 on a Leonardo) wired to the Timer0 clock input T0 (PD7, D6) and takes Timer0 and Timer3 while it runs.
+	 */
+	#if !defined(CLOCK_METER_SUPPORT)
+		#define CLOCK_METER_SUPPORT 0
+	#endif
+
+	/** Optional modules, each with its bulk commands, control requests and FUNC_EXT* bit. A module set to 0 compiles
+	 *  to nothing, so these are what to pick from when the flash or SRAM budget the makefile checks runs out; all of
+	 *  them together don't fit the 32U4, so only the script engine the CDC console runs on is on by default and e.g.
+	 *  "make MODULES='SNIFF MUX'" turns others on. Also see \ref STATS_SUPPORT, \ref TRACE_SUPPORT,
+	 *  \ref CLOCK_METER_SUPPORT, \ref SOFTI2C_CHANNELS and \ref SPI_CS_LINES.
+	 */
+	#if !defined(SNIFF_SUPPORT)
+		#define SNIFF_SUPPORT       0 /**< Bus sniffer of BULK_OP_SNIFF, Lib/BusSniffer.c */
+	#endif
+	#if !defined(EMU_SUPPORT)
+		#define EMU_SUPPORT         0 /**< Target emulation of BULK_OP_EMULATE and EMU_RANGE, Lib/TargetEmu.c */
+	#endif
+	#if !defined(UART_SUPPORT)
+		#define UART_SUPPORT        0 /**< UART bridge of BULK_OP_UART, Lib/UartBridge.c */
+	#endif
+	#if !defined(FIFO_SUPPORT)
+		#define FIFO_SUPPORT        0 /**< Sensor FIFO drain of BULK_OP_FIFO, Lib/FifoDrain.c */
+	#endif
+	#if !defined(SCRIPT_SUPPORT)
+		#define SCRIPT_SUPPORT      CDC_SUPPORT /**< CMD_RUN_SCRIPT and the script slots, Lib/Script.c; the console needs it */
+	#endif
+	#if !defined(SPEED_SCAN_SUPPORT)
+		#define SPEED_SCAN_SUPPORT  0 /**< CMD_SPEED_SCAN, Lib/SpeedScan.c */
+	#endif
+	#if !defined(SPEED_ADAPT_SUPPORT)
+		#define SPEED_ADAPT_SUPPORT 0 /**< Adaptive bus speed of CMD_SET_ADAPT, Lib/SpeedAdapt.c */
+	#endif
+	#if !defined(MUX_SUPPORT)
+		#define MUX_SUPPORT         0 /**< Mux routing of CMD_SET_MUX, BULK_OP_ROUTE and DISCOVER, Lib/MuxRoute.c */
+	#endif
+	#if !defined(PREFETCH_SUPPORT)
+		#define PREFETCH_SUPPORT    0 /**< Register read prefetch of OPTION_PREFETCH, Lib/Prefetch.c */
+	#endif
+
+	/** Size of the boot section in bytes, where CMD_START_BOOTLOADER jumps to: 4096 for the Atmel DFU bootloader the
+	 *  XU4 parts ship with and for the Arduino Caterina one, 8192 for the DFU bootloader of the AT90USB128x, which
+	 *  must match the BOOTSZ fuses.
+	 */
+	#if !defined(BOOTLOADER_SIZE)
+		#if defined(__AVR_AT90USB1286__) || defined(__AVR_AT90USB1287__)
+			#define BOOTLOADER_SIZE 8192
+		#else
+			#define BOOTLOADER_SIZE 4096
+		#endif
+	#endif
+
+	/** Set to 0 to keep the CPU spinning in the main loop instead of idle sleeping between interrupts once the
+	 *  bulk endpoint has been quiet for \ref IDLE_SLEEP_FRAMES frames. An arriving bulk packet or a freed IN bank
+	 *  wakes the CPU through an endpoint interrupt, so the first packet of a burst costs only the wakeup.
+	 */
+	#if !defined(IDLE_SLEEP)
+		#define IDLE_SLEEP          1
+	#endif
+
+	/** Number of frames without bulk traffic before the main loop starts to sleep. */
+	#if !defined(IDLE_SLEEP_FRAMES)
+		#define IDLE_SLEEP_FRAMES   2
+	#endif
+
+	/** Set to 0 to leave a stuck bus alone until the host sends CMD_RECOVER_BUS. Otherwise a START that can't get
+	 *  hold of the bus while SDA or SCL is low runs the recovery of Lib/BusRecovery.c right away, so the next
+	 *  transaction finds the bus free. On a bus with another master that may be clocking it, set this to 0.
+	 */
+	#if !defined(AUTO_BUS_RECOVERY)
+		#define AUTO_BUS_RECOVERY   1
+	#endif
+
+	/** Number of times a START that loses arbitration to another master is sent again once the bus is free, before
+	 *  the transaction fails as a bus fault. Losing in the data phase means both masters addressed the same target;
+	 *  the data has gone out already then, so that fails right away.
+	 */
+	#if !defined(ARB_LOST_RETRIES)
+		#define ARB_LOST_RETRIES    16
+	#endif
+
+	/** Set to 0 to leave the watchdog off. Otherwise its first timeout, with the main loop stuck somewhere, only
+	 *  interrupts: the TWI is reset and whatever waits on it gives up, and the main loop recovers the bus; the USB
+	 *  connection stays up. Only if the main loop doesn't come round before the second timeout the chip is reset.
+	 *  See Lib/Watchdog.c.
+	 */
+	#if !defined(WATCHDOG_SUPPORT)
+		#define WATCHDOG_SUPPORT    1
+	#endif
+
+	/** Watchdog timeout, one of the WDTO_* values of <avr/wdt.h>. It must stay well above the longest wait that
+	 *  doesn't kick the watchdog, 255 ms for the longest bus timeout.
+	 */
+	#if !defined(WATCHDOG_TIMEOUT)
+		#define WATCHDOG_TIMEOUT    WDTO_500MS
+	#endif
+
+	/** Size of a script for CMD_RUN_SCRIPT in bytes, up to 256. There is one script in RAM and \ref SCRIPT_SLOTS
+	 *  more in EEPROM.
+	 */
+	#if !defined(SCRIPT_SIZE)
+		#define SCRIPT_SIZE         128
+	#endif
+
+	/** Number of scripts kept in EEPROM, SCRIPT_SLOTS times SCRIPT_SIZE must fit into the 1 KB of the xU4. */
+	#if !defined(SCRIPT_SLOTS)
+		#define SCRIPT_SLOTS        4
+	#endif
+
+	/** Most bytes read by a script that are returned to the host, the rest is dropped. */
+	#if !defined(SCRIPT_RESULT_SIZE)
+		#define SCRIPT_RESULT_SIZE  64
+	#endif
+
+	/** Set to 1 for the composite build with a CDC-ACM serial port running the text console of Lib/Console.c;
+	 *  "make CDC=Y" does so and adds the sources it needs.
+	 */
+	#if !defined(CDC_SUPPORT)
+		#define CDC_SUPPORT         0
+	#endif
+
+	/** Size of the scratch slab of Lib/Arena.c in bytes, which the main loop jobs take their buffers from and which
+	 *  is emptied before each job: the result of CMD_RUN_SCRIPT and, in the CDC build, also the script compiled from
+	 *  a console line, or the payload of a bulk MULTIWRITE. A larger slab leaves room for requests with bigger records.
+	 */
+	#if !defined(ARENA_SIZE)
+		#define ARENA_JOBS_SIZE     (SCRIPT_SUPPORT ? (SCRIPT_RESULT_SIZE + 2 + (CDC_SUPPORT ? SCRIPT_SIZE : 0)) : 0)
+		#define ARENA_SIZE          ((ARENA_JOBS_SIZE > MULTIWRITE_MAX_LENGTH) ? ARENA_JOBS_SIZE : MULTIWRITE_MAX_LENGTH)
+	#endif
+
+	/** Longest payload of a bulk MULTIWRITE command in bytes; it is buffered in the slab of Lib/Arena.c, so that must
+	 *  have room for it.
+	 */
+	#if !defined(MULTIWRITE_MAX_LENGTH)
+		#define MULTIWRITE_MAX_LENGTH  64
+	#endif
+
+	/** Longest console line in characters, longer lines are rejected as a whole. */
+	#if !defined(CONSOLE_LINE_SIZE)
+		#define CONSOLE_LINE_SIZE   96
+	#endif
+
+	/** Set to 1 to make the vendor interface a HID interface with 64 byte vendor defined reports on interrupt
+	 *  endpoints, carrying the bulk command stream, for hosts that won't load a vendor class driver; "make HID=Y"
+	 *  does so and adds the sources it needs. The event endpoint and the alternate settings are left out.
+	 */
+	#if !defined(HID_SUPPORT)
+		#define HID_SUPPORT         0
+	#endif
+
+	#if HID_SUPPORT && CDC_SUPPORT
+		#error HID_SUPPORT and CDC_SUPPORT cannot be combined
+	#endif
+
+	/** Set to 1 for a third alternate setting of the vendor interface that moves the poll records to an isochronous
+	 *  IN endpoint, so the host reserves bandwidth for them in every frame. The endpoint is the one the CDC build's
+	 *  notifications take, and the HID build has no alternate settings, so it is on in the plain build only.
+	 */
+	#if !defined(ISO_SUPPORT)
+		#define ISO_SUPPORT         (!HID_SUPPORT && !CDC_SUPPORT)
+	#endif
+
+	#if ISO_SUPPORT && (HID_SUPPORT || CDC_SUPPORT)
+		#error ISO_SUPPORT cannot be combined with HID_SUPPORT or CDC_SUPPORT
+	#endif
+
+	/** Number of bit-banged I2C channels driven by the bulk protocol, 0 to 4. Channel n uses pin 2n of
+	 *  \ref SOFTI2C_PORT as SCL and pin 2n+1 as SDA; on a Leonardo port B has D8 to D11 on pins 4 to 7.
+	 *  Each line needs an external pull-up.
+	 */
+	#if !defined(SOFTI2C_CHANNELS)
+		#define SOFTI2C_CHANNELS    0
+	#endif
+
+	/** Port registers of the bit-banged channels. */
+	#if !defined(SOFTI2C_PORT)
+		#define SOFTI2C_PORT        PORTB
+		#define SOFTI2C_DDR         DDRB
+		#define SOFTI2C_PIN         PINB
+	#endif
+
+	/** Number of chip select lines of the SPI bridge of BULK_OP_SPI, 0 to 4. Line n is pin \ref SPI_CS_SHIFT + n of
+	 *  \ref SPI_CS_PORT, active low; on a Leonardo D8 and D9 by default. SCK, MOSI and MISO are PB1 to PB3 and PB0
+	 *  must not be pulled low, so the bridge is not there next to the bit-banged channels.
+	 */
+	#if !defined(SPI_CS_LINES)
+		#define SPI_CS_LINES        (SOFTI2C_CHANNELS ? 0 : 2)
+	#endif
+
+	/** Port registers and first pin of the SPI chip select lines. */
+	#if !defined(SPI_CS_PORT)
+		#define SPI_CS_PORT         PORTB
+		#define SPI_CS_DDR          DDRB
+		#define SPI_CS_SHIFT        4
+	#endif
+
+	/** External interrupt watching the SMBALERT# line, and its pin. The default INT6 is PE6, on a Leonardo D7;
+	 *  INT2 (PD2) and INT3 (PD3) work as well. Port B has the pin change interrupts but also the bit-banged channels.
+	 *  Override all of these together.
+	 */
+	#if !defined(ALERT_INT)
+		#define ALERT_INT           6
+		#define ALERT_VECT          INT6_vect
+		#define ALERT_PORT          PORTE
+		#define ALERT_DDR           DDRE
+		#define ALERT_PIN           PINE
+		#define ALERT_BIT           6
+	#endif
+
+	/** External interrupt watching the watermark line of a sensor FIFO, and its pin. The default INT2 is PD2, on a
+	 *  Leonardo D0 (RX); INT3 (PD3, D1) works as well. Override all of these together. Both are the pins of the UART
+	 *  bridge too, a FIFO line there and BULK_OP_UART cannot be used at the same time.
+	 */
+	#if !defined(FIFO_INT)
+		#define FIFO_INT            2
+		#define FIFO_VECT           INT2_vect
+		#define FIFO_PORT           PORTD
+		#define FIFO_DDR            DDRD
+		#define FIFO_PIN            PIND
+		#define FIFO_BIT            2
+	#endif
+
+	/** External interrupt and pin of the SYNC line of CMD_SET_SYNC. The default INT3 is PD3, on a Leonardo D1 (TX),
+	 *  the pin of the UART bridge's transmitter: the SYNC line and BULK_OP_UART cannot be used at the same time.
+	 *  Override all of these together.
+	 */
+	#if !defined(SYNC_INT)
+		#define SYNC_INT            3
+		#define SYNC_VECT           INT3_vect
+		#define SYNC_PORT           PORTD
+		#define SYNC_DDR            DDRD
+		#define SYNC_PIN            PIND
+		#define SYNC_BIT            3
+	#endif
+
+	/** Size of the record buffer of the bus sniffer in bytes, a power of two up to 256. It takes up the traffic of
+	 *  about a millisecond at 100 kHz until the main loop moves it to the bulk IN endpoint.
+	 */
+	#if !defined(SNIFF_BUFFER_SIZE)
+		#define SNIFF_BUFFER_SIZE   ((BUFFER_SCALE > 1) ? 256 : 128)
+	#endif
+
+	/** Size of the register file of the emulated target of BULK_OP_EMULATE in bytes, a power of two from 8 up to
+	 *  256. Register numbers wrap around at the size; BULK_OP_EMU_RANGE splits it between its targets.
+	 */
+	#if !defined(EMU_REGISTERS)
+		#define EMU_REGISTERS       64
+	#endif
+
+	/** Sizes of the receive and transmit buffers of the UART bridge of BULK_OP_UART in bytes. The receive buffer
+	 *  holds about 10 ms of traffic at 115200 baud until the main loop moves it to the bulk IN endpoint.
+	 */
+	#if !defined(UART_RX_SIZE)
+		#define UART_RX_SIZE        (128 * BUFFER_SCALE)
+	#endif
+
+	#if !defined(UART_TX_SIZE)
+		#define UART_TX_SIZE        (64 * BUFFER_SCALE)
+	#endif
+
+	/** Bit rate of the bit-banged channels in kHz, 100 or 400; the bit timing is worked out from F_CPU at compile time. */
+	#if !defined(SOFTI2C_KHZ)
+		#define SOFTI2C_KHZ         100
+	#endif
+
+#endif
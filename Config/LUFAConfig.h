@@ -66,12 +66,15 @@
 //		#define NO_SOF_EVENTS
 
 		/* USB Device Mode Driver Related Tokens: */
+		// No USE_*_DESCRIPTORS: the descriptors are in flash, except for the bus label in EEPROM
 //		#define USE_RAM_DESCRIPTORS
-		#define USE_FLASH_DESCRIPTORS
+//		#define USE_FLASH_DESCRIPTORS
 //		#define USE_EEPROM_DESCRIPTORS
 //		#define NO_INTERNAL_SERIAL
-		#define FIXED_CONTROL_ENDPOINT_SIZE      32
-//		#define DEVICE_STATE_AS_GPIOR            {Insert Value Here}
+		#if !defined(FIXED_CONTROL_ENDPOINT_SIZE)
+			#define FIXED_CONTROL_ENDPOINT_SIZE  32 // 64 halves the packet count on the control path
+		#endif
+		#define DEVICE_STATE_AS_GPIOR            1 // Checked by every task; GPIOR0 and GPIOR2 hold TWI and I2C state
 		#define FIXED_NUM_CONFIGURATIONS         1
 //		#define CONTROL_ONLY_DEVICE
 		#define INTERRUPT_CONTROL_ENDPOINT
@@ -36,6 +36,7 @@
  */
 
 #include "Descriptors.h"
+#include "Lib/BusLabel.h"
 
 
 /** Device descriptor structure. This descriptor, located in FLASH memory, describes the overall
@@ -47,10 +48,19 @@ const USB_Descriptor_Device_t PROGMEM DeviceDescriptor =
 {
 	.Header                 = {.Size = sizeof(USB_Descriptor_Device_t), .Type = DTYPE_Device},
 
-	.USBSpecification       = VERSION_BCD(1,1,0),
+	// 2.1 tells Windows to look for the BOS descriptor and with that the WinUSB binding; the HID build does
+	// without, the HID driver is already there
+	.USBSpecification       = HID_SUPPORT ? VERSION_BCD(2,0,0) : VERSION_BCD(2,1,0),
+#if CDC_SUPPORT
+	// The interface association descriptor ties the two CDC interfaces together
+	.Class                  = USB_CSCP_IADDeviceClass,
+	.SubClass               = USB_CSCP_IADDeviceSubclass,
+	.Protocol               = USB_CSCP_IADDeviceProtocol,
+#else
 	.Class                  = USB_CSCP_NoDeviceClass,
 	.SubClass               = USB_CSCP_NoDeviceSubclass,
 	.Protocol               = USB_CSCP_NoDeviceProtocol,
+#endif
 
 	.Endpoint0Size          = FIXED_CONTROL_ENDPOINT_SIZE,
 
@@ -60,11 +70,25 @@ const USB_Descriptor_Device_t PROGMEM DeviceDescriptor =
 
 	.ManufacturerStrIndex   = STRING_ID_Manufacturer,
 	.ProductStrIndex        = STRING_ID_Product,
-	.SerialNumStrIndex      = USE_INTERNAL_SERIAL,
+#if (USE_INTERNAL_SERIAL != NO_DESCRIPTOR)
+	.SerialNumStrIndex      = STRING_ID_Serial,
+#else
+	.SerialNumStrIndex      = NO_DESCRIPTOR,
+#endif
 
 	.NumberOfConfigurations = FIXED_NUM_CONFIGURATIONS
 };
 
+#if HID_SUPPORT
+/** HID report descriptor of the HID build: one input and one output report of a full endpoint each, without a
+ *  report ID, carrying the bulk command and response streams.
+ */
+const USB_Descriptor_HIDReport_Datatype_t PROGMEM VendorReport[] =
+{
+	HID_DESCRIPTOR_VENDOR(0x00, 0x01, 0x02, 0x03, VENDOR_IO_EPSIZE)
+};
+#endif
+
 /** Configuration descriptor structure. This descriptor, located in FLASH memory, describes the usage
  *  of the device in one of its supported configurations, including information about any device interfaces
  *  and endpoints. The descriptor is read out by the USB host during the enumeration process when selecting
@@ -77,12 +101,12 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 			.Header                 = {.Size = sizeof(USB_Descriptor_Configuration_Header_t), .Type = DTYPE_Configuration},
 
 			.TotalConfigurationSize = sizeof(USB_Descriptor_Configuration_t),
-			.TotalInterfaces        = 1,
+			.TotalInterfaces        = CDC_SUPPORT ? 3 : 1,
 
 			.ConfigurationNumber    = 1,
 			.ConfigurationStrIndex  = NO_DESCRIPTOR,
 
-			.ConfigAttributes       = USB_CONFIG_ATTR_RESERVED,
+			.ConfigAttributes       = (USB_CONFIG_ATTR_RESERVED | USB_CONFIG_ATTR_REMOTEWAKEUP),
 
 			.MaxPowerConsumption    = USB_CONFIG_POWER_MA(100)
 		},
@@ -92,18 +116,97 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 			.Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
 
 			.InterfaceNumber        = INTERFACE_ID_Vendor,
-			.AlternateSetting       = 0,
+			.AlternateSetting       = VENDOR_ALT_CONTROL,
 
-			.TotalEndpoints         = 2,
+			.TotalEndpoints         = HID_SUPPORT ? 2 : 0,
+
+			.Class                  = HID_SUPPORT ? HID_CSCP_HIDClass : 0xFF,
+			.SubClass               = HID_SUPPORT ? HID_CSCP_NonBootSubclass : 0xFF,
+			.Protocol               = HID_SUPPORT ? HID_CSCP_NonBootProtocol : 0xFF,
+
+			.InterfaceStrIndex      = STRING_ID_Label
+		},
+
+#if HID_SUPPORT
+	.Vendor_HID =
+		{
+			.Header                 = {.Size = sizeof(USB_HID_Descriptor_HID_t), .Type = HID_DTYPE_HID},
+
+			.HIDSpec                = VERSION_BCD(1,1,1),
+			.CountryCode            = 0x00,
+			.TotalReportDescriptors = 1,
+			.HIDReportType          = HID_DTYPE_Report,
+			.HIDReportLength        = sizeof(VendorReport)
+		},
+#else
+	.Vendor_BulkInterface =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+			.InterfaceNumber        = INTERFACE_ID_Vendor,
+			.AlternateSetting       = VENDOR_ALT_BULK,
+
+			.TotalEndpoints         = 3,
 
 			.Class                  = 0xFF,
 			.SubClass               = 0xFF,
 			.Protocol               = 0xFF,
 
-			.InterfaceStrIndex      = NO_DESCRIPTOR
+			.InterfaceStrIndex      = STRING_ID_Label
 		},
+#endif
 
 	.Vendor_DataInEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = VENDOR_IN_EPADDR,
+			.Attributes             = (VENDOR_IO_EPTYPE | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = VENDOR_IO_EPSIZE,
+			.PollingIntervalMS      = HID_SUPPORT ? 0x01 : 0x05
+		},
+
+	.Vendor_DataOutEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = VENDOR_OUT_EPADDR,
+			.Attributes             = (VENDOR_IO_EPTYPE | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = VENDOR_IO_EPSIZE,
+			.PollingIntervalMS      = HID_SUPPORT ? 0x01 : 0x05
+		},
+
+#if !HID_SUPPORT
+	.Vendor_EventEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = VENDOR_EVENT_EPADDR,
+			.Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = VENDOR_EVENT_EPSIZE,
+			.PollingIntervalMS      = 0x01
+		},
+#endif
+
+#if ISO_SUPPORT
+	// Each alternate setting lists its own endpoints, the ones shared with the bulk setting are described again
+	.Vendor_IsoInterface =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+			.InterfaceNumber        = INTERFACE_ID_Vendor,
+			.AlternateSetting       = VENDOR_ALT_ISO,
+
+			.TotalEndpoints         = 4,
+
+			.Class                  = 0xFF,
+			.SubClass               = 0xFF,
+			.Protocol               = 0xFF,
+
+			.InterfaceStrIndex      = STRING_ID_Label
+		},
+
+	.Vendor_IsoDataInEndpoint =
 		{
 			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
 
@@ -113,7 +216,7 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 			.PollingIntervalMS      = 0x05
 		},
 
-	.Vendor_DataOutEndpoint =
+	.Vendor_IsoDataOutEndpoint =
 		{
 			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
 
@@ -121,6 +224,208 @@ const USB_Descriptor_Configuration_t PROGMEM ConfigurationDescriptor =
 			.Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
 			.EndpointSize           = VENDOR_IO_EPSIZE,
 			.PollingIntervalMS      = 0x05
+		},
+
+	.Vendor_IsoEventEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = VENDOR_EVENT_EPADDR,
+			.Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = VENDOR_EVENT_EPSIZE,
+			.PollingIntervalMS      = 0x01
+		},
+
+	.Vendor_PollEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = VENDOR_POLL_EPADDR,
+			.Attributes             = (EP_TYPE_ISOCHRONOUS | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = VENDOR_POLL_EPSIZE,
+			.PollingIntervalMS      = 0x01
+		},
+#endif
+
+#if CDC_SUPPORT
+	.CDC_IAD =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Interface_Association_t), .Type = DTYPE_InterfaceAssociation},
+
+			.FirstInterfaceIndex    = INTERFACE_ID_CDC_CCI,
+			.TotalInterfaces        = 2,
+
+			.Class                  = CDC_CSCP_CDCClass,
+			.SubClass               = CDC_CSCP_ACMSubclass,
+			.Protocol               = CDC_CSCP_ATCommandProtocol,
+
+			.IADStrIndex            = NO_DESCRIPTOR
+		},
+
+	.CDC_CCI_Interface =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+			.InterfaceNumber        = INTERFACE_ID_CDC_CCI,
+			.AlternateSetting       = 0,
+
+			.TotalEndpoints         = 1,
+
+			.Class                  = CDC_CSCP_CDCClass,
+			.SubClass               = CDC_CSCP_ACMSubclass,
+			.Protocol               = CDC_CSCP_ATCommandProtocol,
+
+			.InterfaceStrIndex      = NO_DESCRIPTOR
+		},
+
+	.CDC_Functional_Header =
+		{
+			.Header                 = {.Size = sizeof(USB_CDC_Descriptor_FunctionalHeader_t), .Type = DTYPE_CSInterface},
+			.Subtype                = CDC_DSUBTYPE_CSInterface_Header,
+
+			.CDCSpecification       = VERSION_BCD(1,1,0),
+		},
+
+	.CDC_Functional_ACM =
+		{
+			.Header                 = {.Size = sizeof(USB_CDC_Descriptor_FunctionalACM_t), .Type = DTYPE_CSInterface},
+			.Subtype                = CDC_DSUBTYPE_CSInterface_ACM,
+
+			.Capabilities           = 0x06,
+		},
+
+	.CDC_Functional_Union =
+		{
+			.Header                 = {.Size = sizeof(USB_CDC_Descriptor_FunctionalUnion_t), .Type = DTYPE_CSInterface},
+			.Subtype                = CDC_DSUBTYPE_CSInterface_Union,
+
+			.MasterInterfaceNumber  = INTERFACE_ID_CDC_CCI,
+			.SlaveInterfaceNumber   = INTERFACE_ID_CDC_DCI,
+		},
+
+	.CDC_NotificationEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = CDC_NOTIFICATION_EPADDR,
+			.Attributes             = (EP_TYPE_INTERRUPT | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = CDC_NOTIFICATION_EPSIZE,
+			.PollingIntervalMS      = 0xFF
+		},
+
+	.CDC_DCI_Interface =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Interface_t), .Type = DTYPE_Interface},
+
+			.InterfaceNumber        = INTERFACE_ID_CDC_DCI,
+			.AlternateSetting       = 0,
+
+			.TotalEndpoints         = 2,
+
+			.Class                  = CDC_CSCP_CDCDataClass,
+			.SubClass               = CDC_CSCP_NoDataSubclass,
+			.Protocol               = CDC_CSCP_NoDataProtocol,
+
+			.InterfaceStrIndex      = NO_DESCRIPTOR
+		},
+
+	.CDC_DataOutEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = CDC_RX_EPADDR,
+			.Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = CDC_TXRX_EPSIZE,
+			.PollingIntervalMS      = 0x05
+		},
+
+	.CDC_DataInEndpoint =
+		{
+			.Header                 = {.Size = sizeof(USB_Descriptor_Endpoint_t), .Type = DTYPE_Endpoint},
+
+			.EndpointAddress        = CDC_TX_EPADDR,
+			.Attributes             = (EP_TYPE_BULK | ENDPOINT_ATTR_NO_SYNC | ENDPOINT_USAGE_DATA),
+			.EndpointSize           = CDC_TXRX_EPSIZE,
+			.PollingIntervalMS      = 0x05
+		}
+#endif
+};
+
+/** Binary Device Object Store descriptor, read by hosts from devices that report USB 2.1 or later. Its only entry
+ *  is the Microsoft OS 2.0 platform capability, which has Windows 8.1 and later bind WinUSB to the device without
+ *  an INF file, making the raw control and bulk path available to libusb right away.
+ */
+const USB_Descriptor_BOS_t PROGMEM BOSDescriptor =
+{
+	.Header                 = {.Size = 5, .Type = DTYPE_BOS},
+	.TotalLength            = sizeof(USB_Descriptor_BOS_t),
+	.NumDeviceCaps          = 1,
+
+	.MSOS20_Platform =
+		{
+			.Header                 = {.Size = sizeof(BOSDescriptor.MSOS20_Platform), .Type = DTYPE_DeviceCapability},
+			.CapabilityType         = DCAP_TYPE_Platform,
+			.Reserved               = 0,
+
+			// D8DD60DF-4589-4CC7-9CD2-659D9E648A9F, in the mixed endian byte order of a GUID
+			.PlatformUUID           = {0xDF, 0x60, 0xDD, 0xD8, 0x89, 0x45, 0xC7, 0x4C,
+			                           0x9C, 0xD2, 0x65, 0x9D, 0x9E, 0x64, 0x8A, 0x9F},
+			.WindowsVersion         = MSOS20_WINDOWS_VERSION,
+			.DescriptorSetLength    = sizeof(MSOS20_DescriptorSet_t),
+			.VendorCode             = MSOS20_VENDOR_CODE,
+			.AltEnumCode            = 0
+		}
+};
+
+/** Microsoft OS 2.0 descriptor set, returned by the MSOS20_VENDOR_CODE vendor request. */
+const MSOS20_DescriptorSet_t PROGMEM MSOS20_DescriptorSet =
+{
+	.Header =
+		{
+			.Length                 = sizeof(MSOS20_DescriptorSet.Header),
+			.DescriptorType         = MSOS20_SET_HEADER_DESCRIPTOR,
+			.WindowsVersion         = MSOS20_WINDOWS_VERSION,
+			.TotalLength            = sizeof(MSOS20_DescriptorSet_t)
+		},
+
+#if CDC_SUPPORT
+	.ConfigurationSubset =
+		{
+			.Length                 = sizeof(MSOS20_DescriptorSet.ConfigurationSubset),
+			.DescriptorType         = MSOS20_SUBSET_CONFIGURATION,
+			.ConfigurationIndex     = 0,
+			.Reserved               = 0,
+			.TotalLength            = sizeof(MSOS20_DescriptorSet_t) - sizeof(MSOS20_DescriptorSet.Header)
+		},
+
+	.FunctionSubset =
+		{
+			.Length                 = sizeof(MSOS20_DescriptorSet.FunctionSubset),
+			.DescriptorType         = MSOS20_SUBSET_FUNCTION,
+			.FirstInterface         = INTERFACE_ID_Vendor,
+			.Reserved               = 0,
+			.SubsetLength           = sizeof(MSOS20_DescriptorSet_t) - sizeof(MSOS20_DescriptorSet.Header) -
+			                          sizeof(MSOS20_DescriptorSet.ConfigurationSubset)
+		},
+#endif
+
+	.CompatibleID =
+		{
+			.Length                 = sizeof(MSOS20_DescriptorSet.CompatibleID),
+			.DescriptorType         = MSOS20_FEATURE_COMPATIBLE_ID,
+			.CompatibleID           = "WINUSB",
+			.SubCompatibleID        = {0}
+		},
+
+	.InterfaceGUIDs =
+		{
+			.Length                 = sizeof(MSOS20_DescriptorSet.InterfaceGUIDs),
+			.DescriptorType         = MSOS20_FEATURE_REG_PROPERTY,
+			.PropertyDataType       = MSOS20_REG_MULTI_SZ,
+			.PropertyNameLength     = sizeof(MSOS20_DescriptorSet.InterfaceGUIDs.PropertyName),
+			.PropertyName           = L"DeviceInterfaceGUIDs",
+			.PropertyDataLength     = sizeof(MSOS20_DescriptorSet.InterfaceGUIDs.PropertyData),
+			.PropertyData           = L"{5F2B8E1C-7A4D-4C63-9E0B-2D6A1F3C8B47}\0"
 		}
 };
 
@@ -142,6 +447,28 @@ const USB_Descriptor_String_t PROGMEM ManufacturerString = USB_STRING_DESCRIPTOR
  */
 const USB_Descriptor_String_t PROGMEM ProductString = USB_STRING_DESCRIPTOR(L"I2C-Tiny-USB clone");
 
+#if (USE_INTERNAL_SERIAL != NO_DESCRIPTOR)
+/** Serial number descriptor string, the chip's unique serial number from the signature row in hex. LUFA would
+ *  read the signature row again on every request for USE_INTERNAL_SERIAL, so it is built once at boot by
+ *  \ref Descriptors_Init() and served from RAM instead.
+ */
+static struct
+{
+	USB_Descriptor_Header_t Header;
+	uint16_t                UnicodeString[INTERNAL_SERIAL_LENGTH_BITS / 4];
+} SerialString;
+#endif
+
+/** Builds the descriptors that are generated at runtime, call before USB_Init(). */
+void Descriptors_Init(void)
+{
+#if (USE_INTERNAL_SERIAL != NO_DESCRIPTOR)
+	SerialString.Header.Type = DTYPE_String;
+	SerialString.Header.Size = USB_STRING_LEN(INTERNAL_SERIAL_LENGTH_BITS / 4);
+	USB_Device_GetSerialString(SerialString.UnicodeString);
+#endif
+}
+
 /** This function is called by the library when in device mode, and must be overridden (see library "USB Descriptors"
  *  documentation) by the application code so that the address and size of a requested descriptor can be given
  *  to the USB library. When the device receives a Get Descriptor request on the control endpoint, this function
@@ -150,7 +477,8 @@ const USB_Descriptor_String_t PROGMEM ProductString = USB_STRING_DESCRIPTOR(L"I2
  */
 uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
                                     const uint16_t wIndex,
-                                    const void** const DescriptorAddress)
+                                    const void** const DescriptorAddress,
+                                    uint8_t* const DescriptorMemorySpace)
 {
 	const uint8_t  DescriptorType   = (wValue >> 8);
 	const uint8_t  DescriptorNumber = (wValue & 0xFF);
@@ -158,6 +486,8 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 	const void* Address = NULL;
 	uint16_t    Size    = NO_DESCRIPTOR;
 
+	*DescriptorMemorySpace = MEMSPACE_FLASH;
+
 	switch (DescriptorType)
 	{
 		case DTYPE_Device:
@@ -168,6 +498,21 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 			Address = &ConfigurationDescriptor;
 			Size    = sizeof(USB_Descriptor_Configuration_t);
 			break;
+#if HID_SUPPORT
+		case HID_DTYPE_HID:
+			Address = &ConfigurationDescriptor.Vendor_HID;
+			Size    = sizeof(USB_HID_Descriptor_HID_t);
+			break;
+		case HID_DTYPE_Report:
+			Address = &VendorReport;
+			Size    = sizeof(VendorReport);
+			break;
+#else
+		case DTYPE_BOS:
+			Address = &BOSDescriptor;
+			Size    = sizeof(USB_Descriptor_BOS_t);
+			break;
+#endif
 		case DTYPE_String:
 			switch (DescriptorNumber)
 			{
@@ -183,6 +528,16 @@ uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 					Address = &ProductString;
 					Size    = pgm_read_byte(&ProductString.Header.Size);
 					break;
+				case STRING_ID_Label:
+					Size    = Label_GetDescriptor(&Address, DescriptorMemorySpace);
+					break;
+#if (USE_INTERNAL_SERIAL != NO_DESCRIPTOR)
+				case STRING_ID_Serial:
+					Address = &SerialString;
+					Size    = sizeof(SerialString);
+					*DescriptorMemorySpace = MEMSPACE_RAM;
+					break;
+#endif
 			}
 
 			break;
@@ -38,9 +38,13 @@
 
 	/* Includes: */
 		#include <LUFA/Drivers/USB/USB.h>
+		#include <LUFA/Drivers/USB/Class/CDCClass.h>
+		#include <LUFA/Drivers/USB/Class/HIDClass.h>
 
 		#include <avr/pgmspace.h>
 
+		#include "Config/AppConfig.h"
+
 	/* Macros: */
 		/** Endpoint address of the Bulk Vendor device-to-host data IN endpoint. */
 		#define VENDOR_IN_EPADDR               (ENDPOINT_DIR_IN  | 3)
@@ -51,6 +55,72 @@
 		/** Size in bytes of the Bulk Vendor data endpoints. */
 		#define VENDOR_IO_EPSIZE               64
 
+		/** Transfer type of the vendor data endpoints, interrupt for the HID reports of the HID build. */
+		#define VENDOR_IO_EPTYPE               (HID_SUPPORT ? EP_TYPE_INTERRUPT : EP_TYPE_BULK)
+
+		/** Filler for the unused end of a HID input report. Poll records never start with it, and FIFO drain records,
+		 *  which do, always start a report.
+		 */
+		#define VENDOR_REPORT_PAD              0xFF
+
+		/** Endpoint address of the Interrupt Vendor device-to-host event endpoint. */
+		#define VENDOR_EVENT_EPADDR            (ENDPOINT_DIR_IN  | 1)
+
+		/** Size in bytes of the Interrupt Vendor event endpoint. */
+		#define VENDOR_EVENT_EPSIZE            8
+
+		/** Endpoint address of the Isochronous Vendor device-to-host poll record endpoint, \ref ISO_SUPPORT only. */
+		#define VENDOR_POLL_EPADDR             (ENDPOINT_DIR_IN  | 2)
+
+		/** Size in bytes of the Isochronous Vendor poll record endpoint, one packet of records per frame, packed as on
+		 *  the bulk IN endpoint.
+		 */
+		#define VENDOR_POLL_EPSIZE             VENDOR_IO_EPSIZE
+
+		/** Endpoint address of the CDC device-to-host notification IN endpoint, composite build only. */
+		#define CDC_NOTIFICATION_EPADDR        (ENDPOINT_DIR_IN  | 2)
+
+		/** Endpoint address of the CDC device-to-host data IN endpoint. */
+		#define CDC_TX_EPADDR                  (ENDPOINT_DIR_IN  | 5)
+
+		/** Endpoint address of the CDC host-to-device data OUT endpoint. */
+		#define CDC_RX_EPADDR                  (ENDPOINT_DIR_OUT | 6)
+
+		/** Size in bytes of the CDC device-to-host notification IN endpoint. */
+		#define CDC_NOTIFICATION_EPSIZE        8
+
+		/** Size in bytes of the CDC data IN and OUT endpoints. */
+		#define CDC_TXRX_EPSIZE                64
+
+		/** Alternate settings of the vendor interface. */
+		#define VENDOR_ALT_CONTROL             0 /**< Control requests only, as the original I2C-Tiny-USB */
+		#define VENDOR_ALT_BULK                1 /**< Adds the bulk command endpoints and the event endpoint */
+		#define VENDOR_ALT_ISO                 2 /**< As \ref VENDOR_ALT_BULK, with the poll records on their own endpoint */
+
+		/** Descriptor types of the Binary Device Object Store, which LUFA doesn't know about. */
+		#define DTYPE_BOS                      0x0F
+		#define DTYPE_DeviceCapability         0x10
+
+		/** Device capability type of the platform capability descriptor. */
+		#define DCAP_TYPE_Platform             0x05
+
+		/** Oldest Windows version that reads the Microsoft OS 2.0 descriptors, 8.1. */
+		#define MSOS20_WINDOWS_VERSION         0x06030000UL
+
+		/** Vendor request code the host uses to fetch the Microsoft OS 2.0 descriptor set, and wIndex of that request. */
+		#define MSOS20_VENDOR_CODE             0x57
+		#define MSOS20_DESCRIPTOR_INDEX        0x07
+
+		/** Microsoft OS 2.0 descriptor types. */
+		#define MSOS20_SET_HEADER_DESCRIPTOR   0x00
+		#define MSOS20_SUBSET_CONFIGURATION    0x01
+		#define MSOS20_SUBSET_FUNCTION         0x02
+		#define MSOS20_FEATURE_COMPATIBLE_ID   0x03
+		#define MSOS20_FEATURE_REG_PROPERTY    0x04
+
+		/** Registry value type of a list of strings. */
+		#define MSOS20_REG_MULTI_SZ            7
+
 	/* Type Defines: */
 		/** Type define for the device configuration descriptor structure. This must be defined in the
 		 *  application code, as the configuration descriptor contains several sub-descriptors which
@@ -60,19 +130,128 @@
 		{
 			USB_Descriptor_Configuration_Header_t Config;
 
-			// Vendor Interface
+			// Vendor Interface, control only and with the bulk and event endpoints; in the HID build a single
+			// setting with the two report endpoints
 			USB_Descriptor_Interface_t            Vendor_Interface;
+			#if HID_SUPPORT
+			USB_HID_Descriptor_HID_t              Vendor_HID;
+			#else
+			USB_Descriptor_Interface_t            Vendor_BulkInterface;
+			#endif
 			USB_Descriptor_Endpoint_t             Vendor_DataInEndpoint;
 			USB_Descriptor_Endpoint_t             Vendor_DataOutEndpoint;
+			#if !HID_SUPPORT
+			USB_Descriptor_Endpoint_t             Vendor_EventEndpoint;
+			#endif
+			#if ISO_SUPPORT
+			USB_Descriptor_Interface_t            Vendor_IsoInterface;
+			USB_Descriptor_Endpoint_t             Vendor_IsoDataInEndpoint;
+			USB_Descriptor_Endpoint_t             Vendor_IsoDataOutEndpoint;
+			USB_Descriptor_Endpoint_t             Vendor_IsoEventEndpoint;
+			USB_Descriptor_Endpoint_t             Vendor_PollEndpoint;
+			#endif
+
+			#if CDC_SUPPORT
+			// CDC Control Interface
+			USB_Descriptor_Interface_Association_t CDC_IAD;
+			USB_Descriptor_Interface_t            CDC_CCI_Interface;
+			USB_CDC_Descriptor_FunctionalHeader_t CDC_Functional_Header;
+			USB_CDC_Descriptor_FunctionalACM_t    CDC_Functional_ACM;
+			USB_CDC_Descriptor_FunctionalUnion_t  CDC_Functional_Union;
+			USB_Descriptor_Endpoint_t             CDC_NotificationEndpoint;
+
+			// CDC Data Interface
+			USB_Descriptor_Interface_t            CDC_DCI_Interface;
+			USB_Descriptor_Endpoint_t             CDC_DataOutEndpoint;
+			USB_Descriptor_Endpoint_t             CDC_DataInEndpoint;
+			#endif
 		} USB_Descriptor_Configuration_t;
 
+		/** Type define for the Binary Device Object Store, a header and the platform capability descriptor pointing
+		 *  Windows at the Microsoft OS 2.0 descriptor set.
+		 */
+		typedef struct
+		{
+			USB_Descriptor_Header_t Header;
+			uint16_t                TotalLength;
+			uint8_t                 NumDeviceCaps;
+
+			struct
+			{
+				USB_Descriptor_Header_t Header;
+				uint8_t                 CapabilityType;
+				uint8_t                 Reserved;
+				uint8_t                 PlatformUUID[16];
+				uint32_t                WindowsVersion;
+				uint16_t                DescriptorSetLength;
+				uint8_t                 VendorCode;
+				uint8_t                 AltEnumCode;
+			} ATTR_PACKED MSOS20_Platform;
+		} ATTR_PACKED USB_Descriptor_BOS_t;
+
+		/** Type define for the Microsoft OS 2.0 descriptor set: the WinUSB compatible ID for the whole device, and the
+		 *  interface GUID applications look the device up by. The composite build narrows both down to the vendor
+		 *  interface through a configuration and a function subset, leaving the CDC interfaces to the serial driver.
+		 */
+		typedef struct
+		{
+			struct
+			{
+				uint16_t Length;
+				uint16_t DescriptorType;
+				uint32_t WindowsVersion;
+				uint16_t TotalLength;
+			} ATTR_PACKED Header;
+
+			#if CDC_SUPPORT
+			struct
+			{
+				uint16_t Length;
+				uint16_t DescriptorType;
+				uint8_t  ConfigurationIndex;
+				uint8_t  Reserved;
+				uint16_t TotalLength;
+			} ATTR_PACKED ConfigurationSubset;
+
+			struct
+			{
+				uint16_t Length;
+				uint16_t DescriptorType;
+				uint8_t  FirstInterface;
+				uint8_t  Reserved;
+				uint16_t SubsetLength;
+			} ATTR_PACKED FunctionSubset;
+			#endif
+
+			struct
+			{
+				uint16_t Length;
+				uint16_t DescriptorType;
+				uint8_t  CompatibleID[8];
+				uint8_t  SubCompatibleID[8];
+			} ATTR_PACKED CompatibleID;
+
+			struct
+			{
+				uint16_t Length;
+				uint16_t DescriptorType;
+				uint16_t PropertyDataType;
+				uint16_t PropertyNameLength;
+				wchar_t  PropertyName[21];
+				uint16_t PropertyDataLength;
+				wchar_t  PropertyData[40];
+			} ATTR_PACKED InterfaceGUIDs;
+		} ATTR_PACKED MSOS20_DescriptorSet_t;
+
 		/** Enum for the device interface descriptor IDs within the device. Each interface descriptor
 		 *  should have a unique ID index associated with it, which can be used to refer to the
 		 *  interface from other descriptors.
 		 */
 		enum InterfaceDescriptors_t
 		{
-			INTERFACE_ID_Vendor = 0, /**< Vendor interface descriptor ID */
+			INTERFACE_ID_Vendor  = 0, /**< Vendor interface descriptor ID */
+			INTERFACE_ID_CDC_CCI = 1, /**< CDC CCI interface descriptor ID, composite build only */
+			INTERFACE_ID_CDC_DCI = 2, /**< CDC DCI interface descriptor ID, composite build only */
 		};
 
 		/** Enum for the device string descriptor IDs within the device. Each string descriptor should
@@ -84,12 +263,20 @@
 			STRING_ID_Language     = 0, /**< Supported Languages string descriptor ID (must be zero) */
 			STRING_ID_Manufacturer = 1, /**< Manufacturer string ID */
 			STRING_ID_Product      = 2, /**< Product string ID */
+			STRING_ID_Label        = 3, /**< Bus label string ID, the name of the interface */
+			STRING_ID_Serial       = 4, /**< Serial number string ID, built at boot from the signature row */
 		};
 
+	/* External Variables: */
+		extern const MSOS20_DescriptorSet_t MSOS20_DescriptorSet PROGMEM;
+
 	/* Function Prototypes: */
+		void Descriptors_Init(void);
+
 		uint16_t CALLBACK_USB_GetDescriptor(const uint16_t wValue,
 		                                    const uint16_t wIndex,
-		                                    const void** const DescriptorAddress)
+		                                    const void** const DescriptorAddress,
+		                                    uint8_t* const DescriptorMemorySpace)
 		                                    ATTR_WARN_UNUSED_RESULT ATTR_NON_NULL_PTR_ARG(3);
 
 #endif
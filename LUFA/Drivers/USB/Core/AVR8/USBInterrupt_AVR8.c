@@ -262,6 +262,28 @@ ISR(USB_COM_vect, ISR_BLOCK)
 {
 	uint8_t PrevSelectedEndpoint = Endpoint_GetCurrentEndpoint();
 
+	/* LOCAL PATCH (i2c-tiny-usb-avr, see LUFA/LOCAL_PATCHES.txt): other endpoints only interrupt to wake the
+	 * CPU from idle sleep; their flags stay set until the main code services them, so the interrupt is disarmed
+	 * here and nothing else done */
+	uint8_t DataEndpoints = (Endpoint_GetEndpointInterrupts() & ~(1 << ENDPOINT_CONTROLEP));
+
+	for (uint8_t EPNum = 1; DataEndpoints; EPNum++)
+	{
+		if (DataEndpoints & (1 << EPNum))
+		{
+			Endpoint_SelectEndpoint(EPNum);
+			UEIENX &= ~((1 << TXINE) | (1 << RXOUTE));
+			DataEndpoints &= ~(1 << EPNum);
+		}
+	}
+
+	if (!(Endpoint_HasEndpointInterrupted(ENDPOINT_CONTROLEP)))
+	{
+		Endpoint_SelectEndpoint(PrevSelectedEndpoint);
+		return;
+	}
+	/* END LOCAL PATCH */
+
 	Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
 	USB_INT_Disable(USB_INT_RXSTPI);
 
@@ -0,0 +1,114 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Per-target traffic and error counters for CMD_GET_ADDR_STATS. A target gets an entry in the table the first
+ *  time it ACKs its address, so a bus scan doesn't fill the table with addresses nobody answers to; its NAKs are
+ *  counted from then on, which is what shows a flaky target. The TWI engine picks the entry of the addressed target
+ *  with every START and everything moved until the next one is counted there.
+ */
+
+#define  __INCLUDE_FROM_ADDRSTATS_C
+#include "AddrStats.h"
+#include "Stats.h"
+
+AddrStats_Entry_t* volatile AddrStats_Current;
+
+#if STATS_SUPPORT
+AddrStats_t AddrStats;
+
+// Returns the entry of the given address, NULL if it hasn't got one
+static AddrStats_Entry_t* AddrStats_Find(const uint8_t address)
+{
+	for (uint8_t i = 0; i < ADDR_STATS_ENTRIES; i++) {
+		if (AddrStats.Entry[i].Address == address)
+			return &AddrStats.Entry[i];
+	}
+
+	return NULL;
+}
+#endif
+
+/** Clears the table, the current target included. */
+void AddrStats_Reset(void)
+{
+	#if STATS_SUPPORT
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	AddrStats_Current = NULL;
+	memset(&AddrStats, 0, sizeof(AddrStats));
+	AddrStats.TickRateKHz = STATS_TICK_KHZ;
+	AddrStats.Entries     = ADDR_STATS_ENTRIES;
+	AddrStats.EntrySize   = sizeof(AddrStats_Entry_t);
+	for (uint8_t i = 0; i < ADDR_STATS_ENTRIES; i++)
+		AddrStats.Entry[i].Address = ADDR_STATS_UNUSED;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	#endif
+}
+
+/** Makes the target at the given 7-bit address the current one, called for every START. */
+void AddrStats_Select(const uint8_t address)
+{
+	#if STATS_SUPPORT
+	AddrStats_Current = AddrStats_Find(address);
+	#endif
+}
+
+/** Counts an ACKed address, giving the target an entry if it hasn't got one yet. Called from the TWI interrupt. */
+void AddrStats_Acked(const uint8_t address)
+{
+	#if STATS_SUPPORT
+	AddrStats_Entry_t* entry = AddrStats_Current;
+
+	if (!entry) {
+		entry = AddrStats_Find(ADDR_STATS_UNUSED);
+		if (!entry) {
+			if (AddrStats.Untracked != UINT16_MAX)
+				AddrStats.Untracked++;
+			return;
+		}
+		entry->Address    = address;
+		AddrStats_Current = entry;
+	}
+	entry->Transactions++;
+	#endif
+}
+
+/** Counts a NACKed address for the current target. Called from the TWI interrupt. */
+void AddrStats_Nak(void)
+{
+	#if STATS_SUPPORT
+	AddrStats_Entry_t* const entry = AddrStats_Current;
+
+	if (entry && (entry->NAKs != UINT16_MAX))
+		entry->NAKs++;
+	#endif
+}
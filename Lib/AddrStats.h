@@ -0,0 +1,125 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for AddrStats.c.
+ */
+
+#ifndef _ADDR_STATS_H_
+#define _ADDR_STATS_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+
+	/* Macros: */
+		/** Address of a table entry that is still free. */
+		#define ADDR_STATS_UNUSED   0xFF
+
+	/* Type Defines: */
+		/** Type define for the counters of one target, an entry of the CMD_GET_ADDR_STATS response. Byte counts
+		 *  are what was handed to the bus, a transfer cut short by a NAK or an abort counts in full.
+		 */
+		typedef struct
+		{
+			uint8_t  Address;      /**< 7-bit address, the header address for a 10-bit target */
+			uint8_t  Timeouts;     /**< Transfers given up on because the target held the clock, saturating */
+			uint16_t NAKs;         /**< Address NAKs once the target has ACKed, retries included, saturating */
+			uint32_t Transactions; /**< STARTs the target ACKed */
+			uint32_t BytesWritten; /**< Data bytes written, register pointers included */
+			uint32_t BytesRead;    /**< Data bytes read */
+			uint32_t WaitTicks;    /**< Timer1 ticks spent waiting for the bus to move, byte times plus stretching */
+		} ATTR_PACKED AddrStats_Entry_t;
+
+		/** Type define for the CMD_GET_ADDR_STATS response. */
+		typedef struct
+		{
+			uint16_t TickRateKHz;  /**< Timer1 tick rate, \ref STATS_TICK_KHZ */
+			uint8_t  Entries;      /**< \ref ADDR_STATS_ENTRIES */
+			uint8_t  EntrySize;    /**< Size of one \ref AddrStats_Entry_t */
+			uint16_t Untracked;    /**< ACKed STARTs of targets that found the table full, saturating */
+			AddrStats_Entry_t Entry[ADDR_STATS_ENTRIES]; /**< In the order the targets first ACKed */
+		} ATTR_PACKED AddrStats_t;
+
+	/* External Variables: */
+		extern AddrStats_t AddrStats;
+		extern AddrStats_Entry_t* volatile AddrStats_Current;
+
+	/* Function Prototypes: */
+		void AddrStats_Reset(void);
+		void AddrStats_Select(const uint8_t address);
+		void AddrStats_Acked(const uint8_t address);
+		void AddrStats_Nak(void);
+
+		#if defined(__INCLUDE_FROM_ADDRSTATS_C) && STATS_SUPPORT
+			static AddrStats_Entry_t* AddrStats_Find(const uint8_t address);
+		#endif
+
+	/* Inline Functions: */
+		/** Counts \c len bytes written to the current target. */
+		static inline void AddrStats_Written(const uint16_t len) ATTR_ALWAYS_INLINE;
+		static inline void AddrStats_Written(const uint16_t len)
+		{
+			AddrStats_Entry_t* const entry = AddrStats_Current;
+
+			if (STATS_SUPPORT && entry)
+				entry->BytesWritten += len;
+		}
+
+		/** Counts \c len bytes read from the current target. */
+		static inline void AddrStats_Read(const uint16_t len) ATTR_ALWAYS_INLINE;
+		static inline void AddrStats_Read(const uint16_t len)
+		{
+			AddrStats_Entry_t* const entry = AddrStats_Current;
+
+			if (STATS_SUPPORT && entry)
+				entry->BytesRead += len;
+		}
+
+		/** Adds the time since \c since, a Timer1 count, to the wait time of the current target. */
+		static inline void AddrStats_Wait(const uint16_t since) ATTR_ALWAYS_INLINE;
+		static inline void AddrStats_Wait(const uint16_t since)
+		{
+			AddrStats_Entry_t* const entry = AddrStats_Current;
+
+			if (STATS_SUPPORT && entry)
+				entry->WaitTicks += Timebase_Elapsed(since);
+		}
+
+		/** Counts a stretch timeout of the current target. */
+		static inline void AddrStats_Timeout(void) ATTR_ALWAYS_INLINE;
+		static inline void AddrStats_Timeout(void)
+		{
+			AddrStats_Entry_t* const entry = AddrStats_Current;
+
+			if (STATS_SUPPORT && entry && (entry->Timeouts != UINT8_MAX))
+				entry->Timeouts++;
+		}
+
+#endif
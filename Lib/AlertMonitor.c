@@ -0,0 +1,158 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_ALERTMONITOR_C
+#include "AlertMonitor.h"
+
+// ALERT_MODE_* bits set by CMD_SET_ALERT and the register read after a successful ARA read
+static uint8_t Alert_Mode;
+static uint8_t Alert_StatusReg;
+
+// Set by the edge interrupt when the alert needs an ARA read from the main loop
+static volatile uint8_t Alert_Pending;
+
+// Without the ARA read there is nothing to do on the bus, so the alert is reported straight away
+static void Alert_Raise(void)
+{
+	Wakeup_Raise(WAKEUP_ALERT);
+
+	if (Alert_Mode & ALERT_MODE_ARA)
+		Alert_Pending = true;
+	else
+		Events_Push(EVENT_ALERT, ALERT_NO_ADDRESS);
+}
+
+ISR(ALERT_VECT)
+{
+	Alert_Raise();
+}
+
+static uint8_t Alert_Address(const uint8_t address)
+{
+	TWIEngine_Start(address);
+	return TWIEngine_Wait(I2C_StartTimeoutMs);
+}
+
+// Read a single byte, after writing the register pointer if write_reg is set; the caller owns the bus
+static bool Alert_Read(const uint8_t address, const bool write_reg, const uint8_t reg, uint8_t* const value)
+{
+	uint8_t result = Alert_Address((address << 1) | (write_reg ? 0 : I2C_M_RD));
+	const uint8_t bus_held = (result == TWI_ERROR_NoError);
+	if (bus_held && write_reg) {
+		TWIEngine_Write(1);
+		RingBuffer_Insert(&TWIEngine_TxRing, reg);
+		TWIEngine_Kick();
+		result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+		if (result == TWI_ERROR_NoError)
+			result = Alert_Address((address << 1) | I2C_M_RD);
+	}
+
+	if (result == TWI_ERROR_NoError) {
+		TWIEngine_Read(1, true);
+		if (TWIEngine_WaitFor(TWI_EVENT_RxData) && !RingBuffer_IsEmpty(&TWIEngine_RxRing))
+			*value = RingBuffer_Remove(&TWIEngine_RxRing);
+		else
+			result = TWI_ENGINE_ERROR_StretchTimeout;
+	}
+
+	// A NACKed address has already been followed by a STOP from the engine
+	if (bus_held && (result != TWI_ERROR_SlaveNotReady)) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+	}
+
+	return (result == TWI_ERROR_NoError);
+}
+
+/** Sets up the edge interrupt on the alert line, monitoring stays off until \ref Alert_SetMode() turns it on. */
+void Alert_Init(void)
+{
+	ALERT_DDR &= ~(1 << ALERT_BIT);
+
+	#if (ALERT_INT < 4)
+	EICRA = (EICRA & ~(3 << (ALERT_INT * 2))) | (2 << (ALERT_INT * 2));
+	#else
+	EICRB = (EICRB & ~(3 << ((ALERT_INT - 4) * 2))) | (2 << ((ALERT_INT - 4) * 2));
+	#endif
+}
+
+/** Turns monitoring of the alert line on or off, mode is a set of ALERT_MODE_* bits. An alert line that is
+ *  already asserted when monitoring is turned on is handled right away.
+ */
+void Alert_SetMode(const uint8_t mode, const uint8_t status_reg)
+{
+	EIMSK &= ~(1 << ALERT_INT);
+	Alert_Pending   = false;
+	Alert_Mode      = mode;
+	Alert_StatusReg = status_reg;
+
+	if (!(mode & ALERT_MODE_ENABLE)) {
+		ALERT_PORT &= ~(1 << ALERT_BIT);
+		return;
+	}
+
+	// SMBALERT# is open drain; the internal pull-up keeps an unconnected line quiet
+	ALERT_PORT |= (1 << ALERT_BIT);
+	EIFR  = (1 << ALERT_INT);
+	EIMSK |= (1 << ALERT_INT);
+
+	if (!(ALERT_PIN & (1 << ALERT_BIT)))
+		Alert_Raise();
+}
+
+/** Finds out who raised the alert through an ARA read and reports it, followed by the status register of the
+ *  alerting target if asked to. Called from the main loop; an alert that finds the bus taken waits for the next call.
+ */
+void Alert_Task(void)
+{
+	if (!Alert_Pending || !I2C_IsBulkActive())
+		return;
+
+	if (!I2C_ClaimBus(BUS_OWNER_ALERT))
+		return;
+	Alert_Pending = false;
+
+	uint8_t address;
+	if (Alert_Read(ALERT_RESPONSE_ADDRESS, false, 0, &address)) {
+		address >>= 1;
+		Events_Push(EVENT_ALERT, address);
+
+		uint8_t status;
+		if ((Alert_Mode & ALERT_MODE_STATUS) && Alert_Read(address, true, Alert_StatusReg, &status))
+			Events_Push(EVENT_ALERT_STATUS, status);
+
+		// Only the lowest alerting address answers the ARA, the others keep the line low for another round
+		if (!(ALERT_PIN & (1 << ALERT_BIT)))
+			Alert_Pending = true;
+	} else {
+		Events_Push(EVENT_ALERT, ALERT_NO_ADDRESS);
+	}
+
+	I2C_ReleaseBus();
+}
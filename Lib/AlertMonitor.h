@@ -0,0 +1,61 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for AlertMonitor.c.
+ */
+
+#ifndef _ALERT_MONITOR_H_
+#define _ALERT_MONITOR_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "TWIEngine.h"
+		#include "EventQueue.h"
+		#include "RemoteWakeup.h"
+
+	/* Macros: */
+		/** SMBus Alert Response Address; a read from it returns the address of the alerting target. */
+		#define ALERT_RESPONSE_ADDRESS  0x0C
+
+		/** Event argument for an alert without a known source, because the ARA read is off or nobody answered it. */
+		#define ALERT_NO_ADDRESS        0xFF
+
+	/* Function Prototypes: */
+		void Alert_Init(void);
+		void Alert_SetMode(const uint8_t mode, const uint8_t status_reg);
+		void Alert_Task(void);
+
+		#if defined(__INCLUDE_FROM_ALERTMONITOR_C)
+			static void Alert_Raise(void);
+			static uint8_t Alert_Address(const uint8_t address);
+			static bool Alert_Read(const uint8_t address, const bool write_reg, const uint8_t reg, uint8_t* const value);
+		#endif
+
+#endif
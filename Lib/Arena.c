@@ -0,0 +1,60 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Scratch memory for the requests handled in the main loop: a slab of \ref ARENA_SIZE bytes that buffers are
+ *  carved from front to back and that is handed back as a whole before the next job starts. There is no malloc
+ *  and nothing to fragment, the SRAM use is fixed at build time. Main loop jobs run one after the other and don't
+ *  nest, so all of them share the one slab; nothing taken from it may be kept past the end of the job.
+ */
+
+#define  __INCLUDE_FROM_ARENA_C
+#include "Arena.h"
+
+static uint8_t  Arena_Slab[ARENA_SIZE];
+static uint16_t Arena_Used;
+
+/** Hands the whole slab back, called at the start of every job. */
+void Arena_Reset(void)
+{
+	Arena_Used = 0;
+}
+
+/** Takes size bytes from the slab for the rest of the current job.
+ *  @return The buffer, or NULL if the slab is used up
+ */
+void* Arena_Alloc(const uint16_t size)
+{
+	if (size > (ARENA_SIZE - Arena_Used))
+		return NULL;
+
+	void* const block = &Arena_Slab[Arena_Used];
+	Arena_Used += size;
+	return block;
+}
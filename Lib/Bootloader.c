@@ -0,0 +1,78 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  CMD_START_BOOTLOADER: detaches from USB and resets into the bootloader, so adapters can be reflashed without
+ *  pressing a button. The Atmel DFU bootloader is only entered from reset with HWB held low, so a key survives the
+ *  watchdog reset in .noinit and the startup code jumps there before anything is initialized. The Arduino Caterina
+ *  bootloader runs on every reset anyway and stays if it finds its own key after a watchdog reset, so that is left
+ *  for it as well.
+ */
+
+#define  __INCLUDE_FROM_BOOTLOADER_C
+#include "Bootloader.h"
+
+static uint32_t Boot_Key ATTR_NO_INIT;
+
+/** Detaches from USB and resets into the bootloader, see the file comment. Call once the status stage of the
+ *  request is on its way.
+ */
+void Bootloader_Start(void)
+{
+	// Let the ZLP of the status stage go out before the detach
+	Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+	for (uint8_t ms = 0; (ms < 10) && !Endpoint_IsINReady(); ms++)
+		_delay_ms(1);
+
+	USB_Disable();
+	GlobalInterruptDisable();
+	// The hang watchdog would go off during the detach, before the key is in place
+	wdt_disable();
+	_delay_ms(BOOTLOADER_DETACH_MS);
+
+	// Caterina only exists for the xU4; on the larger parts the address may well be in the middle of .noinit
+	#if defined(__AVR_ATmega16U4__) || defined(__AVR_ATmega32U4__)
+	*(volatile uint16_t*)BOOTLOADER_CATERINA_KEY_ADDRESS = BOOTLOADER_CATERINA_KEY;
+	#endif
+	Boot_Key = BOOTLOADER_MAGIC_KEY;
+	wdt_enable(WDTO_250MS);
+
+	for (;;);
+}
+
+/** Runs from .init3 on every reset, before the data and BSS sections are set up: jumps to the bootloader if the
+ *  reset was the one of \ref Bootloader_Start().
+ */
+void Bootloader_Check(void)
+{
+	if ((MCUSR & (1 << WDRF)) && (Boot_Key == BOOTLOADER_MAGIC_KEY)) {
+		Boot_Key = 0;
+		((void (*)(void))(BOOTLOADER_START_ADDRESS / 2))();
+	}
+}
@@ -0,0 +1,60 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for Bootloader.c.
+ */
+
+#ifndef _BOOTLOADER_H_
+#define _BOOTLOADER_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+		#include <util/delay.h>
+
+	/* Macros: */
+		/** Key left in \ref Boot_Key across the watchdog reset to have the next boot jump to the bootloader. */
+		#define BOOTLOADER_MAGIC_KEY       0xDC42ACCA
+
+		/** Byte address of the bootloader at the start of the boot section. */
+		#define BOOTLOADER_START_ADDRESS   (FLASHEND - BOOTLOADER_SIZE + 1)
+
+		/** Where the Arduino Caterina bootloader looks for its key after a watchdog reset, and the key. */
+		#define BOOTLOADER_CATERINA_KEY_ADDRESS  0x0800
+		#define BOOTLOADER_CATERINA_KEY          0x7777
+
+		/** Time to stay detached before the reset, so the host notices the adapter is gone. */
+		#define BOOTLOADER_DETACH_MS       2000
+
+	/* Function Prototypes: */
+		void Bootloader_Start(void) ATTR_NO_RETURN;
+		void Bootloader_Check(void) ATTR_INIT_SECTION(3);
+
+#endif
@@ -0,0 +1,2467 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Bulk endpoint command protocol. The host sends a stream of commands on the
+ * vendor OUT endpoint; address status bytes and read data come back on the
+ * vendor IN endpoint in the same order. This lets the host queue many I2C
+ * transactions per USB frame instead of one per control transfer.
+ *
+ * The actual bus work is done by the interrupt driven TWI engine, fed through
+ * its ring buffers, so the endpoint FIFOs are emptied and filled while the
+ * bus is busy and USB packet boundaries don't stall the bus.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_BULKPROTOCOL_C
+#include "BulkProtocol.h"
+
+// Set when the device got deconfigured mid-command, unwinds all pending work
+static uint8_t Bulk_Aborted;
+
+// Set when the last START failed, I2C accesses are skipped until the next START
+static uint8_t Bulk_Skip;
+
+// Number of bytes in the currently open IN bank, 0 if none is open
+static uint8_t Bulk_InBytes;
+
+// Bit-banged channels selected by BULK_OP_CHANNEL, 0 for the TWI bus, and those of them whose target ACKed
+static uint8_t Bulk_Channels;
+static uint8_t Bulk_SoftAcked;
+
+// Set while a REGWRITE to an auto-incrementing target is left open for the next one to continue, with the
+// target and the register the next REGWRITE has to start at to be merged into it
+static uint8_t Bulk_MergeOpen;
+static uint8_t Bulk_MergeAddress;
+static uint8_t Bulk_MergeNextReg;
+
+// Milliseconds without a command packet after which the bus lock of BULK_OP_LOCK runs out, 0 while unlocked, and
+// the frame the host was last heard from
+static uint16_t Bulk_LockTimeout;
+static uint16_t Bulk_LockFrame;
+
+// Set by a DEADLINE command for the next BATCH, with the moment after which its transactions expire, as a frame
+// number and Timer1 ticks after its Start of Frame
+static uint8_t Bulk_DeadlineSet;
+static uint16_t Bulk_DeadlineFrame;
+static uint16_t Bulk_DeadlineOffset;
+
+// Set by a SYNC command for the next BATCH, with how long a follower waits for the edge
+static uint8_t Bulk_SyncArmed;
+static uint8_t Bulk_SyncTimeout;
+
+// Set by a STAMPS command for the next BATCH
+static uint8_t Bulk_StampsArmed;
+
+// Set by a POST command for the command after it, which then runs posted: its response is dropped, except for the
+// last byte it would have sent, its status, kept to find out whether it failed. Failures are latched for POST_STATUS.
+static uint8_t Bulk_PostArmed;
+static uint8_t Bulk_Posted;
+static uint8_t Bulk_PostTag;
+static uint8_t Bulk_PostLast;
+static Bulk_PostStatus_t Bulk_PostFailures;
+
+// Set by the USB interrupt when a CMD_CANCEL comes in, until Bulk_Cancel() carries it out
+static volatile uint8_t Bulk_CancelPending;
+
+static inline uint8_t Bulk_CheckDeviceGone(void)
+{
+	if (!I2C_IsBulkActive() || Bulk_CancelPending)
+		Bulk_Aborted = true;
+
+	return Bulk_Aborted;
+}
+
+// Wait for command data, moving on to the next OUT packet if the current one is drained; returns the number of
+// bytes left in the current packet, 0 if the device went away. Leaves the OUT endpoint selected.
+static uint8_t Bulk_ReadAvailable(void)
+{
+	// A cancelled command must not take the next command packet for its own
+	if (Bulk_Aborted)
+		return 0;
+
+	Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
+
+	if (!Endpoint_IsReadWriteAllowed()) {
+		const Stats_Stamp_t waited = Stats_LatencyStart();
+
+		while (!Endpoint_IsReadWriteAllowed()) {
+			Watchdog_Kick();
+			if (Endpoint_IsOUTReceived()) {
+				Endpoint_ClearOUT();
+				Stats_Count(&Stats.UsbPackets);
+				Sched_Charge();
+			}
+			if (Bulk_CheckDeviceGone())
+				return 0;
+		}
+		Stats_UsbWaitDone(waited);
+	}
+
+	return Endpoint_BytesInEndpoint();
+}
+
+// Whether there is command data to be had right now, moving on to the next OUT packet if the current one is
+// drained, without waiting for one. Leaves the OUT endpoint selected.
+static bool Bulk_DataReady(void)
+{
+	Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
+
+	if (!Endpoint_IsReadWriteAllowed() && Endpoint_IsOUTReceived()) {
+		Endpoint_ClearOUT();
+		Stats_Count(&Stats.UsbPackets);
+		Sched_Charge();
+	}
+
+	return Endpoint_IsReadWriteAllowed();
+}
+
+// Fetch the next command byte
+static uint8_t Bulk_Read_8(void)
+{
+	if (!Bulk_ReadAvailable())
+		return 0;
+
+	return Endpoint_Read_8();
+}
+
+static uint16_t Bulk_Read_16(void)
+{
+	uint16_t value = Bulk_Read_8();
+	return value | (Bulk_Read_8() << 8);
+}
+
+// Wait for an IN bank to fill with response data; returns the room left in it, 0 if the device went away.
+// Leaves the IN endpoint selected.
+static uint8_t Bulk_WriteSpace(void)
+{
+	// Nor leave its response in a bank the cancel has just emptied
+	if (Bulk_Aborted)
+		return 0;
+
+	Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+
+	if (!Bulk_InBytes && !Endpoint_IsINReady()) {
+		const Stats_Stamp_t waited = Stats_LatencyStart();
+
+		while (!Endpoint_IsINReady()) {
+			Watchdog_Kick();
+			if (Bulk_CheckDeviceGone())
+				return 0;
+		}
+		Stats_UsbWaitDone(waited);
+	}
+
+	return VENDOR_IO_EPSIZE - Bulk_InBytes;
+}
+
+// Account for bytes written into the IN bank, sending it off once it is full
+static void Bulk_WriteDone(const uint8_t count)
+{
+	Bulk_InBytes += count;
+	if (Bulk_InBytes == VENDOR_IO_EPSIZE) {
+		Endpoint_ClearIN();
+		Stats_Count(&Stats.UsbPackets);
+		Sched_Charge();
+		Bulk_InBytes = 0;
+	}
+}
+
+// Append a byte to the response stream
+static void Bulk_Write_8(const uint8_t value)
+{
+	if (Bulk_Posted) {
+		Bulk_PostLast = value;
+		return;
+	}
+
+	if (!Bulk_WriteSpace())
+		return;
+
+	Endpoint_Write_8(value);
+	Bulk_WriteDone(1);
+}
+
+// Send off a partially filled IN bank
+static void Bulk_Flush(void)
+{
+	if (Bulk_InBytes) {
+		Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+		I2C_ClearVendorIN();
+		Stats_Count(&Stats.UsbPackets);
+		Bulk_InBytes = 0;
+	}
+}
+
+// Done with a transaction; while locked the bus stays ours, so no other path gets in before the next one
+static void Bulk_ReleaseBus(void)
+{
+	if (!Bulk_LockTimeout)
+		I2C_ReleaseBus();
+}
+
+// Send a (repeated) START and address byte, returning the resulting status
+static uint8_t Bulk_Address(const uint16_t address)
+{
+	if (!I2C_ClaimBus(BUS_OWNER_BULK))
+		return STATUS_BUS_BUSY;
+
+	TWIEngine_Start(address);
+	if (TWIEngine_Wait(I2C_StartTimeoutMs)) {
+		// The failed START already released the bus one way or another
+		Bulk_ReleaseBus();
+		return STATUS_ADDRESS_NAK;
+	}
+
+	return STATUS_ADDRESS_ACK;
+}
+
+// Returns the status sent, on bit-banged channels an ACK only if all selected channels ACKed; they have no 10-bit
+// addressing, a TWI_ENGINE_TEN() address is NAKed there
+static uint8_t Bulk_I2CStart(const uint16_t address)
+{
+	if (SOFTI2C_CHANNELS && Bulk_Channels) {
+		// One status byte per selected channel, lowest channel first
+		Bulk_SoftAcked = (address & TWI_ENGINE_TEN_BIT) ? 0 : SoftI2C_Start(Bulk_Channels, address);
+		for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+			if (Bulk_Channels & (1 << i))
+				Bulk_Write_8((Bulk_SoftAcked & (1 << i)) ? STATUS_ADDRESS_ACK : STATUS_ADDRESS_NAK);
+		return (Bulk_SoftAcked == Bulk_Channels) ? STATUS_ADDRESS_ACK : STATUS_ADDRESS_NAK;
+	}
+
+	const uint8_t status = Bulk_Address(address);
+
+	Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+	Bulk_Write_8(status);
+	return status;
+}
+
+// Status byte for data phase problems: the target NAKed (or the bus failed), or it held the clock for too long
+static uint8_t Bulk_DataStatus(void)
+{
+	return (TWIEngine.Result == TWI_ENGINE_ERROR_StretchTimeout) ? STATUS_STRETCH_TIMEOUT : STATUS_ADDRESS_NAK;
+}
+
+// Detail record of a batch segment: what ended its START or data phase and the TWSR code behind it. The engine
+// keeps both from the START unless a data phase ran, and a write NAKed anywhere reports the NAK.
+static void Bulk_BatchDetail(const uint8_t status)
+{
+	uint8_t result = TWIEngine.Result;
+	uint8_t twsr   = TWIEngine.Status;
+
+	if (status == STATUS_BUS_BUSY) {
+		result = BATCH_RESULT_BUS_BUSY;
+		twsr   = TW_NO_INFO;
+	} else if ((status == STATUS_IDLE) || (status == STATUS_EXPIRED)) {
+		result = (status == STATUS_IDLE) ? BATCH_RESULT_SKIPPED : BATCH_RESULT_EXPIRED;
+		twsr   = TW_NO_INFO;
+	} else if (SOFTI2C_CHANNELS && Bulk_Channels) {
+		result = (status == STATUS_ADDRESS_ACK) ? TWI_ERROR_NoError : TWI_ERROR_SlaveNotReady;
+		twsr   = TW_NO_INFO;
+	}
+
+	Bulk_Write_8(result);
+	Bulk_Write_8(twsr);
+}
+
+// Hand one byte to a write operation started with TWIEngine_Write()
+static void Bulk_TxPut(const uint8_t value)
+{
+	// If the engine gave up on a bus fault or a stuck clock, the rest is dropped
+	if (TWIEngine_WaitFor(TWI_EVENT_TxSpace) && TWIEngine_IsBusy()) {
+		RingBuffer_Insert(&TWIEngine_TxRing, value);
+		TWIEngine_Kick();
+	}
+}
+
+// Bytes move from the OUT FIFO to the bus in runs as long as the OUT packet allows. Whenever the engine is
+// parked on an empty TX ring, which is the normal case, a run is written out straight from the FIFO;
+// otherwise it goes into the TX ring, limited by the ring space, for the TWI interrupt to drain.
+static void Bulk_TxStream(uint16_t len)
+{
+	while (len && !Bulk_Aborted) {
+		uint8_t run = Bulk_ReadAvailable();
+		if (run > len)
+			run = len;
+
+		// If the engine gave up on a bus fault or a stuck clock, the rest is dropped
+		if (!Bulk_Skip && TWIEngine_WaitFor(TWI_EVENT_TxSpace) && TWIEngine_IsBusy()) {
+			const uint8_t direct = TWIEngine_WriteDirect(run);
+			if (direct) {
+				len -= direct;
+				continue;
+			}
+
+			const uint8_t space = TWI_ENGINE_TX_SIZE - RingBuffer_GetCount(&TWIEngine_TxRing);
+			if (run > space)
+				run = space;
+
+			TWIEngine_TxFromEndpoint(run);
+			TWIEngine_Kick();
+		} else {
+			for (uint8_t i = 0; i < run; i++)
+				Endpoint_Discard_8();
+		}
+
+		len -= run;
+	}
+
+	if (!Bulk_Aborted)
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+}
+
+static void Bulk_I2CWrite(uint16_t len)
+{
+	if (SOFTI2C_CHANNELS && Bulk_Channels) {
+		// Channels that didn't ACK their address are left alone until the next START
+		while (len-- && !Bulk_Aborted) {
+			const uint8_t value = Bulk_Read_8();
+			if (Bulk_SoftAcked)
+				SoftI2C_Write(Bulk_SoftAcked, value);
+		}
+		return;
+	}
+
+	if (!Bulk_Skip)
+		TWIEngine_Write(len);
+
+	Bulk_TxStream(len);
+}
+
+// Take one byte from a read operation started with TWIEngine_Read()
+static uint8_t Bulk_RxGet(void)
+{
+	uint8_t value = 0;
+
+	// If the engine gave up on a bus fault or a stuck clock, the rest reads as zeros
+	TWIEngine_WaitFor(TWI_EVENT_RxData);
+	if (!RingBuffer_IsEmpty(&TWIEngine_RxRing)) {
+		value = RingBuffer_Remove(&TWIEngine_RxRing);
+		TWIEngine_Kick();
+	}
+
+	return value;
+}
+
+// The TWI interrupt fills the RX ring while we move its contents into the IN FIFO, in runs as long as the ring
+// contents and the IN bank space allow
+static void Bulk_TWIRead(uint16_t len, const uint8_t nack_last_byte)
+{
+	if (Bulk_Skip) {
+		while (len-- && !Bulk_Aborted)
+			Bulk_Write_8(0);
+		return;
+	}
+
+	TWIEngine_Read(len, nack_last_byte);
+
+	// Data of a posted command goes nowhere, and doesn't count as its status either
+	if (Bulk_Posted) {
+		while (len-- && !Bulk_Aborted)
+			Bulk_RxGet();
+		return;
+	}
+
+	while (len && !Bulk_Aborted) {
+		// If the engine gave up on a bus fault or a stuck clock, the rest reads as zeros
+		TWIEngine_WaitFor(TWI_EVENT_RxData);
+		uint8_t run = RingBuffer_GetCount(&TWIEngine_RxRing);
+		if (!run) {
+			Bulk_Write_8(0);
+			len--;
+			continue;
+		}
+
+		const uint8_t space = Bulk_WriteSpace();
+		if (run > space)
+			run = space;
+		if (run > len)
+			run = len;
+
+		TWIEngine_RxToEndpoint(run);
+		TWIEngine_Kick();
+		Bulk_WriteDone(run);
+
+		len -= run;
+	}
+}
+
+static void Bulk_I2CRead(uint16_t len, const uint8_t nack_last_byte)
+{
+	if (SOFTI2C_CHANNELS && Bulk_Channels) {
+		// Every byte is read on all channels at once and returned once per selected channel
+		while (len-- && !Bulk_Aborted) {
+			if (Bulk_SoftAcked)
+				SoftI2C_Read(Bulk_SoftAcked, nack_last_byte && !len);
+			for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+				if (Bulk_Channels & (1 << i))
+					Bulk_Write_8((Bulk_SoftAcked & (1 << i)) ? SoftI2C_Data[i] : 0);
+		}
+		return;
+	}
+
+	Bulk_TWIRead(len, nack_last_byte);
+}
+
+// A write longer than the engine can count is split into chunks as well, its data streaming in across as many OUT
+// packets as it takes; between chunks the bus just sees the usual gap between two bytes, no STOP or START
+static void Bulk_I2CWriteLong(uint32_t len)
+{
+	while (len && !Bulk_Aborted) {
+		const uint16_t chunk = (len > BULK_LONG_CHUNK) ? BULK_LONG_CHUNK : len;
+
+		len -= chunk;
+		Bulk_I2CWrite(chunk);
+	}
+}
+
+// A read longer than the engine can count is split into chunks; between chunks the bus just sees the usual
+// gap between two bytes
+static void Bulk_I2CReadLong(uint32_t len)
+{
+	while (len && !Bulk_Aborted) {
+		const uint16_t chunk = (len > BULK_LONG_CHUNK) ? BULK_LONG_CHUNK : len;
+
+		len -= chunk;
+		Bulk_I2CRead(chunk, !len);
+	}
+
+	Bulk_EndTransfer();
+}
+
+// Close the transfer so a host asking for more than it gets doesn't wait for the next response: a short packet, or
+// a zero length one if the data ended on a packet boundary. HID reports have no transfers to close.
+static void Bulk_EndTransfer(void)
+{
+	if (Bulk_InBytes) {
+		Bulk_Flush();
+	} else if (!Bulk_Aborted && !Bulk_Posted && !HID_SUPPORT) {
+		Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+		if (!Endpoint_IsINReady()) {
+			const Stats_Stamp_t waited = Stats_LatencyStart();
+
+			while (!Endpoint_IsINReady()) {
+				Watchdog_Kick();
+				if (Bulk_CheckDeviceGone())
+					return;
+			}
+			Stats_UsbWaitDone(waited);
+		}
+		Endpoint_ClearIN();
+		Stats_Count(&Stats.UsbPackets);
+		Sched_Charge();
+	}
+}
+
+static void Bulk_I2CStop(void)
+{
+	if (SOFTI2C_CHANNELS && Bulk_Channels) {
+		SoftI2C_Stop(Bulk_Channels);
+		Bulk_SoftAcked = 0;
+		return;
+	}
+
+	if (!Bulk_Skip && (I2C_BusOwner == BUS_OWNER_BULK)) {
+		TWIBus_Stop();
+		// Let the STOP go out before a following START can overwrite TWCR
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+	Bulk_Skip = false;
+}
+
+// Wait for a moment given as a USB frame number and an offset from its Start of Frame. All adapters on a host see
+// the same frame numbers, so batches scheduled for the same moment start together, to within the SOF jitter. A
+// moment that has passed already is late: the caller goes ahead right away. The last stretch of the wait opens a
+// quiet window, which the caller closes once the segment is done.
+static void Bulk_WaitUntil(const uint16_t frame, const uint16_t offset_us)
+{
+	const uint16_t offset = Timebase_UsToTicks(offset_us);
+	int16_t left          = Timebase_TicksUntil(frame, offset);
+
+	if (left < 0) {
+		const uint16_t late = (uint16_t)-left / TIMEBASE_TICKS_PER_MS;
+		Trace_Add(TRACE_LATE, (late > UINT8_MAX) ? UINT8_MAX : late);
+		return;
+	}
+
+	while ((Timebase_TicksUntil(frame, offset) > QUIET_LEAD_TICKS) && !Bulk_CheckDeviceGone())
+		;
+	Quiet_Begin();
+	while (((left = Timebase_TicksUntil(frame, offset)) > 0) && !Bulk_CheckDeviceGone())
+		;
+	Stats_TimedStart(-left);
+}
+
+// Respond to a segment left out as if it had run, so the host parses the response the same way, and drain its
+// write data without touching the bus; status is STATUS_IDLE after an earlier segment failed, STATUS_EXPIRED past
+// the deadline
+static void Bulk_BatchSkip(const uint8_t flags, const uint16_t len, const uint8_t status)
+{
+	if (flags & BATCH_FLAG_GPIO) {
+		Bulk_Write_8(0);
+		Bulk_Write_8(status);
+		return;
+	}
+
+	if (SOFTI2C_CHANNELS && Bulk_Channels) {
+		Bulk_SoftAcked = 0;
+		for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+			if (Bulk_Channels & (1 << i))
+				Bulk_Write_8(status);
+	} else {
+		Bulk_Write_8(status);
+	}
+
+	Bulk_Skip = true;
+	if (flags & BATCH_FLAG_RD)
+		Bulk_I2CRead(len, true);
+	else
+		Bulk_I2CWrite(len);
+	Bulk_Skip = false;
+
+	if (flags & BATCH_FLAG_DETAIL)
+		Bulk_BatchDetail(status);
+}
+
+// Set the deadline of the next BATCH: a 16-bit USB frame number, of which the low 11 bits count, and a 16-bit
+// offset in us after its Start of Frame
+static void Bulk_Deadline(void)
+{
+	Bulk_DeadlineFrame  = Bulk_Read_16();
+	Bulk_DeadlineOffset = Timebase_UsToTicks(Bulk_Read_16());
+	Bulk_DeadlineSet    = true;
+}
+
+// Bring on the SYNC edge an armed BATCH starts on, right before its first START so that nothing but the START
+// itself lies between the edge and the bus
+static bool Bulk_SyncStart(void)
+{
+	const bool fired = Sync_Fire(Bulk_SyncTimeout);
+
+	Bulk_SyncArmed = false;
+	Trace_Add(TRACE_SYNC, !fired);
+	return fired;
+}
+
+// Have the next command run posted, arg: tag byte. The host doesn't wait for a response that never comes, so the
+// commands after it go out right away; a failure shows up later, as POST_FAILED and POST_STATUS events and in the
+// POST_STATUS response.
+static void Bulk_Post(void)
+{
+	Bulk_PostTag   = Bulk_Read_8();
+	Bulk_PostArmed = true;
+}
+
+// Done with a posted command: it failed if its status, the last byte of its response, is anything but an ACK.
+// Commands without a response can't fail.
+static void Bulk_PostDone(void)
+{
+	const uint8_t status = Bulk_PostLast;
+
+	Bulk_Posted = false;
+	if (status == STATUS_ADDRESS_ACK)
+		return;
+
+	Trace_Add(TRACE_POST_FAILED, Bulk_PostTag);
+	Events_Push(EVENT_POST_FAILED, Bulk_PostTag);
+	Events_Push(EVENT_POST_STATUS, status);
+
+	if (!Bulk_PostFailures.Failures) {
+		Bulk_PostFailures.Tag    = Bulk_PostTag;
+		Bulk_PostFailures.Status = status;
+	}
+	if (Bulk_PostFailures.Failures != 0xFF)
+		Bulk_PostFailures.Failures++;
+}
+
+// Report and clear the failures of posted commands since the last POST_STATUS; commands complete in order, so
+// this covers everything posted before it
+static void Bulk_PostReport(void)
+{
+	Bulk_Write_8(Bulk_PostFailures.Failures);
+	Bulk_Write_8(Bulk_PostFailures.Tag);
+	Bulk_Write_8(Bulk_PostFailures.Status);
+	memset(&Bulk_PostFailures, 0, sizeof(Bulk_PostFailures));
+}
+
+// Append a frame stamp to the response, as in trace and poll records: the frame count and the Timer1 ticks into it
+static void Bulk_WriteStamp(const uint16_t frame, const uint8_t subframe)
+{
+	Bulk_Write_8(frame & 0xFF);
+	Bulk_Write_8(frame >> 8);
+	Bulk_Write_8(subframe);
+}
+
+// Execute a whole i2c_msg style array; each segment contributes its status byte plus read data to the response.
+// A failed segment with a BATCH_ON_FAIL policy ends its transaction right away and has the segments after it
+// skipped, up to the end of the transaction or of the batch, so an absent target costs only its address phase.
+// Past the deadline of a DEADLINE command no more transactions start: the rest of the batch expires instead, so
+// work the host has given up on doesn't hold up what it sent after. A batch armed by a SYNC command that sees no
+// edge expires the same way. A batch armed by a STAMPS command follows each segment's response with the frame stamps
+// of when it started, right before its START, and of when it was done, after its STOP if it ended the transaction;
+// those of skipped segments are zeros.
+static void Bulk_Batch(void)
+{
+	const bool stamps = Bulk_StampsArmed;
+	uint8_t count = Bulk_Read_8();
+	uint8_t skip = 0;
+	uint8_t skip_status = STATUS_IDLE;
+	uint8_t failed = STATUS_ADDRESS_ACK;
+	bool fresh = true;
+
+	Bulk_StampsArmed = false;
+
+	while (count-- && !Bulk_Aborted) {
+		const uint8_t flags   = Bulk_Read_8();
+		const uint8_t address = Bulk_Read_8();
+		const uint16_t len    = Bulk_Read_16();
+
+		if (flags & BATCH_FLAG_AT) {
+			const uint16_t frame = Bulk_Read_16();
+			// Skipped segments don't wait for their moment
+			if (!skip)
+				Bulk_WaitUntil(frame, Bulk_Read_16());
+			else
+				Bulk_Read_16();
+		}
+
+		if (Bulk_SyncArmed && !Bulk_SyncStart()) {
+			skip = BATCH_ON_FAIL_ABORT;
+			skip_status = STATUS_EXPIRED;
+			failed = STATUS_EXPIRED;
+		}
+
+		// Only checked at the start of the batch and of each transaction, one under way is never cut short
+		if (fresh && !skip && Bulk_DeadlineSet && (Timebase_TicksUntil(Bulk_DeadlineFrame, Bulk_DeadlineOffset) < 0)) {
+			Trace_Add(TRACE_EXPIRED, count + 1);
+			skip = BATCH_ON_FAIL_ABORT;
+			skip_status = STATUS_EXPIRED;
+			if (failed == STATUS_ADDRESS_ACK)
+				failed = STATUS_EXPIRED;
+		}
+		fresh = false;
+
+		const bool ran = !skip;
+		uint8_t started_subframe = 0;
+		const uint16_t started = (stamps && ran) ? Timebase_FrameStamp(&started_subframe) : 0;
+
+		if (skip) {
+			Bulk_BatchSkip(flags, len, skip_status);
+		} else if (flags & BATCH_FLAG_GPIO) {
+			// A GPIO segment runs between I2C segments without touching the bus
+			Bulk_Gpio(address, len);
+		} else {
+			const uint8_t status = Bulk_I2CStart((flags & BATCH_FLAG_TEN) ?
+			                                     TWI_ENGINE_TEN(((flags & BATCH_FLAG_TEN_HIGH) << 3) | address, flags & BATCH_FLAG_RD) :
+			                                     (address << 1) | (flags & BATCH_FLAG_RD));
+
+			if (flags & BATCH_FLAG_RD)
+				Bulk_I2CRead(len, true);
+			else
+				Bulk_I2CWrite(len);
+
+			if (flags & BATCH_FLAG_DETAIL)
+				Bulk_BatchDetail(status);
+
+			const uint8_t policy = (flags & BATCH_FLAG_TEN) ? 0 : (flags & BATCH_ON_FAIL);
+			const uint8_t data_failed = !(SOFTI2C_CHANNELS && Bulk_Channels) && (TWIEngine.Result != TWI_ERROR_NoError);
+			if (policy && ((status != STATUS_ADDRESS_ACK) || data_failed)) {
+				Bulk_I2CStop();
+				skip = policy;
+			}
+			if ((failed == STATUS_ADDRESS_ACK) && (status != STATUS_ADDRESS_ACK))
+				failed = status;
+			else if ((failed == STATUS_ADDRESS_ACK) && data_failed)
+				failed = Bulk_DataStatus();
+		}
+		Quiet_End();
+
+		// A locked bus keeps the last segment open, the next batch continues with a repeated START. A skipping
+		// transaction has had its STOP already, and the skipping ends with it unless the whole batch is aborted.
+		if ((!count && !Bulk_LockTimeout) || (flags & BATCH_FLAG_STOP)) {
+			if (!skip)
+				Bulk_I2CStop();
+			else if (!(skip & BATCH_ON_FAIL_ABORT))
+				skip = 0;
+			fresh = true;
+		}
+
+		if (stamps) {
+			uint8_t done_subframe = 0;
+			const uint16_t done = ran ? Timebase_FrameStamp(&done_subframe) : 0;
+			Bulk_WriteStamp(started, started_subframe);
+			Bulk_WriteStamp(done, done_subframe);
+		}
+	}
+
+	// A batch without segments just has the edge, e.g. to trigger polling on the other adapters
+	if (Bulk_SyncArmed)
+		Bulk_SyncStart();
+	Bulk_DeadlineSet = false;
+
+	// Posted, the batch failed if any of its I2C segments did, not just the last one
+	Bulk_PostLast = failed;
+
+	// One batch, one response
+	Bulk_Flush();
+}
+
+// Take the bus lock: until BULK_OP_LOCK with a timeout of 0, or until the host hasn't sent a command packet for
+// that many milliseconds, no other path of the adapter gets the bus, and batches don't end with a STOP. A
+// read-modify-write thus goes out as batches joined by repeated STARTs without waiting for each response.
+static void Bulk_Lock(void)
+{
+	const uint16_t timeout_ms = Bulk_Read_16();
+	uint8_t status = STATUS_ADDRESS_ACK;
+
+	if (!timeout_ms) {
+		Bulk_Unlock(0);
+	} else if (I2C_ClaimBus(BUS_OWNER_BULK)) {
+		Bulk_LockTimeout = timeout_ms;
+		Bulk_LockFrame   = Timebase_GetFrame();
+		Trace_Add(TRACE_LOCK, 1);
+	} else {
+		status = STATUS_BUS_BUSY;
+	}
+
+	Bulk_Write_8(status);
+}
+
+// Drop the bus lock, ending the transaction it left open; reason is the TRACE_LOCK argument
+static void Bulk_Unlock(const uint8_t reason)
+{
+	if (!Bulk_LockTimeout)
+		return;
+
+	Bulk_LockTimeout = 0;
+	Bulk_MergeClose();
+	Bulk_I2CStop();
+
+	// The last START may have failed, or the transaction was on the bit-banged channels
+	if (I2C_BusOwner == BUS_OWNER_BULK)
+		I2C_ReleaseBus();
+	Trace_Add(TRACE_LOCK, reason);
+}
+
+// Address an EEPROM until it ACKs; while it is busy with an internal write cycle it doesn't respond at all
+static uint8_t Bulk_EEPROMPoll(const uint8_t address)
+{
+	const uint16_t started = Timebase_Now();
+	uint8_t status;
+
+	do {
+		status = Bulk_Address(address);
+		if (status != STATUS_ADDRESS_NAK)
+			break;
+
+		// Let the STOP that went out after the NAK finish before trying again
+		TWIBus_WaitStop();
+	} while (Timebase_Elapsed(started) < Timebase_MsToTicks(EEPROM_WRITE_TIMEOUT_MS));
+
+	return status;
+}
+
+// Address byte of the block an offset lies in, with the EEPROM_FMT_BLOCKS bits of the offset above the memory
+// address bytes in the low bits of the 7-bit address
+static uint8_t Bulk_EEPROMDevice(const uint8_t address, const uint8_t format, const uint32_t offset)
+{
+	const uint8_t width = format & EEPROM_FMT_WIDTH;
+	const uint8_t mask  = (1 << ((format & EEPROM_FMT_BLOCKS) >> EEPROM_FMT_BLOCKS_SHIFT)) - 1;
+
+	return address | (((uint8_t)(offset >> (8 * width)) & mask) << 1);
+}
+
+// Bytes from an offset up to the end of its block, for formats with block-select bits; without any, the memory
+// address just goes on counting
+static uint32_t Bulk_EEPROMBlockLeft(const uint8_t format, const uint32_t offset)
+{
+	if (!(format & EEPROM_FMT_BLOCKS))
+		return UINT32_MAX;
+
+	const uint32_t block = 1UL << (8 * (format & EEPROM_FMT_WIDTH));
+	return block - (offset & (block - 1));
+}
+
+// Point an EEPROM at an offset and turn the bus around with a (repeated) START for reading from there, returning
+// the status; a memory address width of 0 leaves the target's pointer where it is
+static uint8_t Bulk_EEPROMSelect(const uint8_t address, const uint8_t format, const uint32_t offset)
+{
+	const uint8_t device = Bulk_EEPROMDevice(address, format, offset);
+	const uint8_t width  = format & EEPROM_FMT_WIDTH;
+	uint8_t status       = STATUS_ADDRESS_ACK;
+
+	if (width) {
+		status = Bulk_Address(device);
+		if (status == STATUS_ADDRESS_ACK) {
+			TWIEngine_Write(width);
+			if (width > 1)
+				Bulk_TxPut(offset >> 8);
+			Bulk_TxPut(offset & 0xFF);
+			TWIEngine_WaitFor(TWI_EVENT_Idle);
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+		}
+	}
+
+	if (status == STATUS_ADDRESS_ACK)
+		status = Bulk_Address(device | I2C_M_RD);
+
+	return status;
+}
+
+// Address the EEPROMs on the given bit-banged channels until each ACKs, with a STOP after every NAK. Channels whose
+// EEPROM ACKed wait for the others with SCL held low, addressed for writing.
+// @return Mask of the channels whose EEPROM ACKed within the write cycle timeout
+static uint8_t Bulk_EEPROMGangPoll(const uint8_t channels, const uint8_t device)
+{
+	const uint16_t started = Timebase_Now();
+	uint8_t acked          = 0;
+
+	for (;;) {
+		acked |= SoftI2C_Start(channels & ~acked, device);
+
+		const uint8_t busy = channels & ~acked;
+		if (!busy)
+			break;
+		SoftI2C_Stop(busy);
+		if (Timebase_Elapsed(started) >= Timebase_MsToTicks(EEPROM_WRITE_TIMEOUT_MS))
+			break;
+	}
+
+	return acked;
+}
+
+// EEPROM on the selected bit-banged channels: the same data goes into one EEPROM per channel, each page to all of
+// them in lockstep and each write cycle polled on all of them at once, so the command takes as long for four slots
+// as for one. A channel whose EEPROM times out or NAKs drops out for the rest of the data, the others go on. The
+// response is a status byte per selected channel, lowest channel first.
+static void Bulk_EEPROMGangWrite(const uint8_t address, const uint8_t format, const uint16_t page_size,
+                                 uint32_t offset, uint16_t len)
+{
+	const uint8_t addr_width = format & EEPROM_FMT_WIDTH;
+	uint8_t good             = Bulk_Channels;
+	uint8_t device           = address;
+
+	while (len && !Bulk_Aborted) {
+		uint16_t chunk = page_size - (offset % page_size);
+		if (chunk > len)
+			chunk = len;
+
+		// As on the TWI bus, this also polls the previous page's write cycle
+		device = Bulk_EEPROMDevice(address, format, offset);
+		if (good)
+			good = Bulk_EEPROMGangPoll(good, device);
+
+		const uint8_t started = good;
+		if (good && (addr_width > 1))
+			good = SoftI2C_Write(good, offset >> 8);
+		if (good)
+			good = SoftI2C_Write(good, offset & 0xFF);
+
+		// A write protected EEPROM NAKs the data; the data is read all the same, for the other channels or to skip it
+		for (uint16_t i = 0; i < chunk; i++) {
+			const uint8_t value = Bulk_Read_8();
+			if (good)
+				good = SoftI2C_Write(good, value);
+		}
+
+		if (started)
+			SoftI2C_Stop(started);
+
+		offset += chunk;
+		len    -= chunk;
+
+		Control_Preempt();
+	}
+
+	if (good && !Bulk_Aborted) {
+		good = Bulk_EEPROMGangPoll(good, device);
+		if (good)
+			SoftI2C_Stop(good);
+	}
+
+	for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+		if (Bulk_Channels & (1 << i))
+			Bulk_Write_8((good & (1 << i)) ? STATUS_ADDRESS_ACK : STATUS_ADDRESS_NAK);
+}
+
+// Write a data stream to a 24Cxx style EEPROM: split it at page boundaries and ACK poll for each write cycle,
+// including the last one, so that the single status byte in the response means the data is actually stored. With
+// block-select bits a page boundary may also be a block boundary, and the next page goes to the next block's address.
+static void Bulk_EEPROMWrite(void)
+{
+	const uint8_t address    = Bulk_Read_8() << 1;
+	const uint8_t format     = Bulk_Read_8();
+	const uint8_t addr_width = format & EEPROM_FMT_WIDTH;
+	uint16_t page_size       = Bulk_Read_16();
+	uint32_t offset          = Bulk_Read_16();
+	uint16_t len             = Bulk_Read_16();
+	uint8_t status           = STATUS_ADDRESS_ACK;
+	uint8_t device           = address;
+
+	if (!page_size)
+		page_size = 1;
+
+	// Writes need a memory address of 1 or 2 bytes; any other width would have the engine wait for bytes that never
+	// come, or send the offset as data
+	if (!addr_width || (addr_width > 2)) {
+		Bulk_Skip = true;
+		Bulk_TxStream(len);
+		Bulk_Skip = false;
+
+		if (SOFTI2C_CHANNELS && Bulk_Channels) {
+			for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+				if (Bulk_Channels & (1 << i))
+					Bulk_Write_8(STATUS_COUNT_ERROR);
+		} else {
+			Bulk_Write_8(STATUS_COUNT_ERROR);
+		}
+		return;
+	}
+
+	if (SOFTI2C_CHANNELS && Bulk_Channels) {
+		Bulk_EEPROMGangWrite(address, format, page_size, offset, len);
+		return;
+	}
+
+	while (len && !Bulk_Aborted) {
+		uint16_t chunk = page_size - (offset % page_size);
+		if (chunk > len)
+			chunk = len;
+
+		// The chip answers to all of its block addresses, so this also polls the previous page's write cycle
+		device = Bulk_EEPROMDevice(address, format, offset);
+		if (status == STATUS_ADDRESS_ACK)
+			status = Bulk_EEPROMPoll(device);
+
+		Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+		if (!Bulk_Skip) {
+			TWIEngine_Write(addr_width + chunk);
+			if (addr_width > 1)
+				Bulk_TxPut(offset >> 8);
+			Bulk_TxPut(offset & 0xFF);
+		}
+
+		Bulk_TxStream(chunk);
+
+		if (!Bulk_Skip) {
+			// A write protected EEPROM NAKs the data
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+			Bulk_I2CStop();
+		}
+
+		offset += chunk;
+		len    -= chunk;
+
+		// The write cycle takes milliseconds, time enough for a request from the host
+		Control_Preempt();
+	}
+
+	// Wait for the last write cycle to finish too
+	if ((status == STATUS_ADDRESS_ACK) && !Bulk_Aborted) {
+		status = Bulk_EEPROMPoll(device);
+		if (status == STATUS_ADDRESS_ACK) {
+			Bulk_Skip = false;
+			Bulk_I2CStop();
+		}
+	}
+
+	Bulk_Skip = false;
+	Bulk_Write_8(status);
+}
+
+// Dump a range of an EEPROM with a single command: the arguments are those of CHECKSUM with a 32-bit offset, and
+// with block-select bits the firmware addresses each block anew as the read gets there. The response is the data,
+// zeros from wherever something went wrong, and a status byte as for CHECKSUM; it ends the transfer as READ_LONG does.
+static void Bulk_EEPROMRead(void)
+{
+	const uint8_t address = Bulk_Read_8() << 1;
+	const uint8_t format  = Bulk_Read_8();
+	uint16_t low          = Bulk_Read_16();
+	uint32_t offset       = low | ((uint32_t)Bulk_Read_16() << 16);
+	low                   = Bulk_Read_16();
+	uint32_t len          = low | ((uint32_t)Bulk_Read_16() << 16);
+	uint8_t status;
+
+	if (Bulk_Aborted)
+		return;
+
+	if (((format & EEPROM_FMT_WIDTH) > 2) || ((format & EEPROM_FMT_BLOCKS) && !(format & EEPROM_FMT_WIDTH)))
+		status = STATUS_COUNT_ERROR;
+	else if (!Bulk_ClaimIdle())
+		status = STATUS_BUS_BUSY;
+	else
+		status = Bulk_EEPROMSelect(address, format, offset);
+
+	Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+	while (len && !Bulk_Aborted) {
+		const uint32_t left = Bulk_EEPROMBlockLeft(format, offset);
+		uint32_t chunk      = (len < left) ? len : left;
+		if (chunk > BULK_LONG_CHUNK)
+			chunk = BULK_LONG_CHUNK;
+
+		len    -= chunk;
+		offset += chunk;
+		const bool next_block = len && (chunk == left);
+
+		Bulk_TWIRead(chunk, !len || next_block);
+		if (!Bulk_Skip) {
+			TWIEngine_WaitFor(TWI_EVENT_Idle);
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+			else if (next_block)
+				status = Bulk_EEPROMSelect(address, format, offset);
+			Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+		}
+	}
+
+	// As for CHECKSUM, a NAKed address has already released the bus
+	if ((status != STATUS_BUS_BUSY) && (status != STATUS_COUNT_ERROR) && (I2C_BusOwner == BUS_OWNER_BULK)) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+
+	Bulk_Skip = false;
+	Bulk_Write_8(status);
+	Bulk_EndTransfer();
+}
+
+// Wait for a bootloader to finish a block: address it until it ACKs and, with a nonzero mask, read its status
+// register until the bits in mask equal value. Anything but an ACK, or running out of time, ends the wait; the
+// bus is let go in any case.
+static uint8_t Bulk_ProgramPoll(const uint8_t address, const uint8_t reg, const uint8_t mask, const uint8_t value,
+                                const uint16_t timeout)
+{
+	const uint16_t started = Timebase_Now();
+	uint8_t status;
+
+	do {
+		status = mask ? Bulk_RegSelect(address, reg) : Bulk_Address(address);
+		if (status == STATUS_BUS_BUSY)
+			break;
+
+		if ((status == STATUS_ADDRESS_ACK) && mask) {
+			TWIEngine_Read(1, true);
+			const uint8_t reading = Bulk_RxGet();
+			TWIEngine_WaitFor(TWI_EVENT_Idle);
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+			else if ((reading & mask) != value)
+				status = STATUS_ADDRESS_NAK;
+		}
+
+		// A NAKed address has let go of the bus already, but its STOP may still be going out
+		if (I2C_BusOwner == BUS_OWNER_BULK)
+			TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+
+		// Busy bootloaders tend to drop off the bus, or NAK the register byte
+		if (status != STATUS_ADDRESS_NAK)
+			break;
+		Control_Preempt();
+	} while (Timebase_Elapsed(started) < timeout);
+
+	return status;
+}
+
+// Program a target MCU through its I2C bootloader: cut the data stream into fixed size blocks, padding the last
+// one with 0xFF, send each as one write led by the command byte and memory address of PROGRAM_FMT_*, and wait for
+// the bootloader to be done with it before sending the next, by ACK polling or by polling a status register. The
+// response counts the blocks that went through, so after a failure the host knows where to pick up.
+static void Bulk_Program(void)
+{
+	const uint8_t address    = Bulk_Read_8() << 1;
+	const uint8_t format     = Bulk_Read_8();
+	const uint8_t command    = Bulk_Read_8();
+	uint16_t block_size      = Bulk_Read_16();
+	uint16_t low             = Bulk_Read_16();
+	uint32_t target          = low | ((uint32_t)Bulk_Read_16() << 16);
+	low                      = Bulk_Read_16();
+	uint32_t len             = low | ((uint32_t)Bulk_Read_16() << 16);
+	const uint8_t poll_reg   = Bulk_Read_8();
+	const uint8_t poll_mask  = Bulk_Read_8();
+	const uint8_t poll_value = Bulk_Read_8();
+	const uint8_t timeout_ms = Bulk_Read_8();
+	const uint8_t width      = (format & PROGRAM_FMT_WIDTH);
+	const uint8_t prefix     = width + ((format & PROGRAM_FMT_CMD) ? 1 : 0);
+	const uint16_t timeout   = Timebase_MsToTicks(timeout_ms ? timeout_ms : EEPROM_WRITE_TIMEOUT_MS);
+	uint16_t blocks          = 0;
+	uint8_t status           = STATUS_ADDRESS_ACK;
+
+	// The data still has to be drained
+	if ((width > 4) || !block_size) {
+		status     = STATUS_COUNT_ERROR;
+		block_size = VENDOR_IO_EPSIZE;
+	}
+
+	while (len && !Bulk_Aborted) {
+		const uint16_t chunk = (len > block_size) ? block_size : len;
+
+		if (status == STATUS_ADDRESS_ACK)
+			status = Bulk_Address(address);
+
+		Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+		if (!Bulk_Skip) {
+			TWIEngine_Write(prefix + block_size);
+			if (format & PROGRAM_FMT_CMD)
+				Bulk_TxPut(command);
+			for (uint8_t i = 0; i < width; i++) {
+				const uint8_t shift = (format & PROGRAM_FMT_LE) ? (i * 8) : ((width - 1 - i) * 8);
+				Bulk_TxPut(target >> shift);
+			}
+		}
+
+		Bulk_TxStream(chunk);
+
+		if (!Bulk_Skip && !Bulk_Aborted) {
+			for (uint16_t i = chunk; i < block_size; i++)
+				Bulk_TxPut(0xFF);
+			TWIEngine_WaitFor(TWI_EVENT_Idle);
+
+			// A bootloader that doesn't like the block NAKs it
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+			TWIBus_Stop();
+			TWIBus_WaitStop();
+			Bulk_ReleaseBus();
+
+			if (status == STATUS_ADDRESS_ACK)
+				status = Bulk_ProgramPoll(address, poll_reg, poll_mask, poll_value, timeout);
+			if (status == STATUS_ADDRESS_ACK)
+				blocks++;
+		}
+
+		target += (format & PROGRAM_FMT_BLOCKS) ? 1 : block_size;
+		len    -= chunk;
+
+		// Erasing and writing a flash page takes milliseconds, time enough for a request from the host
+		Control_Preempt();
+	}
+
+	Bulk_Skip = false;
+	Bulk_Write_8(blocks & 0xFF);
+	Bulk_Write_8(blocks >> 8);
+	Bulk_Write_8(status);
+}
+
+// Run one SMBus transaction: write command code (plus byte count) and data, then optionally a repeated START and
+// a read, with the PEC generated or checked on the fly. The status byte goes last since the PEC can only be
+// checked once all data is in; the response is the byte count for block reads, the read data and the status.
+static void Bulk_SMBus(void)
+{
+	const uint8_t flags   = Bulk_Read_8();
+	const uint8_t address = Bulk_Read_8() << 1;
+	const uint8_t command = Bulk_Read_8();
+	uint8_t wcount        = Bulk_Read_8();
+	const bool pec        = (flags & SMBUS_FLAG_PEC);
+	const bool block_wr   = (flags & SMBUS_FLAG_BLOCK_WR);
+	uint8_t crc           = 0;
+	uint8_t status;
+
+	status = Bulk_Address(address);
+	Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+
+	if (!Bulk_Skip) {
+		// The read count follows the data, so the PEC of a write-only transaction is sent separately below
+		TWIEngine_Write(1 + block_wr + wcount);
+		crc = CRC8_Update(crc, address);
+		crc = CRC8_Update(crc, command);
+		Bulk_TxPut(command);
+		if (block_wr) {
+			crc = CRC8_Update(crc, wcount);
+			Bulk_TxPut(wcount);
+		}
+	}
+
+	while (wcount-- && !Bulk_Aborted) {
+		const uint8_t value = Bulk_Read_8();
+		if (!Bulk_Skip) {
+			crc = CRC8_Update(crc, value);
+			Bulk_TxPut(value);
+		}
+	}
+
+	const uint8_t rcount  = Bulk_Read_8();
+	const bool block_rd   = (flags & SMBUS_FLAG_BLOCK_RD) && rcount;
+
+	if (Bulk_Aborted)
+		return;
+
+	if (!Bulk_Skip) {
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result != TWI_ERROR_NoError)
+			status = Bulk_DataStatus();
+	}
+
+	if ((status == STATUS_ADDRESS_ACK) && pec && !rcount) {
+		TWIEngine_Write(1);
+		Bulk_TxPut(crc);
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result == TWI_ENGINE_ERROR_StretchTimeout)
+			status = STATUS_STRETCH_TIMEOUT;
+		else if (TWIEngine.Result != TWI_ERROR_NoError)
+			status = STATUS_PEC_ERROR;
+	}
+
+	if (rcount) {
+		uint8_t count = rcount;
+
+		if (status == STATUS_ADDRESS_ACK) {
+			status = Bulk_Address(address | I2C_M_RD);
+			crc = CRC8_Update(crc, address | I2C_M_RD);
+		}
+		Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+
+		if (block_rd) {
+			if (!Bulk_Skip) {
+				TWIEngine_Read(1, false);
+				count = Bulk_RxGet();
+				crc = CRC8_Update(crc, count);
+				if (!count || (count > rcount)) {
+					// Read one more byte to be able to NACK it, and give up
+					TWIEngine_Read(1, true);
+					Bulk_RxGet();
+					status = STATUS_COUNT_ERROR;
+					Bulk_Skip = true;
+				}
+			}
+			Bulk_Write_8(Bulk_Skip ? 0 : count);
+		}
+
+		if (!Bulk_Skip)
+			TWIEngine_Read(count + pec, true);
+
+		for (uint8_t i = 0; i < rcount; i++) {
+			uint8_t value = 0;
+			if (!Bulk_Skip && (i < count)) {
+				value = Bulk_RxGet();
+				crc = CRC8_Update(crc, value);
+			}
+			Bulk_Write_8(value);
+		}
+
+		if (!Bulk_Skip) {
+			if (pec && (Bulk_RxGet() != crc))
+				status = STATUS_PEC_ERROR;
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+		}
+	}
+
+	Bulk_Skip = false;
+	Bulk_I2CStop();
+	Bulk_Write_8(status);
+}
+
+// Finish a REGWRITE left open for merging
+static void Bulk_MergeClose(void)
+{
+	if (!Bulk_MergeOpen)
+		return;
+
+	Bulk_MergeOpen = false;
+	if (I2C_BusOwner == BUS_OWNER_BULK) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+}
+
+// Verified REGWRITE: write the registers, read them back after a repeated START and compare them here, so the
+// host needs no read of its own. The data is buffered for the comparison; more than the arena holds is a count
+// error and isn't written. The response is the offset of the first register that read back differently, 0xFF if
+// none did or the comparison didn't run, and a status byte, STATUS_VERIFY_ERROR for a mismatch.
+static void Bulk_RegVerify(const uint8_t address, const uint8_t reg, const uint8_t count)
+{
+	uint8_t mismatch = 0xFF;
+	uint8_t status = STATUS_ADDRESS_ACK;
+
+	Bulk_MergeClose();
+	Arena_Reset();
+	uint8_t* const data = Arena_Alloc(count);
+	if (!data)
+		status = STATUS_COUNT_ERROR;
+
+	// Drained either way so the command stream stays in sync
+	for (uint8_t i = 0; i < count; i++) {
+		const uint8_t value = Bulk_Read_8();
+		if (data)
+			data[i] = value;
+	}
+
+	if (Bulk_Aborted)
+		return;
+
+	if (status == STATUS_ADDRESS_ACK)
+		status = Bulk_Address(address << 1);
+	if (status == STATUS_ADDRESS_ACK) {
+		TWIEngine_Write(count + 1);
+		Bulk_TxPut(reg);
+		for (uint8_t i = 0; i < count; i++)
+			Bulk_TxPut(data[i]);
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result != TWI_ERROR_NoError)
+			status = Bulk_DataStatus();
+	}
+
+	if (status == STATUS_ADDRESS_ACK)
+		status = Bulk_RegSelect(address << 1, reg);
+	if ((status == STATUS_ADDRESS_ACK) && count) {
+		TWIEngine_Read(count, true);
+		for (uint8_t i = 0; i < count; i++) {
+			const uint8_t value = Bulk_RxGet();
+			if ((value != data[i]) && (mismatch == 0xFF))
+				mismatch = i;
+		}
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result != TWI_ERROR_NoError) {
+			status = Bulk_DataStatus();
+			mismatch = 0xFF;
+		} else if (mismatch != 0xFF) {
+			status = STATUS_VERIFY_ERROR;
+		}
+	}
+
+	// A NAKed address has already released the bus, anything else gets its STOP now
+	if (I2C_BusOwner == BUS_OWNER_BULK) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+	Bulk_Write_8(mismatch);
+	Bulk_Write_8(status);
+}
+
+// Write a run of registers. For targets flagged TARGET_FLAG_AUTOINC the transaction is left open, and a following
+// REGWRITE to the same target that starts right after the last register is sent on as more data of the same
+// write, saving the STOP, START, address and register bytes. Anything else closes it first. Bit 7 of the address
+// byte asks for a verified write instead, see Bulk_RegVerify().
+static void Bulk_RegWrite(void)
+{
+	const uint8_t flags   = Bulk_Read_8();
+	const uint8_t address = flags & 0x7F;
+	const uint8_t reg     = Bulk_Read_8();
+	const uint8_t count   = Bulk_Read_8();
+	uint8_t status = STATUS_ADDRESS_ACK;
+
+	if (flags & BULK_REGWRITE_VERIFY) {
+		Bulk_RegVerify(address, reg, count);
+		return;
+	}
+
+	if (Bulk_MergeOpen && (address == Bulk_MergeAddress) && (reg == Bulk_MergeNextReg)) {
+		TWIEngine_Write(count);
+	} else {
+		Bulk_MergeClose();
+		status = Bulk_Address(address << 1);
+		if (status == STATUS_ADDRESS_ACK) {
+			TWIEngine_Write(count + 1);
+			Bulk_TxPut(reg);
+		}
+	}
+
+	// The data is drained either way so the command stream stays in sync
+	Bulk_Skip = (status != STATUS_ADDRESS_ACK);
+	Bulk_TxStream(count);
+	Bulk_Skip = false;
+
+	if ((status == STATUS_ADDRESS_ACK) && (TWIEngine.Result != TWI_ERROR_NoError))
+		status = Bulk_DataStatus();
+	Bulk_Write_8(status);
+
+	if (Bulk_Aborted)
+		return;
+
+	if ((status == STATUS_ADDRESS_ACK) && (TargetConfig_GetFlags(address) & TARGET_FLAG_AUTOINC)) {
+		Bulk_MergeOpen    = true;
+		Bulk_MergeAddress = address;
+		Bulk_MergeNextReg = reg + count;
+	} else if (I2C_BusOwner == BUS_OWNER_BULK) {
+		// A NAKed address has already released the bus, anything else gets its STOP now
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+}
+
+// Write the register pointer of a TWI target and address it for reading after a repeated START, returning the
+// resulting status; the bus stays ours after a data phase problem, so the caller's STOP ends the transaction
+static uint8_t Bulk_RegSelect(const uint8_t address, const uint8_t reg)
+{
+	uint8_t status = Bulk_Address(address);
+
+	if (status == STATUS_ADDRESS_ACK) {
+		TWIEngine_Write(1);
+		Bulk_TxPut(reg);
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result != TWI_ERROR_NoError)
+			status = Bulk_DataStatus();
+	}
+
+	if (status == STATUS_ADDRESS_ACK)
+		status = Bulk_Address(address | I2C_M_RD);
+	return status;
+}
+
+// Change some bits of a register without a round trip to the host: write the register pointer, read the register
+// after a repeated START, and write it back with the bits in mask taken from value, all without letting go of the
+// bus. Setting bits is mask = value = bits, clearing them mask = bits and value = 0. The response is the old
+// register value, 0 if it couldn't be read, and a status byte; a failed step skips the rest.
+static void Bulk_RegUpdate(void)
+{
+	const uint8_t address = Bulk_Read_8() << 1;
+	const uint8_t reg     = Bulk_Read_8();
+	const uint8_t mask    = Bulk_Read_8();
+	const uint8_t value   = Bulk_Read_8();
+	uint8_t old = 0;
+	uint8_t status;
+
+	if (Bulk_Aborted)
+		return;
+
+	status = Bulk_RegSelect(address, reg);
+	if (status == STATUS_ADDRESS_ACK) {
+		TWIEngine_Read(1, true);
+		old = Bulk_RxGet();
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result != TWI_ERROR_NoError)
+			status = Bulk_DataStatus();
+	}
+
+	if (status == STATUS_ADDRESS_ACK)
+		status = Bulk_Address(address);
+	if (status == STATUS_ADDRESS_ACK) {
+		TWIEngine_Write(2);
+		Bulk_TxPut(reg);
+		Bulk_TxPut((old & ~mask) | (value & mask));
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result != TWI_ERROR_NoError)
+			status = Bulk_DataStatus();
+	}
+
+	// A NAKed address has already released the bus, anything else gets its STOP now
+	if (I2C_BusOwner == BUS_OWNER_BULK) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+	Bulk_Write_8(old);
+	Bulk_Write_8(status);
+}
+
+// Write the same data to a list of targets, e.g. a row of identical sensors getting their configuration block.
+// The arguments are the target count, that many 7-bit addresses, a 16-bit length and the data, which is buffered
+// so it can go out to one target after the other, each in a transaction of its own. The response is a bitmap of
+// the targets that ACKed their address and all data, first target in bit 0, and a status byte: ACK if all did, NAK
+// if not, bus busy if the bus couldn't be had, and count error for too many targets or too much data, in which case
+// nothing is written.
+static void Bulk_MultiWrite(void)
+{
+	uint8_t addresses[MULTIWRITE_MAX_TARGETS];
+	const uint8_t count = Bulk_Read_8();
+	uint16_t acked = 0;
+	uint8_t status = STATUS_ADDRESS_ACK;
+
+	for (uint8_t i = 0; i < count; i++) {
+		const uint8_t address = Bulk_Read_8();
+		if (i < MULTIWRITE_MAX_TARGETS)
+			addresses[i] = address;
+	}
+
+	const uint16_t len = Bulk_Read_16();
+
+	Arena_Reset();
+	uint8_t* const data = (len <= MULTIWRITE_MAX_LENGTH) ? Arena_Alloc(len) : NULL;
+	if (!data || (count > MULTIWRITE_MAX_TARGETS))
+		status = STATUS_COUNT_ERROR;
+
+	// Drained either way so the command stream stays in sync
+	for (uint16_t i = 0; i < len; i++) {
+		const uint8_t value = Bulk_Read_8();
+		if (status == STATUS_ADDRESS_ACK)
+			data[i] = value;
+	}
+
+	if (Bulk_Aborted)
+		return;
+
+	for (uint8_t i = 0; (i < count) && (status != STATUS_COUNT_ERROR); i++) {
+		uint8_t result = Bulk_Address(addresses[i] << 1);
+
+		if (result == STATUS_BUS_BUSY) {
+			status = STATUS_BUS_BUSY;
+			break;
+		}
+
+		if (result == STATUS_ADDRESS_ACK) {
+			TWIEngine_Write(len);
+			for (uint16_t j = 0; j < len; j++)
+				Bulk_TxPut(data[j]);
+			TWIEngine_WaitFor(TWI_EVENT_Idle);
+			if (TWIEngine.Result == TWI_ERROR_NoError)
+				acked |= (1U << i);
+
+			TWIBus_Stop();
+			TWIBus_WaitStop();
+			Bulk_ReleaseBus();
+		}
+
+		if (!(acked & (1U << i)))
+			status = STATUS_ADDRESS_NAK;
+	}
+
+	Bulk_Write_8(acked & 0xFF);
+	Bulk_Write_8(acked >> 8);
+	Bulk_Write_8(status);
+}
+
+// Read the same register from a list of targets, e.g. a telemetry sweep over identical devices. The arguments are
+// the target count, the register, the read length and that many 7-bit addresses; each target gets a transaction of
+// its own as it comes in. The response has a record per target: the data, zeros if the read failed, and a status
+// byte. Once the bus turns out to be busy, the remaining targets are skipped and report that.
+static void Bulk_Gather(void)
+{
+	const uint8_t count = Bulk_Read_8();
+	const uint8_t reg   = Bulk_Read_8();
+	const uint8_t len   = Bulk_Read_8();
+	bool busy = false;
+
+	for (uint8_t i = 0; (i < count) && !Bulk_Aborted; i++) {
+		const uint8_t address = Bulk_Read_8() << 1;
+		uint8_t status = STATUS_BUS_BUSY;
+
+		if (!busy)
+			status = Bulk_RegSelect(address, reg);
+		busy = (status == STATUS_BUS_BUSY);
+
+		if (status == STATUS_ADDRESS_ACK)
+			TWIEngine_Read(len, true);
+		for (uint8_t j = 0; j < len; j++)
+			Bulk_Write_8((status == STATUS_ADDRESS_ACK) ? Bulk_RxGet() : 0);
+
+		if (status == STATUS_ADDRESS_ACK) {
+			TWIEngine_WaitFor(TWI_EVENT_Idle);
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+		}
+
+		// A NAKed address has already released the bus, anything else gets its STOP now
+		if (!busy && (I2C_BusOwner == BUS_OWNER_BULK)) {
+			TWIBus_Stop();
+			TWIBus_WaitStop();
+			Bulk_ReleaseBus();
+		}
+		Bulk_Write_8(status);
+		Control_Preempt();
+	}
+}
+
+// Read a list of register ranges from one target, for parts whose register pointer doesn't auto-increment across
+// them, or ranges too far apart to read in one. The arguments are the 7-bit address, the range count and that many
+// pairs of register and read length (8 bit); each range is a register write and a read after a repeated START, and
+// the ranges follow each other with repeated STARTs, a single STOP ending the lot. The response has a record per
+// range as for GATHER: the data, zeros if the read failed, and a status byte. Once the bus turns out to be busy,
+// the remaining ranges are skipped and report that.
+static void Bulk_Scatter(void)
+{
+	const uint8_t address = Bulk_Read_8() << 1;
+	const uint8_t count   = Bulk_Read_8();
+	bool busy = false;
+
+	for (uint8_t i = 0; (i < count) && !Bulk_Aborted; i++) {
+		const uint8_t reg = Bulk_Read_8();
+		const uint8_t len = Bulk_Read_8();
+		uint8_t status = STATUS_BUS_BUSY;
+
+		if (!busy)
+			status = Bulk_RegSelect(address, reg);
+		busy = (status == STATUS_BUS_BUSY);
+
+		if ((status == STATUS_ADDRESS_ACK) && len)
+			TWIEngine_Read(len, true);
+		for (uint8_t j = 0; j < len; j++)
+			Bulk_Write_8((status == STATUS_ADDRESS_ACK) ? Bulk_RxGet() : 0);
+
+		if ((status == STATUS_ADDRESS_ACK) && len) {
+			TWIEngine_WaitFor(TWI_EVENT_Idle);
+			if (TWIEngine.Result != TWI_ERROR_NoError)
+				status = Bulk_DataStatus();
+		}
+
+		// A failed data phase gets its STOP right away; after a NAKed address the bus is released already, and
+		// the next range starts afresh
+		if ((status != STATUS_ADDRESS_ACK) && !busy && (I2C_BusOwner == BUS_OWNER_BULK)) {
+			TWIBus_Stop();
+			TWIBus_WaitStop();
+			Bulk_ReleaseBus();
+		}
+		Bulk_Write_8(status);
+	}
+
+	if (!busy && (I2C_BusOwner == BUS_OWNER_BULK)) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+}
+
+// Claim the bus for a job that runs transactions of its own, ending one the bulk path left open
+static bool Bulk_ClaimIdle(void)
+{
+	const bool open = (I2C_BusOwner == BUS_OWNER_BULK) && !Bulk_Skip;
+
+	if (!I2C_ClaimBus(BUS_OWNER_BULK))
+		return false;
+
+	if (open) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+	}
+	Bulk_Skip = false;
+	return true;
+}
+
+#if MUX_SUPPORT
+// Switch the muxes registered with CMD_SET_MUX to a route, ending an open transaction first. Muxes already set
+// right aren't touched, so a host can put a ROUTE in front of every access at next to no cost. The response is a
+// status byte: ACK, NAK for a mux that didn't respond or isn't registered, bus busy or stretch timeout.
+static void Bulk_Route(void)
+{
+	const uint8_t route = Bulk_Read_8();
+
+	if (Bulk_Aborted)
+		return;
+
+	uint8_t status = STATUS_BUS_BUSY;
+
+	if (Bulk_ClaimIdle()) {
+		const uint8_t result = Mux_Select(route);
+		status = (result == TWI_ERROR_NoError) ? STATUS_ADDRESS_ACK :
+		         (result == TWI_ENGINE_ERROR_StretchTimeout) ? STATUS_STRETCH_TIMEOUT : STATUS_ADDRESS_NAK;
+		Bulk_ReleaseBus();
+	}
+
+	Bulk_Write_8(status);
+}
+
+// Find out what hangs off each channel of the muxes registered with CMD_SET_MUX, by running the bus scan of
+// CMD_SCAN on the adapter's bus and then on every channel, with every other channel closed. The response is a
+// 16 byte bitmap for the adapter's bus, then one for each channel of each registered mux in index order, and a
+// status byte: ACK, NAK if a mux didn't respond or the bus got stuck, leaving the remaining bitmaps empty, or bus
+// busy. A channel's bitmap only has the targets that aren't already visible upstream of its mux, so each target
+// shows up once, on the channel it hangs off. All muxes are closed again at the end.
+static void Bulk_Discover(void)
+{
+	const uint8_t read = Bulk_Read_8() & I2C_M_RD;
+	uint8_t bitmap[SCAN_BITMAP_SIZE];
+	uint8_t status = STATUS_ADDRESS_ACK;
+
+	if (Bulk_Aborted)
+		return;
+
+	// Upstream scans of each mux, filled in as the routes they hang off are scanned
+	Arena_Reset();
+	uint8_t* const upstream = Arena_Alloc(DISCOVER_BUFFER);
+
+	if (!Bulk_ClaimIdle())
+		status = STATUS_BUS_BUSY;
+
+	for (int8_t mux = -1; mux < MUX_ENTRIES; mux++) {
+		if ((mux >= 0) && (Mux_Table[mux].Address == MUX_UNUSED))
+			continue;
+
+		for (uint8_t channel = 0; channel < ((mux < 0) ? 1 : 8); channel++) {
+			const uint8_t route = (mux < 0) ? MUX_ROUTE_ROOT : ((mux << 4) | channel);
+
+			memset(bitmap, 0, sizeof(bitmap));
+			if (status == STATUS_ADDRESS_ACK) {
+				if ((Mux_Select(route) != TWI_ERROR_NoError) || !I2C_Scan(bitmap, read)) {
+					memset(bitmap, 0, sizeof(bitmap));
+					status = STATUS_ADDRESS_NAK;
+				}
+			}
+
+			for (uint8_t i = 0; i < MUX_ENTRIES; i++) {
+				if ((Mux_Table[i].Address != MUX_UNUSED) && (Mux_Table[i].Upstream == route))
+					memcpy(&upstream[i * SCAN_BITMAP_SIZE], bitmap, sizeof(bitmap));
+			}
+
+			for (uint8_t i = 0; i < sizeof(bitmap); i++)
+				Bulk_Write_8((mux < 0) ? bitmap[i] : (bitmap[i] & ~upstream[mux * SCAN_BITMAP_SIZE + i]));
+		}
+	}
+
+	if (status != STATUS_BUS_BUSY) {
+		if (status == STATUS_ADDRESS_ACK)
+			Mux_Select(MUX_ROUTE_ROOT);
+		Bulk_ReleaseBus();
+	}
+	Bulk_Write_8(status);
+}
+#endif
+
+// Play samples to one target at a fixed rate, e.g. a waveform to a DAC. The arguments are the 7-bit address, the
+// sample size in bytes, the sample period in microseconds, a 32-bit sample count and then the samples, each written
+// in a transaction of its own when its time comes. They are taken straight out of the double banked OUT endpoint,
+// so the host fills one bank while the other is played. A sample that can't go out on time, because it hasn't come
+// in yet or the last transaction ran past it, is an underrun: it goes out as soon as it can and the schedule starts
+// over from there. The response is the 16-bit underrun count, saturating, and a status byte: ACK, NAK if a sample
+// wasn't taken, bus busy, or count error for a sample size of 0; the samples after a failure are dropped.
+static void Bulk_Stream(void)
+{
+	const uint8_t address = Bulk_Read_8() << 1;
+	const uint8_t size    = Bulk_Read_8();
+	const uint16_t period = Timebase_UsToTicks(Bulk_Read_16());
+	const uint16_t low    = Bulk_Read_16();
+	uint32_t count        = low | ((uint32_t)Bulk_Read_16() << 16);
+	uint16_t underruns    = 0;
+	uint8_t status        = STATUS_ADDRESS_ACK;
+
+	if (Bulk_Aborted)
+		return;
+
+	if (!size)
+		status = STATUS_COUNT_ERROR;
+	else if (!Bulk_ClaimIdle())
+		status = STATUS_BUS_BUSY;
+
+	uint16_t due = Timebase_Now();
+
+	while (count-- && !Bulk_Aborted) {
+		if (status == STATUS_ADDRESS_ACK) {
+			bool ready;
+			while (!(ready = Bulk_DataReady()) && ((int16_t)(Timebase_Now() - due) < 0))
+				;
+
+			if (!ready || ((int16_t)(Timebase_Now() - due) > (int16_t)period)) {
+				if (underruns < UINT16_MAX)
+					underruns++;
+				Trace_Add(TRACE_UNDERRUN, underruns);
+				if (!Bulk_ReadAvailable())
+					break;
+				due = Timebase_Now();
+			}
+
+			int16_t late;
+			while ((int16_t)(Timebase_Now() - due) < -QUIET_LEAD_TICKS)
+				;
+			Quiet_Begin();
+			while ((late = Timebase_Now() - due) < 0)
+				;
+			Stats_TimedStart(late);
+			due += period;
+
+			const uint8_t result = Bulk_Address(address);
+			if (result == STATUS_ADDRESS_ACK) {
+				TWIEngine_Write(size);
+				Bulk_TxStream(size);
+				if (TWIEngine.Result != TWI_ERROR_NoError)
+					status = Bulk_DataStatus();
+
+				TWIBus_Stop();
+				TWIBus_WaitStop();
+				Bulk_ReleaseBus();
+				Quiet_End();
+				Control_Preempt();
+				continue;
+			}
+			Quiet_End();
+			status = result;
+		}
+
+		// Dropped samples are drained so the command stream stays in sync
+		Bulk_Skip = true;
+		Bulk_TxStream(size);
+		Bulk_Skip = false;
+	}
+
+	if ((status != STATUS_BUS_BUSY) && (I2C_BusOwner == BUS_OWNER_BULK))
+		Bulk_ReleaseBus();
+
+	Bulk_Write_8(underruns & 0xFF);
+	Bulk_Write_8(underruns >> 8);
+	Bulk_Write_8(status);
+}
+
+// Read a range of a memory such as a 24Cxx EEPROM and return only its CRC-32, so that verifying an image doesn't take
+// reading it back over USB. The arguments are the 7-bit address, the EEPROM_FMT_* addressing scheme (a memory
+// address width of 0 reads from wherever the target's pointer is), the memory offset (16 bit) and the length
+// (32 bit), which may go on past 64 KB into the next block. The response is the CRC-32 as zlib's crc32() computes
+// it and a status byte as for REGWRITE, or count error for an address width above 2 or block-select bits without
+// a memory address; the CRC only means something with an ACK.
+static void Bulk_Checksum(void)
+{
+	const uint8_t address = Bulk_Read_8() << 1;
+	const uint8_t format  = Bulk_Read_8();
+	uint32_t offset       = Bulk_Read_16();
+	const uint16_t low    = Bulk_Read_16();
+	uint32_t len          = low | ((uint32_t)Bulk_Read_16() << 16);
+	uint32_t crc          = CRC32_INIT;
+	uint8_t status        = STATUS_ADDRESS_ACK;
+
+	if (Bulk_Aborted)
+		return;
+
+	if (((format & EEPROM_FMT_WIDTH) > 2) || ((format & EEPROM_FMT_BLOCKS) && !(format & EEPROM_FMT_WIDTH)))
+		status = STATUS_COUNT_ERROR;
+	else if (!Bulk_ClaimIdle())
+		status = STATUS_BUS_BUSY;
+	else
+		status = Bulk_EEPROMSelect(address, format, offset);
+
+	while (len && (status == STATUS_ADDRESS_ACK) && !Bulk_Aborted) {
+		const uint32_t left = Bulk_EEPROMBlockLeft(format, offset);
+		uint32_t chunk      = (len < left) ? len : left;
+		if (chunk > BULK_LONG_CHUNK)
+			chunk = BULK_LONG_CHUNK;
+
+		len    -= chunk;
+		offset += chunk;
+		// If the chunk ends its block, the next byte has to be read from the next block's address
+		const bool next_block = len && (chunk == left);
+
+		TWIEngine_Read(chunk, !len || next_block);
+		for (uint16_t i = 0; i < chunk; i++)
+			crc = CRC32_Update(crc, Bulk_RxGet());
+
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		if (TWIEngine.Result != TWI_ERROR_NoError)
+			status = Bulk_DataStatus();
+		else if (next_block)
+			status = Bulk_EEPROMSelect(address, format, offset);
+	}
+
+	// A NAKed address has already released the bus, anything else gets its STOP now
+	if ((status != STATUS_BUS_BUSY) && (status != STATUS_COUNT_ERROR) && (I2C_BusOwner == BUS_OWNER_BULK)) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Bulk_ReleaseBus();
+	}
+
+	crc ^= CRC32_INIT;
+	for (uint8_t i = 0; i < 4; i++, crc >>= 8)
+		Bulk_Write_8(crc & 0xFF);
+	Bulk_Write_8(status);
+}
+
+// Replace the polling job; each entry is 7-bit address, register, length and 16-bit period in milliseconds
+static void Bulk_Poll(void)
+{
+	const uint8_t flags = Bulk_Read_8();
+	uint8_t count = flags & ~(POLL_COMPACT | POLL_SYNC);
+
+	Poll_Clear();
+	Poll_SetCompact(flags & POLL_COMPACT);
+	Poll_SetSync(flags & POLL_SYNC);
+
+	while (count-- && !Bulk_Aborted) {
+		const uint8_t address = Bulk_Read_8();
+		const uint8_t reg     = Bulk_Read_8();
+		const uint8_t length  = Bulk_Read_8();
+		const uint16_t period = Bulk_Read_16();
+
+		// Invalid entries and those beyond POLL_MAX_ENTRIES are dropped
+		Poll_AddEntry(address, reg, length, period);
+	}
+}
+
+// Set the filter of a polling job entry; args are entry index, flags, field, two 16-bit limits and 16-bit heartbeat
+static void Bulk_PollFilter(void)
+{
+	Poll_Filter_t filter;
+
+	const uint8_t index = Bulk_Read_8();
+	filter.Flags     = Bulk_Read_8();
+	filter.Field     = Bulk_Read_8();
+	filter.Limits[0] = Bulk_Read_16();
+	filter.Limits[1] = Bulk_Read_16();
+	filter.Heartbeat = Bulk_Read_16();
+
+	// Invalid filters are dropped, as invalid POLL entries are
+	if (!Bulk_Aborted)
+		Poll_SetFilter(index, &filter);
+}
+
+// Set the reduction of a polling job entry; args are entry index, op, flags, field, values and 16-bit sample count
+static void Bulk_PollReduce(void)
+{
+	Poll_Reduce_t reduce;
+
+	const uint8_t index = Bulk_Read_8();
+	reduce.Op      = Bulk_Read_8();
+	reduce.Flags   = Bulk_Read_8();
+	reduce.Field   = Bulk_Read_8();
+	reduce.Values  = Bulk_Read_8();
+	reduce.Samples = Bulk_Read_16();
+
+	if (!Bulk_Aborted)
+		Poll_SetReduce(index, &reduce);
+}
+
+#if SNIFF_SUPPORT
+// Start or stop the bus sniffer. Starting takes the bus from all other paths, so it fails with a busy status while
+// one of them, this one included, is in the middle of a transaction or has the bus locked.
+static void Bulk_Sniff(void)
+{
+	const uint8_t enable = Bulk_Read_8();
+	uint8_t status = STATUS_ADDRESS_ACK;
+
+	if (Bulk_Aborted)
+		return;
+
+	if (!enable)
+		Sniff_Stop();
+	else if (!Sniff_Start())
+		status = STATUS_BUS_BUSY;
+
+	Bulk_Write_8(status);
+}
+#endif
+
+#if EMU_SUPPORT
+// Start emulating a target, or stop with address 0, which no target can have. A new address takes effect right
+// away; like SNIFF, starting takes the bus from the master paths. EMU_RANGE (bits above 0) emulates a whole
+// block of targets at once.
+static void Bulk_Emulate(const uint8_t bits)
+{
+	const uint8_t address = Bulk_Read_8();
+	uint8_t status = STATUS_ADDRESS_ACK;
+
+	if (Bulk_Aborted)
+		return;
+
+	Emu_Stop();
+	if (bits > EMU_MAX_ADDRESS_BITS)
+		status = STATUS_COUNT_ERROR;
+	else if (address && !Emu_Start(address, bits))
+		status = STATUS_BUS_BUSY;
+
+	Bulk_Write_8(status);
+}
+
+// Write registers of the emulated target, applied all at once; values beyond the size of the register file are
+// dropped
+static void Bulk_EmuWrite(void)
+{
+	const uint8_t reg   = Bulk_Read_8();
+	const uint8_t count = Bulk_Read_8();
+	uint8_t values[EMU_REGISTERS];
+
+	for (uint8_t i = 0; i < count; i++) {
+		const uint8_t value = Bulk_Read_8();
+		if (i < EMU_REGISTERS)
+			values[i] = value;
+	}
+
+	if (!Bulk_Aborted)
+		Emu_Update(reg, values, (count < EMU_REGISTERS) ? count : EMU_REGISTERS);
+}
+
+// Read back registers of the emulated target, e.g. what the master wrote; past the size of the register file
+// the values repeat
+static void Bulk_EmuRead(void)
+{
+	const uint8_t reg   = Bulk_Read_8();
+	const uint8_t count = Bulk_Read_8();
+	uint8_t values[EMU_REGISTERS];
+
+	if (Bulk_Aborted)
+		return;
+
+	Emu_Fetch(reg, values, (count < EMU_REGISTERS) ? count : EMU_REGISTERS);
+	for (uint8_t i = 0; i < count; i++)
+		Bulk_Write_8(values[i % EMU_REGISTERS]);
+}
+#endif
+
+// Full duplex SPI transfer, independent of the I2C buses. The next byte is fetched from the OUT bank while one is
+// shifted out, and the byte clocked in is put into the IN bank while the next one is.
+static void Bulk_Spi(void)
+{
+	const uint8_t config = Bulk_Read_8();
+	const uint8_t line   = Bulk_Read_8();
+	uint16_t len         = Bulk_Read_16();
+
+	if (Bulk_Aborted)
+		return;
+
+	if (!SPIBridge_Begin(config, line)) {
+		// No such chip select, the data is dropped and reads as zeros
+		while (len-- && !Bulk_Aborted) {
+			Bulk_Read_8();
+			Bulk_Write_8(0);
+		}
+		Bulk_Write_8(STATUS_COUNT_ERROR);
+		return;
+	}
+
+	if (len) {
+		SPIBridge_Send(Bulk_Read_8());
+		while (--len && !Bulk_Aborted) {
+			const uint8_t next  = Bulk_Read_8();
+			const uint8_t value = SPIBridge_Receive();
+
+			SPIBridge_Send(next);
+			Bulk_Write_8(value);
+		}
+		Bulk_Write_8(SPIBridge_Receive());
+	}
+
+	SPIBridge_End();
+	Bulk_Write_8(STATUS_ADDRESS_ACK);
+}
+
+#if UART_SUPPORT
+static void Bulk_Uart(void)
+{
+	const uint16_t low  = Bulk_Read_16();
+	const uint32_t baud = low | ((uint32_t)Bulk_Read_16() << 16);
+
+	if (Bulk_Aborted)
+		return;
+
+	if (baud)
+		Uart_Start(baud);
+	else
+		Uart_Stop();
+
+	Bulk_Write_8(STATUS_ADDRESS_ACK);
+}
+
+static void Bulk_UartWrite(void)
+{
+	uint16_t len = Bulk_Read_16();
+
+	while (len-- && !Bulk_Aborted)
+		Uart_Write(Bulk_Read_8());
+}
+#endif
+
+static void Bulk_Gpio(const uint8_t op, const uint16_t arg)
+{
+	uint8_t level;
+
+	if (Bulk_Aborted)
+		return;
+
+	const uint8_t status = Gpio_Run(op, arg, &level);
+
+	Bulk_Write_8(level);
+	Bulk_Write_8(status);
+}
+
+static void Bulk_GpioOp(void)
+{
+	const uint8_t op = Bulk_Read_8();
+	Bulk_Gpio(op, Bulk_Read_16());
+}
+
+#if FIFO_SUPPORT
+static void Bulk_Fifo(void)
+{
+	Fifo_Job_t job;
+
+	job.Flags     = Bulk_Read_8();
+	job.Address   = Bulk_Read_8();
+	job.LevelReg  = Bulk_Read_8();
+	job.LevelMask = Bulk_Read_16();
+	job.Unit      = Bulk_Read_8();
+	job.DataReg   = Bulk_Read_8();
+	job.MaxLength = Bulk_Read_16();
+
+	if (!Bulk_Aborted)
+		Fifo_SetJob(&job);
+}
+#endif
+
+/** Tells the other writers of the bulk IN endpoint that a response is still being collected in it, which in the
+ *  HID build may last until the host sends BULK_OP_FLUSH.
+ */
+bool Bulk_ResponsePending(void)
+{
+	return (Bulk_InBytes != 0);
+}
+
+// Drop the transaction in progress and all command state, after the host went away or cancelled
+static void Bulk_Abandon(void)
+{
+	// Don't leave the bus hanging, the host will start over anyway
+	TWIEngine_Cancel();
+	if (I2C_BusOwner == BUS_OWNER_BULK) {
+		TWIBus_Stop();
+		I2C_ReleaseBus();
+	}
+	if (SOFTI2C_CHANNELS && Bulk_Channels)
+		SoftI2C_Stop(Bulk_Channels);
+	SPIBridge_Stop();
+	Bulk_Skip = false;
+	Bulk_MergeOpen = false;
+	Bulk_DeadlineSet = false;
+	Bulk_SyncArmed = false;
+	Bulk_StampsArmed = false;
+	Bulk_LockTimeout = 0;
+	Bulk_InBytes = 0;
+	Bulk_Channels = 0;
+	Bulk_SoftAcked = 0;
+	Bulk_PostArmed = false;
+	Bulk_Posted = false;
+}
+
+/** Asks the bulk command in progress to give up at its next wait for USB or the bus, for CMD_CANCEL; false takes
+ *  that back for a cancel superseded by the next control request. Safe to call from the USB interrupt.
+ */
+void Bulk_RequestCancel(const bool cancel)
+{
+	Bulk_CancelPending = cancel;
+}
+
+/** Carries out a CMD_CANCEL from the main loop: ends the bulk transaction in progress with a STOP, releases a
+ *  bus lock, drops the command packets received so far and the response data not fetched by the host yet, and
+ *  clears the polling and FIFO drain jobs, whose results would only pile up behind it. The report tells what was
+ *  dropped. Command packets the host sends from now on are carried out as usual, it must have cancelled the OUT
+ *  transfers it doesn't want to go ahead before asking.
+ */
+void Bulk_Cancel(Bulk_Cancel_t* const report)
+{
+	report->OutBytes  = 0;
+	report->InPackets = 0;
+	report->Flags     = 0;
+
+	if ((I2C_BusOwner == BUS_OWNER_BULK) || Bulk_MergeOpen)
+		report->Flags |= CANCEL_FLAG_STOP;
+	if (Bulk_LockTimeout)
+		report->Flags |= CANCEL_FLAG_UNLOCK;
+	if (Poll_GetEntry(0))
+		report->Flags |= CANCEL_FLAG_POLL;
+
+	Bulk_Aborted = true;
+	Bulk_CancelPending = false;
+	Bulk_Abandon();
+	TWIBus_WaitStop();
+	Poll_Clear();
+	Fifo_Clear();
+
+	Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
+	while (Endpoint_IsOUTReceived()) {
+		report->OutBytes += Endpoint_BytesInEndpoint();
+		Endpoint_ClearOUT();
+		Stats_Count(&Stats.UsbPackets);
+	}
+
+	// The banks sent off but not fetched simply go, the data toggle stays as the host expects it
+	Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+	report->InPackets = Endpoint_GetBusyBanks() + (Endpoint_BytesInEndpoint() ? 1 : 0);
+	Endpoint_ResetEndpoint(VENDOR_IN_EPADDR);
+
+	Trace_Add(TRACE_CANCEL, report->Flags);
+}
+
+/** Processes bulk commands as long as OUT data keeps coming in, then sends off any pending response data.
+ *  Called from the main loop; commands spanning packet boundaries are handled by waiting for the next packet.
+ *  If the next packet is already waiting in the second bank once the current one is done, it is processed right
+ *  away and responses keep filling the current IN bank, so back-to-back command streams give full IN packets.
+ *  @return true if there was anything to do
+ */
+bool Bulk_Task(void)
+{
+	// The host going quiet or away with the bus locked must not leave it locked for good
+	if (Bulk_LockTimeout &&
+	    (!I2C_IsBulkActive() || ((uint16_t)(Timebase_GetFrame() - Bulk_LockFrame) >= Bulk_LockTimeout)))
+		Bulk_Unlock(2);
+
+	if (!I2C_IsBulkActive())
+		return false;
+
+	Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
+	if (!Endpoint_IsOUTReceived())
+		return false;
+
+	Bulk_Aborted = false;
+	Trace_Add(TRACE_BULK_OUT, Endpoint_BytesInEndpoint());
+	Stats_BootStamp(&Stats.BootFirstIoTicks);
+
+	// Responses must not end up in the middle of a sample frame
+	Poll_Flush();
+	Sniff_Flush();
+
+	for (;;) {
+		while (!Bulk_Aborted && Endpoint_IsReadWriteAllowed()) {
+			const uint8_t op = Bulk_Read_8();
+
+			if ((op != BULK_OP_REGWRITE) && (op != BULK_OP_NOP))
+				Bulk_MergeClose();
+
+			// Padding doesn't use up a POST
+			if (Bulk_PostArmed && (op != BULK_OP_NOP)) {
+				Bulk_PostArmed = false;
+				Bulk_Posted    = true;
+				Bulk_PostLast  = STATUS_ADDRESS_ACK;
+			}
+
+			switch (op) {
+				case BULK_OP_NOP:
+					break;
+
+				case BULK_OP_START:
+					Bulk_I2CStart(Bulk_Read_8());
+					break;
+
+				case BULK_OP_WRITE:
+					Bulk_I2CWrite(Bulk_Read_16());
+					break;
+
+				case BULK_OP_READ:
+					Bulk_I2CRead(Bulk_Read_16(), true);
+					break;
+
+				case BULK_OP_READ_ACK:
+					Bulk_I2CRead(Bulk_Read_16(), false);
+					break;
+
+				case BULK_OP_READ_LONG:
+				{
+					const uint16_t low = Bulk_Read_16();
+					Bulk_I2CReadLong(low | ((uint32_t)Bulk_Read_16() << 16));
+				}
+				break;
+
+				case BULK_OP_WRITE_LONG:
+				{
+					const uint16_t low = Bulk_Read_16();
+					Bulk_I2CWriteLong(low | ((uint32_t)Bulk_Read_16() << 16));
+				}
+				break;
+
+				case BULK_OP_STOP:
+					Bulk_I2CStop();
+					break;
+
+				case BULK_OP_BATCH:
+				{
+					const Stats_Stamp_t batch_start = Stats_LatencyStart();
+					Bulk_Batch();
+					Stats_LatencyDone(STATS_LATENCY_Batch, batch_start);
+				}
+				break;
+
+				case BULK_OP_POLL:
+					Bulk_Poll();
+					break;
+
+				case BULK_OP_DEADLINE:
+					Bulk_Deadline();
+					break;
+
+				case BULK_OP_POLL_FILTER:
+					Bulk_PollFilter();
+					break;
+
+				case BULK_OP_POLL_REDUCE:
+					Bulk_PollReduce();
+					break;
+
+				case BULK_OP_CHECKSUM:
+					Bulk_Checksum();
+					break;
+
+#if FIFO_SUPPORT
+				case BULK_OP_FIFO:
+					Bulk_Fifo();
+					break;
+#endif
+
+				case BULK_OP_FLUSH:
+					Bulk_Flush();
+					break;
+
+				case BULK_OP_TAG:
+					// Commands complete in the order they came in, so the tag lands right where the host expects it
+					Bulk_Write_8(Bulk_Read_8());
+					break;
+
+				case BULK_OP_POST:
+					Bulk_Post();
+					break;
+
+				case BULK_OP_POST_STATUS:
+					Bulk_PostReport();
+					break;
+
+				case BULK_OP_SYNC:
+					Bulk_SyncTimeout = Bulk_Read_8();
+					Bulk_SyncArmed   = true;
+					break;
+
+				case BULK_OP_STAMPS:
+					Bulk_StampsArmed = true;
+					break;
+
+				case BULK_OP_LOCK:
+					Bulk_Lock();
+					break;
+
+				case BULK_OP_EEPROM_WRITE:
+					Bulk_EEPROMWrite();
+					break;
+				case BULK_OP_EEPROM_READ:
+					Bulk_EEPROMRead();
+					break;
+				case BULK_OP_PROGRAM:
+					Bulk_Program();
+					break;
+#if SNIFF_SUPPORT
+				case BULK_OP_SNIFF:
+					Bulk_Sniff();
+					break;
+#endif
+#if EMU_SUPPORT
+				case BULK_OP_EMULATE:
+					Bulk_Emulate(0);
+					break;
+				case BULK_OP_EMU_RANGE:
+					Bulk_Emulate(Bulk_Read_8());
+					break;
+				case BULK_OP_EMU_PROFILE:
+				{
+					const uint8_t target = Bulk_Read_8();
+					const uint8_t profile = Bulk_Read_8();
+					if (!Bulk_Aborted)
+						Emu_SetProfile(target, profile);
+				}
+				break;
+				case BULK_OP_EMU_WRITE:
+					Bulk_EmuWrite();
+					break;
+				case BULK_OP_EMU_READ:
+					Bulk_EmuRead();
+					break;
+#endif
+
+				case BULK_OP_SPI:
+					Bulk_Spi();
+					break;
+
+#if UART_SUPPORT
+				case BULK_OP_UART:
+					Bulk_Uart();
+					break;
+
+				case BULK_OP_UART_WRITE:
+					Bulk_UartWrite();
+					break;
+#endif
+
+				case BULK_OP_GPIO:
+					Bulk_GpioOp();
+					break;
+
+				case BULK_OP_SMBUS:
+					Bulk_SMBus();
+					break;
+
+				case BULK_OP_REGWRITE:
+					Bulk_RegWrite();
+					break;
+
+				case BULK_OP_REGUPDATE:
+					Bulk_RegUpdate();
+					break;
+
+				case BULK_OP_MULTIWRITE:
+					Bulk_MultiWrite();
+					break;
+
+				case BULK_OP_GATHER:
+					Bulk_Gather();
+					break;
+
+				case BULK_OP_SCATTER:
+					Bulk_Scatter();
+					break;
+
+#if MUX_SUPPORT
+				case BULK_OP_ROUTE:
+					Bulk_Route();
+					break;
+
+				case BULK_OP_DISCOVER:
+					Bulk_Discover();
+					break;
+#endif
+
+				case BULK_OP_STREAM:
+					Bulk_Stream();
+					break;
+
+				case BULK_OP_CHANNEL:
+					// Unconfigured channels are dropped from the mask, leaving 0 selects the TWI bus
+					Bulk_Channels = Bulk_Read_8() & SOFTI2C_ALL_CHANNELS;
+					break;
+
+				default:
+					// Unknown opcode, we cannot know its length so the rest of the packet is garbage
+					Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
+					while (Endpoint_IsReadWriteAllowed())
+						Endpoint_Discard_8();
+					break;
+			}
+
+			if (Bulk_Posted)
+				Bulk_PostDone();
+
+			// Between two commands is a transaction boundary unless the bulk path left one open
+			Control_Preempt();
+			Watchdog_Kick();
+			Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
+		}
+
+		if (Bulk_Aborted) {
+			Bulk_Abandon();
+			return true;
+		}
+
+		Endpoint_ClearOUT();
+		Stats_Count(&Stats.UsbPackets);
+		Sched_Charge();
+		Bulk_LockFrame = Timebase_GetFrame();
+
+		// With two banks the next packet may already be waiting, unless this turn's budget is used up; it is
+		// taken on the next turn then, after the other services have had theirs
+		if (!Endpoint_IsOUTReceived() || !Sched_HasBudget())
+			break;
+	}
+
+	// Out of commands, so there is nothing left to merge with. HID hosts can't tell padding from data, so there
+	// the response is only sent off once full or on BULK_OP_FLUSH, never depending on how the packets came in.
+	Bulk_MergeClose();
+	if (!HID_SUPPORT)
+		Bulk_Flush();
+	Events_Push(EVENT_BULK_DONE, 0);
+	return true;
+}
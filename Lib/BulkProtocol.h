@@ -0,0 +1,302 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for BulkProtocol.c.
+ */
+
+#ifndef _BULK_PROTOCOL_H_
+#define _BULK_PROTOCOL_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "TWIEngine.h"
+		#include "PollEngine.h"
+		#include "FifoDrain.h"
+		#include "CRC8.h"
+		#include "CRC32.h"
+		#include "SoftI2C.h"
+		#include "EventQueue.h"
+		#include "Arena.h"
+		#include "MuxRoute.h"
+		#include "BusSniffer.h"
+		#include "TargetEmu.h"
+		#include "SPIBridge.h"
+		#include "UartBridge.h"
+		#include "GpioOps.h"
+		#include "SyncLine.h"
+		#include "QuietWindow.h"
+
+	/* Macros: */
+		/** Bulk command opcodes. Each command is one opcode byte followed by its arguments, multi-byte
+		 *  arguments are little endian. Commands may span packet boundaries, see README for details.
+		 */
+		#define BULK_OP_NOP          0x00 /**< No operation, may be used as padding */
+		#define BULK_OP_START        0x01 /**< (Repeated) START, arg: 8-bit address byte; response: status byte */
+		#define BULK_OP_WRITE        0x02 /**< Write, args: 16-bit length + data */
+		#define BULK_OP_READ         0x03 /**< Read and NACK the last byte, arg: 16-bit length; response: data */
+		#define BULK_OP_READ_ACK     0x04 /**< Read and ACK the last byte, more reads follow; as BULK_OP_READ */
+		#define BULK_OP_STOP         0x05 /**< STOP, releases the bus */
+		#define BULK_OP_BATCH        0x06 /**< Message batch, args: segment count + segments; response: per segment results */
+		#define BULK_OP_POLL         0x07 /**< Set up the polling job, args: entry count + entries; response: sample stream */
+		#define BULK_OP_EEPROM_WRITE 0x08 /**< Paged EEPROM write with ACK polling, see README; response: status byte */
+		#define BULK_OP_SMBUS        0x09 /**< SMBus transaction, see README; response: read data + status byte */
+		#define BULK_OP_CHANNEL      0x0A /**< Select bit-banged channels, arg: channel mask, 0 for the TWI bus */
+		#define BULK_OP_REGWRITE     0x0B /**< Register write, args: 7-bit address, register, count + data; response: status byte */
+		#define BULK_OP_READ_LONG    0x0C /**< Read and NACK the last byte, arg: 32-bit length; response: data, ends the transfer */
+		#define BULK_OP_FIFO         0x0D /**< Set up the FIFO drain job, see README; response: drain records */
+		#define BULK_OP_FLUSH        0x0E /**< Send off the response packet now, padded to a full report in the HID build */
+		#define BULK_OP_LOCK         0x0F /**< Hold the bus between transactions, arg: 16-bit timeout in ms, 0 unlocks; response: status byte */
+		#define BULK_OP_REGUPDATE    0x10 /**< Read-modify-write, args: 7-bit address, register, mask, value; response: old value + status byte */
+		#define BULK_OP_MULTIWRITE   0x11 /**< Same write to several targets, see README; response: 16-bit ACK bitmap + status byte */
+		#define BULK_OP_GATHER       0x12 /**< Same register read from several targets, see README; response: data + status byte per target */
+		#define BULK_OP_ROUTE        0x13 /**< Select a route through the muxes of CMD_SET_MUX, arg: route byte; response: status byte */
+		#define BULK_OP_DISCOVER     0x14 /**< Scan every mux channel, arg: probe flags as for CMD_SCAN; response: bitmaps + status byte */
+		#define BULK_OP_STREAM       0x15 /**< Timer paced writes of a sample stream to one target, see README; response: 16-bit underrun count + status byte */
+		#define BULK_OP_POLL_FILTER  0x16 /**< Set which samples of a polling job entry are reported, see README */
+		#define BULK_OP_POLL_REDUCE  0x17 /**< Combine groups of samples of a polling job entry into one record, see README */
+		#define BULK_OP_CHECKSUM     0x18 /**< CRC-32 of a memory range, see README; response: 32-bit CRC + status byte */
+		#define BULK_OP_PROGRAM      0x19 /**< Block write to a bootloader with busy polling, see README; response: 16-bit block count + status byte */
+		#define BULK_OP_SNIFF        0x1A /**< Monitor the bus, arg: 1 to start, 0 to stop; response: status byte, then sniffer records */
+		#define BULK_OP_EMULATE      0x1B /**< Act as a target, arg: 7-bit address, 0 to stop; response: status byte */
+		#define BULK_OP_EMU_WRITE    0x1C /**< Update the emulated registers, args: register, count + data */
+		#define BULK_OP_EMU_READ     0x1D /**< Read the emulated registers, args: register, count; response: data */
+		#define BULK_OP_SPI          0x1E /**< SPI transfer, args: config, chip select, 16-bit length + data; response: data + status byte */
+		#define BULK_OP_UART         0x1F /**< Open the UART, arg: 32-bit baud rate, 0 closes it; response: status byte, then UART records */
+		#define BULK_OP_UART_WRITE   0x20 /**< Send on the UART, args: 16-bit length + data */
+		#define BULK_OP_GPIO         0x21 /**< GPIO operation, args: operation byte, 16-bit argument; response: level + status byte */
+		#define BULK_OP_DEADLINE     0x22 /**< Deadline of the next BATCH, args: 16-bit frame number + 16-bit offset in us */
+		#define BULK_OP_TAG          0x23 /**< Response marker, arg: tag byte; response: the tag byte */
+		#define BULK_OP_WRITE_LONG   0x24 /**< Long write, args: 32-bit length + data */
+		#define BULK_OP_EEPROM_READ  0x25 /**< EEPROM read across blocks, see README; response: data + status byte, ends the transfer */
+		#define BULK_OP_SCATTER      0x26 /**< Several register ranges of one target, see README; response: data + status byte per range */
+		#define BULK_OP_POST         0x27 /**< Run the next command posted, arg: tag byte; its response is dropped, failures are reported later */
+		#define BULK_OP_POST_STATUS  0x28 /**< Failures of posted commands so far; response: failure count, first failed tag, its status */
+		#define BULK_OP_SYNC         0x29 /**< Start the next BATCH on the SYNC edge, arg: timeout in ms */
+		#define BULK_OP_STAMPS       0x2A /**< Frame stamps of the start and end of each segment of the next BATCH */
+		#define BULK_OP_EMU_RANGE    0x2B /**< Emulate a block of targets, args: address bits, 7-bit address */
+		#define BULK_OP_EMU_PROFILE  0x2C /**< Set a behavior profile of an emulated target, args: target, profile */
+
+		/** Address byte flag of a REGWRITE: read the registers back and compare them; response: mismatch offset + status byte. */
+		#define BULK_REGWRITE_VERIFY    0x80
+
+		/** Most targets a MULTIWRITE command can address, one bit each in its response. */
+		#define MULTIWRITE_MAX_TARGETS  16
+
+		#if ARENA_SIZE < MULTIWRITE_MAX_LENGTH
+			#error ARENA_SIZE has no room for a MULTIWRITE payload
+		#endif
+
+		/** Scratch space of a DISCOVER command: the addresses seen upstream of each mux. */
+		#define DISCOVER_BUFFER  (MUX_ENTRIES * SCAN_BITMAP_SIZE)
+
+		#if MUX_SUPPORT && (ARENA_SIZE < DISCOVER_BUFFER)
+			#error ARENA_SIZE has no room for the DISCOVER scratch space
+		#endif
+
+		/** Largest part of a long read or write handed to the TWI engine in one go. */
+		#define BULK_LONG_CHUNK      0x8000
+
+		/** Maximum time an EEPROM write cycle may take before the EEPROM write command gives up, in milliseconds. */
+		#define EEPROM_WRITE_TIMEOUT_MS  20
+
+		/** Addressing scheme of the EEPROM commands and of \ref BULK_OP_CHECKSUM. Block-select bits take the part of
+		 *  the memory offset above the address bytes into the low bits of the 7-bit address, as on a 24C04 to 24C16
+		 *  (1 byte, 1 to 3 bits) or a 24M01 (2 bytes, 1 bit); the firmware addresses each block anew.
+		 */
+		#define EEPROM_FMT_WIDTH     0x03      /**< Mask of the number of memory address bytes, 0 to 2 */
+		#define EEPROM_FMT_BLOCKS    0x0C      /**< Mask of the number of block-select bits, 0 to 3 */
+		#define EEPROM_FMT_BLOCKS_SHIFT 2
+
+		/** Address prefix format of \ref BULK_OP_PROGRAM: how each block's memory address goes out ahead of its data. */
+		#define PROGRAM_FMT_WIDTH    0x07      /**< Mask of the number of memory address bytes, 0 to 4 */
+		#define PROGRAM_FMT_LE       (1 << 3)  /**< Send the memory address least significant byte first */
+		#define PROGRAM_FMT_CMD      (1 << 4)  /**< Send the command byte ahead of the memory address */
+		#define PROGRAM_FMT_BLOCKS   (1 << 5)  /**< The memory address counts blocks rather than bytes */
+
+		/** Batch segment flags, one byte per segment. A segment is flags, 7-bit address (the low byte of a 10-bit
+		 *  one), 16-bit length, the
+		 *  execute-at time for \ref BATCH_FLAG_AT and write data. Segments are joined by repeated STARTs, the last
+		 *  segment ends with a STOP unless the bus is locked by \ref BULK_OP_LOCK. A \ref BATCH_FLAG_GPIO segment
+		 *  carries a GPIO operation byte in place of the address and its argument in place of the length; it leaves
+		 *  the bus as it is, so the next segment still follows with a repeated START. On 7-bit I2C segments the
+		 *  top bits of \ref BATCH_FLAG_TEN_HIGH say what a failed segment does to the ones after it instead, see
+		 *  \ref BATCH_ON_FAIL.
+		 */
+		#define BATCH_FLAG_RD        I2C_M_RD  /**< Read segment */
+		#define BATCH_FLAG_STOP      (1 << 1)  /**< Send a STOP after this segment even if it is not the last */
+		#define BATCH_FLAG_DETAIL    (1 << 2)  /**< Follow the segment's response with its result code and TWSR status */
+		#define BATCH_FLAG_AT        (1 << 3)  /**< Hold the START until a 16-bit USB frame number plus a 16-bit offset in us */
+		#define BATCH_FLAG_TEN       (1 << 4)  /**< 10-bit address, its top two bits in \ref BATCH_FLAG_TEN_HIGH */
+		#define BATCH_FLAG_TEN_HIGH  (3 << 5)  /**< Address bits 9 and 8 of a \ref BATCH_FLAG_TEN segment */
+		#define BATCH_FLAG_GPIO      (1 << 7)  /**< GPIO segment, see Gpio_Run(); response: level + status byte */
+
+		/** Failure policy of a 7-bit I2C segment, in the bits \ref BATCH_FLAG_TEN_HIGH has on 10-bit ones. A segment
+		 *  fails if its address isn't ACKed or its data phase doesn't finish cleanly; 0 goes on with the next segment
+		 *  regardless. Skipped segments send no START and respond as usual, with status \ref STATUS_IDLE, zeros for
+		 *  read data and a \ref BATCH_RESULT_SKIPPED detail record.
+		 */
+		#define BATCH_ON_FAIL        (3 << 5)
+		#define BATCH_ON_FAIL_SKIP   (1 << 5)  /**< STOP, and skip the segments up to the end of the transaction */
+		#define BATCH_ON_FAIL_ABORT  (2 << 5)  /**< STOP, and skip the rest of the batch */
+
+		/** Result code of a batch detail record for a segment that didn't run because another path was in the middle
+		 *  of a transaction; the others are TWI_ErrorCodes_t values and \ref TWI_ENGINE_ERROR_StretchTimeout.
+		 */
+		#define BATCH_RESULT_BUS_BUSY  0x11
+
+		/** Result code of a batch detail record for a segment skipped by an earlier one's \ref BATCH_ON_FAIL. */
+		#define BATCH_RESULT_SKIPPED   0x12
+
+		/** Result code of a batch detail record for a segment skipped past the deadline of \ref BULK_OP_DEADLINE. */
+		#define BATCH_RESULT_EXPIRED   0x13
+
+		/** SMBus command flags. The command is flags, 7-bit address, command code, write count, write data and
+		 *  read count; write and read parts are joined by a repeated START, a read count of 0 means no read part.
+		 */
+		#define SMBUS_FLAG_PEC       (1 << 0)  /**< Append a PEC to the write, or read and check one after the read */
+		#define SMBUS_FLAG_BLOCK_WR  (1 << 1)  /**< Send the write count as a byte count before the write data */
+		#define SMBUS_FLAG_BLOCK_RD  (1 << 2)  /**< The first byte read is the byte count, read count is the maximum */
+
+		/** Flags of a \ref Bulk_Cancel_t, what else a CMD_CANCEL ended besides dropping data. */
+		#define CANCEL_FLAG_STOP     (1 << 0)  /**< A bulk transaction was open and got its STOP */
+		#define CANCEL_FLAG_UNLOCK   (1 << 1)  /**< The bus lock of \ref BULK_OP_LOCK was released */
+		#define CANCEL_FLAG_POLL     (1 << 2)  /**< A polling job was cleared */
+
+	/* Type Defines: */
+		/** Type define for the CMD_CANCEL response, what was dropped. */
+		typedef struct
+		{
+			uint16_t OutBytes;   /**< Command bytes received but not carried out */
+			uint8_t  InPackets;  /**< Response packets not fetched by the host, a partly filled one included */
+			uint8_t  Flags;      /**< CANCEL_FLAG_* bits */
+		} ATTR_PACKED Bulk_Cancel_t;
+
+		/** Type define for the BULK_OP_POST_STATUS response, the posted commands that failed since the last one. */
+		typedef struct
+		{
+			uint8_t  Failures;   /**< Number of failed posted commands, saturating */
+			uint8_t  Tag;        /**< Tag of the first of them */
+			uint8_t  Status;     /**< Its status byte */
+		} ATTR_PACKED Bulk_PostStatus_t;
+
+	/* Function Prototypes: */
+		bool Bulk_ResponsePending(void);
+		void Bulk_RequestCancel(const bool cancel);
+		void Bulk_Cancel(Bulk_Cancel_t* const report);
+		bool Bulk_Task(void);
+
+		#if defined(__INCLUDE_FROM_BULKPROTOCOL_C)
+			static uint8_t Bulk_ReadAvailable(void);
+			static bool Bulk_DataReady(void);
+			static uint8_t Bulk_Read_8(void);
+			static uint16_t Bulk_Read_16(void);
+			static uint8_t Bulk_WriteSpace(void);
+			static void Bulk_WriteDone(const uint8_t count);
+			static void Bulk_Write_8(const uint8_t value);
+			static void Bulk_Flush(void);
+			static void Bulk_ReleaseBus(void);
+			static uint8_t Bulk_Address(const uint16_t address);
+			static uint8_t Bulk_I2CStart(const uint16_t address);
+			static uint8_t Bulk_DataStatus(void);
+			static void Bulk_Abandon(void);
+			static void Bulk_BatchDetail(const uint8_t status);
+			static void Bulk_BatchSkip(const uint8_t flags, const uint16_t len, const uint8_t status);
+			static void Bulk_WriteStamp(const uint16_t frame, const uint8_t subframe);
+			static void Bulk_Deadline(void);
+			static bool Bulk_SyncStart(void);
+			static void Bulk_Post(void);
+			static void Bulk_PostDone(void);
+			static void Bulk_PostReport(void);
+			static void Bulk_TxPut(const uint8_t value);
+			static void Bulk_TxStream(uint16_t len) ATTR_HOT_PATH;
+			static uint8_t Bulk_RxGet(void);
+			static void Bulk_I2CWrite(uint16_t len);
+			static void Bulk_TWIRead(uint16_t len, const uint8_t nack_last_byte) ATTR_HOT_PATH;
+			static void Bulk_I2CRead(uint16_t len, const uint8_t nack_last_byte) ATTR_HOT_PATH;
+			static void Bulk_EndTransfer(void);
+			static void Bulk_I2CReadLong(uint32_t len);
+			static void Bulk_I2CWriteLong(uint32_t len);
+			static void Bulk_I2CStop(void);
+			static void Bulk_WaitUntil(const uint16_t frame, const uint16_t offset_us);
+			static void Bulk_Batch(void);
+			static void Bulk_Lock(void);
+			static void Bulk_Unlock(const uint8_t reason);
+			static uint8_t Bulk_EEPROMPoll(const uint8_t address);
+			static uint8_t Bulk_EEPROMDevice(const uint8_t address, const uint8_t format, const uint32_t offset);
+			static uint32_t Bulk_EEPROMBlockLeft(const uint8_t format, const uint32_t offset);
+			static uint8_t Bulk_EEPROMSelect(const uint8_t address, const uint8_t format, const uint32_t offset);
+			static uint8_t Bulk_EEPROMGangPoll(const uint8_t channels, const uint8_t device);
+			static void Bulk_EEPROMGangWrite(const uint8_t address, const uint8_t format, const uint16_t page_size,
+			                                 uint32_t offset, uint16_t len);
+			static void Bulk_EEPROMWrite(void);
+			static void Bulk_EEPROMRead(void);
+			static uint8_t Bulk_ProgramPoll(const uint8_t address, const uint8_t reg, const uint8_t mask,
+			                                const uint8_t value, const uint16_t timeout);
+			static void Bulk_Program(void);
+			#if SNIFF_SUPPORT
+			static void Bulk_Sniff(void);
+			#endif
+			#if EMU_SUPPORT
+			static void Bulk_Emulate(const uint8_t bits);
+			static void Bulk_EmuWrite(void);
+			static void Bulk_EmuRead(void);
+			#endif
+			static void Bulk_Spi(void) ATTR_HOT_PATH;
+			#if UART_SUPPORT
+			static void Bulk_Uart(void);
+			static void Bulk_UartWrite(void);
+			#endif
+			static void Bulk_Gpio(const uint8_t op, const uint16_t arg);
+			static void Bulk_GpioOp(void);
+			static void Bulk_SMBus(void);
+			static void Bulk_MergeClose(void);
+			static void Bulk_RegVerify(const uint8_t address, const uint8_t reg, const uint8_t count);
+			static void Bulk_RegWrite(void);
+			static uint8_t Bulk_RegSelect(const uint8_t address, const uint8_t reg);
+			static void Bulk_RegUpdate(void);
+			static void Bulk_MultiWrite(void);
+			static void Bulk_Gather(void);
+			static void Bulk_Scatter(void);
+			static bool Bulk_ClaimIdle(void);
+			#if MUX_SUPPORT
+			static void Bulk_Route(void);
+			static void Bulk_Discover(void);
+			#endif
+			static void Bulk_Stream(void);
+			static void Bulk_Checksum(void);
+			static void Bulk_Poll(void);
+			static void Bulk_PollFilter(void);
+			static void Bulk_PollReduce(void);
+			#if FIFO_SUPPORT
+			static void Bulk_Fifo(void);
+			#endif
+		#endif
+
+#endif
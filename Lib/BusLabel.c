@@ -0,0 +1,96 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_BUSLABEL_C
+#include "BusLabel.h"
+
+static Label_Descriptor_t Label_String EEMEM;
+
+/** Sent for the label string while none is stored. */
+static const USB_Descriptor_String_t PROGMEM Label_Empty = USB_STRING_DESCRIPTOR(L"");
+
+// Number of characters stored, 0 for blank EEPROM or anything else that isn't a label
+static uint8_t Label_Length(void)
+{
+	const uint8_t size = eeprom_read_byte(&Label_String.Header.Size);
+
+	if ((eeprom_read_byte(&Label_String.Header.Type) != DTYPE_String) || (size < sizeof(USB_Descriptor_Header_t)) ||
+	    (size > sizeof(Label_Descriptor_t)) || (size & 1))
+		return 0;
+
+	return (size - sizeof(USB_Descriptor_Header_t)) / 2;
+}
+
+/** Points LUFA at the string descriptor holding the bus label, for CALLBACK_USB_GetDescriptor().
+ *  @return Size of the descriptor
+ */
+uint16_t Label_GetDescriptor(const void** const address, uint8_t* const memory_space)
+{
+	if (!Label_Length()) {
+		*address      = &Label_Empty;
+		*memory_space = MEMSPACE_FLASH;
+		return pgm_read_byte(&Label_Empty.Header.Size);
+	}
+
+	*address      = &Label_String;
+	*memory_space = MEMSPACE_EEPROM;
+	return eeprom_read_byte(&Label_String.Header.Size);
+}
+
+/** Copies the bus label into a buffer of \ref LABEL_MAX_LENGTH bytes, one byte per character.
+ *  @return Length of the label, 0 if none is set
+ */
+uint8_t Label_Get(uint8_t* const label)
+{
+	const uint8_t length = Label_Length();
+
+	for (uint8_t i = 0; i < length; i++)
+		label[i] = eeprom_read_word(&Label_String.UnicodeString[i]);
+
+	return length;
+}
+
+/** Stores a new bus label of up to \ref LABEL_MAX_LENGTH bytes, each taken as a Latin-1 character; an empty one
+ *  removes the label. The EEPROM writes take about 3.4 ms per changed byte, so this must not run from an interrupt.
+ *  Hosts see the new label after the next enumeration.
+ */
+void Label_Set(const uint8_t* const label, const uint8_t length)
+{
+	// Invalidate first, so a label cut short by a power loss isn't sent
+	eeprom_update_byte(&Label_String.Header.Type, 0xFF);
+	if (!length)
+		return;
+
+	for (uint8_t i = 0; i < length; i++) {
+		eeprom_update_word(&Label_String.UnicodeString[i], label[i]);
+		Watchdog_Kick();
+	}
+
+	eeprom_update_byte(&Label_String.Header.Size, sizeof(USB_Descriptor_Header_t) + length * 2);
+	eeprom_update_byte(&Label_String.Header.Type, DTYPE_String);
+}
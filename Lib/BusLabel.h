@@ -0,0 +1,66 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for BusLabel.c.
+ */
+
+#ifndef _BUS_LABEL_H_
+#define _BUS_LABEL_H_
+
+	/* Includes: */
+		#include <avr/eeprom.h>
+
+		#include "../i2c-tiny-usb.h"
+		#include "Watchdog.h"
+
+	/* Macros: */
+		/** Longest bus label in characters. */
+		#define LABEL_MAX_LENGTH      32
+
+	/* Type Defines: */
+		/** Type define for the bus label as stored in EEPROM: a complete string descriptor, so that LUFA can send
+		 *  it straight from there.
+		 */
+		typedef struct
+		{
+			USB_Descriptor_Header_t Header;                           /**< Descriptor header, size and type */
+			uint16_t                UnicodeString[LABEL_MAX_LENGTH];  /**< Label characters, Latin-1 in UTF-16 */
+		} Label_Descriptor_t;
+
+	/* Function Prototypes: */
+		uint16_t Label_GetDescriptor(const void** const address, uint8_t* const memory_space);
+		uint8_t Label_Get(uint8_t* const label);
+		void Label_Set(const uint8_t* const label, const uint8_t length);
+
+		#if defined(__INCLUDE_FROM_BUSLABEL_C)
+			static uint8_t Label_Length(void);
+		#endif
+
+#endif
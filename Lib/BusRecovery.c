@@ -0,0 +1,115 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Recovery of a bus whose SDA line is held low by a target that lost track of the transaction, e.g. after the
+ *  host aborted a read in the middle of a byte. The TWI can't get a START out on such a bus, so the lines are
+ *  taken over as GPIOs and clocked until the target has shifted out the rest of its byte, then a STOP puts every
+ *  target back into idle.
+ */
+
+#define  __INCLUDE_FROM_BUSRECOVERY_C
+#include "BusRecovery.h"
+#include "Stats.h"
+#include "TargetConfig.h"
+#include "Timebase.h"
+#include "Trace.h"
+
+#include <util/delay.h>
+
+// Release SCL and wait for it to go high, for as long as a target may stretch the clock
+static bool BusRecovery_ClockHigh(void)
+{
+	const uint16_t started = Timebase_Now();
+
+	BUS_RECOVERY_DDR &= ~BUS_RECOVERY_SCL;
+	while (!(BUS_RECOVERY_PIN & BUS_RECOVERY_SCL)) {
+		if (Timebase_Elapsed(started) >= Timebase_MsToTicks(TargetConfig_Default.StretchTimeoutMs))
+			return false;
+	}
+
+	_delay_us(BUS_RECOVERY_DELAY_US);
+	return true;
+}
+
+/** Frees the bus: up to \ref BUS_RECOVERY_PULSES clock pulses while SDA is low, then a STOP, and the TWI set up
+ *  again with the default speed. Whatever transaction was going on is lost; the caller has claimed the bus.
+ *  @param pulses Set to the number of clock pulses it took
+ *  @return A BUS_RECOVERY_* result
+ */
+uint8_t BusRecovery_Run(uint8_t* const pulses)
+{
+	uint8_t result = BUS_RECOVERY_OK;
+	uint8_t count  = 0;
+
+	// With the TWI off the port drives the pins: open drain by switching the direction, no pull-ups
+	TWCR = 0;
+	Stats_BusEvent(STATS_BUS_Stop);
+	BUS_RECOVERY_PORT &= ~(BUS_RECOVERY_SCL | BUS_RECOVERY_SDA);
+	BUS_RECOVERY_DDR  &= ~(BUS_RECOVERY_SCL | BUS_RECOVERY_SDA);
+
+	if (!BusRecovery_ClockHigh()) {
+		result = BUS_RECOVERY_SCL_STUCK;
+	} else {
+		// A target sending a byte lets go of SDA after its last bit or at our missing ACK
+		while (!(BUS_RECOVERY_PIN & BUS_RECOVERY_SDA) && (count < BUS_RECOVERY_PULSES)) {
+			BUS_RECOVERY_DDR |= BUS_RECOVERY_SCL;
+			_delay_us(BUS_RECOVERY_DELAY_US);
+			count++;
+			if (!BusRecovery_ClockHigh()) {
+				result = BUS_RECOVERY_SCL_STUCK;
+				break;
+			}
+		}
+	}
+
+	if (result == BUS_RECOVERY_OK) {
+		// STOP: SDA goes low while SCL is low and comes back up once SCL is high again
+		BUS_RECOVERY_DDR |= BUS_RECOVERY_SCL;
+		_delay_us(BUS_RECOVERY_DELAY_US);
+		BUS_RECOVERY_DDR |= BUS_RECOVERY_SDA;
+		_delay_us(BUS_RECOVERY_DELAY_US);
+		if (!BusRecovery_ClockHigh())
+			result = BUS_RECOVERY_SCL_STUCK;
+		BUS_RECOVERY_DDR &= ~BUS_RECOVERY_SDA;
+		_delay_us(BUS_RECOVERY_DELAY_US);
+
+		if ((result == BUS_RECOVERY_OK) && !(BUS_RECOVERY_PIN & BUS_RECOVERY_SDA))
+			result = BUS_RECOVERY_SDA_STUCK;
+	}
+
+	BUS_RECOVERY_DDR &= ~(BUS_RECOVERY_SCL | BUS_RECOVERY_SDA);
+	TWI_Init(TargetConfig_Default.Prescaler, TargetConfig_Default.BitRate);
+
+	Trace_Add(TRACE_RECOVERY, (result == BUS_RECOVERY_OK) ? count : 0xFF);
+	Stats_Count(&Stats.BusRecoveries);
+
+	*pulses = count;
+	return result;
+}
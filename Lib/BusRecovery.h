@@ -0,0 +1,75 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for BusRecovery.c.
+ */
+
+#ifndef _BUS_RECOVERY_H_
+#define _BUS_RECOVERY_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+	/* Macros: */
+		/** Port registers and pin masks of the TWI lines, PD0 (SCL) and PD1 (SDA) on the xU4. */
+		#define BUS_RECOVERY_PORT        PORTD
+		#define BUS_RECOVERY_DDR         DDRD
+		#define BUS_RECOVERY_PIN         PIND
+		#define BUS_RECOVERY_SCL         (1 << 0)
+		#define BUS_RECOVERY_SDA         (1 << 1)
+
+		/** Half a clock period of the recovery pulses in microseconds, 100 kHz that every target can follow. */
+		#define BUS_RECOVERY_DELAY_US    5
+
+		/** Most clock pulses to get a target to let go of SDA: the rest of a byte plus the ACK bit. */
+		#define BUS_RECOVERY_PULSES      9
+
+		/** Results of \ref BusRecovery_Run(), the first byte of the CMD_RECOVER_BUS response. */
+		#define BUS_RECOVERY_OK          0 /**< Both lines are high, the bus is free */
+		#define BUS_RECOVERY_SCL_STUCK   1 /**< Something holds SCL low, clocking can't help */
+		#define BUS_RECOVERY_SDA_STUCK   2 /**< SDA stayed low through all pulses and the STOP */
+		#define BUS_RECOVERY_BUSY        3 /**< Another path is in the middle of a transaction, nothing was done */
+
+	/* Inline Functions: */
+		/** Returns true if one of the TWI lines is low although the TWI is not driving the bus. */
+		static inline bool BusRecovery_IsStuck(void) ATTR_ALWAYS_INLINE;
+		static inline bool BusRecovery_IsStuck(void)
+		{
+			return ((BUS_RECOVERY_PIN & (BUS_RECOVERY_SCL | BUS_RECOVERY_SDA)) != (BUS_RECOVERY_SCL | BUS_RECOVERY_SDA));
+		}
+
+	/* Function Prototypes: */
+		uint8_t BusRecovery_Run(uint8_t* const pulses);
+
+		#if defined(__INCLUDE_FROM_BUSRECOVERY_C)
+			static bool BusRecovery_ClockHigh(void);
+		#endif
+
+#endif
@@ -0,0 +1,261 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_BUSSNIFFER_C
+#include "BusSniffer.h"
+#include "BulkProtocol.h"
+#include "PollEngine.h"
+
+#if SNIFF_SUPPORT
+
+#define SNIFF_SCL             BUS_RECOVERY_SCL
+#define SNIFF_SDA             BUS_RECOVERY_SDA
+#define SNIFF_BUFFER_MASK     (SNIFF_BUFFER_SIZE - 1)
+
+// Bit count of Sniff_Bits between a STOP and the next START
+#define SNIFF_IDLE            0xFF
+
+// Records collected by the edge interrupts; the interrupts only move the head, Sniff_Task() only the tail, and
+// the head moves by whole records so the task never sees half of one
+static uint8_t Sniff_Buffer[SNIFF_BUFFER_SIZE];
+static volatile uint8_t Sniff_Head;
+static volatile uint8_t Sniff_Tail;
+
+// Decoder state, interrupts only
+static uint8_t Sniff_Bits;
+static uint8_t Sniff_Shift;
+static uint8_t Sniff_Lost;
+
+static bool Sniff_Active;
+static uint8_t Sniff_Prescaler;
+static uint8_t Sniff_BitRate;
+
+static uint8_t Sniff_FrameBytes;
+static uint16_t Sniff_FrameTick;
+
+// Make room for a record in the interrupts, leading it with an overflow record if records were lost before it;
+// a record that doesn't fit is counted as lost
+static inline bool Sniff_Begin(uint8_t* const head, uint8_t length)
+{
+	if (Sniff_Lost)
+		length += 2;
+
+	if (((Sniff_Tail - *head - 1) & SNIFF_BUFFER_MASK) < length) {
+		if (Sniff_Lost < UINT8_MAX)
+			Sniff_Lost++;
+		return false;
+	}
+
+	if (Sniff_Lost) {
+		Sniff_Put(head, SNIFF_RECORD_OVERFLOW);
+		Sniff_Put(head, Sniff_Lost);
+		Sniff_Lost = 0;
+	}
+
+	return true;
+}
+
+static inline void Sniff_Put(uint8_t* const head, const uint8_t value)
+{
+	Sniff_Buffer[*head] = value;
+	*head = (*head + 1) & SNIFF_BUFFER_MASK;
+}
+
+// SCL rising: SDA holds the next bit, the ninth one of a byte is the receiver's ACK. The pins are read first thing,
+// SDA only stays put for as long as SCL is high.
+ISR(INT0_vect)
+{
+	const uint8_t pins = BUS_RECOVERY_PIN;
+
+	if (Sniff_Bits == SNIFF_IDLE)
+		return;
+
+	if (Sniff_Bits < 8) {
+		Sniff_Shift = (Sniff_Shift << 1) | ((pins & SNIFF_SDA) ? 1 : 0);
+		Sniff_Bits++;
+		return;
+	}
+
+	Sniff_Bits = 0;
+
+	uint8_t head = Sniff_Head;
+	if (Sniff_Begin(&head, 2)) {
+		Sniff_Put(&head, (pins & SNIFF_SDA) ? SNIFF_RECORD_NAK : SNIFF_RECORD_ACK);
+		Sniff_Put(&head, Sniff_Shift);
+		Sniff_Head = head;
+	}
+}
+
+// SDA changing: with SCL low that is just the next bit, with SCL high a START (falling) or STOP (rising)
+ISR(INT1_vect)
+{
+	const uint8_t pins = BUS_RECOVERY_PIN;
+
+	if (!(pins & SNIFF_SCL))
+		return;
+
+	uint8_t head = Sniff_Head;
+	if (!(pins & SNIFF_SDA)) {
+		Sniff_Bits = 0;
+		if (Sniff_Begin(&head, 4)) {
+			uint8_t subframe;
+			const uint16_t frame = Timebase_FrameStamp(&subframe);
+
+			Sniff_Put(&head, SNIFF_RECORD_START);
+			Sniff_Put(&head, frame & 0xFF);
+			Sniff_Put(&head, frame >> 8);
+			Sniff_Put(&head, subframe);
+		}
+	} else if (Sniff_Bits != SNIFF_IDLE) {
+		Sniff_Bits = SNIFF_IDLE;
+		if (Sniff_Begin(&head, 1))
+			Sniff_Put(&head, SNIFF_RECORD_STOP);
+	}
+	Sniff_Head = head;
+}
+
+static uint8_t Sniff_RecordLength(const uint8_t type)
+{
+	switch (type) {
+		case SNIFF_RECORD_START:
+			return 4;
+		case SNIFF_RECORD_STOP:
+			return 1;
+		default:
+			return 2;
+	}
+}
+
+/** Sends off a partially filled packet of records, e.g. before a bulk response goes into the IN endpoint. */
+void Sniff_Flush(void)
+{
+	if (Sniff_FrameBytes) {
+		Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+		I2C_ClearVendorIN();
+		Sniff_FrameBytes = 0;
+	}
+}
+
+/** Turns the adapter into a bus monitor: the TWI lets go of the pins, which become plain inputs without pull-ups,
+ *  and the edge interrupts on SCL (INT0) and SDA (INT1) decode the traffic into records for \ref Sniff_Task().
+ *  The bus stays claimed for the sniffer until \ref Sniff_Stop(), so the other paths report it as busy.
+ *  @return false if another path is in the middle of a transaction
+ */
+bool Sniff_Start(void)
+{
+	if (Sniff_Active)
+		return true;
+	if (!I2C_ClaimBus(BUS_OWNER_SNIFF))
+		return false;
+
+	// Poll records must not end up in the middle of the stream
+	Poll_Flush();
+
+	Sniff_Prescaler = TWSR & ((1 << TWPS1) | (1 << TWPS0));
+	Sniff_BitRate   = TWBR;
+	TWCR = 0;
+	BUS_RECOVERY_PORT &= ~(SNIFF_SCL | SNIFF_SDA);
+	BUS_RECOVERY_DDR  &= ~(SNIFF_SCL | SNIFF_SDA);
+
+	Sniff_Head = Sniff_Tail = 0;
+	Sniff_Lost = 0;
+	Sniff_Bits = SNIFF_IDLE;
+	Sniff_Active = true;
+
+	// SCL on the rising edge only, SDA on both
+	EICRA = (EICRA & ~((3 << ISC00) | (3 << ISC10))) | (3 << ISC00) | (1 << ISC10);
+	EIFR  = (1 << INTF0) | (1 << INTF1);
+	EIMSK |= (1 << INT0) | (1 << INT1);
+
+	Trace_Add(TRACE_SNIFF, 1);
+	return true;
+}
+
+/** Ends monitoring, dropping the records not sent yet, and hands the pins back to the TWI at its old speed. A
+ *  packet of records still open is forgotten as well, see \ref Sniff_Flush().
+ */
+void Sniff_Stop(void)
+{
+	if (!Sniff_Active)
+		return;
+
+	EIMSK &= ~((1 << INT0) | (1 << INT1));
+	Sniff_Active     = false;
+	Sniff_FrameBytes = 0;
+
+	TWI_Init(Sniff_Prescaler, Sniff_BitRate);
+	I2C_ReleaseBus();
+	Trace_Add(TRACE_SNIFF, 0);
+}
+
+/** Tells whether the adapter is monitoring the bus. */
+bool Sniff_IsActive(void)
+{
+	return Sniff_Active;
+}
+
+/** Sends the records collected by the edge interrupts over the bulk IN endpoint, whole records per packet, and
+ *  a packet that isn't full at the end of the frame it was started in. Called from the main loop; while the host
+ *  isn't reading, the buffer fills up and the interrupts count the records they have to drop.
+ */
+void Sniff_Task(void)
+{
+	if (!Sniff_Active || !I2C_IsBulkActive() || Bulk_ResponsePending())
+		return;
+
+	const uint16_t now = Timebase_GetFrame();
+
+	if (Sniff_FrameBytes && (now != Sniff_FrameTick))
+		Sniff_Flush();
+
+	uint8_t tail = Sniff_Tail;
+	while (tail != Sniff_Head) {
+		const uint8_t length = Sniff_RecordLength(Sniff_Buffer[tail]);
+
+		if (Sniff_FrameBytes + length > VENDOR_IO_EPSIZE)
+			Sniff_Flush();
+
+		Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+		if (!Sniff_FrameBytes) {
+			if (!Endpoint_IsINReady())
+				break;
+			Sniff_FrameTick = now;
+		}
+
+		for (uint8_t i = 0; i < length; i++) {
+			Endpoint_Write_8(Sniff_Buffer[tail]);
+			tail = (tail + 1) & SNIFF_BUFFER_MASK;
+		}
+		Sniff_FrameBytes += length;
+
+		// Free the space right away, the interrupts keep adding records meanwhile
+		Sniff_Tail = tail;
+	}
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for BusSniffer.c.
+ */
+
+#ifndef _BUS_SNIFFER_H_
+#define _BUS_SNIFFER_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "BusRecovery.h"
+		#include "Timebase.h"
+		#include "Trace.h"
+
+	/* Macros: */
+		/** Record types of the sniffer stream, distinct from the entry index of a poll record. */
+		#define SNIFF_RECORD_START     0xF0 /**< (Repeated) START, followed by a 16-bit frame count and Timer1 ticks into the frame */
+		#define SNIFF_RECORD_ACK       0xF1 /**< Byte the receiver ACKed, followed by the byte */
+		#define SNIFF_RECORD_NAK       0xF2 /**< Byte the receiver NAKed, followed by the byte */
+		#define SNIFF_RECORD_STOP      0xF3 /**< STOP */
+		#define SNIFF_RECORD_OVERFLOW  0xF4 /**< Records lost to a full buffer, followed by their number, saturating */
+
+		#if (SNIFF_BUFFER_SIZE > 256) || (SNIFF_BUFFER_SIZE & (SNIFF_BUFFER_SIZE - 1))
+			#error SNIFF_BUFFER_SIZE must be a power of two up to 256
+		#endif
+
+	/* Function Prototypes: */
+		#if SNIFF_SUPPORT
+			bool Sniff_Start(void);
+			void Sniff_Stop(void);
+			bool Sniff_IsActive(void);
+			void Sniff_Flush(void);
+			void Sniff_Task(void);
+		#endif
+
+		#if defined(__INCLUDE_FROM_BUSSNIFFER_C) && SNIFF_SUPPORT
+			static inline bool Sniff_Begin(uint8_t* const head, uint8_t length) ATTR_ALWAYS_INLINE;
+			static inline void Sniff_Put(uint8_t* const head, const uint8_t value) ATTR_ALWAYS_INLINE;
+			static uint8_t Sniff_RecordLength(const uint8_t type);
+		#endif
+
+	/* Inline Functions: */
+		#if !SNIFF_SUPPORT
+			/* Without SNIFF_SUPPORT the sniffer never runs, so there is nothing to stop, flush or serve. */
+			static inline void Sniff_Stop(void) {}
+			static inline bool Sniff_IsActive(void) { return false; }
+			static inline void Sniff_Flush(void) {}
+			static inline void Sniff_Task(void) {}
+		#endif
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "CRC32.h"
+
+// The reflected polynomial 0xEDB88320 of zlib and Ethernet, a nibble at a time: 64 bytes of flash instead of 1 KB
+const uint32_t CRC32_Table[16] PROGMEM =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+/** Feeds one byte into a running CRC-32; start with \ref CRC32_INIT and XOR the result with it once more to get
+ *  the value zlib's crc32() gives.
+ */
+uint32_t CRC32_Update(uint32_t crc, const uint8_t value)
+{
+	crc ^= value;
+	crc = (crc >> 4) ^ pgm_read_dword(&CRC32_Table[crc & 0x0F]);
+	crc = (crc >> 4) ^ pgm_read_dword(&CRC32_Table[crc & 0x0F]);
+	return crc;
+}
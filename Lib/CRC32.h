@@ -0,0 +1,53 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for CRC32.c.
+ */
+
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+	/* Includes: */
+		#include <stdint.h>
+		#include <avr/pgmspace.h>
+
+		#include <LUFA/Common/Common.h>
+
+	/* Macros: */
+		/** Value to start a CRC-32 with, and to XOR the final value with. */
+		#define CRC32_INIT    0xFFFFFFFFUL
+
+	/* External Variables: */
+		extern const uint32_t CRC32_Table[16] PROGMEM;
+
+	/* Function Prototypes: */
+		uint32_t CRC32_Update(uint32_t crc, const uint8_t value);
+
+#endif
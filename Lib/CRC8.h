@@ -0,0 +1,54 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for CRC8.c.
+ */
+
+#ifndef _CRC8_H_
+#define _CRC8_H_
+
+	/* Includes: */
+		#include <stdint.h>
+		#include <avr/pgmspace.h>
+
+		#include <LUFA/Common/Common.h>
+
+	/* External Variables: */
+		extern const uint8_t CRC8_Table[256] PROGMEM;
+
+	/* Inline Functions: */
+		/** Feeds one byte into a running SMBus PEC, start with a CRC of 0. */
+		static inline uint8_t CRC8_Update(const uint8_t crc, const uint8_t value) ATTR_ALWAYS_INLINE;
+		static inline uint8_t CRC8_Update(const uint8_t crc, const uint8_t value)
+		{
+			return pgm_read_byte(&CRC8_Table[crc ^ value]);
+		}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Self-measurement of the bus clock. SCL (PD0) is wired to the Timer0 clock input T0 (PD7), so Timer0 counts
+ *  the rising SCL edges in hardware and interrupts once per nine of them, one byte. The interrupt stamps Timer3,
+ *  running at F_CPU / 8, and keeps the shortest and longest time from one byte to the next: the shortest is nine
+ *  bit times, anything longer is SCL held low between bytes while the adapter waited for USB. The stamps are taken
+ *  in the interrupt, so they jitter by its latency, a few microseconds under USB load.
+ */
+
+#define  __INCLUDE_FROM_CLOCKMETER_C
+#include "ClockMeter.h"
+
+#if CLOCK_METER_SUPPORT
+
+static ClockMeter_t ClockMeter;
+
+// Edges counted by Timer0 before the last resync, the Timer3 stamp and frame of the last byte, and whether the
+// next byte time spans a START and is to be left out
+static uint32_t ClockMeter_Partial;
+static uint16_t ClockMeter_Last;
+static uint16_t ClockMeter_LastFrame;
+static uint16_t ClockMeter_StartFrame;
+static uint8_t  ClockMeter_Skip;
+
+// Edges Timer0 has counted that the interrupt hasn't added yet; it adds all nine edges of a byte at the eighth,
+// as TCNT0 reaches OCR0A, so at OCR0A with the interrupt already done that is one less than nothing. Called with
+// interrupts disabled.
+static uint32_t ClockMeter_Pending(void)
+{
+	const uint8_t count = TCNT0;
+
+	if ((count == OCR0A) && !(TIFR0 & (1 << OCF0A)))
+		return (uint32_t)count - CLOCK_METER_BYTE_EDGES;
+
+	return count;
+}
+
+ISR(TIMER0_COMPA_vect, ISR_BLOCK)
+{
+	const uint16_t now      = TCNT3;
+	const uint16_t frame    = Timebase_Frame;
+	uint16_t       interval = now - ClockMeter_Last;
+
+	// Timer3 wraps after 32 ms
+	if ((uint16_t)(frame - ClockMeter_LastFrame) > 30)
+		interval = UINT16_MAX;
+
+	ClockMeter_Last      = now;
+	ClockMeter_LastFrame = frame;
+	ClockMeter.Edges    += CLOCK_METER_BYTE_EDGES;
+
+	if (ClockMeter_Skip) {
+		ClockMeter_Skip = false;
+		return;
+	}
+
+	ClockMeter.Bytes++;
+	if (interval < ClockMeter.MinTicks)
+		ClockMeter.MinTicks = interval;
+	if (interval > ClockMeter.MaxTicks)
+		ClockMeter.MaxTicks = interval;
+}
+
+/** Starts a new measurement, T0 has to be wired to SCL. */
+void ClockMeter_Start(void)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	memset(&ClockMeter, 0, sizeof(ClockMeter));
+	ClockMeter.TickRateKHz = CLOCK_METER_TICK_KHZ;
+	ClockMeter.MinTicks    = UINT16_MAX;
+	ClockMeter_Partial     = 0;
+	ClockMeter_Skip        = true;
+	ClockMeter_StartFrame  = Timebase_Frame;
+	ClockMeter_LastFrame   = Timebase_Frame;
+
+	power_timer0_enable();
+	power_timer3_enable();
+	TCCR3A = 0;
+	TCCR3B = (1 << CS31);
+
+	// CTC at nine edges of the external clock on T0, rising edge
+	DDRD  &= ~(1 << 7);
+	PORTD &= ~(1 << 7);
+	TCCR0A = (1 << WGM01);
+	TCCR0B = (1 << CS02) | (1 << CS01) | (1 << CS00);
+	OCR0A  = CLOCK_METER_BYTE_EDGES - 1;
+	TCNT0  = 0;
+	TIFR0  = (1 << OCF0A);
+	TIMSK0 = (1 << OCIE0A);
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Stops measuring; the result stays readable until the next start. */
+void ClockMeter_Stop(void)
+{
+	if (!(TIMSK0 & (1 << OCIE0A)))
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	ClockMeter_Partial += ClockMeter_Pending();
+	ClockMeter.Millis   = Timebase_Frame - ClockMeter_StartFrame;
+	TIFR0  = (1 << OCF0A);
+	TIMSK0 = 0;
+	TCCR0B = 0;
+	TCCR3B = 0;
+	power_timer0_disable();
+	power_timer3_disable();
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Lines the edge count up with the bytes again at a START, see \ref ClockMeter_Sync(). A repeated START or a STOP
+ *  adds a rising edge of its own, which just shifts the bit the following bytes are stamped at.
+ */
+void ClockMeter_Resync(void)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	// A byte waiting for the interrupt is counted here, or it would take the place of the one to be left out
+	ClockMeter_Partial += ClockMeter_Pending();
+	TCNT0 = 0;
+	TIFR0 = (1 << OCF0A);
+	ClockMeter_Skip = true;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Sends the measurement as the data stage of CMD_CLOCK_METER, then carries out the CLOCK_METER_* action. */
+void ClockMeter_Send(const uint8_t action)
+{
+	ClockMeter_t snapshot;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	snapshot = ClockMeter;
+	if (TIMSK0 & (1 << OCIE0A)) {
+		snapshot.Edges += ClockMeter_Partial + ClockMeter_Pending();
+		snapshot.Millis = Timebase_Frame - ClockMeter_StartFrame;
+	} else {
+		snapshot.Edges += ClockMeter_Partial;
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	Endpoint_Write_Control_Stream_LE(&snapshot, MIN(sizeof(snapshot), USB_ControlRequest.wLength));
+
+	if (action == CLOCK_METER_START)
+		ClockMeter_Start();
+	else if (action == CLOCK_METER_STOP)
+		ClockMeter_Stop();
+}
+
+#endif
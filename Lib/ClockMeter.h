@@ -0,0 +1,87 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for ClockMeter.c.
+ */
+
+#ifndef _CLOCK_METER_H_
+#define _CLOCK_METER_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+
+	/* Macros: */
+		/** Rate of the stopwatch timing the bytes, Timer3 at F_CPU / 8, in kHz. */
+		#define CLOCK_METER_TICK_KHZ   (F_CPU / 8 / 1000)
+
+		/** SCL clock pulses per byte, eight bits and the ACK. */
+		#define CLOCK_METER_BYTE_EDGES 9
+
+		/** Actions in the CMD_CLOCK_METER wValue, carried out after the response has gone out. */
+		#define CLOCK_METER_READ       0 /**< Just return the measurement */
+		#define CLOCK_METER_START      1 /**< Start a new measurement */
+		#define CLOCK_METER_STOP       2 /**< Stop measuring and gate the timers again */
+
+	/* Type Defines: */
+		/** Type define for the CMD_CLOCK_METER response. */
+		typedef struct
+		{
+			uint16_t TickRateKHz; /**< \ref CLOCK_METER_TICK_KHZ */
+			uint32_t Edges;       /**< Rising SCL edges since the start */
+			uint16_t Millis;      /**< Frames since the start, wrapping after 65 s */
+			uint32_t Bytes;       /**< Byte times measured, those right after a START don't count */
+			uint16_t MinTicks;    /**< Shortest time from one byte to the next */
+			uint16_t MaxTicks;    /**< Longest time from one byte to the next within a transaction, 0xFFFF for 32 ms or more */
+		} ATTR_PACKED ClockMeter_t;
+
+	/* Function Prototypes: */
+		void ClockMeter_Start(void);
+		void ClockMeter_Stop(void);
+		void ClockMeter_Resync(void);
+		void ClockMeter_Send(const uint8_t action);
+
+		#if defined(__INCLUDE_FROM_CLOCKMETER_C) && CLOCK_METER_SUPPORT
+			static uint32_t ClockMeter_Pending(void);
+		#endif
+
+	/* Inline Functions: */
+		/** Tells the meter a START is about to go out, so the byte time across it isn't taken for a gap. Does
+		 *  nothing unless a measurement is running. Use this instead of \ref ClockMeter_Resync().
+		 */
+		static inline void ClockMeter_Sync(void) ATTR_ALWAYS_INLINE;
+		static inline void ClockMeter_Sync(void)
+		{
+			if (CLOCK_METER_SUPPORT && (TIMSK0 & (1 << OCIE0A)))
+				ClockMeter_Resync();
+		}
+
+#endif
+
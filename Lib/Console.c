@@ -0,0 +1,446 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Text console on the CDC-ACM interface of the composite build. Each line is either a command or a transaction in
+ *  Bus Pirate like syntax, which is compiled into a script and run by Script.c in one go; the answer is a single
+ *  line with the bytes read and the result.
+ */
+
+#define  __INCLUDE_FROM_CONSOLE_C
+#include "Console.h"
+
+/** LUFA CDC Class driver interface configuration and state information. */
+static USB_ClassInfo_CDC_Device_t Console_CDC =
+	{
+		.Config =
+			{
+				.ControlInterfaceNumber = INTERFACE_ID_CDC_CCI,
+				.DataINEndpoint         =
+					{
+						.Address        = CDC_TX_EPADDR,
+						.Size           = CDC_TXRX_EPSIZE,
+						.Banks          = 1,
+					},
+				.DataOUTEndpoint        =
+					{
+						.Address        = CDC_RX_EPADDR,
+						.Size           = CDC_TXRX_EPSIZE,
+						.Banks          = 1,
+					},
+				.NotificationEndpoint   =
+					{
+						.Address        = CDC_NOTIFICATION_EPADDR,
+						.Size           = CDC_NOTIFICATION_EPSIZE,
+						.Banks          = 1,
+					},
+			},
+	};
+
+static const char Console_Help[] PROGMEM =
+	"[ START, then the address byte, e.g. 0xA0; bytes to write, e.g. 0x12, or 0x12:4 for four of them\r\n"
+	"r read a byte, r:N N bytes; ] STOP; &:N wait N us, %:N wait N ms\r\n"
+	"$N run script slot N, f show the bus speed, f N set it in kHz\r\n";
+
+// Result words, indexed by SCRIPT_STATUS_* code
+static const char Console_StatusNames[][11] PROGMEM =
+	{"OK", "NAK", "BUS ERROR", "LOOP LIMIT", "TIMEOUT", "BAD OP", "BUSY"};
+
+// Line being received; a line that doesn't fit is dropped as a whole
+static char    Console_Line[CONSOLE_LINE_SIZE + 1];
+static uint8_t Console_LineLength;
+static bool    Console_Overflow;
+
+// Script compiled from the current line, taken from the arena, and the WRITE or READ that further bytes are added to
+static uint8_t* Console_Code;
+static uint8_t Console_CodeLength;
+static uint8_t Console_GroupOp;
+static uint8_t Console_GroupCount;
+
+// Set once the host stopped taking the answer, the rest of it is dropped
+static bool    Console_Gone;
+
+static void Console_Put(const char c)
+{
+	if (!Console_Gone && (CDC_Device_SendByte(&Console_CDC, c) != ENDPOINT_READYWAIT_NoError))
+		Console_Gone = true;
+}
+
+static void Console_PutString_P(const char* text)
+{
+	char c;
+
+	while ((c = pgm_read_byte(text++)))
+		Console_Put(c);
+}
+
+static void Console_PutHex(const uint8_t value)
+{
+	static const char digits[] PROGMEM = "0123456789ABCDEF";
+
+	Console_Put(pgm_read_byte(&digits[value >> 4]));
+	Console_Put(pgm_read_byte(&digits[value & 0x0F]));
+}
+
+static void Console_PutDecimal(uint32_t value)
+{
+	char    digits[10];
+	uint8_t count = 0;
+
+	do {
+		digits[count++] = '0' + (value % 10);
+		value /= 10;
+	} while (value);
+
+	while (count)
+		Console_Put(digits[--count]);
+}
+
+static void Console_Newline(void)
+{
+	Console_Put('\r');
+	Console_Put('\n');
+}
+
+// Parses a decimal, 0x hex or 0b binary number of up to 16 bits and moves the text pointer past it
+static bool Console_Number(const char** const text, uint16_t* const value)
+{
+	const char* p = *text;
+	uint8_t base = 10;
+
+	if ((p[0] == '0') && ((p[1] | 0x20) == 'x')) {
+		base = 16;
+		p += 2;
+	} else if ((p[0] == '0') && ((p[1] | 0x20) == 'b')) {
+		base = 2;
+		p += 2;
+	}
+
+	const char* const digits = p;
+	uint32_t result = 0;
+
+	for (;;) {
+		const char c = *p | 0x20;
+		uint8_t digit;
+
+		if ((c >= '0') && (c <= '9'))
+			digit = c - '0';
+		else if ((c >= 'a') && (c <= 'f'))
+			digit = c - 'a' + 10;
+		else
+			break;
+
+		if (digit >= base)
+			break;
+
+		result = (result * base) + digit;
+		if (result > UINT16_MAX)
+			return false;
+		p++;
+	}
+
+	if (p == digits)
+		return false;
+
+	*text  = p;
+	*value = result;
+	return true;
+}
+
+// Parses the optional ":N" after a token, 1 if there is none
+static bool Console_Amount(const char** const text, uint16_t* const value)
+{
+	*value = 1;
+
+	if (**text != ':')
+		return true;
+
+	(*text)++;
+	return Console_Number(text, value) && *value;
+}
+
+static bool Console_Emit(const uint8_t value)
+{
+	if (Console_CodeLength >= SCRIPT_SIZE)
+		return false;
+
+	Console_Code[Console_CodeLength++] = value;
+	return true;
+}
+
+// Counts one more byte into the open WRITE or READ, starting a new one if the last instruction was something else
+// or is full; consecutive reads thus only NACK the last byte, just like on the Bus Pirate
+static bool Console_Extend(const uint8_t op)
+{
+	if ((Console_GroupOp != op) || (Console_Code[Console_GroupCount] == UINT8_MAX)) {
+		if (!Console_Emit(op) || !Console_Emit(0))
+			return false;
+
+		Console_GroupOp    = op;
+		Console_GroupCount = Console_CodeLength - 1;
+	}
+
+	Console_Code[Console_GroupCount]++;
+	return true;
+}
+
+// Compiles a transaction line into Console_Code, returning 0 or the column of the token that didn't work out
+static uint8_t Console_Compile(const char* const line)
+{
+	const char* p = line;
+	bool want_address = false;
+
+	Console_Code = Arena_Alloc(SCRIPT_SIZE);
+	memset(Console_Code, SCRIPT_OP_END, SCRIPT_SIZE);
+	Console_CodeLength = 0;
+	Console_GroupOp    = SCRIPT_OP_END;
+
+	while (*p) {
+		const char* const token = p++;
+		uint16_t amount;
+		bool ok = true;
+
+		switch (*token) {
+			case ' ':
+			case '\t':
+			case ',':
+				continue;
+
+			case '[':
+				ok = !want_address;
+				want_address = true;
+				break;
+
+			case ']':
+				ok = !want_address && Console_Emit(SCRIPT_OP_STOP);
+				Console_GroupOp = SCRIPT_OP_END;
+				break;
+
+			case 'r':
+			case 'R':
+				ok = !want_address && Console_Amount(&p, &amount);
+				while (ok && amount--)
+					ok = Console_Extend(SCRIPT_OP_READ);
+				break;
+
+			case '&':
+			case '%':
+				ok = !want_address && Console_Amount(&p, &amount);
+				if (*token == '%')
+					ok = ok && (amount <= (UINT16_MAX / 1000));
+				if (ok) {
+					const uint16_t us = (*token == '%') ? (amount * 1000) : amount;
+					ok = Console_Emit(SCRIPT_OP_WAIT_US) && Console_Emit(us & 0xFF) && Console_Emit(us >> 8);
+				}
+				Console_GroupOp = SCRIPT_OP_END;
+				break;
+
+			default:
+			{
+				uint16_t value;
+
+				p = token;
+				ok = Console_Number(&p, &value) && (value <= UINT8_MAX) && Console_Amount(&p, &amount);
+				if (ok && want_address) {
+					ok = (amount == 1) && Console_Emit(SCRIPT_OP_START) && Console_Emit(value);
+					want_address = false;
+					Console_GroupOp = SCRIPT_OP_END;
+				} else {
+					while (ok && amount--)
+						ok = Console_Extend(SCRIPT_OP_WRITE) && Console_Emit(value);
+				}
+			}
+			break;
+		}
+
+		if (!ok)
+			return (token - line) + 1;
+	}
+
+	return want_address ? (p - line) + 1 : 0;
+}
+
+// Runs the compiled line, or the script in a slot if there is no code, and answers with the bytes read and the result
+static void Console_Run(const uint8_t* const code, const uint8_t slot)
+{
+	uint8_t* const result = Arena_Alloc(SCRIPT_RESULT_BUFFER);
+	uint8_t length = SCRIPT_RESULT_HEADER;
+
+	if ((I2C_BusOwner == BUS_OWNER_CONSOLE) || !I2C_ClaimBus(BUS_OWNER_CONSOLE)) {
+		result[0] = SCRIPT_STATUS_BUS_BUSY;
+	} else {
+		length = code ? Script_RunCode(code, CONSOLE_TIMEOUT_MS, result) : Script_Run(slot, CONSOLE_TIMEOUT_MS, result);
+		I2C_ReleaseBus();
+	}
+
+	for (uint8_t i = SCRIPT_RESULT_HEADER; i < length; i++) {
+		Console_PutHex(result[i]);
+		Console_Put(' ');
+	}
+
+	if (result[0] < (sizeof(Console_StatusNames) / sizeof(Console_StatusNames[0])))
+		Console_PutString_P(Console_StatusNames[result[0]]);
+	Console_Newline();
+}
+
+// "f" shows the bus speed, "f N" sets it like CMD_SET_BAUDRATE; both answer with the rate in use
+static void Console_Speed(const char* text)
+{
+	uint16_t khz;
+
+	while (*text == ' ')
+		text++;
+
+	if (*text) {
+		if (!Console_Number(&text, &khz) || !khz || *text) {
+			Console_PutString_P(PSTR("ERR"));
+			Console_Newline();
+			return;
+		}
+
+		// Not in the middle of someone else's transaction
+		if (!I2C_ClaimBus(BUS_OWNER_CONSOLE)) {
+			Console_PutString_P(Console_StatusNames[SCRIPT_STATUS_BUS_BUSY]);
+			Console_Newline();
+			return;
+		}
+
+		TWI_Disable();
+		SetupI2CSpeed(khz);
+		I2C_ReleaseBus();
+	}
+
+	Console_PutDecimal(I2C_Speed);
+	Console_PutString_P(PSTR(" Hz"));
+	Console_Newline();
+}
+
+static void Console_Execute(void)
+{
+	const char* line = Console_Line;
+
+	while (*line == ' ')
+		line++;
+
+	Console_Gone = false;
+	Arena_Reset();
+
+	switch (*line) {
+		case '\0':
+		case '#':
+			// Empty lines and comments get no answer
+			break;
+
+		case '?':
+			Console_PutString_P(Console_Help);
+			break;
+
+		case 'f':
+		case 'F':
+			Console_Speed(line + 1);
+			break;
+
+		case '$':
+		{
+			const char* text = line + 1;
+			uint16_t slot;
+
+			if (Console_Number(&text, &slot) && !*text && (slot <= UINT8_MAX) && Script_IsValidSlot(slot)) {
+				Console_Run(NULL, slot);
+			} else {
+				Console_PutString_P(PSTR("ERR"));
+				Console_Newline();
+			}
+		}
+		break;
+
+		default:
+		{
+			const uint8_t column = Console_Compile(line);
+
+			if (!column) {
+				Console_Run(Console_Code, 0);
+			} else {
+				// Either the line doesn't fit into a script, or the column of the offending token
+				if (Console_CodeLength >= SCRIPT_SIZE) {
+					Console_PutString_P(PSTR("ERR full"));
+				} else {
+					Console_PutString_P(PSTR("ERR "));
+					Console_PutDecimal(column + (line - Console_Line));
+				}
+				Console_Newline();
+			}
+		}
+		break;
+	}
+}
+
+/** Configures the CDC endpoints and starts with an empty line, from EVENT_USB_Device_ConfigurationChanged(). */
+bool Console_ConfigureEndpoints(void)
+{
+	Console_LineLength = 0;
+	Console_Overflow   = false;
+
+	return CDC_Device_ConfigureEndpoints(&Console_CDC);
+}
+
+/** Hands the CDC class requests to the LUFA class driver, from EVENT_USB_Device_ControlRequest(). */
+void Console_ProcessControlRequest(void)
+{
+	CDC_Device_ProcessControlRequest(&Console_CDC);
+}
+
+/** Runs every complete line received so far and sends off the answers; called from the main loop. */
+void Console_Task(void)
+{
+	int16_t c;
+
+	while ((c = CDC_Device_ReceiveByte(&Console_CDC)) >= 0) {
+		if ((c == '\r') || (c == '\n')) {
+			Console_Line[Console_LineLength] = '\0';
+
+			if (Console_Overflow) {
+				Console_Gone = false;
+				Console_PutString_P(PSTR("ERR long"));
+				Console_Newline();
+			} else {
+				Console_Execute();
+			}
+
+			Console_LineLength = 0;
+			Console_Overflow   = false;
+		} else if (Console_LineLength < CONSOLE_LINE_SIZE) {
+			Console_Line[Console_LineLength++] = c;
+		} else {
+			Console_Overflow = true;
+		}
+	}
+
+	CDC_Device_USBTask(&Console_CDC);
+}
@@ -0,0 +1,77 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for Console.c.
+ */
+
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Arena.h"
+		#include "Script.h"
+
+		#include <LUFA/Drivers/USB/Class/CDCClass.h>
+
+	/* Macros: */
+		/** Time limit for running one console line, in milliseconds. */
+		#define CONSOLE_TIMEOUT_MS    1000
+
+		#if CDC_SUPPORT && !SCRIPT_SUPPORT
+			#error The console runs its lines as scripts, CDC_SUPPORT needs SCRIPT_SUPPORT
+		#endif
+
+		#if CDC_SUPPORT && (ARENA_SIZE < (SCRIPT_SIZE + SCRIPT_RESULT_BUFFER))
+			#error ARENA_SIZE has no room for a compiled console line and its result
+		#endif
+
+	/* Function Prototypes: */
+		bool Console_ConfigureEndpoints(void);
+		void Console_ProcessControlRequest(void);
+		void Console_Task(void);
+
+		#if defined(__INCLUDE_FROM_CONSOLE_C)
+			static void Console_Put(const char c);
+			static void Console_PutString_P(const char* text);
+			static void Console_PutHex(const uint8_t value);
+			static void Console_PutDecimal(uint32_t value);
+			static void Console_Newline(void);
+			static bool Console_Number(const char** const text, uint16_t* const value);
+			static bool Console_Amount(const char** const text, uint16_t* const value);
+			static bool Console_Emit(const uint8_t value);
+			static bool Console_Extend(const uint8_t op);
+			static uint8_t Console_Compile(const char* const line);
+			static void Console_Run(const uint8_t* const code, const uint8_t slot);
+			static void Console_Speed(const char* text);
+			static void Console_Execute(void);
+		#endif
+
+#endif
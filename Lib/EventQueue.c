@@ -0,0 +1,120 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_EVENTQUEUE_C
+#include "EventQueue.h"
+
+// Enabled event types, events of other types are not even queued
+static uint16_t Events_Mask;
+
+// Records waiting for the interrupt endpoint; pushes may come from interrupts
+static uint8_t Events_Queue[EVENTS_QUEUE_SIZE][EVENTS_RECORD_SIZE];
+static volatile uint8_t Events_Head;
+static volatile uint8_t Events_Count;
+static volatile uint8_t Events_Dropped;
+
+// Appends a record to the queue, which must have room; interrupts must be off
+static void Events_Put(const uint8_t type, const uint8_t arg)
+{
+	uint8_t* record = Events_Queue[(Events_Head + Events_Count++) % EVENTS_QUEUE_SIZE];
+	const uint16_t frame = USB_Device_GetFrameNumber();
+
+	record[0] = type;
+	record[1] = arg;
+	record[2] = frame & 0xFF;
+	record[3] = frame >> 8;
+}
+
+/** Selects the event types to report, a bit mask of (1 << EVENT_*). Queued events are kept. */
+void Events_SetMask(const uint16_t mask)
+{
+	Events_Mask = mask | (1 << EVENT_OVERFLOW);
+}
+
+/** Queues an event for the host, if its type is enabled. Safe to call from both the main loop and interrupts. */
+void Events_Push(const uint8_t type, const uint8_t arg)
+{
+	if (!(Events_Mask & (1U << type)))
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	if (Events_Count == EVENTS_QUEUE_SIZE) {
+		if (Events_Dropped != 0xFF)
+			Events_Dropped++;
+	} else {
+		Events_Put(type, arg);
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Drops all queued events and disables all event types, called when the device is (re)configured. */
+void Events_Clear(void)
+{
+	Events_Mask    = 0;
+	Events_Head    = 0;
+	Events_Count   = 0;
+	Events_Dropped = 0;
+}
+
+/** Sends queued events to the host, as many as fit into a packet. Called from the main loop. */
+void Events_Task(void)
+{
+	// The HID build has no event endpoint
+	if (HID_SUPPORT || !Events_Count || !I2C_IsBulkActive())
+		return;
+
+	Endpoint_SelectEndpoint(VENDOR_EVENT_EPADDR);
+	if (!Endpoint_IsINReady())
+		return;
+
+	for (uint8_t space = VENDOR_EVENT_EPSIZE; space >= EVENTS_RECORD_SIZE; space -= EVENTS_RECORD_SIZE) {
+		if (!Events_Count)
+			break;
+
+		Endpoint_Write_Stream_LE(Events_Queue[Events_Head], EVENTS_RECORD_SIZE, NULL);
+
+		uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+		GlobalInterruptDisable();
+
+		Events_Head = (Events_Head + 1) % EVENTS_QUEUE_SIZE;
+		Events_Count--;
+
+		// Report the loss as soon as there is room for it again
+		if (Events_Dropped) {
+			Events_Put(EVENT_OVERFLOW, Events_Dropped);
+			Events_Dropped = 0;
+		}
+
+		SetGlobalInterruptMask(CurrentGlobalInt);
+	}
+
+	Endpoint_ClearIN();
+}
@@ -0,0 +1,70 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for EventQueue.c.
+ */
+
+#ifndef _EVENT_QUEUE_H_
+#define _EVENT_QUEUE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+	/* Macros: */
+		/** Number of event records queued for the interrupt endpoint before further events are dropped. */
+		#define EVENTS_QUEUE_SIZE      (8 * BUFFER_SCALE)
+
+		/** Size of one event record: type, argument, 16-bit USB frame number. */
+		#define EVENTS_RECORD_SIZE     4
+
+		/** Event types, also the bit numbers of the CMD_SET_EVENTS mask. */
+		#define EVENT_OVERFLOW         0 /**< Events were dropped, arg: number of dropped events; always enabled */
+		#define EVENT_ALERT            1 /**< The alert pin was asserted, arg: 7-bit address of the alerting target */
+		#define EVENT_BULK_DONE        2 /**< All queued bulk commands are done and their responses sent off */
+		#define EVENT_POLL_OVERRUN     3 /**< A poll entry missed a whole period, arg: entry index */
+		#define EVENT_ALERT_STATUS     4 /**< Follows EVENT_ALERT, arg: status register of the alerting target */
+		#define EVENT_EMU_WRITE        5 /**< A master wrote to the emulated target, arg: first register written */
+		#define EVENT_EMU_READ         6 /**< A master read from the emulated target, arg: first register read */
+		#define EVENT_HOST_NOTIFY      7 /**< A device sent an SMBus Host Notify, arg: its 7-bit address */
+		#define EVENT_NOTIFY_DATA      8 /**< Follows EVENT_HOST_NOTIFY twice, arg: low, then high byte of its data */
+		#define EVENT_POST_FAILED      9 /**< A command run by BULK_OP_POST failed, arg: its tag */
+		#define EVENT_POST_STATUS     10 /**< Follows EVENT_POST_FAILED, arg: the status byte of the failed command */
+
+	/* Function Prototypes: */
+		void Events_SetMask(const uint16_t mask);
+		void Events_Push(const uint8_t type, const uint8_t arg);
+		void Events_Clear(void);
+		void Events_Task(void);
+
+		#if defined(__INCLUDE_FROM_EVENTQUEUE_C)
+			static void Events_Put(const uint8_t type, const uint8_t arg);
+		#endif
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_FIFODRAIN_C
+#include "FifoDrain.h"
+#include "BulkProtocol.h"
+
+#if FIFO_SUPPORT
+
+static Fifo_Job_t Fifo_Job;
+
+// Set by the edge interrupt when the watermark was reached and the FIFO needs draining from the main loop
+static volatile uint8_t Fifo_Pending;
+
+// The host went away in the middle of a drain, the rest is read from the bus but not sent
+static bool Fifo_Gone;
+
+ISR(FIFO_VECT)
+{
+	Fifo_Pending = true;
+}
+
+static bool Fifo_IsAsserted(void)
+{
+	const bool high = (FIFO_PIN & (1 << FIFO_BIT));
+	return (Fifo_Job.Flags & FIFO_FLAG_ACTIVE_HIGH) ? high : !high;
+}
+
+static uint8_t Fifo_Address(const uint8_t address)
+{
+	TWIEngine_Start(address);
+	return TWIEngine_Wait(I2C_StartTimeoutMs);
+}
+
+// Write the register pointer and turn the bus around for reading; held is set once we own the bus
+static uint8_t Fifo_Select(const uint8_t reg, bool* const held)
+{
+	uint8_t result = Fifo_Address(Fifo_Job.Address << 1);
+	if (result == TWI_ERROR_NoError) {
+		*held = true;
+		TWIEngine_Write(1);
+		RingBuffer_Insert(&TWIEngine_TxRing, reg);
+		TWIEngine_Kick();
+		result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+		if (result == TWI_ERROR_NoError)
+			result = Fifo_Address((Fifo_Job.Address << 1) | I2C_M_RD);
+	}
+
+	return result;
+}
+
+// If the engine gave up on a bus fault or a stuck clock, the rest reads as zeros
+static uint8_t Fifo_Get(const bool ok)
+{
+	uint8_t value = 0;
+
+	if (ok && TWIEngine_WaitFor(TWI_EVENT_RxData) && !RingBuffer_IsEmpty(&TWIEngine_RxRing)) {
+		value = RingBuffer_Remove(&TWIEngine_RxRing);
+		TWIEngine_Kick();
+	}
+
+	return value;
+}
+
+// Append a byte to the drain record, sending off full packets as we go
+static void Fifo_Put(const uint8_t value)
+{
+	if (Fifo_Gone)
+		return;
+
+	if (!Endpoint_IsReadWriteAllowed()) {
+		Endpoint_ClearIN();
+		Sched_Charge();
+		while (!Endpoint_IsINReady()) {
+			Watchdog_Kick();
+			if (!I2C_IsBulkActive()) {
+				Fifo_Gone = true;
+				return;
+			}
+		}
+	}
+
+	Endpoint_Write_8(value);
+}
+
+// Read the level, then that many bytes from the data register, as one record ending the bulk transfer;
+// the caller owns the bus and has made sure the IN bank is free
+static void Fifo_Drain(void)
+{
+	const Fifo_Job_t* job = &Fifo_Job;
+	uint16_t len = 0;
+	uint8_t subframe;
+
+	const uint16_t frame = Timebase_FrameStamp(&subframe);
+
+	bool bus_held = false;
+	uint8_t result = Fifo_Select(job->LevelReg, &bus_held);
+	if (result == TWI_ERROR_NoError) {
+		const bool wide = (job->Flags & FIFO_FLAG_LEVEL16);
+		TWIEngine_Read(wide ? 2 : 1, true);
+
+		uint16_t level = Fifo_Get(true);
+		if (wide) {
+			const uint8_t next = Fifo_Get(true);
+			level = (job->Flags & FIFO_FLAG_BIG_ENDIAN) ? ((level << 8) | next) : (level | (next << 8));
+		}
+
+		// Whole units only, so a sample set is never split between two drains
+		const uint16_t max_units = job->MaxLength / job->Unit;
+		level &= job->LevelMask;
+		if (level > max_units)
+			level = max_units;
+		len = level * job->Unit;
+
+		if (len)
+			result = Fifo_Select(job->DataReg, &bus_held);
+		if (result != TWI_ERROR_NoError)
+			len = 0;
+	}
+
+	Fifo_Gone = false;
+	Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+	Endpoint_Write_8(FIFO_RECORD_MARKER);
+	Endpoint_Write_16_LE(frame);
+	Endpoint_Write_8(subframe);
+	Endpoint_Write_8((result == TWI_ERROR_NoError) ? STATUS_ADDRESS_ACK : STATUS_ADDRESS_NAK);
+	Endpoint_Write_16_LE(len);
+
+	if (len) {
+		TWIEngine_Read(len, true);
+		for (uint16_t i = 0; i < len; i++)
+			Fifo_Put(Fifo_Get(true));
+	}
+
+	// A NACKed address has already been followed by a STOP from the engine
+	if (bus_held && (result != TWI_ERROR_SlaveNotReady)) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+	}
+
+	// End the transfer with a short packet, or a zero length one if the record filled the last packet exactly;
+	// the HID build pads the last report instead
+	if (!Fifo_Gone) {
+		const bool full = !Endpoint_IsReadWriteAllowed();
+		I2C_ClearVendorIN();
+		if (full && !HID_SUPPORT) {
+			while (!Endpoint_IsINReady()) {
+				Watchdog_Kick();
+				if (!I2C_IsBulkActive())
+					return;
+			}
+			Endpoint_ClearIN();
+			Sched_Charge();
+		}
+	}
+}
+
+/** Sets up the watermark line as an input, draining stays off until \ref Fifo_SetJob() turns it on. */
+void Fifo_Init(void)
+{
+	FIFO_DDR &= ~(1 << FIFO_BIT);
+}
+
+/** Turns draining off and forgets the job. */
+void Fifo_Clear(void)
+{
+	EIMSK &= ~(1 << FIFO_INT);
+	Fifo_Pending   = false;
+	Fifo_Job.Flags = 0;
+	FIFO_PORT &= ~(1 << FIFO_BIT);
+}
+
+/** Replaces the FIFO drain job. A watermark line that is already asserted when draining is turned on is handled
+ *  right away.
+ */
+void Fifo_SetJob(const Fifo_Job_t* const job)
+{
+	Fifo_Clear();
+	if (!(job->Flags & FIFO_FLAG_ENABLE))
+		return;
+
+	Fifo_Job = *job;
+
+	if (!Fifo_Job.Unit)
+		Fifo_Job.Unit = 1;
+	if (!(Fifo_Job.Flags & FIFO_FLAG_LEVEL16))
+		Fifo_Job.LevelMask &= 0xFF;
+
+	// Rising edge for an active high line, falling edge and the pull-up for an active low one, which may be open drain
+	uint8_t sense = 3;
+	if (Fifo_Job.Flags & FIFO_FLAG_ACTIVE_HIGH) {
+		FIFO_PORT &= ~(1 << FIFO_BIT);
+	} else {
+		FIFO_PORT |= (1 << FIFO_BIT);
+		sense = 2;
+	}
+
+	#if (FIFO_INT < 4)
+	EICRA = (EICRA & ~(3 << (FIFO_INT * 2))) | (sense << (FIFO_INT * 2));
+	#else
+	EICRB = (EICRB & ~(3 << ((FIFO_INT - 4) * 2))) | (sense << ((FIFO_INT - 4) * 2));
+	#endif
+
+	EIFR  = (1 << FIFO_INT);
+	EIMSK |= (1 << FIFO_INT);
+
+	if (Fifo_IsAsserted())
+		Fifo_Pending = true;
+}
+
+/** Drains the FIFO after the watermark line was asserted, as soon as the bus and the IN endpoint allow. Called
+ *  from the main loop; a FIFO still above its watermark afterwards is drained again on the next call.
+ */
+void Fifo_Task(void)
+{
+	if (!Fifo_Pending || !I2C_IsBulkActive() || Bulk_ResponsePending())
+		return;
+
+	// Samples and responses must not end up in the middle of the record, and the host has to be reading
+	Poll_Flush();
+	Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+	if (!Endpoint_IsINReady())
+		return;
+
+	if (!I2C_ClaimBus(BUS_OWNER_FIFO))
+		return;
+	Fifo_Pending = false;
+
+	Fifo_Drain();
+	I2C_ReleaseBus();
+
+	// The line follows the level, so an edge that came and went during the drain is no reason to drain again
+	Fifo_Pending = Fifo_IsAsserted();
+}
+
+#endif
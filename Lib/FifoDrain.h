@@ -0,0 +1,96 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for FifoDrain.c.
+ */
+
+#ifndef _FIFO_DRAIN_H_
+#define _FIFO_DRAIN_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "TWIEngine.h"
+		#include "Timebase.h"
+		#include "PollEngine.h"
+
+	/* Macros: */
+		/** Mode flags of the FIFO drain job, set by BULK_OP_FIFO. */
+		#define FIFO_FLAG_ENABLE      (1 << 0) /**< Watch the watermark line and drain the FIFO on each assertion */
+		#define FIFO_FLAG_LEVEL16     (1 << 1) /**< The level register is 16 bits wide */
+		#define FIFO_FLAG_BIG_ENDIAN  (1 << 2) /**< A 16-bit level is sent high byte first */
+		#define FIFO_FLAG_ACTIVE_HIGH (1 << 3) /**< The watermark line is asserted high, not low */
+
+		/** First byte of a drain record, distinct from the entry index of a poll record. */
+		#define FIFO_RECORD_MARKER    0xFF
+
+		/** Size of the drain record header: marker, 16-bit frame count, Timer1 ticks into the frame, status and
+		 *  16-bit data length.
+		 */
+		#define FIFO_RECORD_HEADER    7
+
+	/* Type Defines: */
+		/** Type define for the FIFO drain job. */
+		typedef struct
+		{
+			uint8_t  Flags;     /**< FIFO_FLAG_* bits */
+			uint8_t  Address;   /**< 7-bit target address */
+			uint8_t  LevelReg;  /**< Register holding the FIFO level */
+			uint16_t LevelMask; /**< Bits of the level register making up the level, the rest are status flags */
+			uint8_t  Unit;      /**< Bytes per level count, e.g. the size of one sample set */
+			uint8_t  DataReg;   /**< Register the FIFO is read through */
+			uint16_t MaxLength; /**< Most bytes to read per drain */
+		} Fifo_Job_t;
+
+	/* Function Prototypes: */
+		#if FIFO_SUPPORT
+			void Fifo_Init(void);
+			void Fifo_Clear(void);
+			void Fifo_SetJob(const Fifo_Job_t* const job);
+			void Fifo_Task(void);
+		#endif
+
+		#if defined(__INCLUDE_FROM_FIFODRAIN_C) && FIFO_SUPPORT
+			static bool Fifo_IsAsserted(void);
+			static uint8_t Fifo_Address(const uint8_t address);
+			static uint8_t Fifo_Select(const uint8_t reg, bool* const held);
+			static uint8_t Fifo_Get(const bool ok);
+			static void Fifo_Put(const uint8_t value);
+			static void Fifo_Drain(void);
+		#endif
+
+	/* Inline Functions: */
+		#if !FIFO_SUPPORT
+			/* Without FIFO_SUPPORT no drain job is ever set, so there is nothing to set up, clear or run. */
+			static inline void Fifo_Init(void) {}
+			static inline void Fifo_Clear(void) {}
+			static inline void Fifo_Task(void) {}
+		#endif
+
+#endif
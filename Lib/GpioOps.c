@@ -0,0 +1,109 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_GPIOOPS_C
+#include "GpioOps.h"
+
+#include <util/delay.h>
+
+// Wait for the pin to take the level, timed by the frame count
+static bool Gpio_Wait(const uint8_t pin, const uint8_t high, const uint16_t timeout_ms)
+{
+	const uint16_t started = Timebase_GetFrame();
+
+	while (!(GPIO_PIN & pin) != !high) {
+		Watchdog_Kick();
+		if ((uint16_t)(Timebase_GetFrame() - started) >= timeout_ms)
+			return false;
+		if (USB_DeviceState != DEVICE_STATE_Configured)
+			return false;
+	}
+
+	return true;
+}
+
+/** Runs one GPIO operation, see GPIO_OP_MASK, on a pin of \ref GPIO_PINS and stores the level the pin reads
+ *  afterwards in \c level, 0 or 1.
+ *  @return STATUS_ADDRESS_ACK when done, STATUS_ADDRESS_NAK for a wait that timed out and STATUS_COUNT_ERROR for a pin
+ *  that isn't available or an unknown operation
+ */
+uint8_t Gpio_Run(const uint8_t op, const uint16_t arg, uint8_t* const level)
+{
+	const uint8_t pin = 1 << (op & GPIO_OP_PIN);
+	uint8_t status    = STATUS_ADDRESS_ACK;
+
+	*level = 0;
+
+	if ((op & GPIO_OP_MASK) == GPIO_OP_DELAY) {
+		const uint16_t started = Timebase_Now();
+		const uint16_t ticks   = Timebase_UsToTicks(arg);
+
+		while (Timebase_Elapsed(started) < ticks);
+		return STATUS_ADDRESS_ACK;
+	}
+
+	if (!(GPIO_PINS & pin))
+		return STATUS_COUNT_ERROR;
+
+	switch (op & GPIO_OP_MASK) {
+		case GPIO_OP_LOW:
+			GPIO_PORT &= ~pin;
+			GPIO_DDR  |= pin;
+			break;
+
+		case GPIO_OP_HIGH:
+			GPIO_PORT |= pin;
+			GPIO_DDR  |= pin;
+			break;
+
+		case GPIO_OP_INPUT:
+			GPIO_DDR &= ~pin;
+			if (arg)
+				GPIO_PORT |= pin;
+			else
+				GPIO_PORT &= ~pin;
+			break;
+
+		case GPIO_OP_READ:
+			break;
+
+		case GPIO_OP_WAIT_LOW:
+		case GPIO_OP_WAIT_HIGH:
+			if (!Gpio_Wait(pin, (op & GPIO_OP_MASK) == GPIO_OP_WAIT_HIGH, arg))
+				status = STATUS_ADDRESS_NAK;
+			break;
+
+		default:
+			return STATUS_COUNT_ERROR;
+	}
+
+	// The input synchronizer shows a newly driven level a cycle later
+	_delay_us(1);
+	*level = (GPIO_PIN & pin) ? 1 : 0;
+	return status;
+}
@@ -0,0 +1,65 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for GpioOps.c.
+ */
+
+#ifndef _GPIO_OPS_H_
+#define _GPIO_OPS_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+		#include "Watchdog.h"
+
+	/* Macros: */
+		/** GPIO operation byte of BULK_OP_GPIO and of a BATCH segment with \ref BATCH_FLAG_GPIO: the pin of
+		 *  \ref GPIO_PORT in bits 0 to 2 and the operation in bits 4 to 6. Each operation is followed by a 16-bit
+		 *  argument.
+		 */
+		#define GPIO_OP_PIN           0x07
+		#define GPIO_OP_MASK          (7 << 4)
+		#define GPIO_OP_LOW           (0 << 4) /**< Drive the pin low */
+		#define GPIO_OP_HIGH          (1 << 4) /**< Drive the pin high */
+		#define GPIO_OP_INPUT         (2 << 4) /**< Make the pin an input, with the pull-up if the argument is nonzero */
+		#define GPIO_OP_READ          (3 << 4) /**< Just sample the pin */
+		#define GPIO_OP_WAIT_LOW      (4 << 4) /**< Wait for the pin to read low, for at most the argument in ms */
+		#define GPIO_OP_WAIT_HIGH     (5 << 4) /**< Wait for the pin to read high, for at most the argument in ms */
+		#define GPIO_OP_DELAY         (6 << 4) /**< Wait for the argument in us, up to 65 ms; the pin is not used */
+
+	/* Function Prototypes: */
+		uint8_t Gpio_Run(const uint8_t op, const uint16_t arg, uint8_t* const level);
+
+		#if defined(__INCLUDE_FROM_GPIOOPS_C)
+			static bool Gpio_Wait(const uint8_t pin, const uint8_t high, const uint16_t timeout_ms);
+		#endif
+
+#endif
+
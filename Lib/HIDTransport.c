@@ -0,0 +1,94 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  HID class glue of the HID build. The reports on the interrupt endpoints are the bulk command and response
+ *  streams and are served by BulkProtocol.c straight from the endpoint banks like in the vendor class build; the
+ *  LUFA class driver only handles the HID class requests on the control pipe.
+ */
+
+#include "HIDTransport.h"
+
+/** LUFA HID Class driver interface configuration and state information. */
+static USB_ClassInfo_HID_Device_t HIDTransport_Interface =
+	{
+		.Config =
+			{
+				.InterfaceNumber        = INTERFACE_ID_Vendor,
+				.ReportINEndpoint       =
+					{
+						.Address        = VENDOR_IN_EPADDR,
+						.Size           = VENDOR_IO_EPSIZE,
+						.Banks          = VENDOR_IO_EPBANKS,
+					},
+				.PrevReportINBuffer     = NULL,
+				.PrevReportINBufferSize = VENDOR_IO_EPSIZE,
+			},
+	};
+
+/** Configures both report endpoints, from EVENT_USB_Device_ConfigurationChanged(). */
+bool HIDTransport_ConfigureEndpoints(void)
+{
+	bool ok = HID_Device_ConfigureEndpoints(&HIDTransport_Interface);
+	ok &= Endpoint_ConfigureEndpoint(VENDOR_OUT_EPADDR, EP_TYPE_INTERRUPT, VENDOR_IO_EPSIZE, VENDOR_IO_EPBANKS);
+
+	return ok;
+}
+
+/** Hands the HID class requests to the LUFA class driver, from EVENT_USB_Device_ControlRequest(). */
+void HIDTransport_ProcessControlRequest(void)
+{
+	HID_Device_ProcessControlRequest(&HIDTransport_Interface);
+}
+
+/** HID class driver callback for GET_REPORT. Responses only come on the interrupt endpoint, in order, so the
+ *  report read through the control pipe is all padding.
+ */
+bool CALLBACK_HID_Device_CreateHIDReport(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo,
+                                         uint8_t* const ReportID,
+                                         const uint8_t ReportType,
+                                         void* ReportData,
+                                         uint16_t* const ReportSize)
+{
+	memset(ReportData, VENDOR_REPORT_PAD, VENDOR_IO_EPSIZE);
+	*ReportSize = VENDOR_IO_EPSIZE;
+
+	return false;
+}
+
+/** HID class driver callback for SET_REPORT. Commands only count on the interrupt endpoint, where their order
+ *  with respect to the rest of the stream is known, so reports sent through the control pipe are dropped.
+ */
+void CALLBACK_HID_Device_ProcessHIDReport(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo,
+                                          const uint8_t ReportID,
+                                          const uint8_t ReportType,
+                                          const void* ReportData,
+                                          const uint16_t ReportSize)
+{
+}
@@ -0,0 +1,105 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  SMBus Host Notify: devices that want attention master the bus themselves and write their own address and a data
+ *  word to the host at 0x08. With the listener on, the TWI answers to that address in slave mode whenever no master
+ *  path is using the bus, and the notifications go out as events, so the host need not poll those devices.
+ *  Claiming the bus turns listening off again, or waits for a notification in progress to finish.
+ */
+
+#define  __INCLUDE_FROM_HOSTNOTIFY_C
+#include "HostNotify.h"
+#include "TWIEngine.h"
+
+Notify_State_t Notify;
+
+/** Turns the listener on or off; queued notifications are dropped either way. */
+void Notify_SetEnabled(const bool enabled)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	Notify.Enabled   = enabled;
+	Notify.Receiving = false;
+	Notify.Queued    = 0;
+	Notify.Dropped   = 0;
+	// Stop answering right away unless the bus is taken, in which case TWEA is off anyway, or emulated
+	if (!enabled && (I2C_BusOwner == BUS_OWNER_NONE) && !TWIEngine_IsBusy() && (TWCR & (1 << TWEA))) {
+		TWCR = (1 << TWEN);
+		TWAR = 0;
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Listens for notifications while the bus is free, and reports those that came in as a HOST_NOTIFY event with the
+ *  7-bit address of the notifying device followed by two NOTIFY_DATA events with the low and the high byte of its
+ *  data word. Called from the main loop.
+ */
+void Notify_Task(void)
+{
+	if (!Notify.Enabled)
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	// Whatever a master path or a speed change left in TWCR, listening resumes once the last STOP is out
+	if ((I2C_BusOwner == BUS_OWNER_NONE) && !TWIEngine_IsBusy()
+	 && !(TWCR & ((1 << TWEA) | (1 << TWINT) | (1 << TWSTO)))) {
+		TWAR = NOTIFY_ADDRESS << 1;
+		TWCR = (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	while (Notify.Queued) {
+		const uint8_t* entry = Notify.Queue[Notify.Head];
+
+		Events_Push(EVENT_HOST_NOTIFY, entry[0] >> 1);
+		Events_Push(EVENT_NOTIFY_DATA, entry[1]);
+		Events_Push(EVENT_NOTIFY_DATA, entry[2]);
+
+		GlobalInterruptDisable();
+		Notify.Head = (Notify.Head + 1) & (NOTIFY_QUEUE_SIZE - 1);
+		Notify.Queued--;
+		SetGlobalInterruptMask(CurrentGlobalInt);
+	}
+
+	if (Notify.Dropped) {
+		GlobalInterruptDisable();
+		const uint8_t dropped = Notify.Dropped;
+		Notify.Dropped = 0;
+		SetGlobalInterruptMask(CurrentGlobalInt);
+
+		// Counted in events like the other losses, three per notification
+		Events_Push(EVENT_OVERFLOW, MIN(dropped * 3, UINT8_MAX));
+	}
+}
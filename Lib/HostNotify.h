@@ -0,0 +1,149 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for HostNotify.c.
+ */
+
+#ifndef _HOST_NOTIFY_H_
+#define _HOST_NOTIFY_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "EventQueue.h"
+
+		#include <util/twi.h>
+
+	/* Macros: */
+		/** SMBus Host Notify address the notifying devices write to. */
+		#define NOTIFY_ADDRESS       0x08
+
+		/** Number of notifications kept between the TWI interrupt and \ref Notify_Task(), a power of two. */
+		#define NOTIFY_QUEUE_SIZE    4
+
+		/** Bytes of a notification: the notifying device's address byte and the 16-bit data word. */
+		#define NOTIFY_MESSAGE_SIZE  3
+
+	/* Type Defines: */
+		/** Type define for the Host Notify listener, shared between the TWI interrupt and the main loop. */
+		typedef struct
+		{
+			bool             Enabled;    /**< Listen for notifications whenever the master paths leave the bus */
+			volatile bool    Receiving;  /**< Addressed, the notification's STOP hasn't come yet */
+			uint8_t          Count;      /**< Bytes of the current notification so far */
+			uint8_t          Message[NOTIFY_MESSAGE_SIZE];                    /**< The current notification */
+			uint8_t          Queue[NOTIFY_QUEUE_SIZE][NOTIFY_MESSAGE_SIZE];  /**< Finished notifications */
+			volatile uint8_t Head;       /**< Oldest queued notification */
+			volatile uint8_t Queued;     /**< Number of queued notifications */
+			volatile uint8_t Dropped;    /**< Notifications lost to a full queue, saturating */
+		} Notify_State_t;
+
+	/* External Variables: */
+		extern Notify_State_t Notify;
+
+	/* Inline Functions: */
+		/** Serves one slave mode state of the TWI while listening for Host Notify, called by its interrupt. A
+		 *  notification is the device's address byte and a data word; complete ones are queued at their STOP, anything
+		 *  shorter is dropped, and a read of the notify address gets 0xFF. Inlined like \ref Emu_Service().
+		 */
+		static inline void Notify_Service(const uint8_t status) ATTR_ALWAYS_INLINE;
+		static inline void Notify_Service(const uint8_t status)
+		{
+			switch (status) {
+				case TW_SR_SLA_ACK:
+				case TW_SR_ARB_LOST_SLA_ACK:
+					Notify.Receiving = true;
+					Notify.Count     = 0;
+					break;
+
+				case TW_SR_DATA_ACK:
+					if (Notify.Count < NOTIFY_MESSAGE_SIZE)
+						Notify.Message[Notify.Count] = TWDR;
+					Notify.Count++;
+					break;
+
+				case TW_SR_STOP:
+					Notify.Receiving = false;
+					if (Notify.Count != NOTIFY_MESSAGE_SIZE)
+						break;
+
+					if (Notify.Queued == NOTIFY_QUEUE_SIZE) {
+						if (Notify.Dropped != 0xFF)
+							Notify.Dropped++;
+					} else {
+						uint8_t* entry = Notify.Queue[(Notify.Head + Notify.Queued) & (NOTIFY_QUEUE_SIZE - 1)];
+						for (uint8_t i = 0; i < NOTIFY_MESSAGE_SIZE; i++)
+							entry[i] = Notify.Message[i];
+						Notify.Queued++;
+					}
+					break;
+
+				case TW_ST_SLA_ACK:
+				case TW_ST_ARB_LOST_SLA_ACK:
+				case TW_ST_DATA_ACK:
+					TWDR = 0xFF;
+					break;
+
+				default:
+					// TW_ST_DATA_NACK or TW_ST_LAST_DATA, the reader is done
+					break;
+			}
+
+			TWCR = (1 << TWINT) | (Notify.Enabled ? (1 << TWEA) : 0) | (1 << TWEN) | (1 << TWIE);
+		}
+
+		/** Stops listening so one of the master paths can take the bus, called by \ref I2C_ClaimBus() with
+		 *  interrupts off while nobody holds the bus.
+		 *  @return false while a notification is coming in, which the claim has to wait for
+		 */
+		static inline bool Notify_Yield(void) ATTR_ALWAYS_INLINE;
+		static inline bool Notify_Yield(void)
+		{
+			if (!(TWCR & (1 << TWEA)))
+				return true;
+			// An address match not served yet holds the clock just like a notification in progress
+			if (Notify.Receiving || (TWCR & (1 << TWINT)))
+				return false;
+
+			TWCR = (1 << TWEN);
+			return true;
+		}
+
+		/** Forgets a notification cut short by a bus error, called by the TWI interrupt. */
+		static inline void Notify_Abort(void) ATTR_ALWAYS_INLINE;
+		static inline void Notify_Abort(void)
+		{
+			Notify.Receiving = false;
+		}
+
+	/* Function Prototypes: */
+		void Notify_SetEnabled(const bool enabled);
+		void Notify_Task(void);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Channel routing through PCA9548 style I2C muxes. The host registers the muxes and where each one hangs off
+ *  once, then names the route of a target instead of writing the mux control registers itself. The state of
+ *  every mux is cached, so a route that is already selected costs no bus traffic at all.
+ */
+
+#define  __INCLUDE_FROM_MUXROUTE_C
+#include "MuxRoute.h"
+
+#if MUX_SUPPORT
+
+Mux_Entry_t Mux_Table[MUX_ENTRIES];
+
+// A mux can only be written while every mux upstream of it has the channel leading to it open
+static bool Mux_IsReachable(const uint8_t index)
+{
+	for (uint8_t hop = Mux_Table[index].Upstream; hop != MUX_ROUTE_ROOT; hop = Mux_Table[hop >> 4].Upstream) {
+		if (Mux_Table[hop >> 4].State != (1 << (hop & 7)))
+			return false;
+	}
+
+	return true;
+}
+
+// Write a mux control register, returning a TWI_ErrorCodes_t value; the caller owns the bus
+static uint8_t Mux_Write(const uint8_t address, const uint8_t control)
+{
+	TWIEngine_Start(address << 1);
+	uint8_t result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+	// A NACKed address has already been followed by a STOP from the engine
+	if (result == TWI_ERROR_NoError) {
+		TWIEngine_Write(1);
+		RingBuffer_Insert(&TWIEngine_TxRing, control);
+		TWIEngine_Kick();
+		result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+	}
+
+	return result;
+}
+
+/** Forgets all registered muxes. */
+void Mux_Clear(void)
+{
+	for (uint8_t i = 0; i < MUX_ENTRIES; i++)
+		Mux_Table[i].Address = MUX_UNUSED;
+}
+
+// Forget the cached channel state of all muxes, so the next select writes every mux on its way
+static void Mux_Forget(void)
+{
+	for (uint8_t i = 0; i < MUX_ENTRIES; i++)
+		Mux_Table[i].State = MUX_STATE_UNKNOWN;
+}
+
+/** Registers the mux at \c index. Its upstream mux must already be registered at a lower index, so routes
+ *  can't loop and select can settle the muxes in index order, upstream ones first.
+ *  @return false if the index, the address or the upstream route is invalid
+ */
+bool Mux_Set(const uint8_t index, const uint8_t address, const uint8_t upstream)
+{
+	if ((index >= MUX_ENTRIES) || (address >= 0x80))
+		return false;
+
+	if ((upstream != MUX_ROUTE_ROOT) &&
+	    (((upstream >> 4) >= index) || (Mux_Table[upstream >> 4].Address == MUX_UNUSED) || (upstream & 0x08)))
+		return false;
+
+	Mux_Table[index].Address  = address;
+	Mux_Table[index].Upstream = upstream;
+
+	// The topology changed, nothing known about the muxes can be trusted any more
+	Mux_Forget();
+	return true;
+}
+
+/** Sets up the muxes for a route: every mux on the way gets the channel leading there, every other one that can
+ *  be reached is closed. Muxes already in the right state are left alone, as are those hidden behind a closed
+ *  channel, since whatever they have open is cut off anyway. The caller owns the bus, outside of a transaction.
+ *  @return a TWI_ErrorCodes_t value, TWI_ERROR_SlaveNotReady for a route through an unregistered mux
+ */
+uint8_t Mux_Select(const uint8_t route)
+{
+	uint8_t want[MUX_ENTRIES] = {0};
+
+	if ((route != MUX_ROUTE_ROOT) &&
+	    (((route >> 4) >= MUX_ENTRIES) || (Mux_Table[route >> 4].Address == MUX_UNUSED) || (route & 0x08)))
+		return TWI_ERROR_SlaveNotReady;
+
+	for (uint8_t hop = route; hop != MUX_ROUTE_ROOT; hop = Mux_Table[hop >> 4].Upstream)
+		want[hop >> 4] = (1 << (hop & 7));
+
+	for (uint8_t i = 0; i < MUX_ENTRIES; i++) {
+		Mux_Entry_t* mux = &Mux_Table[i];
+
+		if ((mux->Address == MUX_UNUSED) || (mux->State == want[i]) || !Mux_IsReachable(i))
+			continue;
+
+		const uint8_t result = Mux_Write(mux->Address, want[i]);
+		if (result != TWI_ERROR_NoError) {
+			mux->State = MUX_STATE_UNKNOWN;
+			return result;
+		}
+		mux->State = want[i];
+	}
+
+	return TWI_ERROR_NoError;
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for MuxRoute.c.
+ */
+
+#ifndef _MUX_ROUTE_H_
+#define _MUX_ROUTE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "TWIEngine.h"
+
+	/* Macros: */
+		/** Number of muxes that can be registered. */
+		#define MUX_ENTRIES           4
+
+		/** Address marking a free entry, and clearing the whole table in CMD_SET_MUX. */
+		#define MUX_UNUSED            0xFF
+
+		/** Route byte for the bus the adapter sits on, with every registered mux closed. Any other route is
+		 *  the mux index in bits 7-4 and the channel in bits 2-0; the upstream of a mux is given the same way.
+		 */
+		#define MUX_ROUTE_ROOT        0xFF
+
+		/** Control register value marking a mux whose channel state isn't known, it is written by the next select. */
+		#define MUX_STATE_UNKNOWN     0xFF
+
+	/* Type Defines: */
+		/** Type define for one mux of the topology, a PCA9548 style part whose control register enables one
+		 *  downstream channel per bit.
+		 */
+		typedef struct
+		{
+			uint8_t Address;   /**< 7-bit mux address, \ref MUX_UNUSED for a free entry */
+			uint8_t Upstream;  /**< Route the mux itself sits on, \ref MUX_ROUTE_ROOT for the adapter's bus */
+			uint8_t State;     /**< Control register as last written, \ref MUX_STATE_UNKNOWN if not known */
+		} Mux_Entry_t;
+
+	/* External Variables: */
+		#if MUX_SUPPORT
+			extern Mux_Entry_t Mux_Table[MUX_ENTRIES];
+		#endif
+
+	/* Function Prototypes: */
+		#if MUX_SUPPORT
+			void Mux_Clear(void);
+			bool Mux_Set(const uint8_t index, const uint8_t address, const uint8_t upstream);
+			uint8_t Mux_Select(const uint8_t route);
+		#endif
+
+		#if defined(__INCLUDE_FROM_MUXROUTE_C) && MUX_SUPPORT
+			static void Mux_Forget(void);
+			static bool Mux_IsReachable(const uint8_t index);
+			static uint8_t Mux_Write(const uint8_t address, const uint8_t control);
+		#endif
+
+	/* Inline Functions: */
+		#if !MUX_SUPPORT
+			/* Without MUX_SUPPORT no mux is ever registered, so there is nothing to forget. */
+			static inline void Mux_Clear(void) {}
+		#endif
+
+#endif
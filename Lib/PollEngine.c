@@ -0,0 +1,692 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * On-device register polling. The host uploads a list of (address, register,
+ * length, period) entries and the firmware samples them on its own, timed off
+ * the USB Start of Frame event, pushing the results as timestamped records on
+ * the bulk IN endpoint. Records are packed into frames of up to one endpoint
+ * bank, a frame is sent off once the next record won't fit or the millisecond
+ * it was started in is over.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_POLLENGINE_C
+#include "PollEngine.h"
+#include "BulkProtocol.h"
+#include "CRC8.h"
+
+static Poll_Entry_t Poll_Entries[POLL_MAX_ENTRIES];
+static Poll_FilterState_t Poll_FilterStates[POLL_MAX_ENTRIES];
+static Poll_ReduceState_t Poll_ReduceStates[POLL_MAX_ENTRIES];
+
+// VOUT_MODE of the device behind each PMBus entry, read before its first READ_VOUT and again after a failed read
+static uint8_t Poll_VoutModes[POLL_MAX_ENTRIES];
+
+// Telemetry commands of a PMBus sweep, in the order of the POLL_PMBUS_* bits
+static const uint8_t Poll_PmbusCommands[8] PROGMEM = {0x88, 0x89, PMBUS_READ_VOUT, 0x8C, 0x8D, 0x8E, 0x96, 0x97};
+static uint8_t Poll_Count;
+
+// Number of bytes in the currently open IN bank and the tick it was opened in
+static uint8_t Poll_FrameBytes;
+static uint16_t Poll_FrameTick;
+
+// Records go out in the compact format, and the Timer1 stamp of the last one in the open IN bank
+static uint8_t Poll_Compact;
+static uint16_t Poll_LastStamp;
+
+// Entry periods and due times count SYNC edges instead of frames
+static uint8_t Poll_Sync;
+
+// Records go to their own isochronous endpoint in VENDOR_ALT_ISO, and share the bulk IN endpoint with the command
+// responses otherwise
+static bool Poll_IsIso(void)
+{
+	return ISO_SUPPORT && (I2C_AltSetting == VENDOR_ALT_ISO);
+}
+
+#define POLL_EPADDR  (Poll_IsIso() ? VENDOR_POLL_EPADDR : VENDOR_IN_EPADDR)
+
+static uint8_t Poll_Address(const uint8_t address)
+{
+	TWIEngine_Start(address);
+	return TWIEngine_Wait(I2C_StartTimeoutMs);
+}
+
+// Run one register read into data, returning the status byte for its record
+static uint8_t Poll_Read(const uint8_t address, const uint8_t reg, uint8_t* const data, const uint8_t length)
+{
+	uint8_t result = Poll_Address(address << 1);
+	const uint8_t bus_held = (result == TWI_ERROR_NoError);
+	if (bus_held) {
+		TWIEngine_Write(1);
+		RingBuffer_Insert(&TWIEngine_TxRing, reg);
+		TWIEngine_Kick();
+		result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+		if (result == TWI_ERROR_NoError)
+			result = Poll_Address((address << 1) | I2C_M_RD);
+		if (result == TWI_ERROR_NoError)
+			TWIEngine_Read(length, true);
+	}
+
+	// Same as the bulk path: if anything went wrong the record is padded with zeros
+	for (uint8_t i = 0; i < length; i++) {
+		uint8_t value = 0;
+		if (result == TWI_ERROR_NoError) {
+			TWIEngine_WaitFor(TWI_EVENT_RxData);
+			if (!RingBuffer_IsEmpty(&TWIEngine_RxRing))
+				value = RingBuffer_Remove(&TWIEngine_RxRing);
+		}
+		data[i] = value;
+	}
+
+	// A NACKed address has already been followed by a STOP from the engine
+	if (bus_held && (result != TWI_ERROR_SlaveNotReady)) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+	}
+
+	return (result == TWI_ERROR_NoError) ? STATUS_ADDRESS_ACK : STATUS_ADDRESS_NAK;
+}
+
+// Take one reading of an ADC entry into data, returning the status byte for its record. A conversion takes 13 ADC
+// clocks, about 104 us.
+static uint8_t Poll_Convert(const Poll_Entry_t* const entry, uint8_t* const data)
+{
+	const uint8_t mux = entry->Register;
+	const uint16_t result = ADC_GetChannelReading(ADC_RIGHT_ADJUSTED | (mux & ~(1 << 5)) | ((uint16_t)(mux & (1 << 5)) << 3));
+
+	data[0] = result;
+	data[1] = result >> 8;
+	return STATUS_ADDRESS_ACK;
+}
+
+// Read a PMBus byte or word, little endian, into value; with pec the PEC byte that follows has to match
+static uint8_t Poll_PmbusRead(const uint8_t address, const uint8_t command, const uint8_t length,
+                              const bool pec, uint16_t* const value)
+{
+	uint8_t data[3];
+
+	const uint8_t status = Poll_Read(address, command, data, length + pec);
+	if (status != STATUS_ADDRESS_ACK)
+		return status;
+
+	if (pec) {
+		uint8_t crc = CRC8_Update(0, address << 1);
+		crc = CRC8_Update(crc, command);
+		crc = CRC8_Update(crc, (address << 1) | I2C_M_RD);
+		for (uint8_t i = 0; i < length; i++)
+			crc = CRC8_Update(crc, data[i]);
+		if (crc != data[length])
+			return STATUS_PEC_ERROR;
+	}
+
+	*value = data[0] | ((length > 1) ? ((uint16_t)data[1] << 8) : 0);
+	return STATUS_ADDRESS_ACK;
+}
+
+// A mantissa times 2 to the exponent in milli-units, rounded; results beyond the range saturate short of
+// POLL_PMBUS_INVALID
+static int32_t Poll_PmbusScale(const int32_t mantissa, int8_t exponent)
+{
+	int32_t milli = mantissa * 1000;
+
+	if (exponent < 0)
+		return (milli + (1L << (-exponent - 1))) >> -exponent;
+
+	while (exponent--) {
+		if ((milli > INT32_MAX / 2) || (milli < -(INT32_MAX / 2)))
+			return (milli < 0) ? -INT32_MAX : INT32_MAX;
+		milli *= 2;
+	}
+	return milli;
+}
+
+// Take one sweep of a PMBus entry into data, a value per telemetry command it selects, returning the status byte
+// for its record: that of the first command that failed, whose value is POLL_PMBUS_INVALID, while the others stay
+// valid. The bus is released between the commands, as a PMBus device expects every read to end with a STOP.
+static uint8_t Poll_Pmbus(const uint8_t index, uint8_t* const data)
+{
+	const Poll_Entry_t* entry = &Poll_Entries[index];
+	const bool pec            = (entry->Length & POLL_PMBUS_PEC);
+	uint8_t* out              = data;
+	uint8_t status            = STATUS_ADDRESS_ACK;
+
+	for (uint8_t bit = 0; bit < 8; bit++) {
+		if (!(entry->Register & (1 << bit)))
+			continue;
+
+		const uint8_t command = pgm_read_byte(&Poll_PmbusCommands[bit]);
+		uint32_t value        = POLL_PMBUS_INVALID;
+		uint8_t result        = STATUS_ADDRESS_ACK;
+		uint16_t raw;
+
+		if (command == PMBUS_READ_VOUT) {
+			// LINEAR16: an unsigned mantissa and the exponent in the low five bits of VOUT_MODE
+			if (Poll_VoutModes[index] == POLL_VOUT_UNKNOWN) {
+				result = Poll_PmbusRead(entry->Address, PMBUS_VOUT_MODE, 1, pec, &raw);
+				if (result == STATUS_ADDRESS_ACK)
+					Poll_VoutModes[index] = raw;
+			}
+			if (result == STATUS_ADDRESS_ACK)
+				result = Poll_PmbusRead(entry->Address, command, 2, pec, &raw);
+			// VID and DIRECT formats need tables or coefficients the sweep doesn't have
+			if ((result == STATUS_ADDRESS_ACK) &&
+			    ((Poll_VoutModes[index] & PMBUS_MODE_MASK) == PMBUS_MODE_LINEAR))
+				value = Poll_PmbusScale(raw, (int8_t)(Poll_VoutModes[index] << 3) >> 3);
+		} else {
+			// LINEAR11: a five bit exponent above an eleven bit mantissa, both signed
+			result = Poll_PmbusRead(entry->Address, command, 2, pec, &raw);
+			if (result == STATUS_ADDRESS_ACK)
+				value = Poll_PmbusScale((int16_t)(raw << 5) >> 5, (int8_t)((raw >> 8) & 0xF8) >> 3);
+		}
+
+		if (result != STATUS_ADDRESS_ACK) {
+			// A device that was away may come back configured differently
+			Poll_VoutModes[index] = POLL_VOUT_UNKNOWN;
+			if (status == STATUS_ADDRESS_ACK)
+				status = result;
+		}
+
+		for (uint8_t i = 0; i < POLL_PMBUS_VALUE; i++, value >>= 8)
+			*out++ = value;
+	}
+
+	return status;
+}
+
+// Bytes of sample data in the records of an entry
+static uint8_t Poll_DataLength(const Poll_Entry_t* const entry)
+{
+	return (entry->Length & POLL_PMBUS) ? (entry->Length & POLL_PMBUS_LENGTH) : entry->Length;
+}
+
+// Take one sample of an entry into data, whichever kind it is, returning the status byte for its record
+static uint8_t Poll_Take(const uint8_t index, uint8_t* const data)
+{
+	const Poll_Entry_t* entry = &Poll_Entries[index];
+
+	if (entry->Address & POLL_ADC)
+		return Poll_Convert(entry, data);
+	if (entry->Length & POLL_PMBUS)
+		return Poll_Pmbus(index, data);
+	return Poll_Read(entry->Address, entry->Register, data, entry->Length);
+}
+
+// Extract a value in the format given by the POLL_FILTER_WIDE, _BIG and _SIGNED flags
+static uint16_t Poll_Value(const uint8_t flags, const uint8_t* const data)
+{
+	uint16_t value = data[0];
+
+	if (flags & POLL_FILTER_WIDE)
+		value = (flags & POLL_FILTER_BIG) ? ((value << 8) | data[1]) : (value | (data[1] << 8));
+	else if (flags & POLL_FILTER_SIGNED)
+		value = (int8_t)value;
+
+	return value;
+}
+
+// Put a value back in that format
+static void Poll_Store(const uint8_t flags, uint8_t* const data, const uint16_t value)
+{
+	if (!(flags & POLL_FILTER_WIDE)) {
+		data[0] = value;
+	} else if (flags & POLL_FILTER_BIG) {
+		data[0] = value >> 8;
+		data[1] = value;
+	} else {
+		data[0] = value;
+		data[1] = value >> 8;
+	}
+}
+
+// Map a value or limit to an unsigned number with the same order, so one set of comparisons covers both formats
+static uint16_t Poll_Order(const uint8_t flags, const uint16_t value)
+{
+	return (flags & POLL_FILTER_SIGNED) ? (value ^ 0x8000) : value;
+}
+
+// Result of a sum in the value format, saturating at its range; acc is the sum of count values in unsigned order
+static uint16_t Poll_Sum(const uint8_t flags, const uint32_t acc, const uint16_t count)
+{
+	const bool wide = (flags & POLL_FILTER_WIDE);
+
+	if (!(flags & POLL_FILTER_SIGNED)) {
+		const uint16_t max = wide ? UINT16_MAX : UINT8_MAX;
+		return (acc > max) ? max : acc;
+	}
+
+	// Each value carries an offset of 0x8000 in unsigned order
+	const uint32_t offset = (uint32_t)count << 15;
+	if (acc >= offset) {
+		const uint16_t max = wide ? INT16_MAX : INT8_MAX;
+		return ((acc - offset) > max) ? max : (acc - offset);
+	}
+
+	const uint16_t min = wide ? 0x8000 : 0x80;
+	return ((offset - acc) > min) ? -min : -(offset - acc);
+}
+
+// Fold a sample into the entry's reduction. Returns true once a group of samples is complete, with the result in
+// status and data: the reduced values in place of the sampled ones, the other bytes as in the last sample.
+static bool Poll_Reduce(const uint8_t index, uint8_t* const status, uint8_t* const data)
+{
+	const Poll_Reduce_t* reduce = &Poll_Entries[index].Reduce;
+	Poll_ReduceState_t* state   = &Poll_ReduceStates[index];
+	const uint8_t width         = (reduce->Flags & POLL_FILTER_WIDE) ? 2 : 1;
+
+	if (reduce->Op == POLL_REDUCE_OFF)
+		return true;
+
+	// Failed samples read as zeros and are left out
+	if (*status == STATUS_ADDRESS_ACK) {
+		for (uint8_t i = 0; i < reduce->Values; i++) {
+			const uint16_t value = Poll_Order(reduce->Flags, Poll_Value(reduce->Flags, &data[reduce->Field + i * width]));
+			uint32_t* acc = &state->Acc[i];
+
+			if (!state->Good)
+				*acc = value;
+			else if ((reduce->Op == POLL_REDUCE_MEAN) || (reduce->Op == POLL_REDUCE_SUM))
+				*acc += value;
+			else if ((reduce->Op == POLL_REDUCE_MIN) ? (value < *acc) : (value > *acc))
+				*acc = value;
+		}
+		state->Good++;
+	}
+
+	if (++state->Taken < reduce->Samples)
+		return false;
+
+	if (state->Good) {
+		for (uint8_t i = 0; i < reduce->Values; i++) {
+			const uint32_t acc = state->Acc[i];
+			uint16_t value;
+
+			if (reduce->Op == POLL_REDUCE_SUM)
+				value = Poll_Sum(reduce->Flags, acc, state->Good);
+			else if (reduce->Op == POLL_REDUCE_MEAN)
+				value = Poll_Order(reduce->Flags, (acc + state->Good / 2) / state->Good);
+			else
+				value = Poll_Order(reduce->Flags, acc);
+
+			Poll_Store(reduce->Flags, &data[reduce->Field + i * width], value);
+		}
+		*status = STATUS_ADDRESS_ACK;
+	}
+
+	state->Taken = 0;
+	state->Good  = 0;
+	return true;
+}
+
+// Below, between or above the thresholds of a POLL_FILTER_THRESHOLD filter, for a value in unsigned order
+static uint8_t Poll_Zone(const Poll_Filter_t* const filter, const uint16_t value)
+{
+	const uint16_t low  = Poll_Order(filter->Flags, filter->Limits[0]);
+	const uint16_t high = Poll_Order(filter->Flags, filter->Limits[1]);
+
+	return (value < low) ? 0 : (value > high) ? 2 : 1;
+}
+
+// Decide whether a sample is reported, and remember it if so
+static bool Poll_Filter(const uint8_t index, const uint8_t status, const uint8_t* const data)
+{
+	const Poll_Filter_t* filter = &Poll_Entries[index].Filter;
+	Poll_FilterState_t* state   = &Poll_FilterStates[index];
+	const uint8_t mode          = filter->Flags & POLL_FILTER_MODE;
+
+	if (mode == POLL_FILTER_ALWAYS)
+		return true;
+
+	const uint16_t value = Poll_Order(filter->Flags, Poll_Value(filter->Flags, &data[filter->Field]));
+	const uint16_t low   = Poll_Order(filter->Flags, filter->Limits[0]);
+
+	bool report = !state->Reported || (status != state->Status) ||
+	              (filter->Heartbeat && (++state->Skipped >= filter->Heartbeat));
+
+	// Failed samples read as zeros, so only their status counts
+	if (!report && (status == STATUS_ADDRESS_ACK)) {
+		const uint16_t last = state->Value;
+
+		switch (mode) {
+			case POLL_FILTER_CHANGE:
+				report = (value != last);
+				break;
+
+			case POLL_FILTER_DELTA:
+				report = (((value > last) ? (value - last) : (last - value)) >= low);
+				break;
+
+			case POLL_FILTER_THRESHOLD:
+				report = (Poll_Zone(filter, value) != Poll_Zone(filter, last));
+				break;
+		}
+	}
+
+	if (report) {
+		state->Reported = true;
+		state->Status   = status;
+		state->Value    = value;
+		state->Skipped  = 0;
+	}
+
+	return report;
+}
+
+// Bytes the next record of an entry takes up in the open frame, including the packet header it may have to start
+static uint8_t Poll_RecordLength(const uint8_t length)
+{
+	if (!Poll_Compact)
+		return POLL_RECORD_HEADER + length;
+
+	return POLL_COMPACT_HEADER + length + (Poll_FrameBytes ? 0 : POLL_PACKET_HEADER);
+}
+
+// Run one register read and, unless the entry's reduction or filter holds it back, append its record to the open
+// frame; the caller owns the bus. Returns the number of bytes that went out.
+static uint8_t Poll_Sample(const uint8_t index)
+{
+	const Poll_Entry_t* entry = &Poll_Entries[index];
+	uint8_t data[POLL_MAX_LENGTH];
+	uint8_t subframe;
+
+	const uint16_t frame = Timebase_FrameStamp(&subframe);
+	const uint16_t stamp = Timebase_Now();
+	const uint8_t length = Poll_DataLength(entry);
+	uint8_t status = Poll_Take(index, data);
+
+	if (!Poll_Reduce(index, &status, data) || !Poll_Filter(index, status, data))
+		return 0;
+
+	const uint8_t written = Poll_RecordLength(length);
+
+	Endpoint_SelectEndpoint(POLL_EPADDR);
+	if (!Poll_Compact) {
+		Endpoint_Write_8(index);
+		Endpoint_Write_16_LE(frame);
+		Endpoint_Write_8(subframe);
+		Endpoint_Write_8(status);
+	} else {
+		// The packet carries the frame stamp of its first record, the others the ticks since the one before
+		uint16_t delta = 0;
+		if (!Poll_FrameBytes) {
+			Endpoint_Write_16_LE(frame);
+			Endpoint_Write_8(subframe);
+		} else {
+			delta = stamp - Poll_LastStamp;
+		}
+		Poll_LastStamp = stamp;
+
+		Endpoint_Write_8(index | ((status == STATUS_ADDRESS_ACK) ? 0 : POLL_COMPACT_FAILED));
+		Endpoint_Write_8((delta > UINT8_MAX) ? UINT8_MAX : delta);
+	}
+	for (uint8_t i = 0; i < length; i++)
+		Endpoint_Write_8(data[i]);
+
+	return written;
+}
+
+/** Stops polling and forgets all entries, going back to the plain record format. Does not touch the endpoint, use
+ *  \ref Poll_Flush() for that.
+ */
+void Poll_Clear(void)
+{
+	Poll_Count      = 0;
+	Poll_FrameBytes = 0;
+	Poll_Compact    = false;
+	Poll_Sync       = false;
+
+	if (ADC_GetStatus()) {
+		ADC_Disable();
+		power_adc_disable();
+	}
+}
+
+/** Selects the compact record format, see \ref POLL_COMPACT, or the plain one. Only to be called with no frame
+ *  open, i.e. right after \ref Poll_Clear().
+ */
+void Poll_SetCompact(const bool compact)
+{
+	Poll_Compact = compact;
+}
+
+/** Returns whether records go out in the compact format. */
+bool Poll_IsCompact(void)
+{
+	return Poll_Compact;
+}
+
+/** Has the entry periods count SYNC edges, see \ref POLL_SYNC, or frames. Only to be called before any entries
+ *  are added, i.e. right after \ref Poll_Clear().
+ */
+void Poll_SetSync(const bool sync)
+{
+	Poll_Sync = sync;
+}
+
+/** Adds an entry to the polling job, its first sample is taken right away. An address with \ref POLL_ADC samples
+ *  an ADC channel instead, which powers up the ADC until the job is cleared, and a length with \ref POLL_PMBUS
+ *  sweeps the telemetry of a PMBus device.
+ *  @return false if the entry is invalid or the job is full
+ */
+bool Poll_AddEntry(const uint8_t address, const uint8_t reg, const uint8_t length, const uint16_t period)
+{
+	uint8_t stored = length;
+
+	if (length & POLL_PMBUS) {
+		uint8_t values = 0;
+		for (uint8_t bits = reg; bits; bits >>= 1)
+			values += (bits & 1);
+		if ((address & POLL_ADC) || !values)
+			return false;
+		// Entries saved with the settings come back the same way
+		stored = (length & (POLL_PMBUS | POLL_PMBUS_PEC)) | (values * POLL_PMBUS_VALUE);
+	} else if (!length || (length > POLL_MAX_LENGTH)) {
+		return false;
+	}
+
+	if (Poll_Count == POLL_MAX_ENTRIES)
+		return false;
+
+	if (address & POLL_ADC) {
+		const uint8_t channel = ((reg & (1 << 5)) ? 8 : 0) | (reg & 0x07);
+
+		if (length != POLL_ADC_LENGTH)
+			return false;
+
+		// 125 kHz ADC clock, within the 50 to 200 kHz of full resolution; pins ADC0 to ADC13 lose their digital input
+		power_adc_enable();
+		ADC_Init(ADC_SINGLE_CONVERSION | ADC_PRESCALE_128);
+		if (!(reg & 0x18) && (channel < 14))
+			ADC_SetupChannel(channel);
+	}
+
+	Poll_Entry_t* entry = &Poll_Entries[Poll_Count];
+	entry->Address  = address;
+	entry->Register = reg;
+	entry->Length   = stored;
+	entry->Period   = period ? period : 1;
+	// Synchronised entries wait for the next edge rather than having all adapters start out of step
+	entry->Due      = Poll_Sync ? Sync_GetEdges() + 1 : Timebase_GetFrame();
+	memset(&entry->Filter, 0, sizeof(entry->Filter));
+	memset(&entry->Reduce, 0, sizeof(entry->Reduce));
+	Poll_VoutModes[Poll_Count] = POLL_VOUT_UNKNOWN;
+	Poll_FilterStates[Poll_Count++].Reported = false;
+
+	return true;
+}
+
+/** Sets up which samples of an entry are reported, see POLL_FILTER_MODE; the next sample is reported either way.
+ *  PMBus sweeps only take the default, as their 32-bit values don't fit the filter.
+ *  @return false if there is no such entry or the watched value lies outside its data
+ */
+bool Poll_SetFilter(const uint8_t index, const Poll_Filter_t* const filter)
+{
+	const uint8_t width = (filter->Flags & POLL_FILTER_WIDE) ? 2 : 1;
+
+	if ((index >= Poll_Count) || ((uint16_t)filter->Field + width > Poll_DataLength(&Poll_Entries[index])))
+		return false;
+	if ((Poll_Entries[index].Length & POLL_PMBUS) && ((filter->Flags & POLL_FILTER_MODE) != POLL_FILTER_ALWAYS))
+		return false;
+
+	Poll_Entries[index].Filter = *filter;
+	Poll_FilterStates[index].Reported = false;
+
+	return true;
+}
+
+/** Sets up an entry to reduce each group of samples to one record, see POLL_REDUCE_OFF; a group starts with the
+ *  next sample. Reduced records go through the entry's filter like samples do. PMBus sweeps aren't reduced.
+ *  @return false if there is no such entry or the values lie outside its data
+ */
+bool Poll_SetReduce(const uint8_t index, const Poll_Reduce_t* const reduce)
+{
+	const uint8_t width = (reduce->Flags & POLL_FILTER_WIDE) ? 2 : 1;
+
+	if ((index >= Poll_Count) || (reduce->Op > POLL_REDUCE_MAX))
+		return false;
+	if ((reduce->Op != POLL_REDUCE_OFF) &&
+	    (!reduce->Values || (reduce->Values > POLL_REDUCE_VALUES) || !reduce->Samples ||
+	     (Poll_Entries[index].Length & POLL_PMBUS) ||
+	     ((uint16_t)reduce->Field + reduce->Values * width > Poll_DataLength(&Poll_Entries[index]))))
+		return false;
+
+	Poll_Entries[index].Reduce = *reduce;
+	Poll_ReduceStates[index].Taken = 0;
+	Poll_ReduceStates[index].Good  = 0;
+
+	return true;
+}
+
+/** Returns the entry with the given index, or NULL past the last one. */
+const Poll_Entry_t* Poll_GetEntry(const uint8_t index)
+{
+	return (index < Poll_Count) ? &Poll_Entries[index] : NULL;
+}
+
+// Send off the open frame, if any. An isochronous packet goes out with the next frame's IN token whatever, no retry,
+// and is not charged to the bulk endpoint services.
+static void Poll_Send(void)
+{
+	if (!Poll_FrameBytes)
+		return;
+
+	Endpoint_SelectEndpoint(POLL_EPADDR);
+	if (Poll_IsIso())
+		Endpoint_ClearIN();
+	else
+		I2C_ClearVendorIN();
+	Poll_FrameBytes = 0;
+}
+
+/** Sends off the currently open frame, if any. Must be called before anybody else writes to the bulk IN endpoint;
+ *  records on the isochronous endpoint are not in the way and stay where they are.
+ */
+void Poll_Flush(void)
+{
+	if (!Poll_IsIso())
+		Poll_Send();
+}
+
+/** Takes all samples that are due, as far as the bus and the IN endpoint allow. Called from the main loop;
+ *  samples that cannot be taken right away stay due and are retried on the next call.
+ */
+void Poll_Task(void)
+{
+	// A HID build response waiting for BULK_OP_FLUSH holds the IN bank
+	if (!Poll_Count || !I2C_IsBulkActive() || Bulk_ResponsePending())
+		return;
+
+	const uint16_t frame = Timebase_GetFrame();
+	const uint16_t now   = Poll_Sync ? Sync_GetEdges() : frame;
+
+	if (Poll_FrameBytes && (frame != Poll_FrameTick))
+		Poll_Send();
+
+	for (uint8_t i = 0; i < Poll_Count; i++) {
+		Poll_Entry_t* entry = &Poll_Entries[i];
+		if ((int16_t)(now - entry->Due) < 0)
+			continue;
+
+		if (Poll_FrameBytes + Poll_RecordLength(Poll_DataLength(entry)) > VENDOR_IO_EPSIZE)
+			Poll_Send();
+
+		Endpoint_SelectEndpoint(POLL_EPADDR);
+		if (!Poll_FrameBytes) {
+			// Host isn't keeping up, leave the sample pending rather than blocking the main loop
+			if (!Endpoint_IsINReady())
+				return;
+			Poll_FrameTick = frame;
+		}
+
+		// The bulk path may be in the middle of a transaction spanning several packets; ADC entries don't need the bus
+		const bool bus = !(entry->Address & POLL_ADC);
+		const Stats_Stamp_t sample_start = Stats_LatencyStart();
+		if (bus && !I2C_ClaimBus(BUS_OWNER_POLL))
+			return;
+		const uint8_t written = Poll_Sample(i);
+		if (bus)
+			I2C_ReleaseBus();
+		Stats_LatencyDone(STATS_LATENCY_Poll, sample_start);
+		Control_Preempt();
+
+		Poll_FrameBytes += written;
+
+		// Keep the sampling grid, unless we fell behind by more than a period
+		entry->Due += entry->Period;
+		if ((int16_t)(now - entry->Due) >= 0) {
+			entry->Due = now + entry->Period;
+			Events_Push(EVENT_POLL_OVERRUN, i);
+		}
+	}
+}
+
+/** Samples the entries with a threshold filter without sending anything, for a remote wakeup while the host has
+ *  suspended the device. Reductions are left out, each entry is read once.
+ *  The caller owns the bus; the crossing itself goes out as a record once polling goes on after the resume.
+ *  @return true if an entry crossed into another zone than its last record was in
+ */
+bool Poll_CheckThresholds(void)
+{
+	for (uint8_t i = 0; i < Poll_Count; i++) {
+		const Poll_Entry_t* entry       = &Poll_Entries[i];
+		const Poll_FilterState_t* state = &Poll_FilterStates[i];
+		uint8_t data[POLL_MAX_LENGTH];
+
+		if (((entry->Filter.Flags & POLL_FILTER_MODE) != POLL_FILTER_THRESHOLD) || !state->Reported)
+			continue;
+
+		const uint8_t status = Poll_Take(i, data);
+		if (status != STATUS_ADDRESS_ACK)
+			continue;
+
+		const uint16_t value = Poll_Order(entry->Filter.Flags, Poll_Value(entry->Filter.Flags, &data[entry->Filter.Field]));
+		if (Poll_Zone(&entry->Filter, value) != Poll_Zone(&entry->Filter, state->Value))
+			return true;
+	}
+
+	return false;
+}
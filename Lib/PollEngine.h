@@ -0,0 +1,223 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for PollEngine.c.
+ */
+
+#ifndef _POLL_ENGINE_H_
+#define _POLL_ENGINE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "TWIEngine.h"
+		#include "Timebase.h"
+		#include "EventQueue.h"
+		#include "SyncLine.h"
+
+		#include <LUFA/Drivers/Peripheral/ADC.h>
+
+	/* Macros: */
+		/** Maximum number of registers that can be polled at the same time. */
+		#define POLL_MAX_ENTRIES      8
+
+		/** Size of the record header preceding the register data: entry index, 16-bit frame count, Timer1 ticks
+		 *  into the frame, status.
+		 */
+		#define POLL_RECORD_HEADER    5
+
+		/** Maximum number of bytes read per sample, so that every record fits into a single frame. */
+		#define POLL_MAX_LENGTH       (VENDOR_IO_EPSIZE - POLL_RECORD_HEADER)
+
+		/** Bit of an entry's address turning it into an ADC channel. The register is then the ADMUX value with MUX5
+		 *  in place of ADLAR: reference in bits 7 and 6, MUX5 in bit 5 and MUX4 to MUX0 below, e.g. 0x40 for ADC0
+		 *  against AVCC. Such an entry samples \ref POLL_ADC_LENGTH bytes, the 10-bit result little endian.
+		 */
+		#define POLL_ADC              0x80
+		#define POLL_ADC_LENGTH       2
+
+		/** Bit of an entry's length turning it into a PMBus telemetry sweep. Its register byte then selects the
+		 *  POLL_PMBUS_* telemetry commands to read, and each sample has a signed 32-bit little endian value in
+		 *  milli-units (mV, mA, milli-degrees or mW) per selected command, in the order of the bits, decoded from LINEAR11 or,
+		 *  for READ_VOUT, LINEAR16 with the exponent from the device's VOUT_MODE. With \ref POLL_PMBUS_PEC the reads
+		 *  are checked against their PEC. The other length bits are ignored and replaced by the data length.
+		 */
+		#define POLL_PMBUS            0x80
+		#define POLL_PMBUS_PEC        0x40
+		#define POLL_PMBUS_LENGTH     0x3F
+
+		/** Bytes per value of a PMBus sweep, and the value of a command that couldn't be read or decoded. */
+		#define POLL_PMBUS_VALUE      4
+		#define POLL_PMBUS_INVALID    0x80000000UL
+
+		/** Telemetry commands of a PMBus sweep, bits of its register byte. */
+		#define POLL_PMBUS_VIN        (1 << 0) /**< READ_VIN (0x88) */
+		#define POLL_PMBUS_IIN        (1 << 1) /**< READ_IIN (0x89) */
+		#define POLL_PMBUS_VOUT       (1 << 2) /**< READ_VOUT (0x8B) */
+		#define POLL_PMBUS_IOUT       (1 << 3) /**< READ_IOUT (0x8C) */
+		#define POLL_PMBUS_TEMP1      (1 << 4) /**< READ_TEMPERATURE_1 (0x8D) */
+		#define POLL_PMBUS_TEMP2      (1 << 5) /**< READ_TEMPERATURE_2 (0x8E) */
+		#define POLL_PMBUS_POUT       (1 << 6) /**< READ_POUT (0x96) */
+		#define POLL_PMBUS_PIN        (1 << 7) /**< READ_PIN (0x97) */
+
+		/** PMBus commands and VOUT_MODE fields the sweep needs beyond the telemetry itself. */
+		#define PMBUS_VOUT_MODE       0x20
+		#define PMBUS_READ_VOUT       0x8B
+		#define PMBUS_MODE_MASK       0xE0
+		#define PMBUS_MODE_LINEAR     0x00
+
+		/** VOUT_MODE cached for an entry that hasn't got it yet; no device has it, as mode 7 is not defined. */
+		#define POLL_VOUT_UNKNOWN     0xFF
+
+		/** Bit of the POLL entry count selecting the compact record format. Each packet then starts with the 16-bit
+		 *  frame count and the Timer1 ticks into the frame of its first record, and the records only have the entry
+		 *  index, with \ref POLL_COMPACT_FAILED for a failed sample, and the Timer1 ticks since the record before.
+		 */
+		#define POLL_COMPACT          0x80
+
+		/** Bit of the POLL entry count making the entry periods count edges of the SYNC line instead of frames, so
+		 *  that adapters sharing the line sample together. Not kept with the saved settings.
+		 */
+		#define POLL_SYNC             0x40
+
+		/** Size of the packet header and of the record header of the compact format. */
+		#define POLL_PACKET_HEADER    3
+		#define POLL_COMPACT_HEADER   2
+
+		/** Bit of a compact record's index byte set for a sample that failed. */
+		#define POLL_COMPACT_FAILED   0x80
+
+		/** Filter flags of a polling job entry, deciding which samples are reported. The filter watches an 8 or
+		 *  16-bit value in the sample data; a sample whose status differs from the last reported one always goes out.
+		 */
+		#define POLL_FILTER_MODE      0x03     /**< Mask of the reporting mode */
+		#define POLL_FILTER_ALWAYS    0x00     /**< Report every sample */
+		#define POLL_FILTER_CHANGE    0x01     /**< Report when the value differs from the last reported one */
+		#define POLL_FILTER_DELTA     0x02     /**< Report when the value moved by Limits[0] or more since the last report */
+		#define POLL_FILTER_THRESHOLD 0x03     /**< Report when the value crosses Limits[0] (low) or Limits[1] (high) */
+		#define POLL_FILTER_WIDE      (1 << 2) /**< The value is 16 bits wide */
+		#define POLL_FILTER_BIG       (1 << 3) /**< A 16-bit value is high byte first */
+		#define POLL_FILTER_SIGNED    (1 << 4) /**< The value and the limits are two's complement */
+
+		/** Reductions of a polling job entry, which sends one record per group of samples. */
+		#define POLL_REDUCE_OFF       0 /**< Every sample is a record of its own */
+		#define POLL_REDUCE_MEAN      1 /**< Mean of the values, rounded */
+		#define POLL_REDUCE_SUM       2 /**< Sum of the values, saturating at the value format's range */
+		#define POLL_REDUCE_MIN       3 /**< Smallest value */
+		#define POLL_REDUCE_MAX       4 /**< Largest value */
+
+		/** Most values reduced per sample. */
+		#define POLL_REDUCE_VALUES    4
+
+	/* Type Defines: */
+		/** Type define for the reporting filter of a polling job entry. */
+		typedef struct
+		{
+			uint8_t  Flags;     /**< POLL_FILTER_* mode and value format */
+			uint8_t  Field;     /**< Offset of the watched value in the sample data */
+			uint16_t Limits[2]; /**< Delta, or low and high threshold, in the value's format */
+			uint16_t Heartbeat; /**< Report at least every this many samples, 0 for no such minimum */
+		} Poll_Filter_t;
+
+		/** Type define for the reduction of a polling job entry. */
+		typedef struct
+		{
+			uint8_t  Op;        /**< POLL_REDUCE_* operation */
+			uint8_t  Flags;     /**< Value format, POLL_FILTER_WIDE, _BIG and _SIGNED */
+			uint8_t  Field;     /**< Offset of the first value in the sample data */
+			uint8_t  Values;    /**< Number of values back to back from there, up to \ref POLL_REDUCE_VALUES */
+			uint16_t Samples;   /**< Samples per record */
+		} Poll_Reduce_t;
+
+		/** Type define for one polling job entry. */
+		typedef struct
+		{
+			uint8_t  Address;  /**< 7-bit target address */
+			uint8_t  Register; /**< Register pointer written before reading */
+			uint8_t  Length;   /**< Number of bytes to read */
+			uint16_t Period;   /**< Sampling period in milliseconds */
+			uint16_t Due;      /**< Frame count the next sample is due at */
+			Poll_Filter_t Filter; /**< Which samples are reported */
+			Poll_Reduce_t Reduce; /**< How samples are combined before that */
+		} Poll_Entry_t;
+
+		/** Type define for what the filter of an entry remembers about the last sample it reported. */
+		typedef struct
+		{
+			uint8_t  Reported; /**< A sample was reported since the entry or its filter was set up */
+			uint8_t  Status;   /**< Status byte of that sample */
+			uint16_t Value;    /**< Its watched value, in unsigned order */
+			uint16_t Skipped;  /**< Samples held back since */
+		} Poll_FilterState_t;
+
+		/** Type define for the group of samples a reduction is working on. */
+		typedef struct
+		{
+			uint16_t Taken;                       /**< Samples in the group so far */
+			uint16_t Good;                        /**< Those of them that were read fine */
+			uint32_t Acc[POLL_REDUCE_VALUES];     /**< Sum, minimum or maximum of each value, in unsigned order */
+		} Poll_ReduceState_t;
+
+	/* Function Prototypes: */
+		void Poll_Clear(void);
+		bool Poll_AddEntry(const uint8_t address, const uint8_t reg, const uint8_t length, const uint16_t period);
+		bool Poll_SetFilter(const uint8_t index, const Poll_Filter_t* const filter);
+		bool Poll_SetReduce(const uint8_t index, const Poll_Reduce_t* const reduce);
+		void Poll_SetCompact(const bool compact);
+		bool Poll_IsCompact(void);
+		void Poll_SetSync(const bool sync);
+		const Poll_Entry_t* Poll_GetEntry(const uint8_t index);
+		void Poll_Flush(void);
+		void Poll_Task(void);
+		bool Poll_CheckThresholds(void);
+
+		#if defined(__INCLUDE_FROM_POLLENGINE_C)
+			static uint8_t Poll_Address(const uint8_t address);
+			static uint8_t Poll_Read(const uint8_t address, const uint8_t reg, uint8_t* const data, const uint8_t length);
+			static uint8_t Poll_Convert(const Poll_Entry_t* const entry, uint8_t* const data);
+			static uint8_t Poll_PmbusRead(const uint8_t address, const uint8_t command, const uint8_t length,
+			                              const bool pec, uint16_t* const value);
+			static int32_t Poll_PmbusScale(const int32_t mantissa, int8_t exponent);
+			static uint8_t Poll_Pmbus(const uint8_t index, uint8_t* const data);
+			static uint8_t Poll_DataLength(const Poll_Entry_t* const entry);
+			static uint8_t Poll_Take(const uint8_t index, uint8_t* const data);
+			static uint16_t Poll_Value(const uint8_t flags, const uint8_t* const data);
+			static void Poll_Store(const uint8_t flags, uint8_t* const data, const uint16_t value);
+			static uint16_t Poll_Order(const uint8_t flags, const uint16_t value);
+			static uint16_t Poll_Sum(const uint8_t flags, const uint32_t acc, const uint16_t count);
+			static bool Poll_Reduce(const uint8_t index, uint8_t* const status, uint8_t* const data);
+			static uint8_t Poll_Zone(const Poll_Filter_t* const filter, const uint16_t value);
+			static bool Poll_Filter(const uint8_t index, const uint8_t status, const uint8_t* const data);
+			static uint8_t Poll_RecordLength(const uint8_t length);
+			static uint8_t Poll_Sample(const uint8_t index);
+			static bool Poll_IsIso(void);
+			static void Poll_Send(void);
+		#endif
+
+#endif
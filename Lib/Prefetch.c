@@ -0,0 +1,136 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_PREFETCH_C
+#include "Prefetch.h"
+#include "TWIEngine.h"
+
+#if PREFETCH_SUPPORT
+
+Prefetch_Buffer_t Prefetch = { .Address = PREFETCH_UNUSED };
+
+static uint8_t Prefetch_Address(const uint8_t address)
+{
+	TWIEngine_Start(address);
+	return TWIEngine_Wait(I2C_StartTimeoutMs);
+}
+
+// Reads the armed block into the buffer. The caller owns the bus.
+// @return false if the target didn't ACK or the read was cut short
+static bool Prefetch_Read(void)
+{
+	const uint8_t address = Prefetch.Address << 1;
+	uint8_t result = Prefetch_Address(address);
+	const uint8_t bus_held = (result == TWI_ERROR_NoError);
+
+	if (bus_held) {
+		TWIEngine_Write(Prefetch.PointerWidth);
+		if (Prefetch.PointerWidth > 1)
+			RingBuffer_Insert(&TWIEngine_TxRing, Prefetch.Register >> 8);
+		RingBuffer_Insert(&TWIEngine_TxRing, Prefetch.Register);
+		TWIEngine_Kick();
+		result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+		if (result == TWI_ERROR_NoError)
+			result = Prefetch_Address(address | I2C_M_RD);
+		if (result == TWI_ERROR_NoError)
+			TWIEngine_Read(Prefetch.Length, true);
+	}
+
+	for (uint8_t i = 0; (result == TWI_ERROR_NoError) && (i < Prefetch.Length); i++) {
+		if (!TWIEngine_WaitFor(TWI_EVENT_RxData) || RingBuffer_IsEmpty(&TWIEngine_RxRing)) {
+			result = TWI_ERROR_BusFault;
+		} else {
+			Prefetch.Data[i] = RingBuffer_Remove(&TWIEngine_RxRing);
+			TWIEngine_Kick();
+		}
+	}
+
+	// A NACKed address has already been followed by a STOP from the engine
+	if (bus_held && (result != TWI_ERROR_SlaveNotReady)) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+	}
+	if (result != TWI_ERROR_NoError)
+		TWIEngine_Reset();
+
+	return (result == TWI_ERROR_NoError);
+}
+
+/** Empties the buffer, for a configure. */
+void Prefetch_Clear(void)
+{
+	Prefetch.Address = PREFETCH_UNUSED;
+}
+
+/** Looks for a CMD_I2C_REGREAD in the buffer, which must hold at least \c length bytes from \c reg on.
+ *  @return The data to answer the read with, or NULL if it has to go to the target
+ */
+const uint8_t* Prefetch_Lookup(const uint8_t address, const uint8_t width, const uint16_t reg, const uint16_t length)
+{
+	if (!(I2C_Options & OPTION_PREFETCH) || (Prefetch.Address != address) || (Prefetch.State != PREFETCH_Valid))
+		return NULL;
+	if ((Prefetch.PointerWidth != width) || (Prefetch.Register != reg) || (Prefetch.Length < length))
+		return NULL;
+
+	return Prefetch.Data;
+}
+
+/** Arms the read ahead of the block following a successful CMD_I2C_REGREAD, whether that came from the target or
+ *  from the buffer. Reads too long for the buffer leave it alone.
+ */
+void Prefetch_Done(const uint8_t address, const uint8_t width, const uint16_t reg, const uint16_t length)
+{
+	if (!(I2C_Options & OPTION_PREFETCH) || !length || (length > PREFETCH_SIZE))
+		return;
+
+	Prefetch.Address      = address;
+	Prefetch.State        = PREFETCH_Armed;
+	Prefetch.PointerWidth = width;
+	Prefetch.Length       = length;
+	Prefetch.Register     = (width > 1) ? reg + length : (uint8_t)(reg + length);
+}
+
+/** Reads the armed block while nobody else wants the bus. Run from the main loop. */
+void Prefetch_Task(void)
+{
+	if ((Prefetch.Address == PREFETCH_UNUSED) || (Prefetch.State != PREFETCH_Armed))
+		return;
+	if (!I2C_ClaimBus(BUS_OWNER_PREFETCH))
+		return;
+
+	TWIBus_WaitStop();
+	if (Prefetch_Read())
+		Prefetch.State = PREFETCH_Valid;
+	else
+		Prefetch.Address = PREFETCH_UNUSED;
+
+	I2C_ReleaseBus();
+}
+
+#endif
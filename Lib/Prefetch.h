@@ -0,0 +1,114 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for Prefetch.c.
+ */
+
+#ifndef _PREFETCH_H_
+#define _PREFETCH_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+	/* Macros: */
+		/** Longest CMD_I2C_REGREAD that gets the block after it read ahead. */
+		#define PREFETCH_SIZE         64
+
+		/** Address of an empty prefetch buffer. */
+		#define PREFETCH_UNUSED       0xFF
+
+	/* Type Defines: */
+		/** Type define for the states of the prefetch buffer. */
+		enum Prefetch_State_t
+		{
+			PREFETCH_Armed = 0,              /**< The block is to be read once the bus is idle */
+			PREFETCH_Valid = 1,              /**< Data holds the block */
+		};
+
+		/** Type define for the prefetch buffer, one block of a single target. */
+		typedef struct
+		{
+			uint8_t  Address;                /**< 7-bit target address, \ref PREFETCH_UNUSED if empty */
+			uint8_t  State;                  /**< A \ref Prefetch_State_t value */
+			uint8_t  PointerWidth;           /**< Register pointer bytes, 1 or 2 */
+			uint8_t  Length;                 /**< Block length */
+			uint16_t Register;               /**< Register pointer the block starts at */
+			uint8_t  Data[PREFETCH_SIZE];    /**< Block contents */
+		} Prefetch_Buffer_t;
+
+	/* External Variables: */
+		#if PREFETCH_SUPPORT
+			extern Prefetch_Buffer_t Prefetch;
+		#endif
+
+	/* Function Prototypes: */
+		#if PREFETCH_SUPPORT
+			void Prefetch_Clear(void);
+			const uint8_t* Prefetch_Lookup(const uint8_t address, const uint8_t width, const uint16_t reg,
+			                               const uint16_t length);
+			void Prefetch_Done(const uint8_t address, const uint8_t width, const uint16_t reg, const uint16_t length);
+			void Prefetch_Task(void);
+		#endif
+
+		#if defined(__INCLUDE_FROM_PREFETCH_C) && PREFETCH_SUPPORT
+			static uint8_t Prefetch_Address(const uint8_t address);
+			static bool Prefetch_Read(void);
+		#endif
+
+	/* Inline Functions: */
+		#if PREFETCH_SUPPORT
+		/** Called by the TWI engine for every START with the address byte sent. A write to the target of the
+		 *  buffer drops the buffer, whoever sends it, except for the pointer write of the prefetch itself.
+		 */
+		static inline void Prefetch_Started(const uint8_t address) ATTR_ALWAYS_INLINE;
+		static inline void Prefetch_Started(const uint8_t address)
+		{
+			if (((address >> 1) == Prefetch.Address) && !(address & I2C_M_RD) && (I2C_BusOwner != BUS_OWNER_PREFETCH))
+				Prefetch.Address = PREFETCH_UNUSED;
+		}
+		#else
+		/* Without PREFETCH_SUPPORT OPTION_PREFETCH is ignored and the buffer is always empty. */
+		static inline void Prefetch_Started(const uint8_t address) { (void)address; }
+		static inline void Prefetch_Clear(void) {}
+		static inline const uint8_t* Prefetch_Lookup(const uint8_t address, const uint8_t width, const uint16_t reg,
+		                                             const uint16_t length)
+		{
+			(void)address; (void)width; (void)reg; (void)length;
+			return NULL;
+		}
+		static inline void Prefetch_Done(const uint8_t address, const uint8_t width, const uint16_t reg,
+		                                 const uint16_t length)
+		{
+			(void)address; (void)width; (void)reg; (void)length;
+		}
+		static inline void Prefetch_Task(void) {}
+		#endif
+
+#endif
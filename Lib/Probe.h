@@ -0,0 +1,80 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Debug probe pins for timing hot paths with a scope or logic analyzer. Everything here compiles to nothing
+ *  unless PROBE_SUPPORT is set, and to single sbi/cbi instructions if it is.
+ */
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+	/* Macros: */
+		/** Probe pins on \ref PROBE_PORT. Levels are high while the code path runs, unless noted otherwise. */
+		#define PROBE_WRITE     7 /**< I2C_Write, the control OUT data stage */
+		#define PROBE_READ      6 /**< I2C_Read, the control IN data stage */
+		#define PROBE_START     5 /**< From the START until the address is ACKed or NACKed */
+		#define PROBE_TWINT     4 /**< Waiting for the TWI to finish a byte */
+		#define PROBE_ENDPOINT  1 /**< Toggled on every control data packet sent or received */
+
+	/* Inline Functions: */
+		static inline void Probe_Init(void) ATTR_ALWAYS_INLINE;
+		static inline void Probe_Init(void)
+		{
+			if (PROBE_SUPPORT)
+				PROBE_DDR |= (1 << PROBE_WRITE) | (1 << PROBE_READ) | (1 << PROBE_START) | (1 << PROBE_TWINT) |
+				             (1 << PROBE_ENDPOINT);
+		}
+
+		static inline void Probe_On(const uint8_t pin) ATTR_ALWAYS_INLINE;
+		static inline void Probe_On(const uint8_t pin)
+		{
+			if (PROBE_SUPPORT)
+				PROBE_PORT |= (1 << pin);
+		}
+
+		static inline void Probe_Off(const uint8_t pin) ATTR_ALWAYS_INLINE;
+		static inline void Probe_Off(const uint8_t pin)
+		{
+			if (PROBE_SUPPORT)
+				PROBE_PORT &= ~(1 << pin);
+		}
+
+		/** Toggles a pin through the PIN register, which doesn't need a read-modify-write of the port. */
+		static inline void Probe_Toggle(const uint8_t pin) ATTR_ALWAYS_INLINE;
+		static inline void Probe_Toggle(const uint8_t pin)
+		{
+			if (PROBE_SUPPORT)
+				PROBE_PIN = (1 << pin);
+		}
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Low-jitter windows around timed STARTs. With OPTION_QUIET set, the bulk
+ * protocol opens a window a little before a STREAM sample or a BATCH_FLAG_AT
+ * segment is due and closes it once that transaction is done. Inside it the
+ * interrupts that have nothing to do with the bus are masked: the Start of
+ * Frame, which also drives the statistics, suspend, the control endpoint and
+ * the boot clock overflow. What they flag while masked is served when the
+ * window closes, and the frame stamp the late SOF takes is extrapolated
+ * instead, so the timebase doesn't move.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_QUIETWINDOW_C
+#include "QuietWindow.h"
+
+// Interrupt enable bits the open window has masked, restored when it closes
+static uint8_t Quiet_UsbMask;
+static uint8_t Quiet_ControlMask;
+static uint8_t Quiet_TimerMask;
+static bool    Quiet_Open;
+
+/** Opens a window, unless OPTION_QUIET is off or one is open already. The TWI and Timer1 compare interrupts of the
+ *  TWI engine stay on.
+ */
+void Quiet_Begin(void)
+{
+	if (!(I2C_Options & OPTION_QUIET) || Quiet_Open)
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	Quiet_UsbMask = UDIEN & ((1 << SOFE) | (1 << SUSPE));
+	UDIEN &= ~Quiet_UsbMask;
+
+	Quiet_TimerMask = TIMSK1 & (1 << TOIE1);
+	TIMSK1 &= ~Quiet_TimerMask;
+
+	const uint8_t endpoint = Endpoint_GetCurrentEndpoint();
+	Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+	Quiet_ControlMask = UEIENX;
+	UEIENX = 0;
+	Endpoint_SelectEndpoint(endpoint);
+
+	Quiet_Open = true;
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Closes the window, if one is open. Only the bits it masked are set again, the TWI engine may have changed the
+ *  others meanwhile.
+ */
+void Quiet_End(void)
+{
+	if (!Quiet_Open)
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	// The SOF flagged meanwhile is served right after this, long past the frame start it would stamp
+	if (UDINT & (1 << SOFI))
+		Timebase_Held = true;
+
+	UDIEN  |= Quiet_UsbMask;
+	TIMSK1 |= Quiet_TimerMask;
+
+	const uint8_t endpoint = Endpoint_GetCurrentEndpoint();
+	Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+	UEIENX |= Quiet_ControlMask;
+	Endpoint_SelectEndpoint(endpoint);
+
+	Quiet_Open = false;
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
@@ -0,0 +1,52 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for QuietWindow.c.
+ */
+
+#ifndef _QUIET_WINDOW_H_
+#define _QUIET_WINDOW_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+
+	/* Macros: */
+		/** How long before a timed START the window opens, longer than the slowest interrupt it keeps out. */
+		#define QUIET_LEAD_US        200
+
+		/** \ref QUIET_LEAD_US in Timer1 ticks. */
+		#define QUIET_LEAD_TICKS     ((int16_t)Timebase_UsToTicks(QUIET_LEAD_US))
+
+	/* Function Prototypes: */
+		void Quiet_Begin(void);
+		void Quiet_End(void);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_REGCACHE_C
+#include "RegCache.h"
+
+static RegCache_Entry_t RegCache_Table[REGCACHE_ENTRIES];
+
+static RegCache_Entry_t* RegCache_Find(const uint8_t address, const uint16_t reg)
+{
+	for (uint8_t i = 0; i < REGCACHE_ENTRIES; i++) {
+		RegCache_Entry_t* entry = &RegCache_Table[i];
+		if ((entry->Address == address) && ((address == REGCACHE_UNUSED) || (entry->Register == reg)))
+			return entry;
+	}
+
+	return NULL;
+}
+
+/** Forgets all cached registers. */
+void RegCache_Clear(void)
+{
+	for (uint8_t i = 0; i < REGCACHE_ENTRIES; i++)
+		RegCache_Table[i].Address = REGCACHE_UNUSED;
+}
+
+/** Creates or replaces the entry for a register range. With \c data the entry is filled right away, without
+ *  it the next CMD_I2C_REGREAD of exactly that range reads the target and fills it.
+ *  @return false if the table is full or the range is too long
+ */
+bool RegCache_Set(const uint8_t address, const uint16_t reg, const uint8_t length, const uint8_t* const data)
+{
+	if (!length || (length > REGCACHE_MAX_LENGTH))
+		return false;
+
+	RegCache_Entry_t* entry = RegCache_Find(address, reg);
+	if (!entry)
+		entry = RegCache_Find(REGCACHE_UNUSED, 0);
+	if (!entry)
+		return false;
+
+	entry->Address  = address;
+	entry->Register = reg;
+	entry->Length   = length;
+	entry->Valid    = (data != NULL);
+	if (data)
+		memcpy(entry->Data, data, length);
+
+	return true;
+}
+
+/** Drops the entry for a register range, if there is one. */
+void RegCache_Remove(const uint8_t address, const uint16_t reg)
+{
+	RegCache_Entry_t* entry = RegCache_Find(address, reg);
+	if (entry)
+		entry->Address = REGCACHE_UNUSED;
+}
+
+/** Looks up the entry for a register read, which must cover the cached range exactly.
+ *  @return The entry, valid or waiting to be filled, or NULL if the range isn't cached
+ */
+RegCache_Entry_t* RegCache_Lookup(const uint8_t address, const uint16_t reg, const uint16_t length)
+{
+	RegCache_Entry_t* entry = RegCache_Find(address, reg);
+
+	return (entry && (entry->Length == length)) ? entry : NULL;
+}
@@ -0,0 +1,71 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for RegCache.c.
+ */
+
+#ifndef _REG_CACHE_H_
+#define _REG_CACHE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+	/* Macros: */
+		/** Number of register ranges that can be cached. */
+		#define REGCACHE_ENTRIES      (4 * BUFFER_SCALE)
+
+		/** Longest register range a cache entry can hold. */
+		#define REGCACHE_MAX_LENGTH   16
+
+		/** Address marking a free entry, and clearing the whole cache in CMD_SET_CACHE. */
+		#define REGCACHE_UNUSED       0xFF
+
+	/* Type Defines: */
+		/** Type define for one cached register range. */
+		typedef struct
+		{
+			uint8_t  Address;                    /**< 7-bit target address, \ref REGCACHE_UNUSED for a free entry */
+			uint8_t  Length;                     /**< Number of bytes cached */
+			uint16_t Register;                   /**< Register pointer the range starts at */
+			uint8_t  Valid;                      /**< Data holds the register contents; if not, the next read fills it */
+			uint8_t  Data[REGCACHE_MAX_LENGTH];  /**< Register contents */
+		} RegCache_Entry_t;
+
+	/* Function Prototypes: */
+		void RegCache_Clear(void);
+		bool RegCache_Set(const uint8_t address, const uint16_t reg, const uint8_t length, const uint8_t* const data);
+		void RegCache_Remove(const uint8_t address, const uint16_t reg);
+		RegCache_Entry_t* RegCache_Lookup(const uint8_t address, const uint16_t reg, const uint16_t length);
+
+		#if defined(__INCLUDE_FROM_REGCACHE_C)
+			static RegCache_Entry_t* RegCache_Find(const uint8_t address, const uint16_t reg);
+		#endif
+
+#endif
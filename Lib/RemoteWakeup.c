@@ -0,0 +1,127 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/** \file
+ *
+ *  Remote wakeup: a host that suspends idle adapters can still have an alert or a polled value crossing a threshold
+ *  wake it up. The configuration descriptor offers remote wakeup and the host decides whether to allow it for each
+ *  suspend; CMD_SET_WAKEUP picks what may use it. The alert interrupt wakes the CPU from its suspend sleep anyway.
+ *  For the polling job, the Timer1 compare B interrupt wakes it once per Timer1 period, about a quarter of a second,
+ *  and the main loop samples the threshold entries once. The Start of Frame doesn't come in suspend, so the
+ *  entries' own periods don't apply. The same interrupt also times the idle time the spec asks for before the resume
+ *  signalling. The events and records themselves go out as usual once the host has resumed the bus.
+ */
+
+#define  __INCLUDE_FROM_REMOTEWAKEUP_C
+#include "RemoteWakeup.h"
+
+// WAKEUP_* bits set by CMD_SET_WAKEUP
+static uint8_t Wakeup_Mode;
+
+// WAKEUP_* bit of what asked for a wakeup during the suspend, the bus has been idle long enough for a resume,
+// a poll round is due
+static volatile uint8_t Wakeup_Pending;
+static volatile uint8_t Wakeup_Settled;
+static volatile uint8_t Wakeup_Round;
+
+ISR(TIMER1_COMPB_vect)
+{
+	Wakeup_Settled = true;
+	Wakeup_Round   = true;
+}
+
+/** Sets what wakes the host, a set of WAKEUP_* bits; takes effect with the next suspend. */
+void Wakeup_SetMode(const uint8_t mode)
+{
+	Wakeup_Mode = mode & WAKEUP_MODES;
+}
+
+/** Asks for a wakeup for the given WAKEUP_* source, if it is allowed to and the device is suspended. Safe to call
+ *  from interrupts.
+ */
+void Wakeup_Raise(const uint8_t source)
+{
+	if ((Wakeup_Mode & source) && (USB_DeviceState == DEVICE_STATE_Suspended))
+		Wakeup_Pending = source;
+}
+
+/** Starts the timer interrupt for a suspend the host allows a wakeup from. Called from the USB_Suspend event. */
+void Wakeup_Suspend(void)
+{
+	Wakeup_Pending = 0;
+	Wakeup_Settled = false;
+	Wakeup_Round   = false;
+
+	if (!Wakeup_Mode || !USB_Device_RemoteWakeupEnabled)
+		return;
+
+	OCR1B  = TCNT1 + Timebase_MsToTicks(WAKEUP_SETTLE_MS);
+	TIFR1  = (1 << OCF1B);
+	TIMSK1 |= (1 << OCIE1B);
+}
+
+/** Stops the timer interrupt again once the bus is back. Called from the USB_WakeUp event. */
+void Wakeup_Resume(void)
+{
+	TIMSK1 &= ~(1 << OCIE1B);
+	Wakeup_Pending = 0;
+}
+
+/** Returns true if the main loop has a wakeup to send or a poll round to do, so it mustn't go to sleep. Call with
+ *  interrupts off, right before the sleep.
+ */
+bool Wakeup_IsDue(void)
+{
+	return Wakeup_Settled && (Wakeup_Pending || (Wakeup_Round && (Wakeup_Mode & WAKEUP_POLL)));
+}
+
+/** Returns true once per Timer1 period in a suspend with \ref WAKEUP_POLL allowed; the caller then powers up the
+ *  TWI, claims the bus and raises a wakeup if \ref Poll_CheckThresholds() finds a crossing.
+ */
+bool Wakeup_PollDue(void)
+{
+	if (!Wakeup_Round || !Wakeup_Settled || !(Wakeup_Mode & WAKEUP_POLL))
+		return false;
+
+	Wakeup_Round = false;
+	return true;
+}
+
+/** Signals a resume to the host if something asked for it. Called from the main loop while suspended. */
+void Wakeup_Task(void)
+{
+	const uint8_t source = Wakeup_Pending;
+
+	if (!source || !Wakeup_Settled || (USB_DeviceState != DEVICE_STATE_Suspended))
+		return;
+
+	Wakeup_Pending = 0;
+	Trace_Add(TRACE_WAKEUP, source);
+	USB_Device_SendRemoteWakeup();
+}
@@ -0,0 +1,62 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/** \file
+ *
+ *  Header file for RemoteWakeup.c.
+ */
+
+#ifndef _REMOTE_WAKEUP_H_
+#define _REMOTE_WAKEUP_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+		#include "PollEngine.h"
+		#include "Trace.h"
+
+	/* Macros: */
+		/** CMD_SET_WAKEUP bits in wValue, what wakes the host while it has the device suspended. */
+		#define WAKEUP_ALERT          (1 << 0) /**< An edge on the alert pin, with monitoring on, see CMD_SET_ALERT */
+		#define WAKEUP_POLL           (1 << 1) /**< A polling entry with a threshold filter crossing a threshold */
+		#define WAKEUP_MODES          (WAKEUP_ALERT | WAKEUP_POLL)
+
+		/** Time the bus must have been idle in suspend before the device may signal a resume, 5 ms by the spec. */
+		#define WAKEUP_SETTLE_MS      5
+
+	/* Function Prototypes: */
+		void Wakeup_SetMode(const uint8_t mode);
+		void Wakeup_Raise(const uint8_t source);
+		void Wakeup_Suspend(void);
+		void Wakeup_Resume(void);
+		bool Wakeup_IsDue(void);
+		bool Wakeup_PollDue(void);
+		void Wakeup_Task(void);
+
+#endif
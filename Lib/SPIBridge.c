@@ -0,0 +1,101 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_SPIBRIDGE_C
+#include "SPIBridge.h"
+
+// SPI_SPEED_* option of each SPI_BRIDGE_CLOCK value
+static const uint8_t PROGMEM SPIBridge_Clocks[] = {
+	SPI_SPEED_FCPU_DIV_2,  SPI_SPEED_FCPU_DIV_4,  SPI_SPEED_FCPU_DIV_8, SPI_SPEED_FCPU_DIV_16,
+	SPI_SPEED_FCPU_DIV_32, SPI_SPEED_FCPU_DIV_64, SPI_SPEED_FCPU_DIV_128,
+};
+
+// Chip select line of the transfer in progress or held, SPI_BRIDGE_NO_CS if none is asserted
+static uint8_t SPIBridge_Line = SPI_BRIDGE_NO_CS;
+static uint8_t SPIBridge_Hold;
+
+static void SPIBridge_Deselect(void)
+{
+	if (SPIBridge_Line != SPI_BRIDGE_NO_CS)
+		SPI_CS_PORT |= (1 << (SPI_CS_SHIFT + SPIBridge_Line));
+	SPIBridge_Line = SPI_BRIDGE_NO_CS;
+}
+
+/** Drives all chip select lines high; the SPI itself stays powered down until the first transfer. */
+void SPIBridge_Init(void)
+{
+	SPI_CS_PORT |= SPI_BRIDGE_ALL_CS;
+	SPI_CS_DDR  |= SPI_BRIDGE_ALL_CS;
+}
+
+/** Sets up the SPI for a transfer with the mode and clock of \c config and asserts chip select \c line, or none for
+ *  \ref SPI_BRIDGE_NO_CS. A line held by the transfer before is released first unless it is the same one.
+ *  @return false if there is no such line, or no bridge at all next to the bit-banged channels
+ */
+bool SPIBridge_Begin(const uint8_t config, const uint8_t line)
+{
+	uint8_t clock = (config & SPI_BRIDGE_CLOCK) >> 2;
+
+	if (SOFTI2C_CHANNELS || ((line != SPI_BRIDGE_NO_CS) && (line >= SPI_CS_LINES)))
+		return false;
+
+	if (line != SPIBridge_Line)
+		SPIBridge_Deselect();
+
+	if (clock >= sizeof(SPIBridge_Clocks))
+		clock = sizeof(SPIBridge_Clocks) - 1;
+
+	power_spi_enable();
+	SPI_Init(SPI_MODE_MASTER | pgm_read_byte(&SPIBridge_Clocks[clock]) |
+	         ((config & 0x02) ? SPI_SCK_LEAD_FALLING : SPI_SCK_LEAD_RISING) |
+	         ((config & 0x01) ? SPI_SAMPLE_TRAILING : SPI_SAMPLE_LEADING) |
+	         ((config & SPI_BRIDGE_LSB_FIRST) ? SPI_ORDER_LSB_FIRST : SPI_ORDER_MSB_FIRST));
+
+	if (line != SPI_BRIDGE_NO_CS)
+		SPI_CS_PORT &= ~(1 << (SPI_CS_SHIFT + line));
+	SPIBridge_Line = line;
+	SPIBridge_Hold = config & SPI_BRIDGE_HOLD_CS;
+	return true;
+}
+
+/** Finishes the transfer set up by \ref SPIBridge_Begin(), releasing its chip select unless it is held. */
+void SPIBridge_End(void)
+{
+	if (!SPIBridge_Hold)
+		SPIBridge_Deselect();
+}
+
+/** Releases a held chip select and powers the SPI down again, handing its pins back to their reset state. */
+void SPIBridge_Stop(void)
+{
+	SPIBridge_Deselect();
+	if (SPCR & (1 << SPE)) {
+		SPI_Disable();
+		power_spi_disable();
+	}
+}
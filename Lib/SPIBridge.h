@@ -0,0 +1,86 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for SPIBridge.c.
+ */
+
+#ifndef _SPI_BRIDGE_H_
+#define _SPI_BRIDGE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+		#include <LUFA/Drivers/Peripheral/SPI.h>
+
+	/* Macros: */
+		/** Bits of the configuration byte of BULK_OP_SPI. */
+		#define SPI_BRIDGE_MODE       0x03      /**< SPI mode 0 to 3, CPOL in bit 1 and CPHA in bit 0 */
+		#define SPI_BRIDGE_CLOCK      (7 << 2)  /**< SCK is F_CPU / 2^(n + 1), n from 0 (8 MHz) to 6 (125 kHz) */
+		#define SPI_BRIDGE_LSB_FIRST  (1 << 5)  /**< Shift out the least significant bit first */
+		#define SPI_BRIDGE_HOLD_CS    (1 << 6)  /**< Leave the chip select asserted for the next transfer */
+
+		/** Chip select argument of BULK_OP_SPI for a transfer that asserts none of the lines. */
+		#define SPI_BRIDGE_NO_CS      0xFF
+
+		/** Mask with a bit set for the pin of every configured chip select line. */
+		#define SPI_BRIDGE_ALL_CS     (((1 << SPI_CS_LINES) - 1) << SPI_CS_SHIFT)
+
+		#if SPI_CS_LINES && SOFTI2C_CHANNELS
+			#error The SPI bridge takes the pins of the bit-banged channels, set SPI_CS_LINES or SOFTI2C_CHANNELS to 0
+		#endif
+
+	/* Inline Functions: */
+		/** Starts shifting out a byte; the one before must have been collected with \ref SPIBridge_Receive(). */
+		static inline void SPIBridge_Send(const uint8_t value) ATTR_ALWAYS_INLINE;
+		static inline void SPIBridge_Send(const uint8_t value)
+		{
+			SPDR = value;
+		}
+
+		/** Waits for the byte started with \ref SPIBridge_Send() and returns the one clocked in meanwhile. */
+		static inline uint8_t SPIBridge_Receive(void) ATTR_ALWAYS_INLINE;
+		static inline uint8_t SPIBridge_Receive(void)
+		{
+			while (!(SPSR & (1 << SPIF)));
+			return SPDR;
+		}
+
+	/* Function Prototypes: */
+		void SPIBridge_Init(void);
+		bool SPIBridge_Begin(const uint8_t config, const uint8_t line);
+		void SPIBridge_End(void);
+		void SPIBridge_Stop(void);
+
+		#if defined(__INCLUDE_FROM_SPIBRIDGE_C)
+			static void SPIBridge_Deselect(void);
+		#endif
+
+#endif
+
@@ -0,0 +1,317 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_SCRIPT_C
+#include "Script.h"
+
+#if SCRIPT_SUPPORT
+
+static uint8_t Script_Ram[SCRIPT_SIZE];
+
+#if SCRIPT_SLOTS
+static uint8_t Script_Slots[SCRIPT_SLOTS][SCRIPT_SIZE] EEMEM;
+#endif
+
+/** Response of the running script, \ref SCRIPT_RESULT_BUFFER bytes from the caller: result code, offset of the
+ *  instruction it stopped at, then the data read.
+ */
+static uint8_t* Script_Result;
+
+// State of the running script; the code of a RAM script can be somewhere else than Script_Ram
+static uint8_t  Script_Slot;
+static const uint8_t* Script_Code;
+static uint16_t Script_PC;
+static uint16_t Script_OpStart;
+static uint8_t  Script_Length;
+static uint8_t  Script_Last;
+static bool     Script_Held;
+
+// Running off the end of the script reads as SCRIPT_OP_END
+static uint8_t Script_Fetch(void)
+{
+	if (Script_PC >= SCRIPT_SIZE)
+		return SCRIPT_OP_END;
+
+	const uint16_t pc = Script_PC++;
+
+	#if SCRIPT_SLOTS
+	if (Script_Slot != SCRIPT_SLOT_RAM)
+		return eeprom_read_byte(&Script_Slots[Script_Slot][pc]);
+	#endif
+
+	return Script_Code[pc];
+}
+
+// The bus helpers return SCRIPT_STATUS_DONE to carry on, anything else ends the script
+static uint8_t Script_Start(const uint8_t address)
+{
+	// Don't cut short the STOP of the previous transaction
+	if (!Script_Held)
+		TWIBus_WaitStop();
+
+	TWIEngine_Start(address);
+	const uint8_t result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+	if (result == TWI_ERROR_NoError) {
+		Script_Held = true;
+		return SCRIPT_STATUS_DONE;
+	}
+
+	// A NACKed address has already been followed by a STOP from the engine
+	if (result == TWI_ERROR_SlaveNotReady) {
+		Script_Held = false;
+		return SCRIPT_STATUS_NAK;
+	}
+
+	return SCRIPT_STATUS_BUS_ERROR;
+}
+
+static uint8_t Script_Write(uint8_t count)
+{
+	if (!Script_Held)
+		return SCRIPT_STATUS_BAD_OP;
+	if (!count)
+		return SCRIPT_STATUS_DONE;
+
+	TWIEngine_Write(count);
+	while (count--) {
+		const uint8_t value = Script_Fetch();
+
+		// If the engine gave up on a bus fault or a stuck clock, the rest is dropped
+		if (TWIEngine_WaitFor(TWI_EVENT_TxSpace) && TWIEngine_IsBusy()) {
+			RingBuffer_Insert(&TWIEngine_TxRing, value);
+			TWIEngine_Kick();
+		}
+	}
+	TWIEngine_WaitFor(TWI_EVENT_Idle);
+
+	if (TWIEngine.Result == TWI_ERROR_NoError)
+		return SCRIPT_STATUS_DONE;
+	return (TWIEngine.Result == TWI_ERROR_SlaveNAK) ? SCRIPT_STATUS_NAK : SCRIPT_STATUS_BUS_ERROR;
+}
+
+// Every byte read becomes the one SCRIPT_OP_LOOP_UNTIL tests; keep puts it into the response as well, as far as
+// there is room
+static uint8_t Script_Read(uint8_t count, const bool keep)
+{
+	if (!Script_Held)
+		return SCRIPT_STATUS_BAD_OP;
+	if (!count)
+		return SCRIPT_STATUS_DONE;
+
+	TWIEngine_Read(count, true);
+	while (count--) {
+		uint8_t value = 0;
+
+		// If the engine gave up on a bus fault or a stuck clock, the rest reads as zeros
+		if (TWIEngine_WaitFor(TWI_EVENT_RxData) && !RingBuffer_IsEmpty(&TWIEngine_RxRing)) {
+			value = RingBuffer_Remove(&TWIEngine_RxRing);
+			TWIEngine_Kick();
+		}
+
+		Script_Last = value;
+		if (keep && (Script_Length < SCRIPT_RESULT_SIZE))
+			Script_Result[SCRIPT_RESULT_HEADER + Script_Length++] = value;
+	}
+
+	return (TWIEngine.Result == TWI_ENGINE_ERROR_StretchTimeout) ? SCRIPT_STATUS_BUS_ERROR : SCRIPT_STATUS_DONE;
+}
+
+static void Script_Stop(void)
+{
+	if (Script_Held) {
+		TWIBus_Stop();
+		TWIBus_WaitStop();
+		Script_Held = false;
+	}
+}
+
+static uint8_t Script_Execute(const uint16_t timeout_ms)
+{
+	const uint16_t started = Timebase_GetFrame();
+	uint8_t loops = 0;
+
+	for (;;) {
+		if ((uint16_t)(Timebase_GetFrame() - started) > timeout_ms)
+			return SCRIPT_STATUS_TIMEOUT;
+
+		uint8_t status = SCRIPT_STATUS_DONE;
+
+		Script_OpStart = Script_PC;
+		switch (Script_Fetch()) {
+			case SCRIPT_OP_END:
+				return SCRIPT_STATUS_DONE;
+
+			case SCRIPT_OP_START:
+				status = Script_Start(Script_Fetch());
+				break;
+
+			case SCRIPT_OP_WRITE:
+				status = Script_Write(Script_Fetch());
+				break;
+
+			case SCRIPT_OP_READ:
+				status = Script_Read(Script_Fetch(), true);
+				break;
+
+			case SCRIPT_OP_CHECK:
+				status = Script_Read(Script_Fetch(), false);
+				break;
+
+			case SCRIPT_OP_STOP:
+				Script_Stop();
+				break;
+
+			case SCRIPT_OP_WAIT_US:
+			{
+				uint16_t us = Script_Fetch();
+				us |= (Script_Fetch() << 8);
+
+				const uint16_t ticks = Timebase_UsToTicks(us);
+				const uint16_t wait_start = Timebase_Now();
+				while (Timebase_Elapsed(wait_start) < ticks);
+			}
+			break;
+
+			case SCRIPT_OP_LOOP_UNTIL:
+			{
+				const uint8_t mask   = Script_Fetch();
+				const uint8_t value  = Script_Fetch();
+				const uint8_t target = Script_Fetch();
+				const uint8_t limit  = Script_Fetch();
+
+				// There is a single iteration counter, so loops don't nest; a limit of 0 leaves it to the time limit
+				if ((Script_Last & mask) == value) {
+					loops = 0;
+				} else if (limit && (++loops >= limit)) {
+					status = SCRIPT_STATUS_LOOP_LIMIT;
+				} else {
+					Script_PC = target;
+				}
+			}
+			break;
+
+			case SCRIPT_OP_JUMP:
+				Script_PC = Script_Fetch();
+				break;
+
+			default:
+				status = SCRIPT_STATUS_BAD_OP;
+				break;
+		}
+
+		if (status != SCRIPT_STATUS_DONE)
+			return status;
+	}
+}
+
+/** Checks a slot number from a request: \ref SCRIPT_SLOT_RAM or one of the SCRIPT_SLOTS EEPROM slots. */
+bool Script_IsValidSlot(const uint8_t slot)
+{
+	return (slot == SCRIPT_SLOT_RAM) || (slot < SCRIPT_SLOTS);
+}
+
+/** Reads a script of up to \ref SCRIPT_SIZE bytes from the data stage of the current control request into a slot,
+ *  leaving the status stage to the caller. The RAM slot is quick; an EEPROM slot takes about 3.4 ms for every byte
+ *  that changes, so it must not be filled from the USB interrupt.
+ */
+void Script_Receive(const uint8_t slot, uint16_t length)
+{
+	if (slot == SCRIPT_SLOT_RAM) {
+		memset(Script_Ram, SCRIPT_OP_END, sizeof(Script_Ram));
+		Endpoint_Read_Control_Stream_LE(Script_Ram, length);
+		return;
+	}
+
+	#if SCRIPT_SLOTS
+	uint8_t* dest = Script_Slots[slot];
+	const bool short_script = (length < SCRIPT_SIZE);
+
+	// Byte by byte as they come in, the host is NAKed while the EEPROM is busy
+	while (length) {
+		Watchdog_Kick();
+		if ((USB_DeviceState == DEVICE_STATE_Unattached) || Endpoint_IsSETUPReceived())
+			return;
+
+		if (Endpoint_IsOUTReceived()) {
+			while (length && Endpoint_BytesInEndpoint()) {
+				eeprom_update_byte(dest++, Endpoint_Read_8());
+				length--;
+				Watchdog_Kick();
+			}
+			Endpoint_ClearOUT();
+		}
+	}
+
+	if (short_script)
+		eeprom_update_byte(dest, SCRIPT_OP_END);
+	#endif
+}
+
+static uint8_t Script_Launch(const uint16_t timeout_ms, uint8_t* const result)
+{
+	Script_Result = result;
+	Script_PC     = 0;
+	Script_Length = 0;
+	Script_Last   = 0;
+	Script_Held   = false;
+
+	const uint8_t status = Script_Execute(timeout_ms ? timeout_ms : SCRIPT_TIMEOUT_MS);
+
+	if (TWIEngine_IsBusy())
+		TWIEngine_Cancel();
+	Script_Stop();
+
+	Script_Result[0] = status;
+	Script_Result[1] = Script_OpStart;
+	return SCRIPT_RESULT_HEADER + Script_Length;
+}
+
+/** Runs the script in a slot on the TWI bus, which the caller has claimed. The script ends with a STOP in any
+ *  case and gives up once it has run for longer than timeout_ms, 0 for \ref SCRIPT_TIMEOUT_MS. The response goes
+ *  to result, which has room for \ref SCRIPT_RESULT_BUFFER bytes.
+ *  @return Length of the response
+ */
+uint8_t Script_Run(const uint8_t slot, const uint16_t timeout_ms, uint8_t* const result)
+{
+	Script_Slot = slot;
+	Script_Code = Script_Ram;
+	return Script_Launch(timeout_ms, result);
+}
+
+/** Runs a script the firmware built itself, from a buffer of \ref SCRIPT_SIZE bytes, like \ref Script_Run().
+ *  The RAM slot the host loads is left alone.
+ */
+uint8_t Script_RunCode(const uint8_t* const code, const uint16_t timeout_ms, uint8_t* const result)
+{
+	Script_Slot = SCRIPT_SLOT_RAM;
+	Script_Code = code;
+	return Script_Launch(timeout_ms, result);
+}
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for Script.c.
+ */
+
+#ifndef _SCRIPT_H_
+#define _SCRIPT_H_
+
+	/* Includes: */
+		#include <avr/eeprom.h>
+
+		#include "../i2c-tiny-usb.h"
+		#include "TWIEngine.h"
+		#include "Timebase.h"
+
+	/* Macros: */
+		/** Script opcodes. Each instruction is one opcode byte followed by its arguments, offsets are from the
+		 *  start of the script.
+		 */
+		#define SCRIPT_OP_END         0x00 /**< Ends the script, sending a STOP if the bus is still held */
+		#define SCRIPT_OP_START       0x01 /**< (Repeated) START, arg: 8-bit address byte */
+		#define SCRIPT_OP_WRITE       0x02 /**< Write, args: count + data */
+		#define SCRIPT_OP_READ        0x03 /**< Read and NACK the last byte, arg: count; the data goes to the response */
+		#define SCRIPT_OP_STOP        0x04 /**< STOP, releases the bus */
+		#define SCRIPT_OP_WAIT_US     0x05 /**< Busy wait, arg: 16-bit time in microseconds */
+		#define SCRIPT_OP_LOOP_UNTIL  0x06 /**< args: mask, value, offset, limit; jumps to offset until the last byte read ANDed with mask equals value */
+		#define SCRIPT_OP_JUMP        0x07 /**< Jump, arg: offset */
+		#define SCRIPT_OP_CHECK       0x08 /**< Read like SCRIPT_OP_READ, but keep the data out of the response */
+
+		/** Script result codes, the first byte of the CMD_RUN_SCRIPT response. */
+		#define SCRIPT_STATUS_DONE       0 /**< Ran to the end */
+		#define SCRIPT_STATUS_NAK        1 /**< A START was NACKed, or a byte written */
+		#define SCRIPT_STATUS_BUS_ERROR  2 /**< The bus could not be captured, or the target held the clock for too long */
+		#define SCRIPT_STATUS_LOOP_LIMIT 3 /**< A loop ran out of iterations */
+		#define SCRIPT_STATUS_TIMEOUT    4 /**< The script ran out of time */
+		#define SCRIPT_STATUS_BAD_OP     5 /**< Unknown opcode, or a transfer outside START and STOP */
+		#define SCRIPT_STATUS_BUS_BUSY   6 /**< Another path was in the middle of a transaction, the script didn't run */
+
+		/** Slot number of the RAM script, the EEPROM slots are numbered from 0. */
+		#define SCRIPT_SLOT_RAM       0xFF
+
+		/** Size of the response header: result code and the offset the script stopped at. */
+		#define SCRIPT_RESULT_HEADER  2
+
+		/** Size of a result buffer for \ref Script_Run(): header plus the bytes read. */
+		#define SCRIPT_RESULT_BUFFER  (SCRIPT_RESULT_HEADER + SCRIPT_RESULT_SIZE)
+
+		#if SCRIPT_SUPPORT && (ARENA_SIZE < SCRIPT_RESULT_BUFFER)
+			#error ARENA_SIZE has no room for a script result
+		#endif
+
+		/** Time limit for a script run if the request doesn't give one, in milliseconds. */
+		#define SCRIPT_TIMEOUT_MS     100
+
+	/* Function Prototypes: */
+		#if SCRIPT_SUPPORT
+			bool Script_IsValidSlot(const uint8_t slot);
+			void Script_Receive(const uint8_t slot, uint16_t length);
+			uint8_t Script_Run(const uint8_t slot, const uint16_t timeout_ms, uint8_t* const result);
+			uint8_t Script_RunCode(const uint8_t* const code, const uint16_t timeout_ms, uint8_t* const result);
+		#endif
+
+		#if defined(__INCLUDE_FROM_SCRIPT_C) && SCRIPT_SUPPORT
+			static uint8_t Script_Fetch(void);
+			static uint8_t Script_Start(const uint8_t address);
+			static uint8_t Script_Write(uint8_t count);
+			static uint8_t Script_Read(uint8_t count, const bool keep);
+			static void Script_Stop(void);
+			static uint8_t Script_Execute(const uint16_t timeout_ms);
+			static uint8_t Script_Launch(const uint16_t timeout_ms, uint8_t* const result);
+		#endif
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_SETTINGS_C
+#include "Settings.h"
+
+static Settings_Image_t Settings_Image EEMEM;
+
+// Covers everything from the size to the CRC, the version byte marks the image valid once the rest is in place
+static uint8_t Settings_Crc(void)
+{
+	const uint8_t* data = (const uint8_t*)&Settings_Image;
+	uint8_t crc = 0;
+
+	for (uint16_t i = offsetof(Settings_Image_t, Size); i < offsetof(Settings_Image_t, Crc); i++)
+		crc = CRC8_Update(crc, eeprom_read_byte(data + i));
+
+	return crc;
+}
+
+// Blank EEPROM reads as 0xFF, which is never a valid version
+static bool Settings_IsValid(void)
+{
+	return (eeprom_read_byte(&Settings_Image.Version) == SETTINGS_VERSION) &&
+	       (eeprom_read_word(&Settings_Image.Size) == sizeof(Settings_Image_t)) &&
+	       (eeprom_read_byte(&Settings_Image.Crc) == Settings_Crc());
+}
+
+// eeprom_update_block() with the watchdog kicked per byte, as rewriting the whole image takes seconds
+static void Settings_Update(const void* const source, void* const dest, const uint16_t size)
+{
+	const uint8_t* from = source;
+	uint8_t* to         = dest;
+
+	for (uint16_t i = 0; i < size; i++) {
+		eeprom_update_byte(to++, *from++);
+		Watchdog_Kick();
+	}
+}
+
+/** Brings back the given parts of the stored settings, see SETTINGS_BUS and SETTINGS_POLL. The bus settings are
+ *  loaded once at power-up, the polling job whenever the host configures the device.
+ *  @return false if there are no valid settings stored, nothing is changed then
+ */
+bool Settings_Load(const uint8_t parts)
+{
+	if (!Settings_IsValid())
+		return false;
+
+	if (parts & SETTINGS_BUS) {
+		uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+		GlobalInterruptDisable();
+
+		I2C_Speed = eeprom_read_dword(&Settings_Image.Speed);
+		eeprom_read_block(&TargetConfig_Default, &Settings_Image.Default, sizeof(TargetConfig_Default));
+		eeprom_read_block(TargetConfig_Table, Settings_Image.Targets, sizeof(Settings_Image.Targets));
+#if SPEED_ADAPT_SUPPORT
+		SpeedAdapt_SetPolicy(eeprom_read_byte(&Settings_Image.Adapt.StepDownErrors),
+		                     eeprom_read_word(&Settings_Image.Adapt.StepUpClean));
+#endif
+		TWI_Init(TargetConfig_Default.Prescaler, TargetConfig_Default.BitRate);
+
+		SetGlobalInterruptMask(CurrentGlobalInt);
+	}
+
+	if (parts & SETTINGS_POLL) {
+		const uint8_t flags = eeprom_read_byte(&Settings_Image.PollCount);
+		const uint8_t count = flags & ~POLL_COMPACT;
+		uint8_t added = 0;
+
+		Poll_Clear();
+		Poll_SetCompact(flags & POLL_COMPACT);
+		for (uint8_t i = 0; (i < count) && (i < POLL_MAX_ENTRIES); i++) {
+			Poll_Entry_t entry;
+
+			eeprom_read_block(&entry, &Settings_Image.Poll[i], sizeof(entry));
+			if (Poll_AddEntry(entry.Address, entry.Register, entry.Length, entry.Period)) {
+				Poll_SetFilter(added, &entry.Filter);
+				Poll_SetReduce(added++, &entry.Reduce);
+			}
+		}
+	}
+
+	return true;
+}
+
+/** Tells whether valid settings are stored, and their CRC, which lets a host recognise settings it stored itself. */
+bool Settings_Stored(uint8_t* const crc)
+{
+	*crc = Settings_Crc();
+	return Settings_IsValid();
+}
+
+/** Stores the current bus, per-target and polling settings, or erases them. Only bytes that change are written,
+ *  at about 3.4 ms each, so this must not run from an interrupt. The version byte is written last, so settings
+ *  cut short by a power loss are ignored rather than loaded half way.
+ */
+void Settings_Save(const uint8_t action)
+{
+	eeprom_update_byte(&Settings_Image.Version, 0xFF);
+	if (action != SETTINGS_SAVE)
+		return;
+
+	uint8_t count = 0;
+	const Poll_Entry_t* entry;
+	while ((entry = Poll_GetEntry(count)) != NULL)
+		Settings_Update(entry, &Settings_Image.Poll[count++], sizeof(*entry));
+
+	eeprom_update_word(&Settings_Image.Size, sizeof(Settings_Image_t));
+	eeprom_update_dword(&Settings_Image.Speed, I2C_Speed);
+	Settings_Update(&TargetConfig_Default, &Settings_Image.Default, sizeof(TargetConfig_Default));
+	Settings_Update(TargetConfig_Table, Settings_Image.Targets, sizeof(Settings_Image.Targets));
+#if SPEED_ADAPT_SUPPORT
+	Settings_Update(&SpeedAdapt_Policy, &Settings_Image.Adapt, sizeof(SpeedAdapt_Policy));
+#endif
+	eeprom_update_byte(&Settings_Image.PollCount, count | (Poll_IsCompact() ? POLL_COMPACT : 0));
+	eeprom_update_byte(&Settings_Image.Crc, Settings_Crc());
+	eeprom_update_byte(&Settings_Image.Version, SETTINGS_VERSION);
+}
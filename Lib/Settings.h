@@ -0,0 +1,85 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for Settings.c.
+ */
+
+#ifndef _SETTINGS_H_
+#define _SETTINGS_H_
+
+	/* Includes: */
+		#include <avr/eeprom.h>
+
+		#include "../i2c-tiny-usb.h"
+		#include "TargetConfig.h"
+		#include "SpeedAdapt.h"
+		#include "PollEngine.h"
+		#include "CRC8.h"
+		#include "Watchdog.h"
+
+	/* Macros: */
+		/** Layout version of the settings image, bump whenever \ref Settings_Image_t changes. */
+		#define SETTINGS_VERSION      4
+
+		/** Parts of the stored settings for \ref Settings_Load(). */
+		#define SETTINGS_BUS          (1 << 0) /**< Default bus speed, timeouts and retries, per-target settings, adaptive speed */
+		#define SETTINGS_POLL         (1 << 1) /**< Polling job */
+
+		/** CMD_SAVE_SETTINGS actions in wValue. */
+		#define SETTINGS_ERASE        0 /**< Forget the stored settings, the next power-up starts with the defaults */
+		#define SETTINGS_SAVE         1 /**< Store the current settings */
+
+	/* Type Defines: */
+		/** Type define for the settings image in EEPROM. */
+		typedef struct
+		{
+			uint8_t        Version;                        /**< \ref SETTINGS_VERSION, anything else is ignored */
+			uint16_t       Size;                           /**< Size of the image, catches builds with other table sizes */
+			uint32_t       Speed;                          /**< Default bus speed in Hz as reported by CMD_GET_BAUDRATE */
+			TargetConfig_t Default;                        /**< Settings for targets without an entry */
+			TargetConfig_t Targets[TARGET_CONFIG_ENTRIES]; /**< Per-target settings */
+			SpeedAdapt_Policy_t Adapt;                     /**< Adaptive speed policy */
+			uint8_t        PollCount;                      /**< Number of polling job entries, ORed with POLL_COMPACT */
+			Poll_Entry_t   Poll[POLL_MAX_ENTRIES];         /**< Polling job */
+			uint8_t        Crc;                            /**< SMBus CRC-8 over all of the above but the version */
+		} Settings_Image_t;
+
+	/* Function Prototypes: */
+		bool Settings_Load(const uint8_t parts);
+		void Settings_Save(const uint8_t action);
+		bool Settings_Stored(uint8_t* const crc);
+
+		#if defined(__INCLUDE_FROM_SETTINGS_C)
+			static uint8_t Settings_Crc(void);
+			static bool Settings_IsValid(void);
+			static void Settings_Update(const void* const source, void* const dest, const uint16_t size);
+		#endif
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Bit-banged I2C masters on spare GPIOs, for rigs with more buses than the
+ * one TWI peripheral. Channel n uses pin 2n of SOFTI2C_PORT as SCL and pin
+ * 2n+1 as SDA, both open drain (the pin is driven low or left floating, so
+ * external pull-ups are needed). All operations take a channel mask and run
+ * the same transaction on all selected channels in lockstep, sampling every
+ * channel's SDA line with a single port read.
+ *
+ * Only the bulk protocol drives these channels, from the main loop, so the
+ * non-atomic port updates never race with an interrupt.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_SOFTI2C_C
+#include "SoftI2C.h"
+
+/** Last byte read on each channel, indexed by channel number. */
+uint8_t SoftI2C_Data[SOFTI2C_CHANNELS ? SOFTI2C_CHANNELS : 1];
+
+// Port pins belonging to the given channels, shift 0 for SCL and 1 for SDA
+static uint8_t SoftI2C_Pins(const uint8_t channels, const uint8_t shift)
+{
+	uint8_t pins = 0;
+
+	for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+		if (channels & (1 << i))
+			pins |= 1 << ((i << 1) + shift);
+
+	return pins;
+}
+
+// Channel mask of the channels whose SDA pin is set in the given port value
+static uint8_t SoftI2C_Channels(const uint8_t pins)
+{
+	uint8_t channels = 0;
+
+	for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+		if (pins & (1 << ((i << 1) + 1)))
+			channels |= 1 << i;
+
+	return channels;
+}
+
+// Busy-waits a compile time constant number of cycles, exactly
+static inline void SoftI2C_Delay(const uint16_t cycles)
+{
+	if (cycles)
+		__builtin_avr_delay_cycles(cycles);
+}
+
+// Release SCL and wait until all targets have stopped stretching it. A target holding the clock for longer
+// than the default stretch timeout is left behind; its transaction will be garbage, but the other channels keep going.
+// The timebase is only read once a target does stretch, so the clock high time stays what the cycle count says.
+static inline void SoftI2C_ClockHigh(const uint8_t scl)
+{
+	SOFTI2C_DDR &= ~scl;
+	if ((SOFTI2C_PIN & scl) != scl) {
+		const uint16_t started = Timebase_Now();
+
+		while (((SOFTI2C_PIN & scl) != scl) && (Timebase_Elapsed(started) < Timebase_MsToTicks(TargetConfig_Default.StretchTimeoutMs)));
+	}
+	SoftI2C_Delay(SOFTI2C_DELAY(SOFTI2C_HIGH_CYCLES, SOFTI2C_HIGH_OVERHEAD));
+}
+
+static inline void SoftI2C_SetSDA(const uint8_t sda, const uint8_t high)
+{
+	if (high)
+		SOFTI2C_DDR &= ~sda;
+	else
+		SOFTI2C_DDR |= sda;
+	SoftI2C_Delay(SOFTI2C_DELAY(SOFTI2C_LOW_CYCLES, SOFTI2C_LOW_OVERHEAD));
+}
+
+// One clock pulse with SDA already set up; returns the SDA pins as sampled while SCL was high
+static inline uint8_t SoftI2C_Clock(const uint8_t scl, const uint8_t sda)
+{
+	SoftI2C_ClockHigh(scl);
+	const uint8_t sampled = SOFTI2C_PIN & sda;
+	SOFTI2C_DDR |= scl;
+	return sampled;
+}
+
+/** Releases all channel pins. The port bits stay 0, so setting a DDR bit pulls the line low. */
+void SoftI2C_Init(void)
+{
+	const uint8_t pins = SoftI2C_Pins(SOFTI2C_ALL_CHANNELS, 0) | SoftI2C_Pins(SOFTI2C_ALL_CHANNELS, 1);
+
+	SOFTI2C_DDR  &= ~pins;
+	SOFTI2C_PORT &= ~pins;
+}
+
+/** Sends a (repeated) START and the address byte on all given channels.
+ *  @return Mask of the channels whose target ACKed
+ */
+uint8_t SoftI2C_Start(const uint8_t channels, const uint8_t address)
+{
+	const uint8_t scl = SoftI2C_Pins(channels, 0);
+	const uint8_t sda = SoftI2C_Pins(channels, 1);
+
+	// After a previous byte SCL is low, so get both lines up without making it look like a STOP
+	SoftI2C_SetSDA(sda, true);
+	SoftI2C_ClockHigh(scl);
+	SoftI2C_SetSDA(sda, false);
+	SOFTI2C_DDR |= scl;
+
+	return SoftI2C_Write(channels, address);
+}
+
+/** Shifts out one byte on all given channels.
+ *  @return Mask of the channels whose target ACKed
+ */
+uint8_t SoftI2C_Write(const uint8_t channels, const uint8_t value)
+{
+	const uint8_t scl = SoftI2C_Pins(channels, 0);
+	const uint8_t sda = SoftI2C_Pins(channels, 1);
+
+	for (uint8_t bit = 0x80; bit; bit >>= 1) {
+		SoftI2C_SetSDA(sda, value & bit);
+		SoftI2C_Clock(scl, sda);
+	}
+
+	SoftI2C_SetSDA(sda, true);
+	return channels & ~SoftI2C_Channels(SoftI2C_Clock(scl, sda));
+}
+
+/** Clocks in one byte on all given channels into \ref SoftI2C_Data.
+ *  @param nack Respond with NACK instead of ACK, for the last byte of a read
+ */
+void SoftI2C_Read(const uint8_t channels, const uint8_t nack)
+{
+	const uint8_t scl = SoftI2C_Pins(channels, 0);
+	const uint8_t sda = SoftI2C_Pins(channels, 1);
+	uint8_t samples[8];
+
+	// Only store the port samples while clocking, sorting them into bytes would stretch every low phase
+	SoftI2C_SetSDA(sda, true);
+	for (uint8_t i = 0; i < 8; i++) {
+		samples[i] = SoftI2C_Clock(scl, sda);
+		SoftI2C_Delay(SOFTI2C_DELAY(SOFTI2C_LOW_CYCLES, SOFTI2C_READ_OVERHEAD));
+	}
+
+	SoftI2C_SetSDA(sda, nack);
+	SoftI2C_Clock(scl, sda);
+	SoftI2C_SetSDA(sda, true);
+
+	for (uint8_t i = 0; i < SOFTI2C_CHANNELS; i++)
+		SoftI2C_Data[i] = 0;
+	for (uint8_t i = 0; i < 8; i++) {
+		const uint8_t high = SoftI2C_Channels(samples[i]);
+		for (uint8_t j = 0; j < SOFTI2C_CHANNELS; j++)
+			if (high & (1 << j))
+				SoftI2C_Data[j] |= 0x80 >> i;
+	}
+}
+
+/** Sends a STOP on all given channels, leaving both lines released. */
+void SoftI2C_Stop(const uint8_t channels)
+{
+	const uint8_t scl = SoftI2C_Pins(channels, 0);
+	const uint8_t sda = SoftI2C_Pins(channels, 1);
+
+	SoftI2C_SetSDA(sda, false);
+	SoftI2C_ClockHigh(scl);
+	SoftI2C_SetSDA(sda, true);
+}
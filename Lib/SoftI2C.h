@@ -0,0 +1,90 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for SoftI2C.c.
+ */
+
+#ifndef _SOFT_I2C_H_
+#define _SOFT_I2C_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+		#include "TargetConfig.h"
+
+	/* Macros: */
+		/** Mask with a bit set for every configured bit-banged channel. */
+		#define SOFTI2C_ALL_CHANNELS  ((1 << SOFTI2C_CHANNELS) - 1)
+
+		/** CPU cycles per bit at \ref SOFTI2C_KHZ, of which SCL is high for 2/5. That split meets the minimum SCL
+		 *  high and low times of both standard mode (4.0 / 4.7 us) and fast mode (0.6 / 1.3 us).
+		 */
+		#define SOFTI2C_BIT_CYCLES    ((F_CPU + SOFTI2C_KHZ * 1000UL - 1) / (SOFTI2C_KHZ * 1000UL))
+		#define SOFTI2C_HIGH_CYCLES   (SOFTI2C_BIT_CYCLES * 2 / 5)
+		#define SOFTI2C_LOW_CYCLES    (SOFTI2C_BIT_CYCLES - SOFTI2C_HIGH_CYCLES)
+
+		/** Instruction cycles each half of a bit takes without any delay, counted off the -Os code with the pin
+		 *  helpers inlined. SCL high spans the stretch check, the SDA sample and pulling SCL low again; SCL low spans
+		 *  the loop step, setting SDA (storing the sample for a read) and releasing SCL.
+		 */
+		#define SOFTI2C_HIGH_OVERHEAD  9
+		#define SOFTI2C_LOW_OVERHEAD   15
+		#define SOFTI2C_READ_OVERHEAD  8
+
+		/** Cycles left to busy-wait for a phase of the given length, none if the code alone takes longer. */
+		#define SOFTI2C_DELAY(cycles, overhead)  (((cycles) > (overhead)) ? ((cycles) - (overhead)) : 0)
+
+		#if SOFTI2C_CHANNELS && (SOFTI2C_KHZ != 100) && (SOFTI2C_KHZ != 400)
+			#error SOFTI2C_KHZ must be 100 or 400
+		#endif
+		#if SOFTI2C_CHANNELS && ((SOFTI2C_HIGH_CYCLES < SOFTI2C_HIGH_OVERHEAD) || (SOFTI2C_LOW_CYCLES < SOFTI2C_READ_OVERHEAD))
+			#error F_CPU is too slow for SOFTI2C_KHZ
+		#endif
+
+	/* External Variables: */
+		extern uint8_t SoftI2C_Data[];
+
+	/* Function Prototypes: */
+		void SoftI2C_Init(void);
+		uint8_t SoftI2C_Start(const uint8_t channels, const uint8_t address);
+		uint8_t SoftI2C_Write(const uint8_t channels, const uint8_t value);
+		void SoftI2C_Read(const uint8_t channels, const uint8_t nack);
+		void SoftI2C_Stop(const uint8_t channels);
+
+		#if defined(__INCLUDE_FROM_SOFTI2C_C)
+			static uint8_t SoftI2C_Pins(const uint8_t channels, const uint8_t shift);
+			static uint8_t SoftI2C_Channels(const uint8_t pins);
+			static inline void SoftI2C_Delay(const uint16_t cycles) ATTR_ALWAYS_INLINE;
+			static inline void SoftI2C_ClockHigh(const uint8_t scl) ATTR_ALWAYS_INLINE;
+			static inline void SoftI2C_SetSDA(const uint8_t sda, const uint8_t high) ATTR_ALWAYS_INLINE;
+			static inline uint8_t SoftI2C_Clock(const uint8_t scl, const uint8_t sda) ATTR_ALWAYS_INLINE;
+		#endif
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Adaptive bus speed: after a number of faulted transactions in a row, every START is held to the next slower
+ *  limit below the speed it would otherwise run at, and after a number of clean ones the next faster limit is
+ *  tried again. A clean transaction is one whose address was ACKed and that had no fault until the next START;
+ *  NACKed addresses count neither way, they say nothing about the wiring. The limit applies to all targets,
+ *  since it is the bus that is marginal, and per-target speeds below it are left alone.
+ */
+
+#define  __INCLUDE_FROM_SPEEDADAPT_C
+#include "SpeedAdapt.h"
+#include "Stats.h"
+#include "Trace.h"
+
+#if SPEED_ADAPT_SUPPORT
+
+/** Policy set by CMD_SET_ADAPT, off after reset unless the stored settings turn it on. */
+SpeedAdapt_Policy_t SpeedAdapt_Policy;
+
+/** What happened on the bus since the last START. */
+volatile uint8_t SpeedAdapt_Outcome;
+
+static const uint16_t PROGMEM SpeedAdapt_KHz[SPEED_ADAPT_LEVELS] = {800, 600, 400, 300, 200, 100, 50};
+
+static const uint8_t PROGMEM SpeedAdapt_BitRates[SPEED_ADAPT_LEVELS] =
+{
+	SPEED_ADAPT_TWBR(800), SPEED_ADAPT_TWBR(600), SPEED_ADAPT_TWBR(400), SPEED_ADAPT_TWBR(300),
+	SPEED_ADAPT_TWBR(200), SPEED_ADAPT_TWBR(100), SPEED_ADAPT_TWBR(50),
+};
+
+// Current limit, 0 for none and otherwise one more than its index into the tables above
+static uint8_t SpeedAdapt_Level;
+
+// Faulted and clean transactions in a row
+static uint8_t SpeedAdapt_Errors;
+static uint16_t SpeedAdapt_Clean;
+
+// SCL period of a limit in CPU cycles, as compared to 16 + TWBR * 2 * 4^prescaler
+static uint16_t SpeedAdapt_Period(const uint8_t level)
+{
+	return 16 + 2 * pgm_read_byte(&SpeedAdapt_BitRates[level - 1]);
+}
+
+// Go to the fastest limit that is still slower than what the bus runs at now
+static void SpeedAdapt_StepDown(const uint16_t requested)
+{
+	uint16_t current = requested;
+
+	if (SpeedAdapt_Level && (SpeedAdapt_Period(SpeedAdapt_Level) > current))
+		current = SpeedAdapt_Period(SpeedAdapt_Level);
+
+	for (uint8_t level = SpeedAdapt_Level + 1; level <= SPEED_ADAPT_LEVELS; level++) {
+		if (SpeedAdapt_Period(level) > current) {
+			SpeedAdapt_Level = level;
+			Stats_Count(&Stats.SpeedStepDowns);
+			Trace_Add(TRACE_SPEED, level);
+			return;
+		}
+	}
+}
+
+// Go to the next faster limit, or drop the limit once it would no longer slow down the target at hand
+static void SpeedAdapt_StepUp(const uint16_t requested)
+{
+	uint8_t level = SpeedAdapt_Level - 1;
+
+	if (level && (SpeedAdapt_Period(level) <= requested))
+		level = 0;
+
+	SpeedAdapt_Level = level;
+	Stats_Count(&Stats.SpeedStepUps);
+	Trace_Add(TRACE_SPEED, level);
+}
+
+/** Sets the policy, 0 step-down errors turning it off; either way the bus goes back to the configured speeds. */
+void SpeedAdapt_SetPolicy(const uint8_t step_down_errors, const uint16_t step_up_clean)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	SpeedAdapt_Policy.StepDownErrors = step_down_errors;
+	SpeedAdapt_Policy.StepUpClean    = step_up_clean ? step_up_clean : 1;
+	SpeedAdapt_Level   = 0;
+	SpeedAdapt_Errors  = 0;
+	SpeedAdapt_Clean   = 0;
+	SpeedAdapt_Outcome = 0;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Accounts for the transaction since the last START and limits the speed the next one is about to run at, given
+ *  as TWSR prescaler bits and TWBR value. Called by \ref TargetConfig_Apply() with interrupts disabled.
+ */
+void SpeedAdapt_Apply(uint8_t* const prescaler, uint8_t* const bit_rate)
+{
+	if (!SpeedAdapt_Policy.StepDownErrors)
+		return;
+
+	const uint16_t requested = 16 + (uint16_t)*bit_rate * (2 << (*prescaler << 1));
+	const uint8_t outcome    = SpeedAdapt_Outcome;
+	SpeedAdapt_Outcome = 0;
+
+	if (outcome & SPEED_ADAPT_FAULTED) {
+		SpeedAdapt_Clean = 0;
+		if (++SpeedAdapt_Errors >= SpeedAdapt_Policy.StepDownErrors) {
+			SpeedAdapt_Errors = 0;
+			SpeedAdapt_StepDown(requested);
+		}
+	} else if (outcome & SPEED_ADAPT_ACKED) {
+		SpeedAdapt_Errors = 0;
+		if (SpeedAdapt_Level && (++SpeedAdapt_Clean >= SpeedAdapt_Policy.StepUpClean)) {
+			SpeedAdapt_Clean = 0;
+			SpeedAdapt_StepUp(requested);
+		}
+	}
+
+	if (SpeedAdapt_Level && (SpeedAdapt_Period(SpeedAdapt_Level) > requested)) {
+		*prescaler = 0;
+		*bit_rate  = pgm_read_byte(&SpeedAdapt_BitRates[SpeedAdapt_Level - 1]);
+	}
+}
+
+/** Returns the current speed limit in kHz, 0 if there is none. */
+uint16_t SpeedAdapt_LimitKHz(void)
+{
+	const uint8_t level = SpeedAdapt_Level;
+
+	return level ? pgm_read_word(&SpeedAdapt_KHz[level - 1]) : 0;
+}
+
+#endif
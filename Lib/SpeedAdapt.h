@@ -0,0 +1,108 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for SpeedAdapt.c.
+ */
+
+#ifndef _SPEED_ADAPT_H_
+#define _SPEED_ADAPT_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+		#include <avr/pgmspace.h>
+
+	/* Macros: */
+		/** Number of speed limits the policy steps down through, from 800 kHz to 50 kHz. */
+		#define SPEED_ADAPT_LEVELS     7
+
+		/** TWBR value with the prescaler off for a speed of at most \c khz. */
+		#define SPEED_ADAPT_TWBR(khz)  (((F_CPU / 1000 / (khz)) > 16) ? ((F_CPU / 1000 / (khz)) - 16 + 1) / 2 : 0)
+
+		/** Bits of \ref SpeedAdapt_Outcome, what happened on the bus since the last START. */
+		#define SPEED_ADAPT_ACKED      (1 << 0) /**< A target ACKed its address */
+		#define SPEED_ADAPT_FAULTED    (1 << 1) /**< A bus fault, stretch timeout or stuck data phase */
+
+	/* Type Defines: */
+		/** Type define for the adaptive speed policy set by CMD_SET_ADAPT. */
+		typedef struct
+		{
+			uint8_t  StepDownErrors; /**< Faulted transactions in a row that lower the speed, 0 for the policy off */
+			uint16_t StepUpClean;    /**< Clean transactions in a row at a lowered speed before trying the next faster one */
+		} SpeedAdapt_Policy_t;
+
+	/* External Variables: */
+		#if SPEED_ADAPT_SUPPORT
+			extern SpeedAdapt_Policy_t SpeedAdapt_Policy;
+			extern volatile uint8_t SpeedAdapt_Outcome;
+		#endif
+
+	/* Inline Functions: */
+		#if SPEED_ADAPT_SUPPORT
+		/** Records an outcome of the current transaction, see SPEED_ADAPT_ACKED; safe to call from the TWI interrupt. */
+		static inline void SpeedAdapt_Note(const uint8_t outcome) ATTR_ALWAYS_INLINE;
+		static inline void SpeedAdapt_Note(const uint8_t outcome)
+		{
+			SpeedAdapt_Outcome |= outcome;
+		}
+
+		/** Drops the outcomes of the current transaction, for one that runs at a forced speed. */
+		static inline void SpeedAdapt_Forget(void) ATTR_ALWAYS_INLINE;
+		static inline void SpeedAdapt_Forget(void)
+		{
+			SpeedAdapt_Outcome = 0;
+		}
+		#else
+		/* Without SPEED_ADAPT_SUPPORT every START runs at the speed it asks for and no limit is ever set. */
+		static inline void SpeedAdapt_Note(const uint8_t outcome) { (void)outcome; }
+		static inline void SpeedAdapt_Forget(void) {}
+		static inline void SpeedAdapt_Apply(uint8_t* const prescaler, uint8_t* const bit_rate)
+		{
+			(void)prescaler;
+			(void)bit_rate;
+		}
+		static inline uint16_t SpeedAdapt_LimitKHz(void) { return 0; }
+		#endif
+
+	/* Function Prototypes: */
+		#if SPEED_ADAPT_SUPPORT
+			void SpeedAdapt_SetPolicy(const uint8_t step_down_errors, const uint16_t step_up_clean);
+			void SpeedAdapt_Apply(uint8_t* const prescaler, uint8_t* const bit_rate);
+			uint16_t SpeedAdapt_LimitKHz(void);
+		#endif
+
+		#if defined(__INCLUDE_FROM_SPEEDADAPT_C) && SPEED_ADAPT_SUPPORT
+			static uint16_t SpeedAdapt_Period(const uint8_t level);
+			static void SpeedAdapt_StepDown(const uint16_t requested);
+			static void SpeedAdapt_StepUp(const uint16_t requested);
+		#endif
+
+#endif
+
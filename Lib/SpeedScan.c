@@ -0,0 +1,159 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Characterization of the bus speed a target can take: the same register read is repeated at rising bus speeds
+ *  and compared with what it returned at the lowest one, until a speed has rounds that fail. What the wiring
+ *  allows depends on the pull-ups and the bus capacitance as much as on the target, so this is run in place.
+ */
+
+#define  __INCLUDE_FROM_SPEEDSCAN_C
+#include "SpeedScan.h"
+
+#if SPEED_SCAN_SUPPORT
+
+static const uint16_t PROGMEM SpeedScan_Steps[SPEED_SCAN_STEPS] = {50, 100, 200, 400, 600, 800, 1000};
+
+// One round: register pointer write, repeated START, read. Every failure counts, whether the target NAKed, the
+// bus faulted or a clock stretch ran out.
+static bool SpeedScan_Read(const uint8_t address, const uint8_t reg, uint8_t* const data, const uint8_t length)
+{
+	TWIBus_WaitStop();
+	TWIEngine_Start(address << 1);
+	uint8_t result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+	if (result == TWI_ERROR_NoError) {
+		TWIEngine_Write(1);
+		if (TWIEngine_WaitFor(TWI_EVENT_TxSpace) && TWIEngine_IsBusy()) {
+			RingBuffer_Insert(&TWIEngine_TxRing, reg);
+			TWIEngine_Kick();
+		}
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		result = TWIEngine.Result;
+	}
+
+	if (result == TWI_ERROR_NoError) {
+		TWIEngine_Start((address << 1) | I2C_M_RD);
+		result = TWIEngine_Wait(I2C_StartTimeoutMs);
+	}
+
+	if (result == TWI_ERROR_NoError) {
+		TWIEngine_Read(length, true);
+		for (uint8_t i = 0; i < length; i++) {
+			data[i] = 0;
+			if (TWIEngine_WaitFor(TWI_EVENT_RxData) && !RingBuffer_IsEmpty(&TWIEngine_RxRing)) {
+				data[i] = RingBuffer_Remove(&TWIEngine_RxRing);
+				TWIEngine_Kick();
+			}
+		}
+		TWIEngine_WaitFor(TWI_EVENT_Idle);
+		result = TWIEngine.Result;
+	}
+
+	// A NACKed address has already been followed by a STOP from the engine
+	if (result != TWI_ERROR_SlaveNotReady)
+		TWIBus_Stop();
+	TWIEngine_Reset();
+
+	return (result == TWI_ERROR_NoError);
+}
+
+/** Runs the characterization on a 7-bit target, reading \c length bytes from register \c reg \c rounds times at
+ *  every speed, and fills \c response as described at \ref SPEED_SCAN_HEADER. The bus has to be claimed already.
+ *  With \ref SPEED_SCAN_STORE set in \c address, the highest clean speed goes into the target's entry.
+ *  @return Number of response bytes
+ */
+uint8_t SpeedScan_Run(const uint8_t address, const uint8_t reg, uint8_t length, uint8_t rounds,
+                      uint8_t* const response)
+{
+	const uint8_t target = address & ~SPEED_SCAN_STORE;
+	uint8_t reference[SPEED_SCAN_MAX_LENGTH];
+	uint8_t data[SPEED_SCAN_MAX_LENGTH];
+	uint16_t best  = 0;
+	uint16_t store = 0;
+	uint8_t steps  = 0;
+	uint8_t result = SPEED_SCAN_OK;
+
+	if (!length)
+		length = 1;
+	if (length > SPEED_SCAN_MAX_LENGTH)
+		length = SPEED_SCAN_MAX_LENGTH;
+	if (!rounds)
+		rounds = SPEED_SCAN_ROUNDS;
+
+	for (uint8_t step = 0; step < SPEED_SCAN_STEPS; step++) {
+		const uint16_t khz = pgm_read_word(&SpeedScan_Steps[step]);
+		uint8_t prescaler;
+		uint8_t bit_rate;
+
+		if (khz > (F_CPU / 16 / 1000))
+			break;
+
+		const uint16_t actual = I2C_CalcSpeed(khz, &prescaler, &bit_rate) / 1000;
+		TargetConfig_ForceSpeed(prescaler, bit_rate);
+
+		// The first read at the lowest speed is what all others must return
+		if (!step && !SpeedScan_Read(target, reg, reference, length)) {
+			result = SPEED_SCAN_NO_TARGET;
+			break;
+		}
+
+		uint8_t errors = 0;
+		for (uint8_t round = 0; round < rounds; round++) {
+			if (!SpeedScan_Read(target, reg, data, length) || memcmp(data, reference, length))
+				errors++;
+		}
+
+		uint8_t* const record = &response[SPEED_SCAN_HEADER + steps++ * SPEED_SCAN_STEP_SIZE];
+		record[0] = actual & 0xFF;
+		record[1] = actual >> 8;
+		record[2] = errors;
+
+		if (errors) {
+			result = step ? SPEED_SCAN_LIMIT : SPEED_SCAN_UNSTABLE;
+			break;
+		}
+		best  = actual;
+		store = khz;
+	}
+
+	TargetConfig_ForceSpeed(TARGET_SPEED_DEFAULT, 0);
+
+	// The nominal speed gives back the same prescaler and TWBR as tried, the one achieved may round differently
+	if (store && (address & SPEED_SCAN_STORE) && !TargetConfig_SetSpeed(target, store))
+		result = SPEED_SCAN_TABLE_FULL;
+
+	response[0] = result;
+	response[1] = best & 0xFF;
+	response[2] = best >> 8;
+	response[3] = steps;
+	return SPEED_SCAN_HEADER + steps * SPEED_SCAN_STEP_SIZE;
+}
+
+#endif
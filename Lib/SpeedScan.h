@@ -0,0 +1,84 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for SpeedScan.c.
+ */
+
+#ifndef _SPEED_SCAN_H_
+#define _SPEED_SCAN_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "TWIEngine.h"
+		#include "TargetConfig.h"
+
+		#include <avr/pgmspace.h>
+
+	/* Macros: */
+		/** Number of bus speeds tried, from 50 kHz up to 1 MHz; those above what the TWI can do are left out. */
+		#define SPEED_SCAN_STEPS       7
+
+		/** Longest register read each round compares, in bytes. */
+		#define SPEED_SCAN_MAX_LENGTH  8
+
+		/** Rounds per speed when the request asks for 0. */
+		#define SPEED_SCAN_ROUNDS      16
+
+		/** Flag in the CMD_SPEED_SCAN address byte: store the highest clean speed in the target's entry. */
+		#define SPEED_SCAN_STORE       0x80
+
+		/** Size of the CMD_SPEED_SCAN response header: result, highest clean speed in kHz (16 bit), step count. Each
+		 *  step tried follows with the speed it ran at in kHz (16 bit) and the number of rounds that failed.
+		 */
+		#define SPEED_SCAN_HEADER      4
+		#define SPEED_SCAN_STEP_SIZE   3
+		#define SPEED_SCAN_RESPONSE    (SPEED_SCAN_HEADER + SPEED_SCAN_STEPS * SPEED_SCAN_STEP_SIZE)
+
+		/** Results of \ref SpeedScan_Run(), the first byte of the CMD_SPEED_SCAN response. */
+		#define SPEED_SCAN_OK          0 /**< Every speed up to the fastest ran clean */
+		#define SPEED_SCAN_LIMIT       1 /**< The last step tried had failed rounds, the one below it is the highest */
+		#define SPEED_SCAN_NO_TARGET   2 /**< The first read at the lowest speed failed, nothing to compare against */
+		#define SPEED_SCAN_UNSTABLE    3 /**< Rounds failed at the lowest speed already, e.g. the register changes */
+		#define SPEED_SCAN_BUSY        4 /**< Another path is in the middle of a transaction, nothing was done */
+		#define SPEED_SCAN_TABLE_FULL  5 /**< As SPEED_SCAN_OK or LIMIT, but the target table had no room to store it */
+
+	/* Function Prototypes: */
+		#if SPEED_SCAN_SUPPORT
+			uint8_t SpeedScan_Run(const uint8_t address, const uint8_t reg, uint8_t length, uint8_t rounds,
+			                      uint8_t* const response);
+		#endif
+
+		#if defined(__INCLUDE_FROM_SPEEDSCAN_C) && SPEED_SCAN_SUPPORT
+			static bool SpeedScan_Read(const uint8_t address, const uint8_t reg, uint8_t* const data,
+			                           const uint8_t length);
+		#endif
+
+#endif
+
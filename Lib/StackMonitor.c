@@ -0,0 +1,88 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Stack high-water mark. The SRAM between the end of the static data and the stack is painted with a known byte
+ *  at reset, and the deepest the stack ever got is where the paint stops. Control requests are handled in the USB
+ *  interrupt with interrupts enabled again, so the TWI and timer interrupts stack on top of them, and that is the
+ *  worst case the mark catches that a static analysis of the call graph would have a hard time finding. Nothing
+ *  allocates from the heap, see Arena.c, so everything above \c __heap_start is the stack's.
+ */
+
+#define  __INCLUDE_FROM_STACKMONITOR_C
+#include "StackMonitor.h"
+
+// First byte after the .noinit section, put there by the linker
+extern uint8_t __heap_start;
+
+// Paints the free SRAM below the stack pointer. Through a volatile pointer so the compiler doesn't turn the loop
+// into a memset() call, whose return address would be painted over.
+static void StackMonitor_Paint(void)
+{
+	volatile uint8_t* p = &__heap_start;
+
+	while (p < (volatile uint8_t*)SP)
+		*p++ = STACK_MONITOR_PAINT;
+}
+
+/** Runs from .init3 on every reset, with the stack still empty. */
+void StackMonitor_Init(void)
+{
+	StackMonitor_Paint();
+}
+
+/** Handles CMD_GET_MEMORY, sending a \ref StackMonitor_t and repainting afterwards if \c flags has
+ *  \ref STACK_MONITOR_REPAINT set.
+ */
+void StackMonitor_Send(const uint16_t flags)
+{
+	const uint8_t* p = &__heap_start;
+	StackMonitor_t monitor =
+		{
+			.RamSize    = RAMEND - RAMSTART + 1,
+			.StaticSize = &__heap_start - (const uint8_t*)RAMSTART,
+			.FreeNow    = (const uint8_t*)SP - &__heap_start,
+		};
+
+	while ((p < (const uint8_t*)SP) && (*p == STACK_MONITOR_PAINT))
+		p++;
+	monitor.StackFree = p - &__heap_start;
+
+	Endpoint_Write_Control_Stream_LE(&monitor, MIN(sizeof(monitor), USB_ControlRequest.wLength));
+
+	if (flags & STACK_MONITOR_REPAINT) {
+		// Nothing may push below the stack pointer while the paint goes on
+		uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+		GlobalInterruptDisable();
+
+		StackMonitor_Paint();
+
+		SetGlobalInterruptMask(CurrentGlobalInt);
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for StackMonitor.c.
+ */
+
+#ifndef _STACK_MONITOR_H_
+#define _STACK_MONITOR_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+	/* Macros: */
+		/** Byte the free SRAM between the static data and the stack is painted with. */
+		#define STACK_MONITOR_PAINT    0xC5
+
+		/** Flag in the CMD_GET_MEMORY wValue repainting the free SRAM after the response, so the next request
+		 *  reports the high-water mark from then on.
+		 */
+		#define STACK_MONITOR_REPAINT  0x0001
+
+	/* Type Defines: */
+		/** Type define for the CMD_GET_MEMORY response, all sizes in bytes. */
+		typedef struct
+		{
+			uint16_t RamSize;     /**< SRAM of the part, RAMEND - RAMSTART + 1 */
+			uint16_t StaticSize;  /**< Data, BSS and .noinit sections, from RAMSTART to \c __heap_start */
+			uint16_t StackFree;   /**< Least free SRAM between the static data and the stack since the last paint */
+			uint16_t FreeNow;     /**< Free SRAM below the stack pointer while handling the request */
+		} ATTR_PACKED StackMonitor_t;
+
+	/* Function Prototypes: */
+		void StackMonitor_Init(void) ATTR_INIT_SECTION(3);
+		void StackMonitor_Send(const uint16_t flags);
+
+		#if defined(__INCLUDE_FROM_STACKMONITOR_C)
+			static void StackMonitor_Paint(void);
+		#endif
+
+#endif
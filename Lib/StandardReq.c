@@ -0,0 +1,231 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Trimmed standard request handling in place of LUFA's, for the builds that
+ * need the flash more than the generality.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Trimmed replacement for LUFA's DeviceStandardReq.c, built with "make MINI_STDREQ=Y". It answers only the
+ *  standard requests this device gets, the way it is configured: one configuration, bus powered with remote
+ *  wakeup, descriptors from Descriptors.c with the serial number already in RAM. LUFA's generic paths for
+ *  several configurations, self power, its own serial number descriptor and the request type combinations no
+ *  host sends are left out, so the flash goes to the transfer engines instead; "make stdreq" shows how much.
+ */
+
+#define  __INCLUDE_FROM_STANDARDREQ_C
+#include "StandardReq.h"
+
+uint8_t USB_Device_ConfigurationNumber;
+bool    USB_Device_RemoteWakeupEnabled;
+
+#if !defined(NO_DEVICE_SELF_POWER)
+// Only cleared by the LUFA controller driver, never reported
+bool    USB_Device_CurrentlySelfPowered;
+#endif
+
+/** Reads the SETUP packet, lets the application handle it first as LUFA does, then takes the standard requests
+ *  it left alone; anything else is STALLed.
+ */
+void USB_Device_ProcessControlRequest(void)
+{
+	uint8_t* RequestHeader = (uint8_t*)&USB_ControlRequest;
+
+	for (uint8_t i = 0; i < sizeof(USB_Request_Header_t); i++)
+		*(RequestHeader++) = Endpoint_Read_8();
+
+	EVENT_USB_Device_ControlRequest();
+
+	const uint8_t type = USB_ControlRequest.bmRequestType;
+
+	// Class and vendor requests are all the application's; "other" recipients don't exist here
+	if (Endpoint_IsSETUPReceived() && ((type & CONTROL_REQTYPE_TYPE) == REQTYPE_STANDARD) &&
+	    ((type & CONTROL_REQTYPE_RECIPIENT) <= REQREC_ENDPOINT)) {
+		const bool is_in = (type & CONTROL_REQTYPE_DIRECTION);
+
+		switch (USB_ControlRequest.bRequest) {
+			case REQ_GetStatus:
+				if (is_in)
+					StdReq_GetStatus();
+				break;
+			case REQ_ClearFeature:
+			case REQ_SetFeature:
+				if (!is_in)
+					StdReq_ClearSetFeature();
+				break;
+			case REQ_SetAddress:
+				if (!is_in)
+					StdReq_SetAddress();
+				break;
+			case REQ_GetDescriptor:
+				// The HID class descriptors are asked for with the interface as recipient
+				if (is_in)
+					StdReq_GetDescriptor();
+				break;
+			case REQ_GetConfiguration:
+				if (is_in) {
+					Endpoint_ClearSETUP();
+					Endpoint_Write_8(USB_Device_ConfigurationNumber);
+					Endpoint_ClearIN();
+					Endpoint_ClearStatusStage();
+				}
+				break;
+			case REQ_SetConfiguration:
+				if (!is_in)
+					StdReq_SetConfiguration();
+				break;
+		}
+	}
+
+	if (Endpoint_IsSETUPReceived()) {
+		Endpoint_ClearSETUP();
+		Endpoint_StallTransaction();
+	}
+}
+
+/** Device status with the remote wakeup bit, interface status (always 0) or an endpoint's halt bit. */
+static void StdReq_GetStatus(void)
+{
+	uint8_t status = 0;
+
+	switch (USB_ControlRequest.bmRequestType & CONTROL_REQTYPE_RECIPIENT) {
+		case REQREC_DEVICE:
+			if (USB_Device_RemoteWakeupEnabled)
+				status = FEATURE_REMOTE_WAKEUP_ENABLED;
+			break;
+		case REQREC_ENDPOINT:
+		{
+			const uint8_t index = (uint8_t)USB_ControlRequest.wIndex & ENDPOINT_EPNUM_MASK;
+			if (index >= ENDPOINT_TOTAL_ENDPOINTS)
+				return;
+
+			Endpoint_SelectEndpoint(index);
+			status = Endpoint_IsStalled();
+			Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+		}
+		break;
+	}
+
+	Endpoint_ClearSETUP();
+	Endpoint_Write_16_LE(status);
+	Endpoint_ClearIN();
+	Endpoint_ClearStatusStage();
+}
+
+/** Remote wakeup on the device and the halt feature of an enabled, non-control endpoint; clearing a halt also
+ *  resets the endpoint and its data toggle.
+ */
+static void StdReq_ClearSetFeature(void)
+{
+	const bool set = (USB_ControlRequest.bRequest == REQ_SetFeature);
+
+	switch (USB_ControlRequest.bmRequestType & CONTROL_REQTYPE_RECIPIENT) {
+		case REQREC_DEVICE:
+			if ((uint8_t)USB_ControlRequest.wValue != FEATURE_SEL_DeviceRemoteWakeup)
+				return;
+			USB_Device_RemoteWakeupEnabled = set;
+			break;
+		case REQREC_ENDPOINT:
+		{
+			const uint8_t index = (uint8_t)USB_ControlRequest.wIndex & ENDPOINT_EPNUM_MASK;
+			if (((uint8_t)USB_ControlRequest.wValue != FEATURE_SEL_EndpointHalt) ||
+			    (index == ENDPOINT_CONTROLEP) || (index >= ENDPOINT_TOTAL_ENDPOINTS))
+				return;
+
+			Endpoint_SelectEndpoint(index);
+			if (Endpoint_IsEnabled()) {
+				if (set) {
+					Endpoint_StallTransaction();
+				} else {
+					Endpoint_ClearStall();
+					Endpoint_ResetEndpoint(index);
+					Endpoint_ResetDataToggle();
+				}
+			}
+			Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+		}
+		break;
+		default:
+			return;
+	}
+
+	Endpoint_ClearSETUP();
+	Endpoint_ClearStatusStage();
+}
+
+/** Takes the new address once the status stage has gone out under the old one. */
+static void StdReq_SetAddress(void)
+{
+	const uint8_t address = USB_ControlRequest.wValue & 0x7F;
+
+	USB_Device_SetDeviceAddress(address);
+	Endpoint_ClearSETUP();
+	Endpoint_ClearStatusStage();
+	while (!Endpoint_IsINReady());
+	USB_Device_EnableDeviceAddress(address);
+
+	USB_DeviceState = address ? DEVICE_STATE_Addressed : DEVICE_STATE_Default;
+}
+
+/** Sends what \ref CALLBACK_USB_GetDescriptor() points to, from whichever memory it says. */
+static void StdReq_GetDescriptor(void)
+{
+	const void* address;
+	uint8_t     space;
+	const uint16_t size = CALLBACK_USB_GetDescriptor(USB_ControlRequest.wValue, USB_ControlRequest.wIndex,
+	                                                 &address, &space);
+
+	if (size == NO_DESCRIPTOR)
+		return;
+
+	Endpoint_ClearSETUP();
+	if (space == MEMSPACE_FLASH)
+		Endpoint_Write_Control_PStream_LE(address, size);
+	else if (space == MEMSPACE_EEPROM)
+		Endpoint_Write_Control_EStream_LE(address, size);
+	else
+		Endpoint_Write_Control_Stream_LE(address, size);
+	Endpoint_ClearOUT();
+}
+
+/** Configuration 1 or 0, nothing else. */
+static void StdReq_SetConfiguration(void)
+{
+	const uint8_t config = USB_ControlRequest.wValue;
+
+	if (config > FIXED_NUM_CONFIGURATIONS)
+		return;
+
+	Endpoint_ClearSETUP();
+	USB_Device_ConfigurationNumber = config;
+	Endpoint_ClearStatusStage();
+
+	USB_DeviceState = config ? DEVICE_STATE_Configured : DEVICE_STATE_Addressed;
+
+	EVENT_USB_Device_ConfigurationChanged();
+}
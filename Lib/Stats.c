@@ -0,0 +1,290 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Lightweight service time instrumentation. The control request handler takes
+ * Timer1 stamps around its phases, which lets the host tell USB bound from I2C
+ * bound workloads. With 16-bit stamps a single measurement wraps after 65536
+ * ticks (262 ms at 16 MHz), far beyond any sensible request.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "Stats.h"
+
+Stats_t Stats;
+
+#if STATS_SUPPORT
+Stats_Latency_t Stats_Latency =
+	{
+		.TickRateKHz = STATS_TICK_KHZ,
+		.Kinds       = STATS_LATENCY_KINDS,
+		.Buckets     = STATS_LATENCY_BUCKETS,
+	};
+#endif
+
+#if STATS_SUPPORT
+// Timer1 overflows since Stats_BootStart(), the high word of the boot clock; only counted until the last boot stamp
+static volatile uint16_t Stats_BootOverflows;
+
+ISR(TIMER1_OVF_vect, ISR_BLOCK)
+{
+	Stats_BootOverflows++;
+}
+
+// Bus utilization meter: the open busy and held intervals, the totals and frames at the start of the second
+// BusLoad and BusHeldLoad are worked out over, and the ticks of the last full second they are worked out from
+static uint8_t  Stats_BusBusy;
+static uint8_t  Stats_BusHeld;
+static uint16_t Stats_BusSince;
+static uint16_t Stats_HeldSince;
+static uint32_t Stats_WindowBusy;
+static uint32_t Stats_WindowHeld;
+static uint16_t Stats_WindowFrames;
+static uint32_t Stats_LastBusy;
+static uint32_t Stats_LastHeld;
+
+// Low byte of Stats.UsbPackets at the last Start of Frame, a byte to be read atomically against the main code
+static uint8_t  Stats_FramePackets;
+
+#define STATS_WINDOW_FRAMES  1000
+#endif
+
+void Stats_Reset(void)
+{
+	memset(&Stats, 0, offsetof(Stats_t, BootAttachTicks));
+	Stats.TickRateKHz = STATS_TICK_KHZ;
+
+	#if STATS_SUPPORT
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	memset(&Stats.BusBusyTicks, 0, sizeof(Stats) - offsetof(Stats_t, BusBusyTicks));
+	Stats_WindowBusy   = 0;
+	Stats_WindowHeld   = 0;
+	Stats_WindowFrames = 0;
+	Stats_LastBusy     = 0;
+	Stats_LastHeld     = 0;
+	Stats_FramePackets = 0;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	#endif
+}
+
+/** Starts the boot clock the boot stamps are taken with, right after Timebase_Init(). Timer1 is set back to 0 for
+ *  it, whatever the bootloader left in there.
+ */
+void Stats_BootStart(void)
+{
+	if (!STATS_SUPPORT)
+		return;
+
+	TCNT1   = 0;
+	TIFR1   = (1 << TOV1);
+	TIMSK1 |= (1 << TOIE1);
+}
+
+/** Takes a boot stamp, see \ref Stats_BootStamp(). The first request stamp is the last one, the boot clock stops
+ *  with it.
+ */
+void Stats_BootStampSlow(uint32_t* const stamp)
+{
+	#if STATS_SUPPORT
+	if (*stamp)
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint16_t count = TCNT1;
+	uint16_t overflows   = Stats_BootOverflows;
+
+	// An overflow the interrupt hasn't counted yet belongs to a count that has just wrapped
+	if ((TIFR1 & (1 << TOV1)) && (count < 0x8000))
+		overflows++;
+
+	*stamp = ((uint32_t)overflows << 16) | count | 1;
+	if (stamp == &Stats.BootFirstIoTicks)
+		TIMSK1 &= ~(1 << TOIE1);
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	#endif
+}
+
+/** Updates the bus utilization for an event, see \ref Stats_BusEvent(). */
+void Stats_BusEventSlow(const uint8_t event)
+{
+	#if STATS_SUPPORT
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint16_t now = TCNT1;
+
+	if (Stats_BusHeld && (event != STATS_BUS_Start) && (event != STATS_BUS_Hold)) {
+		Stats.BusHeldTicks += (uint16_t)(now - Stats_HeldSince);
+		Stats_BusHeld = false;
+	}
+
+	switch (event) {
+		case STATS_BUS_Start:
+			if (!Stats_BusBusy) {
+				Stats_BusSince = now;
+				Stats_BusBusy  = true;
+			}
+			break;
+
+		case STATS_BUS_Stop:
+			if (Stats_BusBusy) {
+				Stats.BusBusyTicks += (uint16_t)(now - Stats_BusSince);
+				Stats_BusBusy = false;
+			}
+			break;
+
+		case STATS_BUS_Hold:
+			if (Stats_BusBusy && !Stats_BusHeld) {
+				Stats_HeldSince = now;
+				Stats_BusHeld   = true;
+			}
+			break;
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	#endif
+}
+
+/** Adds a wait on the host that started at \c since to UsbWaitTicks. Bulk waits can outlast the Timer1 wrap, so
+ *  past that the frames are counted instead.
+ */
+void Stats_UsbWaitDone(const Stats_Stamp_t since)
+{
+	if (!STATS_SUPPORT)
+		return;
+
+	const uint16_t frames = Timebase_GetFrame() - since.Frame;
+
+	// Timer1 wraps after 262 ms, like in Stats_LatencyDone()
+	if (frames >= 250)
+		Stats.UsbWaitTicks += (uint32_t)frames * TIMEBASE_TICKS_PER_MS;
+	else
+		Stats_AddTime(&Stats.UsbWaitTicks, since.Ticks);
+}
+
+/** Advances the bus utilization meter and the USB packet counts by a frame, called from the Start of Frame
+ *  interrupt. The open bus intervals are added up every frame, so they never get near the Timer1 wrap, and once a
+ *  second the window is closed. The divisions for the loads are left to \ref Stats_UpdateLoads(): at some 40 us
+ *  each they would hold up the TWI interrupt behind this one for longer than a byte takes at 400 kHz.
+ */
+void Stats_Frame(void)
+{
+	#if STATS_SUPPORT
+	const uint16_t now = TCNT1;
+
+	// At most a few dozen packets fit in a frame, so the low byte of the count is enough to tell them
+	const uint8_t packets = (uint8_t)Stats.UsbPackets - Stats_FramePackets;
+	Stats_FramePackets += packets;
+	if (packets) {
+		Stats.UsbActiveFrames++;
+		if (packets > Stats.UsbMaxFramePackets)
+			Stats.UsbMaxFramePackets = packets;
+	}
+
+	if (Stats_BusBusy) {
+		Stats.BusBusyTicks += (uint16_t)(now - Stats_BusSince);
+		Stats_BusSince      = now;
+	}
+	if (Stats_BusHeld) {
+		Stats.BusHeldTicks += (uint16_t)(now - Stats_HeldSince);
+		Stats_HeldSince     = now;
+	}
+
+	if (++Stats_WindowFrames < STATS_WINDOW_FRAMES)
+		return;
+
+	Stats_LastBusy     = Stats.BusBusyTicks - Stats_WindowBusy;
+	Stats_LastHeld     = Stats.BusHeldTicks - Stats_WindowHeld;
+	Stats_WindowBusy   = Stats.BusBusyTicks;
+	Stats_WindowHeld   = Stats.BusHeldTicks;
+	Stats_WindowFrames = 0;
+	#endif
+}
+
+/** Works out BusLoad and BusHeldLoad for the last full second, before \ref Stats goes out to the host. */
+void Stats_UpdateLoads(void)
+{
+	#if STATS_SUPPORT
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	uint32_t busy = Stats_LastBusy;
+	uint32_t held = Stats_LastHeld;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	// A second has TIMEBASE_TICKS_PER_MS thousandths
+	busy /= TIMEBASE_TICKS_PER_MS;
+	held /= TIMEBASE_TICKS_PER_MS;
+	Stats.BusLoad     = MIN(busy, 1000);
+	Stats.BusHeldLoad = MIN(held, 1000);
+	#endif
+}
+
+/** Accounts for a complete CMD_I2C_IO request that started at \c since. */
+void Stats_RequestDone(const uint16_t since)
+{
+	if (!STATS_SUPPORT)
+		return;
+
+	const uint16_t elapsed = Stats_AddTime(&Stats.RequestTicks, since);
+	if (elapsed > Stats.MaxRequestTicks)
+		Stats.MaxRequestTicks = elapsed;
+	Stats.Requests++;
+}
+
+/** Counts a service time that started at \c since in the histogram of \c kind, a Stats_LatencyKind_t value. */
+void Stats_LatencyDone(const uint8_t kind, const Stats_Stamp_t since)
+{
+	#if STATS_SUPPORT
+	uint16_t elapsed = Timebase_Elapsed(since.Ticks);
+	uint8_t  bucket  = STATS_LATENCY_BUCKETS - 1;
+
+	// Timer1 wraps after 262 ms, anything near that goes into the last bucket by the frame count
+	if ((uint16_t)(Timebase_GetFrame() - since.Frame) < 250) {
+		bucket = 0;
+		while (elapsed >>= 1)
+			bucket++;
+	}
+
+	uint16_t* const count = &Stats_Latency.Counts[kind][bucket];
+	if (*count != UINT16_MAX)
+		(*count)++;
+	#endif
+}
+
+/** Clears the latency histograms, leaving their header. */
+void Stats_LatencyReset(void)
+{
+	#if STATS_SUPPORT
+	memset(Stats_Latency.Counts, 0, sizeof(Stats_Latency.Counts));
+	#endif
+}
@@ -0,0 +1,225 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for Stats.c.
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+
+	/* Macros: */
+		/** Rate of the time base used for all service time figures, in kHz. */
+		#define STATS_TICK_KHZ    TIMEBASE_TICKS_PER_MS
+
+		/** Number of log2 buckets per latency histogram. Bucket 0 counts service times of up to 1 tick, bucket
+		 *  n those from 2^n to 2^(n+1) - 1 ticks, and the last one everything from 2^15 ticks (131 ms) up.
+		 */
+		#define STATS_LATENCY_BUCKETS  16
+
+	/* Enums: */
+		/** Enum for the kinds of request with a latency histogram, the rows of \ref Stats_Latency_t. */
+		enum Stats_LatencyKind_t
+		{
+			STATS_LATENCY_IoRead  = 0, /**< CMD_I2C_IO reads and CMD_I2C_REGREAD, from the SETUP packet to the end */
+			STATS_LATENCY_IoWrite = 1, /**< CMD_I2C_IO writes, from the SETUP packet to the end */
+			STATS_LATENCY_Batch   = 2, /**< BULK_OP_BATCH, from the opcode to the last segment */
+			STATS_LATENCY_Scan    = 3, /**< CMD_SCAN, from the SETUP packet to the bitmap */
+			STATS_LATENCY_Poll    = 4, /**< One poll engine sample, from claiming the bus to the record */
+			STATS_LATENCY_KINDS   = 5, /**< Number of histograms */
+		};
+
+		/** Enum for the bus events of \ref Stats_BusEvent(). */
+		enum Stats_BusEvent_t
+		{
+			STATS_BUS_Start  = 0, /**< START sent, the bus is ours until the STOP; repeated STARTs change nothing */
+			STATS_BUS_Stop   = 1, /**< STOP sent or the bus lost, also ends a hold */
+			STATS_BUS_Hold   = 2, /**< SCL held low waiting for the host, e.g. for the next OUT packet */
+			STATS_BUS_Resume = 3, /**< Bytes moving again after a hold */
+		};
+
+	/* Type Defines: */
+		/** Type define for the statistics block returned by CMD_GET_STATS. All times are in Timer1 ticks,
+		 *  averages are left to the host (total ticks divided by number of requests).
+		 */
+		typedef struct
+		{
+			uint16_t TickRateKHz;     /**< Timer1 tick rate, \ref STATS_TICK_KHZ */
+			uint32_t Requests;        /**< CMD_I2C_IO requests handled */
+			uint32_t AddressNAKs;     /**< STARTs whose address was not ACKed */
+			uint32_t CaptureTimeouts; /**< STARTs that could not get hold of the bus in time */
+			uint32_t HostAborts;      /**< Data stages cut short by the host, a bus reset or a suspend */
+			uint32_t RequestTicks;    /**< Total time spent servicing CMD_I2C_IO requests */
+			uint32_t StartTicks;      /**< Part of RequestTicks spent waiting for START and address */
+			uint32_t TransferTicks;   /**< Part of RequestTicks spent moving data in I2C_Write and I2C_Read */
+			uint16_t MaxRequestTicks; /**< Longest single CMD_I2C_IO request */
+			uint32_t BusRecoveries;   /**< Runs of the stuck bus recovery, see BusRecovery.c */
+			uint32_t ArbitrationLost; /**< Times another master won the bus, whether retried or not */
+			uint16_t BusSpeedKHz;     /**< Speed of the last START, filled in when read */
+			uint16_t SpeedLimitKHz;   /**< Adaptive speed limit, 0 for none, filled in when read */
+			uint32_t SpeedStepDowns;  /**< Times the adaptive policy lowered the limit */
+			uint32_t SpeedStepUps;    /**< Times the adaptive policy raised or dropped the limit */
+
+			// The boot stamps are taken once per reset and not cleared with the counters above; 0 for not yet
+			uint32_t BootAttachTicks; /**< Time from the start of SetupHardware() to USB_Init() attaching */
+			uint32_t BootReadyTicks;  /**< Time to the end of SetupHardware(), with interrupts coming on */
+			uint32_t BootConfigTicks; /**< Time to the host selecting the configuration */
+			uint32_t BootFirstIoTicks; /**< Time to the first CMD_I2C_IO request or bulk command */
+
+			// Bus utilization, cleared with the counters again
+			uint32_t BusBusyTicks;    /**< Time the bus was ours, from START to STOP */
+			uint32_t BusHeldTicks;    /**< Part of BusBusyTicks with SCL held low waiting for the host */
+			uint16_t BusLoad;         /**< BusBusyTicks over the last full second, in 1/1000 */
+			uint16_t BusHeldLoad;     /**< BusHeldTicks over the last full second, in 1/1000 */
+
+			// USB side, cleared with the counters
+			uint32_t UsbWaitTicks;    /**< Time spent waiting on the host for a packet or a free IN bank */
+			uint32_t UsbPackets;      /**< Data packets moved in CMD_I2C_IO data stages and on the bulk endpoints */
+			uint32_t UsbActiveFrames; /**< Frames in which any of UsbPackets moved */
+			uint32_t ControlStalls;   /**< Control requests the firmware stalled, see Control_Stall() */
+			uint16_t UsbMaxFramePackets; /**< Most of UsbPackets moved in a single frame */
+
+			// Kept across watchdog resets by Watchdog.c, filled in when read
+			uint16_t WatchdogResets;  /**< Resets by the watchdog since power-up */
+			uint16_t WatchdogRecoveries; /**< Hangs recovered from by the first watchdog timeout, without a reset */
+			uint8_t  ResetCause;      /**< MCUSR bits of the last reset */
+
+			// STARTs that waited for their moment, STREAM samples and BATCH_FLAG_AT segments, cleared with the counters
+			uint32_t TimedStarts;     /**< Timed STARTs that went out, see \ref Stats_TimedStart() */
+			uint32_t TimedLateTicks;  /**< Total time they went out after their moment */
+			uint16_t TimedMaxLate;    /**< Latest of them */
+		} Stats_t;
+
+		/** Type define for the start of a service time, see \ref Stats_LatencyStart(). */
+		typedef struct
+		{
+			uint16_t Ticks; /**< Timer1 count */
+			uint16_t Frame; /**< Frame count, telling times past the Timer1 wrap apart */
+		} Stats_Stamp_t;
+
+		/** Type define for the latency histograms returned by CMD_GET_LATENCY. */
+		typedef struct
+		{
+			uint16_t TickRateKHz; /**< Timer1 tick rate, \ref STATS_TICK_KHZ */
+			uint8_t  Kinds;       /**< \ref STATS_LATENCY_KINDS */
+			uint8_t  Buckets;     /**< \ref STATS_LATENCY_BUCKETS */
+			uint16_t Counts[STATS_LATENCY_KINDS][STATS_LATENCY_BUCKETS]; /**< Saturating at UINT16_MAX */
+		} Stats_Latency_t;
+
+	/* External Variables: */
+		extern Stats_t Stats;
+		extern Stats_Latency_t Stats_Latency;
+
+	/* Inline Functions: */
+		/** Returns the current Timer1 count to measure a service time from. */
+		static inline uint16_t Stats_Timestamp(void) ATTR_ALWAYS_INLINE;
+		static inline uint16_t Stats_Timestamp(void)
+		{
+			return STATS_SUPPORT ? Timebase_Now() : 0;
+		}
+
+		/** Adds the time passed since \c since to a running total and returns it. */
+		static inline uint16_t Stats_AddTime(uint32_t* const total, const uint16_t since) ATTR_ALWAYS_INLINE;
+		static inline uint16_t Stats_AddTime(uint32_t* const total, const uint16_t since)
+		{
+			if (!STATS_SUPPORT)
+				return 0;
+
+			const uint16_t elapsed = Timebase_Elapsed(since);
+			*total += elapsed;
+			return elapsed;
+		}
+
+		/** Counts a timed START that waited for its moment and went out \c late ticks after it. */
+		static inline void Stats_TimedStart(const uint16_t late) ATTR_ALWAYS_INLINE;
+		static inline void Stats_TimedStart(const uint16_t late)
+		{
+			if (!STATS_SUPPORT)
+				return;
+
+			Stats.TimedStarts++;
+			Stats.TimedLateTicks += late;
+			if (late > Stats.TimedMaxLate)
+				Stats.TimedMaxLate = late;
+		}
+
+		static inline void Stats_Count(uint32_t* const counter) ATTR_ALWAYS_INLINE;
+		static inline void Stats_Count(uint32_t* const counter)
+		{
+			if (STATS_SUPPORT)
+				(*counter)++;
+		}
+
+		/** Returns the stamp to measure a service time for \ref Stats_LatencyDone() from. */
+		static inline Stats_Stamp_t Stats_LatencyStart(void) ATTR_ALWAYS_INLINE;
+		static inline Stats_Stamp_t Stats_LatencyStart(void)
+		{
+			Stats_Stamp_t stamp = {0, 0};
+
+			if (STATS_SUPPORT) {
+				stamp.Ticks = Timebase_Now();
+				stamp.Frame = Timebase_GetFrame();
+			}
+			return stamp;
+		}
+
+	/* Function Prototypes: */
+		void Stats_Reset(void);
+		void Stats_RequestDone(const uint16_t since);
+		void Stats_LatencyDone(const uint8_t kind, const Stats_Stamp_t since);
+		void Stats_LatencyReset(void);
+		void Stats_BootStart(void);
+		void Stats_BootStampSlow(uint32_t* const stamp);
+		void Stats_BusEventSlow(const uint8_t event);
+		void Stats_UsbWaitDone(const Stats_Stamp_t since);
+		void Stats_Frame(void);
+		void Stats_UpdateLoads(void);
+
+	/* Inline Functions: */
+		/** Stores the time since \ref Stats_BootStart() in a boot stamp of \ref Stats_t, unless it is set already. */
+		static inline void Stats_BootStamp(uint32_t* const stamp) ATTR_ALWAYS_INLINE;
+		static inline void Stats_BootStamp(uint32_t* const stamp)
+		{
+			if (STATS_SUPPORT && !Stats.BootFirstIoTicks)
+				Stats_BootStampSlow(stamp);
+		}
+
+		/** Tells the bus utilization meter about a Stats_BusEvent_t event. Safe to call from interrupts. */
+		static inline void Stats_BusEvent(const uint8_t event) ATTR_ALWAYS_INLINE;
+		static inline void Stats_BusEvent(const uint8_t event)
+		{
+			if (STATS_SUPPORT)
+				Stats_BusEventSlow(event);
+		}
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * SYNC line shared by several adapters, possibly on different hosts: one of
+ * them drives it as the trigger master and toggles it whenever an armed
+ * batch is due to start, the others follow its edges. The followers wait for
+ * an edge by spinning on the external interrupt flag with interrupts off, so
+ * their STARTs go out within a few CPU cycles of it instead of after however
+ * long the interrupt being served at that moment takes.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_SYNCLINE_C
+#include "SyncLine.h"
+
+// SYNC_MODE_* value set by CMD_SET_SYNC
+static uint8_t Sync_Mode;
+
+// Edges seen or made so far, counted by the edge interrupt and by Sync_Fire()
+static volatile uint16_t Sync_Edges;
+
+ISR(SYNC_VECT)
+{
+	Sync_Edges++;
+}
+
+/** Sets up the line, mode is a SYNC_MODE_* value. A follower reacts to either edge, so the master only ever has to
+ *  toggle its output and there is no pulse width to wait out.
+ *  @return false for an unknown mode, which leaves the line as it was
+ */
+bool Sync_SetMode(const uint8_t mode)
+{
+	if (mode > SYNC_MODE_OUTPUT)
+		return false;
+
+	EIMSK &= ~(1 << SYNC_INT);
+	Sync_Mode  = mode;
+	Sync_Edges = 0;
+	SYNC_DDR  &= ~(1 << SYNC_BIT);
+	SYNC_PORT &= ~(1 << SYNC_BIT);
+
+	if (mode == SYNC_MODE_OUTPUT) {
+		SYNC_DDR |= (1 << SYNC_BIT);
+	} else if (mode == SYNC_MODE_INPUT) {
+		// The pull-up keeps a line without a master quiet
+		SYNC_PORT |= (1 << SYNC_BIT);
+		#if (SYNC_INT < 4)
+		EICRA = (EICRA & ~(3 << (SYNC_INT * 2))) | (1 << (SYNC_INT * 2));
+		#else
+		EICRB = (EICRB & ~(3 << ((SYNC_INT - 4) * 2))) | (1 << ((SYNC_INT - 4) * 2));
+		#endif
+		EIFR   = (1 << SYNC_INT);
+		EIMSK |= (1 << SYNC_INT);
+	}
+
+	return true;
+}
+
+/** Returns the current SYNC_MODE_* value. */
+uint8_t Sync_GetMode(void)
+{
+	return Sync_Mode;
+}
+
+/** Returns the number of edges seen or made since the mode was set, wrapping at 16 bits. */
+uint16_t Sync_GetEdges(void)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint16_t edges = Sync_Edges;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	return edges;
+}
+
+/** Brings on the next edge: the master toggles the line and goes on right away, a follower waits for the master to
+ *  do so. An edge that came in since the last one was taken counts, so the host arms the followers before it has
+ *  the master fire. The wait runs with interrupts off, for at most the given timeout; USB requests coming in during
+ *  that time are served once it is over.
+ *  @param timeout_ms How long a follower waits, 0 only takes an edge that has come in already
+ *  @return false if a follower saw no edge in time, or the line is off
+ */
+bool Sync_Fire(const uint8_t timeout_ms)
+{
+	if (Sync_Mode == SYNC_MODE_OUTPUT) {
+		// Writing the PIN bit toggles the output in one cycle
+		SYNC_PIN = (1 << SYNC_BIT);
+		Sync_Edges++;
+		return true;
+	}
+
+	if (Sync_Mode != SYNC_MODE_INPUT)
+		return false;
+
+	const uint16_t timeout = Timebase_MsToTicks(timeout_ms);
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint16_t started = TCNT1;
+	bool fired;
+
+	while (!(fired = (EIFR & (1 << SYNC_INT))) && ((uint16_t)(TCNT1 - started) < timeout))
+		;
+	if (fired) {
+		EIFR = (1 << SYNC_INT);
+		Sync_Edges++;
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	return fired;
+}
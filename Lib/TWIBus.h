@@ -0,0 +1,203 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Polled access to the hardware I2C bus, for the code paths that drive it byte by byte rather than through the
+ *  TWI engine interrupt. The backend is picked by \c ARCH at compile time and is all static inline, so each call
+ *  boils down to the same couple of register accesses as the open coded version.
+ *
+ *  Only the AVR8 TWI is implemented. The TWI engine interrupt in TWIEngine.c is the AVR8 state machine itself
+ *  and talks to the registers directly.
+ */
+
+#ifndef _TWI_BUS_H_
+#define _TWI_BUS_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Trace.h"
+		#include "Stats.h"
+		#include "Timebase.h"
+
+		#include <util/delay_basic.h>
+
+	/* Macros: */
+		/** Minimum bus free time between a STOP and the next START in CPU cycles (4.7, 1.3 and 0.5 us), rounded up,
+		 *  for standard mode, fast mode and fast mode plus.
+		 */
+		#define TWIBUS_BUF_STANDARD   ((F_CPU / 10000 * 47 + 999) / 1000)
+		#define TWIBUS_BUF_FAST       ((F_CPU / 10000 * 13 + 999) / 1000)
+		#define TWIBUS_BUF_FAST_PLUS  ((F_CPU / 10000 * 5 + 999) / 1000)
+
+		/** CPU cycles per Timer1 tick. */
+		#define TWIBUS_TICK_CYCLES    (F_CPU / 1000 / TIMEBASE_TICKS_PER_MS)
+
+	/* External Variables: */
+		extern uint16_t      TWIBus_StoppedAt;
+		extern volatile bool TWIBus_Stopped;
+
+	/* Inline Functions: */
+		#if (ARCH == ARCH_AVR8)
+			/** Returns the SCL period of the current bit rate in CPU cycles. */
+			static inline uint16_t TWIBus_PeriodCycles(void) ATTR_ALWAYS_INLINE;
+			static inline uint16_t TWIBus_PeriodCycles(void)
+			{
+				return 16 + (uint16_t)TWBR * (2 << ((TWSR & 0x03) << 1));
+			}
+
+			/** Returns the bus free time the current bit rate needs after a STOP, in CPU cycles. */
+			static inline uint8_t TWIBus_FreeCycles(void) ATTR_ALWAYS_INLINE;
+			static inline uint8_t TWIBus_FreeCycles(void)
+			{
+				const uint16_t period = TWIBus_PeriodCycles();
+
+				return (period >= F_CPU / 100000) ? TWIBUS_BUF_STANDARD :
+				       (period >= F_CPU / 400000) ? TWIBUS_BUF_FAST : TWIBUS_BUF_FAST_PLUS;
+			}
+
+			/** Notes a STOP just handed to the TWI, for \ref TWIBus_WaitFree(). Until it has gone out all we know is
+			 *  that it takes less than an SCL period, so the stamp is put that much into the future.
+			 */
+			static inline void TWIBus_Stopping(void) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_Stopping(void)
+			{
+				TWIBus_StoppedAt = Timebase_Now() + (TWIBus_PeriodCycles() + TWIBUS_TICK_CYCLES - 1) / TWIBUS_TICK_CYCLES;
+				TWIBus_Stopped   = true;
+			}
+
+			/** Holds off the next START until the bus has been free for tBUF since the last STOP. Usually the USB side
+			 *  took longer than that anyway and this costs one timer read; a START right behind a STOP waits exactly
+			 *  as long as it has to, give or take a timer tick.
+			 *  @param cycles Bus free time to wait for, see \ref TWIBus_FreeCycles()
+			 */
+			static inline void TWIBus_WaitFree(const uint8_t cycles) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_WaitFree(const uint8_t cycles)
+			{
+				if (!TWIBus_Stopped)
+					return;
+				TWIBus_Stopped = false;
+
+				// A STOP still going out gives the one exact reference, the moment the TWI clears TWSTO
+				if (TWCR & (1 << TWSTO)) {
+					while (TWCR & (1 << TWSTO));
+					_delay_loop_1(cycles / 3 + 1);
+					return;
+				}
+
+				// Otherwise the stamp is up to a tick off either way, so count one tick less than the timer says
+				const int16_t ticks = (int16_t)(Timebase_Now() - TWIBus_StoppedAt) - 1;
+				if (ticks >= (int16_t)(cycles / TWIBUS_TICK_CYCLES + 1))
+					return;
+
+				const int16_t left = cycles - ((ticks > 0) ? ticks * TWIBUS_TICK_CYCLES : 0);
+				if (left > 0)
+					_delay_loop_1(left / 3 + 1);
+			}
+
+			/** Returns the Timer1 ticks to leave between a STOP handed to the TWI and the next START. */
+			static inline uint16_t TWIBus_FreeTicks(void) ATTR_ALWAYS_INLINE;
+			static inline uint16_t TWIBus_FreeTicks(void)
+			{
+				return (TWIBus_PeriodCycles() + TWIBus_FreeCycles() + TWIBUS_TICK_CYCLES - 1) / TWIBUS_TICK_CYCLES + 1;
+			}
+
+			/** Sends a (repeated) START without the TWI interrupt; wait with \ref TWIBus_IsReady(). */
+			static inline void TWIBus_Start(void) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_Start(void)
+			{
+				TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN);
+			}
+
+			/** Returns true once the last START, byte or address has gone out and the bus waits for us. */
+			static inline bool TWIBus_IsReady(void) ATTR_ALWAYS_INLINE;
+			static inline bool TWIBus_IsReady(void)
+			{
+				return (TWCR & (1 << TWINT));
+			}
+
+			/** Returns the outcome of the last bus operation, a TW_* status code. */
+			static inline uint8_t TWIBus_Status(void) ATTR_ALWAYS_INLINE;
+			static inline uint8_t TWIBus_Status(void)
+			{
+				return (TWSR & TW_STATUS_MASK);
+			}
+
+			/** Shifts out a data or address byte; the bus must be ready. */
+			static inline void TWIBus_PutByte(const uint8_t value) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_PutByte(const uint8_t value)
+			{
+				TWDR = value;
+				TWCR = (1 << TWINT) | (1 << TWEN);
+			}
+
+			/** Clocks in a byte, answered with ACK or NACK; collect it with \ref TWIBus_GetByte() once ready. */
+			static inline void TWIBus_ReceiveByte(const bool ack) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_ReceiveByte(const bool ack)
+			{
+				TWCR = (1 << TWINT) | (1 << TWEN) | (ack ? (1 << TWEA) : 0);
+			}
+
+			/** Returns the byte clocked in by \ref TWIBus_ReceiveByte(). */
+			static inline uint8_t TWIBus_GetByte(void) ATTR_ALWAYS_INLINE;
+			static inline uint8_t TWIBus_GetByte(void)
+			{
+				return TWDR;
+			}
+
+			/** Sends a STOP, releasing the bus. */
+			static inline void TWIBus_Stop(void) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_Stop(void)
+			{
+				TWI_StopTransmission();
+				TWIBus_Stopping();
+				Trace_Add(TRACE_STOP, 0);
+				Stats_BusEvent(STATS_BUS_Stop);
+			}
+
+			/** Waits for a STOP to go out, so a following START doesn't cut it short; the bus free time counts
+			 *  from here.
+			 */
+			static inline void TWIBus_WaitStop(void) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_WaitStop(void)
+			{
+				while (TWCR & (1 << TWSTO));
+				TWIBus_StoppedAt = Timebase_Now();
+			}
+
+			/** Resets the TWI module, letting go of the bus without a STOP; for a target that holds the clock. */
+			static inline void TWIBus_Abort(void) ATTR_ALWAYS_INLINE;
+			static inline void TWIBus_Abort(void)
+			{
+				TWCR = 0;
+				TWCR = (1 << TWEN);
+				Stats_BusEvent(STATS_BUS_Stop);
+			}
+		#endif
+
+#endif
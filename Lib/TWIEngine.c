@@ -0,0 +1,661 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Interrupt driven TWI master engine. The main code hands over one operation
+ * (START + address, write N bytes, read N bytes) at a time. Data flows through
+ * a pair of ring buffers: the USB side fills the TX ring and drains the RX
+ * ring at its own pace while the TWI interrupt works the other end, so USB
+ * packet boundaries and I2C transfer lengths are decoupled. If a ring runs
+ * empty (TX) or full (RX) the engine stalls with the clock held low until the
+ * USB side catches up. Between operations TWINT is left set, so the bus is
+ * held until the next operation or a STOP.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "TWIEngine.h"
+
+TWIEngine_t TWIEngine;
+
+RingBuffer_t TWIEngine_TxRing;
+RingBuffer_t TWIEngine_RxRing;
+
+static uint8_t TWIEngine_TxData[TWI_ENGINE_TX_SIZE];
+static uint8_t TWIEngine_RxData[TWI_ENGINE_RX_SIZE];
+
+/** Timer1 stamp of the last STOP and whether a START has yet to wait out the bus free time after it. */
+uint16_t      TWIBus_StoppedAt;
+volatile bool TWIBus_Stopped;
+
+// Finish the current operation; TWIE goes off but TWINT stays set so the bus is not released
+static inline void TWIEngine_Done(const uint8_t result)
+{
+	TWCR = (1 << TWEN);
+	if (result != TWI_ERROR_NoError)
+		TWIEngine.Result = result;
+	TWIEngine.State = TWI_ENGINE_Idle;
+}
+
+// The target did not answer to its address: retry as configured, or give up and release the bus
+static inline void TWIEngine_AddressNAK(void)
+{
+	Trace_Add(TRACE_NAK, TWIEngine.Retries);
+	AddrStats_Nak();
+	if (TWIEngine.Retries) {
+		TWIEngine.Retries--;
+		if (!TWIEngine.Backoff) {
+			// STOP and a fresh START in one go
+			TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWSTO) | (1 << TWEN) | (1 << TWIE);
+		} else {
+			// Let go of the bus, the Timer1 compare interrupt sends the next START once the backoff and the bus
+			// free time have passed
+			const uint16_t free_ticks = TWIBus_FreeTicks();
+
+			TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+			Stats_BusEvent(STATS_BUS_Stop);
+			OCR1A   = TCNT1 + ((TWIEngine.Backoff > free_ticks) ? TWIEngine.Backoff : free_ticks);
+			TIFR1   = (1 << OCF1A);
+			TIMSK1 |= (1 << OCIE1A);
+		}
+		return;
+	}
+	// Same as TWI_StartTransmission: a NACKed address releases the bus right away
+	Probe_Off(PROBE_START);
+	TWIEngine.Status = TWSR & TW_STATUS_MASK;
+	TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN);
+	TWIBus_Stopping();
+	TWIEngine.Result = TWI_ERROR_SlaveNotReady;
+	TWIEngine.State  = TWI_ENGINE_Idle;
+	Stats_BusEvent(STATS_BUS_Stop);
+}
+
+// Park the engine until the USB side has made room or data; TWINT stays set and holds the clock low
+static inline void TWIEngine_Stall(void)
+{
+	TWCR = (1 << TWEN);
+	TWI_ENGINE_FLAGS |= (1 << TWI_FLAG_STALLED);
+	Stats_BusEvent(STATS_BUS_Hold);
+}
+
+static inline void TWIEngine_SendNext(void)
+{
+	if (RingBuffer_IsEmpty(&TWIEngine_TxRing)) {
+		TWIEngine_Stall();
+		return;
+	}
+
+	TWDR = RingBuffer_Remove(&TWIEngine_TxRing);
+	TWIEngine.Remaining--;
+	TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+}
+
+static inline void TWIEngine_ReceiveNext(void)
+{
+	if (TWIEngine_IsNackLast() && TWIEngine.Remaining == 1)
+		TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+	else
+		TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE) | (1 << TWEA);
+}
+
+ISR(TWI_vect, ISR_BLOCK)
+{
+	switch (TWSR & TW_STATUS_MASK) {
+		case TW_START:
+			// A retried 10-bit read begins again with the write header
+			if (TWIEngine.TenBit == TWI_TEN_ReadHeader)
+				TWIEngine.TenBit = TWI_TEN_Read;
+			/* Fall through */
+		case TW_REP_START:
+			Trace_Add(TRACE_START, TWIEngine.Address);
+			TWDR = (TWIEngine.TenBit == TWI_TEN_ReadHeader) ? (TWIEngine.Address | I2C_M_RD) : TWIEngine.Address;
+			TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+			break;
+
+		case TW_MT_SLA_ACK:
+			if (TWIEngine.TenBit != TWI_TEN_None) {
+				// Header taken, the low address byte follows
+				TWDR = TWIEngine.AddressLow;
+				TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWIE);
+				break;
+			}
+			/* Fall through */
+		case TW_MR_SLA_ACK:
+			Trace_Add(TRACE_ACK, 0);
+			AddrStats_Acked(TWIEngine.Address >> 1);
+			Probe_Off(PROBE_START);
+			SpeedAdapt_Note(SPEED_ADAPT_ACKED);
+			TWIEngine_Done(TWI_ERROR_NoError);
+			break;
+
+		case TW_MT_SLA_NACK:
+		case TW_MR_SLA_NACK:
+			TWIEngine_AddressNAK();
+			break;
+
+		case TW_MT_DATA_NACK:
+			if (TWIEngine.State == TWI_ENGINE_Start) {
+				// Nobody took the low byte of the 10-bit address
+				TWIEngine_AddressNAK();
+				break;
+			}
+			// Like the control path, keep going but remember the target complained
+			TWIEngine.Result = TWI_ERROR_SlaveNAK;
+			TWIEngine.Status = TW_MT_DATA_NACK;
+			/* Fall through */
+		case TW_MT_DATA_ACK:
+			if (TWIEngine.State == TWI_ENGINE_Start) {
+				// Low byte of the 10-bit address taken; a read turns the bus around with the header again
+				if (TWIEngine.TenBit == TWI_TEN_Read) {
+					TWIEngine.TenBit = TWI_TEN_ReadHeader;
+					TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+				} else {
+					Trace_Add(TRACE_ACK, 0);
+					AddrStats_Acked(TWIEngine.Address >> 1);
+					Probe_Off(PROBE_START);
+					SpeedAdapt_Note(SPEED_ADAPT_ACKED);
+					TWIEngine_Done(TWI_ERROR_NoError);
+				}
+				break;
+			}
+			if (TWIEngine.Remaining)
+				TWIEngine_SendNext();
+			else
+				TWIEngine_Done(TWI_ERROR_NoError);
+			break;
+
+		case TW_MR_DATA_ACK:
+		case TW_MR_DATA_NACK:
+			// We only ever start a byte if there is room for it
+			RingBuffer_Insert(&TWIEngine_RxRing, TWDR);
+			if (!--TWIEngine.Remaining)
+				TWIEngine_Done(TWI_ERROR_NoError);
+			else if (RingBuffer_IsFull(&TWIEngine_RxRing))
+				TWIEngine_Stall();
+			else
+				TWIEngine_ReceiveNext();
+			break;
+
+		case TW_MT_ARB_LOST:
+			Stats_Count(&Stats.ArbitrationLost);
+			if ((TWIEngine.State == TWI_ENGINE_Start) && TWIEngine.ArbRetries) {
+				// Somebody else won the bus in the address byte, nothing went out yet; the START waits for its STOP
+				TWIEngine.ArbRetries--;
+				Trace_Add(TRACE_ARB_LOST, TWIEngine.ArbRetries);
+				TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+				break;
+			}
+			Trace_Add(TRACE_FAULT, TW_MT_ARB_LOST);
+			Probe_Off(PROBE_START);
+			SpeedAdapt_Note(SPEED_ADAPT_FAULTED);
+			TWCR = (1 << TWINT) | (1 << TWEN);
+			TWIEngine.Result = TWI_ERROR_BusFault;
+			TWIEngine.Status = TW_MT_ARB_LOST;
+			TWIEngine.State  = TWI_ENGINE_Idle;
+			Stats_BusEvent(STATS_BUS_Stop);
+			break;
+
+		case TW_SR_SLA_ACK:
+		case TW_SR_ARB_LOST_SLA_ACK:
+		case TW_SR_DATA_ACK:
+		case TW_SR_STOP:
+		case TW_ST_SLA_ACK:
+		case TW_ST_ARB_LOST_SLA_ACK:
+		case TW_ST_DATA_ACK:
+		case TW_ST_DATA_NACK:
+		case TW_ST_LAST_DATA:
+#if EMU_SUPPORT
+			if (Emu.Active)
+				Emu_Service(TWSR & TW_STATUS_MASK);
+			else
+#endif
+				Notify_Service(TWSR & TW_STATUS_MASK);
+			break;
+
+		default:
+			// Bus error or a state we never asked for, get off the bus; an emulated target keeps listening
+			Trace_Add(TRACE_FAULT, TWSR & TW_STATUS_MASK);
+			Probe_Off(PROBE_START);
+			SpeedAdapt_Note(SPEED_ADAPT_FAULTED);
+			TWCR = (1 << TWINT) | (1 << TWSTO) | (1 << TWEN) | (Emu_IsActive() ? ((1 << TWEA) | (1 << TWIE)) : 0);
+			TWIBus_Stopping();
+			TWIEngine.Result = TWI_ERROR_BusFault;
+			TWIEngine.Status = TWSR & TW_STATUS_MASK;
+			TWIEngine.State  = TWI_ENGINE_Idle;
+			Notify_Abort();
+			Stats_BusEvent(STATS_BUS_Stop);
+			break;
+	}
+}
+
+// Retry a NACKed START after the backoff
+ISR(TIMER1_COMPA_vect, ISR_BLOCK)
+{
+	TIMSK1 &= ~(1 << OCIE1A);
+
+	if (TWIEngine.State == TWI_ENGINE_Start) {
+		while (TWCR & (1 << TWSTO));
+		TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+		Stats_BusEvent(STATS_BUS_Start);
+	}
+}
+
+/** Sends a (repeated) START followed by the given address byte, with the settings for that target applied.
+ *  A 10-bit target is addressed with \ref TWI_ENGINE_TEN(); its settings are those of the header address.
+ *  Use \ref TWIEngine_Wait() to collect the result.
+ */
+void TWIEngine_Start(const uint16_t address)
+{
+	// Both the speed the last STOP went out at and the one of this target get their bus free time
+	const uint8_t free_cycles = TWIBus_FreeCycles();
+
+	if (address & TWI_ENGINE_TEN_BIT) {
+		TWIEngine.Address    = 0xF0 | ((address >> 8) & 0x06);
+		TWIEngine.AddressLow = address >> 1;
+		TWIEngine.TenBit     = (address & I2C_M_RD) ? TWI_TEN_Read : TWI_TEN_Write;
+	} else {
+		TWIEngine.Address    = address;
+		TWIEngine.TenBit     = TWI_TEN_None;
+	}
+	TargetConfig_Apply(TWIEngine.Address >> 1);
+	TWIBus_WaitFree((free_cycles > TWIBus_FreeCycles()) ? free_cycles : TWIBus_FreeCycles());
+	Prefetch_Started(TWIEngine.Address);
+	AddrStats_Select(TWIEngine.Address >> 1);
+	ClockMeter_Sync();
+	TWIEngine.Result  = TWI_ERROR_NoError;
+	TWIEngine.Status  = TW_NO_INFO;
+	TWIEngine.State   = TWI_ENGINE_Start;
+	TWIEngine.ArbRetries = ARB_LOST_RETRIES;
+	Stats_BusEvent(STATS_BUS_Start);
+	Probe_On(PROBE_START);
+	TWCR = (1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE);
+}
+
+/** Shifts out the next \c len bytes put into the TX ring, which is emptied first. */
+void TWIEngine_Write(const uint16_t len)
+{
+	if (!len)
+		return;
+
+	Trace_AddCount(TRACE_WRITE, len);
+	AddrStats_Written(len);
+	RingBuffer_InitBuffer(&TWIEngine_TxRing, TWIEngine_TxData, sizeof(TWIEngine_TxData));
+	TWIEngine.Remaining = len;
+	TWIEngine.Result    = TWI_ERROR_NoError;
+	TWIEngine.Status    = TW_NO_INFO;
+	TWIEngine.State     = TWI_ENGINE_Write;
+	TWI_ENGINE_FLAGS   &= ~(1 << TWI_FLAG_STALLED);
+	TWIEngine_SendNext();
+}
+
+/** Clocks in \c len bytes into the RX ring, which is emptied first.
+ *  @param nack_last_byte Respond to the last byte with NACK instead of ACK
+ */
+void TWIEngine_Read(const uint16_t len, const uint8_t nack_last_byte)
+{
+	if (!len)
+		return;
+
+	Trace_AddCount(TRACE_READ, len);
+	AddrStats_Read(len);
+	RingBuffer_InitBuffer(&TWIEngine_RxRing, TWIEngine_RxData, sizeof(TWIEngine_RxData));
+	TWIEngine.Remaining = len;
+	TWIEngine.Result    = TWI_ERROR_NoError;
+	TWIEngine.Status    = TW_NO_INFO;
+	TWIEngine.State     = TWI_ENGINE_Read;
+	TWI_ENGINE_FLAGS   &= ~(1 << TWI_FLAG_STALLED);
+	if (nack_last_byte)
+		TWI_ENGINE_FLAGS |= (1 << TWI_FLAG_NACK_LAST);
+	else
+		TWI_ENGINE_FLAGS &= ~(1 << TWI_FLAG_NACK_LAST);
+	TWIEngine_ReceiveNext();
+}
+
+/** Resumes a stalled engine; call after putting data into the TX ring or taking data out of the RX ring.
+ *  Cheap enough to be called for every byte. The TWI interrupt is off while the engine is stalled, so this
+ *  cannot race with it.
+ */
+void TWIEngine_Kick(void)
+{
+	if (!TWIEngine_IsStalled())
+		return;
+
+	TWI_ENGINE_FLAGS &= ~(1 << TWI_FLAG_STALLED);
+	Stats_BusEvent(STATS_BUS_Resume);
+	if (TWIEngine.State == TWI_ENGINE_Write)
+		TWIEngine_SendNext();
+	else
+		TWIEngine_ReceiveNext();
+}
+
+/** Shifts out up to \c count bytes of the current write straight from the FIFO of the selected endpoint, by
+ *  polling TWINT instead of going through the TX ring and the interrupt. Only takes over while the engine is
+ *  stalled on an empty TX ring, so the interrupt is off and the bus is waiting for us.
+ *
+ *  Between TWINT coming up and the next byte going out there are about 17 cycles at -Os: up to 5 to notice
+ *  TWINT, 5 to check the status, 4 for reading UEDATX into TWDR and 3 for writing TWCR, i.e. about 1.1 us of
+ *  SCL held low at 16 MHz, where the interrupt path takes 4 us or more. The TWI always holds SCL low from the
+ *  ACK until TWINT is cleared, so some gap remains; at 1 MHz it costs about a tenth of the bus time.
+ *
+ *  A NACKed byte is remembered and the write carries on, like in the interrupt. Lost arbitration or a bus
+ *  error is left to the interrupt, and a stretched clock is given up on after \ref I2C_StretchTimeoutMs.
+ *  The engine is stalled again once the bytes are out, or idle if the write is complete.
+ *
+ *  @return Number of bytes taken from the FIFO, 0 if the engine wasn't in a state to take any
+ */
+uint8_t TWIEngine_WriteDirect(uint8_t count)
+{
+	if (!TWIEngine_IsStalled() || (TWIEngine.State != TWI_ENGINE_Write) || !RingBuffer_IsEmpty(&TWIEngine_TxRing))
+		return 0;
+
+	Stats_BusEvent(STATS_BUS_Resume);
+
+	uint16_t remaining = TWIEngine.Remaining;
+	if (count > remaining)
+		count = remaining;
+
+	const uint16_t timeout = Timebase_MsToTicks(I2C_StretchTimeoutMs);
+	uint8_t taken = 0;
+
+	while (taken < count) {
+		TWIBus_PutByte(Endpoint_Read_8());
+		taken++;
+		remaining--;
+		Watchdog_Kick();
+
+		// Check the clock only every 256 polls, so noticing TWINT stays a single load and branch
+		const uint16_t started = Timebase_Now();
+		uint8_t polls = 0;
+		while (!TWIBus_IsReady()) {
+			if (!++polls && (Timebase_Elapsed(started) >= timeout)) {
+				TWIBus_Abort();
+				TWIEngine.Result  = TWI_ENGINE_ERROR_StretchTimeout;
+				TWI_ENGINE_FLAGS &= ~(1 << TWI_FLAG_STALLED);
+				TWIEngine.State   = TWI_ENGINE_Idle;
+				Trace_Add(TRACE_TIMEOUT, 0);
+				SpeedAdapt_Note(SPEED_ADAPT_FAULTED);
+				AddrStats_Timeout();
+				return taken;
+			}
+		}
+
+		const uint8_t status = TWIBus_Status();
+		if (status == TW_MT_DATA_ACK)
+			continue;
+
+		if (status == TW_MT_DATA_NACK) {
+			TWIEngine.Result = TWI_ERROR_SlaveNAK;
+			TWIEngine.Status = TW_MT_DATA_NACK;
+			continue;
+		}
+
+		// Let the interrupt sort out the fault; TWINT is still set, so it fires right away
+		TWIEngine.Remaining = remaining;
+		TWI_ENGINE_FLAGS   &= ~(1 << TWI_FLAG_STALLED);
+		TWCR = (1 << TWEN) | (1 << TWIE);
+		return taken;
+	}
+
+	TWIEngine.Remaining = remaining;
+	if (!remaining) {
+		TWI_ENGINE_FLAGS &= ~(1 << TWI_FLAG_STALLED);
+		TWIEngine_Done(TWI_ERROR_NoError);
+	}
+
+	return taken;
+}
+
+// Copy a run known to be in the selected endpoint's bank, unrolled to eight bytes per iteration and without the
+// bank checks of the LUFA stream functions
+static inline void TWIEngine_ReadFIFO(uint8_t* data, uint8_t len)
+{
+	for (uint8_t blocks = len >> 3; blocks; blocks--) {
+		*data++ = Endpoint_Read_8();
+		*data++ = Endpoint_Read_8();
+		*data++ = Endpoint_Read_8();
+		*data++ = Endpoint_Read_8();
+		*data++ = Endpoint_Read_8();
+		*data++ = Endpoint_Read_8();
+		*data++ = Endpoint_Read_8();
+		*data++ = Endpoint_Read_8();
+	}
+
+	for (len &= 0x07; len; len--)
+		*data++ = Endpoint_Read_8();
+}
+
+// Copy a run known to fit the selected endpoint's bank, the same way
+static inline void TWIEngine_WriteFIFO(const uint8_t* data, uint8_t len)
+{
+	for (uint8_t blocks = len >> 3; blocks; blocks--) {
+		Endpoint_Write_8(*data++);
+		Endpoint_Write_8(*data++);
+		Endpoint_Write_8(*data++);
+		Endpoint_Write_8(*data++);
+		Endpoint_Write_8(*data++);
+		Endpoint_Write_8(*data++);
+		Endpoint_Write_8(*data++);
+		Endpoint_Write_8(*data++);
+	}
+
+	for (len &= 0x07; len; len--)
+		Endpoint_Write_8(*data++);
+}
+
+/** Moves \c count bytes from the FIFO of the selected endpoint into the TX ring, which must have room for them.
+ *  Copies at most two contiguous spans with TWIEngine_ReadFIFO() and updates the ring's count once, where
+ *  RingBuffer_Insert() would disable interrupts for every byte. Kick the engine afterwards.
+ */
+void TWIEngine_TxFromEndpoint(const uint8_t count)
+{
+	RingBuffer_t* const ring = &TWIEngine_TxRing;
+	uint8_t first = ring->End - ring->In;
+	if (first > count)
+		first = count;
+
+	TWIEngine_ReadFIFO(ring->In, first);
+	TWIEngine_ReadFIFO(ring->Start, count - first);
+	ring->In += count;
+	if (ring->In >= ring->End)
+		ring->In -= ring->Size;
+
+	// The interrupt only removes, so only the count is shared with it
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+	ring->Count += count;
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Moves \c count bytes from the RX ring, which must hold them, into the FIFO of the selected endpoint, the same
+ *  way as \ref TWIEngine_TxFromEndpoint(). Kick the engine afterwards.
+ */
+void TWIEngine_RxToEndpoint(const uint8_t count)
+{
+	RingBuffer_t* const ring = &TWIEngine_RxRing;
+	uint8_t first = ring->End - ring->Out;
+	if (first > count)
+		first = count;
+
+	TWIEngine_WriteFIFO(ring->Out, first);
+	TWIEngine_WriteFIFO(ring->Start, count - first);
+	ring->Out += count;
+	if (ring->Out >= ring->End)
+		ring->Out -= ring->Size;
+
+	// The interrupt only inserts, so only the count is shared with it
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+	ring->Count -= count;
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Ends the current operation at the next byte boundary and empties both rings. A read always ends with a
+ *  NACKed byte, so the target lets go of SDA. The bus is still held afterwards, the caller is expected to send
+ *  a STOP.
+ */
+void TWIEngine_Cancel(void)
+{
+	Stats_BusEvent(STATS_BUS_Resume);
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	// What is left in the rings is dropped, which also makes room for the bytes a read still takes in below
+	TWIEngine_Reset();
+
+	if (TWIEngine.State == TWI_ENGINE_Read) {
+		// A target whose byte was ACKed goes on to send the next one and holds SDA low for it, which no STOP gets
+		// past; so one more byte is clocked in and NACKed. A read decrements after storing the byte in flight.
+		const bool acked = TWIEngine_IsStalled() || !(TWIEngine_IsNackLast() && (TWIEngine.Remaining == 1));
+
+		TWI_ENGINE_FLAGS |= (1 << TWI_FLAG_NACK_LAST);
+		if (TWIEngine_IsStalled()) {
+			TWI_ENGINE_FLAGS   &= ~(1 << TWI_FLAG_STALLED);
+			TWIEngine.Remaining = 1;
+			TWIEngine_ReceiveNext();
+		} else if (acked) {
+			TWIEngine.Remaining = 2;
+		}
+	} else if (TWIEngine_IsStalled()) {
+		TWI_ENGINE_FLAGS &= ~(1 << TWI_FLAG_STALLED);
+		TWIEngine.State   = TWI_ENGINE_Idle;
+	} else if (TWIEngine_IsBusy() && (TWIEngine.State != TWI_ENGINE_Start)) {
+		// A write decrements before sending the byte in flight
+		TWIEngine.Remaining = 0;
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	TWIEngine_WaitFor(TWI_EVENT_Idle);
+
+	TWIEngine_Reset();
+}
+
+/** Initializes the ring buffers; may also be used to discard any leftover data while the engine is idle. */
+void TWIEngine_Reset(void)
+{
+	RingBuffer_InitBuffer(&TWIEngine_TxRing, TWIEngine_TxData, sizeof(TWIEngine_TxData));
+	RingBuffer_InitBuffer(&TWIEngine_RxRing, TWIEngine_RxData, sizeof(TWIEngine_RxData));
+}
+
+/** Waits for the current operation to finish, cancelling it if it takes longer than the timeout. A START that
+ *  times out on a stuck bus still fails, but with \ref AUTO_BUS_RECOVERY the bus is recovered before returning.
+ *  @return A value from the TWI_ErrorCodes_t enum
+ */
+uint8_t TWIEngine_Wait(const uint8_t timeout_ms)
+{
+	const uint16_t timeout = Timebase_MsToTicks(timeout_ms);
+	const uint16_t started = Timebase_Now();
+	bool capture_timeout   = false;
+
+	Watchdog_Kick();
+	while (TWIEngine_IsBusy()) {
+		if (Timebase_Elapsed(started) >= timeout) {
+			uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+			GlobalInterruptDisable();
+			if (TWIEngine_IsBusy()) {
+				// Running out of time while waiting for a retry means the target kept NACKing
+				if (TIMSK1 & (1 << OCIE1A)) {
+					TWIEngine.Result = TWI_ERROR_SlaveNotReady;
+				} else if ((capture_timeout = (TWIEngine.State == TWI_ENGINE_Start))) {
+					TWIEngine.Result = TWI_ERROR_BusCaptureTimeout;
+				} else {
+					TWIEngine.Result = TWI_ERROR_SlaveResponseTimeout;
+					SpeedAdapt_Note(SPEED_ADAPT_FAULTED);
+				}
+				TIMSK1 &= ~(1 << OCIE1A);
+				TWCR = (1 << TWEN);
+				TWIEngine.State  = TWI_ENGINE_Idle;
+				Probe_Off(PROBE_START);
+				Stats_BusEvent(STATS_BUS_Stop);
+			}
+			SetGlobalInterruptMask(CurrentGlobalInt);
+			break;
+		}
+	}
+
+	// A target holding a line low won't let any START through, free the bus for the next one
+	if (AUTO_BUS_RECOVERY && capture_timeout && BusRecovery_IsStuck()) {
+		uint8_t pulses;
+		BusRecovery_Run(&pulses);
+	}
+
+	return TWIEngine.Result;
+}
+
+/** Waits for the given event or the end of the current operation, whichever comes first. If the bus makes no
+ *  progress for \ref I2C_StretchTimeoutMs while the engine isn't stalled on us, the target is holding the clock;
+ *  the TWI module is then reset to let go of the bus and the operation ends with
+ *  \ref TWI_ENGINE_ERROR_StretchTimeout. A STOP afterwards is harmless, if pointless.
+ *  @return false if the operation was abandoned
+ */
+bool TWIEngine_WaitFor(const uint8_t event)
+{
+	uint16_t remaining = TWIEngine.Remaining;
+	uint16_t started   = Timebase_Now();
+	const uint16_t entered = started;
+	bool     ready;
+
+	Watchdog_Kick();
+	Probe_On(PROBE_TWINT);
+	for (;;) {
+		if (!TWIEngine_IsBusy()) {
+			ready = (TWIEngine.Result != TWI_ENGINE_ERROR_StretchTimeout);
+			break;
+		}
+		if (((event == TWI_EVENT_RxData) && !RingBuffer_IsEmpty(&TWIEngine_RxRing)) ||
+		    ((event == TWI_EVENT_TxSpace) && !RingBuffer_IsFull(&TWIEngine_TxRing))) {
+			ready = true;
+			break;
+		}
+
+		// Every byte moved restarts the clock, a stalled engine waits for us rather than the target
+		if ((TWIEngine.Remaining != remaining) || TWIEngine_IsStalled() || (TWIEngine.State == TWI_ENGINE_Start)) {
+			remaining = TWIEngine.Remaining;
+			started   = Timebase_Now();
+			Watchdog_Kick();
+			continue;
+		}
+
+		if (Timebase_Elapsed(started) >= Timebase_MsToTicks(I2C_StretchTimeoutMs)) {
+			uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+			GlobalInterruptDisable();
+			if (TWIEngine_IsBusy() && !TWIEngine_IsStalled()) {
+				TWCR = 0;
+				TWCR = (1 << TWEN);
+				TWIEngine.Result = TWI_ENGINE_ERROR_StretchTimeout;
+				TWIEngine.State  = TWI_ENGINE_Idle;
+				Trace_Add(TRACE_TIMEOUT, 0);
+				SpeedAdapt_Note(SPEED_ADAPT_FAULTED);
+				AddrStats_Timeout();
+				Stats_BusEvent(STATS_BUS_Stop);
+			}
+			SetGlobalInterruptMask(CurrentGlobalInt);
+		}
+	}
+	Probe_Off(PROBE_TWINT);
+	AddrStats_Wait(entered);
+
+	return ready;
+}
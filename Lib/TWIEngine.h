@@ -0,0 +1,169 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for TWIEngine.c.
+ */
+
+#ifndef _TWI_ENGINE_H_
+#define _TWI_ENGINE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+		#include "TargetConfig.h"
+		#include "Trace.h"
+		#include "Probe.h"
+		#include "TWIBus.h"
+		#include "BusRecovery.h"
+		#include "TargetEmu.h"
+		#include "HostNotify.h"
+		#include "Stats.h"
+		#include "AddrStats.h"
+		#include "SpeedAdapt.h"
+		#include "ClockMeter.h"
+		#include "Prefetch.h"
+		#include "Watchdog.h"
+
+		#include <LUFA/Drivers/Misc/RingBuffer.h>
+
+	/* Macros: */
+		/** Size of the ring buffer feeding write data to the TWI engine. */
+		#define TWI_ENGINE_TX_SIZE    64
+
+		/** Size of the ring buffer collecting read data from the TWI engine. */
+		#define TWI_ENGINE_RX_SIZE    64
+
+		/** The engine flags tested for every byte, in the one general purpose I/O register that SBI, CBI, SBIS
+		 *  and SBIC reach: each test or change is a single instruction, so also atomic against the interrupt.
+		 *  GPIOR1 holds USB_DeviceState (DEVICE_STATE_AS_GPIOR) and GPIOR2 \ref I2C_Status.
+		 */
+		#define TWI_ENGINE_FLAGS      GPIOR0
+
+		/** Flag in \ref TWI_ENGINE_FLAGS: TX ring ran empty or RX ring ran full, waiting for \ref TWIEngine_Kick() */
+		#define TWI_FLAG_STALLED      0
+
+		/** Flag in \ref TWI_ENGINE_FLAGS: NACK the final byte of the current read */
+		#define TWI_FLAG_NACK_LAST    1
+
+		/** Result code for an operation abandoned because the target stretched the clock for longer than
+		 *  \ref I2C_StretchTimeoutMs, in addition to the TWI_ErrorCodes_t values.
+		 */
+		#define TWI_ENGINE_ERROR_StretchTimeout  0x10
+
+		/** Flag for \ref TWIEngine_Start() marking a 10-bit address, see \ref TWI_ENGINE_TEN(). */
+		#define TWI_ENGINE_TEN_BIT    0x8000
+
+		/** Argument for \ref TWIEngine_Start() addressing the 10-bit target \c address, with \c read being 0 or
+		 *  \ref I2C_M_RD. The engine sends the 11110xx header and the low address byte, and for a read a repeated
+		 *  START with the header again.
+		 */
+		#define TWI_ENGINE_TEN(address, read)  (TWI_ENGINE_TEN_BIT | ((uint16_t)(address) << 1) | (read))
+
+	/* Enums: */
+		/** Enum for the operation the TWI engine is currently busy with. */
+		enum TWIEngine_State_t
+		{
+			TWI_ENGINE_Idle  = 0, /**< No operation in flight, TWINT is left set so the bus stays ours */
+			TWI_ENGINE_Start = 1, /**< Sending (repeated) START and address byte */
+			TWI_ENGINE_Write = 2, /**< Shifting out bytes from the TX ring */
+			TWI_ENGINE_Read  = 3, /**< Clocking in bytes into the RX ring */
+		};
+
+		/** Enum for the conditions \ref TWIEngine_WaitFor() can wait for. */
+		enum TWIEngine_Event_t
+		{
+			TWI_EVENT_Idle    = 0, /**< The current operation is finished */
+			TWI_EVENT_RxData  = 1, /**< There is a byte in the RX ring */
+			TWI_EVENT_TxSpace = 2, /**< There is room in the TX ring */
+		};
+
+		/** Enum for the progress through a 10-bit address. */
+		enum TWIEngine_TenBit_t
+		{
+			TWI_TEN_None       = 0, /**< 7-bit address */
+			TWI_TEN_Write      = 1, /**< Header and low address byte, then done */
+			TWI_TEN_Read       = 2, /**< Header and low address byte, then a repeated START */
+			TWI_TEN_ReadHeader = 3, /**< Header again with the read bit after the repeated START */
+		};
+
+	/* Type Defines: */
+		/** Type define for the state shared between the TWI interrupt and the main code. */
+		typedef struct
+		{
+			volatile uint8_t  State;     /**< Current operation, a TWIEngine_State_t value */
+			volatile uint8_t  Result;    /**< Outcome of the last operation, a TWI_ErrorCodes_t value */
+			volatile uint8_t  Status;    /**< TWSR status code behind a failed Result, TW_NO_INFO if there is none */
+			uint8_t           Address;   /**< Address byte to send after the START, the header of a 10-bit address */
+			uint8_t           AddressLow; /**< Low byte of a 10-bit address */
+			uint8_t           TenBit;    /**< Where in a 10-bit address the START is, a TWIEngine_TenBit_t value */
+			volatile uint16_t Remaining; /**< Bytes left in the current operation */
+			uint8_t           Retries;   /**< Retries left for a START whose address is NACKed */
+			uint16_t          Backoff;   /**< Timer1 ticks to wait before each retry, 0 for right away */
+			uint8_t           ArbRetries; /**< Retries left for a START that loses arbitration */
+		} TWIEngine_t;
+
+	/* External Variables: */
+		extern TWIEngine_t TWIEngine;
+		extern RingBuffer_t TWIEngine_TxRing;
+		extern RingBuffer_t TWIEngine_RxRing;
+
+	/* Inline Functions: */
+		static inline bool TWIEngine_IsBusy(void) ATTR_ALWAYS_INLINE;
+		static inline bool TWIEngine_IsBusy(void)
+		{
+			return (TWIEngine.State != TWI_ENGINE_Idle);
+		}
+
+		static inline bool TWIEngine_IsStalled(void) ATTR_ALWAYS_INLINE;
+		static inline bool TWIEngine_IsStalled(void)
+		{
+			return (TWI_ENGINE_FLAGS & (1 << TWI_FLAG_STALLED));
+		}
+
+		static inline bool TWIEngine_IsNackLast(void) ATTR_ALWAYS_INLINE;
+		static inline bool TWIEngine_IsNackLast(void)
+		{
+			return (TWI_ENGINE_FLAGS & (1 << TWI_FLAG_NACK_LAST));
+		}
+
+	/* Function Prototypes: */
+		void TWIEngine_Start(const uint16_t address);
+		void TWIEngine_Write(const uint16_t len);
+		void TWIEngine_Read(const uint16_t len, const uint8_t nack_last_byte);
+		void TWIEngine_Kick(void);
+		uint8_t TWIEngine_WriteDirect(uint8_t count) ATTR_HOT_PATH;
+		void TWIEngine_TxFromEndpoint(const uint8_t count) ATTR_HOT_PATH;
+		void TWIEngine_RxToEndpoint(const uint8_t count) ATTR_HOT_PATH;
+		void TWIEngine_Cancel(void);
+		void TWIEngine_Reset(void);
+		uint8_t TWIEngine_Wait(const uint8_t timeout_ms);
+		bool TWIEngine_WaitFor(const uint8_t event) ATTR_HOT_PATH;
+
+#endif
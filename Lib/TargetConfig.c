@@ -0,0 +1,218 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Per-target settings: targets on a shared bus may want different bus speeds,
+ * timeouts or NAK retries. Entries are looked up by address whenever the TWI
+ * engine sends a START, so switching between targets costs nothing but a
+ * short table search; targets without an entry get the defaults set through
+ * CMD_SET_BAUDRATE, CMD_SET_DELAY, CMD_SET_STRETCH and CMD_SET_RETRY.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_TARGETCONFIG_C
+#include "TargetConfig.h"
+#include "TWIEngine.h"
+
+/** Settings for all targets without an entry; the address field is unused. */
+TargetConfig_t TargetConfig_Default =
+{
+	.Address          = TARGET_CONFIG_UNUSED,
+	.StartTimeoutMs   = I2C_START_TIMEOUT_MS,
+	.StretchTimeoutMs = I2C_STRETCH_TIMEOUT_MS,
+};
+
+/** Settings for the targets that have an entry. */
+TargetConfig_t TargetConfig_Table[TARGET_CONFIG_ENTRIES];
+
+// Bus speed used for every target while CMD_SPEED_SCAN tries it, TARGET_SPEED_DEFAULT otherwise
+static uint8_t TargetConfig_ForcedPrescaler = TARGET_SPEED_DEFAULT;
+static uint8_t TargetConfig_ForcedBitRate;
+
+static TargetConfig_t* TargetConfig_Find(const uint8_t address)
+{
+	for (uint8_t i = 0; i < TARGET_CONFIG_ENTRIES; i++)
+		if (TargetConfig_Table[i].Address == address)
+			return &TargetConfig_Table[i];
+
+	return NULL;
+}
+
+/** Forgets all per-target settings. */
+void TargetConfig_Clear(void)
+{
+	for (uint8_t i = 0; i < TARGET_CONFIG_ENTRIES; i++)
+		TargetConfig_Table[i].Address = TARGET_CONFIG_UNUSED;
+}
+
+/** Creates or replaces the entry for a target from a CMD_SET_TARGET data stage of \ref TARGET_CONFIG_SIZE_FLAGS
+ *  bytes; the flags byte is zero if the host sent the short form.
+ *  @return false if the table is full
+ */
+bool TargetConfig_Set(const uint8_t address, const uint8_t* const data)
+{
+	TargetConfig_t entry;
+	const uint16_t khz = data[0] | (data[1] << 8);
+
+	entry.Address = address;
+	if (khz)
+		I2C_CalcSpeed(khz, &entry.Prescaler, &entry.BitRate);
+	else
+		entry.Prescaler = TARGET_SPEED_DEFAULT;
+	entry.StartTimeoutMs   = data[2];
+	entry.StretchTimeoutMs = data[3];
+	entry.Retries          = data[4];
+	entry.Backoff          = Timebase_UsToTicks(data[5] | (data[6] << 8));
+	entry.Flags            = data[7];
+
+	TargetConfig_t* slot = TargetConfig_Find(address);
+	if (!slot)
+		slot = TargetConfig_Find(TARGET_CONFIG_UNUSED);
+	if (!slot)
+		return false;
+
+	// The main loop may be looking the table up right now
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+	*slot = entry;
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	return true;
+}
+
+/** Drops the entry for a target, if there is one. */
+void TargetConfig_Remove(const uint8_t address)
+{
+	TargetConfig_t* slot = TargetConfig_Find(address);
+	if (slot)
+		slot->Address = TARGET_CONFIG_UNUSED;
+}
+
+/** Switches bus speed, timeouts and retries over to the settings for the given 7-bit address. Called for every
+ *  START while the bus is ours and idle, so the speed can be changed without disabling the TWI.
+ */
+void TargetConfig_Apply(const uint8_t address)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const TargetConfig_t* entry = TargetConfig_Find(address);
+	if (!entry)
+		entry = &TargetConfig_Default;
+
+	uint8_t prescaler = TargetConfig_Default.Prescaler;
+	uint8_t bit_rate  = TargetConfig_Default.BitRate;
+
+	if (entry->Prescaler != TARGET_SPEED_DEFAULT) {
+		prescaler = entry->Prescaler;
+		bit_rate  = entry->BitRate;
+	}
+
+	// A speed scan must see the bus at the speed it tries, and its failures say nothing about the others
+	if (TargetConfig_ForcedPrescaler != TARGET_SPEED_DEFAULT) {
+		prescaler = TargetConfig_ForcedPrescaler;
+		bit_rate  = TargetConfig_ForcedBitRate;
+		SpeedAdapt_Forget();
+	} else {
+		SpeedAdapt_Apply(&prescaler, &bit_rate);
+	}
+
+	TWSR = prescaler;
+	TWBR = bit_rate;
+
+	I2C_StartTimeoutMs   = entry->StartTimeoutMs   ? entry->StartTimeoutMs   : TargetConfig_Default.StartTimeoutMs;
+	I2C_StretchTimeoutMs = entry->StretchTimeoutMs ? entry->StretchTimeoutMs : TargetConfig_Default.StretchTimeoutMs;
+	TWIEngine.Retries    = entry->Retries;
+	TWIEngine.Backoff    = entry->Backoff;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Returns the TARGET_FLAG_* bits for the given 7-bit address. */
+uint8_t TargetConfig_GetFlags(const uint8_t address)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const TargetConfig_t* entry = TargetConfig_Find(address);
+	const uint8_t flags = entry ? entry->Flags : 0;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	return flags;
+}
+
+/** Sets the NAK retry policy for all targets without an entry; the backoff is the time between a NACKed address
+ *  and the next attempt, during which the bus is free.
+ */
+void TargetConfig_SetRetries(const uint8_t retries, const uint16_t backoff_us)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	TargetConfig_Default.Retries = retries;
+	TargetConfig_Default.Backoff = Timebase_UsToTicks(backoff_us);
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Sets the bus speed of a target, keeping the other settings of its entry or creating one with the defaults.
+ *  @return false if the target has no entry and the table is full
+ */
+bool TargetConfig_SetSpeed(const uint8_t address, const uint16_t khz)
+{
+	TargetConfig_t* slot = TargetConfig_Find(address);
+	const bool fresh     = !slot;
+
+	if (fresh)
+		slot = TargetConfig_Find(TARGET_CONFIG_UNUSED);
+	if (!slot)
+		return false;
+
+	uint8_t prescaler;
+	uint8_t bit_rate;
+	I2C_CalcSpeed(khz, &prescaler, &bit_rate);
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	if (fresh) {
+		memset(slot, 0, sizeof(*slot));
+		slot->Address = address;
+	}
+	slot->Prescaler = prescaler;
+	slot->BitRate   = bit_rate;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	return true;
+}
+
+/** Makes every START run at the given speed, whatever the target's settings, until called again with a prescaler
+ *  of \ref TARGET_SPEED_DEFAULT.
+ */
+void TargetConfig_ForceSpeed(const uint8_t prescaler, const uint8_t bit_rate)
+{
+	TargetConfig_ForcedPrescaler = prescaler;
+	TargetConfig_ForcedBitRate   = bit_rate;
+}
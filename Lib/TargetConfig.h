@@ -0,0 +1,94 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for TargetConfig.c.
+ */
+
+#ifndef _TARGET_CONFIG_H_
+#define _TARGET_CONFIG_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "SpeedAdapt.h"
+
+	/* Macros: */
+		/** Number of targets that can have settings of their own. */
+		#define TARGET_CONFIG_ENTRIES  8
+
+		/** Address marking a free entry. */
+		#define TARGET_CONFIG_UNUSED   0xFF
+
+		/** Prescaler marking an entry that runs at the default bus speed. */
+		#define TARGET_SPEED_DEFAULT   0xFF
+
+		/** Size of the CMD_SET_TARGET data stage: speed in kHz (16 bit), START timeout, stretch timeout, retries,
+		 *  retry backoff in microseconds (16 bit).
+		 */
+		#define TARGET_CONFIG_SIZE     7
+
+		/** Size of the CMD_SET_TARGET data stage with the optional TARGET_FLAG_* byte appended. */
+		#define TARGET_CONFIG_SIZE_FLAGS  8
+
+		/** Target flags, all off for targets without an entry. */
+		#define TARGET_FLAG_AUTOINC    (1 << 0) /**< Register pointer auto-increments, bulk REGWRITEs may be merged */
+
+	/* Type Defines: */
+		/** Type define for the settings applied to every START addressing a given target. */
+		typedef struct
+		{
+			uint8_t Address;          /**< 7-bit target address, \ref TARGET_CONFIG_UNUSED for a free entry */
+			uint8_t Prescaler;        /**< TWSR prescaler bits, \ref TARGET_SPEED_DEFAULT for the bus speed */
+			uint8_t BitRate;          /**< TWBR value */
+			uint8_t StartTimeoutMs;   /**< Bus capture and address timeout, 0 for the default */
+			uint8_t StretchTimeoutMs; /**< Longest clock stretch within a byte, 0 for the default */
+			uint8_t Retries;          /**< Number of times a NACKed address is retried */
+			uint16_t Backoff;         /**< Time between a NACK and the next retry in Timer1 ticks, 0 for right away */
+			uint8_t Flags;            /**< TARGET_FLAG_* bits */
+		} TargetConfig_t;
+
+	/* External Variables: */
+		extern TargetConfig_t TargetConfig_Default;
+		extern TargetConfig_t TargetConfig_Table[TARGET_CONFIG_ENTRIES];
+
+	/* Function Prototypes: */
+		void TargetConfig_Clear(void);
+		bool TargetConfig_Set(const uint8_t address, const uint8_t* const data);
+		void TargetConfig_Remove(const uint8_t address);
+		void TargetConfig_Apply(const uint8_t address);
+		uint8_t TargetConfig_GetFlags(const uint8_t address);
+		void TargetConfig_SetRetries(const uint8_t retries, const uint16_t backoff_us);
+		bool TargetConfig_SetSpeed(const uint8_t address, const uint16_t khz);
+		void TargetConfig_ForceSpeed(const uint8_t prescaler, const uint8_t bit_rate);
+
+		#if defined(__INCLUDE_FROM_TARGETCONFIG_C)
+			static TargetConfig_t* TargetConfig_Find(const uint8_t address);
+		#endif
+
+#endif
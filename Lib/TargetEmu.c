@@ -0,0 +1,145 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_TARGETEMU_C
+#include "TargetEmu.h"
+
+#if EMU_SUPPORT
+
+uint8_t Emu_Registers[EMU_REGISTERS];
+Emu_State_t Emu;
+
+/** Has the TWI answer to a 7-bit address as a target with the register file \ref Emu_Registers, which keeps its
+ *  contents from before. With \c bits above 0 the TWI address mask ignores that many low address bits, so it
+ *  answers to a block of 2^bits addresses from \c address on, each a target of its own with an equal window of
+ *  the register file, in address order. The bus is claimed for the emulation until \ref Emu_Stop(), so the
+ *  master paths report it as busy meanwhile.
+ *  @return false if another path is in the middle of a transaction
+ */
+bool Emu_Start(const uint8_t address, const uint8_t bits)
+{
+	if (!I2C_ClaimBus(BUS_OWNER_EMU))
+		return false;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	Emu.Pending    = 0;
+	Emu.Selecting  = false;
+	Emu.Written    = false;
+	Emu.TargetMask = (1 << bits) - 1;
+	Emu.WindowMask = (EMU_REGISTERS >> bits) - 1;
+	for (uint8_t i = 0; i < EMU_TARGETS; i++)
+		Emu.Pointers[i] = (i & Emu.TargetMask) * (Emu.WindowMask + 1);
+	TWAR  = (address & ~Emu.TargetMask) << 1;
+	TWAMR = Emu.TargetMask << 1;
+	TWCR = (1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+	Emu.Active = true;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	return true;
+}
+
+/** Stops answering, a transaction in progress is cut off, and gives the bus back to the master paths. */
+void Emu_Stop(void)
+{
+	if (!Emu.Active)
+		return;
+
+	// Turning the TWI off and on lets go of a clock held low in the middle of a byte
+	Emu.Active = false;
+	TWIBus_Abort();
+	TWAR  = 0;
+	TWAMR = 0;
+	I2C_ReleaseBus();
+}
+
+/** Sets the EMU_PROFILE_* bits that shape how one target behaves beyond the plain register file, taking effect
+ *  with its next transaction. Profiles outlast \ref Emu_Stop() just like the registers.
+ */
+void Emu_SetProfile(const uint8_t target, const uint8_t profile)
+{
+	if (target < EMU_TARGETS)
+		Emu.Profiles[target] = profile;
+}
+
+/** Stores \c count values in the register file from \c reg on, wrapping around, all in one go so a master never
+ *  reads a mix of old and new bytes.
+ */
+void Emu_Update(uint8_t reg, const uint8_t* const values, const uint8_t count)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	for (uint8_t i = 0; i < count; i++) {
+		Emu_Registers[reg & EMU_REGISTER_MASK] = values[i];
+		reg++;
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Copies \c count values from the register file from \c reg on, wrapping around, as one consistent snapshot. */
+void Emu_Fetch(uint8_t reg, uint8_t* const values, const uint8_t count)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	for (uint8_t i = 0; i < count; i++) {
+		values[i] = Emu_Registers[reg & EMU_REGISTER_MASK];
+		reg++;
+	}
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Reports the transactions the emulated target saw as events, the first register of the last write and of the
+ *  last read since the previous call. Called from the main loop.
+ */
+void Emu_Task(void)
+{
+	if (!Emu.Pending)
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint8_t pending     = Emu.Pending;
+	const uint8_t write_start = Emu.WriteStart;
+	const uint8_t read_start  = Emu.ReadStart;
+	Emu.Pending = 0;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	if (pending & EMU_PENDING_WRITE)
+		Events_Push(EVENT_EMU_WRITE, write_start);
+	if (pending & EMU_PENDING_READ)
+		Events_Push(EVENT_EMU_READ, read_start);
+}
+
+#endif
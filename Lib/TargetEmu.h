@@ -0,0 +1,198 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for TargetEmu.c.
+ */
+
+#ifndef _TARGET_EMU_H_
+#define _TARGET_EMU_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "EventQueue.h"
+		#include "TWIBus.h"
+
+		#include <util/twi.h>
+
+	/* Macros: */
+		/** Mask for register numbers wrapping around the register file. */
+		#define EMU_REGISTER_MASK    (EMU_REGISTERS - 1)
+
+		/** Most low address bits \ref Emu_Start() can mask, so the most targets emulated at once. */
+		#define EMU_MAX_ADDRESS_BITS 3
+		#define EMU_TARGETS          (1 << EMU_MAX_ADDRESS_BITS)
+
+		/** Behavior profile bits of one emulated target, see \ref Emu_SetProfile(). */
+		#define EMU_PROFILE_FIXED          (1 << 0) /**< The pointer stays put, as on a FIFO data register */
+		#define EMU_PROFILE_READ_ONLY      (1 << 1) /**< Data written is acknowledged but dropped */
+		#define EMU_PROFILE_CLEAR_ON_READ  (1 << 2) /**< Registers read out become zero, as status latches do */
+
+		/** Bits of \ref Emu_State_t.Pending, set by the TWI interrupt for \ref Emu_Task() to report. */
+		#define EMU_PENDING_WRITE    (1 << 0)
+		#define EMU_PENDING_READ     (1 << 1)
+
+		#if (EMU_REGISTERS > 256) || (EMU_REGISTERS < EMU_TARGETS) || (EMU_REGISTERS & (EMU_REGISTERS - 1))
+			#error EMU_REGISTERS must be a power of two from 8 up to 256
+		#endif
+
+	/* Type Defines: */
+		/** Type define for the state of the emulated targets, shared between the TWI interrupt and the main loop. The
+		 *  register file is split into equal windows, one per target, and register numbers here index the whole file.
+		 */
+		typedef struct
+		{
+			bool             Active;     /**< The TWI answers to the emulated addresses */
+			uint8_t          TargetMask; /**< Low address bits that select the target */
+			uint8_t          WindowMask; /**< Registers per target, minus one */
+			uint8_t          Base;       /**< First register of the current transaction's target */
+			uint8_t          Profile;    /**< EMU_PROFILE_* bits of the current transaction's target */
+			uint8_t*         Pointer;    /**< The current target's entry in Pointers */
+			uint8_t          Pointers[EMU_TARGETS]; /**< Register the next byte of each target goes to or comes from */
+			uint8_t          Profiles[EMU_TARGETS]; /**< EMU_PROFILE_* bits of each target */
+			bool             Selecting;  /**< The next byte written sets the pointer */
+			bool             Written;    /**< The current write transaction has stored data */
+			uint8_t          First;      /**< First register of the current transaction */
+			volatile uint8_t Pending;    /**< EMU_PENDING_* bits of finished transactions */
+			volatile uint8_t WriteStart; /**< First register of the last finished write */
+			volatile uint8_t ReadStart;  /**< First register of the last finished read */
+		} Emu_State_t;
+
+	/* External Variables: */
+		#if EMU_SUPPORT
+			extern uint8_t Emu_Registers[EMU_REGISTERS];
+			extern Emu_State_t Emu;
+		#endif
+
+	/* Inline Functions: */
+		#if EMU_SUPPORT
+		/** Tells whether the adapter is emulating a target; inlined as the TWI interrupt asks on bus faults. */
+		static inline bool Emu_IsActive(void) ATTR_ALWAYS_INLINE;
+		static inline bool Emu_IsActive(void)
+		{
+			return Emu.Active;
+		}
+
+		/** Moves on to the target the address byte just received in TWDR selects, through the address bits masked
+		 *  by TWAMR.
+		 */
+		static inline void Emu_Select(void) ATTR_ALWAYS_INLINE;
+		static inline void Emu_Select(void)
+		{
+			const uint8_t target = (TWDR >> 1) & Emu.TargetMask;
+
+			Emu.Base    = target * (Emu.WindowMask + 1);
+			Emu.Profile = Emu.Profiles[target];
+			Emu.Pointer = &Emu.Pointers[target];
+		}
+
+		/** Steps the current target's pointer, wrapping around its window, unless its profile keeps it in place. */
+		static inline void Emu_Advance(void) ATTR_ALWAYS_INLINE;
+		static inline void Emu_Advance(void)
+		{
+			if (!(Emu.Profile & EMU_PROFILE_FIXED))
+				*Emu.Pointer = Emu.Base | ((*Emu.Pointer + 1) & Emu.WindowMask);
+		}
+
+		/** Serves one slave mode state of the TWI, called by its interrupt. A write sets the register pointer of the
+		 *  addressed target with its first byte and stores the rest from there on, a read returns the registers from
+		 *  the pointer on, both wrapping around the target's window of the register file. Inlined so the master states
+		 *  don't pay for a call in the interrupt.
+		 */
+		static inline void Emu_Service(const uint8_t status) ATTR_ALWAYS_INLINE;
+		static inline void Emu_Service(const uint8_t status)
+		{
+			switch (status) {
+				case TW_SR_SLA_ACK:
+				case TW_SR_ARB_LOST_SLA_ACK:
+					Emu_Select();
+					Emu.Selecting = true;
+					Emu.Written   = false;
+					break;
+
+				case TW_SR_DATA_ACK:
+					if (Emu.Selecting) {
+						*Emu.Pointer  = Emu.Base | (TWDR & Emu.WindowMask);
+						Emu.First     = *Emu.Pointer;
+						Emu.Selecting = false;
+					} else if (!(Emu.Profile & EMU_PROFILE_READ_ONLY)) {
+						Emu_Registers[*Emu.Pointer] = TWDR;
+						Emu_Advance();
+						Emu.Written = true;
+					}
+					break;
+
+				case TW_SR_STOP:
+					// STOP or repeated START; a write that only set the pointer is the first half of a read
+					if (Emu.Written) {
+						Emu.WriteStart = Emu.First;
+						Emu.Pending   |= EMU_PENDING_WRITE;
+						Emu.Written    = false;
+					}
+					break;
+
+				case TW_ST_SLA_ACK:
+				case TW_ST_ARB_LOST_SLA_ACK:
+					Emu_Select();
+					Emu.First = *Emu.Pointer;
+					/* Fall through */
+				case TW_ST_DATA_ACK:
+					TWDR = Emu_Registers[*Emu.Pointer];
+					if (Emu.Profile & EMU_PROFILE_CLEAR_ON_READ)
+						Emu_Registers[*Emu.Pointer] = 0;
+					Emu_Advance();
+					break;
+
+				default:
+					// TW_ST_DATA_NACK or TW_ST_LAST_DATA: the master is done reading, the TWI goes back to listening
+					Emu.ReadStart = Emu.First;
+					Emu.Pending  |= EMU_PENDING_READ;
+					break;
+			}
+
+			TWCR = (1 << TWINT) | (1 << TWEA) | (1 << TWEN) | (1 << TWIE);
+		}
+		#else
+		/* Without EMU_SUPPORT no target is ever emulated, so there is nothing to stop or report. */
+		static inline void Emu_Stop(void) {}
+		static inline bool Emu_IsActive(void) { return false; }
+		static inline void Emu_Task(void) {}
+		#endif
+
+	/* Function Prototypes: */
+		#if EMU_SUPPORT
+			bool Emu_Start(const uint8_t address, const uint8_t bits);
+			void Emu_Stop(void);
+			void Emu_SetProfile(const uint8_t target, const uint8_t profile);
+			void Emu_Update(uint8_t reg, const uint8_t* const values, const uint8_t count);
+			void Emu_Fetch(uint8_t reg, uint8_t* const values, const uint8_t count);
+			void Emu_Task(void);
+		#endif
+
+#endif
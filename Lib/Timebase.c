@@ -0,0 +1,105 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * USB frame timestamps. Every Start of Frame latches the Timer1 count, so a
+ * timestamp can be given as the frame number plus the Timer1 ticks since
+ * that frame began. All devices on a bus see the same frame numbers, which
+ * lets the host line up records from several adapters.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "Timebase.h"
+
+volatile uint16_t Timebase_Frame;
+volatile uint16_t Timebase_FrameStart;
+volatile bool     Timebase_Held;
+
+/** Advances the frame count, called from the USB Start of Frame event. The count follows the 11-bit USB frame
+ *  number, so its low bits always match the frame number and missed SOFs are caught up; frames lost in a suspend
+ *  longer than 2 seconds are only counted modulo 2048. An SOF held up by \ref Timebase_Held doesn't stamp the
+ *  frame start, it is extrapolated from the last one instead.
+ */
+void Timebase_StartOfFrame(void)
+{
+	const uint16_t stamp  = TCNT1;
+	const uint16_t frames = (USB_Device_GetFrameNumber() - Timebase_Frame) & TIMEBASE_FRAME_MASK;
+
+	Timebase_Frame     += frames;
+	Timebase_FrameStart = Timebase_Held ? Timebase_FrameStart + frames * TIMEBASE_TICKS_PER_MS : stamp;
+	Timebase_Held       = false;
+}
+
+/** Returns the current frame count. */
+uint16_t Timebase_GetFrame(void)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint16_t frame = Timebase_Frame;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	return frame;
+}
+
+/** Returns the Timer1 ticks left until \c offset ticks past the Start of Frame of the given 11-bit USB frame number,
+ *  negative once that moment has passed, saturating at the int16_t range. Frames up to 1024 ahead count as coming,
+ *  those up to 1024 back as gone by; a coming frame's start is extrapolated at \ref TIMEBASE_TICKS_PER_MS per frame
+ *  from the last one, which is exact to well below a tick by the time that frame is next.
+ */
+int16_t Timebase_TicksUntil(const uint16_t frame, const uint16_t offset)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint16_t count = Timebase_Frame;
+	const uint16_t ticks = TCNT1 - Timebase_FrameStart;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	int16_t frames = (frame - count) & TIMEBASE_FRAME_MASK;
+	if (frames > (TIMEBASE_FRAME_MASK / 2))
+		frames -= TIMEBASE_FRAME_MASK + 1;
+
+	const int32_t left = (int32_t)frames * TIMEBASE_TICKS_PER_MS + offset - ticks;
+	return (left > INT16_MAX) ? INT16_MAX : (left < INT16_MIN) ? INT16_MIN : left;
+}
+
+/** Returns the current frame count and stores the Timer1 ticks since the start of that frame in \c subframe,
+ *  saturating at 255 in case the SOF interrupt is held up.
+ */
+uint16_t Timebase_FrameStamp(uint8_t* const subframe)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	const uint16_t frame = Timebase_Frame;
+	const uint16_t ticks = TCNT1 - Timebase_FrameStart;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+
+	*subframe = (ticks > UINT8_MAX) ? UINT8_MAX : ticks;
+	return frame;
+}
@@ -0,0 +1,108 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Free running Timer1 time base for timeouts and service time measurements. Timer1 counts at F_CPU/64,
+ *  i.e. 4 us per tick at 16 MHz, and wraps after 65536 ticks; intervals are measured by subtracting two
+ *  16-bit stamps, which is fine for anything shorter than the wrap time.
+ */
+
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+	/* Includes: */
+		#include <avr/io.h>
+
+		#include <LUFA/Common/Common.h>
+		#include <LUFA/Drivers/USB/USB.h>
+
+	/* Macros: */
+		/** Number of Timer1 ticks per millisecond. */
+		#define TIMEBASE_TICKS_PER_MS    (F_CPU / 64 / 1000)
+
+		/** Bits of the frame count that mirror the USB frame number. */
+		#define TIMEBASE_FRAME_MASK      0x07FF
+
+	/* External Variables: */
+		extern volatile uint16_t Timebase_Frame;
+		extern volatile uint16_t Timebase_FrameStart;
+		extern volatile bool     Timebase_Held;
+
+	/* Inline Functions: */
+		/** Starts Timer1 in normal mode, counting at F_CPU/64. */
+		static inline void Timebase_Init(void)
+		{
+			TCCR1A = 0;
+			TCCR1B = (1 << CS11) | (1 << CS10);
+		}
+
+		/** Returns the current tick count. Safe to call from both the main loop and interrupts; the 16-bit
+		 *  read goes through the shared TEMP register which an interrupt could otherwise clobber halfway.
+		 */
+		static inline uint16_t Timebase_Now(void) ATTR_ALWAYS_INLINE;
+		static inline uint16_t Timebase_Now(void)
+		{
+			uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+			GlobalInterruptDisable();
+
+			uint16_t now = TCNT1;
+
+			SetGlobalInterruptMask(CurrentGlobalInt);
+			return now;
+		}
+
+		/** Returns the number of ticks passed since the given stamp. */
+		static inline uint16_t Timebase_Elapsed(const uint16_t since) ATTR_ALWAYS_INLINE;
+		static inline uint16_t Timebase_Elapsed(const uint16_t since)
+		{
+			return Timebase_Now() - since;
+		}
+
+		/** Converts a timeout in milliseconds to ticks, saturating at the wrap time. */
+		static inline uint16_t Timebase_MsToTicks(const uint8_t ms) ATTR_ALWAYS_INLINE;
+		static inline uint16_t Timebase_MsToTicks(const uint8_t ms)
+		{
+			const uint32_t ticks = (uint32_t)ms * TIMEBASE_TICKS_PER_MS;
+			return (ticks > UINT16_MAX) ? UINT16_MAX : ticks;
+		}
+
+		/** Converts a time in microseconds to ticks, rounding up so that nonzero times stay nonzero. */
+		static inline uint16_t Timebase_UsToTicks(const uint16_t us) ATTR_ALWAYS_INLINE;
+		static inline uint16_t Timebase_UsToTicks(const uint16_t us)
+		{
+			return ((uint32_t)us * TIMEBASE_TICKS_PER_MS + 999) / 1000;
+		}
+
+	/* Function Prototypes: */
+		void Timebase_StartOfFrame(void);
+		uint16_t Timebase_GetFrame(void);
+		uint16_t Timebase_FrameStamp(uint8_t* const subframe);
+		int16_t Timebase_TicksUntil(const uint16_t frame, const uint16_t offset);
+
+#endif
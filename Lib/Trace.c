@@ -0,0 +1,94 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include "Trace.h"
+
+#if TRACE_SUPPORT
+
+Trace_t Trace;
+
+// Set while the buffer is on its way to the host, so the host gets a consistent snapshot
+static volatile uint8_t Trace_Paused;
+
+/** Empties the trace buffer. */
+void Trace_Reset(void)
+{
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	memset(&Trace, 0, sizeof(Trace));
+	Trace.TickRateKHz = TIMEBASE_TICKS_PER_MS;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Appends a record, overwriting the oldest one if the buffer is full. Use \ref Trace_Add() instead. */
+void Trace_Record(const uint8_t type, const uint8_t arg)
+{
+	if (Trace_Paused)
+		return;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	Trace_Record_t* record = &Trace.Records[Trace.Head];
+	record->Type      = type;
+	record->Arg       = arg;
+	record->Frame     = Timebase_FrameStamp(&record->Subframe);
+
+	if (++Trace.Head == TRACE_ENTRIES)
+		Trace.Head = 0;
+	if (Trace.Count < TRACE_ENTRIES)
+		Trace.Count++;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+}
+
+/** Sends the trace buffer as the data stage of the current control request. Nothing is recorded meanwhile. */
+void Trace_Send(void)
+{
+	Trace_Paused = true;
+	Endpoint_Write_Control_Stream_LE(&Trace, sizeof(Trace));
+	Trace_Paused = false;
+}
+
+#else
+
+void Trace_Reset(void)
+{
+}
+
+void Trace_Record(const uint8_t type, const uint8_t arg)
+{
+}
+
+void Trace_Send(void)
+{
+}
+
+#endif
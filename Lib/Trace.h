@@ -0,0 +1,115 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for Trace.c.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+
+	/* Macros: */
+		/** Trace record types. */
+		#define TRACE_START        0x01 /**< (Repeated) START sent, arg: address byte */
+		#define TRACE_ACK          0x02 /**< Address ACKed */
+		#define TRACE_NAK          0x03 /**< Address NACKed, arg: retries left */
+		#define TRACE_WRITE        0x04 /**< Write started, arg: byte count, 255 for 255 or more */
+		#define TRACE_READ         0x05 /**< Read started, arg: byte count, 255 for 255 or more */
+		#define TRACE_STOP         0x06 /**< STOP sent */
+		#define TRACE_FAULT        0x07 /**< Bus fault or lost arbitration, arg: TWI status */
+		#define TRACE_TIMEOUT      0x08 /**< Clock stretch timeout */
+		#define TRACE_RECOVERY     0x09 /**< Bus recovery, arg: clock pulses it took, 255 if the bus stayed stuck */
+		#define TRACE_REQUEST      0x10 /**< Control request started, arg: bRequest */
+		#define TRACE_REQUEST_END  0x11 /**< Control request done, arg: I2C_Status */
+		#define TRACE_BULK_OUT     0x12 /**< Bulk command packet picked up, arg: packet size */
+		#define TRACE_ABORT        0x13 /**< Control data stage cut short, arg: ENDPOINT_RWCSTREAM_* code */
+		#define TRACE_LOCK         0x14 /**< Bulk bus lock taken or dropped, arg: 1 taken, 0 unlocked, 2 ran out */
+		#define TRACE_UNDERRUN     0x15 /**< Bulk STREAM sample late, arg: underrun count, low byte */
+		#define TRACE_LATE         0x16 /**< Scheduled batch segment started late, arg: frames late, 255 for 255 or more */
+		#define TRACE_SNIFF        0x17 /**< Bus sniffer started (arg 1) or stopped (arg 0) */
+		#define TRACE_ARB_LOST     0x18 /**< START lost arbitration and is sent again, arg: retries left */
+		#define TRACE_SPEED        0x19 /**< Adaptive speed limit changed, arg: new level, 0 for no limit */
+		#define TRACE_WAKEUP       0x1A /**< Remote wakeup signalled, arg: WAKEUP_* bit of what asked for it */
+		#define TRACE_CANCEL       0x1B /**< CMD_CANCEL carried out, arg: CANCEL_FLAG_* bits */
+		#define TRACE_EXPIRED      0x1C /**< BATCH past its deadline, arg: segments skipped */
+		#define TRACE_POST_FAILED  0x1D /**< A posted command failed, arg: its tag */
+		#define TRACE_SYNC         0x1E /**< A BATCH armed by BULK_OP_SYNC started, arg: 0 on the edge, 1 without one */
+
+	/* Type Defines: */
+		/** Type define for one trace record. */
+		typedef struct
+		{
+			uint8_t  Type;      /**< TRACE_* record type */
+			uint8_t  Arg;       /**< Type specific argument */
+			uint16_t Frame;     /**< Frame count, see \ref Timebase_FrameStamp() */
+			uint8_t  Subframe;  /**< Timer1 ticks since the start of the frame */
+		} ATTR_PACKED Trace_Record_t;
+
+		/** Type define for the trace buffer returned by CMD_GET_TRACE. Records are kept in a ring: once it is full,
+		 *  \c Head is the oldest record and every new one overwrites it.
+		 */
+		typedef struct
+		{
+			uint16_t       TickRateKHz;             /**< Timer1 tick rate */
+			uint8_t        Head;                    /**< Index of the next record to be written */
+			uint8_t        Count;                   /**< Number of valid records */
+			Trace_Record_t Records[TRACE_ENTRIES];  /**< Record ring */
+		} Trace_t;
+
+	/* External Variables: */
+		#if TRACE_SUPPORT
+			extern Trace_t Trace;
+		#endif
+
+	/* Function Prototypes: */
+		void Trace_Reset(void);
+		void Trace_Record(const uint8_t type, const uint8_t arg);
+		void Trace_Send(void);
+
+	/* Inline Functions: */
+		/** Adds a record to the trace, compiled out unless TRACE_SUPPORT is set. Safe to call from interrupts. */
+		static inline void Trace_Add(const uint8_t type, const uint8_t arg) ATTR_ALWAYS_INLINE;
+		static inline void Trace_Add(const uint8_t type, const uint8_t arg)
+		{
+			if (TRACE_SUPPORT)
+				Trace_Record(type, arg);
+		}
+
+		/** Adds a record with a 16-bit count, saturating at 255. */
+		static inline void Trace_AddCount(const uint8_t type, const uint16_t count) ATTR_ALWAYS_INLINE;
+		static inline void Trace_AddCount(const uint8_t type, const uint16_t count)
+		{
+			Trace_Add(type, (count > UINT8_MAX) ? UINT8_MAX : count);
+		}
+
+#endif
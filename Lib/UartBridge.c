@@ -0,0 +1,178 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define  __INCLUDE_FROM_UARTBRIDGE_C
+#include "UartBridge.h"
+#include "BulkProtocol.h"
+#include "PollEngine.h"
+#include "BusSniffer.h"
+
+#if UART_SUPPORT
+
+// Most data bytes in one record, which always fills a packet of its own
+#define UART_RECORD_DATA      (VENDOR_IO_EPSIZE - UART_RECORD_HEADER)
+
+static RingBuffer_t Uart_RxRing;
+static RingBuffer_t Uart_TxRing;
+static uint8_t Uart_RxData[UART_RX_SIZE];
+static uint8_t Uart_TxData[UART_TX_SIZE];
+
+static bool Uart_Active;
+
+// Arrival of the first byte in the RX ring not yet claimed by a record, and bytes dropped since the last record
+static volatile bool Uart_Stamped;
+static uint16_t Uart_StampFrame;
+static uint8_t Uart_StampSubframe;
+static volatile uint8_t Uart_Lost;
+
+ISR(USART1_RX_vect)
+{
+	const uint8_t value = UDR1;
+
+	if (RingBuffer_IsFull(&Uart_RxRing)) {
+		if (Uart_Lost < UINT8_MAX)
+			Uart_Lost++;
+		return;
+	}
+
+	if (!Uart_Stamped) {
+		Uart_StampFrame = Timebase_FrameStamp(&Uart_StampSubframe);
+		Uart_Stamped = true;
+	}
+	RingBuffer_Insert(&Uart_RxRing, value);
+}
+
+ISR(USART1_UDRE_vect)
+{
+	if (RingBuffer_IsEmpty(&Uart_TxRing))
+		UCSR1B &= ~(1 << UDRIE1);
+	else
+		UDR1 = RingBuffer_Remove(&Uart_TxRing);
+}
+
+/** Opens the USART (RXD1 on PD2, TXD1 on PD3, 8N1) at the given baud rate, or restarts it at a new one. What comes
+ *  in is timestamped and sent to the host by \ref Uart_Task() as records among the other bulk IN traffic.
+ *  @return false for a baud rate of 0
+ */
+bool Uart_Start(const uint32_t baud)
+{
+	if (!baud)
+		return false;
+
+	Uart_Stop();
+
+	RingBuffer_InitBuffer(&Uart_RxRing, Uart_RxData, sizeof(Uart_RxData));
+	RingBuffer_InitBuffer(&Uart_TxRing, Uart_TxData, sizeof(Uart_TxData));
+	Uart_Stamped = false;
+	Uart_Lost    = 0;
+	Uart_Active  = true;
+
+	power_usart1_enable();
+	Serial_Init(baud, true);
+	UCSR1B |= (1 << RXCIE1);
+	return true;
+}
+
+/** Closes the USART, dropping data not sent in either direction yet. */
+void Uart_Stop(void)
+{
+	if (!Uart_Active)
+		return;
+
+	Serial_Disable();
+	power_usart1_disable();
+	Uart_Active = false;
+}
+
+/** Tells whether the UART is open. */
+bool Uart_IsActive(void)
+{
+	return Uart_Active;
+}
+
+/** Queues a byte for sending, waiting for room in the TX ring; dropped if the UART isn't open. */
+void Uart_Write(const uint8_t value)
+{
+	if (!Uart_Active)
+		return;
+
+	while (RingBuffer_IsFull(&Uart_TxRing));
+	RingBuffer_Insert(&Uart_TxRing, value);
+	UCSR1B |= (1 << UDRIE1);
+}
+
+/** Sends what the UART received as a record, once a packet's worth is in or the frame of its first byte is over,
+ *  so a steady stream goes out in full packets and a lone line within a millisecond. Called from the main loop.
+ */
+void Uart_Task(void)
+{
+	if (!Uart_Active || !Uart_Stamped || !I2C_IsBulkActive() || Bulk_ResponsePending())
+		return;
+
+	if ((RingBuffer_GetCount(&Uart_RxRing) < UART_RECORD_DATA) && (Timebase_GetFrame() == Uart_StampFrame))
+		return;
+
+	// Samples and sniffer records must not end up in the middle of the record, and the host has to be reading
+	Poll_Flush();
+	Sniff_Flush();
+	Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+	if (!Endpoint_IsINReady())
+		return;
+
+	// Bytes coming in from here on, beyond this record, get a stamp of their own
+	uint16_t count;
+	uint16_t frame;
+	uint8_t subframe;
+	uint8_t lost;
+
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
+
+	count     = RingBuffer_GetCount(&Uart_RxRing);
+	frame     = Uart_StampFrame;
+	subframe  = Uart_StampSubframe;
+	lost      = Uart_Lost;
+	Uart_Lost = 0;
+	if (count <= UART_RECORD_DATA)
+		Uart_Stamped = false;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	if (count > UART_RECORD_DATA)
+		count = UART_RECORD_DATA;
+
+	Endpoint_Write_8(UART_RECORD_MARKER);
+	Endpoint_Write_16_LE(frame);
+	Endpoint_Write_8(subframe);
+	Endpoint_Write_8(lost);
+	Endpoint_Write_8(count);
+	while (count--)
+		Endpoint_Write_8(RingBuffer_Remove(&Uart_RxRing));
+	I2C_ClearVendorIN();
+}
+
+#endif
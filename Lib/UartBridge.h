@@ -0,0 +1,71 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for UartBridge.c.
+ */
+
+#ifndef _UART_BRIDGE_H_
+#define _UART_BRIDGE_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+		#include "Timebase.h"
+
+		#include <LUFA/Drivers/Peripheral/Serial.h>
+		#include <LUFA/Drivers/Misc/RingBuffer.h>
+
+	/* Macros: */
+		/** First byte of a UART record, distinct from the entry index of a poll record and the sniffer records. */
+		#define UART_RECORD_MARKER    0xF5
+
+		/** Size of the UART record header: marker, 16-bit frame count and Timer1 ticks into the frame for the first
+		 *  byte, bytes lost to a full buffer before it (saturating) and the data length.
+		 */
+		#define UART_RECORD_HEADER    6
+
+	/* Function Prototypes: */
+		#if UART_SUPPORT
+			bool Uart_Start(const uint32_t baud);
+			void Uart_Stop(void);
+			bool Uart_IsActive(void);
+			void Uart_Write(const uint8_t value);
+			void Uart_Task(void);
+		#endif
+
+	/* Inline Functions: */
+		#if !UART_SUPPORT
+			/* Without UART_SUPPORT the UART is never opened, so there is nothing to stop or forward. */
+			static inline void Uart_Stop(void) {}
+			static inline bool Uart_IsActive(void) { return false; }
+			static inline void Uart_Task(void) {}
+		#endif
+
+#endif
+
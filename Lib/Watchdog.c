@@ -0,0 +1,148 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/** \file
+ *
+ *  Hang detection. The watchdog runs in interrupt and reset mode: the first timeout only takes \c WDT_vect, and
+ *  only the second one resets the chip. The interrupt resets the TWI and ends the operation of the TWI engine with
+ *  a bus fault, which gets every wait on the TWI out of its loop; the main loop then sees what happened and frees
+ *  the bus. The USB connection isn't touched, so the host merely sees the transaction in flight fail. Taking the
+ *  interrupt clears WDIE, so if the main loop doesn't come round to arm it again in time, the next timeout resets
+ *  the chip; the host library reconnects and restores its settings then. A hang with interrupts off goes straight
+ *  to the reset, as the interrupt can't be taken.
+ *
+ *  The main loop kicks the watchdog once per round, and so does every loop that waits on the host, which a paused
+ *  host may keep going for any time. A bootloader may clear MCUSR before starting the firmware, so a reset of the
+ *  second stage is also told by the tripped flag left in .noinit; a power-up or brown-out starts the counts over.
+ */
+
+#define  __INCLUDE_FROM_WATCHDOG_C
+#include "Watchdog.h"
+#include "BusRecovery.h"
+#include "Stats.h"
+#include "TWIEngine.h"
+
+static Watchdog_State_t Watchdog_State ATTR_NO_INIT;
+
+// MCUSR as this reset left it
+static uint8_t Watchdog_Cause;
+
+/** Takes over from whatever the bootloader or the fuses left the watchdog at, counts a watchdog reset and arms
+ *  the watchdog. Call first thing in SetupHardware().
+ */
+void Watchdog_Init(void)
+{
+	Watchdog_Cause = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+
+	if ((Watchdog_Cause & ((1 << PORF) | (1 << BORF))) || (Watchdog_State.Magic != WATCHDOG_MAGIC)) {
+		Watchdog_State.Magic      = WATCHDOG_MAGIC;
+		Watchdog_State.Resets     = 0;
+		Watchdog_State.Recoveries = 0;
+		Watchdog_State.Tripped    = false;
+	}
+
+	if (Watchdog_State.Tripped) {
+		Watchdog_Cause |= (1 << WDRF);
+		Watchdog_State.Tripped = false;
+	}
+	if ((Watchdog_Cause & (1 << WDRF)) && (Watchdog_State.Resets < UINT16_MAX))
+		Watchdog_State.Resets++;
+
+	Watchdog_Arm();
+}
+
+/** Starts the watchdog in interrupt and reset mode, see the file comment. */
+void Watchdog_Arm(void)
+{
+	#if WATCHDOG_SUPPORT
+	wdt_enable(WATCHDOG_TIMEOUT);
+	WDTCSR |= (1 << WDIE);
+	#endif
+}
+
+/** Stops the watchdog, for a USB suspend, where the CPU sleeps until the host wakes it up. */
+void Watchdog_Disarm(void)
+{
+	wdt_disable();
+}
+
+/** Kicks the watchdog, and recovers the bus after the first timeout: a line held low is clocked free, otherwise
+ *  the TWI is set up again from scratch.
+ */
+void Watchdog_Task(void)
+{
+	#if WATCHDOG_SUPPORT
+	wdt_reset();
+
+	if (!Watchdog_State.Tripped)
+		return;
+
+	if (BusRecovery_IsStuck()) {
+		uint8_t pulses;
+		BusRecovery_Run(&pulses);
+	} else {
+		TWI_Init(TargetConfig_Default.Prescaler, TargetConfig_Default.BitRate);
+	}
+	TWIEngine_Reset();
+
+	if (Watchdog_State.Recoveries < UINT16_MAX)
+		Watchdog_State.Recoveries++;
+	Watchdog_State.Tripped = false;
+	WDTCSR |= (1 << WDIE);
+	#endif
+}
+
+/** Fills in the watchdog fields of \ref Stats for CMD_GET_STATS. */
+void Watchdog_FillStats(void)
+{
+	Stats.WatchdogResets     = Watchdog_State.Resets;
+	Stats.WatchdogRecoveries = Watchdog_State.Recoveries;
+	Stats.ResetCause         = Watchdog_Cause;
+}
+
+#if WATCHDOG_SUPPORT
+// First timeout: the main loop is stuck, most likely waiting on the TWI. Resetting it and ending the engine's
+// operation gets every such wait out of its loop.
+ISR(WDT_vect)
+{
+	Watchdog_State.Tripped = true;
+
+	TIMSK1 &= ~(1 << OCIE1A);
+	TWCR = 0;
+	TWCR = (1 << TWEN);
+	TWI_ENGINE_FLAGS &= ~(1 << TWI_FLAG_STALLED);
+	if (TWIEngine_IsBusy()) {
+		TWIEngine.Result = TWI_ERROR_BusFault;
+		TWIEngine.State  = TWI_ENGINE_Idle;
+		Stats_BusEvent(STATS_BUS_Stop);
+	}
+}
+#endif
@@ -0,0 +1,71 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+/** \file
+ *
+ *  Header file for Watchdog.c.
+ */
+
+#ifndef _WATCHDOG_H_
+#define _WATCHDOG_H_
+
+	/* Includes: */
+		#include "../i2c-tiny-usb.h"
+
+	/* Macros: */
+		/** Marks the .noinit state of Watchdog.c as set up, rather than what a power-up left in SRAM. */
+		#define WATCHDOG_MAGIC         0x5744
+
+	/* Type Defines: */
+		/** Type define for the state kept across watchdog resets. */
+		typedef struct
+		{
+			uint16_t Magic;       /**< \ref WATCHDOG_MAGIC while the state is valid */
+			uint16_t Resets;      /**< Watchdog resets since power-up */
+			uint16_t Recoveries;  /**< Hangs the first timeout got the main loop out of, without a reset */
+			uint8_t  Tripped;     /**< First timeout taken, the main loop hasn't recovered from it yet */
+		} Watchdog_State_t;
+
+	/* Inline Functions: */
+		/** Restarts the watchdog timeout; for loops waiting on the host, which are not hangs however long they take. */
+		static inline void Watchdog_Kick(void) ATTR_ALWAYS_INLINE;
+		static inline void Watchdog_Kick(void)
+		{
+			if (WATCHDOG_SUPPORT)
+				wdt_reset();
+		}
+
+	/* Function Prototypes: */
+		void Watchdog_Init(void);
+		void Watchdog_Arm(void);
+		void Watchdog_Disarm(void);
+		void Watchdog_Task(void);
+		void Watchdog_FillStats(void);
+
+#endif
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Static cycle estimates for the inner loops of firmware functions, from the avr-objdump disassembly of the ELF:
+#   avr-objdump -d i2c-tiny-usb.elf | python3 avr-cycles.py I2C_Write I2C_Read
+# or just "make cycles" at the top level. Every backward branch within a function closes a loop, which is reported
+# with one pass through each of its instructions: conditional branches and skips not taken, the closing branch
+# taken, calls at the cost of the call alone. That is no substitute for a simulator, but the numbers move with
+# every instruction added to or dropped from a loop, so diffing the output before and after a change shows what it
+# did to the hot paths. Offsets are relative to the function, so the output diffs cleanly when code moves.
+
+import argparse
+import re
+import sys
+
+# Cycles on the AVRe+ core of the ATmegaXU4 (16-bit PC), 1 for anything not listed
+CYCLES = {
+    "adiw": 2, "sbiw": 2, "mul": 2, "muls": 2, "mulsu": 2, "fmul": 2, "fmuls": 2, "fmulsu": 2,
+    "ld": 2, "ldd": 2, "lds": 2, "st": 2, "std": 2, "sts": 2, "push": 2, "pop": 2,
+    "sbi": 2, "cbi": 2, "rjmp": 2, "ijmp": 2,
+    "lpm": 3, "elpm": 3, "jmp": 3, "rcall": 3, "icall": 3,
+    "call": 4, "ret": 4, "reti": 4,
+}
+
+BRANCHES = {"rjmp", "jmp"} | {
+    "br" + cond for cond in ("eq", "ne", "cs", "cc", "sh", "lo", "mi", "pl", "ge", "lt", "hs", "hc", "ts", "tc",
+                             "vs", "vc", "ie", "id", "bs", "bc")
+}
+CALLS = {"rcall", "call", "icall"}
+
+FUNC_RE = re.compile(r"^([0-9a-f]+) <(.+)>:$")
+INSN_RE = re.compile(r"^\s*([0-9a-f]+):\t([0-9a-f ]+?)\s*\t(\S+)\s*(.*)$")
+TARGET_RE = re.compile(r";\s*0x([0-9a-f]+)(?: <([^>+]+))?")
+
+
+def parse(lines):
+    """Returns {function: [(address, size, mnemonic, target, callee)]} from avr-objdump -d output."""
+    funcs, insns = {}, None
+    for line in lines:
+        line = line.rstrip("\n")
+        m = FUNC_RE.match(line)
+        if m:
+            insns = funcs.setdefault(m.group(2), [])
+            continue
+        m = INSN_RE.match(line)
+        if not m or insns is None:
+            continue
+        address, size, mnemonic = int(m.group(1), 16), len(m.group(2).split()), m.group(3)
+        target, callee = None, None
+        t = TARGET_RE.search(m.group(4))
+        if t:
+            target, callee = int(t.group(1), 16), t.group(2)
+        insns.append((address, size, mnemonic, target, callee))
+    return funcs
+
+
+def cycles(mnemonic, closing):
+    if mnemonic.startswith("br"):
+        return 2 if closing else 1
+    return CYCLES.get(mnemonic, 1)
+
+
+def report(name, insns, out):
+    if not insns:
+        print("%-24s  not found, inlined into its callers?" % name, file=out)
+        return
+    start = insns[0][0]
+    size = sum(i[1] for i in insns)
+    print("%-24s  %5u bytes  %4u insns" % (name, size, len(insns)), file=out)
+
+    for n, (address, _, mnemonic, target, _) in enumerate(insns):
+        if mnemonic not in BRANCHES or target is None or not start <= target <= address:
+            continue
+        body = [i for i in insns[: n + 1] if i[0] >= target]
+        total = sum(cycles(i[2], i is body[-1]) for i in body)
+        calls = sorted({i[4] or "?" for i in body if i[2] in CALLS})
+        print("  loop +0x%04x..+0x%04x  %4u insns  %4u cycles%s" % (
+            target - start, address - start, len(body), total,
+            ("  calls " + ", ".join(calls)) if calls else ""), file=out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Estimate cycles of the loops in firmware functions")
+    parser.add_argument("functions", nargs="+", help="function names, e.g. I2C_Write or __vector_36")
+    parser.add_argument("-d", "--disassembly", type=argparse.FileType("r"), default=sys.stdin,
+                        help="avr-objdump -d output, default stdin")
+    args = parser.parse_args()
+
+    funcs = parse(args.disassembly)
+    for name in args.functions:
+        report(name, funcs.get(name), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
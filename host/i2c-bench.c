@@ -0,0 +1,1115 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - host side benchmark
+ *
+ * Runs a set of workloads against the adapter and a target on its bus and
+ * reports transactions per second, payload throughput and p50/p99 latency
+ * per workload, payload size and bus speed. Read workloads are harmless on
+ * pretty much any target; write workloads actually write to the target and
+ * need to be enabled explicitly with -W. With -N the workloads run on
+ * several adapters at once, one thread each, to see where the host's USB
+ * scheduling rather than the firmware becomes the limit. -S is a soak test
+ * mixing workloads for hours, with percentiles logged per interval. -T
+ * compares the transports on the same register read, and -J prints the
+ * results as JSON lines tagged with the host OS and USB controller.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <sys/utsname.h>
+#endif
+#include <libusb.h>
+
+#include "protocol.h"
+
+#define TIMEOUT_MS  1000
+#define MAX_SIZE    4096
+#define MAX_ADAPTERS 64
+#define MAX_PORTS   7
+
+// Workload result for a target that didn't ACK, as opposed to negative libusb errors
+#define NAKED       1
+
+struct bench {
+	libusb_device_handle *dev;
+	uint8_t addr;
+	uint8_t reg;
+	int hid;        // Interrupt endpoints carrying 64 byte reports, see bulk()
+	int meter;      // Report byte times from CMD_CLOCK_METER, see -C
+	uint32_t extensions;
+	char name[32];  // bus-port.port... as in sysfs, for -N
+	char hub[32];   // The same without the last port, the hub the adapter hangs off
+	uint8_t bus;    // Bus number, one per host controller
+	int json;       // Print results as JSON lines, see -J
+
+	// Result of the last measure()
+	double *lat;
+	unsigned done, errors;
+	double seconds;
+
+	uint8_t buf[MAX_SIZE + 16];
+	uint8_t out[MAX_SIZE + 16];
+};
+
+struct workload {
+	const char *name;
+	int writes;     // Modifies the target, only run with -W
+	uint32_t needs; // FUNC_EXT_* bits the firmware must advertise
+	unsigned min_size;
+	int (*run)(struct bench *b, unsigned size);
+};
+
+static int ctrl(struct bench *b, uint8_t dir, uint8_t cmd, uint16_t value, uint16_t index,
+                uint8_t *data, uint16_t len)
+{
+	int ret = libusb_control_transfer(b->dev, dir | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                                  cmd, value, index, data, len, TIMEOUT_MS);
+	return (ret < 0) ? ret : 0;
+}
+
+// Extension bits of the flashed firmware, 0 for stock firmware which only returns the first word
+static uint32_t get_extensions(struct bench *b)
+{
+	uint8_t info[FUNC_INFO_SIZE];
+	int ret = libusb_control_transfer(b->dev, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                                  CMD_GET_FUNC, 0, 0, info, sizeof(info), TIMEOUT_MS);
+	if (ret < 8)
+		return 0;
+	return info[4] | info[5] << 8 | info[6] << 16 | (uint32_t)info[7] << 24;
+}
+
+// Second extension word, 0 for firmware that doesn't have one
+static uint32_t get_extensions2(struct bench *b)
+{
+	uint8_t info[FUNC_INFO_SIZE];
+	int ret = libusb_control_transfer(b->dev, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                                  CMD_GET_FUNC, 0, 0, info, sizeof(info), TIMEOUT_MS);
+	if (ret < 16)
+		return 0;
+	return info[12] | info[13] << 8 | info[14] << 16 | (uint32_t)info[15] << 24;
+}
+
+// Prints what the clock meter saw during a measurement: the byte times and the clock rate they amount to
+static void print_meter(struct bench *b)
+{
+	uint8_t m[CLOCK_METER_RESPONSE];
+
+	if (ctrl(b, LIBUSB_ENDPOINT_IN, CMD_CLOCK_METER, CLOCK_METER_STOP, 0, m, sizeof(m)))
+		return;
+
+	unsigned tick_khz = m[0] | m[1] << 8;
+	uint32_t bytes = m[8] | m[9] << 8 | m[10] << 16 | (uint32_t)m[11] << 24;
+	unsigned min = m[12] | m[13] << 8, max = m[14] | m[15] << 8;
+
+	if (!bytes || !tick_khz) {
+		printf("         clock meter: no byte times, is SCL wired to T0?\n");
+		return;
+	}
+	printf("         clock meter: %u byte times, %.1f to %s%.1f us, %.0f kHz at best\n", (unsigned)bytes,
+	       min * 1e3 / tick_khz, (max == 0xFFFF) ? ">" : "", max * 1e3 / tick_khz, 9.0 * tick_khz / min);
+}
+
+// Prints the stack high-water mark since the repaint before the first workload
+static void print_memory(struct bench *b)
+{
+	uint8_t m[MEMORY_RESPONSE];
+
+	if (ctrl(b, LIBUSB_ENDPOINT_IN, CMD_GET_MEMORY, 0, 0, m, sizeof(m)))
+		return;
+
+	unsigned ram = m[0] | m[1] << 8, used = m[2] | m[3] << 8, free = m[4] | m[5] << 8;
+	printf("SRAM: %u bytes, %u static, stack peaked at %u, %u never touched\n", ram, used, ram - used - free, free);
+}
+
+static int get_status(struct bench *b)
+{
+	uint8_t status;
+	int ret = ctrl(b, LIBUSB_ENDPOINT_IN, CMD_GET_STATUS, 0, 0, &status, 1);
+	if (ret)
+		return ret;
+	return (status == STATUS_ADDRESS_ACK) ? 0 : NAKED;
+}
+
+static int io(struct bench *b, uint8_t flags, int read, uint8_t *data, uint16_t len)
+{
+	return ctrl(b, read ? LIBUSB_ENDPOINT_IN : LIBUSB_ENDPOINT_OUT, CMD_I2C_IO | flags,
+	            read ? I2C_M_RD : 0, b->addr, data, len);
+}
+
+// Send a bulk command stream and collect the expected number of response bytes
+static int bulk(struct bench *b, uint8_t *cmd, int cmd_len, uint8_t *resp, int resp_len)
+{
+	uint8_t report[I2CTU_EP_SIZE];
+	int done, ret;
+
+	if (!b->hid) {
+		ret = libusb_bulk_transfer(b->dev, I2CTU_EP_BULK_OUT, cmd, cmd_len, &done, TIMEOUT_MS);
+		if (ret)
+			return ret;
+
+		while (resp_len > 0) {
+			ret = libusb_bulk_transfer(b->dev, I2CTU_EP_BULK_IN, resp, resp_len, &done, TIMEOUT_MS);
+			if (ret)
+				return ret;
+			resp += done;
+			resp_len -= done;
+		}
+		return 0;
+	}
+
+	// Over HID the response only goes out once its report is full or flushed, what follows it is padding
+	memcpy(b->out, cmd, cmd_len);
+	b->out[cmd_len++] = BULK_OP_FLUSH;
+	ret = libusb_interrupt_transfer(b->dev, I2CTU_EP_BULK_OUT, b->out, cmd_len, &done, TIMEOUT_MS);
+	if (ret)
+		return ret;
+
+	while (resp_len > 0) {
+		ret = libusb_interrupt_transfer(b->dev, I2CTU_EP_BULK_IN, report, sizeof(report), &done, TIMEOUT_MS);
+		if (ret)
+			return ret;
+		if (done > resp_len)
+			done = resp_len;
+		memcpy(resp, report, done);
+		resp += done;
+		resp_len -= done;
+	}
+	return 0;
+}
+
+static int ctrl_read(struct bench *b, unsigned size)
+{
+	int ret = io(b, CMD_I2C_IO_BEGIN | CMD_I2C_IO_END, 1, b->buf, size);
+	return ret ? ret : get_status(b);
+}
+
+static int ctrl_read_inline(struct bench *b, unsigned size)
+{
+	int ret = io(b, CMD_I2C_IO_BEGIN | CMD_I2C_IO_END, 1, b->buf, size + 1);
+	if (ret)
+		return ret;
+	return (b->buf[size] == STATUS_ADDRESS_ACK) ? 0 : NAKED;
+}
+
+// BEGIN, plain and END requests making up one transaction
+static int ctrl_read_split(struct bench *b, unsigned size)
+{
+	unsigned first = size / 3, second = size / 3, third = size - first - second;
+	int ret;
+
+	if ((ret = io(b, CMD_I2C_IO_BEGIN, 1, b->buf, first)) || (ret = get_status(b)))
+		return ret;
+	if ((ret = io(b, 0, 1, b->buf + first, second)))
+		return ret;
+	return io(b, CMD_I2C_IO_END, 1, b->buf + first + second, third);
+}
+
+static int ctrl_write(struct bench *b, unsigned size)
+{
+	b->buf[0] = b->reg;
+	int ret = io(b, CMD_I2C_IO_BEGIN | CMD_I2C_IO_END, 0, b->buf, size);
+	return ret ? ret : get_status(b);
+}
+
+static int ctrl_write_split(struct bench *b, unsigned size)
+{
+	unsigned first = size / 3, second = size / 3, third = size - first - second;
+	int ret;
+
+	b->buf[0] = b->reg;
+	if ((ret = io(b, CMD_I2C_IO_BEGIN, 0, b->buf, first)) || (ret = get_status(b)))
+		return ret;
+	if ((ret = io(b, 0, 0, b->buf + first, second)))
+		return ret;
+	return io(b, CMD_I2C_IO_END, 0, b->buf + first + second, third);
+}
+
+static int bulk_read(struct bench *b, unsigned size)
+{
+	uint8_t cmd[] = { BULK_OP_START, (b->addr << 1) | 1, BULK_OP_READ, size & 0xFF, size >> 8, BULK_OP_STOP };
+	int ret = bulk(b, cmd, sizeof(cmd), b->buf, size + 1);
+	return ret ? ret : (b->buf[0] == STATUS_ADDRESS_ACK) ? 0 : NAKED;
+}
+
+static int bulk_write(struct bench *b, unsigned size)
+{
+	uint8_t *cmd = b->buf;
+	cmd[0] = BULK_OP_START;
+	cmd[1] = b->addr << 1;
+	cmd[2] = BULK_OP_WRITE;
+	cmd[3] = size & 0xFF;
+	cmd[4] = size >> 8;
+	cmd[5] = b->reg;
+	memset(cmd + 6, 0, size - 1);
+	cmd[5 + size] = BULK_OP_STOP;
+
+	uint8_t status;
+	int ret = bulk(b, cmd, size + 6, &status, 1);
+	return ret ? ret : (status == STATUS_ADDRESS_ACK) ? 0 : NAKED;
+}
+
+// Register read the way the stock driver does it: pointer write with BEGIN, read with END, status after each
+static int ctrl_io_regread(struct bench *b, unsigned size)
+{
+	int ret;
+
+	b->out[0] = b->reg;
+	if ((ret = ctrl(b, LIBUSB_ENDPOINT_OUT, CMD_I2C_IO | CMD_I2C_IO_BEGIN, 0, b->addr, b->out, 1)) ||
+	    (ret = get_status(b)))
+		return ret;
+	if ((ret = io(b, CMD_I2C_IO_END, 1, b->buf, size)))
+		return ret;
+	return get_status(b);
+}
+
+// Register read as a single control request, with the status inline
+static int ctrl_regread(struct bench *b, unsigned size)
+{
+	int ret = ctrl(b, LIBUSB_ENDPOINT_IN, CMD_I2C_REGREAD, b->reg, b->addr, b->buf, size + 1);
+	if (ret)
+		return ret;
+	return (b->buf[size] == STATUS_ADDRESS_ACK) ? 0 : NAKED;
+}
+
+// Register read as a two segment i2c_msg array: write pointer, repeated START, read
+static int batch_regread(struct bench *b, unsigned size)
+{
+	uint8_t cmd[] = { BULK_OP_BATCH, 2,
+	                  0, b->addr, 1, 0, b->reg,
+	                  BATCH_FLAG_RD, b->addr, size & 0xFF, size >> 8 };
+	int ret = bulk(b, cmd, sizeof(cmd), b->buf, size + 2);
+	if (ret)
+		return ret;
+	return (b->buf[0] == STATUS_ADDRESS_ACK && b->buf[1] == STATUS_ADDRESS_ACK) ? 0 : NAKED;
+}
+
+// Register read as bulk commands: START, pointer write, repeated START, READ, STOP
+static int bulk_regread(struct bench *b, unsigned size)
+{
+	uint8_t cmd[] = { BULK_OP_START, b->addr << 1, BULK_OP_WRITE, 1, 0, b->reg,
+	                  BULK_OP_START, (b->addr << 1) | 1, BULK_OP_READ, size & 0xFF, size >> 8, BULK_OP_STOP };
+	int ret = bulk(b, cmd, sizeof(cmd), b->buf, size + 2);
+	if (ret)
+		return ret;
+	return (b->buf[0] == STATUS_ADDRESS_ACK && b->buf[1] == STATUS_ADDRESS_ACK) ? 0 : NAKED;
+}
+
+static const struct workload workloads[] = {
+	{ "ctrl-read",        0, 0,                      0, ctrl_read },
+	{ "ctrl-read-inline", 0, FUNC_EXT_INLINE_STATUS, 0, ctrl_read_inline },
+	{ "ctrl-read-split",  0, 0,                      3, ctrl_read_split },
+	{ "ctrl-write",       1, 0,                      1, ctrl_write },
+	{ "ctrl-write-split", 1, 0,                      3, ctrl_write_split },
+	{ "bulk-read",        0, FUNC_EXT_BULK,          1, bulk_read },
+	{ "bulk-write",       1, FUNC_EXT_BULK,          1, bulk_write },
+	{ "ctrl-regread",     0, FUNC_EXT_REGREAD | FUNC_EXT_INLINE_STATUS, 0, ctrl_regread },
+	{ "batch-regread",    0, FUNC_EXT_BATCH,         1, batch_regread },
+	{ "ctrl-io-regread",  0, 0,                      1, ctrl_io_regread },
+	{ "bulk-regread",     0, FUNC_EXT_BULK,          1, bulk_regread },
+};
+
+// The same register read over each transport, for -T
+static const char *const transports[] = { "ctrl-io-regread", "ctrl-regread", "batch-regread", "bulk-regread" };
+
+// Where the numbers were taken, for the JSON lines of -J
+static char host_os[96], host_libusb[32];
+
+static void host_info(void)
+{
+	const struct libusb_version *v = libusb_get_version();
+#ifdef _WIN32
+	snprintf(host_os, sizeof(host_os), "windows");
+#else
+	struct utsname u;
+
+	if (!uname(&u))
+		snprintf(host_os, sizeof(host_os), "%s %s %s", u.sysname, u.release, u.machine);
+	else
+		snprintf(host_os, sizeof(host_os), "unknown");
+#endif
+	snprintf(host_libusb, sizeof(host_libusb), "%u.%u.%u", v->major, v->minor, v->micro);
+}
+
+// The host controller of the adapter's bus: its product string where sysfs has one, else just the bus number
+static void controller_name(unsigned bus, char *out, size_t size)
+{
+	snprintf(out, size, "bus %u", bus);
+#ifdef __linux__
+	char path[64];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/bus/usb/devices/usb%u/product", bus);
+	if ((f = fopen(path, "r"))) {
+		if (fgets(out, size, f))
+			out[strcspn(out, "\n\"\\")] = 0;
+		fclose(f);
+	}
+#endif
+}
+
+static const char *usb_speed_name(libusb_device *dev)
+{
+	switch (libusb_get_device_speed(dev)) {
+		case LIBUSB_SPEED_LOW:   return "low";
+		case LIBUSB_SPEED_FULL:  return "full";
+		case LIBUSB_SPEED_HIGH:  return "high";
+		case LIBUSB_SPEED_SUPER: return "super";
+		default:                 return "unknown";
+	}
+}
+
+// One measurement as a JSON line, latencies in us
+static void print_json(struct bench *b, const struct workload *w, unsigned size, unsigned speed)
+{
+	libusb_device *dev = libusb_get_device(b->dev);
+	unsigned bus = libusb_get_bus_number(dev);
+	char controller[64], port[32];
+	uint8_t ports[MAX_PORTS];
+	int nports = libusb_get_port_numbers(dev, ports, MAX_PORTS), len;
+
+	controller_name(bus, controller, sizeof(controller));
+	len = snprintf(port, sizeof(port), "%u-", bus);
+	for (int p = 0; p < nports && len < (int)sizeof(port); p++)
+		len += snprintf(port + len, sizeof(port) - len, p ? ".%u" : "%u", ports[p]);
+	printf("{\"os\":\"%s\",\"libusb\":\"%s\",\"controller\":\"%s\",\"bus\":%u,\"port\":\"%s\","
+	       "\"usb_speed\":\"%s\",\"hid\":%s,\"workload\":\"%s\",\"size\":%u,\"speed_khz\":%u,"
+	       "\"transactions\":%u,\"errors\":%u,\"tx_per_s\":%.1f,\"kb_per_s\":%.2f,"
+	       "\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f}\n",
+	       host_os, host_libusb, controller, bus, port, usb_speed_name(dev), b->hid ? "true" : "false",
+	       w->name, size, speed, b->done, b->errors, b->done / b->seconds, (double)b->done * size / b->seconds / 1024,
+	       b->lat[b->done / 2], b->lat[(b->done * 99) / 100], b->lat[b->done - 1]);
+	fflush(stdout);
+}
+
+static double now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Runs a workload, leaving the sorted latencies and the counts in b; the warm-up round is left to the caller.
+// @return 0, or -1 if there was no memory for the latencies
+static int measure(struct bench *b, const struct workload *w, unsigned size, unsigned iterations)
+{
+	b->lat = calloc(iterations, sizeof(*b->lat));
+	b->done = b->errors = 0;
+	if (!b->lat)
+		return -1;
+
+	double start = now_us();
+	for (unsigned i = 0; i < iterations; i++) {
+		double t = now_us();
+		int ret = w->run(b, size);
+		b->lat[b->done++] = now_us() - t;
+		if (ret)
+			b->errors++;
+		if (ret < 0) {
+			fprintf(stderr, "%s%s%s: %s\n", b->name, *b->name ? " " : "", w->name, libusb_error_name(ret));
+			break;
+		}
+	}
+	b->seconds = (now_us() - start) / 1e6;
+
+	qsort(b->lat, b->done, sizeof(*b->lat), cmp_double);
+	return 0;
+}
+
+static void run(struct bench *b, const struct workload *w, unsigned size, unsigned iterations, unsigned speed)
+{
+	// One warm-up round so setup costs don't end up in the numbers
+	w->run(b, size);
+	if (b->meter)
+		ctrl(b, LIBUSB_ENDPOINT_IN, CMD_CLOCK_METER, CLOCK_METER_START, 0, b->buf, CLOCK_METER_RESPONSE);
+
+	if (!measure(b, w, size, iterations) && b->done && b->json) {
+		print_json(b, w, size, speed);
+	} else if (b->done) {
+		printf("%7u  %-16s  %5u  %9.0f  %9.1f  %8.0f  %8.0f  %6u\n", speed, w->name, size, b->done / b->seconds,
+		       (double)b->done * size / b->seconds / 1024, b->lat[b->done / 2], b->lat[(b->done * 99) / 100],
+		       b->errors);
+		if (b->meter)
+			print_meter(b);
+	}
+	free(b->lat);
+	b->lat = NULL;
+}
+
+// One thread of a -N run
+struct worker {
+	struct bench *b;
+	const struct workload *w;
+	unsigned size, iterations;
+	pthread_barrier_t *start;
+};
+
+static void *worker(void *arg)
+{
+	struct worker *t = arg;
+
+	t->w->run(t->b, t->size);
+	pthread_barrier_wait(t->start);
+	measure(t->b, t->w, t->size, t->iterations);
+	return NULL;
+}
+
+// Adds a group line to a -N report, once per hub or bus: the rate of all its adapters together
+static void group(struct bench **benches, unsigned n, unsigned i, int by_hub)
+{
+	double rate = 0;
+	unsigned members = 0;
+
+	for (unsigned j = 0; j < i; j++)
+		if (by_hub ? !strcmp(benches[j]->hub, benches[i]->hub) : benches[j]->bus == benches[i]->bus)
+			return;
+	for (unsigned j = i; j < n; j++) {
+		if (by_hub ? strcmp(benches[j]->hub, benches[i]->hub) : benches[j]->bus != benches[i]->bus)
+			continue;
+		if (benches[j]->done)
+			rate += benches[j]->done / benches[j]->seconds;
+		members++;
+	}
+	if (by_hub)
+		printf("         hub %-12s         %3u  %9.0f\n", benches[i]->hub, members, rate);
+	else
+		printf("         bus %-12u         %3u  %9.0f\n", benches[i]->bus, members, rate);
+}
+
+// Runs a workload on the first n adapters at once and reports each of them, their hubs and buses and the total
+static void run_parallel(struct bench **benches, unsigned n, const struct workload *w, unsigned size,
+                         unsigned iterations, unsigned speed)
+{
+	struct worker workers[MAX_ADAPTERS];
+	pthread_t threads[MAX_ADAPTERS];
+	pthread_barrier_t start;
+	unsigned done = 0, errors = 0, started = 0;
+	double seconds = 0;
+
+	pthread_barrier_init(&start, NULL, n);
+	for (unsigned i = 0; i < n; i++) {
+		workers[i] = (struct worker){ benches[i], w, size, iterations, &start };
+		if (pthread_create(&threads[i], NULL, worker, &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			break;
+		}
+		started++;
+	}
+	// A thread short leaves the others stuck at the barrier, so make up for it
+	for (unsigned i = started; i < n; i++)
+		pthread_barrier_wait(&start);
+	for (unsigned i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_barrier_destroy(&start);
+
+	// All latencies together for the percentiles of the whole run
+	double *all = calloc((size_t)n * iterations, sizeof(*all));
+	for (unsigned i = 0; i < started; i++) {
+		struct bench *b = benches[i];
+
+		if (all && b->lat)
+			memcpy(all + done, b->lat, b->done * sizeof(*all));
+		done += b->done;
+		errors += b->errors;
+		if (b->seconds > seconds)
+			seconds = b->seconds;
+	}
+	if (!all || !done || seconds <= 0) {
+		free(all);
+		return;
+	}
+	qsort(all, done, sizeof(*all), cmp_double);
+
+	printf("%7u  %-16s  %5u  %3u  %9.0f  %9.1f  %8.0f  %8.0f  %6u\n", speed, w->name, size, n, done / seconds,
+	       (double)done * size / seconds / 1024, all[done / 2], all[(done * 99) / 100], errors);
+	for (unsigned i = 0; i < started; i++) {
+		struct bench *b = benches[i];
+
+		if (b->done)
+			printf("         %-16s              %9.0f  %9.1f  %8.0f  %8.0f  %6u\n", b->name, b->done / b->seconds,
+			       (double)b->done * size / b->seconds / 1024, b->lat[b->done / 2], b->lat[(b->done * 99) / 100],
+			       b->errors);
+		free(b->lat);
+		b->lat = NULL;
+	}
+	for (unsigned i = 0; i < started; i++)
+		group(benches, started, i, 1);
+	for (unsigned i = 0; i < started; i++)
+		group(benches, started, i, 0);
+	free(all);
+}
+
+// Soak test log: a header, then a record per workload and interval, little endian throughout
+#define SOAK_MAGIC       "I2CS"
+#define SOAK_VERSION     1
+#define SOAK_NAME_SIZE   16
+#define SOAK_POLL        0xFF    // Workload index of the poll stream records
+#define SOAK_WORKLOADS   16
+
+// Poll stream phase of each soak interval
+#define SOAK_POLL_MS     1000
+#define SOAK_POLL_PERIOD 2
+#define SOAK_POLL_LENGTH 2
+
+// What a soak test run collects per workload and interval
+struct soak_slot {
+	const struct workload *w;
+	unsigned size;
+	double *lat;
+	unsigned count, alloc, errors;
+	double first_p50, first_p99, last_p50, last_p99, worst_p99;
+	unsigned long long total, total_errors;
+};
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+// Writes one interval record: seconds into the run, workload index, count, errors, then p50, p99 and max in us
+static void soak_record(FILE *log, uint32_t seconds, uint8_t index, unsigned count, unsigned errors,
+                        const double *sorted)
+{
+	uint8_t r[25];
+
+	if (!log)
+		return;
+	put32(r, seconds);
+	r[4] = index;
+	put32(r + 5, count);
+	put32(r + 9, errors);
+	put32(r + 13, count ? sorted[count / 2] : 0);
+	put32(r + 17, count ? sorted[(count * 99) / 100] : 0);
+	put32(r + 21, count ? sorted[count - 1] : 0);
+	fwrite(r, sizeof(r), 1, log);
+}
+
+// Streams polling samples of the target for SOAK_POLL_MS, leaving the gaps between samples in lat (in us, from
+// their frame stamps) and the failed samples in *errors
+// @return the number of gaps, negative libusb errors
+static int soak_poll(struct bench *b, double *lat, unsigned max, unsigned *errors)
+{
+	uint8_t cmd[] = { BULK_OP_POLL, 1, b->addr, b->reg, SOAK_POLL_LENGTH, SOAK_POLL_PERIOD, 0 };
+	uint8_t stop[] = { BULK_OP_POLL, 0 };
+	uint8_t packet[I2CTU_EP_SIZE];
+	const int record = POLL_RECORD_HEADER + SOAK_POLL_LENGTH;
+	unsigned n = 0;
+	int have_last = 0, done, ret;
+	uint16_t last = 0;
+
+	*errors = 0;
+	ret = libusb_bulk_transfer(b->dev, I2CTU_EP_BULK_OUT, cmd, sizeof(cmd), &done, TIMEOUT_MS);
+	if (ret)
+		return ret;
+
+	double end = now_us() + SOAK_POLL_MS * 1e3;
+	while (now_us() < end) {
+		ret = libusb_bulk_transfer(b->dev, I2CTU_EP_BULK_IN, packet, sizeof(packet), &done, TIMEOUT_MS);
+		if (ret)
+			break;
+		for (int i = 0; i + record <= done; i += record) {
+			uint16_t frame = packet[i + 1] | packet[i + 2] << 8;
+
+			if (packet[i + 4] != STATUS_ADDRESS_ACK)
+				(*errors)++;
+			if (have_last && n < max)
+				lat[n++] = (uint16_t)(frame - last) * 1000.0;
+			last = frame;
+			have_last = 1;
+		}
+	}
+
+	// Stop and drop whatever is still on its way
+	libusb_bulk_transfer(b->dev, I2CTU_EP_BULK_OUT, stop, sizeof(stop), &done, TIMEOUT_MS);
+	while (!libusb_bulk_transfer(b->dev, I2CTU_EP_BULK_IN, packet, sizeof(packet), &done, 50))
+		;
+	return (ret && ret != LIBUSB_ERROR_TIMEOUT) ? ret : (int)n;
+}
+
+// Runs the slots in turn for the given number of minutes, reporting each interval, then sums up the drift
+static int soak(struct bench *b, struct soak_slot *slots, unsigned nslots, int poll, unsigned minutes,
+                unsigned interval, FILE *log)
+{
+	static double poll_gaps[SOAK_POLL_MS];
+	struct { double first_p99, last_p99, worst_p99; unsigned long long total, errors; } p = { 0, 0, 0, 0, 0 };
+	double start = now_us(), end = start + minutes * 60e6;
+	int ret = 0;
+
+	if (log) {
+		uint8_t h[8 + SOAK_WORKLOADS * (SOAK_NAME_SIZE + 2)];
+		unsigned len = 8;
+
+		memcpy(h, SOAK_MAGIC, 4);
+		h[4] = SOAK_VERSION;
+		h[5] = nslots;
+		h[6] = interval;
+		h[7] = interval >> 8;
+		for (unsigned i = 0; i < nslots; i++) {
+			memset(h + len, 0, SOAK_NAME_SIZE);
+			strncpy((char *)h + len, slots[i].w->name, SOAK_NAME_SIZE);
+			h[len + SOAK_NAME_SIZE] = slots[i].size;
+			h[len + SOAK_NAME_SIZE + 1] = slots[i].size >> 8;
+			len += SOAK_NAME_SIZE + 2;
+		}
+		fwrite(h, len, 1, log);
+	}
+
+	printf("   time  workload           size       ops  errors   p50 us   p99 us   max us\n");
+	for (unsigned n = 0; now_us() < end && !ret; n++) {
+		double stop = start + (n + 1) * interval * 1e6 - (poll ? SOAK_POLL_MS * 1e3 : 0);
+		uint32_t seconds = (n + 1) * interval;
+
+		// The workloads take turns, one operation each
+		for (unsigned i = 0; now_us() < stop && !ret; i = (i + 1) % nslots) {
+			struct soak_slot *s = &slots[i];
+
+			if (s->count == s->alloc) {
+				double *lat = realloc(s->lat, (s->alloc ? s->alloc * 2 : 4096) * sizeof(*lat));
+				if (!lat) {
+					ret = -1;
+					break;
+				}
+				s->lat = lat;
+				s->alloc = s->alloc ? s->alloc * 2 : 4096;
+			}
+
+			double t = now_us();
+			int r = s->w->run(b, s->size);
+			s->lat[s->count++] = now_us() - t;
+			if (r)
+				s->errors++;
+			if (r < 0) {
+				fprintf(stderr, "%s: %s\n", s->w->name, libusb_error_name(r));
+				ret = r;
+			}
+		}
+
+		for (unsigned i = 0; i < nslots; i++) {
+			struct soak_slot *s = &slots[i];
+
+			if (!s->count)
+				continue;
+			qsort(s->lat, s->count, sizeof(*s->lat), cmp_double);
+			double p50 = s->lat[s->count / 2], p99 = s->lat[(s->count * 99) / 100];
+			printf("%7u  %-16s  %5u  %8u  %6u %8.0f %8.0f %8.0f\n", (unsigned)seconds, s->w->name, s->size,
+			       s->count, s->errors, p50, p99, s->lat[s->count - 1]);
+			soak_record(log, seconds, i, s->count, s->errors, s->lat);
+
+			if (!s->total) {
+				s->first_p50 = p50;
+				s->first_p99 = p99;
+			}
+			s->last_p50 = p50;
+			s->last_p99 = p99;
+			if (p99 > s->worst_p99)
+				s->worst_p99 = p99;
+			s->total += s->count;
+			s->total_errors += s->errors;
+			s->count = s->errors = 0;
+		}
+
+		if (poll && !ret) {
+			unsigned errors;
+			int gaps = soak_poll(b, poll_gaps, SOAK_POLL_MS, &errors);
+
+			if (gaps < 0) {
+				fprintf(stderr, "poll: %s\n", libusb_error_name(gaps));
+				ret = gaps;
+			} else if (gaps) {
+				qsort(poll_gaps, gaps, sizeof(*poll_gaps), cmp_double);
+				double p99 = poll_gaps[(gaps * 99) / 100];
+				printf("%7u  %-16s  %5u  %8u  %6u %8.0f %8.0f %8.0f\n", (unsigned)seconds, "poll-gap",
+				       SOAK_POLL_LENGTH, gaps, errors, poll_gaps[gaps / 2], p99, poll_gaps[gaps - 1]);
+				soak_record(log, seconds, SOAK_POLL, gaps, errors, poll_gaps);
+
+				if (!p.total)
+					p.first_p99 = p99;
+				p.last_p99 = p99;
+				if (p99 > p.worst_p99)
+					p.worst_p99 = p99;
+				p.total += gaps;
+				p.errors += errors;
+			}
+		}
+		if (log)
+			fflush(log);
+		fflush(stdout);
+	}
+
+	// Drift: how the tail moved between the first and the last interval, and the worst one seen
+	printf("\nworkload           size         ops  error rate  p50 first/last us  p99 first/last/worst us\n");
+	for (unsigned i = 0; i < nslots; i++) {
+		const struct soak_slot *s = &slots[i];
+
+		if (!s->total)
+			continue;
+		printf("%-16s  %5u  %10llu  %10.2e  %8.0f %8.0f  %8.0f %8.0f %8.0f\n", s->w->name, s->size, s->total,
+		       (double)s->total_errors / s->total, s->first_p50, s->last_p50, s->first_p99, s->last_p99,
+		       s->worst_p99);
+		free(s->lat);
+	}
+	if (p.total)
+		printf("%-16s  %5u  %10llu  %10.2e                     %8.0f %8.0f %8.0f\n", "poll-gap", SOAK_POLL_LENGTH,
+		       p.total, (double)p.errors / p.total, p.first_p99, p.last_p99, p.worst_p99);
+	return ret;
+}
+
+// Claims the adapter's interface and finds out what its firmware can do
+// @return 0, or 1 after printing what went wrong
+static int setup(struct bench *b)
+{
+	int ret;
+
+	libusb_set_auto_detach_kernel_driver(b->dev, 1);
+	if ((ret = libusb_claim_interface(b->dev, 0))) {
+		fprintf(stderr, "%s%slibusb_claim_interface: %s\n", b->name, *b->name ? ": " : "", libusb_error_name(ret));
+		return 1;
+	}
+
+	b->extensions = get_extensions(b);
+	b->hid = !!(b->extensions & FUNC_EXT_HID);
+	if ((b->extensions & FUNC_EXT_ALT_BULK) && (ret = libusb_set_interface_alt_setting(b->dev, 0, 1))) {
+		fprintf(stderr, "%s%slibusb_set_interface_alt_setting: %s\n", b->name, *b->name ? ": " : "",
+		        libusb_error_name(ret));
+		return 1;
+	}
+	return 0;
+}
+
+// Opens every attached adapter for -N, in bus and port order so the first n of them are always the same ones
+// @return the number opened
+static unsigned open_all(struct bench **benches, const struct bench *defaults)
+{
+	libusb_device **list;
+	unsigned count = 0;
+	ssize_t n;
+
+	if ((n = libusb_get_device_list(NULL, &list)) < 0)
+		return 0;
+
+	for (ssize_t i = 0; i < n && count < MAX_ADAPTERS; i++) {
+		struct libusb_device_descriptor desc;
+		uint8_t ports[MAX_PORTS];
+		struct bench *b;
+		int nports, len;
+
+		if (libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != I2CTU_VID || desc.idProduct != I2CTU_PID)
+			continue;
+		if (!(b = malloc(sizeof(*b))))
+			break;
+		*b = *defaults;
+
+		b->bus = libusb_get_bus_number(list[i]);
+		nports = libusb_get_port_numbers(list[i], ports, MAX_PORTS);
+		len = snprintf(b->name, sizeof(b->name), "%u-", b->bus);
+		for (int p = 0; p < nports && len < (int)sizeof(b->name); p++) {
+			if (p == nports - 1)
+				snprintf(b->hub, sizeof(b->hub), "%.*s", (p ? len : len - 1), b->name);
+			len += snprintf(b->name + len, sizeof(b->name) - len, p ? ".%u" : "%u", ports[p]);
+		}
+
+		if (libusb_open(list[i], &b->dev) || setup(b)) {
+			fprintf(stderr, "%s: skipped\n", b->name);
+			if (b->dev)
+				libusb_close(b->dev);
+			free(b);
+			continue;
+		}
+
+		// Insertion sort by bus, then port path
+		unsigned j = count++;
+		while (j && (benches[j - 1]->bus > b->bus ||
+		             (benches[j - 1]->bus == b->bus && strcmp(benches[j - 1]->name, b->name) > 0))) {
+			benches[j] = benches[j - 1];
+			j--;
+		}
+		benches[j] = b;
+	}
+	libusb_free_device_list(list, 1);
+	return count;
+}
+
+static unsigned parse_list(const char *s, unsigned *out, unsigned max)
+{
+	unsigned n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoul(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "  -a ADDR   7-bit target address (default 0x50)\n"
+	        "  -r REG    register/pointer byte used by all workloads (default 0)\n"
+	        "  -n N      iterations per measurement (default 1000)\n"
+	        "  -s LIST   comma separated payload sizes (default 1,4,16,64,256)\n"
+	        "  -f LIST   comma separated bus speeds in kHz (default 100,400)\n"
+	        "  -w NAME   only run the named workload, may be given several times\n"
+	        "  -W        also run workloads that write to the target\n"
+	        "  -L        loopback mode: control workloads only, without touching the bus\n"
+	        "  -C        report byte times measured by the adapter, needs SCL wired to T0/PD7\n"
+	        "  -M        report the deepest the adapter's stack got during the run\n"
+	        "  -N LIST   comma separated adapter counts: run each measurement on that many adapters at once\n"
+	        "  -S MINS   soak test: mix the workloads for that long at the first bus speed, one line per interval\n"
+	        "  -I SECS   soak test interval (default 60)\n"
+	        "  -o FILE   soak test log with the percentiles of each interval, see the README for the format\n"
+	        "  -T        transport comparison: the same register read over each transport the firmware has\n"
+	        "  -J        print one JSON line per measurement, with the host OS and USB controller\n"
+	        "Workloads the flashed firmware does not advertise via CMD_GET_FUNC are skipped.\n",
+	        prog);
+	fprintf(stderr, "Workloads:");
+	for (unsigned i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++)
+		fprintf(stderr, " %s", workloads[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct bench b = { .addr = 0x50 };
+	unsigned sizes[16] = { 1, 4, 16, 64, 256 }, nsizes = 5;
+	unsigned speeds[16] = { 100, 400 }, nspeeds = 2;
+	unsigned iterations = 1000;
+	const char *only[16];
+	unsigned nonly = 0;
+	unsigned scale[16], nscale = 0;
+	struct bench *benches[MAX_ADAPTERS] = { &b };
+	unsigned nbenches = 1;
+	unsigned soak_minutes = 0, soak_interval = 60;
+	const char *soak_log = NULL;
+	int writes = 0, loopback = 0, memory = 0, compare = 0, opt, ret;
+	uint32_t extensions;
+
+	while ((opt = getopt(argc, argv, "a:r:n:s:f:w:WLCMN:S:I:o:TJh")) != -1) {
+		switch (opt) {
+			case 'a': b.addr = strtoul(optarg, NULL, 0); break;
+			case 'r': b.reg = strtoul(optarg, NULL, 0); break;
+			case 'n': iterations = strtoul(optarg, NULL, 0); break;
+			case 's': nsizes = parse_list(optarg, sizes, 16); break;
+			case 'f': nspeeds = parse_list(optarg, speeds, 16); break;
+			case 'w': if (nonly < 16) only[nonly++] = optarg; break;
+			case 'W': writes = 1; break;
+			case 'L': loopback = writes = 1; break;
+			case 'C': b.meter = 1; break;
+			case 'M': memory = 1; break;
+			case 'N': nscale = parse_list(optarg, scale, 16); break;
+			case 'S': soak_minutes = strtoul(optarg, NULL, 0); break;
+			case 'I': soak_interval = strtoul(optarg, NULL, 0); break;
+			case 'o': soak_log = optarg; break;
+			case 'T': compare = 1; break;
+			case 'J': b.json = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+
+	if (!iterations) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (nscale && (b.meter || memory || soak_minutes)) {
+		fprintf(stderr, "-C, -M and -S only work on a single adapter, without -N\n");
+		return 1;
+	}
+	if ((compare || b.json) && (nscale || soak_minutes)) {
+		fprintf(stderr, "-T and -J only work on a single adapter, without -N and -S\n");
+		return 1;
+	}
+	if (compare && !nonly) {
+		memcpy(only, transports, sizeof(transports));
+		nonly = sizeof(transports) / sizeof(transports[0]);
+	}
+	if (soak_minutes && (soak_interval < 2 || soak_interval > 65535)) {
+		fprintf(stderr, "The soak test interval is 2 to 65535 seconds\n");
+		return 1;
+	}
+	for (unsigned i = 0; i < nsizes; i++) {
+		if (sizes[i] > MAX_SIZE) {
+			fprintf(stderr, "Payload sizes are limited to %u bytes\n", MAX_SIZE);
+			return 1;
+		}
+	}
+
+	if ((ret = libusb_init(NULL))) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+
+	if (nscale) {
+		nbenches = open_all(benches, &b);
+		if (!nbenches) {
+			fprintf(stderr, "No adapter found\n");
+			return 1;
+		}
+	} else {
+		b.dev = libusb_open_device_with_vid_pid(NULL, I2CTU_VID, I2CTU_PID);
+		if (!b.dev) {
+			fprintf(stderr, "No adapter found\n");
+			return 1;
+		}
+		if (setup(&b))
+			return 1;
+	}
+	host_info();
+
+	// With -N only what all of the adapters can do
+	extensions = benches[0]->extensions;
+	for (unsigned i = 1; i < nbenches; i++)
+		extensions &= benches[i]->extensions;
+	if (loopback && !(extensions & FUNC_EXT_LOOPBACK)) {
+		fprintf(stderr, "Firmware does not support loopback mode\n");
+		return 1;
+	}
+	if (loopback)
+		extensions &= ~(FUNC_EXT_BULK | FUNC_EXT_BATCH);
+	if (b.meter && !(get_extensions2(&b) & FUNC_EXT2_CLOCK_METER)) {
+		fprintf(stderr, "Firmware does not support the clock meter\n");
+		return 1;
+	}
+	if (memory && !(get_extensions2(&b) & FUNC_EXT2_MEMORY)) {
+		fprintf(stderr, "Firmware does not support CMD_GET_MEMORY\n");
+		return 1;
+	}
+	if (memory)
+		ctrl(&b, LIBUSB_ENDPOINT_IN, CMD_GET_MEMORY, MEMORY_REPAINT, 0, b.buf, MEMORY_RESPONSE);
+
+	if (soak_minutes) {
+		// Without -w, the everyday mix: register reads both ways and sequential EEPROM style reads
+		static const char *const mix[] = { "ctrl-regread", "batch-regread", "bulk-read" };
+		struct soak_slot slots[SOAK_WORKLOADS];
+		unsigned nslots = 0;
+		FILE *log = NULL;
+
+		if (!nonly) {
+			memcpy(only, mix, sizeof(mix));
+			nonly = sizeof(mix) / sizeof(mix[0]);
+		}
+		for (unsigned i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+			const struct workload *w = &workloads[i];
+			int selected = 0;
+
+			for (unsigned j = 0; j < nonly; j++)
+				selected |= !strcmp(only[j], w->name);
+			if (!selected || (w->writes && !writes) || ((w->needs & extensions) != w->needs))
+				continue;
+			for (unsigned s = 0; s < nsizes && nslots < SOAK_WORKLOADS; s++)
+				if (sizes[s] >= w->min_size)
+					slots[nslots++] = (struct soak_slot){ .w = w, .size = sizes[s] };
+		}
+		if (!nslots) {
+			fprintf(stderr, "None of the workloads can run on this firmware\n");
+			return 1;
+		}
+		if (soak_log && !(log = fopen(soak_log, "wb"))) {
+			perror(soak_log);
+			return 1;
+		}
+
+		// Inline status for all of them, the workloads without it just get the status twice
+		ctrl(&b, LIBUSB_ENDPOINT_OUT, CMD_SET_BAUDRATE, speeds[0], 0, NULL, 0);
+		if (extensions & (FUNC_EXT_INLINE_STATUS | FUNC_EXT_LOOPBACK))
+			ctrl(&b, LIBUSB_ENDPOINT_OUT, CMD_SET_OPTIONS, (loopback ? OPTION_LOOPBACK : 0) |
+			     ((extensions & FUNC_EXT_INLINE_STATUS) ? OPTION_INLINE_STATUS : 0), 0, NULL, 0);
+
+		ret = soak(&b, slots, nslots, (extensions & FUNC_EXT_POLL) && !b.hid && !loopback, soak_minutes,
+		           soak_interval, log);
+		if (log)
+			fclose(log);
+		nspeeds = 0;
+	} else if (b.json)
+		;
+	else if (nscale)
+		printf("  speed  workload           size    n       tx/s       kB/s   p50 us   p99 us  errors\n");
+	else
+		printf("  speed  workload           size       tx/s       kB/s   p50 us   p99 us  errors\n");
+	for (unsigned f = 0; f < nspeeds; f++) {
+		uint8_t actual[4];
+		unsigned speed = speeds[f];
+
+		for (unsigned i = 0; i < nbenches; i++)
+			ctrl(benches[i], LIBUSB_ENDPOINT_OUT, CMD_SET_BAUDRATE, speeds[f], 0, NULL, 0);
+		if ((extensions & FUNC_EXT_GET_BAUDRATE) && !ctrl(benches[0], LIBUSB_ENDPOINT_IN, CMD_GET_BAUDRATE, 0, 0, actual, sizeof(actual)))
+			speed = (actual[0] | actual[1] << 8 | actual[2] << 16 | (unsigned)actual[3] << 24) / 1000;
+
+		for (unsigned i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+			const struct workload *w = &workloads[i];
+			int selected = !nonly;
+
+			for (unsigned j = 0; j < nonly; j++)
+				selected |= !strcmp(only[j], w->name);
+			if (!selected || (w->writes && !writes) || ((w->needs & extensions) != w->needs))
+				continue;
+
+			uint16_t options = loopback ? OPTION_LOOPBACK : 0;
+			if (w->run == ctrl_read_inline || w->run == ctrl_regread)
+				options |= OPTION_INLINE_STATUS;
+			for (unsigned j = 0; j < nbenches; j++)
+				if (extensions & (FUNC_EXT_INLINE_STATUS | FUNC_EXT_LOOPBACK))
+					ctrl(benches[j], LIBUSB_ENDPOINT_OUT, CMD_SET_OPTIONS, options, 0, NULL, 0);
+
+			for (unsigned s = 0; s < nsizes; s++) {
+				if (sizes[s] < w->min_size)
+					continue;
+				if (!nscale)
+					run(&b, w, sizes[s], iterations, speed);
+				for (unsigned j = 0; j < nscale; j++)
+					if (scale[j] && scale[j] <= nbenches)
+						run_parallel(benches, scale[j], w, sizes[s], iterations, speed);
+			}
+		}
+	}
+
+	for (unsigned i = 0; i < nbenches; i++) {
+		if (extensions & (FUNC_EXT_INLINE_STATUS | FUNC_EXT_LOOPBACK))
+			ctrl(benches[i], LIBUSB_ENDPOINT_OUT, CMD_SET_OPTIONS, 0, 0, NULL, 0);
+		if (memory)
+			print_memory(benches[i]);
+		libusb_release_interface(benches[i]->dev, 0);
+		libusb_close(benches[i]->dev);
+	}
+	libusb_exit(NULL);
+	return (soak_minutes && ret) ? 1 : 0;
+}
@@ -0,0 +1,649 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - i2c-dev compatible character device
+ *
+ * Existing tools talk to I2C buses through /dev/i2c-N and its ioctls, which
+ * for this adapter go through the kernel driver one message at a time. This
+ * CUSE server puts up a /dev/i2c-N of its own that speaks the same ioctl
+ * interface on top of the host library instead: an I2C_RDWR message array
+ * becomes a single batch, and so does each emulated I2C_SMBUS transaction
+ * and each read() or write(). It serves all openers from one event loop, so
+ * the requests of several processes arriving together share USB transfers.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define FUSE_USE_VERSION 31
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <cuse_lowlevel.h>
+#include <fuse_lowlevel.h>
+
+#include "i2ctu.h"
+#include "protocol.h"
+
+#define MAX_MSG_LEN   8192  // Same limit as i2c-dev
+#define MAX_ADAPTERS  64
+
+// I2C_SMBUS_BLOCK_DATA reads and block process calls need I2C_M_RECV_LEN, which batches can't do; neither is PEC
+#define FUNCS         (I2C_FUNC_I2C | (I2C_FUNC_SMBUS_EMUL & ~I2C_FUNC_SMBUS_PEC))
+
+// State of an open file, selected with I2C_SLAVE like on i2c-dev
+struct file_state {
+	uint16_t addr;
+	uint16_t flags;          // I2C_M_TEN or 0
+};
+
+enum { XFER_READ, XFER_WRITE, XFER_RDWR, XFER_SMBUS };
+
+// A request on its way through the adapter, answered from its callback
+struct xfer {
+	fuse_req_t req;
+	int kind;
+	int count;
+	uint32_t smbus_size;     // XFER_SMBUS: the transaction type
+	uint32_t read_len;       // Data read, at the end of buf
+	uint8_t *read;
+	struct i2ctu_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	uint8_t buf[];           // Data written, then data read
+};
+
+static struct i2ctu_dev *dev;
+
+/*
+ * Requests
+ */
+
+// Error codes as in Documentation/i2c/fault-codes.rst, like the kernel driver gives them
+static int detail_to_errno(uint8_t result, uint8_t twsr)
+{
+	switch (result) {
+		case BATCH_RESULT_OK: return 0;
+		case BATCH_RESULT_ADDRESS_NAK: return ENXIO;
+		case BATCH_RESULT_BUS_FAULT: return (twsr == TWSR_ARB_LOST) ? EAGAIN : EIO;
+		case BATCH_RESULT_CAPTURE_TIMEOUT: return EBUSY;
+		case BATCH_RESULT_RESPONSE_TIMEOUT:
+		case BATCH_RESULT_STRETCH_TIMEOUT: return ETIMEDOUT;
+		case BATCH_RESULT_BUS_BUSY: return EAGAIN;
+		default: return EIO;
+	}
+}
+
+static int result_to_errno(const struct xfer *x, int result)
+{
+	if (result < 0)
+		return (result == LIBUSB_ERROR_NO_DEVICE) ? ENODEV : (result == LIBUSB_ERROR_TIMEOUT) ? ETIMEDOUT : EIO;
+	for (int i = 0; i < x->count; i++)
+		if (x->msgs[i].result != BATCH_RESULT_OK)
+			return detail_to_errno(x->msgs[i].result, x->msgs[i].twsr);
+	switch (result) {
+		case I2CTU_OK: return 0;
+		case I2CTU_NAK: return ENXIO;
+		case I2CTU_BUSY: return EAGAIN;
+		default: return EIO;
+	}
+}
+
+static int submit_errno(int ret)
+{
+	switch (ret) {
+		case LIBUSB_ERROR_INVALID_PARAM: return EINVAL;
+		case LIBUSB_ERROR_NOT_SUPPORTED: return EOPNOTSUPP;
+		case LIBUSB_ERROR_NO_MEM: return ENOMEM;
+		case LIBUSB_ERROR_NO_DEVICE: return ENODEV;
+		default: return EIO;
+	}
+}
+
+static struct xfer *new_xfer(fuse_req_t req, int kind, uint32_t write_len, uint32_t read_len)
+{
+	struct xfer *x = calloc(1, sizeof(*x) + write_len + read_len);
+
+	if (!x)
+		return NULL;
+	x->req = req;
+	x->kind = kind;
+	x->read_len = read_len;
+	x->read = x->buf + write_len;
+	return x;
+}
+
+// The batch's segment results come back as SMBus data the way the kernel's emulation lays it out
+static void smbus_reply(struct xfer *x)
+{
+	union i2c_smbus_data data;
+	size_t len = 0;
+
+	memset(&data, 0, sizeof(data));
+	switch (x->smbus_size) {
+		case I2C_SMBUS_BYTE:
+		case I2C_SMBUS_BYTE_DATA:
+			data.byte = x->read[0];
+			len = sizeof(data.byte);
+			break;
+		case I2C_SMBUS_WORD_DATA:
+		case I2C_SMBUS_PROC_CALL:
+			data.word = x->read[0] | x->read[1] << 8;
+			len = sizeof(data.word);
+			break;
+		case I2C_SMBUS_I2C_BLOCK_BROKEN:
+		case I2C_SMBUS_I2C_BLOCK_DATA:
+			data.block[0] = x->read_len;
+			memcpy(&data.block[1], x->read, x->read_len);
+			len = sizeof(data.block);
+			break;
+	}
+	fuse_reply_ioctl(x->req, 0, &data, x->read_len ? len : 0);
+}
+
+static void xfer_done(struct i2ctu_dev *d, int result, void *user)
+{
+	struct xfer *x = user;
+	int err = result_to_errno(x, result);
+
+	(void)d;
+	if (err)
+		fuse_reply_err(x->req, err);
+	else if (x->kind == XFER_READ)
+		fuse_reply_buf(x->req, (const char *)x->read, x->read_len);
+	else if (x->kind == XFER_WRITE)
+		fuse_reply_write(x->req, x->msgs[0].len);
+	else if (x->kind == XFER_RDWR)
+		fuse_reply_ioctl(x->req, x->count, x->read, x->read_len);
+	else
+		smbus_reply(x);
+	free(x);
+}
+
+static void submit(struct xfer *x)
+{
+	int ret = i2ctu_submit_batch(dev, x->msgs, x->count, xfer_done, x);
+
+	if (ret) {
+		fuse_reply_err(x->req, submit_errno(ret));
+		free(x);
+	}
+}
+
+static void add_msg(struct xfer *x, const struct file_state *fs, uint16_t flags, uint8_t *buf, uint16_t len)
+{
+	x->msgs[x->count++] = (struct i2ctu_msg){ fs->addr, fs->flags | flags, len, buf, 0, 0 };
+}
+
+/*
+ * ioctls; CUSE has the caller's memory fetched in steps, each step asking for what the previous one revealed
+ */
+
+static void ioctl_rdwr(fuse_req_t req, void *arg, const void *in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+	struct i2c_rdwr_ioctl_data rdwr;
+	struct iovec in_iov[2 + I2C_RDWR_IOCTL_MAX_MSGS], out_iov[I2C_RDWR_IOCTL_MAX_MSGS];
+	const struct i2c_msg *msgs;
+	size_t write_len = 0, read_len = 0, head;
+	int in_count = 2, out_count = 0;
+	struct xfer *x;
+	const uint8_t *wr;
+	uint8_t *dst, *rd;
+
+	in_iov[0] = (struct iovec){ arg, sizeof(rdwr) };
+	if (in_bufsz < sizeof(rdwr)) {
+		fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+		return;
+	}
+	memcpy(&rdwr, in_buf, sizeof(rdwr));
+	if (!rdwr.nmsgs || rdwr.nmsgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+	head = sizeof(rdwr) + rdwr.nmsgs * sizeof(*msgs);
+	in_iov[1] = (struct iovec){ rdwr.msgs, rdwr.nmsgs * sizeof(*msgs) };
+	if (in_bufsz < head) {
+		fuse_reply_ioctl_retry(req, in_iov, 2, NULL, 0);
+		return;
+	}
+
+	msgs = (const struct i2c_msg *)((const uint8_t *)in_buf + sizeof(rdwr));
+	for (unsigned i = 0; i < rdwr.nmsgs; i++) {
+		if (msgs[i].len > MAX_MSG_LEN || (msgs[i].flags & ~(I2C_M_RD | I2C_M_TEN | I2C_M_NOSTART))) {
+			fuse_reply_err(req, (msgs[i].len > MAX_MSG_LEN) ? EINVAL : EOPNOTSUPP);
+			return;
+		}
+		if (msgs[i].flags & I2C_M_RD) {
+			out_iov[out_count++] = (struct iovec){ msgs[i].buf, msgs[i].len };
+			read_len += msgs[i].len;
+		} else {
+			in_iov[in_count++] = (struct iovec){ msgs[i].buf, msgs[i].len };
+			write_len += msgs[i].len;
+		}
+	}
+	if (in_bufsz != head + write_len || out_bufsz != read_len) {
+		fuse_reply_ioctl_retry(req, in_iov, in_count, out_iov, out_count);
+		return;
+	}
+
+	if (!(x = new_xfer(req, XFER_RDWR, write_len, read_len))) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	wr = (const uint8_t *)in_buf + head;
+	dst = x->buf;
+	rd = x->read;
+	for (unsigned i = 0; i < rdwr.nmsgs; i++) {
+		struct i2ctu_msg *msg = &x->msgs[x->count++];
+
+		*msg = (struct i2ctu_msg){ msgs[i].addr, msgs[i].flags, msgs[i].len, NULL, 0, 0 };
+		if (msg->flags & I2C_M_RD) {
+			msg->buf = rd;
+			rd += msg->len;
+		} else {
+			memcpy(dst, wr, msg->len);
+			msg->buf = dst;
+			dst += msg->len;
+			wr += msg->len;
+		}
+	}
+	submit(x);
+}
+
+// Bytes of union i2c_smbus_data a transaction type moves, as i2c-dev copies them
+static size_t smbus_datasize(uint32_t size)
+{
+	switch (size) {
+		case I2C_SMBUS_QUICK: return 0;
+		case I2C_SMBUS_BYTE:
+		case I2C_SMBUS_BYTE_DATA: return sizeof(uint8_t);
+		case I2C_SMBUS_WORD_DATA:
+		case I2C_SMBUS_PROC_CALL: return sizeof(uint16_t);
+		default: return sizeof(union i2c_smbus_data);
+	}
+}
+
+// SMBus emulated on plain messages, the same way the kernel does it for adapters without native SMBus
+static void ioctl_smbus(fuse_req_t req, const struct file_state *fs, void *arg, const void *in_buf, size_t in_bufsz,
+                        size_t out_bufsz)
+{
+	struct i2c_smbus_ioctl_data args;
+	struct iovec in_iov[2], out_iov[1];
+	union i2c_smbus_data data;
+	size_t datasize, want_in, want_out;
+	int rd, len;
+	struct xfer *x;
+
+	in_iov[0] = (struct iovec){ arg, sizeof(args) };
+	if (in_bufsz < sizeof(args)) {
+		fuse_reply_ioctl_retry(req, in_iov, 1, NULL, 0);
+		return;
+	}
+	memcpy(&args, in_buf, sizeof(args));
+	if (args.size == I2C_SMBUS_BLOCK_PROC_CALL ||
+	    (args.size == I2C_SMBUS_BLOCK_DATA && args.read_write == I2C_SMBUS_READ)) {
+		fuse_reply_err(req, EOPNOTSUPP);
+		return;
+	}
+	if (args.size > I2C_SMBUS_I2C_BLOCK_DATA || (args.read_write != I2C_SMBUS_READ &&
+	                                              args.read_write != I2C_SMBUS_WRITE)) {
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	// I2C block reads say how much to read in the data, process calls read back after writing
+	datasize = smbus_datasize(args.size);
+	rd = args.read_write == I2C_SMBUS_READ || args.size == I2C_SMBUS_PROC_CALL;
+	want_out = (rd && args.size != I2C_SMBUS_QUICK) ? datasize : 0;
+	want_in = sizeof(args);
+	if ((!rd && args.size > I2C_SMBUS_BYTE) || args.size == I2C_SMBUS_PROC_CALL ||
+	    args.size == I2C_SMBUS_I2C_BLOCK_DATA)
+		want_in += datasize;
+	in_iov[1] = (struct iovec){ args.data, datasize };
+	out_iov[0] = (struct iovec){ args.data, datasize };
+	if (in_bufsz != want_in || out_bufsz != want_out) {
+		fuse_reply_ioctl_retry(req, in_iov, 1 + (want_in > sizeof(args)), out_iov, !!want_out);
+		return;
+	}
+	memset(&data, 0, sizeof(data));
+	memcpy(&data, (const uint8_t *)in_buf + sizeof(args), want_in - sizeof(args));
+	if (args.size == I2C_SMBUS_I2C_BLOCK_BROKEN && rd)
+		data.block[0] = I2C_SMBUS_BLOCK_MAX;
+
+	if (args.size >= I2C_SMBUS_BLOCK_DATA && args.size != I2C_SMBUS_BLOCK_PROC_CALL &&
+	    (data.block[0] < 1 || data.block[0] > I2C_SMBUS_BLOCK_MAX)) {
+		fuse_reply_err(req, EINVAL);
+		return;
+	}
+
+	// Command byte and up to a length byte and a block written, up to a block read
+	if (!(x = new_xfer(req, XFER_SMBUS, 2 + I2C_SMBUS_BLOCK_MAX, I2C_SMBUS_BLOCK_MAX))) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	x->smbus_size = args.size;
+	x->read_len = 0;
+	x->buf[0] = args.command;
+
+	switch (args.size) {
+		case I2C_SMBUS_QUICK:
+			add_msg(x, fs, args.read_write ? I2C_M_RD : 0, x->buf, 0);
+			break;
+		case I2C_SMBUS_BYTE:
+			if (rd)
+				add_msg(x, fs, I2C_M_RD, x->read, x->read_len = 1);
+			else
+				add_msg(x, fs, 0, x->buf, 1);
+			break;
+		case I2C_SMBUS_BYTE_DATA:
+			x->buf[1] = data.byte;
+			add_msg(x, fs, 0, x->buf, rd ? 1 : 2);
+			if (rd)
+				add_msg(x, fs, I2C_M_RD, x->read, x->read_len = 1);
+			break;
+		case I2C_SMBUS_WORD_DATA:
+		case I2C_SMBUS_PROC_CALL:
+			x->buf[1] = data.word;
+			x->buf[2] = data.word >> 8;
+			add_msg(x, fs, 0, x->buf, (args.read_write == I2C_SMBUS_READ && args.size == I2C_SMBUS_WORD_DATA) ? 1 : 3);
+			if (rd)
+				add_msg(x, fs, I2C_M_RD, x->read, x->read_len = 2);
+			break;
+		case I2C_SMBUS_BLOCK_DATA:
+			len = data.block[0];
+			memcpy(&x->buf[1], data.block, 1 + len);
+			add_msg(x, fs, 0, x->buf, 2 + len);
+			break;
+		case I2C_SMBUS_I2C_BLOCK_BROKEN:
+		case I2C_SMBUS_I2C_BLOCK_DATA:
+			len = data.block[0];
+			if (rd) {
+				add_msg(x, fs, 0, x->buf, 1);
+				add_msg(x, fs, I2C_M_RD, x->read, x->read_len = len);
+			} else {
+				memcpy(&x->buf[1], &data.block[1], len);
+				add_msg(x, fs, 0, x->buf, 1 + len);
+			}
+			break;
+	}
+	submit(x);
+}
+
+static void cuse_ioctl(fuse_req_t req, int cmd, void *arg, struct fuse_file_info *fi, unsigned flags,
+                       const void *in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+	struct file_state *fs = (struct file_state *)(uintptr_t)fi->fh;
+	const unsigned long value = (uintptr_t)arg;
+	const unsigned long funcs = FUNCS;
+	struct iovec iov = { arg, sizeof(funcs) };
+
+	// The structures hold pointers, a 32-bit caller's don't match ours
+	if (flags & FUSE_IOCTL_COMPAT) {
+		fuse_reply_err(req, ENOSYS);
+		return;
+	}
+
+	switch (cmd) {
+		case I2C_SLAVE:
+		case I2C_SLAVE_FORCE:
+			// Nothing else can have claimed an address here, so both are the same
+			if (value > ((fs->flags & I2C_M_TEN) ? 0x3ff : 0x7f)) {
+				fuse_reply_err(req, EINVAL);
+				return;
+			}
+			fs->addr = value;
+			break;
+		case I2C_TENBIT:
+			fs->flags = value ? I2C_M_TEN : 0;
+			break;
+		case I2C_PEC:
+			if (value) {
+				fuse_reply_err(req, EOPNOTSUPP);
+				return;
+			}
+			break;
+		case I2C_RETRIES:
+		case I2C_TIMEOUT:
+			// The firmware has timeouts of its own and never retries
+			break;
+		case I2C_FUNCS:
+			if (!out_bufsz)
+				fuse_reply_ioctl_retry(req, NULL, 0, &iov, 1);
+			else
+				fuse_reply_ioctl(req, 0, &funcs, sizeof(funcs));
+			return;
+		case I2C_RDWR:
+			ioctl_rdwr(req, arg, in_buf, in_bufsz, out_bufsz);
+			return;
+		case I2C_SMBUS:
+			ioctl_smbus(req, fs, arg, in_buf, in_bufsz, out_bufsz);
+			return;
+		default:
+			fuse_reply_err(req, ENOTTY);
+			return;
+	}
+	fuse_reply_ioctl(req, 0, NULL, 0);
+}
+
+/*
+ * File operations
+ */
+
+static void cuse_open(fuse_req_t req, struct fuse_file_info *fi)
+{
+	struct file_state *fs = calloc(1, sizeof(*fs));
+
+	if (!fs) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	fi->fh = (uintptr_t)fs;
+	fi->direct_io = 1;
+	fi->nonseekable = 1;
+	fuse_reply_open(req, fi);
+}
+
+static void cuse_release(fuse_req_t req, struct fuse_file_info *fi)
+{
+	free((void *)(uintptr_t)fi->fh);
+	fuse_reply_err(req, 0);
+}
+
+// read() and write() are a single message to the address set with I2C_SLAVE
+static void cuse_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	struct file_state *fs = (struct file_state *)(uintptr_t)fi->fh;
+	struct xfer *x;
+
+	(void)off;
+	if (size > MAX_MSG_LEN)
+		size = MAX_MSG_LEN;
+	if (!(x = new_xfer(req, XFER_READ, 0, size))) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	add_msg(x, fs, I2C_M_RD, x->read, size);
+	submit(x);
+}
+
+static void cuse_write(fuse_req_t req, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	struct file_state *fs = (struct file_state *)(uintptr_t)fi->fh;
+	struct xfer *x;
+
+	(void)off;
+	if (size > MAX_MSG_LEN)
+		size = MAX_MSG_LEN;
+	if (!(x = new_xfer(req, XFER_WRITE, size, 0))) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	memcpy(x->buf, buf, size);
+	add_msg(x, fs, 0, x->buf, size);
+	submit(x);
+}
+
+static const struct cuse_lowlevel_ops ops = {
+	.open = cuse_open,
+	.release = cuse_release,
+	.read = cuse_read,
+	.write = cuse_write,
+	.ioctl = cuse_ioctl,
+};
+
+/*
+ * Serving
+ */
+
+// Everything the openers sent meanwhile is submitted before the flush, so their requests share transfers
+static int serve(struct fuse_session *se)
+{
+	struct fuse_buf fbuf = { .mem = NULL };
+	struct epoll_event fuse_ev = { .events = EPOLLIN }, usb_ev = { .events = EPOLLIN }, events[2];
+	const int fuse_fd = fuse_session_fd(se);
+	int epoll_fd, usb_fd, ret = 0;
+
+	if ((usb_fd = i2ctu_get_fd(dev)) < 0) {
+		fprintf(stderr, "i2ctu_get_fd: %s\n", libusb_error_name(usb_fd));
+		return 1;
+	}
+	fuse_ev.data.fd = fuse_fd;
+	usb_ev.data.fd = usb_fd;
+	if (fcntl(fuse_fd, F_SETFL, fcntl(fuse_fd, F_GETFL) | O_NONBLOCK) ||
+	    (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fuse_fd, &fuse_ev) || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, usb_fd, &usb_ev)) {
+		perror("epoll");
+		return 1;
+	}
+
+	while (!fuse_session_exited(se)) {
+		int n = epoll_wait(epoll_fd, events, 2, i2ctu_get_timeout(dev));
+
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			ret = 1;
+			break;
+		}
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.fd != fuse_fd)
+				continue;
+			for (int res; (res = fuse_session_receive_buf(se, &fbuf)) != -EAGAIN;) {
+				if (res == -EINTR)
+					continue;
+				if (res <= 0) {
+					fuse_session_exit(se);
+					break;
+				}
+				fuse_session_process_buf(se, &fbuf);
+			}
+		}
+		if (i2ctu_dispatch(dev) == LIBUSB_ERROR_NO_DEVICE) {
+			fprintf(stderr, "Adapter gone\n");
+			ret = 1;
+			break;
+		}
+	}
+	free(fbuf.mem);
+	close(epoll_fd);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "  -a INDEX  adapter to serve, in bus and port order (default 0)\n"
+	        "  -n NAME   device name (default the first free i2c-N)\n"
+	        "  -d        print the FUSE requests\n"
+	        "Serves an adapter as an i2c-dev compatible /dev device, with I2C_RDWR and SMBus transactions sent as\n"
+	        "batches. Needs access to /dev/cuse.\n",
+	        prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct i2ctu_dev *devs[MAX_ADAPTERS];
+	char name[64] = "", devname[80];
+	const char *dev_info_argv[] = { devname };
+	char *fuse_argv[] = { argv[0], "-f", "-s", NULL, NULL };
+	struct cuse_info ci = { .dev_info_argc = 1, .dev_info_argv = dev_info_argv, .flags = CUSE_UNRESTRICTED_IOCTL };
+	struct fuse_session *se;
+	int adapter = 0, count, multithreaded, opt, ret;
+
+	while ((opt = getopt(argc, argv, "a:n:dh")) != -1) {
+		switch (opt) {
+			case 'a': adapter = atoi(optarg); break;
+			case 'n': snprintf(name, sizeof(name), "%s", optarg); break;
+			case 'd': fuse_argv[3] = "-d"; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (optind != argc || adapter < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Tools find buses by number, so take one the kernel isn't using
+	for (int bus = 0; !name[0]; bus++) {
+		snprintf(devname, sizeof(devname), "/dev/i2c-%d", bus);
+		if (access(devname, F_OK))
+			snprintf(name, sizeof(name), "i2c-%d", bus);
+	}
+	snprintf(devname, sizeof(devname), "DEVNAME=%s", name);
+
+	if ((ret = libusb_init(NULL))) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+	if ((count = i2ctu_open_all(NULL, devs, MAX_ADAPTERS)) <= adapter) {
+		fprintf(stderr, "Adapter %d not found\n", adapter);
+		for (int i = 0; i < count; i++)
+			i2ctu_close(devs[i]);
+		libusb_exit(NULL);
+		return 1;
+	}
+	for (int i = 0; i < count; i++)
+		if (i != adapter)
+			i2ctu_close(devs[i]);
+	dev = devs[adapter];
+
+	ret = 1;
+	if (!(se = cuse_lowlevel_setup(fuse_argv[3] ? 4 : 3, fuse_argv, &ci, &ops, &multithreaded, NULL))) {
+		fprintf(stderr, "Can't set up /dev/%s\n", name);
+	} else {
+		printf("Serving adapter %d as /dev/%s\n", adapter, name);
+		fflush(stdout);
+		ret = serve(se);
+		cuse_lowlevel_teardown(se);
+	}
+
+	i2ctu_close(dev);
+	libusb_exit(NULL);
+	return ret;
+}
@@ -0,0 +1,589 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - poll stream logger
+ *
+ * Starts a polling job on an adapter and writes its samples to a poll log
+ * (see i2ctu_polllog.h) for as long as it runs: per entry columns of sample
+ * times, status bytes and data, in fixed size chunks that analysis tools
+ * mmap and read in place. Writing a chunk is a single pwrite() of a buffer
+ * that was filled by copying the records out of the USB packets, so even
+ * the fastest polling jobs log for days on next to no CPU. With -p it reads
+ * a log back the same way, without copying.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <libusb.h>
+
+#include "i2ctu_polllog.h"
+#include "protocol.h"
+
+#define TIMEOUT_MS      200
+#define MAX_PORTS       7
+#define READ_SIZE       (64 * I2CTU_EP_SIZE)
+#define FLUSH_MS        1000
+#define DEFAULT_CHUNK   256         // KiB
+
+struct log {
+	int fd;
+	struct i2ctu_plog_header h;
+	uint8_t *chunk;             // The chunk being filled, its index block first
+	struct i2ctu_plog_chunk *index;
+	uint32_t filled;            // Samples in the chunk, all entries together
+	uint64_t samples[I2CTU_PLOG_ENTRIES];
+	uint64_t failed[I2CTU_PLOG_ENTRIES];
+};
+
+// Where the adapter's frame stamps have got to, expanded to 64 bits
+struct clock {
+	int started;
+	int64_t frame;
+	int64_t first;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint32_t align8(uint32_t n)
+{
+	return (n + 7) & ~7u;
+}
+
+// Data bytes of each sample of an entry, as the firmware works them out
+static uint8_t sample_size(uint8_t addr, uint8_t reg, uint8_t len)
+{
+	if (addr & POLL_ADC)
+		return POLL_ADC_LENGTH;
+	if (len & POLL_PMBUS)
+		return __builtin_popcount(reg) * POLL_PMBUS_VALUE;
+	return len;
+}
+
+/*
+ * Writing
+ */
+
+// Splits a chunk between the entries, by the bytes each one is expected to fill per second
+static int layout(struct log *log)
+{
+	const struct i2ctu_plog_header *h = &log->h;
+	uint32_t room = h->chunk_size - align8(sizeof(struct i2ctu_plog_chunk)) - h->entries * 3 * 8;
+	uint32_t offset = align8(sizeof(struct i2ctu_plog_chunk));
+	double weight = 0;
+
+	for (int e = 0; e < h->entries; e++)
+		weight += (8.0 + 1 + h->entry[e].sample_size) / h->entry[e].period;
+
+	for (int e = 0; e < h->entries; e++) {
+		const struct i2ctu_plog_entry *entry = &h->entry[e];
+		struct i2ctu_plog_column *c = &log->index->column[e];
+
+		c->capacity = room / weight / entry->period;
+		if (!c->capacity)
+			return -1;
+		c->time_offset = offset;
+		offset = align8(offset + c->capacity * 8);
+		c->status_offset = offset;
+		offset = align8(offset + c->capacity);
+		c->data_offset = offset;
+		offset = align8(offset + c->capacity * entry->sample_size);
+	}
+	return (offset <= h->chunk_size) ? 0 : -1;
+}
+
+// Writes the chunk's data, then its index, so a reader never sees counts running ahead of the data
+static int flush(struct log *log)
+{
+	const off_t at = I2CTU_PLOG_HEADER_SIZE + (off_t)log->index->seq * log->h.chunk_size;
+	const size_t index = align8(sizeof(struct i2ctu_plog_chunk));
+
+	if (pwrite(log->fd, log->chunk + index, log->h.chunk_size - index, at + index) < 0 ||
+	    pwrite(log->fd, log->chunk, index, at) < 0) {
+		perror("pwrite");
+		return -1;
+	}
+	return 0;
+}
+
+static int next_chunk(struct log *log)
+{
+	log->index->flags |= I2CTU_PLOG_COMPLETE;
+	if (flush(log))
+		return -1;
+
+	log->index->seq++;
+	log->index->flags = 0;
+	log->filled = 0;
+	for (int e = 0; e < log->h.entries; e++)
+		log->index->column[e].count = 0;
+	return 0;
+}
+
+static int append(struct log *log, int e, int64_t t, uint8_t status, const uint8_t *data)
+{
+	struct i2ctu_plog_column *c = &log->index->column[e];
+	const uint8_t size = log->h.entry[e].sample_size;
+
+	if (c->count == c->capacity) {
+		if (next_chunk(log))
+			return -1;
+	}
+	memcpy(log->chunk + c->time_offset + c->count * 8, &t, 8);
+	log->chunk[c->status_offset + c->count] = status;
+	memcpy(log->chunk + c->data_offset + c->count * size, data, size);
+	c->count++;
+	if (!log->filled++ || t < log->index->first_ns)
+		log->index->first_ns = t;
+	if (log->filled == 1 || t > log->index->last_ns)
+		log->index->last_ns = t;
+	log->samples[e]++;
+	if (status != STATUS_ADDRESS_ACK)
+		log->failed[e]++;
+	return 0;
+}
+
+static int create(struct log *log, const char *path)
+{
+	uint8_t header[I2CTU_PLOG_HEADER_SIZE] = { 0 };
+
+	if (!(log->chunk = calloc(1, log->h.chunk_size)))
+		return -1;
+	log->index = (struct i2ctu_plog_chunk *)log->chunk;
+	log->index->magic = I2CTU_PLOG_CHUNK_MAGIC;
+	if (layout(log)) {
+		fprintf(stderr, "Chunks of %u KiB are too small for these entries\n", log->h.chunk_size / 1024);
+		return -1;
+	}
+
+	if ((log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		perror(path);
+		return -1;
+	}
+	memcpy(header, &log->h, sizeof(log->h));
+	if (pwrite(log->fd, header, sizeof(header), 0) < 0) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+// Puts the host time of the first sample into the header
+static int set_start(struct log *log)
+{
+	log->h.start_ns = realtime_ns();
+	if (pwrite(log->fd, &log->h, sizeof(log->h), 0) < 0) {
+		perror("pwrite");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Recording
+ */
+
+static int64_t sample_time(const struct log *log, struct clock *clk, uint16_t frame, uint32_t ticks)
+{
+	// Records come in the order they were taken, give or take one frame
+	if (!clk->started) {
+		clk->frame = clk->first = frame;
+		clk->started = 1;
+	} else {
+		clk->frame += (int16_t)(frame - (uint16_t)clk->frame);
+	}
+	return (clk->frame - clk->first) * 1000000LL + (log->h.tick_khz ? ticks * 1000000LL / log->h.tick_khz : 0);
+}
+
+// Takes the records out of one packet
+static int parse_packet(struct log *log, struct clock *clk, int compact, const uint8_t *p, int len)
+{
+	const struct i2ctu_plog_header *h = &log->h;
+	int i = 0, ret = 0;
+
+	if (compact) {
+		uint16_t frame;
+		uint32_t ticks;
+
+		if (len < POLL_PACKET_HEADER)
+			return 0;
+		frame = p[0] | p[1] << 8;
+		ticks = p[2];
+		for (i = POLL_PACKET_HEADER; i + POLL_COMPACT_HEADER <= len && !ret;) {
+			const int e = p[i] & ~POLL_COMPACT_FAILED;
+
+			if (e >= h->entries || i + POLL_COMPACT_HEADER + h->entry[e].sample_size > len)
+				break;  // Padding
+			ticks += p[i + 1];
+			ret = append(log, e, sample_time(log, clk, frame, ticks),
+			             (p[i] & POLL_COMPACT_FAILED) ? STATUS_ADDRESS_NAK : STATUS_ADDRESS_ACK,
+			             p + i + POLL_COMPACT_HEADER);
+			i += POLL_COMPACT_HEADER + h->entry[e].sample_size;
+		}
+		return ret;
+	}
+
+	while (i + POLL_RECORD_HEADER <= len && !ret) {
+		const int e = p[i];
+
+		if (e >= h->entries || i + POLL_RECORD_HEADER + h->entry[e].sample_size > len)
+			break;
+		ret = append(log, e, sample_time(log, clk, p[i + 1] | p[i + 2] << 8, p[i + 3]), p[i + 4],
+		             p + i + POLL_RECORD_HEADER);
+		i += POLL_RECORD_HEADER + h->entry[e].sample_size;
+	}
+	return ret;
+}
+
+static int record(libusb_device_handle *dev, struct log *log, int compact, unsigned seconds)
+{
+	const struct i2ctu_plog_header *h = &log->h;
+	uint8_t cmd[2 + I2CTU_PLOG_ENTRIES * 5] = { BULK_OP_POLL, h->entries };
+	uint8_t stop_cmd[] = { BULK_OP_POLL, 0 };
+	static uint8_t buf[READ_SIZE];
+	struct clock clk = { 0 };
+	double end = seconds ? now_ms() + seconds * 1e3 : 0, flushed = now_ms();
+	int len = 2, done, ret = 0;
+
+	if (compact)
+		cmd[1] |= POLL_COMPACT;
+	if (h->flags & I2CTU_PLOG_SYNC)
+		cmd[1] |= POLL_SYNC;
+	for (int e = 0; e < h->entries; e++) {
+		cmd[len++] = h->entry[e].addr;
+		cmd[len++] = h->entry[e].reg;
+		cmd[len++] = h->entry[e].len;
+		cmd[len++] = h->entry[e].period;
+		cmd[len++] = h->entry[e].period >> 8;
+	}
+	if ((ret = libusb_bulk_transfer(dev, I2CTU_EP_BULK_OUT, cmd, len, &done, TIMEOUT_MS)))
+		return ret;
+
+	while (!stop && (!end || now_ms() < end)) {
+		ret = libusb_bulk_transfer(dev, I2CTU_EP_BULK_IN, buf, sizeof(buf), &done, TIMEOUT_MS);
+		if (ret == LIBUSB_ERROR_TIMEOUT || ret == LIBUSB_ERROR_INTERRUPTED)
+			ret = 0;
+		if (ret)
+			break;
+		if (done && !clk.started && set_start(log)) {
+			ret = -1;
+			break;
+		}
+
+		// Records never straddle packets, and only the last packet of a transfer is short
+		for (int i = 0; i < done && !ret; i += I2CTU_EP_SIZE)
+			ret = parse_packet(log, &clk, compact, buf + i, (done - i < I2CTU_EP_SIZE) ? done - i : I2CTU_EP_SIZE);
+		if (ret)
+			break;
+
+		if (now_ms() - flushed >= FLUSH_MS) {
+			if ((ret = flush(log)))
+				break;
+			flushed = now_ms();
+		}
+	}
+
+	// Stop and drop whatever is still on its way
+	libusb_bulk_transfer(dev, I2CTU_EP_BULK_OUT, stop_cmd, sizeof(stop_cmd), &done, TIMEOUT_MS);
+	while (!libusb_bulk_transfer(dev, I2CTU_EP_BULK_IN, buf, sizeof(buf), &done, 50))
+		;
+	log->index->flags |= I2CTU_PLOG_COMPLETE;
+	if (flush(log) && !ret)
+		ret = -1;
+	return ret;
+}
+
+// Opens the adapter at the given port path (as in sysfs, e.g. 1-2.4), or the first one found
+static libusb_device_handle *open_adapter(const char *path)
+{
+	libusb_device_handle *dev = NULL;
+	libusb_device **list;
+	ssize_t n;
+
+	if ((n = libusb_get_device_list(NULL, &list)) < 0)
+		return NULL;
+	for (ssize_t i = 0; i < n && !dev; i++) {
+		struct libusb_device_descriptor desc;
+		uint8_t ports[MAX_PORTS];
+		char name[32];
+		int nports, len;
+
+		if (libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != I2CTU_VID || desc.idProduct != I2CTU_PID)
+			continue;
+		nports = libusb_get_port_numbers(list[i], ports, MAX_PORTS);
+		len = snprintf(name, sizeof(name), "%u-", libusb_get_bus_number(list[i]));
+		for (int p = 0; p < nports && len < (int)sizeof(name); p++)
+			len += snprintf(name + len, sizeof(name) - len, p ? ".%u" : "%u", ports[p]);
+		if (path && strcmp(path, name))
+			continue;
+		if (libusb_open(list[i], &dev))
+			fprintf(stderr, "%s: can't open\n", name);
+	}
+	libusb_free_device_list(list, 1);
+	return dev;
+}
+
+// Claims the interface and fills in what the log needs to know about the adapter
+// @return 0, or 1 after printing what went wrong
+static int setup(libusb_device_handle *dev, struct log *log)
+{
+	uint8_t info[FUNC_INFO_SIZE], stats[2];
+	int ret;
+
+	libusb_set_auto_detach_kernel_driver(dev, 1);
+	if ((ret = libusb_claim_interface(dev, 0))) {
+		fprintf(stderr, "libusb_claim_interface: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+
+	ret = libusb_control_transfer(dev, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                              CMD_GET_FUNC, 0, 0, info, sizeof(info), TIMEOUT_MS);
+	if (ret >= 8)
+		log->h.extensions = info[4] | info[5] << 8 | info[6] << 16 | (uint32_t)info[7] << 24;
+	if (ret >= 16)
+		log->h.extensions2 = info[12] | info[13] << 8 | info[14] << 16 | (uint32_t)info[15] << 24;
+	if (!(log->h.extensions & FUNC_EXT_BULK) || (log->h.extensions & FUNC_EXT_HID)) {
+		fprintf(stderr, "The adapter has no bulk protocol on a vendor interface\n");
+		return 1;
+	}
+	if ((log->h.extensions & FUNC_EXT_ALT_BULK) && (ret = libusb_set_interface_alt_setting(dev, 0, 1))) {
+		fprintf(stderr, "libusb_set_interface_alt_setting: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+
+	// Without the stats the ticks are left out of the sample times, which then go by whole frames
+	if (libusb_control_transfer(dev, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                            CMD_GET_STATS, 0, 0, stats, sizeof(stats), TIMEOUT_MS) == sizeof(stats))
+		log->h.tick_khz = stats[STATS_TICK_RATE] | stats[STATS_TICK_RATE + 1] << 8;
+	return 0;
+}
+
+/*
+ * Reading
+ */
+
+static int print(const char *path, int dump)
+{
+	const struct i2ctu_plog_header *h;
+	uint64_t samples[I2CTU_PLOG_ENTRIES] = { 0 }, failed[I2CTU_PLOG_ENTRIES] = { 0 };
+	int64_t first[I2CTU_PLOG_ENTRIES], last[I2CTU_PLOG_ENTRIES];
+	unsigned chunks = 0;
+	const uint8_t *map;
+	struct stat st;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st)) {
+		perror(path);
+		return 1;
+	}
+	if (st.st_size < I2CTU_PLOG_HEADER_SIZE ||
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "%s: not a poll log\n", path);
+		return 1;
+	}
+	h = (const struct i2ctu_plog_header *)map;
+	if (h->magic != I2CTU_PLOG_MAGIC || h->version != I2CTU_PLOG_VERSION || !h->chunk_size ||
+	    h->entries > I2CTU_PLOG_ENTRIES || (dump >= 0 && dump >= h->entries)) {
+		fprintf(stderr, "%s: not a poll log, or no entry %d in it\n", path, dump);
+		return 1;
+	}
+
+	// A chunk cut short by a crash has its last index, which only counts data written before it
+	for (off_t at = I2CTU_PLOG_HEADER_SIZE; at + h->chunk_size <= st.st_size; at += h->chunk_size, chunks++) {
+		const uint8_t *chunk = map + at;
+		const struct i2ctu_plog_chunk *index = (const struct i2ctu_plog_chunk *)chunk;
+
+		if (index->magic != I2CTU_PLOG_CHUNK_MAGIC)
+			break;
+		for (int e = 0; e < h->entries; e++) {
+			const struct i2ctu_plog_column *c = &index->column[e];
+			const int64_t *t = (const int64_t *)(chunk + c->time_offset);
+			const uint8_t *status = chunk + c->status_offset;
+
+			if (!c->count)
+				continue;
+			if (!samples[e])
+				first[e] = t[0];
+			last[e] = t[c->count - 1];
+			samples[e] += c->count;
+			for (uint32_t i = 0; i < c->count; i++)
+				failed[e] += (status[i] != STATUS_ADDRESS_ACK);
+
+			if (e != dump)
+				continue;
+			for (uint32_t i = 0; i < c->count; i++) {
+				const uint8_t *data = chunk + c->data_offset + i * h->entry[e].sample_size;
+
+				printf("%.6f %u", t[i] / 1e9, status[i]);
+				for (int b = 0; b < h->entry[e].sample_size; b++)
+					printf(" %02x", data[b]);
+				printf("\n");
+			}
+		}
+	}
+
+	if (dump < 0) {
+		time_t start = h->start_ns / 1000000000;
+
+		printf("Started %s", ctime(&start));
+		printf("%u chunks of %u KiB, tick rate %u kHz\n", chunks, h->chunk_size / 1024, h->tick_khz);
+		printf("entry  addr  reg  len  period      samples    failed   span s   per s\n");
+		for (int e = 0; e < h->entries; e++) {
+			const struct i2ctu_plog_entry *entry = &h->entry[e];
+			const double span = samples[e] > 1 ? (last[e] - first[e]) / 1e9 : 0;
+
+			printf("%5d  0x%02x 0x%02x %4u %5u%s %12llu %9llu %8.1f %7.1f\n", e, entry->addr, entry->reg,
+			       entry->len, entry->period, (h->flags & I2CTU_PLOG_SYNC) ? "e" : "ms",
+			       (unsigned long long)samples[e], (unsigned long long)failed[e], span,
+			       span ? (samples[e] - 1) / span : 0);
+		}
+	}
+	munmap((void *)map, st.st_size);
+	close(fd);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] -e ADDR:REG:LEN:PERIOD [-e ...] FILE\n"
+	        "       %s -p [-d ENTRY] FILE\n"
+	        "  -a PATH   adapter at this port path, e.g. 1-2.4 (default the first one found)\n"
+	        "  -e SPEC   poll entry as for BULK_OP_POLL, up to %d; PERIOD in ms\n"
+	        "  -s        periods count SYNC edges instead of milliseconds\n"
+	        "  -k        compact records, for many small samples\n"
+	        "  -c KIB    chunk size (default %d), a multiple of 4\n"
+	        "  -t SECS   stop after this long (default when interrupted)\n"
+	        "  -p        print a summary of a log instead of recording one\n"
+	        "  -d ENTRY  with -p, print the samples of this entry: seconds, status and data bytes\n",
+	        prog, prog, I2CTU_PLOG_ENTRIES, DEFAULT_CHUNK);
+}
+
+int main(int argc, char **argv)
+{
+	struct log log = { .fd = -1 };
+	const char *path = NULL;
+	libusb_device_handle *dev;
+	int only_print = 0, dump = -1, compact = 0, opt, ret;
+	unsigned seconds = 0, chunk_kib = DEFAULT_CHUNK;
+
+	log.h.magic = I2CTU_PLOG_MAGIC;
+	log.h.version = I2CTU_PLOG_VERSION;
+	while ((opt = getopt(argc, argv, "a:e:skc:t:pd:h")) != -1) {
+		switch (opt) {
+			case 'a': path = optarg; break;
+			case 'e':
+			{
+				struct i2ctu_plog_entry *e = &log.h.entry[log.h.entries];
+				unsigned addr, reg, len, period;
+
+				if (log.h.entries == I2CTU_PLOG_ENTRIES ||
+				    sscanf(optarg, "%i:%i:%i:%i", &addr, &reg, &len, &period) != 4 ||
+				    addr > 0xFF || reg > 0xFF || len > 0xFF || !period || period > 0xFFFF) {
+					usage(argv[0]);
+					return 1;
+				}
+				*e = (struct i2ctu_plog_entry){ addr, reg, len, sample_size(addr, reg, len), period, 0 };
+				log.h.entries++;
+			}
+			break;
+			case 's': log.h.flags |= I2CTU_PLOG_SYNC; break;
+			case 'k': compact = 1; break;
+			case 'c': chunk_kib = atoi(optarg); break;
+			case 't': seconds = atoi(optarg); break;
+			case 'p': only_print = 1; break;
+			case 'd': dump = atoi(optarg); break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (optind != argc - 1 || (!only_print && !log.h.entries) || !chunk_kib || (chunk_kib % 4)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (only_print)
+		return print(argv[optind], dump);
+
+	log.h.chunk_size = chunk_kib * 1024;
+	if ((ret = libusb_init(NULL))) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+	if (!(dev = open_adapter(path))) {
+		fprintf(stderr, "No adapter found\n");
+		libusb_exit(NULL);
+		return 1;
+	}
+	if (setup(dev, &log) || create(&log, argv[optind])) {
+		libusb_close(dev);
+		libusb_exit(NULL);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if ((ret = record(dev, &log, compact, seconds)) > 0 || ret < -1)
+		fprintf(stderr, "Polling: %s\n", libusb_error_name(ret));
+	printf("%u chunks\n", log.index->seq + 1);
+	for (int e = 0; e < log.h.entries; e++)
+		printf("entry %d: %llu samples, %llu failed\n", e, (unsigned long long)log.samples[e],
+		       (unsigned long long)log.failed[e]);
+
+	close(log.fd);
+	free(log.chunk);
+	libusb_close(dev);
+	libusb_exit(NULL);
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - fleet reflash tool
+ *
+ * Sends CMD_START_BOOTLOADER to every attached adapter, waits for each one to
+ * come back as an Atmel DFU device on the same USB port and runs
+ * dfu-programmer (0.7 or later) on all of them in parallel. Adapters on the
+ * Arduino Caterina bootloader reboot into it as well, but come back as a
+ * serial port and have to be flashed with avrdude by hand.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <libusb.h>
+
+#include "protocol.h"
+
+#define TIMEOUT_MS    1000
+#define MAX_ADAPTERS  256
+#define MAX_PORTS     7
+
+// Atmel DFU bootloader IDs of the XU4 parts
+#define DFU_VID       0x03EB
+#define DFU_PID_32U4  0x2FF4
+#define DFU_PID_16U4  0x2FF3
+
+struct adapter {
+	uint8_t bus;
+	uint8_t ports[MAX_PORTS];
+	int nports;
+	char name[32];  // bus-port.port... as in sysfs
+	pid_t pid;      // dfu-programmer run in progress, 0 before and after
+	int state;      // WAITING, FLASHING, DONE, FAILED
+};
+
+enum { WAITING, FLASHING, DONE, FAILED };
+
+static const char *dfu_programmer = "dfu-programmer";
+
+static void port_name(struct adapter *a)
+{
+	int len = snprintf(a->name, sizeof(a->name), "%u-", a->bus);
+
+	for (int i = 0; i < a->nports && len < (int)sizeof(a->name); i++)
+		len += snprintf(a->name + len, sizeof(a->name) - len, i ? ".%u" : "%u", a->ports[i]);
+}
+
+static int same_port(const struct adapter *a, libusb_device *dev)
+{
+	uint8_t ports[MAX_PORTS];
+	int n = libusb_get_port_numbers(dev, ports, MAX_PORTS);
+
+	return (n == a->nports) && (libusb_get_bus_number(dev) == a->bus) && !memcmp(ports, a->ports, n);
+}
+
+// Asks one adapter to reboot into its bootloader
+// @return 0 if it took the request, 1 if its firmware doesn't have CMD_START_BOOTLOADER, negative libusb errors
+static int reboot(libusb_device *dev)
+{
+	libusb_device_handle *handle;
+	uint8_t info[FUNC_INFO_SIZE];
+	uint32_t ext2 = 0;
+	int ret;
+
+	if ((ret = libusb_open(dev, &handle)))
+		return ret;
+
+	ret = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                              CMD_GET_FUNC, 0, 0, info, sizeof(info), TIMEOUT_MS);
+	if (ret >= 16)
+		ext2 = info[12] | info[13] << 8 | info[14] << 16 | (uint32_t)info[15] << 24;
+
+	if (ret < 0) {
+		// Keep the error
+	} else if (!(ext2 & FUNC_EXT2_BOOTLOADER)) {
+		ret = 1;
+	} else {
+		ret = libusb_control_transfer(handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                              CMD_START_BOOTLOADER, 0, 0, NULL, 0, TIMEOUT_MS);
+		ret = (ret < 0) ? ret : 0;
+	}
+
+	libusb_close(handle);
+	return ret;
+}
+
+// Runs one dfu-programmer command in a child of the flashing process
+// @return its exit status, or 1 if it couldn't be run
+static int run(const char *target, const char *cmd, const char *arg, const char *arg2)
+{
+	int status;
+	pid_t pid = fork();
+
+	if (pid < 0)
+		return 1;
+	if (!pid) {
+		execlp(dfu_programmer, dfu_programmer, target, cmd, arg, arg2, (char *)NULL);
+		perror(dfu_programmer);
+		_exit(127);
+	}
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		return 1;
+	return WEXITSTATUS(status);
+}
+
+// Flashes one DFU device in a process of its own, which exits with 0 on success
+static pid_t flash(libusb_device *dev, const char *mcu, const char *hex)
+{
+	char target[48];
+	pid_t pid;
+
+	snprintf(target, sizeof(target), "%s:%u,%u", mcu, libusb_get_bus_number(dev), libusb_get_device_address(dev));
+
+	pid = fork();
+	if (pid)
+		return pid;
+
+	// Output of the parallel runs interleaves, but each line carries the target
+	_exit(run(target, "erase", "--force", NULL) || run(target, "flash", hex, NULL) || run(target, "launch", NULL, NULL));
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] FIRMWARE.hex\n"
+	        "  -n        only list the adapters, don't reboot or flash anything\n"
+	        "  -t SECS   time to wait for the adapters to show up as DFU devices (default 15)\n"
+	        "  -D PATH   dfu-programmer to run (default dfu-programmer from PATH)\n"
+	        "Reboots every attached adapter into its bootloader and flashes them all in parallel.\n",
+	        prog);
+}
+
+int main(int argc, char **argv)
+{
+	static struct adapter adapters[MAX_ADAPTERS];
+	int count = 0, waiting = 0, running = 0, failed = 0;
+	int list_only = 0, timeout = 15, opt, ret;
+	libusb_device **list;
+	ssize_t n;
+
+	while ((opt = getopt(argc, argv, "nt:D:h")) != -1) {
+		switch (opt) {
+			case 'n': list_only = 1; break;
+			case 't': timeout = atoi(optarg); break;
+			case 'D': dfu_programmer = optarg; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if ((optind != argc - 1) && !list_only) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *hex = argv[optind];
+
+	if (!list_only && access(hex, R_OK)) {
+		perror(hex);
+		return 1;
+	}
+	if ((ret = libusb_init(NULL))) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+
+	// Reboot all adapters first, so they all spend their time in the bootloader at once
+	if ((n = libusb_get_device_list(NULL, &list)) < 0) {
+		fprintf(stderr, "libusb_get_device_list: %s\n", libusb_error_name(n));
+		return 1;
+	}
+	for (ssize_t i = 0; i < n && count < MAX_ADAPTERS; i++) {
+		struct libusb_device_descriptor desc;
+		struct adapter *a = &adapters[count];
+
+		if (libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != I2CTU_VID || desc.idProduct != I2CTU_PID)
+			continue;
+
+		a->bus = libusb_get_bus_number(list[i]);
+		a->nports = libusb_get_port_numbers(list[i], a->ports, MAX_PORTS);
+		port_name(a);
+		count++;
+
+		if (list_only) {
+			printf("%s\n", a->name);
+			continue;
+		}
+
+		ret = reboot(list[i]);
+		if (ret == 1) {
+			printf("%s: firmware without CMD_START_BOOTLOADER, skipped\n", a->name);
+			a->state = FAILED;
+			failed++;
+		} else if (ret < 0) {
+			printf("%s: %s, skipped\n", a->name, libusb_error_name(ret));
+			a->state = FAILED;
+			failed++;
+		} else {
+			printf("%s: rebooting into the bootloader\n", a->name);
+			a->state = WAITING;
+			waiting++;
+		}
+	}
+	libusb_free_device_list(list, 1);
+
+	if (!count)
+		fprintf(stderr, "No adapter found\n");
+	if (list_only || !count) {
+		libusb_exit(NULL);
+		return !count;
+	}
+
+	// The adapters come back one by one, each is flashed as soon as it's there
+	for (int polls = timeout * 5; waiting && polls > 0; polls--) {
+		usleep(200000);
+		if ((n = libusb_get_device_list(NULL, &list)) < 0)
+			continue;
+
+		for (ssize_t i = 0; i < n; i++) {
+			struct libusb_device_descriptor desc;
+			const char *mcu;
+
+			if (libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != DFU_VID)
+				continue;
+			if (desc.idProduct == DFU_PID_32U4)
+				mcu = "atmega32u4";
+			else if (desc.idProduct == DFU_PID_16U4)
+				mcu = "atmega16u4";
+			else
+				continue;
+
+			for (int j = 0; j < count; j++) {
+				struct adapter *a = &adapters[j];
+
+				if (a->state != WAITING || !same_port(a, list[i]))
+					continue;
+				if ((a->pid = flash(list[i], mcu, hex)) < 0) {
+					printf("%s: fork failed\n", a->name);
+					a->state = FAILED;
+					failed++;
+				} else {
+					printf("%s: flashing\n", a->name);
+					a->state = FLASHING;
+					running++;
+				}
+				waiting--;
+			}
+		}
+		libusb_free_device_list(list, 1);
+	}
+
+	for (int j = 0; j < count; j++) {
+		if (adapters[j].state == WAITING) {
+			printf("%s: didn't come back as a DFU device\n", adapters[j].name);
+			failed++;
+		}
+	}
+
+	while (running) {
+		int status;
+		pid_t pid = wait(&status);
+
+		if (pid < 0)
+			break;
+		for (int j = 0; j < count; j++) {
+			struct adapter *a = &adapters[j];
+
+			if (a->state != FLASHING || a->pid != pid)
+				continue;
+			a->state = (WIFEXITED(status) && !WEXITSTATUS(status)) ? DONE : FAILED;
+			a->pid = 0;
+			failed += (a->state == FAILED);
+			printf("%s: %s\n", a->name, (a->state == DONE) ? "done" : "flashing failed");
+			running--;
+		}
+	}
+
+	printf("%d of %d adapters flashed\n", count - failed, count);
+	libusb_exit(NULL);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - traffic replay
+ *
+ * Replays the requests a program made on a test station, recorded by the
+ * host library (see i2ctu_record.h), on an adapter in the lab: with their
+ * original pacing, to reproduce what the station saw, or as fast as the
+ * adapter takes them. Then compares each request's latency and result with
+ * those recorded, so a slow run becomes something to look at offline.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i2ctu.h"
+#include "i2ctu_record.h"
+#include "protocol.h"
+
+#define MAX_ADAPTERS   64
+#define DEFAULT_DEPTH  64
+
+// A recorded request, and how it went when replayed
+struct op {
+	struct i2ctu_rec_entry entry;
+	uint64_t at_us;          // Submitted, since recording started
+	const uint8_t *data;
+	int64_t rec_latency_us;  // -1 if the recording ended before it completed
+	int rec_result;
+
+	uint64_t submit_us, done_us;
+	int result;
+	int done;
+	uint8_t *buf;
+};
+
+static struct op *ops;
+static int count;
+static uint64_t rec_span_us;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Loading
+ */
+
+static int load(const char *path, struct i2ctu_rec_header *header)
+{
+	const uint8_t *p, *end;
+	uint8_t *file = NULL;
+	size_t size = 0, got;
+	uint64_t t = 0;
+	int size_ops = 0;
+	FILE *f;
+
+	if (!(f = fopen(path, "rb"))) {
+		perror(path);
+		return -1;
+	}
+	do {
+		uint8_t *more = realloc(file, size + 65536);
+
+		if (!more) {
+			fclose(f);
+			return -1;
+		}
+		file = more;
+		size += got = fread(file + size, 1, 65536, f);
+	} while (got);
+	fclose(f);
+
+	memcpy(header, file, (size < sizeof(*header)) ? size : sizeof(*header));
+	if (size < sizeof(*header) || header->magic != I2CTU_RECORD_MAGIC || header->version != I2CTU_RECORD_VERSION) {
+		fprintf(stderr, "%s: not a traffic record\n", path);
+		return -1;
+	}
+
+	// The data stays where it was loaded, the ops point into it
+	for (p = file + sizeof(*header), end = file + size; end - p >= (ptrdiff_t)sizeof(struct i2ctu_rec_entry);) {
+		struct i2ctu_rec_entry entry;
+		uint32_t seq;
+
+		memcpy(&entry, p, sizeof(entry));
+		p += sizeof(entry);
+		if ((size_t)(end - p) < entry.len)
+			break;  // Cut off while recording
+		t += entry.delta_us;
+
+		if (entry.type == I2CTU_REC_MSG || entry.type == I2CTU_REC_BULK) {
+			if (count == size_ops) {
+				struct op *more = realloc(ops, (size_ops += 1024) * sizeof(*ops));
+
+				if (!more)
+					return -1;
+				ops = more;
+			}
+			ops[count] = (struct op){ .entry = entry, .at_us = t, .data = p, .rec_latency_us = -1 };
+			count++;
+		} else if (entry.type == I2CTU_REC_DONE && entry.len >= sizeof(seq)) {
+			memcpy(&seq, p, sizeof(seq));
+			if (seq < (uint32_t)count) {
+				ops[seq].rec_latency_us = t - ops[seq].at_us;
+				ops[seq].rec_result = (int32_t)entry.value;
+			}
+		}
+		p += entry.len;
+	}
+	rec_span_us = t;
+	return 0;
+}
+
+static void print(void)
+{
+	for (int i = 0; i < count; i++) {
+		const struct i2ctu_rec_entry *e = &ops[i].entry;
+
+		printf("%12.3f ms  #%-6d ", ops[i].at_us / 1000.0, i);
+		if (e->type == I2CTU_REC_MSG)
+			printf("msg   0x%02x %s %5u bytes%s%s", e->addr, (e->flags & 1) ? "read " : "write", e->value,
+			       (e->flags & (I2CTU_START << 1)) ? " start" : "", (e->flags & (I2CTU_STOP << 1)) ? " stop" : "");
+		else
+			printf("bulk  %5u bytes, %5u back", e->len, e->value);
+		if (ops[i].rec_latency_us >= 0)
+			printf("  %8lld us  result %d\n", (long long)ops[i].rec_latency_us, ops[i].rec_result);
+		else
+			printf("  not completed\n");
+	}
+}
+
+/*
+ * Replaying
+ */
+
+static void done_cb(struct i2ctu_dev *dev, int result, void *user)
+{
+	struct op *op = user;
+
+	(void)dev;
+	op->done_us = now_us();
+	op->result = result;
+	op->done = 1;
+}
+
+static int submit(struct i2ctu_dev *dev, struct op *op)
+{
+	const struct i2ctu_rec_entry *e = &op->entry;
+
+	if (!(op->buf = malloc(e->value ? e->value : 1)))
+		return LIBUSB_ERROR_NO_MEM;
+	op->submit_us = now_us();
+	if (e->type == I2CTU_REC_BULK)
+		return i2ctu_submit_bulk(dev, op->data, e->len, op->buf, e->value, done_cb, op);
+
+	if (!(e->flags & 1))
+		memcpy(op->buf, op->data, e->len);
+	return i2ctu_submit_msg(dev, e->addr, e->flags & 1, e->flags >> 1, op->buf, e->value, done_cb, op);
+}
+
+// Handles the adapter's events until the moment comes, the last millisecond without sleeping
+static void wait_until(struct i2ctu_dev *dev, uint64_t t)
+{
+	uint64_t now;
+
+	while ((now = now_us()) < t)
+		i2ctu_handle_events(dev, (t - now > 2000) ? (t - now) / 1000 - 1 : 0);
+}
+
+static int replay(struct i2ctu_dev *dev, int paced, int depth)
+{
+	const uint64_t start = now_us();
+	int ret;
+
+	for (int i = 0; i < count; i++) {
+		struct op *op = &ops[i];
+
+		if (paced)
+			wait_until(dev, start + op->at_us);
+		else
+			while (i2ctu_pending(dev) >= depth)
+				i2ctu_handle_events(dev, 100);
+
+		if ((ret = submit(dev, op))) {
+			op->result = ret;
+			op->done = 1;
+			op->done_us = op->submit_us;
+			if (ret == LIBUSB_ERROR_NO_DEVICE)
+				return ret;
+		}
+	}
+	return i2ctu_wait_all(dev);
+}
+
+static void report(int paced)
+{
+	uint64_t *rec = malloc(count * sizeof(*rec)), *rep = malloc(count * sizeof(*rep));
+	uint64_t first = UINT64_MAX, last = 0;
+	int nrec = 0, nrep = 0, differ = 0;
+
+	if (!rec || !rep)
+		return;
+	for (int i = 0; i < count; i++) {
+		const struct op *op = &ops[i];
+
+		if (op->rec_latency_us >= 0)
+			rec[nrec++] = op->rec_latency_us;
+		if (op->done) {
+			rep[nrep++] = op->done_us - op->submit_us;
+			if (op->submit_us < first)
+				first = op->submit_us;
+			if (op->done_us > last)
+				last = op->done_us;
+			if (op->rec_latency_us >= 0 && op->result != op->rec_result)
+				differ++;
+		}
+	}
+	qsort(rec, nrec, sizeof(*rec), cmp_u64);
+	qsort(rep, nrep, sizeof(*rep), cmp_u64);
+
+	printf("Recorded: %d requests in %.3f s\n", count, rec_span_us / 1e6);
+	if (nrep)
+		printf("Replayed: %d requests in %.3f s, %.0f per second (%s)\n", nrep, (last - first) / 1e6,
+		       nrep / ((last - first + 1) / 1e6), paced ? "original pacing" : "as fast as possible");
+	printf("            p50 us   p99 us   max us\n");
+	if (nrec)
+		printf("recorded  %8llu %8llu %8llu\n", (unsigned long long)rec[nrec / 2],
+		       (unsigned long long)rec[(nrec * 99) / 100], (unsigned long long)rec[nrec - 1]);
+	if (nrep)
+		printf("replayed  %8llu %8llu %8llu\n", (unsigned long long)rep[nrep / 2],
+		       (unsigned long long)rep[(nrep * 99) / 100], (unsigned long long)rep[nrep - 1]);
+	printf("Results differing from the recording: %d\n", differ);
+	free(rec);
+	free(rep);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options] FILE\n"
+	        "  -a INDEX  adapter to replay on, in bus and port order (default 0)\n"
+	        "  -m        submit as fast as possible instead of with the recorded pacing\n"
+	        "  -d DEPTH  most requests in flight with -m (default %d)\n"
+	        "  -p        print the recorded requests instead of replaying them\n"
+	        "Replays traffic recorded with " I2CTU_RECORD_ENV "=FILE set for a program using the host library, or\n"
+	        "with i2ctu_record(), and compares the latencies and results with those recorded.\n",
+	        prog, DEFAULT_DEPTH);
+}
+
+int main(int argc, char **argv)
+{
+	struct i2ctu_dev *devs[MAX_ADAPTERS];
+	struct i2ctu_rec_header header;
+	int adapter = 0, paced = 1, depth = DEFAULT_DEPTH, only_print = 0, n, opt, ret;
+
+	while ((opt = getopt(argc, argv, "a:md:ph")) != -1) {
+		switch (opt) {
+			case 'a': adapter = atoi(optarg); break;
+			case 'm': paced = 0; break;
+			case 'd': depth = atoi(optarg); break;
+			case 'p': only_print = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (optind != argc - 1 || adapter < 0 || depth < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (load(argv[optind], &header))
+		return 1;
+	if (only_print) {
+		print();
+		return 0;
+	}
+
+	// The recording of this run would be overwritten with itself
+	unsetenv(I2CTU_RECORD_ENV);
+	if ((ret = libusb_init(NULL))) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+	if ((n = i2ctu_open_all(NULL, devs, MAX_ADAPTERS)) <= adapter) {
+		fprintf(stderr, "Adapter %d not found\n", adapter);
+		for (int i = 0; i < n; i++)
+			i2ctu_close(devs[i]);
+		libusb_exit(NULL);
+		return 1;
+	}
+	for (int i = 0; i < n; i++)
+		if (i != adapter)
+			i2ctu_close(devs[i]);
+
+	if (i2ctu_extensions(devs[adapter]) != header.extensions || i2ctu_extensions2(devs[adapter]) != header.extensions2)
+		fprintf(stderr, "Warning: the firmware differs from the recording's, requests may fail or behave differently\n");
+
+	if ((ret = replay(devs[adapter], paced, depth)))
+		fprintf(stderr, "Replay: %s\n", libusb_error_name(ret));
+	report(paced);
+
+	i2ctu_close(devs[adapter]);
+	libusb_exit(NULL);
+	return ret ? 1 : 0;
+}
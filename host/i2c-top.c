@@ -0,0 +1,442 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - live monitor
+ *
+ * Polls CMD_GET_STATS, CMD_GET_LATENCY and CMD_GET_ADDR_STATS from every
+ * attached adapter once per interval and shows what changed since the last
+ * sample: request and error rates, bus and USB utilization, latency
+ * percentiles and the busiest targets. Nothing is cleared on the adapters,
+ * so it runs alongside whatever else is using them, and adapters plugged in
+ * or out on the way are picked up.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <libusb.h>
+
+#include "protocol.h"
+
+#define TIMEOUT_MS    200
+#define MAX_ADAPTERS  64
+#define MAX_PORTS     7
+#define MAX_ENTRIES   32
+#define ADDR_STATS_RESPONSE  (ADDR_STATS_HEADER + MAX_ENTRIES * ADDR_STATS_ENTRY_SIZE)
+
+// One reading of an adapter's counters
+struct sample {
+	uint8_t stats[STATS_RESPONSE];
+	int stats_len;
+	uint8_t latency[LATENCY_RESPONSE];
+	int latency_len;
+	uint8_t addr[ADDR_STATS_RESPONSE];
+	int addr_len;
+	double time;
+};
+
+struct adapter {
+	libusb_device_handle *dev;
+	uint8_t bus;
+	uint8_t ports[MAX_PORTS];
+	int nports;
+	char name[32];        // bus-port.port... as in sysfs
+	char label[LABEL_MAX_LENGTH + 1];
+	uint32_t ext, ext2;
+	int seen;             // Still on the bus at the last scan
+	int samples;          // Readings taken, the first one has nothing to compare against
+	struct sample now, prev;
+};
+
+static const char *latency_names[LATENCY_KINDS] = { "io-read", "io-write", "batch", "scan", "poll" };
+
+static struct adapter adapters[MAX_ADAPTERS];
+static int count;
+
+static double monotonic(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Growth of a counter between two samples. The 32-bit counters wrap, but a drop by more than half the range means
+// somebody cleared them in between, so the new value is all there is to count then.
+static uint32_t delta32(uint32_t now, uint32_t prev)
+{
+	uint32_t d = now - prev;
+	return (d > 0x80000000UL) ? now : d;
+}
+
+// Same for a stats field at offset, 0 if the firmware doesn't return it
+static uint32_t stats_delta(const struct adapter *a, int offset)
+{
+	if (a->now.stats_len < offset + 4 || a->prev.stats_len < offset + 4)
+		return 0;
+	return delta32(get32(a->now.stats + offset), get32(a->prev.stats + offset));
+}
+
+static void port_name(struct adapter *a)
+{
+	int len = snprintf(a->name, sizeof(a->name), "%u-", a->bus);
+
+	for (int i = 0; i < a->nports && len < (int)sizeof(a->name); i++)
+		len += snprintf(a->name + len, sizeof(a->name) - len, i ? ".%u" : "%u", a->ports[i]);
+}
+
+static int same_port(const struct adapter *a, libusb_device *dev)
+{
+	uint8_t ports[MAX_PORTS];
+	int n = libusb_get_port_numbers(dev, ports, MAX_PORTS);
+
+	return (n == a->nports) && (libusb_get_bus_number(dev) == a->bus) && !memcmp(ports, a->ports, n);
+}
+
+static int ctrl_in(struct adapter *a, uint8_t cmd, uint8_t *data, uint16_t len)
+{
+	return libusb_control_transfer(a->dev, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                               cmd, 0, 0, data, len, TIMEOUT_MS);
+}
+
+// Opens a newly found adapter and reads what it can do
+static void add_adapter(libusb_device *dev)
+{
+	struct adapter *a = &adapters[count];
+	uint8_t info[FUNC_INFO_SIZE];
+	int ret;
+
+	memset(a, 0, sizeof(*a));
+	a->bus = libusb_get_bus_number(dev);
+	a->nports = libusb_get_port_numbers(dev, a->ports, MAX_PORTS);
+	port_name(a);
+
+	if ((ret = libusb_open(dev, &a->dev))) {
+		fprintf(stderr, "%s: %s\n", a->name, libusb_error_name(ret));
+		return;
+	}
+
+	ret = ctrl_in(a, CMD_GET_FUNC, info, sizeof(info));
+	if (ret >= 8)
+		a->ext = get32(info + 4);
+	if (ret >= 16)
+		a->ext2 = get32(info + 12);
+	if (a->ext & FUNC_EXT_LABEL) {
+		ret = ctrl_in(a, CMD_GET_LABEL, (uint8_t *)a->label, LABEL_MAX_LENGTH);
+		a->label[(ret > 0) ? ret : 0] = 0;
+	}
+
+	a->seen = 1;
+	count++;
+}
+
+// Picks up adapters plugged in since the last scan and drops the ones gone
+static void scan(void)
+{
+	libusb_device **list;
+	ssize_t n;
+
+	if ((n = libusb_get_device_list(NULL, &list)) < 0)
+		return;
+
+	for (int j = 0; j < count; j++)
+		adapters[j].seen = 0;
+
+	for (ssize_t i = 0; i < n; i++) {
+		struct libusb_device_descriptor desc;
+		int j;
+
+		if (libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != I2CTU_VID || desc.idProduct != I2CTU_PID)
+			continue;
+
+		for (j = 0; j < count && !same_port(&adapters[j], list[i]); j++)
+			;
+		if (j < count)
+			adapters[j].seen = 1;
+		else if (count < MAX_ADAPTERS)
+			add_adapter(list[i]);
+	}
+	libusb_free_device_list(list, 1);
+
+	for (int j = 0; j < count; j++) {
+		if (adapters[j].seen)
+			continue;
+		libusb_close(adapters[j].dev);
+		memmove(&adapters[j], &adapters[j + 1], (count - j - 1) * sizeof(adapters[0]));
+		count--;
+		j--;
+	}
+}
+
+// Takes one reading; a failed request just leaves its part empty until the adapter drops off the bus
+static void sample(struct adapter *a)
+{
+	struct sample *s = &a->now;
+	int ret;
+
+	a->prev = a->now;
+	s->time = monotonic();
+
+	ret = ctrl_in(a, CMD_GET_STATS, s->stats, sizeof(s->stats));
+	s->stats_len = (ret < 0) ? 0 : ret;
+
+	s->latency_len = 0;
+	if (a->ext2 & FUNC_EXT2_LATENCY) {
+		ret = ctrl_in(a, CMD_GET_LATENCY, s->latency, sizeof(s->latency));
+		s->latency_len = (ret < 0) ? 0 : ret;
+	}
+
+	s->addr_len = 0;
+	if (a->ext2 & FUNC_EXT2_ADDR_STATS) {
+		ret = ctrl_in(a, CMD_GET_ADDR_STATS, s->addr, sizeof(s->addr));
+		s->addr_len = (ret < 0) ? 0 : ret;
+	}
+
+	a->samples++;
+}
+
+// Upper bound of the bucket holding the given fraction of the samples, in ms, or -1 if there are none
+static double percentile(const uint16_t *counts, uint32_t total, double fraction, unsigned tick_khz)
+{
+	uint32_t sum = 0;
+
+	if (!total)
+		return -1;
+	for (int b = 0; b < LATENCY_BUCKETS; b++) {
+		sum += counts[b];
+		if (sum >= fraction * total)
+			return (double)(2UL << b) / tick_khz;
+	}
+	return (double)(2UL << (LATENCY_BUCKETS - 1)) / tick_khz;
+}
+
+static void show_latency(const struct adapter *a)
+{
+	const uint8_t *now = a->now.latency, *prev = a->prev.latency;
+	unsigned tick_khz = get16(now);
+	int printed = 0;
+
+	if (a->now.latency_len < LATENCY_RESPONSE || a->prev.latency_len < LATENCY_RESPONSE || !tick_khz)
+		return;
+
+	for (int k = 0; k < LATENCY_KINDS; k++) {
+		uint16_t counts[LATENCY_BUCKETS];
+		uint32_t total = 0;
+
+		// The device counts saturate, a stuck count just stops contributing
+		for (int b = 0; b < LATENCY_BUCKETS; b++) {
+			int offset = 4 + 2 * (k * LATENCY_BUCKETS + b);
+			counts[b] = get16(now + offset) - get16(prev + offset);
+			total += counts[b];
+		}
+		if (!total)
+			continue;
+
+		printf("%s %s %u p50<%.2f p99<%.2f", printed ? "" : "  latency ms:", latency_names[k], (unsigned)total,
+		       percentile(counts, total, 0.50, tick_khz), percentile(counts, total, 0.99, tick_khz));
+		printed = 1;
+	}
+	if (printed)
+		printf("\n");
+}
+
+struct target {
+	uint8_t address;
+	uint32_t transactions, written, read, naks, timeouts, wait;
+};
+
+static int by_transactions(const void *x, const void *y)
+{
+	const struct target *a = x, *b = y;
+	return (a->transactions < b->transactions) - (a->transactions > b->transactions);
+}
+
+static void show_targets(const struct adapter *a, double dt, int max)
+{
+	struct target t[MAX_ENTRIES];
+	const uint8_t *now = a->now.addr, *prev = a->prev.addr;
+	int n = 0;
+
+	if (a->now.addr_len < ADDR_STATS_HEADER || !max)
+		return;
+
+	unsigned tick_khz = get16(now), size = now[3];
+	int entries = (a->now.addr_len - ADDR_STATS_HEADER) / (size ? size : 1);
+	int prev_entries = (a->prev.addr_len >= ADDR_STATS_HEADER) ? (a->prev.addr_len - ADDR_STATS_HEADER) / (size ? size : 1) : 0;
+
+	if (size < ADDR_STATS_ENTRY_SIZE || !tick_khz)
+		return;
+
+	for (int i = 0; i < entries && i < MAX_ENTRIES; i++) {
+		const uint8_t *e = now + ADDR_STATS_HEADER + i * size, *p = NULL;
+
+		if (e[0] == ADDR_STATS_UNUSED)
+			continue;
+		// Entries keep their place until cleared, but look the address up in case they were
+		for (int j = 0; j < prev_entries && j < MAX_ENTRIES; j++) {
+			if (prev[ADDR_STATS_HEADER + j * size] == e[0]) {
+				p = prev + ADDR_STATS_HEADER + j * size;
+				break;
+			}
+		}
+
+		t[n].address = e[0];
+		t[n].timeouts = p ? (uint8_t)(e[1] - p[1]) : e[1];
+		t[n].naks = p ? (uint16_t)(get16(e + 2) - get16(p + 2)) : get16(e + 2);
+		t[n].transactions = p ? delta32(get32(e + 4), get32(p + 4)) : get32(e + 4);
+		t[n].written = p ? delta32(get32(e + 8), get32(p + 8)) : get32(e + 8);
+		t[n].read = p ? delta32(get32(e + 12), get32(p + 12)) : get32(e + 12);
+		t[n].wait = p ? delta32(get32(e + 16), get32(p + 16)) : get32(e + 16);
+		if (t[n].transactions || t[n].naks || t[n].timeouts)
+			n++;
+	}
+	if (!n)
+		return;
+
+	qsort(t, n, sizeof(t[0]), by_transactions);
+	printf("  addr     xfer/s     wr B/s     rd B/s   NAK/s  stretch  wait%%\n");
+	for (int i = 0; i < n && i < max; i++) {
+		printf("  0x%02x %10.0f %10.0f %10.0f %7.0f %8u %5.1f\n", t[i].address, t[i].transactions / dt,
+		       t[i].written / dt, t[i].read / dt, t[i].naks / dt, (unsigned)t[i].timeouts,
+		       t[i].wait / (dt * tick_khz * 10.0));
+	}
+	if (n > max)
+		printf("  ... %d more\n", n - max);
+}
+
+static void show(const struct adapter *a, int max_targets)
+{
+	double dt = a->now.time - a->prev.time;
+	const uint8_t *s = a->now.stats;
+
+	printf("%s%s%s%s\n", a->name, *a->label ? "  \"" : "", a->label, *a->label ? "\"" : "");
+	if (!a->now.stats_len) {
+		printf("  no response\n");
+		return;
+	}
+	if (a->samples < 2 || dt <= 0 || a->prev.stats_len < STATS_BUS_SPEED + 2) {
+		printf("  waiting for the next sample\n");
+		return;
+	}
+
+	printf("  req/s %.0f  NAK/s %.0f  busy/s %.0f  abort/s %.0f  arb/s %.0f  recoveries %u",
+	       stats_delta(a, STATS_REQUESTS) / dt, stats_delta(a, STATS_ADDRESS_NAKS) / dt,
+	       stats_delta(a, STATS_CAPTURE_TIMEOUTS) / dt, stats_delta(a, STATS_HOST_ABORTS) / dt,
+	       stats_delta(a, STATS_ARB_LOST) / dt, (unsigned)stats_delta(a, STATS_BUS_RECOVERIES));
+	if (a->now.stats_len >= STATS_CONTROL_STALLS + 4)
+		printf("  stalls %u", (unsigned)stats_delta(a, STATS_CONTROL_STALLS));
+	if (a->now.stats_len >= STATS_RESPONSE)
+		printf("  watchdog %u/%u", get16(s + STATS_WD_RECOVERIES), get16(s + STATS_WD_RESETS));
+	printf("\n");
+
+	printf("  bus %u kHz", get16(s + STATS_BUS_SPEED));
+	if (a->now.stats_len >= STATS_BUS_HELD_LOAD + 2)
+		printf("  load %.1f%%  held %.1f%%", get16(s + STATS_BUS_LOAD) / 10.0, get16(s + STATS_BUS_HELD_LOAD) / 10.0);
+	if (a->now.stats_len >= STATS_CONTROL_STALLS + 4) {
+		uint32_t packets = stats_delta(a, STATS_USB_PACKETS), frames = stats_delta(a, STATS_USB_FRAMES);
+		unsigned tick_khz = get16(s + STATS_TICK_RATE);
+
+		printf("  usb wait %.1f%%  packets/s %.0f  per frame %.2f",
+		       tick_khz ? stats_delta(a, STATS_USB_WAIT_TICKS) / (dt * tick_khz * 10.0) : 0.0, packets / dt,
+		       frames ? (double)packets / frames : 0.0);
+	}
+	printf("\n");
+
+	show_latency(a);
+	show_targets(a, dt, max_targets);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "  -i MS     sample interval (default 1000)\n"
+	        "  -n COUNT  stop after COUNT samples (default run until interrupted)\n"
+	        "  -t COUNT  busiest targets to show per adapter (default 4, 0 for none)\n"
+	        "  -b        batch mode, append each sample instead of redrawing the screen\n"
+	        "Shows live statistics of every attached adapter, without clearing anything on them.\n",
+	        prog);
+}
+
+int main(int argc, char **argv)
+{
+	int interval = 1000, samples = 0, max_targets = 4, batch = !isatty(STDOUT_FILENO), opt, ret;
+
+	while ((opt = getopt(argc, argv, "i:n:t:bh")) != -1) {
+		switch (opt) {
+			case 'i': interval = atoi(optarg); break;
+			case 'n': samples = atoi(optarg); break;
+			case 't': max_targets = atoi(optarg); break;
+			case 'b': batch = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (optind != argc || interval <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	if ((ret = libusb_init(NULL))) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+
+	// One sample more than shown, the first one is only there to take the differences against
+	for (int n = 0;; n++) {
+		scan();
+		for (int j = 0; j < count; j++)
+			sample(&adapters[j]);
+
+		if (n) {
+			if (!batch)
+				printf("\033[H\033[J");
+			printf("%d adapter%s, %.1f s interval\n", count, (count == 1) ? "" : "s", interval / 1000.0);
+			for (int j = 0; j < count; j++)
+				show(&adapters[j], max_targets);
+			if (batch)
+				printf("\n");
+			fflush(stdout);
+		}
+		if (samples && n == samples)
+			break;
+		usleep(interval * 1000);
+	}
+
+	for (int j = 0; j < count; j++)
+		libusb_close(adapters[j].dev);
+	libusb_exit(NULL);
+	return 0;
+}
@@ -0,0 +1,3157 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - asynchronous host library
+ *
+ * Control requests map to one libusb control transfer each (plus a chained
+ * CMD_GET_STATUS on firmware without inline status). The commands of bulk
+ * requests are staged into one byte stream, which goes out in OUT transfers of
+ * up to OUT_SIZE bytes with a configurable number of them in flight, so many
+ * small requests share packets and the next transfer is on its way while the
+ * device works on the current one. Since the firmware answers commands strictly
+ * in order, the IN side is a plain byte stream too, which is handed out to the
+ * queued requests oldest first while a couple of IN transfers are kept pending.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include "i2ctu.h"
+#include "i2ctu_record.h"
+#include "protocol.h"
+
+#define TIMEOUT_MS     1000
+#define IN_TRANSFERS   2
+#define IN_SIZE        (16 * I2CTU_EP_SIZE)
+#define OUT_SIZE       (16 * I2CTU_EP_SIZE)
+#define DEFAULT_DEPTH  2
+#define BUFFERS_SIZE   (IN_TRANSFERS * IN_SIZE + I2CTU_MAX_DEPTH * OUT_SIZE)
+
+// Flush the staged stream as far as whole packets go, leaving the rest to its deadline; see flush_out()
+#define FLUSH_PACKETS  2
+
+// Bounds of the automatic deadline: a microframe, a frame
+#define DEADLINE_MIN   125
+#define DEADLINE_MAX   1000
+#define RTT_INITIAL    1000
+
+// libusb_dev_mem_alloc() came with libusb 1.0.21, hotplug callbacks with 1.0.16
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+#define HAVE_DEV_MEM
+#endif
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000102
+#define HAVE_HOTPLUG
+#endif
+
+// How often the devices are looked through for an adapter that dropped off where hotplug doesn't say
+#define RECONNECT_SCAN_MS  50
+
+// Register cache, see i2ctu_set_regcache()
+#define REGCACHE_TARGETS   128
+#define REGCACHE_REGS      256
+
+// Configuration cache, one file per USB port in $I2CTU_CACHE, $XDG_CACHE_HOME/i2ctu or ~/.cache/i2ctu
+#define CACHE_ENV      "I2CTU_CACHE"
+#define CACHE_MAGIC    0x43543249  // "I2TC"
+
+// What the library remembers about an adapter from one program to the next. The firmware's boot id and
+// configuration generation (CMD_GET_CONFIG) tell whether it is still in the state the last program left it in.
+struct cache_entry {
+	uint32_t magic;
+	uint16_t bcd_device;     // Firmware version from the device descriptor
+	uint8_t info_len;
+	uint8_t info[FUNC_INFO_SIZE];  // CMD_GET_FUNC response
+	uint8_t config[CONFIG_RESPONSE];  // CMD_GET_CONFIG response when the adapter was closed
+	uint16_t baud_khz;       // Bus speed set with i2ctu_set_baudrate() and still in effect, 0 if unknown
+	uint32_t tag;            // Of i2ctu_config_uploaded() and still in effect, 0 if none
+
+	// What i2ctu_config_saved() stored in EEPROM, comes back when the adapter powers up with stored_crc
+	uint8_t stored;
+	uint8_t stored_crc;
+	uint16_t stored_khz;
+	uint32_t stored_tag;
+};
+
+// Registers of one target in the register cache. A value counts until it expires and as long as it was read in the
+// target's current generation, which every write to the target moves on.
+struct regcache_target {
+	uint32_t generation;
+	uint32_t ttl[REGCACHE_REGS];     // Declared with i2ctu_set_reg_ttl(), I2CTU_TTL_DEFAULT if not
+	uint32_t read_in[REGCACHE_REGS]; // Generation the value was read in
+	uint64_t expires[REGCACHE_REGS]; // now_us() it stops counting at, 0 if it never did
+	uint8_t value[REGCACHE_REGS];
+};
+
+// A register read answered without the bus at the next round of event handling: from the cache, or failed before
+// it could go out
+struct regcache_hit {
+	struct regcache_hit *next;
+	int result;
+	i2ctu_cb cb;
+	void *user;
+};
+
+// What a request is still waiting for
+#define WAIT_IO        (1 << 0)  // Control transfer, or bulk OUT transfer
+#define WAIT_STATUS    (1 << 1)  // Chained CMD_GET_STATUS
+#define WAIT_RESPONSE  (1 << 2)  // Bulk response data
+
+struct request {
+	struct i2ctu_dev *dev;
+	struct libusb_transfer *xfer;
+	i2ctu_cb cb;
+	void *user;
+	int result;
+	int state;
+
+	// Control requests
+	uint8_t *data;
+	uint16_t len;
+	uint8_t rd;
+	uint8_t flags;
+
+	// Bulk requests
+	int cmd_len;
+	int cmd_sent;            // Bytes of the command already handed to an OUT transfer
+	uint64_t sent_us;        // When the last of it went out, with the automatic deadline
+	struct request *out_next;
+	uint8_t *resp;
+	int resp_len;
+	int resp_done;
+	struct i2ctu_msg *msgs;  // Batch segments to scatter the response into, the caller's array
+	int count;
+	int detail;              // Every segment with a START has a detail record
+	int status;              // The response ends with a status byte giving the result
+	uint16_t *bitmap;        // Where the 16-bit word leading a MULTIWRITE, STREAM or PROGRAM response goes
+	uint32_t *crc;           // Where a CHECKSUM response's CRC goes
+	int gather;              // GATHER response, count records of len bytes into data plus a status byte
+	int scatter;             // SCATTER response, count records of the lengths in the command plus a status byte
+	int gang;                // EEPROM gang write response, a status byte for each of count channels
+	int *results;            // Per target results of a GATHER, or per channel of an EEPROM gang write; may be NULL
+	i2ctu_view_cb view;      // Hand the response out where it lies instead of copying it to resp
+	uint8_t *copy;           // View responses that couldn't be lent out of an IN transfer
+	uint32_t rec_seq;        // Number in the record plus one, 0 if not recorded
+
+	struct request *next;    // Response queue
+	uint8_t buf[];           // Setup packet and data stage, or bulk command (and batch response)
+};
+
+// An OUT transfer of the staged command stream
+struct out_slot {
+	struct i2ctu_dev *dev;
+	struct libusb_transfer *xfer;
+	int busy;
+	int len;
+	struct request *reqs;    // Requests whose command ends in this transfer
+	uint8_t *buf;
+};
+
+struct i2ctu_dev {
+	libusb_context *ctx;
+	libusb_device_handle *handle;
+	uint32_t extensions;
+	uint32_t extensions2;
+	uint32_t extensions3;
+	int inline_status;
+	int hid;                 // Reports instead of bulk packets: each response ends with BULK_OP_FLUSH and padding
+	int ep_size;             // Packet size of the bulk OUT endpoint, from its descriptor
+	int pending;
+
+	// Bulk requests waiting for response data, oldest first
+	struct request *head, *tail;
+
+	struct libusb_transfer *in[IN_TRANSFERS];
+	int in_busy[IN_TRANSFERS];
+	uint8_t *in_buf[IN_TRANSFERS];
+
+	// Transfer buffers, mapped from usbfs where the platform has that (the kernel then doesn't copy the data
+	// between its own buffers and these) or else allocated as usual
+	uint8_t *dev_mem;
+	uint8_t *mem;
+
+	// Bulk requests whose command hasn't been sent completely yet, oldest first, and the bytes still to go
+	struct request *staged, *staged_tail;
+	int staged_len;
+	uint64_t staged_us;      // When the stream last went from empty to staged
+
+	// Flushing commands that don't fill a packet: 0 only when the caller waits, I2CTU_DEADLINE_AUTO, or once
+	// they have waited deadline_us; rtt_us is the smoothed round trip of bulk requests the automatic one follows
+	int deadline;
+	int deadline_us;
+	int rtt_us;
+
+	int depth;
+	int credits;             // Most command bytes in OUT transfers in flight, 0 for no limit
+	int in_flight;
+	struct out_slot out[I2CTU_MAX_DEPTH];
+	struct i2ctu_stats stats;
+
+	// Event loop integration: an epoll set of libusb's descriptors and wake_fd, -1 until asked for
+	int epoll_fd;
+	int wake_fd;             // eventfd telling the loop there are staged commands to flush
+	int woken;               // wake_fd is signalled already, or i2ctu_dispatch() flushes anyway
+
+	// Traffic recording, see i2ctu_record.h
+	FILE *record;
+	uint64_t record_us;      // When the last entry was written
+	uint32_t record_seq;     // Requests recorded so far
+
+	// Configuration cache, NULL path without one; generation is the adapter's as far as the library knows
+	char *cache_path;
+	struct cache_entry cache;
+	uint16_t generation;
+
+	// Reconnecting after the adapter dropped off the bus, see i2ctu_set_reconnect()
+	i2ctu_reconnect_cb reconnect;
+	void *reconnect_user;
+	uint8_t serial_index;    // String descriptor of the serial number
+	char serial[64];
+	uint16_t baud_khz;       // Last set with i2ctu_set_baudrate(), set again after reconnecting
+	int gone;                // The handle is dead, waiting for the adapter to come back
+	uint64_t gone_us;
+	uint64_t scan_us;        // When the devices were last looked through for it
+	int arrived;             // Hotplug saw an adapter arrive since then
+	int hotplug;             // Hotplug tells when to look
+#ifdef HAVE_HOTPLUG
+	libusb_hotplug_callback_handle hotplug_handle;
+#endif
+
+	// Register cache, see i2ctu_set_regcache(); targets are allocated as their registers are first read or declared
+	int regcache;
+	uint32_t regcache_ttl;   // Of registers not declared otherwise
+	struct regcache_target *targets[REGCACHE_TARGETS];
+	struct regcache_hit *hits, *hits_tail;
+
+	// Register reads held back for coalescing into bursts, see i2ctu_set_coalesce(); -1 if they aren't
+	int coalesce_gap;
+	struct reg_read *planned, *planned_tail;
+};
+
+static int record_index;     // Adapters opened with I2CTU_RECORD set so far
+
+static int transfer_error(enum libusb_transfer_status status)
+{
+	switch (status) {
+	case LIBUSB_TRANSFER_COMPLETED: return 0;
+	case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+	case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+	case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+	case LIBUSB_TRANSFER_OVERFLOW:  return LIBUSB_ERROR_OVERFLOW;
+	case LIBUSB_TRANSFER_CANCELLED: return LIBUSB_ERROR_INTERRUPTED;
+	default:                        return LIBUSB_ERROR_IO;
+	}
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int status_result(uint8_t status)
+{
+	switch (status) {
+	case STATUS_ADDRESS_ACK:  return I2CTU_OK;
+	case STATUS_BUS_BUSY:     return I2CTU_BUSY;
+	case STATUS_VERIFY_ERROR: return I2CTU_MISMATCH;
+	case STATUS_EXPIRED:      return I2CTU_EXPIRED;
+	default:                  return I2CTU_NAK;
+	}
+}
+
+static struct request *alloc_request(struct i2ctu_dev *dev, size_t size, i2ctu_cb cb, void *user)
+{
+	struct request *req = calloc(1, sizeof(*req) + size);
+	if (!req)
+		return NULL;
+
+	req->xfer = libusb_alloc_transfer(0);
+	if (!req->xfer) {
+		free(req);
+		return NULL;
+	}
+
+	req->dev = dev;
+	req->cb = cb;
+	req->user = user;
+	return req;
+}
+
+static void free_request(struct request *req)
+{
+	libusb_free_transfer(req->xfer);
+	free(req->copy);
+	free(req);
+}
+
+/*
+ * Recording
+ */
+
+static void record_entry(struct i2ctu_dev *dev, struct i2ctu_rec_entry *entry, const void *data)
+{
+	const uint64_t now = now_us();
+
+	entry->delta_us = (now - dev->record_us > UINT32_MAX) ? UINT32_MAX : now - dev->record_us;
+	dev->record_us = now;
+	fwrite(entry, sizeof(*entry), 1, dev->record);
+	if (entry->len)
+		fwrite(data, entry->len, 1, dev->record);
+}
+
+static void record_request(struct i2ctu_dev *dev, struct request *req, uint8_t type, const void *data, uint32_t len)
+{
+	struct i2ctu_rec_entry entry = { .type = type, .len = len };
+
+	if (type == I2CTU_REC_MSG) {
+		entry.flags = req->rd | req->flags << 1;
+		entry.addr = req->buf[4];  // Low byte of the setup packet's wIndex
+		entry.value = req->len;
+	} else {
+		entry.value = req->resp_len;
+	}
+	record_entry(dev, &entry, data);
+	req->rec_seq = ++dev->record_seq;
+}
+
+static void record_done(struct i2ctu_dev *dev, struct request *req)
+{
+	struct i2ctu_rec_entry entry = { .type = I2CTU_REC_DONE, .len = 4, .value = req->result };
+	const uint32_t seq = req->rec_seq - 1;
+
+	record_entry(dev, &entry, &seq);
+}
+
+// Hand the result to the owner; the callback may submit new requests right away
+static void lost(struct i2ctu_dev *dev);
+static void regcache_written(struct i2ctu_dev *dev, uint16_t addr);
+static void regcache_batch(struct i2ctu_dev *dev, const struct i2ctu_msg *msgs, int count);
+static void plan_reads(struct i2ctu_dev *dev);
+
+static void complete(struct request *req)
+{
+	struct i2ctu_dev *dev = req->dev;
+	i2ctu_cb cb = req->cb;
+	void *user = req->user;
+	int result = req->result;
+
+	if (req->rec_seq && dev->record)
+		record_done(dev, req);
+	if (result == LIBUSB_ERROR_NO_DEVICE)
+		lost(dev);
+
+	if (req->view) {
+		// The data may live in the request, so that goes only once the callback is done with it
+		dev->pending--;
+		req->view(dev, result, result ? NULL : req->resp, result ? 0 : req->resp_len, user);
+		free_request(req);
+		return;
+	}
+
+	free_request(req);
+	dev->pending--;
+	if (cb)
+		cb(dev, result, user);
+}
+
+static int submit(struct request *req)
+{
+	int ret = libusb_submit_transfer(req->xfer);
+	if (ret == LIBUSB_ERROR_NO_DEVICE)
+		lost(req->dev);
+	if (ret)
+		free_request(req);
+	else
+		req->dev->pending++;
+	return ret;
+}
+
+/*
+ * Control requests
+ */
+
+static void ctrl_cb(struct libusb_transfer *xfer)
+{
+	struct request *req = xfer->user_data;
+	struct i2ctu_dev *dev = req->dev;
+	uint8_t *data = libusb_control_transfer_get_data(xfer);
+	int ret;
+
+	if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		// With inline status, a write whose START wasn't ACKed STALLs its status stage
+		if (xfer->status == LIBUSB_TRANSFER_STALL && req->state == WAIT_IO && dev->inline_status && !req->rd)
+			req->result = I2CTU_NAK;
+		else
+			req->result = transfer_error(xfer->status);
+		complete(req);
+		return;
+	}
+
+	if (req->state == WAIT_STATUS) {
+		req->result = (xfer->actual_length == 1) ? status_result(data[0]) : LIBUSB_ERROR_IO;
+		complete(req);
+		return;
+	}
+
+	if (req->rd) {
+		if (xfer->actual_length < req->len + dev->inline_status) {
+			req->result = LIBUSB_ERROR_IO;
+			complete(req);
+			return;
+		}
+		memcpy(req->data, data, req->len);
+		if (dev->inline_status)
+			req->result = status_result(data[req->len]);
+	}
+
+	if (!dev->inline_status && (req->flags & I2CTU_START)) {
+		// Stock firmware behaviour: ask for the address status separately, reusing the transfer
+		libusb_fill_control_setup(req->buf, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                          CMD_GET_STATUS, 0, 0, 1);
+		libusb_fill_control_transfer(xfer, dev->handle, req->buf, ctrl_cb, req, TIMEOUT_MS);
+		req->state = WAIT_STATUS;
+		if (!(ret = libusb_submit_transfer(xfer)))
+			return;
+		req->result = ret;
+	}
+
+	complete(req);
+}
+
+static int submit_msg(struct i2ctu_dev *dev, uint8_t addr, uint8_t rd, uint8_t flags, uint8_t *buf, uint16_t len,
+                      i2ctu_cb cb, void *user)
+{
+	uint16_t wlen = (rd && dev->inline_status) ? len + 1 : len;
+	uint8_t cmd = CMD_I2C_IO;
+	struct request *req;
+	int ret;
+
+	if (rd && dev->inline_status && len == UINT16_MAX)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (dev->planned)
+		plan_reads(dev);
+
+	// One spare byte for the chained status request
+	req = alloc_request(dev, LIBUSB_CONTROL_SETUP_SIZE + wlen + 1, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	if (flags & I2CTU_START)
+		cmd |= CMD_I2C_IO_BEGIN;
+	if (flags & I2CTU_STOP)
+		cmd |= CMD_I2C_IO_END;
+
+	req->data = buf;
+	req->len = len;
+	req->rd = rd;
+	req->flags = flags;
+	req->state = WAIT_IO;
+
+	libusb_fill_control_setup(req->buf, (rd ? LIBUSB_ENDPOINT_IN : LIBUSB_ENDPOINT_OUT) |
+	                          LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                          cmd, rd ? I2C_M_RD : 0, addr, wlen);
+	if (!rd && len)
+		memcpy(req->buf + LIBUSB_CONTROL_SETUP_SIZE, buf, len);
+	libusb_fill_control_transfer(req->xfer, dev->handle, req->buf, ctrl_cb, req, TIMEOUT_MS);
+
+	// Control transfers only complete from within event handling, so the request is still there afterwards
+	if ((ret = submit(req)) || !dev->record)
+		return ret;
+	record_request(dev, req, I2CTU_REC_MSG, buf, rd ? 0 : len);
+	return 0;
+}
+
+/** Queues one CMD_I2C_IO request. \c flags controls whether the request sends a START (and the address) first
+ *  and a STOP afterwards, so one struct i2c_msg is I2CTU_START | I2CTU_STOP; longer messages may be split
+ *  into several requests. The result reflects the address status of the last START.
+ */
+int i2ctu_submit_msg(struct i2ctu_dev *dev, uint8_t addr, uint8_t rd, uint8_t flags, uint8_t *buf, uint16_t len,
+                     i2ctu_cb cb, void *user)
+{
+	int ret;
+
+	if ((ret = submit_msg(dev, addr, rd, flags, buf, len, cb, user)) == 0 && !rd)
+		regcache_written(dev, addr);
+	return ret;
+}
+
+/*
+ * Bulk requests
+ */
+
+static void start_in(struct i2ctu_dev *dev);
+
+static void unqueue(struct request *req)
+{
+	struct i2ctu_dev *dev = req->dev;
+	struct request **p, *prev = NULL;
+
+	for (p = &dev->head; *p; prev = *p, p = &(*p)->next) {
+		if (*p == req) {
+			*p = req->next;
+			if (dev->tail == req)
+				dev->tail = prev;
+			break;
+		}
+	}
+	req->state &= ~WAIT_RESPONSE;
+}
+
+// What a bare status byte says in terms of a detail record
+static uint8_t status_detail(uint8_t status)
+{
+	switch (status) {
+	case STATUS_ADDRESS_ACK:     return BATCH_RESULT_OK;
+	case STATUS_ADDRESS_NAK:     return BATCH_RESULT_ADDRESS_NAK;
+	case STATUS_BUS_BUSY:        return BATCH_RESULT_BUS_BUSY;
+	case STATUS_STRETCH_TIMEOUT: return BATCH_RESULT_STRETCH_TIMEOUT;
+	case STATUS_IDLE:            return BATCH_RESULT_SKIPPED;
+	case STATUS_EXPIRED:         return BATCH_RESULT_EXPIRED;
+	default:                     return BATCH_RESULT_BUS_FAULT;
+	}
+}
+
+static int detail_result(uint8_t result)
+{
+	switch (result) {
+	case BATCH_RESULT_OK:          return I2CTU_OK;
+	case BATCH_RESULT_ADDRESS_NAK:
+	case BATCH_RESULT_DATA_NAK:    return I2CTU_NAK;
+	case BATCH_RESULT_BUS_BUSY:    return I2CTU_BUSY;
+	case BATCH_RESULT_EXPIRED:     return I2CTU_EXPIRED;
+	default:                       return I2CTU_FAULT;
+	}
+}
+
+// Split a batch response back into the segments' buffers and results; segments continuing the previous one have
+// no status or detail record of their own and share those of the segment they continue
+static void scatter(struct request *req)
+{
+	const uint8_t *p = req->resp;
+	uint8_t result = BATCH_RESULT_OK, twsr = TWSR_NO_INFO;
+
+	for (int i = 0; i < req->count; i++) {
+		struct i2ctu_msg *msg = &req->msgs[i];
+		const int start = !(msg->flags & I2C_M_NOSTART);
+
+		if (start) {
+			result = status_detail(*p);
+			twsr = TWSR_NO_INFO;
+			if (*p != STATUS_ADDRESS_ACK && !req->result)
+				req->result = status_result(*p);
+			p++;
+		}
+		if (msg->flags & I2C_M_RD) {
+			memcpy(msg->buf, p, msg->len);
+			p += msg->len;
+		}
+		if (start && req->detail) {
+			result = p[0];
+			twsr = p[1];
+			p += 2;
+			if (!req->result)
+				req->result = detail_result(result);
+		}
+
+		msg->result = result;
+		msg->twsr = twsr;
+	}
+}
+
+// Split a GATHER response into the data buffer and per target results; the request fails with the first failure
+static void gather(struct request *req)
+{
+	const uint8_t *p = req->resp;
+
+	for (int i = 0; i < req->count; i++) {
+		const int result = status_result(p[req->len]);
+
+		memcpy(req->data + i * req->len, p, req->len);
+		p += req->len + 1;
+		if (req->results)
+			req->results[i] = result;
+		if (!req->result)
+			req->result = result;
+	}
+}
+
+// Per channel results of an EEPROM gang write, the same way
+static void gang_results(struct request *req)
+{
+	for (int i = 0; i < req->count; i++) {
+		const int result = status_result(req->resp[i]);
+
+		if (req->results)
+			req->results[i] = result;
+		if (!req->result)
+			req->result = result;
+	}
+}
+
+// Round trips set the automatic deadline: waiting a quarter of one for more requests to share the packet costs
+// little latency compared to it
+// Split a SCATTER response the same way, into the data of all ranges back to back; the range lengths are those in
+// the command, which is still in the request
+static void scatter_ranges(struct request *req)
+{
+	const uint8_t *p = req->resp, *lens = req->buf + 3 + 1;
+	uint8_t *data = req->data;
+
+	for (int i = 0; i < req->count; i++) {
+		const uint8_t len = lens[2 * i];
+		const int result = status_result(p[len]);
+
+		memcpy(data, p, len);
+		data += len;
+		p += len + 1;
+		if (req->results)
+			req->results[i] = result;
+		if (!req->result)
+			req->result = result;
+	}
+}
+
+static void measure_rtt(struct i2ctu_dev *dev, struct request *req)
+{
+	int rtt = now_us() - req->sent_us, deadline;
+
+	dev->rtt_us += (rtt - dev->rtt_us) / 8;
+	deadline = dev->rtt_us / 4;
+	dev->deadline_us = deadline < DEADLINE_MIN ? DEADLINE_MIN : deadline > DEADLINE_MAX ? DEADLINE_MAX : deadline;
+}
+
+static void response_done(struct request *req)
+{
+	unqueue(req);
+	if (req->sent_us && !req->result)
+		measure_rtt(req->dev, req);
+	if (req->gather && !req->result)
+		gather(req);
+	if (req->scatter && !req->result)
+		scatter_ranges(req);
+	if (req->gang && !req->result)
+		gang_results(req);
+	if (req->msgs && !req->result)
+		scatter(req);
+	else if (req->status && !req->result)
+		req->result = status_result(req->resp[req->resp_len - 1]);
+	if (req->status && req->data)
+		memcpy(req->data, req->resp, req->resp_len - 1);
+	if (req->bitmap)
+		*req->bitmap = req->resp[0] | req->resp[1] << 8;
+	if (req->crc)
+		*req->crc = req->resp[0] | req->resp[1] << 8 | req->resp[2] << 16 | (uint32_t)req->resp[3] << 24;
+	if (req->view && req->state && req->resp && req->resp != req->copy) {
+		// Still waiting for its OUT transfer, and the IN transfer it was lent out of goes out again before that
+		if ((req->copy = malloc(req->resp_len)))
+			memcpy(req->copy, req->resp, req->resp_len);
+		else if (!req->result)
+			req->result = LIBUSB_ERROR_NO_MEM;
+		req->resp = req->copy;
+		req->dev->stats.view_copies++;
+	}
+	if (!req->state)
+		complete(req);
+}
+
+static void fail_queued(struct i2ctu_dev *dev, int error)
+{
+	while (dev->head) {
+		struct request *req = dev->head;
+		if (!req->result)
+			req->result = error;
+		unqueue(req);
+		if (!req->state)
+			complete(req);
+	}
+}
+
+static void in_cb(struct libusb_transfer *xfer)
+{
+	struct i2ctu_dev *dev = xfer->user_data;
+	const uint8_t *data = xfer->buffer;
+	int len = xfer->actual_length;
+
+	// Timeouts may still have delivered data, so hand that out first
+	while (len && dev->head) {
+		struct request *req = dev->head;
+		int n = req->resp_len - req->resp_done;
+
+		if (n > len)
+			n = len;
+		if (req->view && n == req->resp_len) {
+			// All of it is in this transfer, which stays busy until its callbacks are done
+			req->resp = (uint8_t *)data;
+			dev->stats.views++;
+		} else {
+			if (req->view && !req->resp && !(req->resp = req->copy = malloc(req->resp_len)) && !req->result)
+				req->result = LIBUSB_ERROR_NO_MEM;
+			if (req->resp)
+				memcpy(req->resp + req->resp_done, data, n);
+			if (req->view)
+				dev->stats.view_copies += !req->resp_done;
+		}
+		req->resp_done += n;
+		data += n;
+		len -= n;
+
+		if (req->resp_done == req->resp_len) {
+			response_done(req);
+
+			// Over HID the rest of the report is padding, the next response starts with the next one
+			if (dev->hid)
+				len = 0;
+		}
+	}
+
+	// Anything left over wasn't asked for (e.g. poll records) and is dropped. Only now may the buffer be reused:
+	// with mapped device memory, resubmitting it while it's still being read would let new data in underneath.
+	for (int i = 0; i < IN_TRANSFERS; i++)
+		if (dev->in[i] == xfer)
+			dev->in_busy[i] = 0;
+
+	if (xfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		// The stream position is lost, nothing queued can be trusted any more
+		fail_queued(dev, transfer_error(xfer->status));
+		return;
+	}
+
+	start_in(dev);
+}
+
+// Keep IN transfers pending for as long as anybody waits for response data
+static void start_in(struct i2ctu_dev *dev)
+{
+	for (int i = 0; i < IN_TRANSFERS && dev->head; i++) {
+		int ret;
+
+		if (dev->in_busy[i])
+			continue;
+
+		// Reports are always full, so over HID a longer transfer would only end once the next ones came in
+		libusb_fill_bulk_transfer(dev->in[i], dev->handle, I2CTU_EP_BULK_IN, dev->in_buf[i],
+		                          dev->hid ? I2CTU_EP_SIZE : IN_SIZE, in_cb, dev, TIMEOUT_MS);
+		if (dev->hid)
+			dev->in[i]->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+		if ((ret = libusb_submit_transfer(dev->in[i]))) {
+			// Only give up if there is no other transfer left to pick the data up
+			for (int j = 0; j < IN_TRANSFERS; j++)
+				if (dev->in_busy[j])
+					return;
+			fail_queued(dev, ret);
+			return;
+		}
+		dev->in_busy[i] = 1;
+	}
+}
+
+// Done with sending a list of requests' commands, successfully or not
+static void sent(struct request *req, int error)
+{
+	while (req) {
+		struct request *next = req->out_next;
+
+		req->state &= ~WAIT_IO;
+		if (error) {
+			if (!req->result)
+				req->result = error;
+			unqueue(req);
+		}
+		if (!req->state)
+			complete(req);
+		req = next;
+	}
+}
+
+// A command stream that broke off somewhere can't be continued: the device may be stuck in the middle of a
+// command, so nothing staged can go out and nothing queued will get its response
+static void fail_stream(struct i2ctu_dev *dev, int error)
+{
+	struct request *staged = dev->staged;
+
+	dev->staged = dev->staged_tail = NULL;
+	dev->staged_len = 0;
+	sent(staged, error);
+	fail_queued(dev, error);
+}
+
+static void flush_out(struct i2ctu_dev *dev, int partial);
+
+static void out_cb(struct libusb_transfer *xfer)
+{
+	struct out_slot *slot = xfer->user_data;
+	struct i2ctu_dev *dev = slot->dev;
+	struct request *reqs = slot->reqs;
+	int error = transfer_error(xfer->status);
+
+	// The device has taken these bytes in, which returns their credits
+	slot->busy = 0;
+	slot->reqs = NULL;
+	dev->in_flight -= slot->len;
+	sent(reqs, error);
+	if (error)
+		fail_stream(dev, error);
+	else
+		flush_out(dev, 1);
+}
+
+// Largest OUT transfer: the credits of a device with less room than that
+static int chunk_size(struct i2ctu_dev *dev)
+{
+	return (dev->credits && dev->credits < OUT_SIZE) ? dev->credits : OUT_SIZE;
+}
+
+// Fill an OUT transfer from the front of the staged stream, requests may straddle transfers
+static int send_out(struct i2ctu_dev *dev, struct out_slot *slot, int size)
+{
+	struct request **tail = &slot->reqs;
+	int len = 0, ret;
+
+	while (dev->staged && len < size) {
+		struct request *req = dev->staged;
+		int n = req->cmd_len - req->cmd_sent;
+
+		if (n > size - len)
+			n = size - len;
+		memcpy(slot->buf + len, req->buf + req->cmd_sent, n);
+		req->cmd_sent += n;
+		dev->staged_len -= n;
+		len += n;
+
+		if (req->cmd_sent == req->cmd_len) {
+			if (dev->deadline == I2CTU_DEADLINE_AUTO && (req->state & WAIT_RESPONSE))
+				req->sent_us = now_us();
+			dev->staged = req->out_next;
+			if (!dev->staged)
+				dev->staged_tail = NULL;
+			req->out_next = NULL;
+			*tail = req;
+			tail = &req->out_next;
+		}
+	}
+
+	libusb_fill_bulk_transfer(slot->xfer, dev->handle, I2CTU_EP_BULK_OUT, slot->buf, len, out_cb, slot, TIMEOUT_MS);
+	if (dev->hid)
+		slot->xfer->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+	if ((ret = libusb_submit_transfer(slot->xfer))) {
+		sent(slot->reqs, ret);
+		slot->reqs = NULL;
+		return ret;
+	}
+
+	slot->busy = 1;
+	slot->len = len;
+	dev->in_flight += len;
+	dev->stats.transfers++;
+	dev->stats.bytes += len;
+	dev->stats.packets += (len + dev->ep_size - 1) / dev->ep_size;
+	return 0;
+}
+
+// Hand the staged stream to free OUT transfers; full ones go right away, a partial one only if asked to. Whatever
+// doesn't fit into the transfers or credits in flight waits for a transfer to finish, collecting more requests in
+// the meantime. A transfer only goes out once there are credits for all of it, so they aren't frittered away on
+// short ones.
+static void flush_out(struct i2ctu_dev *dev, int partial)
+{
+	const int chunk = chunk_size(dev);
+
+	for (int i = 0; i < dev->depth && dev->staged_len; i++) {
+		int size = (dev->staged_len < chunk) ? dev->staged_len : chunk;
+		int ret;
+
+		if (dev->out[i].busy)
+			continue;
+		if (!partial && dev->staged_len < chunk)
+			return;
+		if (partial == FLUSH_PACKETS && size < chunk && !(size -= size % dev->ep_size))
+			return;
+		if (dev->credits && dev->in_flight + size > dev->credits) {
+			dev->stats.credit_waits++;
+			return;
+		}
+		if ((ret = send_out(dev, &dev->out[i], size))) {
+			fail_stream(dev, ret);
+			return;
+		}
+	}
+}
+
+// With a deadline, a packet's worth of staged commands goes out right away and less than that once the oldest of
+// them has waited for the deadline; anything not due yet waits for the next request or event
+static void flush_due(struct i2ctu_dev *dev)
+{
+	if (!dev->staged_len)
+		return;
+	if (now_us() - dev->staged_us >= (uint64_t)dev->deadline_us) {
+		dev->stats.deadline_flushes++;
+		flush_out(dev, 1);
+	} else {
+		flush_out(dev, FLUSH_PACKETS);
+	}
+}
+
+// Commands left staged outside of i2ctu_dispatch() only go out once the event loop comes round to flushing them
+static void wake_loop(struct i2ctu_dev *dev)
+{
+	const uint64_t one = 1;
+
+	// A deadline is kept by i2ctu_get_timeout() instead; cache hits and held back reads go with the next dispatch
+	if (dev->wake_fd < 0 || dev->woken || ((!dev->staged_len || dev->deadline) && !dev->hits && !dev->planned))
+		return;
+	if (write(dev->wake_fd, &one, sizeof(one)) == sizeof(one))
+		dev->woken = 1;
+}
+
+static int submit_bulk(struct request *req, int cmd_len)
+{
+	struct i2ctu_dev *dev = req->dev;
+
+	// Held back register reads were submitted first, so they go out first
+	if (dev->planned)
+		plan_reads(dev);
+	if (dev->record)
+		record_request(dev, req, I2CTU_REC_BULK, req->buf, cmd_len);
+
+	// The callers leave room for it
+	if (dev->hid)
+		req->buf[cmd_len++] = BULK_OP_FLUSH;
+
+	req->cmd_len = cmd_len;
+	req->state = WAIT_IO;
+	dev->pending++;
+	dev->stats.requests++;
+
+	if (dev->staged_tail)
+		dev->staged_tail->out_next = req;
+	else
+		dev->staged = req;
+	dev->staged_tail = req;
+	if (!dev->staged_len && dev->deadline)
+		dev->staged_us = now_us();
+	dev->staged_len += cmd_len;
+
+	if (req->resp_len) {
+		req->state |= WAIT_RESPONSE;
+		if (dev->tail)
+			dev->tail->next = req;
+		else
+			dev->head = req;
+		dev->tail = req;
+		start_in(dev);
+	}
+
+	if (dev->deadline)
+		flush_due(dev);
+	else
+		flush_out(dev, 0);
+	wake_loop(dev);
+	return 0;
+}
+
+/** Queues a raw bulk command stream which produces exactly \c resp_len response bytes. */
+int i2ctu_submit_bulk(struct i2ctu_dev *dev, const uint8_t *cmd, int cmd_len, uint8_t *resp, int resp_len,
+                      i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions & FUNC_EXT_BULK))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, cmd_len + dev->hid, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	memcpy(req->buf, cmd, cmd_len);
+	req->resp = resp;
+	req->resp_len = resp_len;
+
+	return submit_bulk(req, cmd_len);
+}
+
+/** Like i2ctu_submit_bulk(), but instead of being copied to a buffer of the caller's the response is handed to
+ *  \c cb where it lies, usually right in the IN transfer it came in. The data is only valid during the callback;
+ *  it is NULL if the request failed. Responses spread over several IN transfers are put together in a buffer of
+ *  their own first.
+ */
+int i2ctu_submit_bulk_view(struct i2ctu_dev *dev, const uint8_t *cmd, int cmd_len, int resp_len,
+                           i2ctu_view_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions & FUNC_EXT_BULK))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (!cb || resp_len < 1)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	req = alloc_request(dev, cmd_len + dev->hid, NULL, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	memcpy(req->buf, cmd, cmd_len);
+	req->view = cb;
+	req->resp_len = resp_len;
+
+	return submit_bulk(req, cmd_len);
+}
+
+// Length of the write segment starting at msgs[i] with all I2C_M_NOSTART writes after it merged in
+static uint32_t merged_len(const struct i2ctu_msg *msgs, int count, int i)
+{
+	uint32_t len = msgs[i].len;
+
+	while (++i < count && (msgs[i].flags & I2C_M_NOSTART))
+		len += msgs[i].len;
+	return len;
+}
+
+// Common part of the batch submit functions; at is the frame number and offset for BATCH_FLAG_AT, by those of a
+// DEADLINE, or NULL
+static int submit_batch(struct i2ctu_dev *dev, struct i2ctu_msg *msgs, int count, const uint16_t *at,
+                        const uint16_t *by, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+	int cmd_len, resp_len = 0, starts = 0, raw = !(dev->extensions & FUNC_EXT_BATCH), data_len = 0, detail, ten = 0;
+	int abort = 0;
+	uint8_t *p;
+
+	if (!(dev->extensions & FUNC_EXT_BULK))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (count < 1 || (msgs[0].flags & I2C_M_NOSTART))
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	for (int i = 0; i < count; i++) {
+		const int rd = msgs[i].flags & I2C_M_RD;
+
+		if (msgs[i].flags & I2C_M_NOSTART) {
+			// Continuing a transfer in the other direction would need a START for the new R/W bit
+			if (rd != (msgs[i - 1].flags & I2C_M_RD))
+				return LIBUSB_ERROR_INVALID_PARAM;
+			if (rd)
+				raw = 1;
+		} else {
+			starts++;
+			resp_len++;
+			if (msgs[i].flags & I2C_M_TEN)
+				ten = 1;
+			if (msgs[i].flags & I2CTU_M_ABORT) {
+				if (msgs[i].flags & I2C_M_TEN)
+					return LIBUSB_ERROR_INVALID_PARAM;
+				abort = 1;
+			}
+			if (!rd && merged_len(msgs, count, i) > UINT16_MAX)
+				raw = 1;
+		}
+
+		if (rd)
+			resp_len += msgs[i].len;
+		else
+			data_len += msgs[i].len;
+	}
+
+	// BATCH: opcode, count, then a header per segment; otherwise START per segment, an op and length per message
+	if (starts > 255)
+		raw = 1;
+	// Only a BATCH command can carry an execute-at time, a 10-bit address or a failure policy
+	if ((at || by || ten || abort) && raw)
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (abort && !(dev->extensions2 & FUNC_EXT2_ON_FAIL))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (ten && !(dev->extensions2 & FUNC_EXT2_TEN_BIT))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	detail = !raw && (dev->extensions & FUNC_EXT_BATCH_DETAIL);
+	if (raw)
+		cmd_len = 2 * starts + 3 * count + data_len + 1;
+	else
+		cmd_len = 2 + 4 * starts + data_len + (at ? 4 : 0) + (by ? 5 : 0);
+	if (detail)
+		resp_len += 2 * starts;
+
+	req = alloc_request(dev, cmd_len + dev->hid + resp_len, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->msgs = msgs;
+	req->count = count;
+	req->detail = detail;
+
+	p = req->buf;
+	if (by) {
+		*p++ = BULK_OP_DEADLINE;
+		*p++ = by[0] & 0xff;
+		*p++ = by[0] >> 8;
+		*p++ = by[1] & 0xff;
+		*p++ = by[1] >> 8;
+	}
+	if (!raw) {
+		*p++ = BULK_OP_BATCH;
+		*p++ = starts;
+	}
+	for (int i = 0; i < count; i++) {
+		const int rd = msgs[i].flags & I2C_M_RD;
+		const int start = !(msgs[i].flags & I2C_M_NOSTART);
+		uint16_t len = msgs[i].len;
+
+		if (raw) {
+			if (start) {
+				*p++ = BULK_OP_START;
+				*p++ = (msgs[i].addr << 1) | rd;
+			}
+			// ACK the last byte of a read the next message continues
+			*p++ = !rd ? BULK_OP_WRITE : (i + 1 < count && (msgs[i + 1].flags & I2C_M_NOSTART)) ? BULK_OP_READ_ACK
+			                                                                                        : BULK_OP_READ;
+			*p++ = len & 0xff;
+			*p++ = len >> 8;
+		} else if (start) {
+			if (!rd)
+				len = merged_len(msgs, count, i);
+			*p++ = (rd ? BATCH_FLAG_RD : 0) | (detail ? BATCH_FLAG_DETAIL : 0) | ((at && !i) ? BATCH_FLAG_AT : 0) |
+			       ((msgs[i].flags & I2C_M_TEN) ? BATCH_FLAG_TEN | ((msgs[i].addr >> 3) & BATCH_FLAG_TEN_HIGH) : 0) |
+			       ((msgs[i].flags & I2CTU_M_ABORT) ? BATCH_ON_FAIL_ABORT : 0);
+			*p++ = msgs[i].addr & 0xff;
+			*p++ = len & 0xff;
+			*p++ = len >> 8;
+			if (at && !i) {
+				*p++ = at[0] & 0xff;
+				*p++ = at[0] >> 8;
+				*p++ = at[1] & 0xff;
+				*p++ = at[1] >> 8;
+			}
+		}
+		if (!rd) {
+			memcpy(p, msgs[i].buf, msgs[i].len);
+			p += msgs[i].len;
+		}
+	}
+	if (raw)
+		*p++ = BULK_OP_STOP;
+
+	req->resp = req->buf + cmd_len + dev->hid;
+	req->resp_len = resp_len;
+
+	return submit_bulk(req, cmd_len);
+}
+
+/** Queues a complete struct i2c_msg style transaction. The result is that of the first segment that failed, read
+ *  data ends up in the segments' buffers and each segment gets its result and TWSR code, so msgs must stay valid
+ *  until completion as well. Writes flagged I2C_M_NOSTART are merged into the segment before them; the array goes
+ *  out as one BATCH command if that fits, i.e. up to 255 segments after merging and no I2C_M_NOSTART reads, and as
+ *  the equivalent START/WRITE/READ/STOP commands otherwise, which only report address phase results. Segments with
+ *  10-bit addresses (I2C_M_TEN) need the BATCH command and firmware with FUNC_EXT2_TEN_BIT.
+ */
+int i2ctu_submit_batch(struct i2ctu_dev *dev, struct i2ctu_msg *msgs, int count, i2ctu_cb cb, void *user)
+{
+	int ret;
+
+	if ((ret = submit_batch(dev, msgs, count, NULL, NULL, cb, user)) == 0)
+		regcache_batch(dev, msgs, count);
+	return ret;
+}
+
+/** Queues a transaction as for i2ctu_submit_batch() that the device holds back until \c offset_us microseconds
+ *  after the Start of Frame of USB frame \c frame (11 bits, up to a second ahead), timed by its own Timer1, so
+ *  adapters on the same host can sample together. The frame numbers are those of the event records; a moment that
+ *  has passed already starts the transaction right away. Needs the firmware's BATCH command.
+ */
+int i2ctu_submit_batch_at(struct i2ctu_dev *dev, struct i2ctu_msg *msgs, int count, uint16_t frame,
+                          uint16_t offset_us, i2ctu_cb cb, void *user)
+{
+	const uint16_t at[2] = { frame & 0x7ff, offset_us };
+	int ret;
+
+	if (!(dev->extensions2 & FUNC_EXT2_BATCH_AT))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	if ((ret = submit_batch(dev, msgs, count, at, NULL, cb, user)) == 0)
+		regcache_batch(dev, msgs, count);
+	return ret;
+}
+
+/** Queues a transaction as for i2ctu_submit_batch() that is only of use if it starts by \c offset_us microseconds
+ *  after the Start of Frame of USB frame \c frame, in the same timebase as i2ctu_submit_batch_at(). Past that
+ *  moment the device skips what hasn't started yet, and the request fails with I2CTU_EXPIRED, the segments not run
+ *  getting BATCH_RESULT_EXPIRED. Needs the firmware's DEADLINE command.
+ */
+int i2ctu_submit_batch_by(struct i2ctu_dev *dev, struct i2ctu_msg *msgs, int count, uint16_t frame,
+                          uint16_t offset_us, i2ctu_cb cb, void *user)
+{
+	const uint16_t by[2] = { frame & 0x7ff, offset_us };
+	int ret;
+
+	if (!(dev->extensions3 & FUNC_EXT3_DEADLINE))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	if ((ret = submit_batch(dev, msgs, count, NULL, by, cb, user)) == 0)
+		regcache_batch(dev, msgs, count);
+	return ret;
+}
+
+/** Queues a LOCK command: until one with a timeout of 0, or until the device hasn't received a command for
+ *  \c timeout_ms, no other path of the adapter gets the bus and batches leave their last segment open, so the
+ *  next one follows with a repeated START. Fails with I2CTU_BUSY if another path is in the middle of a transaction.
+ */
+int i2ctu_submit_lock(struct i2ctu_dev *dev, uint16_t timeout_ms, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions & FUNC_EXT_BUS_LOCK))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, 3 + dev->hid + 1, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_LOCK;
+	req->buf[1] = timeout_ms & 0xff;
+	req->buf[2] = timeout_ms >> 8;
+	req->resp = req->buf + 3 + dev->hid;
+	req->resp_len = 1;
+	req->status = 1;
+
+	return submit_bulk(req, 3);
+}
+
+/** Queues a ROUTE command, which switches the muxes registered with CMD_SET_MUX so that the following requests
+ *  reach the targets behind \c route, e.g. MUX_ROUTE(0, 3); MUX_ROUTE_ROOT closes them all. Muxes that are
+ *  already set right aren't written again, so a ROUTE in front of every access costs next to nothing.
+ */
+int i2ctu_submit_route(struct i2ctu_dev *dev, uint8_t route, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions2 & FUNC_EXT2_MUX))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, 2 + dev->hid + 1, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_ROUTE;
+	req->buf[1] = route;
+	req->resp = req->buf + 2 + dev->hid;
+	req->resp_len = 1;
+	req->status = 1;
+
+	return submit_bulk(req, 2);
+}
+
+/** Queues a DISCOVER command, which scans the adapter's bus and then every channel of the \c muxes muxes registered
+ *  with CMD_SET_MUX. \c bitmaps gets a CMD_SCAN style bitmap for the adapter's bus followed by one for each channel
+ *  of each mux in index order, (1 + 8 * muxes) * SCAN_BITMAP_SIZE bytes in all; a channel only lists the targets
+ *  that hang off it, not those visible upstream. \c rd probes by reading as with CMD_SCAN.
+ */
+int i2ctu_submit_discover(struct i2ctu_dev *dev, int muxes, uint8_t rd, uint8_t *bitmaps, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+	const int resp_len = (1 + 8 * muxes) * SCAN_BITMAP_SIZE + 1;
+
+	if (!(dev->extensions2 & FUNC_EXT2_MUX))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (muxes < 0 || muxes > MUX_ENTRIES)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	req = alloc_request(dev, 2 + dev->hid + resp_len, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_DISCOVER;
+	req->buf[1] = rd ? I2C_M_RD : 0;
+	req->resp = req->buf + 2 + dev->hid;
+	req->resp_len = resp_len;
+	req->status = 1;
+	req->data = bitmaps;
+
+	return submit_bulk(req, 2);
+}
+
+/** Queues a REGUPDATE command: the device reads register \c reg of the target and writes it back with the bits in
+ *  \c mask taken from \c value, without letting go of the bus in between. The value read is stored in \c old
+ *  (0 if it couldn't be read) unless that is NULL.
+ */
+int i2ctu_submit_update(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, uint8_t mask, uint8_t value, uint8_t *old,
+                        i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions2 & FUNC_EXT2_REGUPDATE))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, 5 + dev->hid + 2, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_REGUPDATE;
+	req->buf[1] = addr;
+	req->buf[2] = reg;
+	req->buf[3] = mask;
+	req->buf[4] = value;
+	req->resp = req->buf + 5 + dev->hid;
+	req->resp_len = 2;
+	req->status = 1;
+	req->data = old;
+
+	regcache_written(dev, addr);
+	return submit_bulk(req, 5);
+}
+
+/** Queues a write of \c len bytes to the target at 7-bit address \c addr in a single transaction, START, one
+ *  WRITE_LONG and STOP, however long it is; the data streams to the bus as the OUT packets come in. The result only
+ *  tells whether the address was ACKed.
+ */
+int i2ctu_submit_write_long(struct i2ctu_dev *dev, uint8_t addr, const uint8_t *buf, uint32_t len, i2ctu_cb cb,
+                            void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions3 & FUNC_EXT3_WRITE_LONG))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (len > INT32_MAX - 16)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	req = alloc_request(dev, 8 + len + dev->hid + 1, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_START;
+	req->buf[1] = addr << 1;
+	req->buf[2] = BULK_OP_WRITE_LONG;
+	req->buf[3] = len & 0xff;
+	req->buf[4] = len >> 8;
+	req->buf[5] = len >> 16;
+	req->buf[6] = len >> 24;
+	memcpy(req->buf + 7, buf, len);
+	req->buf[7 + len] = BULK_OP_STOP;
+	req->resp = req->buf + 8 + len + dev->hid;
+	req->resp_len = 1;
+	req->status = 1;
+
+	regcache_written(dev, addr);
+	return submit_bulk(req, 8 + len);
+}
+
+/** Queues a verified REGWRITE: \c len bytes from \c buf are written to the registers from \c reg on, read back
+ *  and compared by the firmware. \c mismatch (unless NULL) gets the offset of the first register that read back
+ *  differently, 0xFF if none did; the result is I2CTU_MISMATCH then. Up to 64 bytes with the default settings.
+ */
+int i2ctu_submit_verify(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, const uint8_t *buf, uint8_t len,
+                        uint8_t *mismatch, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions2 & FUNC_EXT2_VERIFY))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, 4 + len + dev->hid + 2, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_REGWRITE;
+	req->buf[1] = addr | BULK_REGWRITE_VERIFY;
+	req->buf[2] = reg;
+	req->buf[3] = len;
+	memcpy(req->buf + 4, buf, len);
+	req->resp = req->buf + 4 + len + dev->hid;
+	req->resp_len = 2;
+	req->status = 1;
+	req->data = mismatch;
+
+	regcache_written(dev, addr);
+	return submit_bulk(req, 4 + len);
+}
+
+/** Queues a MULTIWRITE command: the same \c len bytes are written to each of the \c count targets in \c addrs, one
+ *  transaction after the other. Bit i of \c acked (unless NULL) is set if target i ACKed its address and all data;
+ *  the result is I2CTU_NAK if any of them didn't. Up to 16 targets and 64 bytes with the default firmware settings.
+ */
+int i2ctu_submit_multiwrite(struct i2ctu_dev *dev, const uint8_t *addrs, int count, const uint8_t *buf, uint16_t len,
+                            uint16_t *acked, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+	int cmd_len = 1 + 1 + count + 2 + len;
+
+	if (!(dev->extensions2 & FUNC_EXT2_MULTIWRITE))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (count < 1 || count > MULTIWRITE_MAX_TARGETS)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	req = alloc_request(dev, cmd_len + dev->hid + 3, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_MULTIWRITE;
+	req->buf[1] = count;
+	memcpy(req->buf + 2, addrs, count);
+	req->buf[2 + count] = len & 0xff;
+	req->buf[3 + count] = len >> 8;
+	memcpy(req->buf + 4 + count, buf, len);
+	req->resp = req->buf + cmd_len + dev->hid;
+	req->resp_len = 3;
+	req->status = 1;
+	req->bitmap = acked;
+
+	for (int i = 0; i < count; i++)
+		regcache_written(dev, addrs[i]);
+	return submit_bulk(req, cmd_len);
+}
+
+/** Queues a GATHER command: \c len bytes of register \c reg are read from each of the \c count targets in \c addrs,
+ *  one transaction after the other, into \c buf, target i at offset i * len; that is zeros for a target that failed.
+ *  Each target's result goes into \c results unless that is NULL, the request's result is the first failure.
+ */
+int i2ctu_submit_gather(struct i2ctu_dev *dev, const uint8_t *addrs, int count, uint8_t reg, uint8_t *buf, uint8_t len,
+                        int *results, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+	const int cmd_len = 4 + count, resp_len = count * (len + 1);
+
+	if (!(dev->extensions2 & FUNC_EXT2_GATHER))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (count < 1 || count > 255)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	req = alloc_request(dev, cmd_len + dev->hid + resp_len, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_GATHER;
+	req->buf[1] = count;
+	req->buf[2] = reg;
+	req->buf[3] = len;
+	memcpy(req->buf + 4, addrs, count);
+	req->resp = req->buf + cmd_len + dev->hid;
+	req->resp_len = resp_len;
+	req->gather = 1;
+	req->count = count;
+	req->data = buf;
+	req->len = len;
+	req->results = results;
+
+	return submit_bulk(req, cmd_len);
+}
+
+/** Queues a STREAM command: \c count samples of \c size bytes from \c buf are written to the target one per
+ *  transaction, one every \c period_us microseconds as timed by the device. The samples go out as fast as the
+ *  transport takes them, the device plays them from its double banked endpoint; the number of samples that couldn't
+ *  go out on time is stored in \c underruns unless that is NULL. Keep the period longer than one transaction.
+ */
+int i2ctu_submit_stream(struct i2ctu_dev *dev, uint8_t addr, uint8_t size, uint16_t period_us, const uint8_t *buf,
+                        uint32_t count, uint16_t *underruns, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+	int cmd_len;
+
+	if (!(dev->extensions2 & FUNC_EXT2_STREAM))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (!size || count > (INT_MAX - 16) / size)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	cmd_len = 9 + count * size;
+	req = alloc_request(dev, cmd_len + dev->hid + 3, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_STREAM;
+	req->buf[1] = addr;
+	req->buf[2] = size;
+	req->buf[3] = period_us & 0xff;
+	req->buf[4] = period_us >> 8;
+	req->buf[5] = count & 0xff;
+	req->buf[6] = (count >> 8) & 0xff;
+	req->buf[7] = (count >> 16) & 0xff;
+	req->buf[8] = count >> 24;
+	memcpy(req->buf + 9, buf, (size_t)count * size);
+	req->resp = req->buf + cmd_len + dev->hid;
+	req->resp_len = 3;
+	req->status = 1;
+	req->bitmap = underruns;
+
+	regcache_written(dev, addr);
+	return submit_bulk(req, cmd_len);
+}
+
+/** Queues a PROGRAM command: \c len bytes from \c buf go to a bootloader as blocks of \c prog->block_size, the
+ *  last one padded with 0xFF, each written with its memory address and waited for by the device as \c prog says.
+ *  The number of blocks that went through is stored in \c blocks unless that is NULL.
+ */
+int i2ctu_submit_program(struct i2ctu_dev *dev, uint8_t addr, const struct i2ctu_program *prog, const uint8_t *buf,
+                         uint32_t len, uint16_t *blocks, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+	int cmd_len;
+
+	if (!(dev->extensions2 & FUNC_EXT2_PROGRAM))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (!prog->block_size || (prog->format & PROGRAM_FMT_WIDTH) > 4 || len > INT_MAX - 32)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	cmd_len = 18 + len;
+	req = alloc_request(dev, cmd_len + dev->hid + 3, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_PROGRAM;
+	req->buf[1] = addr;
+	req->buf[2] = prog->format;
+	req->buf[3] = prog->command;
+	req->buf[4] = prog->block_size & 0xff;
+	req->buf[5] = prog->block_size >> 8;
+	for (int i = 0; i < 4; i++) {
+		req->buf[6 + i] = (prog->address >> (i * 8)) & 0xff;
+		req->buf[10 + i] = (len >> (i * 8)) & 0xff;
+	}
+	req->buf[14] = prog->poll_reg;
+	req->buf[15] = prog->poll_mask;
+	req->buf[16] = prog->poll_value;
+	req->buf[17] = prog->timeout_ms;
+	memcpy(req->buf + 18, buf, len);
+	req->resp = req->buf + cmd_len + dev->hid;
+	req->resp_len = 3;
+	req->status = 1;
+	req->bitmap = blocks;
+
+	regcache_written(dev, addr);
+	return submit_bulk(req, cmd_len);
+}
+
+/** Queues a SCATTER command: the \c count register ranges of the target at \c addr, register \c regs[i] and
+ *  \c lens[i] bytes, are read one after the other in a single command, each with its register write and a repeated
+ *  START, for parts that don't auto-increment across them. The data of all ranges goes to \c buf back to back, and
+ *  each range's result to \c results unless that is NULL; the request fails with the first failure.
+ */
+int i2ctu_submit_scatter(struct i2ctu_dev *dev, uint8_t addr, const uint8_t *regs, const uint8_t *lens, int count,
+                         uint8_t *buf, int *results, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+	const int cmd_len = 3 + 2 * count;
+	int resp_len = count;
+
+	if (!(dev->extensions3 & FUNC_EXT3_SCATTER))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (count < 1 || count > 255)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	for (int i = 0; i < count; i++)
+		resp_len += lens[i];
+
+	req = alloc_request(dev, cmd_len + dev->hid + resp_len, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_SCATTER;
+	req->buf[1] = addr;
+	req->buf[2] = count;
+	for (int i = 0; i < count; i++) {
+		req->buf[3 + 2 * i] = regs[i];
+		req->buf[4 + 2 * i] = lens[i];
+	}
+	req->resp = req->buf + cmd_len + dev->hid;
+	req->resp_len = resp_len;
+	req->scatter = 1;
+	req->count = count;
+	req->data = buf;
+	req->results = results;
+
+	return submit_bulk(req, cmd_len);
+}
+
+/** Queues a CHECKSUM command: the device reads \c len bytes from memory offset \c offset of the target, after
+ *  writing the offset as \c addr_width bytes (0 to 2, 0 reads on from the target's current pointer; block-select
+ *  bits may be added with EEPROM_FMT()), and returns just their CRC-32, which is stored in \c crc unless that is NULL. It is the same value zlib's crc32() gives for
+ *  the data, so an image can be verified without reading it back.
+ */
+int i2ctu_submit_checksum(struct i2ctu_dev *dev, uint8_t addr, uint8_t addr_width, uint16_t offset, uint32_t len,
+                          uint32_t *crc, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions2 & FUNC_EXT2_CHECKSUM))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if ((addr_width & EEPROM_FMT_WIDTH) > 2 || addr_width > EEPROM_FMT_WIDTH + EEPROM_FMT_BLOCKS)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if ((addr_width & EEPROM_FMT_BLOCKS) && !(dev->extensions3 & FUNC_EXT3_EEPROM_BLOCKS))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, 9 + dev->hid + 5, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_CHECKSUM;
+	req->buf[1] = addr;
+	req->buf[2] = addr_width;
+	req->buf[3] = offset & 0xff;
+	req->buf[4] = offset >> 8;
+	req->buf[5] = len & 0xff;
+	req->buf[6] = (len >> 8) & 0xff;
+	req->buf[7] = (len >> 16) & 0xff;
+	req->buf[8] = len >> 24;
+	req->resp = req->buf + 9 + dev->hid;
+	req->resp_len = 5;
+	req->status = 1;
+	req->crc = crc;
+
+	return submit_bulk(req, 9);
+}
+
+/** Queues an EEPROM_READ: \c len bytes from memory offset \c offset of an EEPROM addressed as \c format describes
+ *  (see EEPROM_FMT()) are read into \c buf in a single command, whichever blocks they lie in.
+ */
+int i2ctu_submit_eeprom_read(struct i2ctu_dev *dev, uint8_t addr, uint8_t format, uint32_t offset, uint8_t *buf,
+                             uint32_t len, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions3 & FUNC_EXT3_EEPROM_BLOCKS))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if ((format & EEPROM_FMT_WIDTH) > 2 || format > EEPROM_FMT_WIDTH + EEPROM_FMT_BLOCKS || len > INT32_MAX - 16)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	req = alloc_request(dev, 11 + dev->hid + len + 1, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_EEPROM_READ;
+	req->buf[1] = addr;
+	req->buf[2] = format;
+	req->buf[3] = offset & 0xff;
+	req->buf[4] = (offset >> 8) & 0xff;
+	req->buf[5] = (offset >> 16) & 0xff;
+	req->buf[6] = offset >> 24;
+	req->buf[7] = len & 0xff;
+	req->buf[8] = (len >> 8) & 0xff;
+	req->buf[9] = (len >> 16) & 0xff;
+	req->buf[10] = len >> 24;
+	req->resp = req->buf + 11 + dev->hid;
+	req->resp_len = len + 1;
+	req->status = 1;
+	req->data = buf;
+
+	return submit_bulk(req, 11);
+}
+
+/** Queues an EEPROM write: the device writes \c len bytes to memory offset \c offset in pages of \c page_size,
+ *  ACK polling the EEPROM around each page, and completes once the last page is stored. \c format is the
+ *  addressing byte, a memory address width of 1 or 2 with block-select bits from EEPROM_FMT() where supported.
+ */
+int i2ctu_submit_eeprom_write(struct i2ctu_dev *dev, uint8_t addr, uint8_t format, uint16_t page_size,
+                              uint16_t offset, const uint8_t *buf, uint16_t len, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions & FUNC_EXT_BULK))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (!(format & EEPROM_FMT_WIDTH) || (format & EEPROM_FMT_WIDTH) > 2 || format > EEPROM_FMT_WIDTH + EEPROM_FMT_BLOCKS)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if ((format & EEPROM_FMT_BLOCKS) && !(dev->extensions3 & FUNC_EXT3_EEPROM_BLOCKS))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, 9 + len + dev->hid + 1, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_EEPROM_WRITE;
+	req->buf[1] = addr;
+	req->buf[2] = format;
+	req->buf[3] = page_size & 0xff;
+	req->buf[4] = page_size >> 8;
+	req->buf[5] = offset & 0xff;
+	req->buf[6] = offset >> 8;
+	req->buf[7] = len & 0xff;
+	req->buf[8] = len >> 8;
+	memcpy(req->buf + 9, buf, len);
+	req->resp = req->buf + 9 + len + dev->hid;
+	req->resp_len = 1;
+	req->status = 1;
+
+	regcache_written(dev, addr);
+	return submit_bulk(req, 9 + len);
+}
+
+/** Queues the same EEPROM write on the bit-banged channels in the mask \c channels, one EEPROM at \c addr on each,
+ *  with the arguments of i2ctu_submit_eeprom_write(). The device writes all of them in lockstep, so this takes as
+ *  long as a single write. Each channel's result goes into \c results, lowest channel first, unless that is NULL;
+ *  the request's result is the first failure.
+ */
+int i2ctu_submit_eeprom_gang(struct i2ctu_dev *dev, uint8_t channels, uint8_t addr, uint8_t format,
+                             uint16_t page_size, uint16_t offset, const uint8_t *buf, uint16_t len, int *results,
+                             i2ctu_cb cb, void *user)
+{
+	const int count = __builtin_popcount(channels);
+	struct request *req;
+
+	if (!(dev->extensions3 & FUNC_EXT3_EEPROM_GANG))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (!channels || (channels >> FUNC_EXT_SOFTI2C_COUNT(dev->extensions)))
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (!(format & EEPROM_FMT_WIDTH) || (format & EEPROM_FMT_WIDTH) > 2 || format > EEPROM_FMT_WIDTH + EEPROM_FMT_BLOCKS)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	// Switched back to the TWI bus right after, where every other request expects to be
+	req = alloc_request(dev, 2 + 9 + len + 2 + dev->hid + count, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_CHANNEL;
+	req->buf[1] = channels;
+	req->buf[2] = BULK_OP_EEPROM_WRITE;
+	req->buf[3] = addr;
+	req->buf[4] = format;
+	req->buf[5] = page_size & 0xff;
+	req->buf[6] = page_size >> 8;
+	req->buf[7] = offset & 0xff;
+	req->buf[8] = offset >> 8;
+	req->buf[9] = len & 0xff;
+	req->buf[10] = len >> 8;
+	memcpy(req->buf + 11, buf, len);
+	req->buf[11 + len] = BULK_OP_CHANNEL;
+	req->buf[12 + len] = 0;
+	req->resp = req->buf + 13 + len + dev->hid;
+	req->resp_len = count;
+	req->gang = 1;
+	req->count = count;
+	req->results = results;
+
+	return submit_bulk(req, 13 + len);
+}
+
+/** Queues a full duplex SPI transfer of \c len bytes: \c tx goes out on MOSI with chip select line \c cs asserted
+ *  (SPI_NO_CS for none) and what comes in on MISO meanwhile is stored in \c rx unless that is NULL. \c config is
+ *  the SPI mode in bits 0-1, the clock F_CPU / 2^(n + 1) in bits 2-4, LSB first in bit 5, and in bit 6 whether the
+ *  chip select stays asserted for the next transfer on the same line.
+ */
+int i2ctu_submit_spi(struct i2ctu_dev *dev, uint8_t config, uint8_t cs, const uint8_t *tx, uint8_t *rx, uint16_t len,
+                     i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions2 & FUNC_EXT2_SPI))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (cs != SPI_NO_CS && cs >= FUNC_EXT2_SPI_CS(dev->extensions2))
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	req = alloc_request(dev, 5 + len + dev->hid + len + 1, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_SPI;
+	req->buf[1] = config;
+	req->buf[2] = cs;
+	req->buf[3] = len & 0xff;
+	req->buf[4] = len >> 8;
+	memcpy(req->buf + 5, tx, len);
+	req->resp = req->buf + 5 + len + dev->hid;
+	req->resp_len = len + 1;
+	req->status = 1;
+	req->data = rx;
+
+	return submit_bulk(req, 5 + len);
+}
+
+/** Queues a GPIO operation, \c op being GPIO_OP() of protocol.h, and stores the level the pin reads afterwards in
+ *  \c level unless that is NULL. A wait that times out fails with I2CTU_NAK, as does a pin the firmware doesn't
+ *  have. To run operations between the segments of a batch, use BATCH_FLAG_GPIO segments instead.
+ */
+int i2ctu_submit_gpio(struct i2ctu_dev *dev, uint8_t op, uint16_t arg, uint8_t *level, i2ctu_cb cb, void *user)
+{
+	struct request *req;
+
+	if (!(dev->extensions2 & FUNC_EXT2_GPIO))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	req = alloc_request(dev, 4 + dev->hid + 2, cb, user);
+	if (!req)
+		return LIBUSB_ERROR_NO_MEM;
+
+	req->buf[0] = BULK_OP_GPIO;
+	req->buf[1] = op;
+	req->buf[2] = arg & 0xff;
+	req->buf[3] = arg >> 8;
+	req->resp = req->buf + 4 + dev->hid;
+	req->resp_len = 2;
+	req->status = 1;
+	req->data = level;
+
+	return submit_bulk(req, 4);
+}
+
+/*
+ * Register reads: the cache and coalescing
+ */
+
+static uint32_t effective_ttl(const struct i2ctu_dev *dev, const struct regcache_target *t, int reg)
+{
+	return (t->ttl[reg] == I2CTU_TTL_DEFAULT) ? dev->regcache_ttl : t->ttl[reg];
+}
+
+static struct regcache_target *regcache_target(struct i2ctu_dev *dev, uint8_t addr)
+{
+	struct regcache_target *t = dev->targets[addr];
+
+	if (t)
+		return t;
+	if (!(t = calloc(1, sizeof(*t))))
+		return NULL;
+	for (int i = 0; i < REGCACHE_REGS; i++)
+		t->ttl[i] = I2CTU_TTL_DEFAULT;
+	// Generation 0 is what a value never read has
+	t->generation = 1;
+	return dev->targets[addr] = t;
+}
+
+// Anything written to a target may have changed any of its registers, say a reset bit or an auto-incremented
+// pointer in a register written in the same go, so a write forgets all of them
+static void regcache_written(struct i2ctu_dev *dev, uint16_t addr)
+{
+	struct regcache_target *t;
+
+	if (dev->regcache && addr < REGCACHE_TARGETS && (t = dev->targets[addr]))
+		t->generation++;
+}
+
+static void regcache_batch(struct i2ctu_dev *dev, const struct i2ctu_msg *msgs, int count)
+{
+	uint16_t addr = 0, ten = 0;
+
+	if (!dev->regcache)
+		return;
+	for (int i = 0; i < count; i++) {
+		// Continued segments go to the target of the last START
+		if (!(msgs[i].flags & I2C_M_NOSTART)) {
+			addr = msgs[i].addr;
+			ten = msgs[i].flags & I2C_M_TEN;
+		}
+		if (!(msgs[i].flags & I2C_M_RD) && !ten)
+			regcache_written(dev, addr);
+	}
+}
+
+// Answers a read at the next round of event handling; it counts as pending already
+static void queue_hit(struct i2ctu_dev *dev, int result, i2ctu_cb cb, void *user)
+{
+	struct regcache_hit *hit = malloc(sizeof(*hit));
+
+	if (!hit) {
+		// Out of memory on top of whatever went wrong, so don't keep the caller waiting for an answer either
+		dev->pending--;
+		if (cb)
+			cb(dev, result ? result : LIBUSB_ERROR_NO_MEM, user);
+		return;
+	}
+	hit->next = NULL;
+	hit->result = result;
+	hit->cb = cb;
+	hit->user = user;
+	if (dev->hits_tail)
+		dev->hits_tail->next = hit;
+	else
+		dev->hits = hit;
+	dev->hits_tail = hit;
+	wake_loop(dev);
+}
+
+static void answer_hits(struct i2ctu_dev *dev)
+{
+	struct regcache_hit *hit = dev->hits, *next;
+
+	// Hits queued by the callbacks wait for the next round, like any request they submit
+	dev->hits = dev->hits_tail = NULL;
+	for (; hit; hit = next) {
+		next = hit->next;
+		dev->pending--;
+		if (hit->cb)
+			hit->cb(dev, hit->result, hit->user);
+		free(hit);
+	}
+}
+
+// A register read that missed the cache, on its way to the target, or held back to go out in a burst
+struct reg_read {
+	struct reg_read *next;   // Held back reads, then the reads of a burst
+	i2ctu_cb cb;
+	void *user;
+	uint8_t addr, reg;
+	uint8_t *buf;
+	uint16_t len;
+	uint32_t generation;     // The target's when the read was submitted, 0 if the data isn't to be cached
+	struct i2ctu_msg msgs[2];
+};
+
+static void reg_read_done(struct i2ctu_dev *dev, int result, void *user)
+{
+	struct reg_read *rr = user;
+	struct regcache_target *t = rr->generation ? dev->targets[rr->addr] : NULL;
+	i2ctu_cb cb = rr->cb;
+
+	// Unless the target was written to since, in which case the data may be from before that
+	if (!result && rr->generation && dev->regcache && t && t->generation == rr->generation) {
+		const uint64_t now = now_us();
+
+		for (int i = 0; i < rr->len; i++) {
+			const int reg = rr->reg + i;
+			const uint32_t ttl = effective_ttl(dev, t, reg);
+
+			if (ttl == I2CTU_TTL_VOLATILE)
+				continue;
+			t->value[reg] = rr->buf[i];
+			t->read_in[reg] = t->generation;
+			t->expires[reg] = (ttl == I2CTU_TTL_FOREVER) ? UINT64_MAX : now + ttl;
+		}
+	}
+	user = rr->user;
+	free(rr);
+	if (cb)
+		cb(dev, result, user);
+}
+
+// Whether all of the registers are in the cache and still count, and if so, their values copied to buf
+static int regcache_lookup(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t len)
+{
+	const struct regcache_target *t = dev->targets[addr];
+	uint64_t now;
+
+	if (!t)
+		return 0;
+	now = now_us();
+	for (int i = reg; i < reg + len; i++)
+		if (t->read_in[i] != t->generation || t->expires[i] <= now)
+			return 0;
+	memcpy(buf, &t->value[reg], len);
+	return 1;
+}
+
+/** Queues a register read: writes the register address \c reg to the target and reads \c len bytes back after a
+ *  repeated START, as one batch with the bulk protocol and as two CMD_I2C_IO requests without. With the register
+ *  cache turned on, the read is answered from the cache if all of its registers are there and haven't expired;
+ *  the callback is then called at the next round of event handling, possibly ahead of requests submitted
+ *  before, which never needed the bus. With coalescing (see i2ctu_set_coalesce()) reads that miss are held back
+ *  to be merged with others.
+ */
+int i2ctu_submit_read_reg(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t len, i2ctu_cb cb,
+                          void *user)
+{
+	const int cacheable = dev->regcache && addr < REGCACHE_TARGETS && len && reg + len <= REGCACHE_REGS;
+	struct reg_read *rr;
+	int ret;
+
+	if (cacheable && regcache_lookup(dev, addr, reg, buf, len)) {
+		dev->pending++;
+		dev->stats.reg_hits++;
+		queue_hit(dev, I2CTU_OK, cb, user);
+		return 0;
+	}
+
+	if (!(rr = calloc(1, sizeof(*rr))))
+		return LIBUSB_ERROR_NO_MEM;
+	rr->cb = cb;
+	rr->user = user;
+	rr->addr = addr;
+	rr->reg = reg;
+	rr->buf = buf;
+	rr->len = len;
+	if (cacheable) {
+		const struct regcache_target *t = regcache_target(dev, addr);
+
+		rr->generation = t ? t->generation : 0;
+		dev->stats.reg_misses++;
+	}
+
+	// Reads that wrap around the register space don't mix with others
+	if (dev->coalesce_gap >= 0 && len && reg + len <= REGCACHE_REGS) {
+		if (dev->planned_tail)
+			dev->planned_tail->next = rr;
+		else
+			dev->planned = rr;
+		dev->planned_tail = rr;
+		dev->pending++;
+		wake_loop(dev);
+		return 0;
+	}
+
+	if (dev->extensions & FUNC_EXT_BULK) {
+		rr->msgs[0] = (struct i2ctu_msg){ addr, 0, 1, &rr->reg, 0, 0 };
+		rr->msgs[1] = (struct i2ctu_msg){ addr, I2C_M_RD, len, buf, 0, 0 };
+		ret = submit_batch(dev, rr->msgs, 2, NULL, NULL, reg_read_done, rr);
+	} else if (!(ret = submit_msg(dev, addr, 0, I2CTU_START, &rr->reg, 1, NULL, NULL))) {
+		// Only the read's result comes back; a target that NAKs the register address NAKs its address again
+		ret = submit_msg(dev, addr, 1, I2CTU_START | I2CTU_STOP, buf, len, reg_read_done, rr);
+	}
+	if (ret)
+		free(rr);
+	return ret;
+}
+
+// One register address phase and one read for a number of held back reads of the same target
+struct reg_burst {
+	struct reg_read *reads;
+	uint8_t reg;
+	struct i2ctu_msg msgs[2];
+	uint8_t data[];
+};
+
+static void burst_done(struct i2ctu_dev *dev, int result, void *user)
+{
+	struct reg_burst *b = user;
+	struct reg_read *rr, *next;
+
+	for (rr = b->reads; rr; rr = next) {
+		next = rr->next;
+		dev->pending--;
+		if (!result)
+			memcpy(rr->buf, b->data + (rr->reg - b->reg), rr->len);
+		reg_read_done(dev, result, rr);
+	}
+	free(b);
+}
+
+static void submit_burst(struct i2ctu_dev *dev, struct reg_read **reads, int count, int start, int end)
+{
+	struct reg_burst *b = malloc(sizeof(*b) + end - start);
+	const uint8_t addr = reads[0]->addr;
+	int ret = LIBUSB_ERROR_NO_MEM;
+
+	for (int i = 0; i < count; i++)
+		reads[i]->next = (i + 1 < count) ? reads[i + 1] : NULL;
+	if (b) {
+		b->reads = reads[0];
+		b->reg = start;
+		b->msgs[0] = (struct i2ctu_msg){ addr, 0, 1, &b->reg, 0, 0 };
+		b->msgs[1] = (struct i2ctu_msg){ addr, I2C_M_RD, end - start, b->data, 0, 0 };
+		if (!(ret = submit_batch(dev, b->msgs, 2, NULL, NULL, burst_done, b))) {
+			dev->stats.reg_bursts++;
+			dev->stats.reg_coalesced += count;
+			return;
+		}
+		free(b);
+	}
+
+	// The submit that set this off mustn't call callbacks itself
+	for (struct reg_read *rr = reads[0], *next; rr; rr = next) {
+		next = rr->next;
+		queue_hit(dev, ret, rr->cb, rr->user);
+		free(rr);
+	}
+}
+
+static int compare_reads(const void *a, const void *b)
+{
+	const struct reg_read *ra = *(struct reg_read * const *)a, *rb = *(struct reg_read * const *)b;
+
+	if (ra->addr != rb->addr)
+		return ra->addr - rb->addr;
+	return ra->reg - rb->reg;
+}
+
+// Sends the held back reads off: sorted by target and register, and those whose ranges overlap or lie at most the
+// coalescing gap apart merged into one burst read
+static void plan_reads(struct i2ctu_dev *dev)
+{
+	struct reg_read *list = dev->planned, *rr, *next, **sorted;
+	int count = 0, i, j;
+
+	if (!list)
+		return;
+	dev->planned = dev->planned_tail = NULL;
+	for (rr = list; rr; rr = rr->next)
+		count++;
+	if (!(sorted = malloc(count * sizeof(*sorted)))) {
+		// Each on its own then, in the order they came
+		for (rr = list; rr; rr = next) {
+			next = rr->next;
+			submit_burst(dev, &rr, 1, rr->reg, rr->reg + rr->len);
+		}
+		return;
+	}
+	for (rr = list, i = 0; rr; rr = rr->next)
+		sorted[i++] = rr;
+	qsort(sorted, count, sizeof(*sorted), compare_reads);
+
+	for (i = 0; i < count; i = j) {
+		const int start = sorted[i]->reg;
+		int end = start + sorted[i]->len;
+
+		for (j = i + 1; j < count && sorted[j]->addr == sorted[i]->addr && sorted[j]->reg <= end + dev->coalesce_gap;
+		     j++)
+			if (sorted[j]->reg + sorted[j]->len > end)
+				end = sorted[j]->reg + sorted[j]->len;
+		submit_burst(dev, sorted + i, j - i, start, end);
+	}
+	free(sorted);
+}
+
+/** Holds register reads from i2ctu_submit_read_reg() back until the next flush, event handling or other request,
+ *  and then sends them off sorted by target and register, with reads whose ranges overlap or are at most \c gap
+ *  registers apart merged into a single auto-incrementing burst read, and the data sliced back into each read's
+ *  buffer. Fewer STARTs and register address phases for the same data, at the cost of the gap bytes read in vain,
+ *  and only for targets whose register pointer increments on reads. Reads of a burst complete together, so not
+ *  necessarily in the order they were submitted. \c gap -1 turns coalescing off again. Needs the bulk protocol.
+ */
+int i2ctu_set_coalesce(struct i2ctu_dev *dev, int gap)
+{
+	if (gap >= 0 && !(dev->extensions & FUNC_EXT_BULK))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (gap < -1 || gap >= REGCACHE_REGS)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	plan_reads(dev);
+	dev->coalesce_gap = gap;
+	return 0;
+}
+
+/** Turns the register cache for i2ctu_submit_read_reg() on or off. \c ttl_us is how long a value read counts for
+ *  registers not declared otherwise with i2ctu_set_reg_ttl(): I2CTU_TTL_VOLATILE caches only declared registers,
+ *  I2CTU_TTL_FOREVER keeps values until the target is written to. Every write to a target through the library
+ *  forgets its registers; raw bulk command streams are opaque to the cache, so after writing through those, call
+ *  i2ctu_regcache_invalidate(). Turning the cache off forgets the declarations too.
+ */
+int i2ctu_set_regcache(struct i2ctu_dev *dev, int enable, uint32_t ttl_us)
+{
+	if (ttl_us == I2CTU_TTL_DEFAULT)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	dev->regcache_ttl = ttl_us;
+	if (enable) {
+		dev->regcache = 1;
+		return 0;
+	}
+	dev->regcache = 0;
+	for (int i = 0; i < REGCACHE_TARGETS; i++) {
+		free(dev->targets[i]);
+		dev->targets[i] = NULL;
+	}
+	return 0;
+}
+
+/** Declares how long values of registers \c reg to \c reg + \c count - 1 of the target at \c addr count once read:
+ *  I2CTU_TTL_VOLATILE for status or FIFO registers that must always be read from the target, I2CTU_TTL_FOREVER
+ *  for ones like chip IDs that only change when written, or I2CTU_TTL_DEFAULT for the cache's default again.
+ *  Turns the cache on if it isn't.
+ */
+int i2ctu_set_reg_ttl(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, uint16_t count, uint32_t ttl_us)
+{
+	struct regcache_target *t;
+
+	if (addr >= REGCACHE_TARGETS || reg + count > REGCACHE_REGS)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (!(t = regcache_target(dev, addr)))
+		return LIBUSB_ERROR_NO_MEM;
+
+	dev->regcache = 1;
+	for (int i = reg; i < reg + count; i++) {
+		t->ttl[i] = ttl_us;
+		// A value cached under a longer TTL shan't outlive the new one
+		t->expires[i] = 0;
+	}
+	return 0;
+}
+
+/** Forgets the cached registers of the target at \c addr, or of all targets for -1, e.g. after it was reset or
+ *  written to behind the library's back. The declarations stay.
+ */
+void i2ctu_regcache_invalidate(struct i2ctu_dev *dev, int addr)
+{
+	for (int i = 0; i < REGCACHE_TARGETS; i++)
+		if (dev->targets[i] && (addr < 0 || addr == i))
+			dev->targets[i]->generation++;
+}
+
+/*
+ * Device handling
+ */
+
+// I2CTU_RECORD with its %d, if any, replaced by the adapter's index
+static void start_recording(struct i2ctu_dev *dev, const char *pattern)
+{
+	const char *d = strstr(pattern, "%d");
+	const int index = __atomic_fetch_add(&record_index, 1, __ATOMIC_RELAXED);
+	char path[PATH_MAX];
+
+	if (d)
+		snprintf(path, sizeof(path), "%.*s%d%s", (int)(d - pattern), pattern, index, d + 2);
+	else
+		snprintf(path, sizeof(path), "%s", pattern);
+	i2ctu_record(dev, path);
+}
+
+/** Opens the first adapter found and enables inline status if the firmware supports it. */
+// Orders devices by bus number, then port path
+static int compare_ports(const void *a, const void *b)
+{
+	libusb_device *x = *(libusb_device *const *)a, *y = *(libusb_device *const *)b;
+	uint8_t px[7], py[7];
+	int bx = libusb_get_bus_number(x), by = libusb_get_bus_number(y);
+
+	if (bx != by)
+		return bx - by;
+
+	int nx = libusb_get_port_numbers(x, px, sizeof(px)), ny = libusb_get_port_numbers(y, py, sizeof(py));
+	for (int i = 0; i < nx && i < ny; i++)
+		if (px[i] != py[i])
+			return px[i] - py[i];
+	return nx - ny;
+}
+
+// Carve the transfer buffers out of one block, preferably of device memory
+static int alloc_buffers(struct i2ctu_dev *dev)
+{
+	uint8_t *p = NULL;
+
+#ifdef HAVE_DEV_MEM
+	// NULL where usbfs can't map memory, e.g. on older kernels and other platforms
+	p = dev->dev_mem = libusb_dev_mem_alloc(dev->handle, BUFFERS_SIZE);
+#endif
+	if (!p && !(p = dev->mem = malloc(BUFFERS_SIZE)))
+		return LIBUSB_ERROR_NO_MEM;
+
+	for (int i = 0; i < IN_TRANSFERS; i++, p += IN_SIZE)
+		dev->in_buf[i] = p;
+	for (int i = 0; i < I2CTU_MAX_DEPTH; i++, p += OUT_SIZE)
+		dev->out[i].buf = p;
+	return 0;
+}
+
+static void free_buffers(struct i2ctu_dev *dev)
+{
+#ifdef HAVE_DEV_MEM
+	if (dev->dev_mem)
+		libusb_dev_mem_free(dev->handle, dev->dev_mem, BUFFERS_SIZE);
+#endif
+	free(dev->mem);
+}
+
+// Cache file of the adapter on udev's port, NULL if there is nowhere to keep one. An empty I2CTU_CACHE turns the
+// cache off.
+static char *cache_path(libusb_device *udev)
+{
+	const char *dir = getenv(CACHE_ENV), *sub = "";
+	uint8_t ports[7];
+	char name[32], *path;
+	int n, len;
+
+	if (dir && !*dir)
+		return NULL;
+	if (!dir && (dir = getenv("XDG_CACHE_HOME")) && *dir)
+		sub = "/i2ctu";
+	else if (!dir && (dir = getenv("HOME")))
+		sub = "/.cache/i2ctu";
+	if (!dir || (n = libusb_get_port_numbers(udev, ports, sizeof(ports))) <= 0)
+		return NULL;
+
+	// Named like the device in sysfs, e.g. 1-4.2
+	len = snprintf(name, sizeof(name), "%d-", libusb_get_bus_number(udev));
+	for (int i = 0; i < n; i++)
+		len += snprintf(name + len, sizeof(name) - len, i ? ".%d" : "%d", ports[i]);
+
+	len = snprintf(NULL, 0, "%s%s/%s", dir, sub, name);
+	if ((path = malloc(len + 1)))
+		snprintf(path, len + 1, "%s%s/%s", dir, sub, name);
+	return path;
+}
+
+// Whether the cache has an entry for the firmware on the adapter
+static int cache_load(struct i2ctu_dev *dev, struct cache_entry *entry)
+{
+	FILE *f = fopen(dev->cache_path, "rb");
+	int ok;
+
+	if (!f)
+		return 0;
+	ok = fread(entry, sizeof(*entry), 1, f) == 1 && entry->magic == CACHE_MAGIC &&
+	     entry->bcd_device == dev->cache.bcd_device && entry->info_len <= FUNC_INFO_SIZE;
+	fclose(f);
+	return ok;
+}
+
+// Stores what the library knows about the adapter, config being its final CMD_GET_CONFIG response
+static void cache_save(struct i2ctu_dev *dev, const uint8_t *config)
+{
+	char *path = dev->cache_path, *tmp;
+	FILE *f;
+	int len;
+
+	// Somebody changed the configuration behind the library's back, so it can't tell what is in effect
+	if ((config[CONFIG_GENERATION] | config[CONFIG_GENERATION + 1] << 8) != dev->generation)
+		dev->cache.baud_khz = dev->cache.tag = 0;
+	dev->cache.magic = CACHE_MAGIC;
+	memcpy(dev->cache.config, config, CONFIG_RESPONSE);
+
+	for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+		*p = 0;
+		mkdir(path, 0755);
+		*p = '/';
+	}
+
+	// Written aside and renamed, so a program opening the adapter next never sees half an entry
+	len = snprintf(NULL, 0, "%s.%d", path, (int)getpid());
+	if (!(tmp = malloc(len + 1)))
+		return;
+	snprintf(tmp, len + 1, "%s.%d", path, (int)getpid());
+	if ((f = fopen(tmp, "wb"))) {
+		int ok = fwrite(&dev->cache, sizeof(dev->cache), 1, f) == 1;
+
+		if (fclose(f) || !ok || rename(tmp, path))
+			unlink(tmp);
+	}
+	free(tmp);
+}
+
+// Takes over what of the settings in known is still in effect on an adapter reporting config: all of them if it
+// neither powered up nor changed since, those stored with i2ctu_config_saved() if it powered up with them and
+// hasn't changed since, none otherwise. Returns whether the settings survived.
+static int restore(struct i2ctu_dev *dev, const uint8_t *config, const struct cache_entry *known)
+{
+	const int stored = known->stored && (config[CONFIG_FLAGS] & CONFIG_FLAG_STORED) &&
+	                   config[CONFIG_STORED_CRC] == known->stored_crc;
+
+	dev->generation = config[CONFIG_GENERATION] | config[CONFIG_GENERATION + 1] << 8;
+	memcpy(dev->cache.config, config, CONFIG_RESPONSE);
+	dev->cache.stored = stored;
+	dev->cache.stored_crc = config[CONFIG_STORED_CRC];
+	dev->cache.stored_khz = stored ? known->stored_khz : 0;
+	dev->cache.stored_tag = stored ? known->stored_tag : 0;
+
+	if (!memcmp(&config[CONFIG_BOOT_ID], &known->config[CONFIG_BOOT_ID], 4)) {
+		dev->cache.baud_khz = known->baud_khz;
+		dev->cache.tag = known->tag;
+	} else if (stored && !dev->generation) {
+		dev->cache.baud_khz = known->stored_khz;
+		dev->cache.tag = known->stored_tag;
+	} else {
+		dev->cache.baud_khz = dev->cache.tag = 0;
+		return 0;
+	}
+	return 1;
+}
+
+// Claims the adapter on dev->handle and sets it up the way the library drives it. known is what the library knew
+// about it before, from the cache or from before it dropped off the bus, or NULL. Returns whether the settings
+// in known are still in effect, or a libusb error.
+static int attach(struct i2ctu_dev *dev, const struct cache_entry *known)
+{
+	static const struct cache_entry none;
+	uint8_t info[FUNC_INFO_SIZE], config[CONFIG_RESPONSE];
+	int ret = 0, cached = 0, configured = 0;
+
+	libusb_set_auto_detach_kernel_driver(dev->handle, 1);
+	if ((ret = libusb_claim_interface(dev->handle, 0)))
+		return ret;
+
+	// A known build with CMD_GET_CONFIG needs only that: it turns on inline status where the firmware has it, and
+	// its CRC tells whether the CMD_GET_FUNC response is still the same
+	if (known && known->info_len >= 16 && (((uint32_t)known->info[15] << 24) & FUNC_EXT2_CONFIG)) {
+		ret = libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                              CMD_GET_CONFIG, (known->info[4] & FUNC_EXT_INLINE_STATUS) ? OPTION_INLINE_STATUS : 0,
+		                              CONFIG_SET_OPTIONS, config, sizeof(config), TIMEOUT_MS);
+		if (ret == CONFIG_RESPONSE && !memcmp(&config[CONFIG_FUNC_CRC], &known->config[CONFIG_FUNC_CRC], 4)) {
+			memcpy(info, known->info, ret = known->info_len);
+			cached = configured = 1;
+		}
+	}
+
+	// Stock firmware only returns the first word, leaving us without extensions
+	if (!cached)
+		ret = libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                              CMD_GET_FUNC, 0, 0, info, sizeof(info), TIMEOUT_MS);
+	if (ret < 0)
+		goto err_release;
+	memcpy(dev->cache.info, info, ret);
+	dev->cache.info_len = ret;
+	if (ret >= 8)
+		dev->extensions = info[4] | info[5] << 8 | info[6] << 16 | (uint32_t)info[7] << 24;
+	if (ret >= 12)
+		dev->credits = info[10] | info[11] << 8;
+	if (ret >= 16)
+		dev->extensions2 = info[12] | info[13] << 8 | info[14] << 16 | (uint32_t)info[15] << 24;
+	if (ret >= 20)
+		dev->extensions3 = info[16] | info[17] << 8 | info[18] << 16 | (uint32_t)info[19] << 24;
+
+	dev->hid = !!(dev->extensions & FUNC_EXT_HID);
+
+	// The bulk and event endpoints only exist in the second alternate setting
+	if ((dev->extensions & FUNC_EXT_ALT_BULK) && (ret = libusb_set_interface_alt_setting(dev->handle, 0, 1)))
+		goto err_release;
+
+	// Only counted for the stats, so stick with the full speed size if the descriptor can't be had
+	dev->ep_size = libusb_get_max_packet_size(libusb_get_device(dev->handle), I2CTU_EP_BULK_OUT);
+	if (dev->ep_size <= 0)
+		dev->ep_size = I2CTU_EP_SIZE;
+
+	if (!cached && (dev->extensions2 & FUNC_EXT2_CONFIG)) {
+		// Sets the options like CMD_SET_OPTIONS and tells the generation the next cache entry starts from
+		ret = libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                              CMD_GET_CONFIG, (dev->extensions & FUNC_EXT_INLINE_STATUS) ? OPTION_INLINE_STATUS : 0,
+		                              CONFIG_SET_OPTIONS, config, sizeof(config), TIMEOUT_MS);
+		if (ret < 0)
+			goto err_release;
+		configured = ret == CONFIG_RESPONSE;
+	} else if ((dev->extensions & FUNC_EXT_INLINE_STATUS) && !cached) {
+		ret = libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                              CMD_SET_OPTIONS, OPTION_INLINE_STATUS, 0, NULL, 0, TIMEOUT_MS);
+		if (ret < 0)
+			goto err_release;
+	}
+	dev->inline_status = !!(dev->extensions & FUNC_EXT_INLINE_STATUS);
+
+	if (configured)
+		return restore(dev, config, known ? known : &none);
+	dev->cache.baud_khz = dev->cache.tag = 0;
+	return 0;
+
+err_release:
+	libusb_release_interface(dev->handle, 0);
+	return ret;
+}
+
+// Sets up an adapter opened as handle, which is closed again if that fails
+static int open_handle(libusb_context *ctx, libusb_device_handle *handle, struct i2ctu_dev **devp)
+{
+	libusb_device *udev = libusb_get_device(handle);
+	struct libusb_device_descriptor desc;
+	struct cache_entry entry;
+	struct i2ctu_dev *dev;
+	int ret;
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev) {
+		libusb_close(handle);
+		return LIBUSB_ERROR_NO_MEM;
+	}
+	dev->ctx = ctx;
+	dev->handle = handle;
+	dev->depth = DEFAULT_DEPTH;
+	dev->rtt_us = RTT_INITIAL;
+	dev->epoll_fd = dev->wake_fd = -1;
+	dev->coalesce_gap = -1;
+	if (!libusb_get_device_descriptor(udev, &desc)) {
+		dev->cache_path = cache_path(udev);
+		dev->cache.bcd_device = desc.bcdDevice;
+		dev->serial_index = desc.iSerialNumber;
+	}
+
+	for (int i = 0; i < IN_TRANSFERS; i++) {
+		if (!(dev->in[i] = libusb_alloc_transfer(0))) {
+			ret = LIBUSB_ERROR_NO_MEM;
+			goto err_close;
+		}
+	}
+	for (int i = 0; i < I2CTU_MAX_DEPTH; i++) {
+		dev->out[i].dev = dev;
+		if (!(dev->out[i].xfer = libusb_alloc_transfer(0))) {
+			ret = LIBUSB_ERROR_NO_MEM;
+			goto err_close;
+		}
+	}
+	if ((ret = alloc_buffers(dev)))
+		goto err_close;
+
+	if ((ret = attach(dev, (dev->cache_path && cache_load(dev, &entry)) ? &entry : NULL)) < 0)
+		goto err_close;
+
+	if (getenv(I2CTU_RECORD_ENV))
+		start_recording(dev, getenv(I2CTU_RECORD_ENV));
+
+	*devp = dev;
+	return 0;
+
+err_close:
+	free_buffers(dev);
+	libusb_close(dev->handle);
+	for (int i = 0; i < IN_TRANSFERS; i++)
+		libusb_free_transfer(dev->in[i]);
+	for (int i = 0; i < I2CTU_MAX_DEPTH; i++)
+		libusb_free_transfer(dev->out[i].xfer);
+	free(dev->cache_path);
+	free(dev);
+	return ret;
+}
+
+/** Opens the first adapter found. */
+int i2ctu_open(libusb_context *ctx, struct i2ctu_dev **devp)
+{
+	libusb_device_handle *handle = libusb_open_device_with_vid_pid(ctx, I2CTU_VID, I2CTU_PID);
+
+	if (!handle)
+		return LIBUSB_ERROR_NOT_FOUND;
+	return open_handle(ctx, handle, devp);
+}
+
+/** Opens up to \c max of the attached adapters, in bus and port order, skipping those that can't be opened.
+ *  @return the number opened, or a negative libusb error if the devices can't be listed
+ */
+int i2ctu_open_all(libusb_context *ctx, struct i2ctu_dev **devs, int max)
+{
+	libusb_device **list;
+	ssize_t n;
+	int count = 0;
+
+	if ((n = libusb_get_device_list(ctx, &list)) < 0)
+		return n;
+
+	// Port order first, so the same fixture slot gets the same index every time
+	qsort(list, n, sizeof(*list), compare_ports);
+
+	for (ssize_t i = 0; i < n && count < max; i++) {
+		struct libusb_device_descriptor desc;
+		libusb_device_handle *handle;
+
+		if (libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != I2CTU_VID || desc.idProduct != I2CTU_PID)
+			continue;
+		if (libusb_open(list[i], &handle))
+			continue;
+		if (!open_handle(ctx, handle, &devs[count]))
+			count++;
+	}
+	libusb_free_device_list(list, 1);
+	return count;
+}
+
+static void close_loop(struct i2ctu_dev *dev);
+
+/** Closes the adapter. Requests still in flight are waited for, so don't call this from a callback. */
+void i2ctu_close(struct i2ctu_dev *dev)
+{
+	i2ctu_wait_all(dev);
+
+	for (int i = 0; i < IN_TRANSFERS; i++)
+		if (dev->in_busy[i])
+			libusb_cancel_transfer(dev->in[i]);
+	for (int i = 0; i < IN_TRANSFERS; i++)
+		while (dev->in_busy[i] && libusb_handle_events(dev->ctx) == 0);
+
+	if (dev->extensions2 & FUNC_EXT2_CONFIG) {
+		uint8_t config[CONFIG_RESPONSE];
+
+		// Clears the options in the same go as reading the state to remember for the next program
+		if (libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                            CMD_GET_CONFIG, 0, CONFIG_SET_OPTIONS, config, sizeof(config), TIMEOUT_MS)
+		    == CONFIG_RESPONSE && dev->cache_path)
+			cache_save(dev, config);
+	} else if (dev->inline_status) {
+		libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+		                        CMD_SET_OPTIONS, 0, 0, NULL, 0, TIMEOUT_MS);
+	}
+
+	libusb_release_interface(dev->handle, 0);
+	free_buffers(dev);
+	libusb_close(dev->handle);
+	for (int i = 0; i < IN_TRANSFERS; i++)
+		libusb_free_transfer(dev->in[i]);
+	for (int i = 0; i < I2CTU_MAX_DEPTH; i++)
+		libusb_free_transfer(dev->out[i].xfer);
+	close_loop(dev);
+	i2ctu_record(dev, NULL);
+	i2ctu_set_reconnect(dev, NULL, NULL);
+	i2ctu_set_regcache(dev, 0, 0);
+	free(dev->cache_path);
+	free(dev);
+}
+
+/** The underlying libusb handle, for synchronous requests the library doesn't wrap. */
+libusb_device_handle *i2ctu_handle(struct i2ctu_dev *dev)
+{
+	return dev->handle;
+}
+
+/** The libusb context the adapter was opened in, NULL for the default one. */
+libusb_context *i2ctu_context(struct i2ctu_dev *dev)
+{
+	return dev->ctx;
+}
+
+/** FUNC_EXT_* bits advertised by the firmware. */
+uint32_t i2ctu_extensions(struct i2ctu_dev *dev)
+{
+	return dev->extensions;
+}
+
+uint32_t i2ctu_extensions2(struct i2ctu_dev *dev)
+{
+	return dev->extensions2;
+}
+
+uint32_t i2ctu_extensions3(struct i2ctu_dev *dev)
+{
+	return dev->extensions3;
+}
+
+/** Sets the default bus speed in kHz with CMD_SET_BAUDRATE, unless the adapter is known to run at that speed from
+ *  an earlier call, possibly by an earlier program: with firmware that has CMD_GET_CONFIG the library remembers the
+ *  speed from one program to the next for as long as nothing else changes the adapter's configuration. Changes
+ *  made through i2ctu_handle() meanwhile are only noticed when the adapter is closed. The speed is set again
+ *  after reconnecting where it didn't survive, see i2ctu_set_reconnect().
+ */
+int i2ctu_set_baudrate(struct i2ctu_dev *dev, uint16_t khz)
+{
+	int ret;
+
+	dev->baud_khz = khz;
+	if (khz && dev->cache.baud_khz == khz)
+		return 0;
+
+	ret = libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                              CMD_SET_BAUDRATE, khz, 0, NULL, 0, TIMEOUT_MS);
+	if (ret < 0) {
+		dev->cache.baud_khz = 0;
+		return ret;
+	}
+	// The one change the firmware counts for it
+	dev->generation++;
+	dev->cache.baud_khz = khz;
+	return 0;
+}
+
+/** Whether the settings reported with i2ctu_config_uploaded() under the same tag, by this or an earlier program,
+ *  are still in effect. tag is the caller's name for the whole set, e.g. a hash of its per-target settings, muxes
+ *  and register cache entries; never 0. Programs that upload such settings at startup can skip that if so.
+ */
+int i2ctu_config_current(struct i2ctu_dev *dev, uint32_t tag)
+{
+	return tag && dev->cache.tag == tag;
+}
+
+// The adapter's CMD_GET_CONFIG response, taking its generation as the one the library's knowledge is valid for
+static int read_config(struct i2ctu_dev *dev, uint8_t *config)
+{
+	int ret;
+
+	if (!(dev->extensions2 & FUNC_EXT2_CONFIG))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	ret = libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                              CMD_GET_CONFIG, 0, 0, config, CONFIG_RESPONSE, TIMEOUT_MS);
+	if (ret < 0)
+		return ret;
+	if (ret != CONFIG_RESPONSE)
+		return LIBUSB_ERROR_IO;
+
+	dev->generation = config[CONFIG_GENERATION] | config[CONFIG_GENERATION + 1] << 8;
+	return 0;
+}
+
+/** Reports that the settings tag stands for were just uploaded through i2ctu_handle(). Every change since the last
+ *  i2ctu_set_baudrate() or i2ctu_config_uploaded() counts as part of them. Costs a CMD_GET_CONFIG, and needs
+ *  firmware that has it.
+ */
+int i2ctu_config_uploaded(struct i2ctu_dev *dev, uint32_t tag)
+{
+	uint8_t config[CONFIG_RESPONSE];
+	int ret;
+
+	if ((ret = read_config(dev, config)))
+		return ret;
+	dev->cache.tag = tag;
+	return 0;
+}
+
+/** Stores the adapter's current settings in its EEPROM with CMD_SAVE_SETTINGS and remembers them as the bus speed
+ *  and tag in effect now. When the adapter later powers up with them, e.g. after dropping off the bus, the
+ *  library knows they are back, so neither the speed nor the tagged settings need uploading again.
+ */
+int i2ctu_config_saved(struct i2ctu_dev *dev)
+{
+	uint8_t config[CONFIG_RESPONSE];
+	int ret;
+
+	if (!(dev->extensions2 & FUNC_EXT2_CONFIG))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	// Takes a while for the EEPROM writes
+	ret = libusb_control_transfer(dev->handle, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_CLASS | LIBUSB_RECIPIENT_DEVICE,
+	                              CMD_SAVE_SETTINGS, SETTINGS_SAVE, 0, NULL, 0, TIMEOUT_MS);
+	if (ret < 0)
+		return ret;
+	dev->generation++;
+	if ((ret = read_config(dev, config)))
+		return ret;
+	if (!(config[CONFIG_FLAGS] & CONFIG_FLAG_STORED))
+		return LIBUSB_ERROR_IO;
+
+	dev->cache.stored = 1;
+	dev->cache.stored_crc = config[CONFIG_STORED_CRC];
+	dev->cache.stored_khz = dev->cache.baud_khz;
+	dev->cache.stored_tag = dev->cache.tag;
+	return 0;
+}
+
+/*
+ * Reconnecting
+ */
+
+// Requests failing for lack of a device mean the adapter dropped off the bus
+static void lost(struct i2ctu_dev *dev)
+{
+	if (!dev->reconnect || dev->gone)
+		return;
+	dev->gone = 1;
+	dev->gone_us = dev->scan_us = now_us();
+}
+
+#ifdef HAVE_HOTPLUG
+static int hotplug_cb(libusb_context *ctx, libusb_device *udev, libusb_hotplug_event event, void *user)
+{
+	struct i2ctu_dev *dev = user;
+
+	(void)ctx;
+	// Nothing may be opened from here, so the adapter is only looked for once event handling is done
+	if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+		dev->arrived = 1;
+	else if (udev == libusb_get_device(dev->handle))
+		lost(dev);
+	return 0;
+}
+#endif
+
+// An attached adapter with the serial number of the one that dropped off, preferably on the same port
+static libusb_device_handle *find_again(struct i2ctu_dev *dev)
+{
+	libusb_device **list;
+	libusb_device_handle *found = NULL;
+	uint8_t old[7], ports[7];
+	int n_old = libusb_get_port_numbers(libusb_get_device(dev->handle), old, sizeof(old));
+	ssize_t n;
+
+	if ((n = libusb_get_device_list(dev->ctx, &list)) < 0)
+		return NULL;
+
+	for (int pass = 0; pass < 2 && !found; pass++) {
+		for (ssize_t i = 0; i < n && !found; i++) {
+			struct libusb_device_descriptor desc;
+			libusb_device_handle *handle;
+			unsigned char serial[sizeof(dev->serial)];
+			int same = libusb_get_port_numbers(list[i], ports, sizeof(ports)) == n_old && n_old > 0 &&
+			           !memcmp(ports, old, n_old);
+
+			if (same == pass || libusb_get_device_descriptor(list[i], &desc) || desc.idVendor != I2CTU_VID ||
+			    desc.idProduct != I2CTU_PID || libusb_open(list[i], &handle))
+				continue;
+			if (libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial)) > 0 &&
+			    !strcmp((char *)serial, dev->serial))
+				found = handle;
+			else
+				libusb_close(handle);
+		}
+	}
+	libusb_free_device_list(list, 1);
+	return found;
+}
+
+// Picks the adapter up again once it is back, with the settings made before where they didn't survive
+static void reconnect(struct i2ctu_dev *dev)
+{
+	struct cache_entry known = dev->cache;
+	libusb_device_handle *handle;
+	uint64_t now = now_us();
+	int restored;
+
+	// The old handle's transfers all have to be done with first
+	for (int i = 0; i < IN_TRANSFERS; i++)
+		if (dev->in_busy[i])
+			return;
+	for (int i = 0; i < I2CTU_MAX_DEPTH; i++)
+		if (dev->out[i].busy)
+			return;
+	if (dev->pending)
+		return;
+
+	if (dev->hotplug && !dev->arrived)
+		return;
+	if (!dev->arrived && now - dev->scan_us < RECONNECT_SCAN_MS * 1000)
+		return;
+	dev->arrived = 0;
+	dev->scan_us = now;
+	if (!(handle = find_again(dev)))
+		return;
+
+	// Whatever the library changed since opening counts, up to the generation it last knew of
+	known.config[CONFIG_GENERATION] = dev->generation;
+	known.config[CONFIG_GENERATION + 1] = dev->generation >> 8;
+	free_buffers(dev);
+	libusb_close(dev->handle);
+	dev->handle = handle;
+	free(dev->cache_path);
+	dev->cache_path = cache_path(libusb_get_device(handle));
+	if (alloc_buffers(dev) || (restored = attach(dev, &known)) < 0) {
+		// Neither is that likely to fix itself, but the next adapter arriving gets another go
+		dev->cache.baud_khz = dev->cache.tag = 0;
+		return;
+	}
+	dev->gone = 0;
+	dev->stats.reconnects++;
+	// The targets may well have lost power along with the adapter
+	i2ctu_regcache_invalidate(dev, -1);
+
+	if (dev->baud_khz && dev->cache.baud_khz != dev->baud_khz)
+		i2ctu_set_baudrate(dev, dev->baud_khz);
+	dev->reconnect(dev, restored, (now - dev->gone_us) / 1000, dev->reconnect_user);
+}
+
+/** Has the library pick the adapter up again when it drops off the bus and comes back, e.g. after a USB reset or
+ *  a flaky hub, instead of failing every request from then on. Requests in flight fail with
+ *  LIBUSB_ERROR_NO_DEVICE as usual, and so do new ones until it is back; meanwhile the library looks for an
+ *  adapter with the same serial number whenever hotplug reports one, or every 50 ms where libusb has no hotplug
+ *  support, from within event handling. Once it is found, the library sets it up again and calls cb, which
+ *  resubmits whatever it needs, such as streams, and uploads settings that didn't survive (see
+ *  i2ctu_config_current()). The bus speed of i2ctu_set_baudrate() is set again before. The adapter then has a
+ *  new i2ctu_handle(). NULL turns reconnecting off.
+ */
+int i2ctu_set_reconnect(struct i2ctu_dev *dev, i2ctu_reconnect_cb cb, void *user)
+{
+	if (cb && !dev->serial[0] &&
+	    (!dev->serial_index || libusb_get_string_descriptor_ascii(dev->handle, dev->serial_index,
+	                                                              (unsigned char *)dev->serial, sizeof(dev->serial)) <= 0)) {
+		dev->serial[0] = 0;
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	}
+
+#ifdef HAVE_HOTPLUG
+	if (cb && !dev->hotplug && libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		dev->hotplug = !libusb_hotplug_register_callback(dev->ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+		                                                 LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, 0, I2CTU_VID, I2CTU_PID,
+		                                                 LIBUSB_HOTPLUG_MATCH_ANY, hotplug_cb, dev, &dev->hotplug_handle);
+	if (!cb && dev->hotplug) {
+		libusb_hotplug_deregister_callback(dev->ctx, dev->hotplug_handle);
+		dev->hotplug = 0;
+	}
+#endif
+	dev->reconnect = cb;
+	dev->reconnect_user = user;
+	if (!cb)
+		dev->gone = 0;
+	return 0;
+}
+
+/** Whether the adapter is there, 0 from dropping off the bus until i2ctu_set_reconnect() picked it up again. */
+int i2ctu_connected(struct i2ctu_dev *dev)
+{
+	return !dev->gone;
+}
+
+/** Sets the number of OUT transfers of bulk commands kept in flight, 1 to I2CTU_MAX_DEPTH. More of them keep
+ *  the device busy across the host's scheduling gaps, fewer leave more requests to share each transfer.
+ */
+int i2ctu_set_depth(struct i2ctu_dev *dev, int depth)
+{
+	if (depth < 1 || depth > I2CTU_MAX_DEPTH)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	dev->depth = depth;
+	return 0;
+}
+
+/** Overrides the command buffer size the firmware reported, 0 lifts the limit. With more credits than the device
+ *  has room for, the host controller ends up retrying the excess until the device gets to it.
+ */
+int i2ctu_set_credits(struct i2ctu_dev *dev, int credits)
+{
+	if (credits < 0)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	dev->credits = credits;
+	return 0;
+}
+
+/** When staged commands too short for a packet go out. By default (0) only once the caller waits for events,
+ *  which packs the most but leaves a request submitted by a caller busy with other things sitting in the stream.
+ *  With a deadline, a packet's worth goes out right away and less than that once its oldest command has waited
+ *  \c deadline_us; I2CTU_DEADLINE_AUTO sets it to a quarter of the measured round trip of bulk requests, between
+ *  125 us and 1 ms. Waiting for events flushes everything either way.
+ */
+int i2ctu_set_deadline(struct i2ctu_dev *dev, int deadline_us)
+{
+	if (deadline_us < I2CTU_DEADLINE_AUTO)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	dev->deadline = deadline_us;
+	if (deadline_us > 0)
+		dev->deadline_us = deadline_us;
+	else if (deadline_us == I2CTU_DEADLINE_AUTO)
+		dev->deadline_us = RTT_INITIAL / 4;
+	return 0;
+}
+
+/** The deadline in effect in microseconds, 0 for none; the automatic one with the round trip behind it. */
+int i2ctu_get_deadline(struct i2ctu_dev *dev, int *rtt_us)
+{
+	if (rtt_us)
+		*rtt_us = dev->rtt_us;
+	return dev->deadline ? dev->deadline_us : 0;
+}
+
+/** Records every request submitted from now on and its completion to \c path, for i2c-replay; NULL stops
+ *  recording. Requests submitted before aren't recorded, nor are their completions. Setting I2CTU_RECORD in the
+ *  environment starts recording to that file whenever an adapter is opened, %d in it standing for the number of
+ *  adapters opened before.
+ */
+int i2ctu_record(struct i2ctu_dev *dev, const char *path)
+{
+	struct i2ctu_rec_header header = { I2CTU_RECORD_MAGIC, I2CTU_RECORD_VERSION, 0, dev->extensions, dev->extensions2 };
+	int ret = 0;
+
+	if (dev->record) {
+		if (fclose(dev->record))
+			ret = LIBUSB_ERROR_IO;
+		dev->record = NULL;
+	}
+	if (!path)
+		return ret;
+
+	if (!(dev->record = fopen(path, "wb")))
+		return LIBUSB_ERROR_ACCESS;
+	if (fwrite(&header, sizeof(header), 1, dev->record) != 1) {
+		fclose(dev->record);
+		dev->record = NULL;
+		return LIBUSB_ERROR_IO;
+	}
+	dev->record_us = now_us();
+	dev->record_seq = 0;
+	return 0;
+}
+
+/** Packing counters of the bulk command stream since the adapter was opened. */
+void i2ctu_get_stats(struct i2ctu_dev *dev, struct i2ctu_stats *stats)
+{
+	*stats = dev->stats;
+}
+
+/** Sends off the staged bulk commands that don't fill a whole transfer, as far as the depth allows. Done by
+ *  i2ctu_handle_events() and i2ctu_wait_all() anyway, so only needed before waiting on libusb directly.
+ */
+void i2ctu_flush(struct i2ctu_dev *dev)
+{
+	plan_reads(dev);
+	flush_out(dev, 1);
+}
+
+/** Number of requests whose callback hasn't been called yet. */
+int i2ctu_pending(struct i2ctu_dev *dev)
+{
+	return dev->pending;
+}
+
+/** Processes completed transfers and calls their callbacks, waiting at most \c timeout_ms for one. */
+int i2ctu_handle_events(struct i2ctu_dev *dev, int timeout_ms)
+{
+	struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	int ret;
+
+	// Cache hits waiting to be answered are events already
+	if (dev->hits)
+		tv.tv_sec = tv.tv_usec = 0;
+	plan_reads(dev);
+	flush_out(dev, 1);
+	ret = libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+	if (dev->gone)
+		reconnect(dev);
+	answer_hits(dev);
+	return ret;
+}
+
+/** Processes events until all requests have completed. */
+int i2ctu_wait_all(struct i2ctu_dev *dev)
+{
+	for (;;) {
+		int ret;
+
+		// Callbacks may hold back reads again
+		plan_reads(dev);
+		flush_out(dev, 1);
+		answer_hits(dev);
+		if (!dev->pending)
+			return 0;
+		ret = libusb_handle_events(dev->ctx);
+		if (ret && ret != LIBUSB_ERROR_INTERRUPTED)
+			return ret;
+	}
+}
+
+/*
+ * Event loop integration
+ */
+
+#ifdef __linux__
+
+static uint32_t epoll_events(short events)
+{
+	return ((events & POLLIN) ? EPOLLIN : 0) | ((events & POLLOUT) ? EPOLLOUT : 0);
+}
+
+static void pollfd_added(int fd, short events, void *user)
+{
+	struct i2ctu_dev *dev = user;
+	struct epoll_event ev = { .events = epoll_events(events), .data.fd = fd };
+
+	epoll_ctl(dev->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void pollfd_removed(int fd, void *user)
+{
+	struct i2ctu_dev *dev = user;
+
+	epoll_ctl(dev->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+// Dispatching isn't waiting for a result, so a deadline still holds there
+static void flush_staged(struct i2ctu_dev *dev)
+{
+	if (dev->deadline)
+		flush_due(dev);
+	else
+		flush_out(dev, 1);
+}
+
+/** A descriptor for an event loop to poll for reading, standing for all of the adapter's libusb context: once it is
+ *  readable, call i2ctu_dispatch(). Made on the first call, which also takes over libusb's pollfd notifiers, so
+ *  use it for one adapter per libusb context only. Staged commands signal it too, so there is no need for
+ *  i2ctu_flush() before going back to the loop.
+ *  @return the descriptor, or a negative libusb error
+ */
+int i2ctu_get_fd(struct i2ctu_dev *dev)
+{
+	const struct libusb_pollfd **fds;
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	if (dev->epoll_fd >= 0)
+		return dev->epoll_fd;
+
+	if ((dev->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	    (dev->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		goto err;
+	ev.data.fd = dev->wake_fd;
+	if (epoll_ctl(dev->epoll_fd, EPOLL_CTL_ADD, dev->wake_fd, &ev))
+		goto err;
+
+	// The notifiers keep the set up to date from here on, e.g. with descriptors of adapters opened later
+	libusb_set_pollfd_notifiers(dev->ctx, pollfd_added, pollfd_removed, dev);
+	if (!(fds = libusb_get_pollfds(dev->ctx))) {
+		libusb_set_pollfd_notifiers(dev->ctx, NULL, NULL, NULL);
+		goto err;
+	}
+	for (int i = 0; fds[i]; i++)
+		pollfd_added(fds[i]->fd, fds[i]->events, dev);
+	libusb_free_pollfds(fds);
+
+	wake_loop(dev);
+	return dev->epoll_fd;
+
+err:
+	close_loop(dev);
+	return LIBUSB_ERROR_OTHER;
+}
+
+/** Whatever the descriptor from i2ctu_get_fd() is signalled for, without blocking: flushes staged commands and calls
+ *  the callbacks of completed requests.
+ */
+int i2ctu_dispatch(struct i2ctu_dev *dev)
+{
+	struct timeval tv = { 0, 0 };
+	uint64_t count;
+	int ret;
+
+	// Requests submitted by the callbacks go out with the flush at the end, no need to signal for them
+	if (dev->wake_fd >= 0 && read(dev->wake_fd, &count, sizeof(count)) < 0)
+		count = 0;
+	dev->woken = 1;
+	plan_reads(dev);
+	flush_staged(dev);
+	ret = libusb_handle_events_timeout_completed(dev->ctx, &tv, NULL);
+	if (dev->gone)
+		reconnect(dev);
+	answer_hits(dev);
+	plan_reads(dev);
+	flush_staged(dev);
+	dev->woken = 0;
+	return ret;
+}
+
+/** How long the loop may wait on the descriptor at most before calling i2ctu_dispatch() anyway, in milliseconds:
+ *  for libusb to time out transfers, and for staged commands to go out on their deadline (see
+ *  i2ctu_set_deadline()). -1 if there is no such limit, e.g. because libusb covers timeouts with a descriptor of
+ *  its own and nothing is staged.
+ */
+int i2ctu_get_timeout(struct i2ctu_dev *dev)
+{
+	struct timeval tv;
+	int timeout = -1;
+
+	if (dev->hits || dev->planned)
+		return 0;
+	// Rounded up, so the loop doesn't come back a bit early and find nothing to do yet
+	if (!libusb_pollfds_handle_timeouts(dev->ctx) && libusb_get_next_timeout(dev->ctx, &tv) == 1)
+		timeout = tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+	if (dev->deadline && dev->staged_len) {
+		int64_t left = dev->staged_us + dev->deadline_us - now_us();
+		int ms = (left > 0) ? (left + 999) / 1000 : 0;
+
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	if (dev->gone && !dev->hotplug && (timeout < 0 || timeout > RECONNECT_SCAN_MS))
+		timeout = RECONNECT_SCAN_MS;
+	return timeout;
+}
+
+static void close_loop(struct i2ctu_dev *dev)
+{
+	if (dev->epoll_fd >= 0)
+		libusb_set_pollfd_notifiers(dev->ctx, NULL, NULL, NULL);
+	if (dev->wake_fd >= 0)
+		close(dev->wake_fd);
+	if (dev->epoll_fd >= 0)
+		close(dev->epoll_fd);
+	dev->epoll_fd = dev->wake_fd = -1;
+}
+
+#else
+
+int i2ctu_get_fd(struct i2ctu_dev *dev)
+{
+	(void)dev;
+	return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+int i2ctu_dispatch(struct i2ctu_dev *dev)
+{
+	return i2ctu_handle_events(dev, 0);
+}
+
+int i2ctu_get_timeout(struct i2ctu_dev *dev)
+{
+	(void)dev;
+	return -1;
+}
+
+static void close_loop(struct i2ctu_dev *dev)
+{
+	(void)dev;
+}
+
+#endif
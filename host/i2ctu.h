@@ -0,0 +1,286 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - asynchronous host library
+ *
+ * Thin layer on top of the libusb asynchronous API which keeps any number of
+ * control and bulk requests in flight and reports their outcome through
+ * completion callbacks. Single threaded: callbacks run from within
+ * i2ctu_handle_events(). For many threads sharing an adapter, a worker
+ * thread can own it instead and take requests from all of them.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _I2CTU_H_
+#define _I2CTU_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <libusb.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Request results; negative values are libusb error codes
+#define I2CTU_OK        0
+#define I2CTU_NAK       1  // Target did not ACK its address (or NAKed data)
+#define I2CTU_BUSY      2  // The bus was in use by another protocol on the adapter
+#define I2CTU_FAULT     3  // Bus fault, lost arbitration or a timeout; batches tell more in each segment
+#define I2CTU_MISMATCH  4  // i2ctu_submit_verify: a register read back differently than written
+#define I2CTU_EXPIRED   5  // i2ctu_submit_batch_by: the deadline passed before (all of) the batch could run
+
+#define I2CTU_START     (1 << 0)  // i2ctu_submit_msg: send a (repeated) START and the address first
+#define I2CTU_STOP      (1 << 1)  // i2ctu_submit_msg: send a STOP afterwards
+
+#define I2CTU_M_ABORT   0x0100    // i2ctu_msg flag: if this segment fails, skip the rest of the batch (7-bit only)
+
+#define I2CTU_MAX_DEPTH 8         // Most bulk OUT transfers in flight, see i2ctu_set_depth()
+#define I2CTU_DEADLINE_AUTO -1    // i2ctu_set_deadline: follow the measured round trip
+
+// Register cache lifetimes in microseconds, see i2ctu_set_regcache() and i2ctu_set_reg_ttl()
+#define I2CTU_TTL_VOLATILE  0           // Never cached, always read from the target
+#define I2CTU_TTL_FOREVER   UINT32_MAX  // Cached until the target is written to
+#define I2CTU_TTL_DEFAULT   (UINT32_MAX - 1)  // i2ctu_set_reg_ttl: whatever the cache's default is
+
+struct i2ctu_dev;
+struct i2ctu_worker;
+struct i2ctu_pool;
+struct i2ctu_client;
+struct i2ctu_eeprom;
+
+// One segment of a batch, same meaning as in struct i2c_msg. result and twsr are filled in on completion unless
+// the request failed on USB: a BATCH_RESULT_* code and the TWSR status code behind it (TWSR_NO_INFO for none).
+// Firmware without FUNC_EXT_BATCH_DETAIL only reports the address phase, so data NAKs go unnoticed there.
+struct i2ctu_msg {
+	uint16_t addr;    // 7-bit address, or 10-bit with I2C_M_TEN
+	uint16_t flags;   // I2C_M_RD, I2C_M_TEN, I2C_M_NOSTART, I2CTU_M_ABORT
+	uint16_t len;
+	uint8_t *buf;
+	uint8_t result;
+	uint8_t twsr;
+};
+
+// Bulk command stream counters; bytes / (packets * packet size, 64 on the XU4) is the packing efficiency of the
+// OUT packets
+struct i2ctu_stats {
+	uint64_t requests;   // Bulk and batch requests
+	uint64_t transfers;  // OUT transfers they went out in
+	uint64_t bytes;      // Command bytes
+	uint64_t packets;    // Packets on the wire, short ones included
+	uint64_t credit_waits;  // Times the staged commands waited for the device to take in earlier ones
+	uint64_t views;      // View responses handed out of the IN transfer they came in
+	uint64_t view_copies;  // View responses that had to be copied after all
+	uint64_t deadline_flushes;  // Staged commands short of a packet sent because their deadline had passed
+	uint64_t reconnects; // Times the adapter came back after dropping off the bus, see i2ctu_set_reconnect()
+	uint64_t reg_hits;   // Register reads answered from the register cache, see i2ctu_set_regcache()
+	uint64_t reg_misses; // Register reads the cache had to hand on to the target
+	uint64_t reg_coalesced;  // Register reads held back for coalescing, see i2ctu_set_coalesce()
+	uint64_t reg_bursts; // Burst reads they went out in
+};
+
+// Page cache counters of an EEPROM view, see i2ctu_eeprom.c
+struct i2ctu_eeprom_stats {
+	uint64_t hits;       // Pages found in the cache
+	uint64_t misses;     // Pages read from the EEPROM
+	uint64_t reads;      // EEPROM_READ commands they took
+	uint64_t writes;     // EEPROM write commands the dirty pages took
+};
+
+// How a bootloader takes blocks for i2ctu_submit_program(); see BULK_OP_PROGRAM in the README
+struct i2ctu_program {
+	uint8_t format;      // Memory address width and PROGRAM_FMT_* flags
+	uint8_t command;     // Sent ahead of the address with PROGRAM_FMT_CMD
+	uint16_t block_size;
+	uint32_t address;    // Memory address of the first block, in blocks with PROGRAM_FMT_BLOCKS
+	uint8_t poll_reg;    // Status register read after each block while (value & poll_mask) != poll_value
+	uint8_t poll_mask;   // 0 polls for an ACK of the address instead
+	uint8_t poll_value;
+	uint8_t timeout_ms;  // How long a block may keep the bootloader busy, 0 for 20 ms
+};
+
+// Completion callback, called from within i2ctu_handle_events()
+typedef void (*i2ctu_cb)(struct i2ctu_dev *dev, int result, void *user);
+
+// Completion callback of a view request: the response is only valid until the callback returns
+typedef void (*i2ctu_view_cb)(struct i2ctu_dev *dev, int result, const uint8_t *data, int len, void *user);
+
+// Called from within event handling once an adapter that dropped off the bus is back: restored tells whether the
+// settings made before are still in effect, gap_ms how long it was away. Requests from before have failed.
+typedef void (*i2ctu_reconnect_cb)(struct i2ctu_dev *dev, int restored, uint32_t gap_ms, void *user);
+
+// Call run on the worker thread by i2ctu_post_call(), e.g. to submit any request there
+typedef void (*i2ctu_call)(struct i2ctu_dev *dev, void *arg);
+
+// Completion callback of a request through i2ctud, called from within i2ctu_client_handle_events()
+typedef void (*i2ctu_client_cb)(struct i2ctu_client *client, int result, void *user);
+
+// Job of an adapter pool, run on one of its adapters; index is that adapter's place in the pool
+typedef void (*i2ctu_job)(struct i2ctu_dev *dev, int index, void *arg);
+
+// Result of a request, for a thread to wait on: pass i2ctu_future_cb and the future as the callback
+struct i2ctu_future {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+	int result;
+};
+
+int i2ctu_open(libusb_context *ctx, struct i2ctu_dev **dev);
+int i2ctu_open_all(libusb_context *ctx, struct i2ctu_dev **devs, int max);
+void i2ctu_close(struct i2ctu_dev *dev);
+libusb_device_handle *i2ctu_handle(struct i2ctu_dev *dev);
+libusb_context *i2ctu_context(struct i2ctu_dev *dev);
+uint32_t i2ctu_extensions(struct i2ctu_dev *dev);
+uint32_t i2ctu_extensions2(struct i2ctu_dev *dev);
+uint32_t i2ctu_extensions3(struct i2ctu_dev *dev);
+
+// All submit functions return 0 or a negative libusb error; on success the callback is called exactly once.
+// Buffers must stay valid until then. Requests on the same transport complete in submission order. Bulk
+// commands are packed into shared OUT transfers; a USB error on one of them fails every bulk request after it.
+int i2ctu_submit_msg(struct i2ctu_dev *dev, uint8_t addr, uint8_t rd, uint8_t flags, uint8_t *buf, uint16_t len,
+                     i2ctu_cb cb, void *user);
+int i2ctu_submit_bulk(struct i2ctu_dev *dev, const uint8_t *cmd, int cmd_len, uint8_t *resp, int resp_len,
+                      i2ctu_cb cb, void *user);
+int i2ctu_submit_bulk_view(struct i2ctu_dev *dev, const uint8_t *cmd, int cmd_len, int resp_len,
+                           i2ctu_view_cb cb, void *user);
+int i2ctu_submit_batch(struct i2ctu_dev *dev, struct i2ctu_msg *msgs, int count, i2ctu_cb cb, void *user);
+int i2ctu_submit_batch_at(struct i2ctu_dev *dev, struct i2ctu_msg *msgs, int count, uint16_t frame,
+                          uint16_t offset_us, i2ctu_cb cb, void *user);
+int i2ctu_submit_batch_by(struct i2ctu_dev *dev, struct i2ctu_msg *msgs, int count, uint16_t frame,
+                          uint16_t offset_us, i2ctu_cb cb, void *user);
+int i2ctu_submit_lock(struct i2ctu_dev *dev, uint16_t timeout_ms, i2ctu_cb cb, void *user);
+int i2ctu_submit_route(struct i2ctu_dev *dev, uint8_t route, i2ctu_cb cb, void *user);
+int i2ctu_submit_discover(struct i2ctu_dev *dev, int muxes, uint8_t rd, uint8_t *bitmaps, i2ctu_cb cb, void *user);
+int i2ctu_submit_update(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, uint8_t mask, uint8_t value, uint8_t *old,
+                        i2ctu_cb cb, void *user);
+int i2ctu_submit_write_long(struct i2ctu_dev *dev, uint8_t addr, const uint8_t *buf, uint32_t len, i2ctu_cb cb,
+                            void *user);
+int i2ctu_submit_verify(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, const uint8_t *buf, uint8_t len,
+                        uint8_t *mismatch, i2ctu_cb cb, void *user);
+int i2ctu_submit_multiwrite(struct i2ctu_dev *dev, const uint8_t *addrs, int count, const uint8_t *buf, uint16_t len,
+                            uint16_t *acked, i2ctu_cb cb, void *user);
+int i2ctu_submit_gather(struct i2ctu_dev *dev, const uint8_t *addrs, int count, uint8_t reg, uint8_t *buf, uint8_t len,
+                        int *results, i2ctu_cb cb, void *user);
+int i2ctu_submit_stream(struct i2ctu_dev *dev, uint8_t addr, uint8_t size, uint16_t period_us, const uint8_t *buf,
+                        uint32_t count, uint16_t *underruns, i2ctu_cb cb, void *user);
+int i2ctu_submit_program(struct i2ctu_dev *dev, uint8_t addr, const struct i2ctu_program *prog, const uint8_t *buf,
+                         uint32_t len, uint16_t *blocks, i2ctu_cb cb, void *user);
+int i2ctu_submit_checksum(struct i2ctu_dev *dev, uint8_t addr, uint8_t addr_width, uint16_t offset, uint32_t len,
+                          uint32_t *crc, i2ctu_cb cb, void *user);
+int i2ctu_submit_scatter(struct i2ctu_dev *dev, uint8_t addr, const uint8_t *regs, const uint8_t *lens, int count,
+                         uint8_t *buf, int *results, i2ctu_cb cb, void *user);
+int i2ctu_submit_eeprom_read(struct i2ctu_dev *dev, uint8_t addr, uint8_t format, uint32_t offset, uint8_t *buf,
+                             uint32_t len, i2ctu_cb cb, void *user);
+int i2ctu_submit_eeprom_write(struct i2ctu_dev *dev, uint8_t addr, uint8_t format, uint16_t page_size,
+                              uint16_t offset, const uint8_t *buf, uint16_t len, i2ctu_cb cb, void *user);
+int i2ctu_submit_eeprom_gang(struct i2ctu_dev *dev, uint8_t channels, uint8_t addr, uint8_t format,
+                             uint16_t page_size, uint16_t offset, const uint8_t *buf, uint16_t len, int *results,
+                             i2ctu_cb cb, void *user);
+int i2ctu_submit_spi(struct i2ctu_dev *dev, uint8_t config, uint8_t cs, const uint8_t *tx, uint8_t *rx, uint16_t len,
+                     i2ctu_cb cb, void *user);
+int i2ctu_submit_gpio(struct i2ctu_dev *dev, uint8_t op, uint16_t arg, uint8_t *level, i2ctu_cb cb, void *user);
+int i2ctu_submit_read_reg(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, uint8_t *buf, uint16_t len, i2ctu_cb cb,
+                          void *user);
+
+// Host side cache for i2ctu_submit_read_reg(), off by default
+int i2ctu_set_regcache(struct i2ctu_dev *dev, int enable, uint32_t ttl_us);
+int i2ctu_set_reg_ttl(struct i2ctu_dev *dev, uint8_t addr, uint8_t reg, uint16_t count, uint32_t ttl_us);
+void i2ctu_regcache_invalidate(struct i2ctu_dev *dev, int addr);
+int i2ctu_set_coalesce(struct i2ctu_dev *dev, int gap);
+
+int i2ctu_set_baudrate(struct i2ctu_dev *dev, uint16_t khz);
+int i2ctu_config_current(struct i2ctu_dev *dev, uint32_t tag);
+int i2ctu_config_uploaded(struct i2ctu_dev *dev, uint32_t tag);
+int i2ctu_config_saved(struct i2ctu_dev *dev);
+int i2ctu_set_reconnect(struct i2ctu_dev *dev, i2ctu_reconnect_cb cb, void *user);
+int i2ctu_connected(struct i2ctu_dev *dev);
+int i2ctu_set_depth(struct i2ctu_dev *dev, int depth);
+int i2ctu_set_credits(struct i2ctu_dev *dev, int credits);
+int i2ctu_set_deadline(struct i2ctu_dev *dev, int deadline_us);
+int i2ctu_get_deadline(struct i2ctu_dev *dev, int *rtt_us);
+void i2ctu_get_stats(struct i2ctu_dev *dev, struct i2ctu_stats *stats);
+int i2ctu_record(struct i2ctu_dev *dev, const char *path);
+void i2ctu_flush(struct i2ctu_dev *dev);
+int i2ctu_pending(struct i2ctu_dev *dev);
+int i2ctu_handle_events(struct i2ctu_dev *dev, int timeout_ms);
+int i2ctu_wait_all(struct i2ctu_dev *dev);
+
+// For event loops that can't block in libusb: poll the descriptor, call i2ctu_dispatch() when it is readable
+int i2ctu_get_fd(struct i2ctu_dev *dev);
+int i2ctu_dispatch(struct i2ctu_dev *dev);
+int i2ctu_get_timeout(struct i2ctu_dev *dev);
+
+// Worker thread owning an adapter, see i2ctu_worker.c. Once started, only the worker touches the device: the posts
+// below may be called from any thread and never block, callbacks are called on the worker thread.
+int i2ctu_worker_start(struct i2ctu_dev *dev, struct i2ctu_worker **worker);
+void i2ctu_worker_stop(struct i2ctu_worker *worker);
+int i2ctu_post_msg(struct i2ctu_worker *worker, uint8_t addr, uint8_t rd, uint8_t flags, uint8_t *buf, uint16_t len,
+                   i2ctu_cb cb, void *user);
+int i2ctu_post_bulk(struct i2ctu_worker *worker, const uint8_t *cmd, int cmd_len, uint8_t *resp, int resp_len,
+                    i2ctu_cb cb, void *user);
+int i2ctu_post_batch(struct i2ctu_worker *worker, struct i2ctu_msg *msgs, int count, i2ctu_cb cb, void *user);
+int i2ctu_post_call(struct i2ctu_worker *worker, i2ctu_call fn, void *arg);
+
+void i2ctu_future_init(struct i2ctu_future *future);
+void i2ctu_future_cb(struct i2ctu_dev *dev, int result, void *user);
+int i2ctu_future_wait(struct i2ctu_future *future);
+void i2ctu_future_destroy(struct i2ctu_future *future);
+
+// Pool of adapters on equivalent buses sharing independent jobs, see i2ctu_pool.c
+int i2ctu_pool_create(struct i2ctu_dev **devs, int count, struct i2ctu_pool **pool);
+void i2ctu_pool_destroy(struct i2ctu_pool *pool);
+int i2ctu_pool_submit(struct i2ctu_pool *pool, i2ctu_job fn, void *arg);
+void i2ctu_pool_wait(struct i2ctu_pool *pool);
+void i2ctu_pool_stats(struct i2ctu_pool *pool, int index, uint64_t *done, uint64_t *stolen);
+
+// Page-cached view of a target EEPROM, see i2ctu_eeprom.c. The calls block, handling the adapter's events.
+int i2ctu_eeprom_open(struct i2ctu_dev *dev, uint8_t addr, uint8_t format, uint32_t size, uint16_t page_size,
+                      unsigned slots, struct i2ctu_eeprom **eeprom);
+int i2ctu_eeprom_close(struct i2ctu_eeprom *eeprom);
+int i2ctu_eeprom_read(struct i2ctu_eeprom *eeprom, uint32_t offset, void *buf, uint32_t len);
+int i2ctu_eeprom_write(struct i2ctu_eeprom *eeprom, uint32_t offset, const void *buf, uint32_t len);
+int i2ctu_eeprom_flush(struct i2ctu_eeprom *eeprom);
+void i2ctu_eeprom_invalidate(struct i2ctu_eeprom *eeprom);
+void i2ctu_eeprom_stats(struct i2ctu_eeprom *eeprom, struct i2ctu_eeprom_stats *stats);
+
+// Adapter shared by i2ctud, see i2ctu_client.c. Requests behave like their i2ctu_submit_*() counterparts; only the
+// process's own requests complete in submission order, and LIBUSB_ERROR_BUSY means the rings are full for now.
+int i2ctu_client_open(const char *path, int adapter, struct i2ctu_client **client);
+void i2ctu_client_close(struct i2ctu_client *client);
+uint32_t i2ctu_client_extensions(struct i2ctu_client *client, uint32_t *extensions2);
+int i2ctu_client_bulk(struct i2ctu_client *client, const uint8_t *cmd, int cmd_len, uint8_t *resp, int resp_len,
+                      i2ctu_client_cb cb, void *user);
+int i2ctu_client_batch(struct i2ctu_client *client, struct i2ctu_msg *msgs, int count, i2ctu_client_cb cb,
+                       void *user);
+int i2ctu_client_handle_events(struct i2ctu_client *client, int timeout_ms);
+int i2ctu_client_wait_all(struct i2ctu_client *client);
+int i2ctu_client_fd(struct i2ctu_client *client);
+int i2ctu_client_pending(struct i2ctu_client *client);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - C++20 coroutines over the host library
+ *
+ * Lets drivers for I2C targets be written as straight-line code that still
+ * keeps the adapter busy: co_await dev.read(...), dev.write(...) or
+ * dev.transfer(msgs) submits the request and suspends the coroutine until
+ * its callback resumes it. Nothing blocks, so any number of coroutines can
+ * wait on one adapter at a time, and whatever they submit between two rounds
+ * of event handling goes out packed into the same OUT transfers. all()
+ * submits several requests from one coroutine at once and waits for all of
+ * them. Header only, on top of the C library; results are the library's
+ * result codes, not exceptions.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _I2CTU_HPP_
+#define _I2CTU_HPP_
+
+#include <array>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "i2ctu.h"
+#include "protocol.h"
+
+namespace i2ctu {
+
+/*
+ * Tasks
+ */
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+struct PromiseBase {
+	std::coroutine_handle<> continuation = std::noop_coroutine();
+	std::exception_ptr error;
+
+	// Tasks start when awaited or run, and hand control back to whoever awaited them when they finish
+	struct Final {
+		bool await_ready() noexcept { return false; }
+		template <typename P> std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+		{
+			return h.promise().continuation;
+		}
+		void await_resume() noexcept {}
+	};
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	Final final_suspend() noexcept { return {}; }
+	void unhandled_exception() { error = std::current_exception(); }
+
+	void rethrow()
+	{
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
+
+template <typename T> struct Promise : PromiseBase {
+	std::optional<T> value;
+
+	Task<T> get_return_object();
+	void return_value(T v) { value = std::move(v); }
+	T take() { rethrow(); return std::move(*value); }
+};
+
+template <> struct Promise<void> : PromiseBase {
+	Task<void> get_return_object();
+	void return_void() {}
+	void take() { rethrow(); }
+};
+
+} // namespace detail
+
+// A coroutine that can be awaited by another one or run on an adapter with Device::run()
+template <typename T> class [[nodiscard]] Task {
+public:
+	using promise_type = detail::Promise<T>;
+	using handle_type = std::coroutine_handle<promise_type>;
+
+	explicit Task(handle_type h) : h_(h) {}
+	Task(Task &&other) noexcept : h_(std::exchange(other.h_, {})) {}
+	Task &operator=(Task &&other) noexcept
+	{
+		if (this != &other) {
+			if (h_)
+				h_.destroy();
+			h_ = std::exchange(other.h_, {});
+		}
+		return *this;
+	}
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+	~Task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		h_.promise().continuation = awaiting;
+		return h_;
+	}
+	T await_resume() { return h_.promise().take(); }
+
+	// Runs the task up to its first request, for driving it from an event loop of one's own (see i2ctu_get_fd())
+	void start() { h_.resume(); }
+	bool done() const { return h_.done(); }
+	// The task's return value once done(), threw what the task threw
+	T result() { return h_.promise().take(); }
+
+private:
+	handle_type h_;
+};
+
+namespace detail {
+
+template <typename T> Task<T> Promise<T>::get_return_object()
+{
+	return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object()
+{
+	return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/*
+ * Requests
+ */
+
+// A coroutine waiting for a number of requests, resumed by the last one's callback
+struct Waiter {
+	std::coroutine_handle<> handle;
+	int count;
+};
+
+// An awaitable request; co_await gives its result, I2CTU_OK or one of the library's other result codes. The
+// callbacks only ever run from within event handling, never from the submit call, so the coroutine is resumed
+// by whatever handles the adapter's events.
+class Op {
+public:
+	Op(i2ctu_dev *dev) : dev_(dev) {}
+	// Requests may be moved into containers for all_of(), but only until they are submitted
+	Op(Op &&) = default;
+	Op(const Op &) = delete;
+	Op &operator=(const Op &) = delete;
+	virtual ~Op() = default;
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		own_ = { h, 1 };
+		return start(&own_);
+	}
+	int await_resume() const noexcept { return result_; }
+
+	// Submits the request for w, false if that failed and there is nothing to wait for
+	bool start(Waiter *w)
+	{
+		waiter_ = w;
+		result_ = submit(done, this);
+		return !result_;
+	}
+	int result() const { return result_; }
+
+protected:
+	virtual int submit(i2ctu_cb cb, void *user) = 0;
+
+	// Plain messages go out as a batch where there is bulk support, so they share transfers with everything else
+	bool bulk() const { return i2ctu_extensions(dev_) & FUNC_EXT_BULK; }
+
+	i2ctu_dev *dev_;
+
+private:
+	static void done(i2ctu_dev *, int result, void *user)
+	{
+		Op *op = static_cast<Op *>(user);
+
+		op->result_ = result;
+		if (!--op->waiter_->count)
+			op->waiter_->handle.resume();
+	}
+
+	int result_ = 0;
+	Waiter *waiter_ = nullptr;
+	Waiter own_;
+};
+
+class Msg : public Op {
+public:
+	Msg(i2ctu_dev *dev, uint16_t addr, uint16_t flags, uint8_t *buf, uint16_t len)
+		: Op(dev), msg_{ addr, flags, len, buf, 0, 0 } {}
+
+protected:
+	int submit(i2ctu_cb cb, void *user) override
+	{
+		if (bulk())
+			return i2ctu_submit_batch(dev_, &msg_, 1, cb, user);
+		if (msg_.flags & ~I2C_M_RD)
+			return LIBUSB_ERROR_NOT_SUPPORTED;
+		return i2ctu_submit_msg(dev_, msg_.addr, msg_.flags & I2C_M_RD, I2CTU_START | I2CTU_STOP, msg_.buf, msg_.len,
+		                        cb, user);
+	}
+
+private:
+	i2ctu_msg msg_;
+};
+
+// Register read: the register address written and the data read after a repeated START, through the register
+// cache if it is turned on
+class RegRead : public Op {
+public:
+	RegRead(i2ctu_dev *dev, uint16_t addr, uint8_t reg, uint8_t *buf, uint16_t len)
+		: Op(dev), addr_(addr), reg_(reg), buf_(buf), len_(len) {}
+
+protected:
+	int submit(i2ctu_cb cb, void *user) override
+	{
+		return i2ctu_submit_read_reg(dev_, addr_, reg_, buf_, len_, cb, user);
+	}
+
+private:
+	uint16_t addr_;
+	uint8_t reg_;
+	uint8_t *buf_;
+	uint16_t len_;
+};
+
+// Batch of the caller's segments, which get their results and TWSR codes like with i2ctu_submit_batch()
+class Transfer : public Op {
+public:
+	Transfer(i2ctu_dev *dev, std::span<i2ctu_msg> msgs) : Op(dev), msgs_(msgs) {}
+
+protected:
+	int submit(i2ctu_cb cb, void *user) override
+	{
+		return i2ctu_submit_batch(dev_, msgs_.data(), msgs_.size(), cb, user);
+	}
+
+private:
+	std::span<i2ctu_msg> msgs_;
+};
+
+// Several requests submitted together; co_await gives the first request's failure, or I2CTU_OK
+template <typename... T> class All {
+public:
+	explicit All(T &...ops) : ops_{ &ops... } {}
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		// One count held while submitting, in case everything fails right away
+		waiter_ = { h, 1 };
+		for (Op *op : ops_)
+			waiter_.count += op->start(&waiter_);
+		return --waiter_.count != 0;
+	}
+	int await_resume() const noexcept
+	{
+		for (const Op *op : ops_)
+			if (op->result())
+				return op->result();
+		return I2CTU_OK;
+	}
+
+private:
+	std::array<Op *, sizeof...(T)> ops_;
+	Waiter waiter_;
+};
+
+// Same for a number of requests only known at run time, such as a vector of them
+template <typename R> class AllOf {
+public:
+	explicit AllOf(R &ops) : ops_(ops) {}
+
+	bool await_ready() const noexcept { return false; }
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		waiter_ = { h, 1 };
+		for (Op &op : ops_)
+			waiter_.count += op.start(&waiter_);
+		return --waiter_.count != 0;
+	}
+	int await_resume() const noexcept
+	{
+		for (const Op &op : ops_)
+			if (op.result())
+				return op.result();
+		return I2CTU_OK;
+	}
+
+private:
+	R &ops_;
+	Waiter waiter_;
+};
+
+/** Awaits requests made in the same expression together, e.g. co_await all(dev.read(a, x, 2), dev.read(b, y, 2)). */
+template <typename... T> All<std::remove_reference_t<T>...> all(T &&...ops)
+{
+	return All<std::remove_reference_t<T>...>(ops...);
+}
+
+/** Awaits a container of requests together; it must stay put until the coroutine is resumed. */
+template <typename R> AllOf<R> all_of(R &ops)
+{
+	return AllOf<R>(ops);
+}
+
+/*
+ * Adapter
+ */
+
+// An adapter opened with the C library, which stays the owner; the requests made here are awaitables that submit
+// once awaited, so they belong right behind a co_await or into all()
+class Device {
+public:
+	explicit Device(i2ctu_dev *dev) : dev_(dev) {}
+
+	i2ctu_dev *get() const { return dev_; }
+
+	Msg read(uint16_t addr, uint8_t *buf, uint16_t len) { return Msg(dev_, addr, I2C_M_RD, buf, len); }
+	Msg write(uint16_t addr, const uint8_t *buf, uint16_t len)
+	{
+		return Msg(dev_, addr, 0, const_cast<uint8_t *>(buf), len);
+	}
+	RegRead read_reg(uint16_t addr, uint8_t reg, uint8_t *buf, uint16_t len)
+	{
+		return RegRead(dev_, addr, reg, buf, len);
+	}
+	Transfer transfer(std::span<i2ctu_msg> msgs) { return Transfer(dev_, msgs); }
+
+	/** Runs a task to completion, handling the adapter's events meanwhile, and gives its result. */
+	template <typename T> T run(Task<T> task)
+	{
+		task.start();
+		while (!task.done())
+			handle_events();
+		return task.result();
+	}
+
+	/** Runs a number of tasks side by side until all are done; the requests they make share transfers. */
+	void run_all(std::vector<Task<>> &tasks)
+	{
+		for (Task<> &task : tasks)
+			task.start();
+		for (Task<> &task : tasks) {
+			while (!task.done())
+				handle_events();
+		}
+		for (Task<> &task : tasks)
+			task.result();
+	}
+
+private:
+	void handle_events()
+	{
+		int ret = i2ctu_handle_events(dev_, 100);
+
+		if (ret && ret != LIBUSB_ERROR_INTERRUPTED && ret != LIBUSB_ERROR_TIMEOUT)
+			throw std::runtime_error(libusb_error_name(ret));
+	}
+
+	i2ctu_dev *dev_;
+};
+
+} // namespace i2ctu
+
+#endif
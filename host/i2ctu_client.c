@@ -0,0 +1,709 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - i2ctud client for the host library
+ *
+ * Uses an adapter owned by i2ctud, from any number of processes at once.
+ * Only connecting goes through the daemon's socket: after that, requests are
+ * appended to a ring in memory shared with the daemon and their completions
+ * come back through another one, and the eventfds next to them are only
+ * signalled for a side that may be asleep. Requests submitted in a burst, by
+ * this process or any other, end up in the same OUT transfers.
+ *
+ * A daemon on another host is reached over TCP instead, with the same records
+ * streamed over the connection: requests are collected and sent together
+ * when events are handled, so a burst of them costs one network round trip.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "i2ctu.h"
+#include "i2ctud.h"
+#include "protocol.h"
+
+#define PENDING_INITIAL  64
+#define STREAM_INITIAL   (16 * 1024)
+#define SEND_EARLY       (64 * 1024)  // Over TCP, send without waiting for events once this much is collected
+
+// A request waiting for its completion, indexed by its tag
+struct pending {
+	i2ctu_client_cb cb;
+	void *user;
+	int used;
+	int type;
+	uint8_t *resp;           // I2CTUD_BULK
+	int resp_len;
+	struct i2ctu_msg *msgs;  // I2CTUD_BATCH
+	int count;
+	uint32_t credit;         // Completion ring space held for it
+	int next_free;
+};
+
+struct i2ctu_client {
+	int sock;
+	int req_fd;
+	int done_fd;
+	struct i2ctud_shm *shm;
+	uint32_t extensions;
+	uint32_t extensions2;
+	int fd_mode;             // i2ctu_client_fd() was called, always ask to be signalled
+
+	// Over TCP: there is no shared memory, records go through these buffers instead
+	int tcp;
+	int gone;
+	uint8_t *out, *in;
+	size_t out_len, out_size, in_len, in_size;
+
+	struct pending *pending;
+	int size;
+	int free_list;
+	int outstanding;
+
+	// Completion ring space held by requests in flight; it can't overflow as long as this doesn't
+	uint32_t credit;
+};
+
+static int recv_welcome(int sock, struct i2ctud_welcome *welcome, int *fds)
+{
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { welcome, sizeof(*welcome) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+	                      .msg_controllen = sizeof(control.buf) };
+	struct cmsghdr *cmsg;
+
+	if (recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(*welcome) || welcome->magic != I2CTUD_MAGIC)
+		return LIBUSB_ERROR_IO;
+	if (welcome->result)
+		return welcome->result;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+		return LIBUSB_ERROR_IO;
+	memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+	if (welcome->ring_size != I2CTUD_RING_SIZE) {
+		for (int i = 0; i < 3; i++)
+			close(fds[i]);
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	}
+	return 0;
+}
+
+// "tcp:HOST:PORT", HOST may be bracketed for IPv6 addresses
+static int connect_tcp(const char *where)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res, *ai;
+	char host[256];
+	const char *port;
+	int sock = -1, one = 1;
+	size_t len;
+
+	if (!(port = strrchr(where, ':')) || (len = port - where) >= sizeof(host))
+		return -1;
+	if (len >= 2 && where[0] == '[' && where[len - 1] == ']') {
+		where++;
+		len -= 2;
+	}
+	memcpy(host, where, len);
+	host[len] = 0;
+	if (getaddrinfo(host, port + 1, &hints, &res))
+		return -1;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0)
+			continue;
+		if (!connect(sock, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(sock);
+		sock = -1;
+	}
+	freeaddrinfo(res);
+
+	// Requests are collected and sent together anyway, Nagle would only hold the last of them back
+	if (sock >= 0)
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return sock;
+}
+
+/** Connects to the i2ctud serving \c path and uses its adapter \c adapter, an index in bus and port order like
+ *  i2ctu_open_all(). \c path is the daemon's Unix socket (NULL for the default one), or "tcp:HOST:PORT" for one
+ *  on another host.
+ */
+int i2ctu_client_open(const char *path, int adapter, struct i2ctu_client **clientp)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct i2ctud_hello hello = { I2CTUD_MAGIC, I2CTUD_VERSION, adapter };
+	struct i2ctud_welcome welcome;
+	struct i2ctu_client *c;
+	int fds[3], ret;
+
+	if (!path)
+		path = I2CTUD_SOCKET;
+	if (adapter < 0)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	if (!(c = calloc(1, sizeof(*c))))
+		return LIBUSB_ERROR_NO_MEM;
+	c->free_list = -1;
+
+	if (!strncmp(path, "tcp:", 4)) {
+		c->tcp = 1;
+		if ((c->sock = connect_tcp(path + 4)) < 0) {
+			free(c);
+			return LIBUSB_ERROR_NOT_FOUND;
+		}
+	} else {
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			free(c);
+			return LIBUSB_ERROR_INVALID_PARAM;
+		}
+		strcpy(addr.sun_path, path);
+		if ((c->sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+			free(c);
+			return LIBUSB_ERROR_OTHER;
+		}
+		if (connect(c->sock, (struct sockaddr *)&addr, sizeof(addr))) {
+			ret = LIBUSB_ERROR_NOT_FOUND;
+			goto err;
+		}
+	}
+
+	if (send(c->sock, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello)) {
+		ret = LIBUSB_ERROR_IO;
+		goto err;
+	}
+
+	if (c->tcp) {
+		if (recv(c->sock, &welcome, sizeof(welcome), MSG_WAITALL) != sizeof(welcome) ||
+		    welcome.magic != I2CTUD_MAGIC) {
+			ret = LIBUSB_ERROR_IO;
+			goto err;
+		}
+		if ((ret = welcome.result))
+			goto err;
+		c->extensions = welcome.extensions;
+		c->extensions2 = welcome.extensions2;
+		*clientp = c;
+		return 0;
+	}
+
+	if ((ret = recv_welcome(c->sock, &welcome, fds)))
+		goto err;
+
+	c->shm = mmap(NULL, sizeof(*c->shm), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	close(fds[0]);
+	c->req_fd = fds[1];
+	c->done_fd = fds[2];
+	if (c->shm == MAP_FAILED) {
+		close(c->req_fd);
+		close(c->done_fd);
+		ret = LIBUSB_ERROR_NO_MEM;
+		goto err;
+	}
+
+	c->extensions = welcome.extensions;
+	c->extensions2 = welcome.extensions2;
+	*clientp = c;
+	return 0;
+
+err:
+	close(c->sock);
+	free(c);
+	return ret;
+}
+
+/** Disconnects, after waiting for the requests in flight; don't call this from a callback. */
+void i2ctu_client_close(struct i2ctu_client *c)
+{
+	i2ctu_client_wait_all(c);
+	if (!c->tcp) {
+		munmap(c->shm, sizeof(*c->shm));
+		close(c->done_fd);
+		close(c->req_fd);
+	}
+	close(c->sock);
+	free(c->out);
+	free(c->in);
+	free(c->pending);
+	free(c);
+}
+
+/** Extension words of the adapter, like i2ctu_extensions() and i2ctu_extensions2(). */
+uint32_t i2ctu_client_extensions(struct i2ctu_client *c, uint32_t *extensions2)
+{
+	if (extensions2)
+		*extensions2 = c->extensions2;
+	return c->extensions;
+}
+
+/*
+ * Requests
+ */
+
+static int alloc_pending(struct i2ctu_client *c)
+{
+	int tag;
+
+	if (c->free_list < 0) {
+		int size = c->size ? c->size * 2 : PENDING_INITIAL;
+		struct pending *pending = realloc(c->pending, size * sizeof(*pending));
+
+		if (!pending)
+			return -1;
+		for (int i = size - 1; i >= c->size; i--) {
+			pending[i].used = 0;
+			pending[i].next_free = c->free_list;
+			c->free_list = i;
+		}
+		c->pending = pending;
+		c->size = size;
+	}
+	tag = c->free_list;
+	c->free_list = c->pending[tag].next_free;
+	return tag;
+}
+
+static void free_pending(struct i2ctu_client *c, int tag)
+{
+	c->pending[tag].used = 0;
+	c->pending[tag].next_free = c->free_list;
+	c->free_list = tag;
+}
+
+// Takes a tag and completion space for a request whose completion payload is done_len bytes. Gaps at the end of
+// the ring are never bigger than the record after them, so twice the record size covers the worst case. Over TCP
+// the socket buffers take care of that.
+static int start(struct i2ctu_client *c, uint32_t done_len, i2ctu_client_cb cb, void *user)
+{
+	const uint32_t credit = c->tcp ? 0 : 2 * i2ctud_record_size(sizeof(struct i2ctud_completion) + done_len);
+	int tag;
+
+	if (credit > I2CTUD_RING_SIZE)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (c->credit + credit > I2CTUD_RING_SIZE)
+		return LIBUSB_ERROR_BUSY;
+	if ((tag = alloc_pending(c)) < 0)
+		return LIBUSB_ERROR_NO_MEM;
+
+	memset(&c->pending[tag], 0, sizeof(c->pending[tag]));
+	c->pending[tag].used = 1;
+	c->pending[tag].cb = cb;
+	c->pending[tag].user = user;
+	c->pending[tag].credit = credit;
+	return tag;
+}
+
+static int send_out(struct i2ctu_client *c);
+
+// Room for a request record of len payload bytes, in the ring or the TCP send buffer
+static uint8_t *reserve(struct i2ctu_client *c, uint32_t len, int tag)
+{
+	const size_t need = i2ctud_record_size(len);
+	struct i2ctud_record *rec;
+
+	if (!c->tcp)
+		return i2ctud_reserve(&c->shm->req, len, tag);
+
+	if (need > I2CTUD_RING_SIZE / 2)
+		return NULL;
+	if (c->out_len + need > c->out_size) {
+		size_t size = c->out_size ? c->out_size : STREAM_INITIAL;
+		uint8_t *out;
+
+		while (size < c->out_len + need)
+			size *= 2;
+		if (!(out = realloc(c->out, size)))
+			return NULL;
+		c->out = out;
+		c->out_size = size;
+	}
+	rec = (struct i2ctud_record *)(c->out + c->out_len);
+	memset(rec, 0, need);
+	rec->len = len;
+	rec->tag = tag;
+	return (uint8_t *)(rec + 1);
+}
+
+static void queued(struct i2ctu_client *c, int tag, uint32_t len)
+{
+	const uint64_t one = 1;
+
+	c->credit += c->pending[tag].credit;
+	c->outstanding++;
+
+	if (c->tcp) {
+		c->out_len += i2ctud_record_size(len);
+		if (c->out_len >= SEND_EARLY)
+			send_out(c);
+		return;
+	}
+
+	i2ctud_commit(&c->shm->req, len);
+	if (i2ctud_must_signal(&c->shm->req) && write(c->req_fd, &one, sizeof(one)) < 0)
+		return;  // Only fails if the counter is about to overflow, and then it is signalled anyway
+}
+
+/*
+ * Like the i2ctu_submit_*() calls, each returns 0 or a negative libusb error, and on success the callback is called
+ * exactly once, from within i2ctu_client_handle_events(). LIBUSB_ERROR_BUSY means the rings are full for now:
+ * handle events and try again. Over TCP, requests go out when events are handled.
+ */
+
+/** Queues a raw bulk command stream, see i2ctu_submit_bulk(). */
+int i2ctu_client_bulk(struct i2ctu_client *c, const uint8_t *cmd, int cmd_len, uint8_t *resp, int resp_len,
+                      i2ctu_client_cb cb, void *user)
+{
+	const uint32_t len = sizeof(struct i2ctud_request) + cmd_len;
+	struct i2ctud_request *req;
+	int tag;
+
+	if (cmd_len < 0 || resp_len < 0 || resp_len > I2CTUD_RING_SIZE / 4)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (i2ctud_record_size(len) > I2CTUD_RING_SIZE / 2)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if ((tag = start(c, resp_len, cb, user)) < 0)
+		return tag;
+	if (!(req = (struct i2ctud_request *)reserve(c, len, tag))) {
+		free_pending(c, tag);
+		return c->tcp ? LIBUSB_ERROR_NO_MEM : LIBUSB_ERROR_BUSY;
+	}
+
+	req->type = I2CTUD_BULK;
+	req->count = 0;
+	req->resp_len = resp_len;
+	memcpy(req + 1, cmd, cmd_len);
+	c->pending[tag].type = I2CTUD_BULK;
+	c->pending[tag].resp = resp;
+	c->pending[tag].resp_len = resp_len;
+	queued(c, tag, len);
+	return 0;
+}
+
+/** Queues a batch, see i2ctu_submit_batch(); the segments and their buffers must stay valid until the callback. */
+int i2ctu_client_batch(struct i2ctu_client *c, struct i2ctu_msg *msgs, int count, i2ctu_client_cb cb, void *user)
+{
+	uint32_t read_len = 0, write_len = 0, len;
+	struct i2ctud_segment *seg;
+	struct i2ctud_request *req;
+	uint8_t *p;
+	int tag;
+
+	if (count < 1 || count > UINT16_MAX)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	for (int i = 0; i < count; i++) {
+		if (msgs[i].flags & I2C_M_RD)
+			read_len += msgs[i].len;
+		else
+			write_len += msgs[i].len;
+	}
+	if (read_len > I2CTUD_RING_SIZE / 4)
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	len = sizeof(*req) + count * sizeof(*seg) + write_len;
+	if (i2ctud_record_size(len) > I2CTUD_RING_SIZE / 2)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if ((tag = start(c, 2 * count + read_len, cb, user)) < 0)
+		return tag;
+	if (!(req = (struct i2ctud_request *)reserve(c, len, tag))) {
+		free_pending(c, tag);
+		return c->tcp ? LIBUSB_ERROR_NO_MEM : LIBUSB_ERROR_BUSY;
+	}
+
+	req->type = I2CTUD_BATCH;
+	req->count = count;
+	req->resp_len = 0;
+	seg = (struct i2ctud_segment *)(req + 1);
+	p = (uint8_t *)(seg + count);
+	for (int i = 0; i < count; i++) {
+		seg[i].addr = msgs[i].addr;
+		seg[i].flags = msgs[i].flags;
+		seg[i].len = msgs[i].len;
+		if (!(msgs[i].flags & I2C_M_RD)) {
+			memcpy(p, msgs[i].buf, msgs[i].len);
+			p += msgs[i].len;
+		}
+	}
+	c->pending[tag].type = I2CTUD_BATCH;
+	c->pending[tag].msgs = msgs;
+	c->pending[tag].count = count;
+	queued(c, tag, len);
+	return 0;
+}
+
+/*
+ * Completions
+ */
+
+static void finish(struct i2ctu_client *c, int tag, int result);
+
+// The daemon went away: nothing in flight will ever complete
+static void fail_all(struct i2ctu_client *c)
+{
+	for (int tag = 0; tag < c->size && c->outstanding; tag++)
+		if (c->pending[tag].used)
+			finish(c, tag, LIBUSB_ERROR_NO_DEVICE);
+}
+
+static void finish(struct i2ctu_client *c, int tag, int result)
+{
+	struct pending *pend = &c->pending[tag];
+	i2ctu_client_cb cb = pend->cb;
+	void *user = pend->user;
+
+	c->credit -= pend->credit;
+	c->outstanding--;
+	free_pending(c, tag);
+	if (cb)
+		cb(c, result, user);
+}
+
+// Fills in what a completion record brings, returning the tag it is for or -1 if it is for nothing known
+static int take(struct i2ctu_client *c, const struct i2ctud_record *rec, int *resultp)
+{
+	const uint8_t *p = (const uint8_t *)(rec + 1);
+	const int tag = rec->tag;
+	struct pending *pend;
+	int result;
+
+	if (tag < 0 || tag >= c->size || !c->pending[tag].used || rec->len < sizeof(struct i2ctud_completion))
+		return -1;
+	pend = &c->pending[tag];
+
+	result = ((const struct i2ctud_completion *)p)->result;
+	p += sizeof(struct i2ctud_completion);
+
+	if (result >= 0 && pend->type == I2CTUD_BULK) {
+		if (rec->len - sizeof(struct i2ctud_completion) == (uint32_t)pend->resp_len)
+			memcpy(pend->resp, p, pend->resp_len);
+		else
+			result = LIBUSB_ERROR_IO;
+	} else if (result >= 0 && pend->type == I2CTUD_BATCH) {
+		const uint8_t *data = p + 2 * pend->count;
+
+		for (int i = 0; i < pend->count; i++) {
+			struct i2ctu_msg *msg = &pend->msgs[i];
+
+			msg->result = p[2 * i];
+			msg->twsr = p[2 * i + 1];
+			if (msg->flags & I2C_M_RD) {
+				memcpy(msg->buf, data, msg->len);
+				data += msg->len;
+			}
+		}
+	}
+
+	*resultp = result;
+	return tag;
+}
+
+// Hands out the completions in the ring; the callbacks may queue new requests
+static int process(struct i2ctu_client *c)
+{
+	const struct i2ctud_record *rec;
+	int n = 0;
+
+	while ((rec = i2ctud_peek(&c->shm->done))) {
+		int result, tag = take(c, rec, &result);
+
+		i2ctud_consume(&c->shm->done, rec);
+		if (tag >= 0) {
+			finish(c, tag, result);
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * TCP
+ */
+
+// Sends what the socket takes without blocking
+static int send_out(struct i2ctu_client *c)
+{
+	ssize_t n;
+
+	if (!c->out_len || c->gone)
+		return 0;
+	if ((n = send(c->sock, c->out, c->out_len, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	memmove(c->out, c->out + n, c->out_len - n);
+	c->out_len -= n;
+	return 0;
+}
+
+// Takes in what has arrived and hands out the completions in it; records stay 8-byte aligned in the buffer since
+// the stream after the welcome is made of nothing else
+static int receive(struct i2ctu_client *c)
+{
+	size_t off = 0;
+	int n = 0;
+
+	for (;;) {
+		ssize_t got;
+
+		if (c->in_size - c->in_len < STREAM_INITIAL) {
+			size_t size = c->in_size ? c->in_size * 2 : 4 * STREAM_INITIAL;
+			uint8_t *in = realloc(c->in, size);
+
+			if (!in)
+				break;
+			c->in = in;
+			c->in_size = size;
+		}
+		got = recv(c->sock, c->in + c->in_len, c->in_size - c->in_len, MSG_DONTWAIT);
+		if (got > 0) {
+			c->in_len += got;
+			continue;
+		}
+		if (!got || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			c->gone = 1;
+		break;
+	}
+
+	while (c->in_len - off >= sizeof(struct i2ctud_record)) {
+		const struct i2ctud_record *rec = (const struct i2ctud_record *)(c->in + off);
+		const size_t size = i2ctud_record_size(rec->len);
+		int result, tag;
+
+		if (rec->len > I2CTUD_RING_SIZE) {
+			c->gone = 1;
+			break;
+		}
+		if (c->in_len - off < size)
+			break;
+		off += size;
+		if ((tag = take(c, rec, &result)) >= 0) {
+			// The callback may receive, too; what's been taken in so far goes first
+			memmove(c->in, c->in + off, c->in_len - off);
+			c->in_len -= off;
+			off = 0;
+			finish(c, tag, result);
+			n++;
+		}
+	}
+	memmove(c->in, c->in + off, c->in_len - off);
+	c->in_len -= off;
+	return n;
+}
+
+static int handle_tcp(struct i2ctu_client *c, int timeout_ms)
+{
+	struct pollfd fd = { c->sock, POLLIN, 0 };
+
+	if (send_out(c))
+		c->gone = 1;
+	if (!receive(c) && timeout_ms && !c->gone) {
+		if (c->out_len)
+			fd.events |= POLLOUT;
+		poll(&fd, 1, timeout_ms);
+		if (send_out(c))
+			c->gone = 1;
+		receive(c);
+	}
+	if (c->gone) {
+		fail_all(c);
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+	return 0;
+}
+
+
+/** Calls the callbacks of completed requests, waiting at most \c timeout_ms for the first one (-1 for ever).
+ *  @return 0, or LIBUSB_ERROR_NO_DEVICE once the daemon is gone, which fails everything in flight
+ */
+int i2ctu_client_handle_events(struct i2ctu_client *c, int timeout_ms)
+{
+	struct pollfd fds[2] = { { c->done_fd, POLLIN, 0 }, { c->sock, POLLIN, 0 } };
+	uint64_t count;
+
+	if (c->tcp)
+		return handle_tcp(c, timeout_ms);
+
+	// The descriptor stays readable until the count is taken
+	if (c->fd_mode && read(c->done_fd, &count, sizeof(count)) < 0)
+		count = 0;
+	if (process(c) || !timeout_ms)
+		return 0;
+
+	__atomic_store_n(&c->shm->done.waiting, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!i2ctud_peek(&c->shm->done))
+		poll(fds, 2, timeout_ms);
+	if (!c->fd_mode)
+		__atomic_store_n(&c->shm->done.waiting, 0, __ATOMIC_RELAXED);
+	if (read(c->done_fd, &count, sizeof(count)) < 0)
+		count = 0;
+
+	process(c);
+	// The daemon never sends anything on the socket after the welcome, so this is its end
+	if (fds[1].revents) {
+		fail_all(c);
+		return LIBUSB_ERROR_NO_DEVICE;
+	}
+	return 0;
+}
+
+/** Handles events until all requests have completed. */
+int i2ctu_client_wait_all(struct i2ctu_client *c)
+{
+	while (c->outstanding) {
+		int ret = i2ctu_client_handle_events(c, -1);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/** A descriptor for an event loop to poll for reading; once readable, call i2ctu_client_handle_events() with a
+ *  timeout of 0. The daemon then signals every completion, not only those the client waits for. Over TCP it is
+ *  the connection, and requests only go out from i2ctu_client_handle_events(), so call it after submitting too.
+ */
+int i2ctu_client_fd(struct i2ctu_client *c)
+{
+	if (c->tcp)
+		return c->sock;
+	c->fd_mode = 1;
+	__atomic_store_n(&c->shm->done.waiting, 1, __ATOMIC_RELAXED);
+	return c->done_fd;
+}
+
+/** Requests whose callback hasn't been called yet. */
+int i2ctu_client_pending(struct i2ctu_client *c)
+{
+	return c->outstanding;
+}
@@ -0,0 +1,367 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - page cache over target EEPROMs
+ *
+ * Lets tools treat a 24Cxx style EEPROM like a file: i2ctu_eeprom_read() and
+ * i2ctu_eeprom_write() take any offset and length, and work on a cache of
+ * whole EEPROM pages in between. Pages are read in runs, all the pages a call
+ * misses at once, with one EEPROM_READ per run; writes only mark the pages
+ * dirty, and i2ctu_eeprom_flush() sends each run of dirty pages as a single
+ * EEPROM write that the firmware splits into page writes and ACK polls by
+ * itself. All of a flush's commands go out together and are waited for once,
+ * so a thousand small accesses come down to a handful of bulk commands.
+ *
+ * The cache is direct mapped, page n goes to slot n modulo the slot count, so
+ * consecutive pages never evict each other. Calls block, handling the
+ * adapter's events, and must not be made from within a callback.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2ctu.h"
+#include "protocol.h"
+
+#define NO_PAGE       UINT32_MAX
+#define DEFAULT_SLOTS 64
+#define MAX_WRITE     0x8000  // Longest single EEPROM write, well within its 16-bit length
+#define WAIT_MS       100
+
+struct i2ctu_eeprom {
+	struct i2ctu_dev *dev;
+	uint8_t addr, format;
+	uint16_t page_size;
+	uint32_t pages;
+
+	unsigned slots;
+	uint32_t *tags;          // Page each slot holds, NO_PAGE if none
+	uint8_t *dirty;
+	uint8_t *data;           // slots * page_size bytes, slot after slot
+
+	// Requests of the current round, which are submitted together and then waited for once. Kept here rather
+	// than on the stack, so a request still out after an event handling error can't complete into a stale frame.
+	int pending;
+	int result;
+
+	struct i2ctu_eeprom_stats stats;
+};
+
+static void round_cb(struct i2ctu_dev *dev, int result, void *user)
+{
+	struct i2ctu_eeprom *ee = user;
+
+	(void)dev;
+	if (result && !ee->result)
+		ee->result = result;
+	ee->pending--;
+}
+
+static void round_submitted(struct i2ctu_eeprom *ee, int ret)
+{
+	if (ret) {
+		if (!ee->result)
+			ee->result = ret;
+	} else {
+		ee->pending++;
+	}
+}
+
+static int round_wait(struct i2ctu_eeprom *ee)
+{
+	int ret;
+
+	while (ee->pending) {
+		ret = i2ctu_handle_events(ee->dev, WAIT_MS);
+		if (ret && ret != LIBUSB_ERROR_INTERRUPTED && ret != LIBUSB_ERROR_TIMEOUT)
+			return ret;
+	}
+	ret = ee->result;
+	ee->result = 0;
+	return ret;
+}
+
+static inline unsigned slot_of(const struct i2ctu_eeprom *ee, uint32_t page)
+{
+	return page % ee->slots;
+}
+
+static inline uint8_t *slot_data(const struct i2ctu_eeprom *ee, unsigned slot)
+{
+	return ee->data + (size_t)slot * ee->page_size;
+}
+
+static inline int resident(const struct i2ctu_eeprom *ee, uint32_t page)
+{
+	return ee->tags[slot_of(ee, page)] == page;
+}
+
+// Queues the EEPROM write of a run of dirty pages. Offsets past 64 KB only come with a two byte memory address,
+// where the block-select bits go into the 7-bit address right away; runs never cross a 64 KB boundary.
+static void write_run(struct i2ctu_eeprom *ee, unsigned slot, unsigned count)
+{
+	uint32_t offset = ee->tags[slot] * ee->page_size;
+	uint8_t addr    = ee->addr | (offset >> 16);
+
+	round_submitted(ee, i2ctu_submit_eeprom_write(ee->dev, addr, ee->format, ee->page_size, offset & 0xffff,
+	                                              slot_data(ee, slot), count * ee->page_size, round_cb, ee));
+	ee->stats.writes++;
+}
+
+/** Writes all dirty pages back, each run of consecutive (in the slots and on the chip) ones as a single EEPROM
+ *  write, and waits for them to be stored. Pages whose write failed stay dirty.
+ */
+int i2ctu_eeprom_flush(struct i2ctu_eeprom *ee)
+{
+	unsigned slot = 0, first, count;
+	int ret;
+
+	while (slot < ee->slots) {
+		if (!ee->dirty[slot]) {
+			slot++;
+			continue;
+		}
+		first = slot;
+		count = 1;
+		while (++slot < ee->slots && ee->dirty[slot] && ee->tags[slot] == ee->tags[slot - 1] + 1 &&
+		       (count + 1) * ee->page_size <= MAX_WRITE &&
+		       (ee->tags[slot] * ee->page_size) >> 16 == (ee->tags[first] * ee->page_size) >> 16)
+			count++;
+		write_run(ee, first, count);
+	}
+
+	ret = round_wait(ee);
+	if (!ret)
+		memset(ee->dirty, 0, ee->slots);
+	return ret;
+}
+
+// Makes pages first to first + count - 1 resident, at most a slot count of them: missing pages are read in runs,
+// one EEPROM_READ each, and all reads are waited for together. Pages from skip_from to skip_to - 1 are about to be
+// overwritten as a whole, so their slots are merely claimed. Dirty pages in the way are written back first.
+static int load(struct i2ctu_eeprom *ee, uint32_t first, uint32_t count, uint32_t skip_from, uint32_t skip_to)
+{
+	const uint32_t end = first + count;
+	uint32_t page, run = NO_PAGE;
+	int ret;
+
+	for (page = first; page < end; page++) {
+		const unsigned slot = slot_of(ee, page);
+		if (ee->tags[slot] != page && ee->dirty[slot]) {
+			ret = i2ctu_eeprom_flush(ee);
+			if (ret)
+				return ret;
+			break;
+		}
+	}
+
+	for (page = first; page <= end; page++) {
+		const int need = page < end && !resident(ee, page) && (page < skip_from || page >= skip_to);
+
+		// A run ends at a page that needn't be read, at the end of the range and where the slots wrap around
+		if (run != NO_PAGE && (!need || !slot_of(ee, page))) {
+			round_submitted(ee, i2ctu_submit_eeprom_read(ee->dev, ee->addr, ee->format, run * ee->page_size,
+			                                             slot_data(ee, slot_of(ee, run)),
+			                                             (page - run) * ee->page_size, round_cb, ee));
+			ee->stats.reads++;
+			run = NO_PAGE;
+		}
+		if (page == end)
+			break;
+		if (need) {
+			if (run == NO_PAGE)
+				run = page;
+			ee->stats.misses++;
+		} else if (resident(ee, page)) {
+			ee->stats.hits++;
+		}
+		ee->tags[slot_of(ee, page)] = page;
+	}
+
+	ret = round_wait(ee);
+	if (ret) {
+		// Whatever was being read is unknown now
+		for (page = first; page < end; page++)
+			if (!ee->dirty[slot_of(ee, page)])
+				ee->tags[slot_of(ee, page)] = NO_PAGE;
+	}
+	return ret;
+}
+
+// Pages of the next step from page on, up to last: as many as there are slots
+static uint32_t window(const struct i2ctu_eeprom *ee, uint32_t page, uint32_t last)
+{
+	return (last - page + 1 < ee->slots) ? last - page + 1 : ee->slots;
+}
+
+static int in_range(const struct i2ctu_eeprom *ee, uint32_t offset, uint32_t len)
+{
+	const uint32_t size = ee->pages * ee->page_size;
+
+	return offset < size && len <= size - offset;
+}
+
+/** Reads len bytes from offset into buf, from the cache where it holds them. */
+int i2ctu_eeprom_read(struct i2ctu_eeprom *ee, uint32_t offset, void *buf, uint32_t len)
+{
+	uint8_t *out = buf;
+	uint32_t page, last;
+	int ret;
+
+	if (!len)
+		return I2CTU_OK;
+	if (!in_range(ee, offset, len))
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	last = (offset + len - 1) / ee->page_size;
+	for (page = offset / ee->page_size; page <= last; ) {
+		const uint32_t end = page + window(ee, page, last);
+
+		ret = load(ee, page, end - page, 0, 0);
+		if (ret)
+			return ret;
+		for (; page < end; page++) {
+			const uint32_t in_page = offset % ee->page_size;
+			const uint32_t chunk   = (len < ee->page_size - in_page) ? len : ee->page_size - in_page;
+
+			memcpy(out, slot_data(ee, slot_of(ee, page)) + in_page, chunk);
+			out    += chunk;
+			offset += chunk;
+			len    -= chunk;
+		}
+	}
+	return I2CTU_OK;
+}
+
+/** Writes len bytes from buf to offset into the cache; they reach the EEPROM with the next flush, or when their
+ *  pages are evicted. Pages only written in part are read first.
+ */
+int i2ctu_eeprom_write(struct i2ctu_eeprom *ee, uint32_t offset, const void *buf, uint32_t len)
+{
+	const uint8_t *in = buf;
+	uint32_t page, last, skip_from, skip_to;
+	int ret;
+
+	if (!len)
+		return I2CTU_OK;
+	if (!in_range(ee, offset, len))
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	// The pages written as a whole
+	skip_from = (offset + ee->page_size - 1) / ee->page_size;
+	skip_to   = (offset + len) / ee->page_size;
+
+	last = (offset + len - 1) / ee->page_size;
+	for (page = offset / ee->page_size; page <= last; ) {
+		const uint32_t end = page + window(ee, page, last);
+
+		ret = load(ee, page, end - page, skip_from, skip_to);
+		if (ret)
+			return ret;
+		for (; page < end; page++) {
+			const unsigned slot    = slot_of(ee, page);
+			const uint32_t in_page = offset % ee->page_size;
+			const uint32_t chunk   = (len < ee->page_size - in_page) ? len : ee->page_size - in_page;
+
+			memcpy(slot_data(ee, slot) + in_page, in, chunk);
+			ee->dirty[slot] = 1;
+			in     += chunk;
+			offset += chunk;
+			len    -= chunk;
+		}
+	}
+	return I2CTU_OK;
+}
+
+/** Forgets the cached pages, e.g. after something else wrote to the EEPROM; dirty pages are lost. */
+void i2ctu_eeprom_invalidate(struct i2ctu_eeprom *ee)
+{
+	unsigned slot;
+
+	for (slot = 0; slot < ee->slots; slot++)
+		ee->tags[slot] = NO_PAGE;
+	memset(ee->dirty, 0, ee->slots);
+}
+
+void i2ctu_eeprom_stats(struct i2ctu_eeprom *ee, struct i2ctu_eeprom_stats *stats)
+{
+	*stats = ee->stats;
+}
+
+/** Sets up a cache of slots pages (0 for a default of 64) over the EEPROM at 7-bit address addr, which is size
+ *  bytes in pages of page_size and addressed as format describes (see EEPROM_FMT()). Needs an adapter with
+ *  EEPROM_READ, and one with block-select addressing for formats with block-select bits.
+ */
+int i2ctu_eeprom_open(struct i2ctu_dev *dev, uint8_t addr, uint8_t format, uint32_t size, uint16_t page_size,
+                      unsigned slots, struct i2ctu_eeprom **eeprom)
+{
+	struct i2ctu_eeprom *ee;
+
+	if (!(i2ctu_extensions3(dev) & FUNC_EXT3_EEPROM_BLOCKS))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+	if (!page_size || !size || size % page_size || !(format & EEPROM_FMT_WIDTH) ||
+	    (format & EEPROM_FMT_WIDTH) > 2 || format > EEPROM_FMT_WIDTH + EEPROM_FMT_BLOCKS)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	// As much as the memory address and the block-select bits reach
+	if (size > 1UL << (8 * (format & EEPROM_FMT_WIDTH) + ((format & EEPROM_FMT_BLOCKS) >> EEPROM_FMT_BLOCKS_SHIFT)))
+		return LIBUSB_ERROR_INVALID_PARAM;
+
+	ee = calloc(1, sizeof(*ee));
+	if (!ee)
+		return LIBUSB_ERROR_NO_MEM;
+	ee->dev       = dev;
+	ee->addr      = addr;
+	ee->format    = format;
+	ee->page_size = page_size;
+	ee->pages     = size / page_size;
+	ee->slots     = slots ? slots : DEFAULT_SLOTS;
+	if (ee->slots > ee->pages)
+		ee->slots = ee->pages;
+	ee->tags  = malloc(ee->slots * sizeof(*ee->tags));
+	ee->dirty = calloc(ee->slots, 1);
+	ee->data  = malloc((size_t)ee->slots * page_size);
+	if (!ee->tags || !ee->dirty || !ee->data) {
+		i2ctu_eeprom_close(ee);
+		return LIBUSB_ERROR_NO_MEM;
+	}
+	i2ctu_eeprom_invalidate(ee);
+
+	*eeprom = ee;
+	return 0;
+}
+
+/** Flushes the cache and frees it, returning the result of the flush; the cache is freed either way. */
+int i2ctu_eeprom_close(struct i2ctu_eeprom *ee)
+{
+	int ret = 0;
+
+	if (ee->tags && ee->dirty && ee->data)
+		ret = i2ctu_eeprom_flush(ee);
+	free(ee->tags);
+	free(ee->dirty);
+	free(ee->data);
+	free(ee);
+	return ret;
+}
@@ -0,0 +1,99 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - poll log format
+ *
+ * i2c-polllog writes the samples of a polling job to a file laid out for
+ * reading in place: a header block, then chunks of a fixed size, each
+ * starting with an index block. Within a chunk every poll entry has three
+ * columns of its own, the sample times (64 bit nanoseconds since the first
+ * sample, from the adapter's frame stamps), the status bytes and the sample
+ * data, so an analysis tool can mmap the file and hand a column straight to
+ * whatever crunches it. Chunks are only appended; the last one is rewritten
+ * in place while it fills, its index after its data. All fields are little
+ * endian, blocks and columns are 8-byte aligned.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _I2CTU_POLLLOG_H_
+#define _I2CTU_POLLLOG_H_
+
+#include <stdint.h>
+
+#define I2CTU_PLOG_MAGIC        0x4C503249  // "I2PL"
+#define I2CTU_PLOG_CHUNK_MAGIC  0x43503249  // "I2PC"
+#define I2CTU_PLOG_VERSION      1
+#define I2CTU_PLOG_ENTRIES      8           // Most poll entries, as in the firmware
+#define I2CTU_PLOG_HEADER_SIZE  4096        // The first chunk starts here, page aligned
+
+// Header flags
+#define I2CTU_PLOG_SYNC         (1 << 0)    // Entry periods count SYNC edges instead of milliseconds
+
+// Chunk flags
+#define I2CTU_PLOG_COMPLETE     (1 << 0)    // The chunk is full and won't change any more
+
+struct i2ctu_plog_entry {
+	uint8_t addr;           // As sent with BULK_OP_POLL
+	uint8_t reg;
+	uint8_t len;
+	uint8_t sample_size;    // Data bytes per sample
+	uint16_t period;
+	uint16_t reserved;
+};
+
+struct i2ctu_plog_header {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t entries;
+	uint8_t flags;
+	uint32_t chunk_size;    // Bytes per chunk, a multiple of 4096
+	uint32_t tick_khz;      // Timer1 tick rate the frame stamps were taken with
+	uint32_t extensions;    // Of the adapter recorded on
+	uint32_t extensions2;
+	int64_t start_ns;       // Host CLOCK_REALTIME when the first sample came in
+	struct i2ctu_plog_entry entry[I2CTU_PLOG_ENTRIES];
+};
+
+struct i2ctu_plog_column {
+	uint32_t time_offset;   // From the start of the chunk: int64 ns after the first sample of the log
+	uint32_t status_offset; // uint8 status bytes as for START
+	uint32_t data_offset;   // sample_size bytes per sample
+	uint32_t capacity;      // Samples the columns have room for
+	uint32_t count;         // Samples in the chunk
+	uint32_t reserved;
+};
+
+// Index block at the start of each chunk
+struct i2ctu_plog_chunk {
+	uint32_t magic;
+	uint32_t seq;           // Chunk number, from 0
+	uint32_t flags;
+	uint32_t reserved;
+	int64_t first_ns;       // Earliest and latest sample time in the chunk, to find a moment without a scan
+	int64_t last_ns;
+	struct i2ctu_plog_column column[I2CTU_PLOG_ENTRIES];
+};
+
+#endif
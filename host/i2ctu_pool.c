@@ -0,0 +1,270 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - adapter pool for the host library
+ *
+ * Spreads independent jobs over several adapters wired to equivalent buses,
+ * such as identical DUT slots of a fixture. Each adapter gets a thread and a
+ * deque of jobs; new jobs are dealt out round robin, a thread takes its
+ * newest job first and, once its own deque is empty, steals the oldest job
+ * of another adapter. So an adapter that is slow or busy with a long job
+ * doesn't hold up the ones queued behind it, and a sweep finishes close to
+ * the total work divided by the adapter count.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2ctu.h"
+
+#define DEQUE_INITIAL  64
+
+struct pool_job {
+	i2ctu_job fn;
+	void *arg;
+};
+
+// One adapter and its jobs: a ring of jobs from bottom (oldest, stolen first) to top (newest, taken first)
+struct pool_slot {
+	struct i2ctu_pool *pool;
+	struct i2ctu_dev *dev;
+	int index;
+	pthread_t thread;
+
+	pthread_mutex_t lock;
+	struct pool_job *jobs;
+	unsigned size, bottom, count;
+
+	uint64_t done, stolen;
+};
+
+struct i2ctu_pool {
+	int count;
+	unsigned next;           // Slot the next job is dealt to
+	int stop;
+
+	// Sleeping and waking: queued jobs and jobs not finished yet, changed under lock
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	unsigned queued;
+	unsigned outstanding;
+
+	struct pool_slot slots[];
+};
+
+static int deque_push(struct pool_slot *s, struct pool_job job)
+{
+	pthread_mutex_lock(&s->lock);
+	if (s->count == s->size) {
+		unsigned size = s->size ? s->size * 2 : DEQUE_INITIAL;
+		struct pool_job *jobs = malloc(size * sizeof(*jobs));
+
+		if (!jobs) {
+			pthread_mutex_unlock(&s->lock);
+			return LIBUSB_ERROR_NO_MEM;
+		}
+		for (unsigned i = 0; i < s->count; i++)
+			jobs[i] = s->jobs[(s->bottom + i) % s->size];
+		free(s->jobs);
+		s->jobs = jobs;
+		s->size = size;
+		s->bottom = 0;
+	}
+	s->jobs[(s->bottom + s->count++) % s->size] = job;
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+// Takes the newest job for the slot's own thread, or the oldest one for a thief
+static int deque_pop(struct pool_slot *s, int steal, struct pool_job *job)
+{
+	int found = 0;
+
+	pthread_mutex_lock(&s->lock);
+	if (s->count) {
+		if (steal) {
+			*job = s->jobs[s->bottom];
+			s->bottom = (s->bottom + 1) % s->size;
+		} else {
+			*job = s->jobs[(s->bottom + s->count - 1) % s->size];
+		}
+		s->count--;
+		found = 1;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return found;
+}
+
+static int take(struct pool_slot *s, struct pool_job *job)
+{
+	struct i2ctu_pool *pool = s->pool;
+
+	if (deque_pop(s, 0, job))
+		return 1;
+	for (int i = 1; i < pool->count; i++) {
+		if (deque_pop(&pool->slots[(s->index + i) % pool->count], 1, job)) {
+			s->stolen++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void *slot_thread(void *arg)
+{
+	struct pool_slot *s = arg;
+	struct i2ctu_pool *pool = s->pool;
+	struct pool_job job;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->stop && !pool->queued)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->stop && !pool->queued)
+			break;
+		pthread_mutex_unlock(&pool->lock);
+
+		// Another thread may have got there first, then it's back to sleep
+		int found = take(s, &job);
+		if (found) {
+			pthread_mutex_lock(&pool->lock);
+			pool->queued--;
+			pthread_mutex_unlock(&pool->lock);
+
+			job.fn(s->dev, s->index, job.arg);
+			s->done++;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		if (found && !--pool->outstanding)
+			pthread_cond_broadcast(&pool->idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/** Creates a pool of \c count adapters, each with a thread of its own. The adapters belong to the pool until
+ *  i2ctu_pool_destroy(); a job gets the adapter it runs on and its index in \c devs.
+ */
+int i2ctu_pool_create(struct i2ctu_dev **devs, int count, struct i2ctu_pool **poolp)
+{
+	struct i2ctu_pool *pool;
+	int started = 0;
+
+	if (count < 1)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (!(pool = calloc(1, sizeof(*pool) + count * sizeof(pool->slots[0]))))
+		return LIBUSB_ERROR_NO_MEM;
+
+	pool->count = count;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->idle, NULL);
+
+	for (int i = 0; i < count; i++) {
+		struct pool_slot *s = &pool->slots[i];
+
+		s->pool = pool;
+		s->dev = devs[i];
+		s->index = i;
+		pthread_mutex_init(&s->lock, NULL);
+		if (pthread_create(&s->thread, NULL, slot_thread, s))
+			break;
+		started++;
+	}
+
+	if (started < count) {
+		pool->count = started;
+		i2ctu_pool_destroy(pool);
+		return LIBUSB_ERROR_OTHER;
+	}
+	*poolp = pool;
+	return 0;
+}
+
+/** Finishes the jobs still queued, stops the threads and hands the adapters back. */
+void i2ctu_pool_destroy(struct i2ctu_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->count; i++) {
+		pthread_join(pool->slots[i].thread, NULL);
+		pthread_mutex_destroy(&pool->slots[i].lock);
+		free(pool->slots[i].jobs);
+	}
+	pthread_cond_destroy(&pool->idle);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/** Queues a job, from any thread. It runs on whichever adapter gets to it first, with the library used
+ *  synchronously there: e.g. submit requests and i2ctu_wait_all(). Jobs may submit more jobs.
+ */
+int i2ctu_pool_submit(struct i2ctu_pool *pool, i2ctu_job fn, void *arg)
+{
+	struct pool_job job = { fn, arg };
+	unsigned slot = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->count;
+	int ret;
+
+	// Counted before the push, so a thread taking the job right away never counts it down first
+	pthread_mutex_lock(&pool->lock);
+	pool->outstanding++;
+	pool->queued++;
+	pthread_mutex_unlock(&pool->lock);
+
+	ret = deque_push(&pool->slots[slot], job);
+
+	pthread_mutex_lock(&pool->lock);
+	if (ret) {
+		pool->queued--;
+		if (!--pool->outstanding)
+			pthread_cond_broadcast(&pool->idle);
+	} else {
+		pthread_cond_signal(&pool->work);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+/** Waits until every job submitted so far has run. Don't call this from a job. */
+void i2ctu_pool_wait(struct i2ctu_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	while (pool->outstanding)
+		pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/** Jobs run on adapter \c index so far and how many of them it stole from the others; read once the pool is idle. */
+void i2ctu_pool_stats(struct i2ctu_pool *pool, int index, uint64_t *done, uint64_t *stolen)
+{
+	*done = pool->slots[index].done;
+	*stolen = pool->slots[index].stolen;
+}
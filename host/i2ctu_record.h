@@ -0,0 +1,68 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - traffic record format
+ *
+ * The host library can record every request it submits to an adapter, with
+ * when it was submitted and how and when it completed, so the traffic of a
+ * test station can be replayed elsewhere with i2c-replay. A record file is
+ * a header followed by entries; control requests are kept as their
+ * message, bulk and batch requests as the command stream they turned into,
+ * which replays them exactly whatever call made them. All fields are little
+ * endian, entries are packed without padding.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _I2CTU_RECORD_H_
+#define _I2CTU_RECORD_H_
+
+#include <stdint.h>
+
+#define I2CTU_RECORD_MAGIC    0x52543249  // "I2TR"
+#define I2CTU_RECORD_VERSION  1
+#define I2CTU_RECORD_ENV      "I2CTU_RECORD"  // Record every adapter opened to this path, %d for its index
+
+// Entry types
+#define I2CTU_REC_MSG         1  // i2ctu_submit_msg(); the data written follows
+#define I2CTU_REC_BULK        2  // Bulk command stream; the command follows
+#define I2CTU_REC_DONE        3  // Completion; the 32-bit number of the request follows, counting from 0
+
+struct i2ctu_rec_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t extensions;  // Of the adapter recorded on
+	uint32_t extensions2;
+} __attribute__((packed));
+
+struct i2ctu_rec_entry {
+	uint8_t type;
+	uint8_t flags;        // I2CTU_REC_MSG: the rd argument in bit 0, I2CTU_START and I2CTU_STOP shifted left by one
+	uint16_t addr;        // I2CTU_REC_MSG: target address
+	uint32_t delta_us;    // Since the entry before, or since recording started
+	uint32_t len;         // Bytes following the entry
+	uint32_t value;       // I2CTU_REC_MSG: message length; I2CTU_REC_BULK: response bytes; I2CTU_REC_DONE: result
+} __attribute__((packed));
+
+#endif
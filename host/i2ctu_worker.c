@@ -0,0 +1,342 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - worker thread for the host library
+ *
+ * A worker thread owns one adapter and does all the library calls for it.
+ * Other threads post requests to it through a lock-free queue of many
+ * producers and the worker as the only consumer (Vyukov's intrusive MPSC
+ * queue): posting is an allocation, an atomic exchange and a store, with no
+ * lock to fight over. The worker takes everything queued at once and submits
+ * it before it flushes, so bulk and batch requests of all the threads end up
+ * packed into the same OUT transfers. A worker asleep in libusb is woken with
+ * libusb_interrupt_event_handler(), which needs libusb 1.0.21 or later.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2ctu.h"
+
+// How long the worker sleeps in libusb at most, in case a wakeup slips past it
+#define IDLE_MS  100
+
+enum { JOB_STUB, JOB_MSG, JOB_BULK, JOB_BATCH, JOB_CALL };
+
+struct job {
+	struct job *next;
+	int type;
+	i2ctu_cb cb;
+	void *user;
+
+	// JOB_MSG
+	uint8_t addr, rd, flags;
+	uint8_t *buf;
+	uint16_t len;
+
+	// JOB_BULK, the command is copied into cmd
+	uint8_t *resp;
+	int resp_len;
+	int cmd_len;
+
+	// JOB_BATCH
+	struct i2ctu_msg *msgs;
+	int count;
+
+	// JOB_CALL
+	i2ctu_call fn;
+	void *arg;
+
+	uint8_t cmd[];
+};
+
+struct i2ctu_worker {
+	struct i2ctu_dev *dev;
+	pthread_t thread;
+	int stop;               // Set by i2ctu_worker_stop()
+	int sleeping;           // Set while the worker may be waiting in libusb
+
+	// Producers push at head, the worker pops at tail; stub keeps the queue from ever running empty
+	struct job *head;
+	struct job *tail;
+	struct job stub;
+};
+
+/*
+ * Queue
+ */
+
+static void push(struct i2ctu_worker *w, struct job *job)
+{
+	__atomic_store_n(&job->next, NULL, __ATOMIC_RELAXED);
+	struct job *prev = __atomic_exchange_n(&w->head, job, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, job, __ATOMIC_RELEASE);
+}
+
+// Takes the oldest job, NULL if there is none or a producer is halfway through pushing the next one
+static struct job *pop(struct i2ctu_worker *w)
+{
+	struct job *tail = w->tail;
+	struct job *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == &w->stub) {
+		if (!next)
+			return NULL;
+		w->tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		w->tail = next;
+		return tail;
+	}
+
+	// tail is the last job; put the stub behind it so it can be taken
+	if (tail != __atomic_load_n(&w->head, __ATOMIC_ACQUIRE))
+		return NULL;
+	push(w, &w->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (next) {
+		w->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+static int queued(struct i2ctu_worker *w)
+{
+	return w->tail != &w->stub || __atomic_load_n(&w->stub.next, __ATOMIC_ACQUIRE);
+}
+
+static int post(struct i2ctu_worker *w, struct job *job)
+{
+	push(w, job);
+
+	// Pairs with the worker setting sleeping before it looks at the queue a last time
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED))
+		libusb_interrupt_event_handler(i2ctu_context(w->dev));
+	return 0;
+}
+
+/*
+ * Worker
+ */
+
+static void run(struct i2ctu_worker *w, struct job *job)
+{
+	int ret = 0;
+
+	switch (job->type) {
+	case JOB_MSG:
+		ret = i2ctu_submit_msg(w->dev, job->addr, job->rd, job->flags, job->buf, job->len, job->cb, job->user);
+		break;
+	case JOB_BULK:
+		ret = i2ctu_submit_bulk(w->dev, job->cmd, job->cmd_len, job->resp, job->resp_len, job->cb, job->user);
+		break;
+	case JOB_BATCH:
+		ret = i2ctu_submit_batch(w->dev, job->msgs, job->count, job->cb, job->user);
+		break;
+	case JOB_CALL:
+		job->fn(w->dev, job->arg);
+		break;
+	}
+
+	// The poster gets its one callback either way
+	if (ret && job->cb)
+		job->cb(w->dev, ret, job->user);
+	free(job);
+}
+
+static void *worker(void *arg)
+{
+	struct i2ctu_worker *w = arg;
+	struct job *job;
+
+	for (;;) {
+		// Everything queued goes in before the flush, so it can share transfers
+		while ((job = pop(w)))
+			run(w, job);
+
+		if (__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE) && !queued(w))
+			break;
+
+		__atomic_store_n(&w->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!queued(w))
+			i2ctu_handle_events(w->dev, IDLE_MS);
+		__atomic_store_n(&w->sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	i2ctu_wait_all(w->dev);
+	return NULL;
+}
+
+/** Starts a worker thread for the adapter. From then on only the worker may use it, until i2ctu_worker_stop(). */
+int i2ctu_worker_start(struct i2ctu_dev *dev, struct i2ctu_worker **workerp)
+{
+	struct i2ctu_worker *w = calloc(1, sizeof(*w));
+
+	if (!w)
+		return LIBUSB_ERROR_NO_MEM;
+	w->dev = dev;
+	w->stub.type = JOB_STUB;
+	w->head = w->tail = &w->stub;
+
+	if (pthread_create(&w->thread, NULL, worker, w)) {
+		free(w);
+		return LIBUSB_ERROR_OTHER;
+	}
+	*workerp = w;
+	return 0;
+}
+
+/** Stops the worker once everything posted so far has completed; the adapter is the caller's again afterwards.
+ *  Don't post anything else meanwhile, and don't call this from a callback.
+ */
+void i2ctu_worker_stop(struct i2ctu_worker *w)
+{
+	__atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+	libusb_interrupt_event_handler(i2ctu_context(w->dev));
+	pthread_join(w->thread, NULL);
+	free(w);
+}
+
+/*
+ * Posting, from any thread. Each returns 0 or LIBUSB_ERROR_NO_MEM; on success the callback is called exactly once,
+ * on the worker thread, with the result i2ctu_submit_*() would have given or passed to its callback. Requests
+ * posted by one thread are submitted in the order they were posted.
+ */
+
+static struct job *alloc_job(int type, size_t size, i2ctu_cb cb, void *user)
+{
+	struct job *job = calloc(1, sizeof(*job) + size);
+
+	if (job) {
+		job->type = type;
+		job->cb = cb;
+		job->user = user;
+	}
+	return job;
+}
+
+/** Posts an i2ctu_submit_msg(); buf must stay valid until the callback. */
+int i2ctu_post_msg(struct i2ctu_worker *w, uint8_t addr, uint8_t rd, uint8_t flags, uint8_t *buf, uint16_t len,
+                   i2ctu_cb cb, void *user)
+{
+	struct job *job = alloc_job(JOB_MSG, 0, cb, user);
+
+	if (!job)
+		return LIBUSB_ERROR_NO_MEM;
+	job->addr = addr;
+	job->rd = rd;
+	job->flags = flags;
+	job->buf = buf;
+	job->len = len;
+	return post(w, job);
+}
+
+/** Posts an i2ctu_submit_bulk(). The command is copied right away, resp must stay valid until the callback. */
+int i2ctu_post_bulk(struct i2ctu_worker *w, const uint8_t *cmd, int cmd_len, uint8_t *resp, int resp_len,
+                    i2ctu_cb cb, void *user)
+{
+	struct job *job;
+
+	if (cmd_len < 0)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	if (!(job = alloc_job(JOB_BULK, cmd_len, cb, user)))
+		return LIBUSB_ERROR_NO_MEM;
+	memcpy(job->cmd, cmd, cmd_len);
+	job->cmd_len = cmd_len;
+	job->resp = resp;
+	job->resp_len = resp_len;
+	return post(w, job);
+}
+
+/** Posts an i2ctu_submit_batch(); the segments and their buffers must stay valid until the callback. */
+int i2ctu_post_batch(struct i2ctu_worker *w, struct i2ctu_msg *msgs, int count, i2ctu_cb cb, void *user)
+{
+	struct job *job = alloc_job(JOB_BATCH, 0, cb, user);
+
+	if (!job)
+		return LIBUSB_ERROR_NO_MEM;
+	job->msgs = msgs;
+	job->count = count;
+	return post(w, job);
+}
+
+/** Has the worker call fn, in turn with the requests posted around it: the way to reach every other part of the
+ *  library, e.g. an i2ctu_submit_lock() followed by batches that mustn't be interleaved with other threads' ones.
+ */
+int i2ctu_post_call(struct i2ctu_worker *w, i2ctu_call fn, void *arg)
+{
+	struct job *job = alloc_job(JOB_CALL, 0, NULL, NULL);
+
+	if (!job)
+		return LIBUSB_ERROR_NO_MEM;
+	job->fn = fn;
+	job->arg = arg;
+	return post(w, job);
+}
+
+/*
+ * Futures
+ */
+
+void i2ctu_future_init(struct i2ctu_future *f)
+{
+	pthread_mutex_init(&f->lock, NULL);
+	pthread_cond_init(&f->cond, NULL);
+	f->done = 0;
+	f->result = 0;
+}
+
+/** Callback completing the future passed as user. */
+void i2ctu_future_cb(struct i2ctu_dev *dev, int result, void *user)
+{
+	struct i2ctu_future *f = user;
+
+	(void)dev;
+	pthread_mutex_lock(&f->lock);
+	f->result = result;
+	f->done = 1;
+	pthread_cond_broadcast(&f->cond);
+	pthread_mutex_unlock(&f->lock);
+}
+
+/** Waits for the request and returns its result. */
+int i2ctu_future_wait(struct i2ctu_future *f)
+{
+	pthread_mutex_lock(&f->lock);
+	while (!f->done)
+		pthread_cond_wait(&f->cond, &f->lock);
+	pthread_mutex_unlock(&f->lock);
+	return f->result;
+}
+
+void i2ctu_future_destroy(struct i2ctu_future *f)
+{
+	pthread_cond_destroy(&f->cond);
+	pthread_mutex_destroy(&f->lock);
+}
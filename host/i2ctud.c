@@ -0,0 +1,789 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - adapter sharing daemon
+ *
+ * Only one process at a time can claim an adapter's interface. i2ctud
+ * claims all attached adapters and lets any number of client processes use
+ * them through the i2ctu_client_*() calls of the host library. Each client
+ * gets shared memory rings for its requests and their completions (see
+ * i2ctud.h), so a request costs no socket round trip. The daemon takes the
+ * requests of all clients out of their rings in one go and submits them
+ * before it flushes, so they are packed into the same OUT transfers as if one
+ * process had batched them all.
+ *
+ * With -t, it serves test stations on other hosts over TCP as well. Those
+ * send the same records over the connection instead of a ring, any number
+ * of them without waiting for completions, which go back the same way.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "i2ctu.h"
+#include "i2ctud.h"
+#include "protocol.h"
+
+#define MAX_ADAPTERS  64
+#define MAX_EVENTS    64
+#define TCP_BACKLOG   (1024 * 1024)  // Completions a TCP client hasn't taken yet, beyond which we stop reading
+
+enum { WATCH_LISTEN, WATCH_LISTEN_TCP, WATCH_USB, WATCH_SOCKET, WATCH_BELL };
+
+// What an epoll event is about
+struct watch {
+	int type;
+	struct client *client;
+};
+
+struct client {
+	struct i2ctu_dev *dev;
+	int sock;
+	int req_fd;              // Signalled by the client after queueing requests
+	int done_fd;             // Signalled by us after queueing completions
+	struct i2ctud_shm *shm;
+	struct watch sock_watch, bell_watch;
+	int jobs;                // Requests submitted and not completed yet
+	int hangup;              // Disconnected, to be dropped once the events at hand are through
+	int dead;                // Dropped, freed once the last job is done
+	struct client *next;
+
+	// TCP clients have no shared memory and stream the records instead
+	int tcp;
+	int greeted;             // Hello received, records follow
+	uint32_t events;         // What we're polling the socket for
+	uint8_t *in, *out;       // Records received and not submitted yet, completions not sent yet
+	size_t in_len, out_len, out_size;
+};
+
+// A client's request on its way through the adapter
+struct job {
+	struct client *client;
+	uint32_t tag;
+	int type;
+	int count;
+	uint32_t resp_len;       // Bulk: response bytes; batch: data read
+	struct i2ctu_msg *msgs;
+	uint8_t *resp;
+	uint8_t buf[];           // Segments and data, or the command and response
+};
+
+static struct i2ctu_dev *devs[MAX_ADAPTERS];
+static int count;
+static struct client *clients;
+static int epoll_fd;
+static volatile sig_atomic_t stop;
+static int verbose;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int watch(int fd, uint32_t events, struct watch *w)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = w };
+
+	return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*
+ * Clients
+ */
+
+static void free_client(struct client *c)
+{
+	if (c->tcp) {
+		free(c->in);
+		free(c->out);
+	} else {
+		munmap(c->shm, sizeof(*c->shm));
+		close(c->done_fd);
+		close(c->req_fd);
+	}
+	free(c);
+}
+
+// Drop the connection right away; requests in flight still complete, into the void
+static void drop_client(struct client *c)
+{
+	struct client **p;
+
+	for (p = &clients; *p != c; p = &(*p)->next);
+	*p = c->next;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sock, NULL);
+	if (!c->tcp)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->req_fd, NULL);
+	close(c->sock);
+	if (verbose)
+		fprintf(stderr, "client %p gone, %d requests in flight\n", (void *)c, c->jobs);
+	if (c->jobs)
+		c->dead = 1;
+	else
+		free_client(c);
+}
+
+static int send_welcome(int sock, const struct i2ctud_welcome *welcome, const int *fds, int nfds)
+{
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = { (void *)welcome, sizeof(*welcome) };
+	struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+
+	if (nfds) {
+		struct cmsghdr *cmsg;
+
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+	}
+	return (sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(*welcome)) ? 0 : -1;
+}
+
+// The hello comes right behind the connect, so waiting for it doesn't hold up the others for long
+static void accept_client(int listen_fd)
+{
+	struct i2ctud_welcome welcome = { .magic = I2CTUD_MAGIC, .ring_size = I2CTUD_RING_SIZE };
+	struct timeval tv = { 1, 0 };
+	struct i2ctud_hello hello;
+	struct client *c;
+	int sock, shm_fd = -1, fds[3];
+
+	if ((sock = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+		return;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (recv(sock, &hello, sizeof(hello), MSG_WAITALL) != sizeof(hello) ||
+	    hello.magic != I2CTUD_MAGIC || hello.version != I2CTUD_VERSION) {
+		close(sock);
+		return;
+	}
+
+	if (hello.adapter >= (uint32_t)count) {
+		welcome.result = LIBUSB_ERROR_NOT_FOUND;
+		send_welcome(sock, &welcome, NULL, 0);
+		close(sock);
+		return;
+	}
+
+	if (!(c = calloc(1, sizeof(*c)))) {
+		welcome.result = LIBUSB_ERROR_NO_MEM;
+		send_welcome(sock, &welcome, NULL, 0);
+		close(sock);
+		return;
+	}
+	c->dev = devs[hello.adapter];
+	c->sock = sock;
+	c->req_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	c->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	c->shm = MAP_FAILED;
+	c->sock_watch = (struct watch){ WATCH_SOCKET, c };
+	c->bell_watch = (struct watch){ WATCH_BELL, c };
+	if (c->req_fd < 0 || c->done_fd < 0 || (shm_fd = memfd_create("i2ctud", MFD_CLOEXEC)) < 0 ||
+	    ftruncate(shm_fd, sizeof(*c->shm)) ||
+	    (c->shm = mmap(NULL, sizeof(*c->shm), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0)) == MAP_FAILED)
+		goto err;
+
+	if (watch(c->sock, EPOLLIN | EPOLLRDHUP, &c->sock_watch) || watch(c->req_fd, EPOLLIN, &c->bell_watch))
+		goto err;
+
+	welcome.extensions = i2ctu_extensions(c->dev);
+	welcome.extensions2 = i2ctu_extensions2(c->dev);
+	fds[0] = shm_fd;
+	fds[1] = c->req_fd;
+	fds[2] = c->done_fd;
+	if (send_welcome(sock, &welcome, fds, 3))
+		goto err_quiet;
+	close(shm_fd);
+
+	c->next = clients;
+	clients = c;
+	if (verbose)
+		fprintf(stderr, "client %p on adapter %u\n", (void *)c, hello.adapter);
+	return;
+
+err:
+	welcome.result = LIBUSB_ERROR_NO_MEM;
+	send_welcome(sock, &welcome, NULL, 0);
+err_quiet:
+	if (shm_fd >= 0)
+		close(shm_fd);
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, NULL);
+	if (c->req_fd >= 0) {
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->req_fd, NULL);
+		close(c->req_fd);
+	}
+	if (c->done_fd >= 0)
+		close(c->done_fd);
+	if (c->shm != MAP_FAILED)
+		munmap(c->shm, sizeof(*c->shm));
+	free(c);
+	close(sock);
+}
+
+// Over TCP, the hello is the first thing on the connection and the welcome, without descriptors, the first thing
+// back; nothing waits for it, the connection is polled like any other
+static void accept_tcp(int listen_fd)
+{
+	struct client *c;
+	int sock, one = 1;
+
+	if ((sock = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0)
+		return;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (!(c = calloc(1, sizeof(*c))) || !(c->in = malloc(I2CTUD_RING_SIZE))) {
+		free(c);
+		close(sock);
+		return;
+	}
+	c->tcp = 1;
+	c->sock = sock;
+	c->req_fd = c->done_fd = -1;
+	c->sock_watch = (struct watch){ WATCH_SOCKET, c };
+	c->events = EPOLLIN | EPOLLRDHUP;
+	if (watch(sock, c->events, &c->sock_watch)) {
+		free_client(c);
+		close(sock);
+		return;
+	}
+	c->next = clients;
+	clients = c;
+}
+
+// Handles the hello once it's all there; -1 if the client is to be dropped
+static int greet_tcp(struct client *c)
+{
+	struct i2ctud_welcome welcome = { .magic = I2CTUD_MAGIC };
+	struct i2ctud_hello hello;
+
+	if (c->in_len < sizeof(hello))
+		return 0;
+	memcpy(&hello, c->in, sizeof(hello));
+	if (hello.magic != I2CTUD_MAGIC || hello.version != I2CTUD_VERSION)
+		return -1;
+
+	// The socket buffer is empty yet, so the welcome goes out in one piece
+	if (hello.adapter >= (uint32_t)count) {
+		welcome.result = LIBUSB_ERROR_NOT_FOUND;
+		send(c->sock, &welcome, sizeof(welcome), MSG_NOSIGNAL);
+		return -1;
+	}
+	c->dev = devs[hello.adapter];
+	welcome.extensions = i2ctu_extensions(c->dev);
+	welcome.extensions2 = i2ctu_extensions2(c->dev);
+	if (send(c->sock, &welcome, sizeof(welcome), MSG_NOSIGNAL) != sizeof(welcome))
+		return -1;
+
+	// Records are 8-byte aligned from the start of the buffer on
+	c->in_len -= sizeof(hello);
+	memmove(c->in, c->in + sizeof(hello), c->in_len);
+	c->greeted = 1;
+	if (verbose)
+		fprintf(stderr, "client %p on adapter %u over TCP\n", (void *)c, hello.adapter);
+	return 0;
+}
+
+/*
+ * Requests
+ */
+
+// Room for a completion in a TCP client's send buffer
+static uint8_t *tcp_reserve(struct client *c, uint32_t len, uint32_t tag)
+{
+	const size_t need = i2ctud_record_size(len);
+	struct i2ctud_record *rec;
+
+	if (c->out_len + need > c->out_size) {
+		size_t size = c->out_size ? c->out_size : I2CTUD_RING_SIZE;
+		uint8_t *out;
+
+		while (size < c->out_len + need)
+			size *= 2;
+		if (!(out = realloc(c->out, size)))
+			return NULL;
+		c->out = out;
+		c->out_size = size;
+	}
+	rec = (struct i2ctud_record *)(c->out + c->out_len);
+	memset(rec, 0, need);
+	rec->len = len;
+	rec->tag = tag;
+	c->out_len += need;
+	return (uint8_t *)(rec + 1);
+}
+
+// Hand the result to the client; it reserved room for the completion when it queued the request. A USB error
+// leaves nothing worth sending but the result. TCP clients get theirs sent once the round of events is through.
+static void job_done(struct i2ctu_dev *dev, int result, void *user)
+{
+	struct job *job = user;
+	struct client *c = job->client;
+	uint32_t len = sizeof(struct i2ctud_completion);
+	uint8_t *p;
+
+	(void)dev;
+	if (result >= 0)
+		len += job->resp_len + ((job->type == I2CTUD_BATCH) ? 2 * job->count : 0);
+	if (!c->dead && c->tcp && (p = tcp_reserve(c, len, job->tag))) {
+		((struct i2ctud_completion *)p)->result = result;
+		p += sizeof(struct i2ctud_completion);
+		if (result >= 0) {
+			for (int i = 0; job->type == I2CTUD_BATCH && i < job->count; i++) {
+				*p++ = job->msgs[i].result;
+				*p++ = job->msgs[i].twsr;
+			}
+			memcpy(p, job->resp, job->resp_len);
+		}
+	} else if (!c->dead && !c->tcp && (p = i2ctud_reserve(&c->shm->done, len, job->tag))) {
+		((struct i2ctud_completion *)p)->result = result;
+		p += sizeof(struct i2ctud_completion);
+		if (result >= 0) {
+			for (int i = 0; job->type == I2CTUD_BATCH && i < job->count; i++) {
+				*p++ = job->msgs[i].result;
+				*p++ = job->msgs[i].twsr;
+			}
+			memcpy(p, job->resp, job->resp_len);
+		}
+		i2ctud_commit(&c->shm->done, len);
+
+		if (i2ctud_must_signal(&c->shm->done)) {
+			const uint64_t one = 1;
+			if (write(c->done_fd, &one, sizeof(one)) < 0 && verbose)
+				perror("write");
+		}
+	}
+
+	if (!--c->jobs && c->dead)
+		free_client(c);
+	free(job);
+}
+
+// Turn a request record into a submitted job; the record is only valid until it is consumed
+static void submit(struct client *c, const struct i2ctud_record *rec)
+{
+	const struct i2ctud_request *req = (const void *)(rec + 1);
+	const uint8_t *p = (const uint8_t *)(req + 1);
+	const uint8_t *end = (const uint8_t *)(rec + 1) + rec->len;
+	struct job *job = NULL;
+	int ret = LIBUSB_ERROR_INVALID_PARAM;
+
+	if (rec->len < sizeof(*req))
+		goto fail;
+
+	if (req->type == I2CTUD_BULK) {
+		const int cmd_len = end - p;
+
+		if (req->resp_len > I2CTUD_RING_SIZE / 4)
+			goto fail;
+		if (!(job = calloc(1, sizeof(*job) + cmd_len + req->resp_len))) {
+			ret = LIBUSB_ERROR_NO_MEM;
+			goto fail;
+		}
+		job->type = I2CTUD_BULK;
+		job->resp_len = req->resp_len;
+		job->resp = job->buf + cmd_len;
+		memcpy(job->buf, p, cmd_len);
+		job->client = c;
+		job->tag = rec->tag;
+		if ((ret = i2ctu_submit_bulk(c->dev, job->buf, cmd_len, job->resp, job->resp_len, job_done, job)))
+			goto fail;
+	} else if (req->type == I2CTUD_BATCH) {
+		const struct i2ctud_segment *seg = (const void *)p;
+		const uint8_t *data = p + req->count * sizeof(*seg);
+		uint32_t read_len = 0, write_len = 0;
+		uint8_t *wr, *rd;
+
+		if (!req->count || data > end)
+			goto fail;
+		for (int i = 0; i < req->count; i++) {
+			if (seg[i].flags & I2C_M_RD)
+				read_len += seg[i].len;
+			else
+				write_len += seg[i].len;
+		}
+		if (data + write_len != end || read_len > I2CTUD_RING_SIZE / 4)
+			goto fail;
+
+		if (!(job = calloc(1, sizeof(*job) + req->count * sizeof(*job->msgs) + write_len + read_len))) {
+			ret = LIBUSB_ERROR_NO_MEM;
+			goto fail;
+		}
+		job->type = I2CTUD_BATCH;
+		job->count = req->count;
+		job->msgs = (struct i2ctu_msg *)job->buf;
+		wr = (uint8_t *)(job->msgs + req->count);
+		rd = job->resp = wr + write_len;
+		job->resp_len = read_len;
+		memcpy(wr, data, write_len);
+		for (int i = 0; i < req->count; i++) {
+			struct i2ctu_msg *msg = &job->msgs[i];
+
+			msg->addr = seg[i].addr;
+			msg->flags = seg[i].flags;
+			msg->len = seg[i].len;
+			if (msg->flags & I2C_M_RD) {
+				msg->buf = rd;
+				rd += msg->len;
+			} else {
+				msg->buf = wr;
+				wr += msg->len;
+			}
+		}
+		job->client = c;
+		job->tag = rec->tag;
+		if ((ret = i2ctu_submit_batch(c->dev, job->msgs, job->count, job_done, job)))
+			goto fail;
+	} else {
+		goto fail;
+	}
+
+	c->jobs++;
+	return;
+
+fail:
+	// Completed right away, just the result
+	if (!job && !(job = calloc(1, sizeof(*job))))
+		return;
+	job->client = c;
+	job->tag = rec->tag;
+	c->jobs++;
+	job_done(c->dev, ret, job);
+}
+
+/*
+ * Serving
+ */
+
+static void drain(struct client *c)
+{
+	const struct i2ctud_record *rec;
+
+	while ((rec = i2ctud_peek(&c->shm->req))) {
+		submit(c, rec);
+		i2ctud_consume(&c->shm->req, rec);
+	}
+}
+
+// Takes in what a TCP client sent and submits the complete records in it
+static void read_tcp(struct client *c)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	n = recv(c->sock, c->in + c->in_len, I2CTUD_RING_SIZE - c->in_len, 0);
+	if (n <= 0) {
+		if (!n || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+			c->hangup = 1;
+		return;
+	}
+	c->in_len += n;
+
+	if (!c->greeted) {
+		if (greet_tcp(c))
+			c->hangup = 1;
+		if (!c->greeted)
+			return;
+	}
+
+	while (c->in_len - off >= sizeof(struct i2ctud_record)) {
+		const struct i2ctud_record *rec = (const void *)(c->in + off);
+
+		// Same limit as for the rings, so the buffer always has room for a whole record
+		if (i2ctud_record_size(rec->len) > I2CTUD_RING_SIZE / 2 || rec->len == I2CTUD_WRAP) {
+			c->hangup = 1;
+			return;
+		}
+		if (c->in_len - off < i2ctud_record_size(rec->len))
+			break;
+		submit(c, rec);
+		off += i2ctud_record_size(rec->len);
+	}
+	c->in_len -= off;
+	memmove(c->in, c->in + off, c->in_len);
+}
+
+// Sends what the socket takes of a TCP client's completions; a client not taking them gets no more requests read
+// until it does
+static void write_tcp(struct client *c)
+{
+	struct epoll_event ev = { .data.ptr = &c->sock_watch };
+	uint32_t events = EPOLLRDHUP;
+
+	if (c->out_len) {
+		ssize_t n = send(c->sock, c->out, c->out_len, MSG_NOSIGNAL);
+
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			c->hangup = 1;
+			return;
+		}
+		if (n > 0) {
+			c->out_len -= n;
+			memmove(c->out, c->out + n, c->out_len);
+		}
+	}
+
+	if (c->out_len < TCP_BACKLOG)
+		events |= EPOLLIN;
+	if (c->out_len)
+		events |= EPOLLOUT;
+	if (events != c->events) {
+		ev.events = c->events = events;
+		epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->sock, &ev);
+	}
+}
+
+static int listen_tcp(const char *spec)
+{
+	struct addrinfo hints = { .ai_family = AF_INET6, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE }, *res;
+	const char *port = strrchr(spec, ':');
+	char host[256];
+	int fd, one = 1, zero = 0, ret;
+
+	// [ADDR:]PORT, the wildcard address on both IPv6 and IPv4 by default
+	if (port) {
+		size_t len = port - spec;
+
+		if (len >= sizeof(host))
+			return -1;
+		if (len >= 2 && spec[0] == '[' && spec[len - 1] == ']') {
+			spec++;
+			len -= 2;
+		}
+		memcpy(host, spec, len);
+		host[len] = 0;
+		hints.ai_family = AF_UNSPEC;
+		port++;
+	} else {
+		port = spec;
+	}
+	if ((ret = getaddrinfo(port == spec ? NULL : host, port, &hints, &res))) {
+		fprintf(stderr, "%s: %s\n", spec, gai_strerror(ret));
+		return -1;
+	}
+
+	if ((fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0) {
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (res->ai_family == AF_INET6)
+			setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+		if (bind(fd, res->ai_addr, res->ai_addrlen) || listen(fd, 16)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	if (fd < 0)
+		perror(spec);
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int serve(int listen_fd, int tcp_fd, struct i2ctu_dev *loop_dev)
+{
+	struct watch listen_watch = { WATCH_LISTEN, NULL }, usb_watch = { WATCH_USB, NULL };
+	struct watch tcp_watch = { WATCH_LISTEN_TCP, NULL };
+	struct epoll_event events[MAX_EVENTS];
+	int usb_fd;
+
+	// One descriptor covers the whole libusb context, so every adapter is served through the first one
+	if ((usb_fd = i2ctu_get_fd(loop_dev)) < 0) {
+		fprintf(stderr, "i2ctu_get_fd: %s\n", libusb_error_name(usb_fd));
+		return 1;
+	}
+	if (watch(listen_fd, EPOLLIN, &listen_watch) || watch(usb_fd, EPOLLIN, &usb_watch) ||
+	    (tcp_fd >= 0 && watch(tcp_fd, EPOLLIN, &tcp_watch))) {
+		perror("epoll_ctl");
+		return 1;
+	}
+
+	while (!stop) {
+		int timeout = i2ctu_get_timeout(loop_dev), n;
+
+		// Clients only ring while we may be asleep; whatever they queued meanwhile is picked up right away
+		for (struct client *c = clients; c; c = c->next)
+			if (!c->tcp)
+				__atomic_store_n(&c->shm->req.waiting, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		for (struct client *c = clients; c; c = c->next)
+			if (!c->tcp && i2ctud_peek(&c->shm->req))
+				timeout = 0;
+
+		n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+		for (struct client *c = clients; c; c = c->next)
+			if (!c->tcp)
+				__atomic_store_n(&c->shm->req.waiting, 0, __ATOMIC_RELAXED);
+
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			return 1;
+		}
+		for (int i = 0; i < n; i++) {
+			struct watch *w = events[i].data.ptr;
+			uint64_t bells;
+
+			switch (w->type) {
+			case WATCH_LISTEN:
+				accept_client(listen_fd);
+				break;
+			case WATCH_LISTEN_TCP:
+				accept_tcp(tcp_fd);
+				break;
+			case WATCH_SOCKET:
+				// Local clients never send anything after the hello, so this is the hangup
+				if (!w->client->tcp)
+					w->client->hangup = 1;
+				else if (events[i].events & ~EPOLLOUT)
+					read_tcp(w->client);
+				break;
+			case WATCH_BELL:
+				if (read(w->client->req_fd, &bells, sizeof(bells)) < 0)
+					bells = 0;
+				break;
+			}
+		}
+
+		for (struct client *c = clients, *next; c; c = next) {
+			next = c->next;
+			if (c->hangup)
+				drop_client(c);
+		}
+
+		// Everybody's requests go in before the flush, so they share transfers
+		for (struct client *c = clients; c; c = c->next)
+			if (!c->tcp)
+				drain(c);
+		for (int i = 0; i < count; i++)
+			if (devs[i] != loop_dev)
+				i2ctu_flush(devs[i]);
+		i2ctu_dispatch(loop_dev);
+
+		// The completions of a round go out to each TCP client together
+		for (struct client *c = clients; c; c = c->next)
+			if (c->tcp && !c->hangup)
+				write_tcp(c);
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "Usage: %s [options]\n"
+	        "  -s PATH   socket to serve clients on (default " I2CTUD_SOCKET ")\n"
+	        "  -t [ADDR:]PORT  also serve clients on other hosts over TCP; there is no authentication,\n"
+	        "            so only do this on a network of test stations you trust\n"
+	        "  -v        log clients coming and going\n"
+	        "Claims all attached adapters and shares them between the processes connecting to it.\n",
+	        prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = I2CTUD_SOCKET, *tcp = NULL;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct sigaction sa = { .sa_handler = on_signal };
+	int listen_fd, tcp_fd = -1, opt, ret;
+
+	while ((opt = getopt(argc, argv, "s:t:vh")) != -1) {
+		switch (opt) {
+			case 's': path = optarg; break;
+			case 't': tcp = optarg; break;
+			case 'v': verbose = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (optind != argc || strlen(path) >= sizeof(addr.sun_path)) {
+		usage(argv[0]);
+		return 1;
+	}
+	strcpy(addr.sun_path, path);
+
+	if ((ret = libusb_init(NULL))) {
+		fprintf(stderr, "libusb_init: %s\n", libusb_error_name(ret));
+		return 1;
+	}
+	if ((count = i2ctu_open_all(NULL, devs, MAX_ADAPTERS)) <= 0) {
+		fprintf(stderr, "No adapter found\n");
+		libusb_exit(NULL);
+		return 1;
+	}
+	printf("Serving %d adapter%s on %s\n", count, (count == 1) ? "" : "s", path);
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	ret = 1;
+	if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		perror("epoll_create1");
+		goto out;
+	}
+	unlink(path);
+	if ((listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0 ||
+	    bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_fd, 16)) {
+		perror(path);
+		goto out;
+	}
+	if (tcp) {
+		if ((tcp_fd = listen_tcp(tcp)) < 0)
+			goto out_unlink;
+		printf("Serving TCP clients on %s\n", tcp);
+	}
+
+	ret = serve(listen_fd, tcp_fd, devs[0]);
+
+	if (tcp_fd >= 0)
+		close(tcp_fd);
+out_unlink:
+	close(listen_fd);
+	unlink(path);
+out:
+	while (clients)
+		drop_client(clients);
+	for (int i = 0; i < count; i++)
+		i2ctu_close(devs[i]);
+	libusb_exit(NULL);
+	return ret;
+}
@@ -0,0 +1,173 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - shared memory interface of i2ctud
+ *
+ * i2ctud owns the adapters and serves client processes. A client connects
+ * to the daemon's Unix socket once and gets a shared memory region with two
+ * rings, one for its requests and one for their completions, and an eventfd
+ * for each direction. Requests and completions never touch the socket: each
+ * side appends records to its ring and only signals the other side's eventfd
+ * if that is asleep. Each ring has a single producer and a single consumer,
+ * so it needs no lock either.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _I2CTUD_H_
+#define _I2CTUD_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define I2CTUD_SOCKET     "/tmp/i2ctud.sock"
+#define I2CTUD_MAGIC      0x44543249  // "I2TD"
+#define I2CTUD_VERSION    1
+#define I2CTUD_RING_SIZE  (64 * 1024) // Power of two
+#define I2CTUD_WRAP       0xffffffff  // Record length: the rest of the ring is unused, go on at its start
+
+// Request types
+#define I2CTUD_BULK       1           // Raw bulk command stream, see i2ctu_submit_bulk()
+#define I2CTUD_BATCH      2           // Batch of segments, see i2ctu_submit_batch()
+
+// Sent by the client right after connecting
+struct i2ctud_hello {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t adapter;     // Index in bus and port order
+};
+
+// The daemon's answer, with the shared memory, the request eventfd and the completion eventfd attached on success
+struct i2ctud_welcome {
+	uint32_t magic;
+	int32_t result;       // 0 or a libusb error
+	uint32_t ring_size;
+	uint32_t extensions;
+	uint32_t extensions2;
+};
+
+// Head and tail count bytes for ever, the ring position is their remainder
+struct i2ctud_ring {
+	uint32_t head __attribute__((aligned(64)));     // Written by the producer only
+	uint32_t tail __attribute__((aligned(64)));     // Written by the consumer only
+	uint32_t waiting __attribute__((aligned(64)));  // Consumer may be asleep: signal its eventfd after producing
+	uint8_t data[I2CTUD_RING_SIZE] __attribute__((aligned(64)));
+};
+
+struct i2ctud_shm {
+	struct i2ctud_ring req;   // Client to daemon
+	struct i2ctud_ring done;  // Daemon to client
+};
+
+// Records are 8-byte aligned; tag is the client's, handed back with the completion
+struct i2ctud_record {
+	uint32_t len;         // Payload bytes after this header
+	uint32_t tag;
+};
+
+struct i2ctud_request {
+	uint8_t type;
+	uint8_t reserved;
+	uint16_t count;       // I2CTUD_BATCH: segments following as struct i2ctud_segment, then the data to write
+	uint32_t resp_len;    // I2CTUD_BULK: response bytes; the command follows
+};
+
+struct i2ctud_segment {
+	uint16_t addr;
+	uint16_t flags;
+	uint16_t len;
+};
+
+// Completion payload: the result, then the response for I2CTUD_BULK, or a result and TWSR code per segment and
+// the data read for I2CTUD_BATCH
+struct i2ctud_completion {
+	int32_t result;
+};
+
+// Ring space a record of len payload bytes takes
+static inline uint32_t i2ctud_record_size(uint32_t len)
+{
+	return sizeof(struct i2ctud_record) + ((len + 7) & ~7);
+}
+
+// Room for a record; NULL if the ring is too full. Only the producer may call this.
+static inline uint8_t *i2ctud_reserve(struct i2ctud_ring *r, uint32_t len, uint32_t tag)
+{
+	const uint32_t need = i2ctud_record_size(len);
+	uint32_t head = r->head, pos = head % I2CTUD_RING_SIZE, gap = 0;
+	struct i2ctud_record *rec;
+
+	// Records don't wrap around, the end of the ring is skipped instead
+	if (I2CTUD_RING_SIZE - pos < need)
+		gap = I2CTUD_RING_SIZE - pos;
+	if (need > I2CTUD_RING_SIZE / 2 || head + gap + need - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) > I2CTUD_RING_SIZE)
+		return NULL;
+
+	if (gap) {
+		((struct i2ctud_record *)&r->data[pos])->len = I2CTUD_WRAP;
+		__atomic_store_n(&r->head, head += gap, __ATOMIC_RELEASE);
+		pos = 0;
+	}
+	rec = (struct i2ctud_record *)&r->data[pos];
+	rec->len = len;
+	rec->tag = tag;
+	return (uint8_t *)(rec + 1);
+}
+
+// Hands the reserved record to the consumer
+static inline void i2ctud_commit(struct i2ctud_ring *r, uint32_t len)
+{
+	__atomic_store_n(&r->head, r->head + i2ctud_record_size(len), __ATOMIC_RELEASE);
+}
+
+// The oldest record, NULL if there is none. Only the consumer may call this.
+static inline struct i2ctud_record *i2ctud_peek(struct i2ctud_ring *r)
+{
+	for (;;) {
+		uint32_t tail = r->tail, pos = tail % I2CTUD_RING_SIZE;
+		struct i2ctud_record *rec;
+
+		if (tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE))
+			return NULL;
+		rec = (struct i2ctud_record *)&r->data[pos];
+		if (rec->len != I2CTUD_WRAP)
+			return rec;
+		__atomic_store_n(&r->tail, tail + I2CTUD_RING_SIZE - pos, __ATOMIC_RELEASE);
+	}
+}
+
+// Frees the oldest record's space for the producer
+static inline void i2ctud_consume(struct i2ctud_ring *r, const struct i2ctud_record *rec)
+{
+	__atomic_store_n(&r->tail, r->tail + i2ctud_record_size(rec->len), __ATOMIC_RELEASE);
+}
+
+// Whether the consumer needs its eventfd signalled, after a record was committed
+static inline int i2ctud_must_signal(struct i2ctud_ring *r)
+{
+	// Pairs with the consumer setting waiting before it looks at the ring a last time
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&r->waiting, __ATOMIC_RELAXED);
+}
+
+#endif
@@ -0,0 +1,924 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - Linux I2C adapter driver
+ *
+ * A drop-in replacement for the in-tree i2c-tiny-usb driver. On firmware that
+ * advertises the bulk BATCH command in the extended CMD_GET_FUNC bits, every
+ * i2c_transfer() goes out as one BATCH command on the bulk OUT endpoint and
+ * comes back as one response on the bulk IN endpoint, instead of a control
+ * transfer plus a CMD_GET_STATUS per message. Other firmware, and message
+ * arrays BATCH can't express, take the stock control request path.
+ *
+ * With IIO in the kernel the adapter also shows up as an IIO device whose
+ * buffer is fed by the firmware's polling job: each channel names a target
+ * and register, and enabling the buffer has the firmware sample them all on
+ * its own schedule and stream the records in on the bulk IN endpoint, where
+ * completion handlers push them into the buffer, stamped from the device's
+ * timebase. While the buffer runs, i2c_transfer() takes the control path.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/i2c.h>
+#include <linux/mutex.h>
+#include <linux/usb.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/kfifo_buf.h>
+
+/* Request codes, bulk opcodes and status bytes, keep in sync with ../protocol.h */
+#define CMD_GET_FUNC            1
+#define CMD_SET_DELAY           2
+#define CMD_GET_STATUS          3
+#define CMD_I2C_IO              4
+#define CMD_I2C_IO_BEGIN        1
+#define CMD_I2C_IO_END          2
+#define CMD_GET_STATS           0x14
+
+#define FUNC_INFO_SIZE          10
+#define FUNC_EXT_BULK           BIT(4)
+#define FUNC_EXT_BATCH          BIT(5)
+#define FUNC_EXT_POLL           BIT(6)
+#define FUNC_EXT_ALT_BULK       BIT(27)
+#define FUNC_EXT_HID            BIT(28)
+#define FUNC_EXT_BATCH_DETAIL   BIT(29)
+
+#define BULK_OP_BATCH           0x06
+#define BULK_OP_POLL            0x07
+#define POLL_RECORD_HEADER      5
+#define BATCH_FLAG_RD           BIT(0)
+#define BATCH_FLAG_STOP         BIT(1)
+#define BATCH_FLAG_DETAIL       BIT(2)
+#define BATCH_FLAG_TEN          BIT(4)
+#define BATCH_FLAG_TEN_HIGH(a)  (((a) >> 3) & 0x60)
+#define BATCH_MAX_SEGMENTS      255
+#define BATCH_SEGMENT_HEADER    4
+#define BATCH_DETAIL_SIZE       2
+
+#define BATCH_RESULT_OK               0x00
+#define BATCH_RESULT_BUS_FAULT        0x01
+#define BATCH_RESULT_CAPTURE_TIMEOUT  0x02
+#define BATCH_RESULT_RESPONSE_TIMEOUT 0x03
+#define BATCH_RESULT_ADDRESS_NAK      0x04
+#define BATCH_RESULT_DATA_NAK         0x05
+#define BATCH_RESULT_STRETCH_TIMEOUT  0x10
+#define BATCH_RESULT_BUS_BUSY         0x11
+
+#define TWSR_ARB_LOST           0x38
+
+#define STATUS_IDLE             0
+#define STATUS_ADDRESS_ACK      1
+#define STATUS_ADDRESS_NAK      2
+#define STATUS_BUS_BUSY         3
+#define STATUS_STRETCH_TIMEOUT  6
+
+#define VENDOR_ALT_BULK         1
+
+#define CONTROL_TIMEOUT_MS      2000
+
+/* Polling job entries the firmware takes, each an IIO channel of a 16-bit big endian register */
+#define IIO_CHANNELS            8
+#define IIO_SAMPLE_SIZE         2
+#define IIO_RECORD_SIZE         (POLL_RECORD_HEADER + IIO_SAMPLE_SIZE)
+#define IIO_URBS                4
+
+/* Timer1 of a 16 MHz adapter; CMD_GET_STATS tells the real rate where it is built in */
+#define IIO_DEFAULT_TICK_NS     4000
+
+/* One millisecond per byte on top covers bus speeds down to 10 kHz */
+#define BATCH_TIMEOUT_MS(bytes) (1000 + (bytes))
+
+/* Message flags BATCH has no way to express */
+#define BATCH_UNSUPPORTED_FLAGS (I2C_M_NOSTART | I2C_M_REV_DIR_ADDR | I2C_M_IGNORE_NAK | \
+                                 I2C_M_NO_RD_ACK | I2C_M_RECV_LEN)
+
+static unsigned short delay = 10;
+module_param(delay, ushort, 0);
+MODULE_PARM_DESC(delay, "bit delay in microseconds (default is 10us for 100kHz)");
+
+static bool batch = true;
+module_param(batch, bool, 0644);
+MODULE_PARM_DESC(batch, "use the bulk BATCH command when the firmware has it (default is on)");
+
+static bool iio = true;
+module_param(iio, bool, 0);
+MODULE_PARM_DESC(iio, "register an IIO device streaming the firmware polling job (default is on)");
+
+struct i2c_tiny_usb_avr {
+	struct usb_device *usb_dev;
+	struct usb_interface *interface;
+	struct i2c_adapter adapter;
+	u32 functionality;
+	u32 extensions;
+	unsigned int ep_in;
+	unsigned int ep_out;
+	unsigned int ep_size;
+	bool batch;
+
+	/* Held by BATCH and by the IIO buffer setup, the two users of the bulk endpoints */
+	struct mutex bulk_lock;
+	bool streaming;
+
+	struct iio_dev *indio_dev;
+	u8 iio_address[IIO_CHANNELS];
+	u8 iio_register[IIO_CHANNELS];
+	u16 iio_period_ms;
+	unsigned int iio_tick_ns;
+	struct urb *iio_urbs[IIO_URBS];
+
+	/* Stream state, only touched by the completion handlers while streaming */
+	unsigned int iio_entries;
+	unsigned long iio_round;
+	bool iio_failed;
+	bool iio_synced;
+	u16 iio_anchor_frame;
+	u16 iio_last_frame;
+	s64 iio_frames;
+	s64 iio_anchor_ns;
+	struct {
+		__be16 values[IIO_CHANNELS];
+		s64 timestamp __aligned(8);
+	} iio_scan;
+};
+
+static int usb_read(struct i2c_tiny_usb_avr *dev, int cmd, int value, int index, void *data, int len)
+{
+	void *dmadata = kmalloc(len, GFP_KERNEL);
+	int ret;
+
+	if (!dmadata)
+		return -ENOMEM;
+
+	ret = usb_control_msg(dev->usb_dev, usb_rcvctrlpipe(dev->usb_dev, 0), cmd,
+	                      USB_TYPE_CLASS | USB_RECIP_DEVICE | USB_DIR_IN,
+	                      value, index, dmadata, len, CONTROL_TIMEOUT_MS);
+
+	memcpy(data, dmadata, len);
+	kfree(dmadata);
+	return ret;
+}
+
+static int usb_write(struct i2c_tiny_usb_avr *dev, int cmd, int value, int index, void *data, int len)
+{
+	void *dmadata = kmemdup(data, len, GFP_KERNEL);
+	int ret;
+
+	if (!dmadata)
+		return -ENOMEM;
+
+	ret = usb_control_msg(dev->usb_dev, usb_sndctrlpipe(dev->usb_dev, 0), cmd,
+	                      USB_TYPE_CLASS | USB_RECIP_DEVICE,
+	                      value, index, dmadata, len, CONTROL_TIMEOUT_MS);
+
+	kfree(dmadata);
+	return ret;
+}
+
+static u32 le32_bytes(const u8 *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+static int status_to_errno(u8 status)
+{
+	switch (status) {
+	case STATUS_ADDRESS_ACK:
+		return 0;
+	case STATUS_ADDRESS_NAK:
+		return -ENXIO;
+	case STATUS_BUS_BUSY:
+		return -EAGAIN;
+	case STATUS_STRETCH_TIMEOUT:
+		return -ETIMEDOUT;
+	default:
+		return -EIO;
+	}
+}
+
+/* Error codes as in Documentation/i2c/fault-codes.rst, from a segment's detail record */
+static int detail_to_errno(u8 result, u8 twsr)
+{
+	switch (result) {
+	case BATCH_RESULT_OK:
+		return 0;
+	case BATCH_RESULT_ADDRESS_NAK:
+		return -ENXIO;
+	case BATCH_RESULT_BUS_FAULT:
+		return (twsr == TWSR_ARB_LOST) ? -EAGAIN : -EIO;
+	case BATCH_RESULT_CAPTURE_TIMEOUT:
+		return -EBUSY;
+	case BATCH_RESULT_RESPONSE_TIMEOUT:
+	case BATCH_RESULT_STRETCH_TIMEOUT:
+		return -ETIMEDOUT;
+	case BATCH_RESULT_BUS_BUSY:
+		return -EAGAIN;
+	default:
+		return -EIO;
+	}
+}
+
+/* The stock path: one control transfer per message, each followed by a status read */
+static int xfer_control(struct i2c_tiny_usb_avr *dev, struct i2c_msg *msgs, int num)
+{
+	u8 status;
+	int i, ret;
+
+	for (i = 0; i < num; i++) {
+		struct i2c_msg *pmsg = &msgs[i];
+		int cmd = CMD_I2C_IO;
+
+		if (i == 0)
+			cmd |= CMD_I2C_IO_BEGIN;
+		if (i == num - 1)
+			cmd |= CMD_I2C_IO_END;
+
+		if (pmsg->flags & I2C_M_RD)
+			ret = usb_read(dev, cmd, pmsg->flags, pmsg->addr, pmsg->buf, pmsg->len);
+		else
+			ret = usb_write(dev, cmd, pmsg->flags, pmsg->addr, pmsg->buf, pmsg->len);
+		if (ret != pmsg->len) {
+			dev_err(&dev->adapter.dev, "failure %s data\n", (pmsg->flags & I2C_M_RD) ? "reading" : "writing");
+			return -EIO;
+		}
+
+		if (usb_read(dev, CMD_GET_STATUS, 0, 0, &status, 1) != 1) {
+			dev_err(&dev->adapter.dev, "failure reading status\n");
+			return -EIO;
+		}
+		if (status == STATUS_ADDRESS_NAK)
+			return -ENXIO;
+	}
+
+	return num;
+}
+
+static bool batch_possible(struct i2c_tiny_usb_avr *dev, struct i2c_msg *msgs, int num)
+{
+	int i;
+
+	if (num > BATCH_MAX_SEGMENTS)
+		return false;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & BATCH_UNSUPPORTED_FLAGS)
+			return false;
+		/* Firmware that reports 10-bit addressing also takes it in BATCH */
+		if ((msgs[i].flags & I2C_M_TEN) && !(dev->functionality & I2C_FUNC_10BIT_ADDR))
+			return false;
+	}
+
+	return true;
+}
+
+/* Selecting the bulk setting again flushes both endpoints, so a late or partial response can't end up in the next one */
+static void batch_resync(struct i2c_tiny_usb_avr *dev)
+{
+	if (dev->extensions & FUNC_EXT_ALT_BULK)
+		usb_set_interface(dev->usb_dev, dev->interface->cur_altsetting->desc.bInterfaceNumber, VENDOR_ALT_BULK);
+}
+
+/* The whole message array as one BATCH command; the response is a status byte per segment, each followed by
+ * the data of a read segment and, if the firmware has them, the segment's detail record, which also catches
+ * data NAKs and tells lost arbitration and timeouts apart
+ */
+static int xfer_batch(struct i2c_tiny_usb_avr *dev, struct i2c_msg *msgs, int num)
+{
+	const bool detail = dev->extensions & FUNC_EXT_BATCH_DETAIL;
+	size_t cmd_len = 2, resp_len = 0, done = 0;
+	u8 *cmd, *resp, *p;
+	int i, actual, ret;
+
+	for (i = 0; i < num; i++) {
+		if (msgs[i].flags & I2C_M_RD)
+			resp_len += msgs[i].len;
+		else
+			cmd_len += msgs[i].len;
+	}
+	cmd_len += num * BATCH_SEGMENT_HEADER;
+	resp_len += num * (detail ? 1 + BATCH_DETAIL_SIZE : 1);
+
+	/* Room for a full packet at the end, so stale data shows up as too much data rather than an overflow */
+	cmd = kmalloc(cmd_len + round_up(resp_len, dev->ep_size), GFP_KERNEL);
+	if (!cmd)
+		return -ENOMEM;
+	resp = cmd + cmd_len;
+
+	p = cmd;
+	*p++ = BULK_OP_BATCH;
+	*p++ = num;
+	for (i = 0; i < num; i++) {
+		*p++ = ((msgs[i].flags & I2C_M_RD) ? BATCH_FLAG_RD : 0) | ((msgs[i].flags & I2C_M_STOP) ? BATCH_FLAG_STOP : 0) |
+		       (detail ? BATCH_FLAG_DETAIL : 0) |
+		       ((msgs[i].flags & I2C_M_TEN) ? BATCH_FLAG_TEN | BATCH_FLAG_TEN_HIGH(msgs[i].addr) : 0);
+		*p++ = msgs[i].addr & 0xFF;
+		*p++ = msgs[i].len & 0xFF;
+		*p++ = msgs[i].len >> 8;
+		if (!(msgs[i].flags & I2C_M_RD)) {
+			memcpy(p, msgs[i].buf, msgs[i].len);
+			p += msgs[i].len;
+		}
+	}
+
+	ret = usb_bulk_msg(dev->usb_dev, usb_sndbulkpipe(dev->usb_dev, dev->ep_out), cmd, cmd_len, &actual,
+	                   BATCH_TIMEOUT_MS(cmd_len + resp_len));
+	if (ret)
+		goto fail;
+
+	while (done < resp_len) {
+		ret = usb_bulk_msg(dev->usb_dev, usb_rcvbulkpipe(dev->usb_dev, dev->ep_in), resp + done,
+		                   round_up(resp_len - done, dev->ep_size), &actual, BATCH_TIMEOUT_MS(cmd_len + resp_len));
+		if (ret)
+			goto fail;
+		done += actual;
+		if (done > resp_len) {
+			ret = -EPROTO;
+			goto fail;
+		}
+	}
+
+	/* A failed START skips its segment and the firmware returns zeros, so the layout is always the same */
+	p = resp;
+	for (i = 0; i < num; i++) {
+		u8 status = *p++;
+
+		if (!ret)
+			ret = status_to_errno(status);
+		if (msgs[i].flags & I2C_M_RD) {
+			memcpy(msgs[i].buf, p, msgs[i].len);
+			p += msgs[i].len;
+		}
+		if (detail) {
+			if (!ret && p[0] != BATCH_RESULT_OK) {
+				ret = detail_to_errno(p[0], p[1]);
+				dev_dbg(&dev->adapter.dev, "message %d failed: result 0x%02x, TWSR 0x%02x\n", i, p[0], p[1]);
+			}
+			p += BATCH_DETAIL_SIZE;
+		}
+	}
+
+	kfree(cmd);
+	return ret ? ret : num;
+
+fail:
+	dev_err(&dev->adapter.dev, "batch transfer failed: %d\n", ret);
+	batch_resync(dev);
+	kfree(cmd);
+	return (ret == -ETIMEDOUT) ? -ETIMEDOUT : -EIO;
+}
+
+static int usb_xfer(struct i2c_adapter *adapter, struct i2c_msg *msgs, int num)
+{
+	struct i2c_tiny_usb_avr *dev = i2c_get_adapdata(adapter);
+
+	/* Poll records own the bulk IN endpoint while the IIO buffer runs */
+	if (dev->batch && batch && batch_possible(dev, msgs, num)) {
+		bool tried;
+		int ret = 0;
+
+		/* A batch that ran is final, even its -EAGAIN: replaying it would repeat its writes */
+		mutex_lock(&dev->bulk_lock);
+		tried = !dev->streaming;
+		if (tried)
+			ret = xfer_batch(dev, msgs, num);
+		mutex_unlock(&dev->bulk_lock);
+		if (tried)
+			return ret;
+	}
+
+	return xfer_control(dev, msgs, num);
+}
+
+static u32 usb_func(struct i2c_adapter *adapter)
+{
+	struct i2c_tiny_usb_avr *dev = i2c_get_adapdata(adapter);
+
+	return dev->functionality;
+}
+
+static const struct i2c_algorithm usb_algorithm = {
+	.master_xfer   = usb_xfer,
+	.functionality = usb_func,
+};
+
+#if IS_ENABLED(CONFIG_IIO_KFIFO_BUF)
+
+/* Device frame count and Timer1 ticks into the frame as kernel time. The low 11 bits of the count are the USB
+ * frame number, which the host controller shares, so the first record is placed against the frame number taken
+ * when the buffer was enabled and the ones after it follow the full 16-bit count; apart from that anchor, which is
+ * good to a frame, the samples keep the spacing the adapter took them at.
+ */
+static s64 iio_stamp(struct i2c_tiny_usb_avr *dev, u16 frame, u8 ticks)
+{
+	if (!dev->iio_synced) {
+		dev->iio_frames = (frame - dev->iio_anchor_frame) & 0x7FF;
+		dev->iio_synced = true;
+	} else {
+		dev->iio_frames += (u16)(frame - dev->iio_last_frame);
+	}
+	dev->iio_last_frame = frame;
+
+	return dev->iio_anchor_ns + dev->iio_frames * NSEC_PER_MSEC + (s64)ticks * dev->iio_tick_ns;
+}
+
+/* Poll records, index, 16-bit frame count, ticks, status and data, never straddle packets. One round of samples
+ * covers the entries in order and becomes one scan, stamped with its first record; a round with a failed sample
+ * is dropped.
+ */
+static void iio_parse(struct i2c_tiny_usb_avr *dev, const u8 *p, int len)
+{
+	const unsigned long full = GENMASK(dev->iio_entries - 1, 0);
+
+	for (; len >= IIO_RECORD_SIZE; p += IIO_RECORD_SIZE, len -= IIO_RECORD_SIZE) {
+		const unsigned int index = p[0];
+
+		if (index >= dev->iio_entries)
+			return;
+
+		if (index == 0) {
+			dev->iio_round = 0;
+			dev->iio_failed = false;
+			dev->iio_scan.timestamp = iio_stamp(dev, p[1] | p[2] << 8, p[3]);
+		}
+		if (p[4] != STATUS_ADDRESS_ACK)
+			dev->iio_failed = true;
+		memcpy(&dev->iio_scan.values[index], p + POLL_RECORD_HEADER, IIO_SAMPLE_SIZE);
+		dev->iio_round |= BIT(index);
+
+		if (dev->iio_round == full) {
+			if (!dev->iio_failed)
+				iio_push_to_buffers_with_timestamp(dev->indio_dev, &dev->iio_scan, dev->iio_scan.timestamp);
+			dev->iio_round = 0;
+		}
+	}
+}
+
+static void iio_complete(struct urb *urb)
+{
+	struct i2c_tiny_usb_avr *dev = urb->context;
+
+	switch (urb->status) {
+	case 0:
+		iio_parse(dev, urb->transfer_buffer, urb->actual_length);
+		break;
+	case -ENOENT:
+	case -ECONNRESET:
+	case -ESHUTDOWN:
+		return;
+	default:
+		dev_dbg(&dev->interface->dev, "poll record transfer failed: %d\n", urb->status);
+		break;
+	}
+
+	if (READ_ONCE(dev->streaming))
+		usb_submit_urb(urb, GFP_ATOMIC);
+}
+
+/* The polling job as one bulk POLL command: an entry per enabled channel, in scan order, a count of 0 stops it */
+static int iio_send_poll(struct i2c_tiny_usb_avr *dev, const unsigned long *mask)
+{
+	u8 *cmd = kmalloc(2 + IIO_CHANNELS * 5, GFP_KERNEL), *p;
+	unsigned int i, count = 0;
+	int actual, ret;
+
+	if (!cmd)
+		return -ENOMEM;
+
+	p = cmd + 2;
+	if (mask) {
+		for_each_set_bit(i, mask, IIO_CHANNELS) {
+			*p++ = dev->iio_address[i];
+			*p++ = dev->iio_register[i];
+			*p++ = IIO_SAMPLE_SIZE;
+			*p++ = dev->iio_period_ms & 0xFF;
+			*p++ = dev->iio_period_ms >> 8;
+			count++;
+		}
+	}
+	cmd[0] = BULK_OP_POLL;
+	cmd[1] = count;
+
+	ret = usb_bulk_msg(dev->usb_dev, usb_sndbulkpipe(dev->usb_dev, dev->ep_out), cmd, p - cmd, &actual,
+	                   CONTROL_TIMEOUT_MS);
+	kfree(cmd);
+	return ret;
+}
+
+static int iio_postenable(struct iio_dev *indio_dev)
+{
+	struct i2c_tiny_usb_avr *dev = *(struct i2c_tiny_usb_avr **)iio_priv(indio_dev);
+	const unsigned long *mask = indio_dev->active_scan_mask;
+	unsigned int i;
+	int ret;
+
+	if (!bitmap_weight(mask, IIO_CHANNELS))
+		return -EINVAL;
+	for_each_set_bit(i, mask, IIO_CHANNELS)
+		if (!dev->iio_address[i])
+			return -EINVAL;
+
+	mutex_lock(&dev->bulk_lock);
+	dev->iio_entries = bitmap_weight(mask, IIO_CHANNELS);
+	dev->iio_round = 0;
+	dev->iio_synced = false;
+	dev->iio_anchor_frame = usb_get_current_frame_number(dev->usb_dev);
+	dev->iio_anchor_ns = iio_get_time_ns(indio_dev);
+	WRITE_ONCE(dev->streaming, true);
+
+	for (i = 0; i < IIO_URBS; i++) {
+		ret = usb_submit_urb(dev->iio_urbs[i], GFP_KERNEL);
+		if (ret)
+			goto fail;
+	}
+	ret = iio_send_poll(dev, mask);
+	if (ret)
+		goto fail;
+
+	mutex_unlock(&dev->bulk_lock);
+	return 0;
+
+fail:
+	WRITE_ONCE(dev->streaming, false);
+	for (i = 0; i < IIO_URBS; i++)
+		usb_kill_urb(dev->iio_urbs[i]);
+	batch_resync(dev);
+	mutex_unlock(&dev->bulk_lock);
+	return ret;
+}
+
+/* Records still under way when polling stops would look like the start of the next BATCH response, so the
+ * endpoints are flushed before BATCH gets them back
+ */
+static int iio_predisable(struct iio_dev *indio_dev)
+{
+	struct i2c_tiny_usb_avr *dev = *(struct i2c_tiny_usb_avr **)iio_priv(indio_dev);
+	unsigned int i;
+
+	mutex_lock(&dev->bulk_lock);
+	iio_send_poll(dev, NULL);
+	WRITE_ONCE(dev->streaming, false);
+	for (i = 0; i < IIO_URBS; i++)
+		usb_kill_urb(dev->iio_urbs[i]);
+	batch_resync(dev);
+	mutex_unlock(&dev->bulk_lock);
+	return 0;
+}
+
+static const struct iio_buffer_setup_ops iio_buffer_ops = {
+	.postenable = iio_postenable,
+	.predisable = iio_predisable,
+};
+
+/* Reading a channel directly reads its register over the adapter */
+static int iio_read_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan, int *val, int *val2, long mask)
+{
+	struct i2c_tiny_usb_avr *dev = *(struct i2c_tiny_usb_avr **)iio_priv(indio_dev);
+	u8 reg, data[IIO_SAMPLE_SIZE];
+	struct i2c_msg msgs[2];
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		if (!dev->iio_address[chan->channel])
+			return -EINVAL;
+		ret = iio_device_claim_direct_mode(indio_dev);
+		if (ret)
+			return ret;
+
+		reg = dev->iio_register[chan->channel];
+		msgs[0] = (struct i2c_msg) { .addr = dev->iio_address[chan->channel], .len = 1, .buf = &reg };
+		msgs[1] = (struct i2c_msg) { .addr = dev->iio_address[chan->channel], .flags = I2C_M_RD,
+		                             .len = sizeof(data), .buf = data };
+		ret = i2c_transfer(&dev->adapter, msgs, 2);
+		iio_device_release_direct_mode(indio_dev);
+		if (ret < 0)
+			return ret;
+
+		*val = data[0] << 8 | data[1];
+		return IIO_VAL_INT;
+
+	case IIO_CHAN_INFO_SAMP_FREQ:
+		*val = MSEC_PER_SEC;
+		*val2 = dev->iio_period_ms;
+		return IIO_VAL_FRACTIONAL;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+/* The firmware polls in whole milliseconds, the frequency is rounded to the nearest period */
+static int iio_write_raw(struct iio_dev *indio_dev, struct iio_chan_spec const *chan, int val, int val2, long mask)
+{
+	struct i2c_tiny_usb_avr *dev = *(struct i2c_tiny_usb_avr **)iio_priv(indio_dev);
+	u64 micro_hz = (u64)val * USEC_PER_SEC + val2;
+	int ret;
+
+	if (mask != IIO_CHAN_INFO_SAMP_FREQ)
+		return -EINVAL;
+	if (val < 0 || val2 < 0 || !micro_hz)
+		return -EINVAL;
+
+	ret = iio_device_claim_direct_mode(indio_dev);
+	if (ret)
+		return ret;
+	dev->iio_period_ms = clamp_t(u64, div64_u64((u64)MSEC_PER_SEC * USEC_PER_SEC + micro_hz / 2, micro_hz), 1, U16_MAX);
+	iio_device_release_direct_mode(indio_dev);
+	return 0;
+}
+
+static const struct iio_info iio_info = {
+	.read_raw  = iio_read_raw,
+	.write_raw = iio_write_raw,
+};
+
+/* i2c_address and i2c_register of a channel, private 0 and 1; a channel without an address can't be enabled */
+static ssize_t iio_target_read(struct iio_dev *indio_dev, uintptr_t private, const struct iio_chan_spec *chan,
+                               char *buf)
+{
+	struct i2c_tiny_usb_avr *dev = *(struct i2c_tiny_usb_avr **)iio_priv(indio_dev);
+
+	return sysfs_emit(buf, "0x%02x\n", private ? dev->iio_register[chan->channel] : dev->iio_address[chan->channel]);
+}
+
+static ssize_t iio_target_write(struct iio_dev *indio_dev, uintptr_t private, const struct iio_chan_spec *chan,
+                                const char *buf, size_t len)
+{
+	struct i2c_tiny_usb_avr *dev = *(struct i2c_tiny_usb_avr **)iio_priv(indio_dev);
+	u8 value;
+	int ret;
+
+	ret = kstrtou8(buf, 0, &value);
+	if (ret)
+		return ret;
+	if (!private && value > 0x7F)
+		return -EINVAL;
+
+	ret = iio_device_claim_direct_mode(indio_dev);
+	if (ret)
+		return ret;
+	if (private)
+		dev->iio_register[chan->channel] = value;
+	else
+		dev->iio_address[chan->channel] = value;
+	iio_device_release_direct_mode(indio_dev);
+	return len;
+}
+
+static const struct iio_chan_spec_ext_info iio_ext_info[] = {
+	{ .name = "i2c_address",  .shared = IIO_SEPARATE, .read = iio_target_read, .write = iio_target_write,
+	  .private = 0 },
+	{ .name = "i2c_register", .shared = IIO_SEPARATE, .read = iio_target_read, .write = iio_target_write,
+	  .private = 1 },
+	{ }
+};
+
+/* The polling job doesn't know what the registers hold, they are raw values of whatever the targets measure */
+#define IIO_CHANNEL(n) {                                                        \
+	.type = IIO_VOLTAGE,                                                    \
+	.indexed = 1,                                                           \
+	.channel = (n),                                                         \
+	.info_mask_separate = BIT(IIO_CHAN_INFO_RAW),                           \
+	.info_mask_shared_by_all = BIT(IIO_CHAN_INFO_SAMP_FREQ),                \
+	.scan_index = (n),                                                      \
+	.scan_type = { .sign = 'u', .realbits = 16, .storagebits = 16,          \
+	               .endianness = IIO_BE },                                  \
+	.ext_info = iio_ext_info,                                               \
+}
+
+static const struct iio_chan_spec iio_channels[] = {
+	IIO_CHANNEL(0), IIO_CHANNEL(1), IIO_CHANNEL(2), IIO_CHANNEL(3),
+	IIO_CHANNEL(4), IIO_CHANNEL(5), IIO_CHANNEL(6), IIO_CHANNEL(7),
+	IIO_CHAN_SOFT_TIMESTAMP(IIO_CHANNELS),
+};
+
+static void iio_free_urbs(struct i2c_tiny_usb_avr *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < IIO_URBS; i++) {
+		struct urb *urb = dev->iio_urbs[i];
+
+		if (!urb)
+			continue;
+		usb_free_coherent(dev->usb_dev, dev->ep_size, urb->transfer_buffer, urb->transfer_dma);
+		usb_free_urb(urb);
+		dev->iio_urbs[i] = NULL;
+	}
+}
+
+/* The IIO device needs the bulk endpoints and the polling job; without them, or if anything fails, the adapter
+ * works on without it
+ */
+static void setup_iio(struct i2c_tiny_usb_avr *dev)
+{
+	struct iio_dev *indio_dev;
+	unsigned int i;
+	u8 rate[2];
+	int ret;
+
+	if (!iio || !dev->batch || !(dev->extensions & FUNC_EXT_POLL))
+		return;
+
+	dev->iio_period_ms = 10;
+	dev->iio_tick_ns = IIO_DEFAULT_TICK_NS;
+	if (usb_read(dev, CMD_GET_STATS, 0, 0, rate, sizeof(rate)) == sizeof(rate) && (rate[0] | rate[1] << 8))
+		dev->iio_tick_ns = USEC_PER_SEC / (rate[0] | rate[1] << 8);
+
+	for (i = 0; i < IIO_URBS; i++) {
+		struct urb *urb = usb_alloc_urb(0, GFP_KERNEL);
+		void *buf;
+
+		if (!urb)
+			goto fail;
+		dev->iio_urbs[i] = urb;
+		buf = usb_alloc_coherent(dev->usb_dev, dev->ep_size, GFP_KERNEL, &urb->transfer_dma);
+		if (!buf)
+			goto fail;
+		usb_fill_bulk_urb(urb, dev->usb_dev, usb_rcvbulkpipe(dev->usb_dev, dev->ep_in), buf, dev->ep_size,
+		                  iio_complete, dev);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+
+	indio_dev = devm_iio_device_alloc(&dev->interface->dev, sizeof(dev));
+	if (!indio_dev)
+		goto fail;
+	*(struct i2c_tiny_usb_avr **)iio_priv(indio_dev) = dev;
+	indio_dev->name = "i2c-tiny-usb-avr";
+	indio_dev->info = &iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = iio_channels;
+	indio_dev->num_channels = ARRAY_SIZE(iio_channels);
+
+	ret = devm_iio_kfifo_buffer_setup(&dev->interface->dev, indio_dev, &iio_buffer_ops);
+	if (ret)
+		goto fail;
+	ret = iio_device_register(indio_dev);
+	if (ret)
+		goto fail;
+
+	dev->indio_dev = indio_dev;
+	return;
+
+fail:
+	dev_warn(&dev->interface->dev, "failed to set up the IIO device\n");
+	iio_free_urbs(dev);
+}
+
+/* Unregistering stops a running buffer, so the URBs are idle by the time they are freed */
+static void remove_iio(struct i2c_tiny_usb_avr *dev)
+{
+	if (dev->indio_dev)
+		iio_device_unregister(dev->indio_dev);
+	iio_free_urbs(dev);
+}
+
+#else
+
+static void setup_iio(struct i2c_tiny_usb_avr *dev) { }
+static void remove_iio(struct i2c_tiny_usb_avr *dev) { }
+
+#endif
+
+/* Find the bulk endpoints and enable BATCH if the firmware has it; on failure the control path stays in use */
+static void setup_batch(struct i2c_tiny_usb_avr *dev)
+{
+	struct usb_endpoint_descriptor *in, *out;
+	int ifnum = dev->interface->cur_altsetting->desc.bInterfaceNumber;
+
+	/* The HID build has interrupt endpoints, and the HID driver on them */
+	if (!(dev->extensions & FUNC_EXT_BULK) || !(dev->extensions & FUNC_EXT_BATCH) ||
+	    (dev->extensions & FUNC_EXT_HID))
+		return;
+
+	if ((dev->extensions & FUNC_EXT_ALT_BULK) && usb_set_interface(dev->usb_dev, ifnum, VENDOR_ALT_BULK)) {
+		dev_warn(&dev->interface->dev, "failed to select the bulk alternate setting\n");
+		return;
+	}
+
+	if (usb_find_common_endpoints(dev->interface->cur_altsetting, &in, &out, NULL, NULL)) {
+		dev_warn(&dev->interface->dev, "no bulk endpoints found\n");
+		return;
+	}
+
+	dev->ep_in = usb_endpoint_num(in);
+	dev->ep_out = usb_endpoint_num(out);
+	/* IN transfers are whole packets, whatever size the descriptor says they are */
+	dev->ep_size = usb_endpoint_maxp(in);
+	dev->batch = dev->ep_size > 0;
+}
+
+static int i2c_tiny_usb_avr_probe(struct usb_interface *interface, const struct usb_device_id *id)
+{
+	struct i2c_tiny_usb_avr *dev;
+	u8 info[FUNC_INFO_SIZE] = { 0 };
+	int ret;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return -ENOMEM;
+
+	dev->usb_dev = usb_get_dev(interface_to_usbdev(interface));
+	dev->interface = interface;
+	mutex_init(&dev->bulk_lock);
+	usb_set_intfdata(interface, dev);
+
+	/* Stock firmware only returns the functionality word */
+	ret = usb_read(dev, CMD_GET_FUNC, 0, 0, info, sizeof(info));
+	if (ret < 4) {
+		dev_err(&interface->dev, "failure getting functionality\n");
+		ret = -EIO;
+		goto error;
+	}
+	dev->functionality = le32_bytes(info);
+	if (ret >= 8)
+		dev->extensions = le32_bytes(info + 4);
+
+	if (usb_write(dev, CMD_SET_DELAY, delay, 0, NULL, 0) != 0) {
+		dev_err(&interface->dev, "failure setting delay to %dus\n", delay);
+		ret = -EIO;
+		goto error;
+	}
+
+	setup_batch(dev);
+
+	dev->adapter.owner = THIS_MODULE;
+	dev->adapter.class = I2C_CLASS_HWMON;
+	dev->adapter.algo = &usb_algorithm;
+	dev->adapter.dev.parent = &interface->dev;
+	i2c_set_adapdata(&dev->adapter, dev);
+	snprintf(dev->adapter.name, sizeof(dev->adapter.name), "i2c-tiny-usb at bus %03d device %03d",
+	         dev->usb_dev->bus->busnum, dev->usb_dev->devnum);
+
+	ret = i2c_add_adapter(&dev->adapter);
+	if (ret)
+		goto error;
+
+	setup_iio(dev);
+
+	dev_info(&dev->adapter.dev, "connected i2c-tiny-usb device, %s\n",
+	         dev->batch ? "using bulk BATCH transfers" : "using control transfers");
+	return 0;
+
+error:
+	usb_set_intfdata(interface, NULL);
+	usb_put_dev(dev->usb_dev);
+	kfree(dev);
+	return ret;
+}
+
+static void i2c_tiny_usb_avr_disconnect(struct usb_interface *interface)
+{
+	struct i2c_tiny_usb_avr *dev = usb_get_intfdata(interface);
+
+	remove_iio(dev);
+	i2c_del_adapter(&dev->adapter);
+	usb_set_intfdata(interface, NULL);
+	usb_put_dev(dev->usb_dev);
+	kfree(dev);
+}
+
+/* Only the vendor interface, the console of a CDC build is left to cdc_acm */
+static const struct usb_device_id i2c_tiny_usb_avr_table[] = {
+	{ USB_DEVICE_INTERFACE_NUMBER(0x0403, 0xc631, 0) },
+	{ }
+};
+MODULE_DEVICE_TABLE(usb, i2c_tiny_usb_avr_table);
+
+static struct usb_driver i2c_tiny_usb_avr_driver = {
+	.name       = "i2c-tiny-usb-avr",
+	.probe      = i2c_tiny_usb_avr_probe,
+	.disconnect = i2c_tiny_usb_avr_disconnect,
+	.id_table   = i2c_tiny_usb_avr_table,
+};
+
+module_usb_driver(i2c_tiny_usb_avr_driver);
+
+MODULE_AUTHOR("Joachim Fenkes <github@dojoe.net>");
+MODULE_DESCRIPTION("I2C-Tiny-USB clone for ATmegaXU4, with bulk BATCH transfers");
+MODULE_LICENSE("Dual MIT/GPL");
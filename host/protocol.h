@@ -0,0 +1,558 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - host side protocol definitions
+ *
+ * Mirrors the request codes and bulk opcodes from the firmware headers so the
+ * host tools don't have to pull in AVR headers. Keep in sync with
+ * i2c-tiny-usb.h and Lib/BulkProtocol.h.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#ifndef _I2C_TINY_USB_PROTOCOL_H_
+#define _I2C_TINY_USB_PROTOCOL_H_
+
+#define I2CTU_VID              0x0403
+#define I2CTU_PID              0xc631
+
+#define I2CTU_EP_BULK_IN       0x83
+#define I2CTU_EP_BULK_OUT      0x04
+#define I2CTU_EP_SIZE          64
+#define I2CTU_EP_EVENT         0x81
+#define I2CTU_EP_EVENT_SIZE    8
+#define I2CTU_EP_POLL          0x82  // Isochronous poll records in alternate setting 2, see FUNC_EXT3_ISO
+
+// Control requests, to be sent as class requests to the device
+#define CMD_ECHO               0
+#define CMD_GET_FUNC           1
+#define CMD_SET_DELAY          2
+#define CMD_GET_STATUS         3
+#define CMD_I2C_IO             4
+#define CMD_I2C_IO_BEGIN       1
+#define CMD_I2C_IO_END         2
+#define CMD_START_BOOTLOADER   0x10
+#define CMD_SET_BAUDRATE       0x11
+#define CMD_SET_OPTIONS        0x12
+#define CMD_GET_BAUDRATE       0x13
+#define CMD_GET_STATS          0x14
+#define CMD_SCAN               0x15
+#define CMD_SET_STRETCH        0x16
+#define CMD_SET_TARGET         0x17
+#define CMD_SET_RETRY          0x18
+#define CMD_I2C_REGREAD        0x19
+#define CMD_SET_EVENTS         0x1A
+#define CMD_SET_ALERT          0x1B
+#define CMD_GET_TRACE          0x1C
+#define CMD_SET_CACHE          0x1D
+#define CMD_SET_SCRIPT         0x1E
+#define CMD_RUN_SCRIPT         0x1F
+#define CMD_SAVE_SETTINGS      0x20
+#define CMD_SET_LABEL          0x21
+#define CMD_GET_LABEL          0x22
+#define CMD_RECOVER_BUS        0x23
+#define CMD_SET_MUX            0x24
+#define CMD_SPEED_SCAN         0x25
+#define CMD_SET_ADAPT          0x26
+#define CMD_CLOCK_METER        0x27
+#define CMD_GET_MEMORY         0x28
+#define CMD_GET_LATENCY        0x29
+#define CMD_GET_ADDR_STATS     0x2A
+#define CMD_GET_CONFIG         0x2B
+#define CMD_SET_WAKEUP         0x2C
+#define CMD_CANCEL             0x2D
+#define CMD_SET_NOTIFY         0x2E
+#define CMD_SET_SCHED          0x2F
+#define CMD_SET_SYNC           0x30
+
+#define OPTION_INLINE_STATUS   (1 << 0)
+#define OPTION_LOOPBACK        (1 << 1)
+#define OPTION_PREFETCH        (1 << 2)
+#define OPTION_QUIET           (1 << 3)
+
+#define ALERT_MODE_ENABLE      (1 << 0)
+#define ALERT_MODE_ARA         (1 << 1)
+#define ALERT_MODE_STATUS      (1 << 2)
+
+// CMD_SET_SYNC: wValue
+#define SYNC_MODE_OFF          0
+#define SYNC_MODE_INPUT        1
+#define SYNC_MODE_OUTPUT       2
+
+// CMD_SET_WAKEUP: wValue bits, what may wake a host that suspended the adapter
+#define WAKEUP_ALERT           (1 << 0)
+#define WAKEUP_POLL            (1 << 1)
+
+// CMD_SET_SCHED: wIndex, the service whose packets per turn are set
+#define SCHED_SVC_BULK         0
+#define SCHED_SVC_POLL         1
+#define SCHED_SVC_FIFO         2
+#define SCHED_SVC_SNIFF        3
+#define SCHED_SVC_UART         4
+
+// CMD_CANCEL: response, 16-bit command bytes dropped, response packets dropped, then these flags
+#define CANCEL_RESPONSE        4
+#define CANCEL_FLAG_STOP       (1 << 0)  // An open bulk transaction got its STOP
+#define CANCEL_FLAG_UNLOCK     (1 << 1)  // The bus lock was released
+#define CANCEL_FLAG_POLL       (1 << 2)  // A polling job was cleared
+
+// CMD_SET_SCRIPT and CMD_RUN_SCRIPT: slot number of the RAM script, opcodes and result codes
+#define SCRIPT_SLOT_RAM        0xFF
+#define SCRIPT_OP_END          0x00
+#define SCRIPT_OP_START        0x01
+#define SCRIPT_OP_WRITE        0x02
+#define SCRIPT_OP_READ         0x03
+#define SCRIPT_OP_STOP         0x04
+#define SCRIPT_OP_WAIT_US      0x05
+#define SCRIPT_OP_LOOP_UNTIL   0x06
+#define SCRIPT_OP_JUMP         0x07
+#define SCRIPT_OP_CHECK        0x08
+#define SCRIPT_STATUS_DONE       0
+#define SCRIPT_STATUS_NAK        1
+#define SCRIPT_STATUS_BUS_ERROR  2
+#define SCRIPT_STATUS_LOOP_LIMIT 3
+#define SCRIPT_STATUS_TIMEOUT    4
+#define SCRIPT_STATUS_BAD_OP     5
+#define SCRIPT_STATUS_BUS_BUSY   6
+#define SCRIPT_RESULT_HEADER   2
+
+// CMD_RECOVER_BUS: result, then the clock pulses it took
+#define BUS_RECOVERY_OK        0
+#define BUS_RECOVERY_SCL_STUCK 1
+#define BUS_RECOVERY_SDA_STUCK 2
+#define BUS_RECOVERY_BUSY      3
+
+// CMD_SPEED_SCAN: wIndex is the 7-bit address (plus SPEED_SCAN_STORE) and the register << 8, wValue the read length
+// (1 to 8) and the rounds per speed << 8. The response is the result, the highest clean speed in kHz (16 bit) and
+// the step count, then per step the speed in kHz (16 bit) and the failed rounds.
+#define SPEED_SCAN_STORE       0x80
+#define SPEED_SCAN_HEADER      4
+#define SPEED_SCAN_STEP_SIZE   3
+#define SPEED_SCAN_RESPONSE    25
+#define SPEED_SCAN_OK          0
+#define SPEED_SCAN_LIMIT       1
+#define SPEED_SCAN_NO_TARGET   2
+#define SPEED_SCAN_UNSTABLE    3
+#define SPEED_SCAN_BUSY        4
+#define SPEED_SCAN_TABLE_FULL  5
+
+// CMD_CLOCK_METER: wValue is the action, taken after the counts are sent. The response is the tick rate in kHz
+// (16 bit), SCL edges (32 bit), milliseconds measured (16 bit), byte times (32 bit), then the shortest and longest
+// byte time in ticks (16 bit each).
+#define CLOCK_METER_READ       0
+#define CLOCK_METER_START      1
+#define CLOCK_METER_STOP       2
+#define CLOCK_METER_RESPONSE   16
+
+// CMD_GET_STATS: a nonzero wValue clears the counters after reading. Offsets of the fields the host tools use, the
+// README has them all; older firmware returns fewer of them.
+#define STATS_TICK_RATE        0
+#define STATS_REQUESTS         2
+#define STATS_ADDRESS_NAKS     6
+#define STATS_CAPTURE_TIMEOUTS 10
+#define STATS_HOST_ABORTS      14
+#define STATS_BUS_RECOVERIES   32
+#define STATS_ARB_LOST         36
+#define STATS_BUS_SPEED        40
+#define STATS_BUS_LOAD         76
+#define STATS_BUS_HELD_LOAD    78
+#define STATS_USB_WAIT_TICKS   80
+#define STATS_USB_PACKETS      84
+#define STATS_USB_FRAMES       88
+#define STATS_CONTROL_STALLS   92
+#define STATS_WD_RESETS        98
+#define STATS_WD_RECOVERIES    100
+#define STATS_RESET_CAUSE      102
+#define STATS_RESPONSE         103
+
+// CMD_GET_MEMORY: wValue bit 0 repaints the free SRAM after the response. The response is the SRAM size, the static
+// data, the least free SRAM since the last paint and the free SRAM right now, 16 bit each.
+#define MEMORY_REPAINT         0x0001
+#define MEMORY_RESPONSE        8
+
+// CMD_GET_LATENCY: a nonzero wValue clears the histograms after reading. The response is the tick rate in kHz
+// (16 bit), the number of histograms and of buckets per histogram (8 bit each), then one row of 16-bit counts per
+// histogram: IO read, IO write, batch, scan, poll. Bucket 0 is up to 1 tick, bucket n from 2^n ticks up.
+#define LATENCY_IO_READ        0
+#define LATENCY_IO_WRITE       1
+#define LATENCY_BATCH          2
+#define LATENCY_SCAN           3
+#define LATENCY_POLL           4
+#define LATENCY_KINDS          5
+#define LATENCY_BUCKETS        16
+#define LATENCY_RESPONSE       (4 + 2 * LATENCY_KINDS * LATENCY_BUCKETS)
+
+// CMD_GET_ADDR_STATS: a nonzero wValue clears the table after reading. The response is the tick rate in kHz (16 bit),
+// the number of entries and the entry size (8 bit each), the ACKs of targets that found the table full (16 bit), then
+// the entries: address and stretch timeouts (8 bit each), NAKs (16 bit), transactions, bytes written, bytes read and
+// wait ticks (32 bit each). Free entries have address 0xFF.
+#define ADDR_STATS_HEADER      6
+#define ADDR_STATS_ENTRY_SIZE  20
+#define ADDR_STATS_UNUSED      0xFF
+
+// CMD_GET_CONFIG: wIndex CONFIG_SET_OPTIONS sets the options to wValue first. The response is the CRC-32 of the
+// CMD_GET_FUNC response (32 bit), the boot id and the configuration generation (16 bit each), the default bus
+// speed in Hz (32 bit), the options, the CONFIG_FLAG_* bits and the CRC-8 of the stored settings.
+#define CONFIG_SET_OPTIONS     0x0001
+#define CONFIG_FUNC_CRC        0
+#define CONFIG_BOOT_ID         4
+#define CONFIG_GENERATION      6
+#define CONFIG_SPEED           8
+#define CONFIG_OPTIONS         12
+#define CONFIG_FLAGS           13
+#define CONFIG_STORED_CRC      14
+#define CONFIG_RESPONSE        15
+#define CONFIG_FLAG_STORED     0x01
+
+// CMD_SCAN and BULK_OP_DISCOVER: bit n of byte n / 8 is set if address n ACKed
+#define SCAN_BITMAP_SIZE       16
+
+// CMD_SET_MUX and BULK_OP_ROUTE: a route is the mux index in bits 7-4 and the channel in bits 2-0
+#define MUX_ENTRIES            4
+#define MUX_UNUSED             0xFF
+#define MUX_ROUTE_ROOT         0xFF
+#define MUX_ROUTE(mux, ch)     (((mux) << 4) | ((ch) & 7))
+
+#define SETTINGS_ERASE         0
+#define SETTINGS_SAVE          1
+
+#define LABEL_MAX_LENGTH       32
+
+// Same values as in <linux/i2c.h>, which may come first
+#ifndef I2C_M_RD
+#define I2C_M_RD               1
+#define I2C_M_TEN              0x0010
+#define I2C_M_NOSTART          0x4000
+#endif
+
+// Second word of the CMD_GET_FUNC response, followed by the max bus speed in kHz (16 bit) and the size of the
+// device's bulk command buffer in bytes (16 bit)
+#define FUNC_EXT_INLINE_STATUS (1UL << 0)
+#define FUNC_EXT_LOOPBACK      (1UL << 1)
+#define FUNC_EXT_GET_BAUDRATE  (1UL << 2)
+#define FUNC_EXT_STATS         (1UL << 3)
+#define FUNC_EXT_BULK          (1UL << 4)
+#define FUNC_EXT_BATCH         (1UL << 5)
+#define FUNC_EXT_POLL          (1UL << 6)
+#define FUNC_EXT_SCAN          (1UL << 7)
+#define FUNC_EXT_SMBUS         (1UL << 8)
+#define FUNC_EXT_SOFTI2C       (1UL << 9)
+#define FUNC_EXT_SOFTI2C_COUNT(ext) (((ext) >> 24) & 7)
+#define FUNC_EXT_STRETCH       (1UL << 10)
+#define FUNC_EXT_TARGET        (1UL << 11)
+#define FUNC_EXT_RETRY         (1UL << 12)
+#define FUNC_EXT_REGREAD       (1UL << 13)
+#define FUNC_EXT_EVENTS        (1UL << 14)
+#define FUNC_EXT_ALERT         (1UL << 15)
+#define FUNC_EXT_TRACE         (1UL << 16)
+#define FUNC_EXT_CACHE         (1UL << 17)
+#define FUNC_EXT_REGWRITE      (1UL << 18)
+#define FUNC_EXT_READ_LONG     (1UL << 19)
+#define FUNC_EXT_FIFO          (1UL << 20)
+#define FUNC_EXT_SCRIPT        (1UL << 21)
+#define FUNC_EXT_SETTINGS      (1UL << 22)
+#define FUNC_EXT_LABEL         (1UL << 23)
+#define FUNC_EXT_ALT_BULK      (1UL << 27)
+#define FUNC_EXT_HID           (1UL << 28)
+#define FUNC_EXT_BATCH_DETAIL  (1UL << 29)
+#define FUNC_EXT_RECOVER_BUS   (1UL << 30)
+#define FUNC_EXT_BUS_LOCK      (1UL << 31)
+
+// Second extension word, after the command buffer size
+#define FUNC_EXT2_REGUPDATE    (1UL << 0)
+#define FUNC_EXT2_MULTIWRITE   (1UL << 1)
+#define FUNC_EXT2_GATHER       (1UL << 2)
+#define FUNC_EXT2_MUX          (1UL << 3)
+#define FUNC_EXT2_STREAM       (1UL << 4)
+#define FUNC_EXT2_BATCH_AT     (1UL << 5)
+#define FUNC_EXT2_POLL_FILTER  (1UL << 6)
+#define FUNC_EXT2_POLL_REDUCE  (1UL << 7)
+#define FUNC_EXT2_POLL_COMPACT (1UL << 8)
+#define FUNC_EXT2_CHECKSUM     (1UL << 9)
+#define FUNC_EXT2_PROGRAM      (1UL << 10)
+#define FUNC_EXT2_SNIFF        (1UL << 11)
+#define FUNC_EXT2_EMULATE      (1UL << 12)
+#define FUNC_EXT2_TEN_BIT      (1UL << 13)
+#define FUNC_EXT2_SPI          (1UL << 14)
+#define FUNC_EXT2_SPI_CS(ext2) (((ext2) >> 28) & 7)
+#define FUNC_EXT2_UART         (1UL << 15)
+#define FUNC_EXT2_GPIO         (1UL << 16)
+#define FUNC_EXT2_SPEED_SCAN   (1UL << 17)
+#define FUNC_EXT2_ADAPT        (1UL << 18)
+#define FUNC_EXT2_CLOCK_METER  (1UL << 19)
+#define FUNC_EXT2_BOOTLOADER   (1UL << 20)
+#define FUNC_EXT2_MEMORY       (1UL << 21)
+#define FUNC_EXT2_LATENCY      (1UL << 22)
+#define FUNC_EXT2_ADDR_STATS   (1UL << 23)
+#define FUNC_EXT2_CONFIG       (1UL << 24)
+#define FUNC_EXT2_WAKEUP       (1UL << 25)
+#define FUNC_EXT2_VERIFY       (1UL << 26)
+#define FUNC_EXT2_ON_FAIL      (1UL << 27)
+#define FUNC_EXT2_CANCEL       (1UL << 31)
+
+// Third extension word, after the second one
+#define FUNC_EXT3_DEADLINE     (1UL << 0)
+#define FUNC_EXT3_TAG          (1UL << 1)
+#define FUNC_EXT3_WRITE_LONG   (1UL << 2)
+#define FUNC_EXT3_HOST_NOTIFY  (1UL << 3)
+#define FUNC_EXT3_PMBUS        (1UL << 4)
+#define FUNC_EXT3_EEPROM_BLOCKS (1UL << 5)
+#define FUNC_EXT3_SCATTER      (1UL << 6)
+#define FUNC_EXT3_PREFETCH     (1UL << 7)
+#define FUNC_EXT3_POST         (1UL << 8)
+#define FUNC_EXT3_SCHED        (1UL << 9)
+#define FUNC_EXT3_SYNC         (1UL << 10)
+#define FUNC_EXT3_QUIET        (1UL << 11)
+#define FUNC_EXT3_ISO          (1UL << 12)
+#define FUNC_EXT3_STAMPS       (1UL << 13)
+#define FUNC_EXT3_EMU_RANGE    (1UL << 14)
+#define FUNC_EXT3_EEPROM_GANG  (1UL << 15)
+#define FUNC_INFO_SIZE         20
+
+#define STATUS_IDLE            0
+#define STATUS_ADDRESS_ACK     1
+#define STATUS_ADDRESS_NAK     2
+#define STATUS_BUS_BUSY        3
+#define STATUS_PEC_ERROR       4
+#define STATUS_COUNT_ERROR     5
+#define STATUS_STRETCH_TIMEOUT 6
+#define STATUS_VERIFY_ERROR    7
+#define STATUS_EXPIRED         8
+
+// Bulk protocol opcodes
+#define BULK_OP_NOP            0x00
+#define BULK_OP_START          0x01
+#define BULK_OP_WRITE          0x02
+#define BULK_OP_READ           0x03
+#define BULK_OP_READ_ACK       0x04
+#define BULK_OP_STOP           0x05
+#define BULK_OP_BATCH          0x06
+#define BULK_OP_POLL           0x07
+#define BULK_OP_EEPROM_WRITE   0x08
+#define BULK_OP_SMBUS          0x09
+#define BULK_OP_CHANNEL        0x0A
+#define BULK_OP_REGWRITE       0x0B
+#define BULK_REGWRITE_VERIFY   0x80  // Address byte flag: read back and compare, response: mismatch offset + status
+#define BULK_OP_READ_LONG      0x0C
+#define BULK_OP_FIFO           0x0D
+#define BULK_OP_FLUSH          0x0E
+#define BULK_OP_LOCK           0x0F
+#define BULK_OP_REGUPDATE      0x10
+#define BULK_OP_MULTIWRITE     0x11
+#define BULK_OP_GATHER         0x12
+#define BULK_OP_ROUTE          0x13
+#define BULK_OP_DISCOVER       0x14
+#define BULK_OP_STREAM         0x15
+#define BULK_OP_POLL_FILTER    0x16
+#define BULK_OP_POLL_REDUCE    0x17
+#define BULK_OP_CHECKSUM       0x18
+#define BULK_OP_PROGRAM        0x19
+#define BULK_OP_SNIFF          0x1A
+#define BULK_OP_EMULATE        0x1B
+#define BULK_OP_EMU_WRITE      0x1C
+#define BULK_OP_EMU_READ       0x1D
+#define BULK_OP_SPI            0x1E
+#define BULK_OP_UART           0x1F
+#define BULK_OP_UART_WRITE     0x20
+#define BULK_OP_GPIO           0x21
+#define BULK_OP_DEADLINE       0x22
+#define BULK_OP_TAG            0x23
+#define BULK_OP_WRITE_LONG     0x24
+#define BULK_OP_EEPROM_READ    0x25
+#define BULK_OP_SCATTER        0x26
+#define BULK_OP_POST           0x27
+#define BULK_OP_POST_STATUS    0x28
+#define BULK_OP_SYNC           0x29
+#define BULK_OP_STAMPS         0x2A
+#define BULK_OP_EMU_RANGE      0x2B
+#define BULK_OP_EMU_PROFILE    0x2C
+
+// Addressing byte of BULK_OP_EEPROM, BULK_OP_EEPROM_READ and BULK_OP_CHECKSUM
+#define EEPROM_FMT_WIDTH       0x03        // Memory address bytes, 0 to 2
+#define EEPROM_FMT_BLOCKS      0x0C        // Block-select bits in the 7-bit address, 0 to 3
+#define EEPROM_FMT_BLOCKS_SHIFT 2
+#define EEPROM_FMT(width, blocks) ((width) | ((blocks) << EEPROM_FMT_BLOCKS_SHIFT))
+
+// BULK_OP_SPI configuration byte and the chip select argument for none
+#define SPI_MODE_MASK          0x03
+#define SPI_CLOCK(n)           ((n) << 2)  // F_CPU / 2^(n + 1), 0 to 6
+#define SPI_LSB_FIRST          (1 << 5)
+#define SPI_HOLD_CS            (1 << 6)
+#define SPI_NO_CS              0xFF
+
+// GPIO operation byte of BULK_OP_GPIO and of a BATCH_FLAG_GPIO segment, followed by a 16-bit argument; response is
+// the level the pin reads and a status byte (NAK for a wait that timed out, COUNT_ERROR for a pin not available)
+#define GPIO_OP(op, pin)       ((op) | ((pin) & 7))
+#define GPIO_OP_LOW            (0 << 4)
+#define GPIO_OP_HIGH           (1 << 4)
+#define GPIO_OP_INPUT          (2 << 4)  // Argument nonzero for the pull-up
+#define GPIO_OP_READ           (3 << 4)
+#define GPIO_OP_WAIT_LOW       (4 << 4)  // Argument is the timeout in ms
+#define GPIO_OP_WAIT_HIGH      (5 << 4)
+#define GPIO_OP_DELAY          (6 << 4)  // Argument in us, the pin is not used
+
+// Most targets of one MULTIWRITE command
+#define MULTIWRITE_MAX_TARGETS 16
+
+// Over HID, the end of a report not taken up by responses or poll records is filled with this
+#define HID_REPORT_PAD         0xFF
+
+#define BATCH_FLAG_RD          I2C_M_RD
+#define BATCH_FLAG_STOP        (1 << 1)
+#define BATCH_FLAG_DETAIL      (1 << 2)
+#define BATCH_FLAG_AT          (1 << 3)
+#define BATCH_FLAG_TEN         (1 << 4)
+#define BATCH_FLAG_TEN_HIGH    (3 << 5)  // Address bits 9 and 8 of a BATCH_FLAG_TEN segment
+#define BATCH_FLAG_GPIO        (1 << 7)  // GPIO operation in place of the address, its argument in place of the length
+
+// What a failed 7-bit I2C segment does to the ones after it, in the bits of BATCH_FLAG_TEN_HIGH
+#define BATCH_ON_FAIL          (3 << 5)
+#define BATCH_ON_FAIL_SKIP     (1 << 5)  // STOP, skip the segments up to the end of the transaction
+#define BATCH_ON_FAIL_ABORT    (2 << 5)  // STOP, skip the rest of the batch
+
+// BATCH_FLAG_DETAIL: result code and TWSR status code (0xF8 for none) after each segment's response
+#define BATCH_RESULT_OK               0x00
+#define BATCH_RESULT_BUS_FAULT        0x01  // Bus error or lost arbitration, see the TWSR code
+#define BATCH_RESULT_CAPTURE_TIMEOUT  0x02  // The START didn't get out in time
+#define BATCH_RESULT_RESPONSE_TIMEOUT 0x03  // A data phase didn't finish in time
+#define BATCH_RESULT_ADDRESS_NAK      0x04
+#define BATCH_RESULT_DATA_NAK         0x05
+#define BATCH_RESULT_STRETCH_TIMEOUT  0x10
+#define BATCH_RESULT_BUS_BUSY         0x11  // Another path held the bus, the segment didn't run
+#define BATCH_RESULT_SKIPPED          0x12  // An earlier segment failed with BATCH_ON_FAIL, the segment didn't run
+#define BATCH_RESULT_EXPIRED          0x13  // Past the BULK_OP_DEADLINE, the segment didn't run
+
+#define TWSR_NO_INFO           0xF8
+#define TWSR_ARB_LOST          0x38
+
+#define SMBUS_FLAG_PEC         (1 << 0)
+#define SMBUS_FLAG_BLOCK_WR    (1 << 1)
+#define SMBUS_FLAG_BLOCK_RD    (1 << 2)
+
+// BULK_OP_FIFO: flags, address, level register, 16-bit level mask, entry size, data register, 16-bit maximum;
+// each drain is a transfer of its own, marker, 16-bit frame count, ticks, status, 16-bit length and data
+#define FIFO_FLAG_ENABLE       (1 << 0)
+#define FIFO_FLAG_LEVEL16      (1 << 1)
+#define FIFO_FLAG_BIG_ENDIAN   (1 << 2)
+#define FIFO_FLAG_ACTIVE_HIGH  (1 << 3)
+#define FIFO_RECORD_MARKER     0xFF
+#define FIFO_RECORD_HEADER     7
+
+// BULK_OP_POLL: entry count, ORed with POLL_COMPACT for packets starting with a 16-bit frame count and ticks, and
+// records of index (ORed with POLL_COMPACT_FAILED), ticks since the record before and data
+#define POLL_COMPACT           0x80
+#define POLL_SYNC              0x40        // Entry periods count SYNC edges
+#define POLL_COMPACT_FAILED    0x80
+#define POLL_RECORD_HEADER     5
+#define POLL_PACKET_HEADER     3
+#define POLL_COMPACT_HEADER    2
+// Entry address bit for an ADC channel: the register byte is REFS1:0, MUX5, MUX4:0 and the length 2
+#define POLL_ADC               0x80
+#define POLL_ADC_LENGTH        2
+// Entry length bits for a PMBus telemetry sweep: the register byte selects POLL_PMBUS_* commands, each giving a
+// signed 32-bit little endian value in milli-units, POLL_PMBUS_INVALID if it failed
+#define POLL_PMBUS             0x80
+#define POLL_PMBUS_PEC         0x40
+#define POLL_PMBUS_VALUE       4
+#define POLL_PMBUS_INVALID     0x80000000UL
+#define POLL_PMBUS_VIN         (1 << 0)
+#define POLL_PMBUS_IIN         (1 << 1)
+#define POLL_PMBUS_VOUT        (1 << 2)
+#define POLL_PMBUS_IOUT        (1 << 3)
+#define POLL_PMBUS_TEMP1       (1 << 4)
+#define POLL_PMBUS_TEMP2       (1 << 5)
+#define POLL_PMBUS_POUT        (1 << 6)
+#define POLL_PMBUS_PIN         (1 << 7)
+
+// BULK_OP_POLL_FILTER: entry index, flags, offset of the watched value in the sample, two 16-bit limits and a
+// 16-bit heartbeat in samples (0 for none); no response
+#define POLL_FILTER_ALWAYS     0x00
+#define POLL_FILTER_CHANGE     0x01
+#define POLL_FILTER_DELTA      0x02
+#define POLL_FILTER_THRESHOLD  0x03
+#define POLL_FILTER_WIDE       (1 << 2)
+#define POLL_FILTER_BIG        (1 << 3)
+#define POLL_FILTER_SIGNED     (1 << 4)
+
+// BULK_OP_POLL_REDUCE: entry index, operation, value format as POLL_FILTER_WIDE/_BIG/_SIGNED, offset of the first
+// value, value count (up to 4) and 16-bit samples per record; no response
+#define POLL_REDUCE_OFF        0
+#define POLL_REDUCE_MEAN       1
+#define POLL_REDUCE_SUM        2
+#define POLL_REDUCE_MIN        3
+#define POLL_REDUCE_MAX        4
+
+// BULK_OP_PROGRAM: address, format, command byte, 16-bit block size, 32-bit memory address, 32-bit length, poll
+// register, mask and value (mask 0 for ACK polling), poll timeout in ms (0 for 20) and the data; response is the
+// 16-bit count of blocks written and a status byte
+#define PROGRAM_FMT_WIDTH      0x07
+#define PROGRAM_FMT_LE         (1 << 3)
+#define PROGRAM_FMT_CMD        (1 << 4)
+#define PROGRAM_FMT_BLOCKS     (1 << 5)
+
+// BULK_OP_SNIFF: 1 to start, 0 to stop; response is a status byte, then a stream of records with these types
+#define SNIFF_RECORD_START     0xF0  // Followed by a 16-bit frame count and ticks into the frame
+#define SNIFF_RECORD_ACK       0xF1  // Followed by the byte
+#define SNIFF_RECORD_NAK       0xF2  // Followed by the byte
+#define SNIFF_RECORD_STOP      0xF3
+#define SNIFF_RECORD_OVERFLOW  0xF4  // Followed by the number of records lost
+
+// BULK_OP_UART: 32-bit baud rate, 0 to close; response is a status byte. While open, what the UART receives comes
+// as records of the marker, 16-bit frame count and ticks into the frame of the first byte, bytes lost before it,
+// the data length and the data, each in a packet of its own
+#define UART_RECORD_MARKER     0xF5
+#define UART_RECORD_HEADER     6
+
+// CMD_GET_TRACE: 16-bit tick rate in kHz, head index, record count, then 5-byte records of type, argument,
+// 16-bit frame count and Timer1 ticks into the frame
+#define TRACE_HEADER_SIZE      4
+#define TRACE_RECORD_SIZE      5
+#define TRACE_START            0x01
+#define TRACE_ACK              0x02
+#define TRACE_NAK              0x03
+#define TRACE_WRITE            0x04
+#define TRACE_READ             0x05
+#define TRACE_STOP             0x06
+#define TRACE_FAULT            0x07
+#define TRACE_TIMEOUT          0x08
+#define TRACE_REQUEST          0x10
+#define TRACE_REQUEST_END      0x11
+#define TRACE_BULK_OUT         0x12
+
+// Event records on the interrupt endpoint: type, argument, 16-bit USB frame number
+#define EVENT_RECORD_SIZE      4
+#define EVENT_OVERFLOW         0
+#define EVENT_ALERT            1
+#define EVENT_BULK_DONE        2
+#define EVENT_POLL_OVERRUN     3
+#define EVENT_ALERT_STATUS     4
+#define EVENT_EMU_WRITE        5
+#define EVENT_EMU_READ         6
+#define EVENT_HOST_NOTIFY      7
+#define EVENT_NOTIFY_DATA      8
+#define EVENT_POST_FAILED      9
+#define EVENT_POST_STATUS      10
+
+#define ALERT_NO_ADDRESS       0xFF
+
+#endif
@@ -0,0 +1,611 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4 - Python binding of the host library
+ *
+ * Wraps libi2ctu for Python. The vectorized reads build the whole job in C:
+ * with the bulk protocol it goes out as one command stream and comes back as
+ * one response, otherwise all control requests are queued before waiting for
+ * the first one, so the interpreter never sits in the per-transaction loop.
+ * Results are written into any writable buffer, e.g. a numpy uint8 array,
+ * without the module having to depend on numpy.
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "i2ctu.h"
+#include "protocol.h"
+
+// Bulk command per entry of a vectorized read: START, WRITE of the register, repeated START, READ, STOP
+#define ENTRY_CMD_SIZE    12
+// Response per entry: both START statuses, then the data
+#define ENTRY_RESP_HEADER 2
+
+typedef struct {
+	PyObject_HEAD
+	libusb_context *ctx;
+	struct i2ctu_dev *dev;
+	PyThread_type_lock lock;  // Held while the GIL is dropped for a job, the library isn't thread safe
+} DeviceObject;
+
+static PyObject *Error;
+
+// Result of a single request, a libusb error wins over a bus result
+static void store_result(struct i2ctu_dev *dev, int result, void *user)
+{
+	int *r = user;
+	(void)dev;
+
+	if (!*r || result < 0)
+		*r = result;
+}
+
+static int start_result(uint8_t status)
+{
+	switch (status) {
+	case STATUS_ADDRESS_ACK: return I2CTU_OK;
+	case STATUS_BUS_BUSY:    return I2CTU_BUSY;
+	default:                 return I2CTU_NAK;
+	}
+}
+
+// Raises the exception for a non-OK result and returns NULL
+static PyObject *raise_result(int result)
+{
+	if (result == I2CTU_NAK)
+		PyErr_SetObject(Error, Py_BuildValue("(is)", ENXIO, "target did not ACK"));
+	else if (result == I2CTU_BUSY)
+		PyErr_SetObject(Error, Py_BuildValue("(is)", EBUSY, "bus in use by another protocol"));
+	else if (result == I2CTU_FAULT)
+		PyErr_SetObject(Error, Py_BuildValue("(is)", EIO, "bus fault or timeout"));
+	else
+		PyErr_SetObject(Error, Py_BuildValue("(is)", EIO, libusb_error_name(result)));
+	return NULL;
+}
+
+static int check_open(DeviceObject *self)
+{
+	if (self->dev)
+		return 0;
+	PyErr_SetString(PyExc_ValueError, "device is closed");
+	return -1;
+}
+
+/*
+ * Jobs, run with the GIL dropped
+ */
+
+// One message on the control path, waited for
+static int run_msg(DeviceObject *self, uint8_t addr, uint8_t rd, uint8_t *buf, uint16_t len)
+{
+	int result = I2CTU_OK, ret;
+
+	ret = i2ctu_submit_msg(self->dev, addr, rd, I2CTU_START | I2CTU_STOP, buf, len, store_result, &result);
+	if (!ret)
+		ret = i2ctu_wait_all(self->dev);
+	return ret ? ret : result;
+}
+
+// Register reads for count (address, register) pairs, data into out at len bytes per entry, a result per entry into
+// results; returns 0 or the first libusb error
+static int run_regreads(DeviceObject *self, const uint8_t *addrs, const uint8_t *regs, Py_ssize_t count, uint16_t len,
+                        uint8_t *out, int *results)
+{
+	int error = 0, ret = 0;
+
+	memset(results, 0, count * sizeof(*results));
+
+	if (i2ctu_extensions(self->dev) & FUNC_EXT_BULK) {
+		const size_t entry_resp = ENTRY_RESP_HEADER + len;
+		uint8_t *cmd = malloc(count * ENTRY_CMD_SIZE + count * entry_resp);
+		uint8_t *resp = cmd + count * ENTRY_CMD_SIZE, *p = cmd;
+
+		if (!cmd)
+			return LIBUSB_ERROR_NO_MEM;
+
+		// A NAKed START skips up to the next START, so every entry's response has the same size
+		for (Py_ssize_t i = 0; i < count; i++) {
+			*p++ = BULK_OP_START;
+			*p++ = addrs[i] << 1;
+			*p++ = BULK_OP_WRITE;
+			*p++ = 1;
+			*p++ = 0;
+			*p++ = regs[i];
+			*p++ = BULK_OP_START;
+			*p++ = (addrs[i] << 1) | 1;
+			*p++ = BULK_OP_READ;
+			*p++ = len & 0xFF;
+			*p++ = len >> 8;
+			*p++ = BULK_OP_STOP;
+		}
+
+		ret = i2ctu_submit_bulk(self->dev, cmd, p - cmd, resp, count * entry_resp, store_result, &error);
+		if (!ret)
+			ret = i2ctu_wait_all(self->dev);
+
+		if (!ret && !error) {
+			for (Py_ssize_t i = 0; i < count; i++, resp += entry_resp) {
+				results[i] = start_result(resp[0]);
+				if (!results[i])
+					results[i] = start_result(resp[1]);
+				memcpy(out + i * len, resp + ENTRY_RESP_HEADER, len);
+			}
+		}
+
+		free(cmd);
+		return ret ? ret : (error < 0) ? error : 0;
+	}
+
+	// Stock firmware: queue all control requests, then wait for them together
+	for (Py_ssize_t i = 0; i < count && !ret; i++) {
+		ret = i2ctu_submit_msg(self->dev, addrs[i], 0, I2CTU_START, (uint8_t *)&regs[i], 1, store_result, &results[i]);
+		if (!ret)
+			ret = i2ctu_submit_msg(self->dev, addrs[i], 1, I2CTU_START | I2CTU_STOP, out + i * len, len,
+			                       store_result, &results[i]);
+	}
+
+	// Callbacks of requests already queued still point at our buffers
+	error = i2ctu_wait_all(self->dev);
+	if (ret || error)
+		return ret ? ret : error;
+
+	for (Py_ssize_t i = 0; i < count; i++)
+		if (results[i] < 0)
+			return results[i];
+	return 0;
+}
+
+/*
+ * Argument helpers
+ */
+
+// Fills a malloc()ed array with the bytes of an iterable of ints, returns its length or -1
+static Py_ssize_t byte_array(PyObject *obj, const char *what, uint8_t **array)
+{
+	PyObject *seq = PySequence_Fast(obj, "expected an iterable of ints");
+	Py_ssize_t count;
+
+	if (!seq)
+		return -1;
+
+	count = PySequence_Fast_GET_SIZE(seq);
+	*array = malloc(count ? count : 1);
+	if (!*array) {
+		Py_DECREF(seq);
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	for (Py_ssize_t i = 0; i < count; i++) {
+		long value = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+		if (value == -1 && PyErr_Occurred())
+			goto fail;
+		if (value < 0 || value > 0xFF) {
+			PyErr_Format(PyExc_ValueError, "%s out of range: %ld", what, value);
+			goto fail;
+		}
+		(*array)[i] = value;
+	}
+
+	Py_DECREF(seq);
+	return count;
+
+fail:
+	free(*array);
+	Py_DECREF(seq);
+	return -1;
+}
+
+static int check_addr(int addr)
+{
+	if (addr >= 0 && addr < 0x80)
+		return 0;
+	PyErr_Format(PyExc_ValueError, "address out of range: %d", addr);
+	return -1;
+}
+
+/*
+ * Device methods
+ */
+
+static int Device_init(DeviceObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { NULL };
+	int ret;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "", kwlist))
+		return -1;
+	if (self->dev) {
+		PyErr_SetString(PyExc_RuntimeError, "device is already open");
+		return -1;
+	}
+
+	if ((ret = libusb_init(&self->ctx))) {
+		raise_result(ret);
+		return -1;
+	}
+	if ((ret = i2ctu_open(self->ctx, &self->dev))) {
+		libusb_exit(self->ctx);
+		self->ctx = NULL;
+		raise_result(ret);
+		return -1;
+	}
+	return 0;
+}
+
+static void close_device(DeviceObject *self)
+{
+	if (!self->dev)
+		return;
+
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	i2ctu_close(self->dev);
+	libusb_exit(self->ctx);
+	self->dev = NULL;
+	self->ctx = NULL;
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+}
+
+static PyObject *Device_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	DeviceObject *self = (DeviceObject *)type->tp_alloc(type, 0);
+	(void)args;
+	(void)kwds;
+
+	if (!self)
+		return NULL;
+	self->lock = PyThread_allocate_lock();
+	if (!self->lock) {
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+	return (PyObject *)self;
+}
+
+static void Device_dealloc(DeviceObject *self)
+{
+	if (self->lock) {
+		close_device(self);
+		PyThread_free_lock(self->lock);
+	}
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Device_close(DeviceObject *self, PyObject *unused)
+{
+	(void)unused;
+	close_device(self);
+	Py_RETURN_NONE;
+}
+
+static PyObject *Device_enter(DeviceObject *self, PyObject *unused)
+{
+	(void)unused;
+	if (check_open(self))
+		return NULL;
+	Py_INCREF(self);
+	return (PyObject *)self;
+}
+
+static PyObject *Device_exit(DeviceObject *self, PyObject *args)
+{
+	(void)args;
+	close_device(self);
+	Py_RETURN_FALSE;
+}
+
+static PyObject *Device_get_extensions(DeviceObject *self, void *closure)
+{
+	(void)closure;
+	if (check_open(self))
+		return NULL;
+	return PyLong_FromUnsignedLong(i2ctu_extensions(self->dev));
+}
+
+static PyObject *Device_read(DeviceObject *self, PyObject *args)
+{
+	int addr, len, result;
+	PyObject *data;
+
+	if (!PyArg_ParseTuple(args, "ii", &addr, &len) || check_open(self) || check_addr(addr))
+		return NULL;
+	if (len < 0 || len > 0xFFFF)
+		return PyErr_Format(PyExc_ValueError, "length out of range: %d", len);
+
+	data = PyBytes_FromStringAndSize(NULL, len);
+	if (!data)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	result = run_msg(self, addr, 1, (uint8_t *)PyBytes_AS_STRING(data), len);
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+
+	if (result) {
+		Py_DECREF(data);
+		return raise_result(result);
+	}
+	return data;
+}
+
+static PyObject *Device_write(DeviceObject *self, PyObject *args)
+{
+	Py_buffer data;
+	int addr, result;
+
+	if (!PyArg_ParseTuple(args, "iy*", &addr, &data))
+		return NULL;
+	if (check_open(self) || check_addr(addr) || data.len > 0xFFFF) {
+		if (!PyErr_Occurred())
+			PyErr_SetString(PyExc_ValueError, "data too long");
+		PyBuffer_Release(&data);
+		return NULL;
+	}
+
+	// The library doesn't write to the buffer of a write message
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	result = run_msg(self, addr, 0, data.buf, data.len);
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+
+	PyBuffer_Release(&data);
+	if (result)
+		return raise_result(result);
+	Py_RETURN_NONE;
+}
+
+// Common part of the vectorized reads: count entries of len bytes each into out, or a new bytearray;
+// returns (out, status) with a result code per entry in status
+static PyObject *regreads(DeviceObject *self, const uint8_t *addrs, const uint8_t *regs, Py_ssize_t count, int len,
+                          PyObject *out)
+{
+	PyObject *status = NULL;
+	Py_buffer view;
+	int *results;
+	int ret;
+
+	if (len < 0 || len > 0xFFFF)
+		return PyErr_Format(PyExc_ValueError, "length out of range: %d", len);
+
+	if (out == Py_None) {
+		out = PyByteArray_FromStringAndSize(NULL, count * len);
+		if (!out)
+			return NULL;
+	} else {
+		Py_INCREF(out);
+	}
+
+	if (PyObject_GetBuffer(out, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS)) {
+		Py_DECREF(out);
+		return NULL;
+	}
+	if (view.len < count * len) {
+		PyErr_Format(PyExc_ValueError, "buffer too small, need %zd bytes", count * len);
+		goto out;
+	}
+
+	results = malloc((count ? count : 1) * sizeof(*results));
+	if (!results) {
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	ret = count ? run_regreads(self, addrs, regs, count, len, view.buf, results) : 0;
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+
+	if (ret) {
+		raise_result(ret);
+	} else if ((status = PyBytes_FromStringAndSize(NULL, count))) {
+		for (Py_ssize_t i = 0; i < count; i++)
+			PyBytes_AS_STRING(status)[i] = results[i];
+	}
+	free(results);
+
+out:
+	PyBuffer_Release(&view);
+	if (!status) {
+		Py_DECREF(out);
+		return NULL;
+	}
+	return Py_BuildValue("(NN)", out, status);
+}
+
+static PyObject *Device_read_reg(DeviceObject *self, PyObject *args)
+{
+	int addr, reg, len;
+	uint8_t a, r;
+	PyObject *res, *data;
+
+	if (!PyArg_ParseTuple(args, "iii", &addr, &reg, &len) || check_open(self) || check_addr(addr))
+		return NULL;
+	if (reg < 0 || reg > 0xFF)
+		return PyErr_Format(PyExc_ValueError, "register out of range: %d", reg);
+
+	a = addr;
+	r = reg;
+	res = regreads(self, &a, &r, 1, len, Py_None);
+	if (!res)
+		return NULL;
+
+	if (PyBytes_AS_STRING(PyTuple_GET_ITEM(res, 1))[0]) {
+		int result = PyBytes_AS_STRING(PyTuple_GET_ITEM(res, 1))[0];
+		Py_DECREF(res);
+		return raise_result(result);
+	}
+
+	data = PyBytes_FromObject(PyTuple_GET_ITEM(res, 0));
+	Py_DECREF(res);
+	return data;
+}
+
+static PyObject *Device_read_reg_multi(DeviceObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { "addrs", "reg", "length", "out", NULL };
+	PyObject *addr_list, *out = Py_None, *res = NULL;
+	uint8_t *addrs, *regs;
+	Py_ssize_t count;
+	int reg, len;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "Oii|O", kwlist, &addr_list, &reg, &len, &out) || check_open(self))
+		return NULL;
+	if (reg < 0 || reg > 0xFF)
+		return PyErr_Format(PyExc_ValueError, "register out of range: %d", reg);
+
+	count = byte_array(addr_list, "address", &addrs);
+	if (count < 0)
+		return NULL;
+	for (Py_ssize_t i = 0; i < count; i++)
+		if (check_addr(addrs[i]))
+			goto out;
+
+	regs = malloc(count ? count : 1);
+	if (!regs) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	memset(regs, reg, count);
+
+	res = regreads(self, addrs, regs, count, len, out);
+	free(regs);
+out:
+	free(addrs);
+	return res;
+}
+
+static PyObject *Device_read_regs(DeviceObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { "addr", "regs", "length", "out", NULL };
+	PyObject *reg_list, *out = Py_None, *res = NULL;
+	uint8_t *addrs, *regs;
+	Py_ssize_t count;
+	int addr, len;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "iOi|O", kwlist, &addr, &reg_list, &len, &out) ||
+	    check_open(self) || check_addr(addr))
+		return NULL;
+
+	count = byte_array(reg_list, "register", &regs);
+	if (count < 0)
+		return NULL;
+
+	addrs = malloc(count ? count : 1);
+	if (!addrs) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	memset(addrs, addr, count);
+
+	res = regreads(self, addrs, regs, count, len, out);
+	free(addrs);
+out:
+	free(regs);
+	return res;
+}
+
+static PyMethodDef Device_methods[] = {
+	{ "close", (PyCFunction)Device_close, METH_NOARGS,
+	  "close()\n\nReleases the adapter; also done when the object goes away." },
+	{ "__enter__", (PyCFunction)Device_enter, METH_NOARGS, NULL },
+	{ "__exit__", (PyCFunction)Device_exit, METH_VARARGS, NULL },
+	{ "read", (PyCFunction)Device_read, METH_VARARGS,
+	  "read(addr, length) -> bytes\n\nReads length bytes from the 7-bit address addr." },
+	{ "write", (PyCFunction)Device_write, METH_VARARGS,
+	  "write(addr, data)\n\nWrites a bytes-like object to the 7-bit address addr." },
+	{ "read_reg", (PyCFunction)Device_read_reg, METH_VARARGS,
+	  "read_reg(addr, reg, length) -> bytes\n\nWrites the register pointer, then reads length bytes after a "
+	  "repeated START." },
+	{ "read_reg_multi", (PyCFunction)(void (*)(void))Device_read_reg_multi, METH_VARARGS | METH_KEYWORDS,
+	  "read_reg_multi(addrs, reg, length, out=None) -> (out, status)\n\nReads the same register from every "
+	  "address in addrs as one job. Entry i ends up at out[i*length:(i+1)*length], zeros if the target didn't "
+	  "respond; out is any writable buffer of at least len(addrs)*length bytes, e.g. a numpy uint8 array, or "
+	  "a new bytearray. status holds OK, NAK or BUSY for each entry." },
+	{ "read_regs", (PyCFunction)(void (*)(void))Device_read_regs, METH_VARARGS | METH_KEYWORDS,
+	  "read_regs(addr, regs, length, out=None) -> (out, status)\n\nReads every register in regs from one "
+	  "address as one job, otherwise like read_reg_multi()." },
+	{ NULL }
+};
+
+static PyGetSetDef Device_getset[] = {
+	{ "extensions", (getter)Device_get_extensions, NULL, "FUNC_EXT_* bits advertised by the firmware", NULL },
+	{ NULL }
+};
+
+static PyTypeObject DeviceType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name      = "i2ctu.Device",
+	.tp_doc       = "Device()\n\nOpens the first adapter found.",
+	.tp_basicsize = sizeof(DeviceObject),
+	.tp_flags     = Py_TPFLAGS_DEFAULT,
+	.tp_new       = Device_new,
+	.tp_init      = (initproc)Device_init,
+	.tp_dealloc   = (destructor)Device_dealloc,
+	.tp_methods   = Device_methods,
+	.tp_getset    = Device_getset,
+};
+
+static struct PyModuleDef i2ctu_module = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "i2ctu",
+	.m_doc  = "I2C-Tiny-USB clone for ATmegaXU4, on top of libi2ctu",
+	.m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_i2ctu(void)
+{
+	PyObject *m;
+
+	if (PyType_Ready(&DeviceType) < 0)
+		return NULL;
+
+	m = PyModule_Create(&i2ctu_module);
+	if (!m)
+		return NULL;
+
+	Error = PyErr_NewException("i2ctu.Error", PyExc_OSError, NULL);
+	Py_XINCREF(Error);
+	Py_INCREF(&DeviceType);
+	if (PyModule_AddObject(m, "Error", Error) || PyModule_AddObject(m, "Device", (PyObject *)&DeviceType) ||
+	    PyModule_AddIntConstant(m, "OK", I2CTU_OK) || PyModule_AddIntConstant(m, "NAK", I2CTU_NAK) ||
+	    PyModule_AddIntConstant(m, "BUSY", I2CTU_BUSY)) {
+		Py_XDECREF(Error);
+		Py_DECREF(&DeviceType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	return m;
+}
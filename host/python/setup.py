@@ -0,0 +1,26 @@
+# Builds the i2ctu Python module from the host library sources, needs libusb-1.0 and pkg-config:
+#   python3 setup.py build_ext --inplace
+
+import subprocess
+
+from setuptools import Extension, setup
+
+
+def pkgconfig(option):
+    return subprocess.check_output(["pkg-config", option, "libusb-1.0"], text=True).split()
+
+
+setup(
+    name="i2ctu",
+    version="1.0",
+    description="I2C-Tiny-USB clone for ATmegaXU4, on top of libi2ctu",
+    ext_modules=[
+        Extension(
+            "i2ctu",
+            sources=["i2ctumodule.c", "../i2ctu.c"],
+            include_dirs=[".."],
+            extra_compile_args=["-std=gnu99"] + pkgconfig("--cflags"),
+            extra_link_args=pkgconfig("--libs"),
+        )
+    ],
+)
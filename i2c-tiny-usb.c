@@ -4,9 +4,10 @@
  * A simple USB attached I2C adapter which supports the same USB commands as
  * https://github.com/harbaum/I2C-Tiny-USB/ and https://fischl.de/i2c-mp-usb/.
  *
- * Based on LUFA's BulkVendor demo. Tested on ATmega32U4 but should work on any
- * xU4 device as it fits into 4K of Flash. xU2s don't have hardware I2C support
- * so they don't work, sorry.
+ * Based on LUFA's BulkVendor demo. Tested on ATmega32U4, also builds for the
+ * ATmega32U6 and AT90USB64x/128x. The default build takes about 26K of Flash,
+ * too much for the 16K ATmega16U4. xU2s don't have hardware I2C support so
+ * they don't work, sorry.
  *
  * Author: Joachim Fenkes <github@dojoe.net>
  */
@@ -33,16 +34,43 @@
   this software.
 */
 
-#include <avr/io.h>
-#include <avr/wdt.h>
-#include <avr/power.h>
-#include <avr/interrupt.h>
-
-#include "Descriptors.h"
-
-#include <LUFA/Drivers/USB/USB.h>
-#include <LUFA/Platform/Platform.h>
-#include <LUFA/Drivers/Peripheral/TWI.h>
+#include "i2c-tiny-usb.h"
+#include "Lib/AlertMonitor.h"
+#include "Lib/Arena.h"
+#include "Lib/Bootloader.h"
+#include "Lib/BulkProtocol.h"
+#include "Lib/BusLabel.h"
+#include "Lib/BusRecovery.h"
+#include "Lib/BusSniffer.h"
+#include "Lib/ClockMeter.h"
+#include "Lib/Console.h"
+#include "Lib/EventQueue.h"
+#include "Lib/FifoDrain.h"
+#include "Lib/HostNotify.h"
+#include "Lib/HIDTransport.h"
+#include "Lib/MuxRoute.h"
+#include "Lib/PollEngine.h"
+#include "Lib/Prefetch.h"
+#include "Lib/RegCache.h"
+#include "Lib/Probe.h"
+#include "Lib/RemoteWakeup.h"
+#include "Lib/Script.h"
+#include "Lib/Settings.h"
+#include "Lib/SoftI2C.h"
+#include "Lib/SpeedAdapt.h"
+#include "Lib/SpeedScan.h"
+#include "Lib/SPIBridge.h"
+#include "Lib/StackMonitor.h"
+#include "Lib/Stats.h"
+#include "Lib/SyncLine.h"
+#include "Lib/TargetConfig.h"
+#include "Lib/TargetEmu.h"
+#include "Lib/Trace.h"
+#include "Lib/TWIBus.h"
+#include "Lib/Timebase.h"
+#include "Lib/TWIEngine.h"
+#include "Lib/UartBridge.h"
+#include "Lib/Watchdog.h"
 
 // Cheap LED abstraction for error signalling.
 // Disabled by default, feel free to enable and adapt to your hardware.
@@ -76,49 +104,323 @@ static inline void LED_Init(void)
 
 // Main USB-I2C code
 
-#define CMD_ECHO             0
-#define CMD_GET_FUNC         1
-#define CMD_SET_DELAY        2
-#define CMD_GET_STATUS       3
-#define CMD_I2C_IO           4
-#define CMD_I2C_IO_BEGIN     1
-#define CMD_I2C_IO_END       2
-#define CMD_START_BOOTLOADER 0x10
-#define CMD_SET_BAUDRATE     0x11
+uint8_t I2C_BusOwner = BUS_OWNER_NONE;
+uint8_t I2C_Options = 0;
+uint32_t I2C_Speed;
+uint8_t I2C_StartTimeoutMs = I2C_START_TIMEOUT_MS;
+uint8_t I2C_StretchTimeoutMs = I2C_STRETCH_TIMEOUT_MS;
+volatile uint8_t I2C_AltSetting = VENDOR_ALT_CONTROL;
+uint16_t I2C_ConfigGeneration;
+
+// Round of the main loop services: the service taking its turn, and the packets each has left this turn,
+// negative for a service that has overrun its budget
+uint8_t Sched_Current;
+int16_t Sched_Deficit[SCHED_SERVICES];
+static uint8_t Sched_Weights[SCHED_SERVICES];
+
+// Identifies the power-up CMD_GET_CONFIG reports on; a host's cached configuration is stale after a new one, but a
+// USB reset alone keeps it
+static uint16_t I2C_BootId;
+
+static const I2C_FuncInfo_t PROGMEM I2C_FuncInfo = {
+	.Functionality = I2C_FUNC_I2C | I2C_FUNC_10BIT_ADDR | I2C_FUNC_SMBUS_EMUL,
+	.Extensions    = FUNC_EXT_INLINE_STATUS | FUNC_EXT_LOOPBACK | FUNC_EXT_GET_BAUDRATE |
+	                 (STATS_SUPPORT ? FUNC_EXT_STATS : 0) | FUNC_EXT_BULK | FUNC_EXT_BATCH | FUNC_EXT_POLL |
+	                 FUNC_EXT_SCAN | FUNC_EXT_SMBUS | FUNC_EXT_STRETCH | FUNC_EXT_TARGET | FUNC_EXT_RETRY |
+	                 FUNC_EXT_REGREAD | (HID_SUPPORT ? 0 : FUNC_EXT_EVENTS | FUNC_EXT_ALERT) | (TRACE_SUPPORT ? FUNC_EXT_TRACE : 0) |
+	                 FUNC_EXT_CACHE | FUNC_EXT_REGWRITE | FUNC_EXT_READ_LONG | (FIFO_SUPPORT ? FUNC_EXT_FIFO : 0) |
+	                 (SCRIPT_SUPPORT ? FUNC_EXT_SCRIPT : 0) | FUNC_EXT_SETTINGS | FUNC_EXT_LABEL |
+	                 FUNC_EXT_BATCH_DETAIL | FUNC_EXT_RECOVER_BUS | FUNC_EXT_BUS_LOCK | (HID_SUPPORT ? FUNC_EXT_HID : FUNC_EXT_ALT_BULK) |
+	                 (SOFTI2C_CHANNELS ? FUNC_EXT_SOFTI2C | ((uint32_t)SOFTI2C_CHANNELS << 24) : 0),
+	.MaxSpeedKHz   = F_CPU / 16 / 1000,
+	// Commands are parsed straight out of the endpoint banks, there is no other command queue
+	.CommandBuffer = VENDOR_IO_EPBANKS * VENDOR_IO_EPSIZE,
+	.Extensions2   = FUNC_EXT2_REGUPDATE | FUNC_EXT2_MULTIWRITE | FUNC_EXT2_GATHER | (MUX_SUPPORT ? FUNC_EXT2_MUX : 0) |
+	                  FUNC_EXT2_STREAM | FUNC_EXT2_BATCH_AT | FUNC_EXT2_POLL_FILTER |
+	                  FUNC_EXT2_POLL_REDUCE | FUNC_EXT2_POLL_COMPACT |
+	                  FUNC_EXT2_CHECKSUM | FUNC_EXT2_PROGRAM | (SNIFF_SUPPORT ? FUNC_EXT2_SNIFF : 0) |
+	                  (EMU_SUPPORT ? FUNC_EXT2_EMULATE : 0) | FUNC_EXT2_TEN_BIT | (UART_SUPPORT ? FUNC_EXT2_UART : 0) |
+	                  FUNC_EXT2_GPIO | (SPEED_SCAN_SUPPORT ? FUNC_EXT2_SPEED_SCAN : 0) |
+	                  (SPEED_ADAPT_SUPPORT ? FUNC_EXT2_ADAPT : 0) | (CLOCK_METER_SUPPORT ? FUNC_EXT2_CLOCK_METER : 0) |
+	                  FUNC_EXT2_BOOTLOADER | FUNC_EXT2_MEMORY | (STATS_SUPPORT ? FUNC_EXT2_LATENCY | FUNC_EXT2_ADDR_STATS : 0) |
+	                  FUNC_EXT2_CONFIG | FUNC_EXT2_WAKEUP | FUNC_EXT2_VERIFY | FUNC_EXT2_ON_FAIL | FUNC_EXT2_CANCEL |
+	                  (SOFTI2C_CHANNELS ? 0 : FUNC_EXT2_SPI | ((uint32_t)SPI_CS_LINES << 28)),
+	.Extensions3   = FUNC_EXT3_DEADLINE | FUNC_EXT3_TAG | FUNC_EXT3_WRITE_LONG | FUNC_EXT3_HOST_NOTIFY |
+	                 FUNC_EXT3_PMBUS | FUNC_EXT3_EEPROM_BLOCKS | FUNC_EXT3_SCATTER | (PREFETCH_SUPPORT ? FUNC_EXT3_PREFETCH : 0) |
+	                 FUNC_EXT3_POST | FUNC_EXT3_SCHED | FUNC_EXT3_SYNC | FUNC_EXT3_QUIET |
+	                 (ISO_SUPPORT ? FUNC_EXT3_ISO : 0) | FUNC_EXT3_STAMPS | (EMU_SUPPORT ? FUNC_EXT3_EMU_RANGE : 0) |
+	                 (SOFTI2C_CHANNELS ? FUNC_EXT3_EEPROM_GANG : 0),
+};
+
+static uint8_t Loopback_Buffer[LOOPBACK_SIZE];
+static uint8_t Loopback_Index;
+
+// Set while the TWI clock is gated for a USB suspend
+static uint8_t I2C_PoweredDown;
 
-#define I2C_M_RD   1
+// Set by the USB interrupt for a request that Control_Task() is to carry out
+static volatile uint8_t Control_JobPending;
 
-#define STATUS_IDLE 0
-#define STATUS_ADDRESS_ACK 1
-#define STATUS_ADDRESS_NAK 2
+// When the SETUP packet of that request came in, for the latency histograms
+static Stats_Stamp_t Control_JobStart;
 
-uint8_t I2C_Status = STATUS_IDLE;
+// Frames since the bulk endpoint last had something for us, saturating; the main loop sleeps once it's high enough
+static volatile uint8_t Idle_Frames;
 
-void SetupI2CSpeed(uint16_t khz)
+// Claim the bus for a START; fails if another protocol is in the middle of a transaction.
+// The paths take turns in the main loop, but a transaction may span several turns.
+bool I2C_ClaimBus(uint8_t owner)
 {
-	const uint16_t F_CPU_KHZ = F_CPU / 1000;
-	uint8_t prescaler = 0;
-	uint16_t bit_rate;
+	uint_reg_t CurrentGlobalInt = GetGlobalInterruptMask();
+	GlobalInterruptDisable();
 
-	// Try to find the smallest prescaler that yields a bitrate value which fits the TWBR register.
-	while (1) {
-		bit_rate = ((( (F_CPU_KHZ >> (prescaler << 1)) / khz) - 16) >> 1);
-		if (bit_rate < 256 || prescaler == 3) {
-			TWI_Init(prescaler, bit_rate);
-			return;
+	// A free bus may still be answering a Host Notify as a target
+	bool claimed = ((I2C_BusOwner == BUS_OWNER_NONE) && Notify_Yield()) || (I2C_BusOwner == owner);
+	if (claimed)
+		I2C_BusOwner = owner;
+
+	SetGlobalInterruptMask(CurrentGlobalInt);
+	return claimed;
+}
+
+void I2C_ReleaseBus(void)
+{
+	// Whoever held the bus is done with it, whether or not a STOP went out
+	Stats_BusEvent(STATS_BUS_Stop);
+	I2C_BusOwner = BUS_OWNER_NONE;
+}
+
+// Stall the current control request, counted for CMD_GET_STATS
+static void Control_Stall(void)
+{
+	Stats_Count(&Stats.ControlStalls);
+	Endpoint_StallTransaction();
+}
+
+// Clock settings for the common bit rates, worked out by the compiler. With rounding towards the slower side,
+// the smallest prescaler that lets TWBR fit is also the most accurate one.
+#define I2C_PERIOD(khz)       ((F_CPU + (khz) * 1000UL - 1) / ((khz) * 1000UL))
+#define I2C_STEP(ps)          (2UL << ((ps) << 1))
+#define I2C_TWBR(khz, ps)     ((I2C_PERIOD(khz) > 16) ? (I2C_PERIOD(khz) - 16 + I2C_STEP(ps) - 1) / I2C_STEP(ps) : 0)
+#define I2C_PRESCALER(khz)    ((I2C_TWBR(khz, 0) < 256) ? 0 : (I2C_TWBR(khz, 1) < 256) ? 1 : (I2C_TWBR(khz, 2) < 256) ? 2 : 3)
+#define I2C_BITRATE(khz)      ((I2C_TWBR(khz, I2C_PRESCALER(khz)) < 256) ? I2C_TWBR(khz, I2C_PRESCALER(khz)) : 255)
+#define I2C_SPEED_ENTRY(khz)  { (khz), I2C_PRESCALER(khz), I2C_BITRATE(khz), \
+                                F_CPU / (16 + I2C_BITRATE(khz) * I2C_STEP(I2C_PRESCALER(khz))) }
+
+typedef struct
+{
+	uint16_t khz;
+	uint8_t  prescaler;
+	uint8_t  bit_rate;
+	uint32_t speed;
+} I2C_SpeedEntry_t;
+
+static const I2C_SpeedEntry_t I2C_SpeedTable[] PROGMEM = {
+	I2C_SPEED_ENTRY(10),
+	I2C_SPEED_ENTRY(20),
+	I2C_SPEED_ENTRY(50),
+	I2C_SPEED_ENTRY(100),
+	I2C_SPEED_ENTRY(200),
+	I2C_SPEED_ENTRY(400),
+	I2C_SPEED_ENTRY(1000),
+};
+
+// SCL = F_CPU / (16 + 2 * TWBR * 4^prescaler); common rates come from the table above, for anything else
+// go through all prescalers and pick the pair that gets closest to the requested rate. Rounding is towards
+// the slower side so targets aren't overclocked, only requests beyond F_CPU / 16 end up faster than asked for.
+// Returns the rate achieved in Hz, the register values go to *prescaler and *bit_rate.
+uint32_t I2C_CalcSpeed(uint16_t khz, uint8_t* prescaler_out, uint8_t* bit_rate_out)
+{
+	for (uint8_t i = 0; i < (sizeof(I2C_SpeedTable) / sizeof(I2C_SpeedTable[0])); i++) {
+		const I2C_SpeedEntry_t* entry = &I2C_SpeedTable[i];
+		if (pgm_read_word(&entry->khz) == khz) {
+			*prescaler_out = pgm_read_byte(&entry->prescaler);
+			*bit_rate_out  = pgm_read_byte(&entry->bit_rate);
+			return pgm_read_dword(&entry->speed);
+		}
+	}
+
+	const uint32_t target = (uint32_t)(khz ? khz : 1) * 1000;
+	const uint32_t period = (F_CPU + target - 1) / target;
+	uint32_t best_speed = 0;
+	uint32_t best_error = UINT32_MAX;
+
+	for (uint8_t prescaler = 0; prescaler < 4; prescaler++) {
+		const uint16_t step = 2 << (prescaler << 1);
+		uint32_t bit_rate = (period > 16) ? (period - 16 + step - 1) / step : 0;
+		if (bit_rate > 255)
+			bit_rate = 255;
+
+		const uint32_t speed = F_CPU / (16 + bit_rate * step);
+		const uint32_t error = (speed > target) ? (speed - target) : (target - speed);
+		if (error < best_error) {
+			best_error = error;
+			best_speed = speed;
+			*prescaler_out = prescaler;
+			*bit_rate_out  = bit_rate;
+		}
+	}
+
+	return best_speed;
+}
+
+// Sets the bus speed used for all targets without an entry of their own in the target table.
+// Returns the rate actually achieved in Hz.
+uint32_t SetupI2CSpeed(uint16_t khz)
+{
+	I2C_Speed = I2C_CalcSpeed(khz, &TargetConfig_Default.Prescaler, &TargetConfig_Default.BitRate);
+	TWI_Init(TargetConfig_Default.Prescaler, TargetConfig_Default.BitRate);
+	I2C_ConfigGeneration++;
+	return I2C_Speed;
+}
+
+// Gates the TWI clock for a suspend, unless a transaction is open and the TWI must keep its state
+static void I2C_PowerDown(void)
+{
+	if ((I2C_BusOwner == BUS_OWNER_NONE) && !TWIEngine_IsBusy()) {
+		power_twi_disable();
+		I2C_PoweredDown = true;
+	}
+}
+
+// Ungates the TWI clock after a suspend and brings back the speed last set through SetupI2CSpeed; the TWI has to
+// be initialized again after being powered down
+static void I2C_PowerUp(void)
+{
+	if (I2C_PoweredDown) {
+		power_twi_enable();
+		TWI_Init(TargetConfig_Default.Prescaler, TargetConfig_Default.BitRate);
+		I2C_PoweredDown = false;
+	}
+}
+
+// The START and address phase is handed to the TWI engine as soon as the SETUP packet is in, so it runs while the
+// host sends the data stage. Its outcome is only collected once the first data byte needs to go out or come in.
+static uint8_t I2C_StartPending;
+
+static void I2C_LaunchStart(const uint16_t address)
+{
+	// Don't cut short the STOP of the previous transaction
+	TWIBus_WaitStop();
+	TWIEngine_Start(address);
+	I2C_StartPending = true;
+}
+
+// Waits for a START launched by I2C_LaunchStart, if any, and updates I2C_Status.
+// @return true if I2C accesses must be skipped because there is no addressed target
+static uint8_t I2C_FinishStart(void)
+{
+	if (I2C_StartPending) {
+		I2C_StartPending = false;
+
+		const uint16_t start_start = Stats_Timestamp();
+		const uint8_t result = TWIEngine_Wait(I2C_StartTimeoutMs);
+		Stats_AddTime(&Stats.StartTicks, start_start);
+
+		if (result == TWI_ERROR_BusCaptureTimeout)
+			Stats_Count(&Stats.CaptureTimeouts);
+		else if (result != TWI_ERROR_NoError)
+			Stats_Count(&Stats.AddressNAKs);
+
+		if (result) {
+			I2C_Status = STATUS_ADDRESS_NAK;
+			LED_on();
+		} else {
+			I2C_Status = STATUS_ADDRESS_ACK;
+			LED_off();
 		}
-		prescaler++;
 	}
+
+	return (I2C_Status != STATUS_ADDRESS_ACK);
+}
+
+// Waits for the byte in flight to go out. A target holding the clock for longer than I2C_StretchTimeoutMs is
+// given up on: the TWI module is reset to let go of the bus and the transaction fails with STATUS_STRETCH_TIMEOUT.
+// @return true if the bus is ready for the next byte
+static bool ATTR_HOT_PATH I2C_WaitTWINT(void)
+{
+	const uint16_t started = Timebase_Now();
+
+	// Only the stretch timeout bounds the wait, a long transfer of slow bytes is no hang
+	Watchdog_Kick();
+	Probe_On(PROBE_TWINT);
+	while (!TWIBus_IsReady()) {
+		if (Timebase_Elapsed(started) >= Timebase_MsToTicks(I2C_StretchTimeoutMs)) {
+			TWIBus_Abort();
+			I2C_Status = STATUS_STRETCH_TIMEOUT;
+			LED_on();
+			Trace_Add(TRACE_TIMEOUT, 0);
+			Probe_Off(PROBE_TWINT);
+			AddrStats_Timeout();
+			return false;
+		}
+	}
+	Probe_Off(PROBE_TWINT);
+	AddrStats_Wait(started);
+
+	return true;
+}
+
+// Sends a register pointer of len bytes, MSB first, after an ACKed address. A NACKed pointer ends the transaction.
+// @return true if the target took the pointer and the bus is ready for a repeated START
+static bool I2C_WriteRegister(const uint16_t reg, uint8_t len)
+{
+	AddrStats_Written(len);
+	while (len--) {
+		if (!I2C_WaitTWINT())
+			return false;
+		TWIBus_PutByte(reg >> (len << 3));
+	}
+
+	if (!I2C_WaitTWINT())
+		return false;
+
+	if (TWIBus_Status() != TW_MT_DATA_ACK) {
+		TWIBus_Stop();
+		I2C_Status = STATUS_ADDRESS_NAK;
+		LED_on();
+		return false;
+	}
+
+	return true;
+}
+
+// Hands count bytes of the OUT bank to the bus. If the target holds the clock for too long the rest of the packet is
+// left for Endpoint_ClearOUT() to drop, and I2C_Status has I2C_FinishStart() skip the packets after it.
+static inline void I2C_WritePacket(uint8_t count) ATTR_ALWAYS_INLINE;
+static inline void I2C_WritePacket(uint8_t count)
+{
+	while (count--) {
+		const uint8_t value = Endpoint_Read_8();
+		if (!I2C_WaitTWINT())
+			return;
+		TWIBus_PutByte(value);
+	}
+}
+
+// Stores count bytes of the OUT bank in the loopback buffer.
+static inline void I2C_WriteLoopback(uint8_t count) ATTR_ALWAYS_INLINE;
+static inline void I2C_WriteLoopback(uint8_t count)
+{
+	while (count--)
+		Loopback_Buffer[Loopback_Index++ % LOOPBACK_SIZE] = Endpoint_Read_8();
 }
 
 // Adapted from Endpoint_Read_Control_Stream_LE with I2C access sprinkled in
-// @param skip Omit I2C accesses, just drain the stream.
-uint8_t I2C_Write(uint8_t skip)
+// I2C accesses are skipped and the stream just drained if there is no addressed target. Each packet goes through
+// the loop for its mode, so the per-byte loops don't test for it; a drained packet isn't even read, clearing the
+// bank drops it.
+// @param stall_on_error STALL the status stage if the target wasn't addressed, so the host sees the error right away.
+uint8_t ATTR_HOT_PATH I2C_Write(uint8_t stall_on_error)
 {
+	const uint8_t loopback = I2C_Options & OPTION_LOOPBACK;
 	uint16_t len = USB_ControlRequest.wLength;
+	uint16_t waited = Stats_Timestamp();
 
 	if (!len)
 		Endpoint_ClearOUT();
+	else if (!loopback)
+		Trace_AddCount(TRACE_WRITE, len);
 
 	while (len) {
 		uint8_t USB_DeviceState_LCL = USB_DeviceState;
@@ -131,55 +433,116 @@ uint8_t I2C_Write(uint8_t skip)
 			return ENDPOINT_RWCSTREAM_HostAborted;
 
 		if (Endpoint_IsOUTReceived()) {
-			while (len && Endpoint_BytesInEndpoint()) {
-				uint8_t value = Endpoint_Read_8();
-				if (!skip) {
-					while (!(TWCR & (1 << TWINT)));
-					TWDR = value;
-					TWCR = (1 << TWINT) | (1 << TWEN);
-				}
-				len--;
+			uint8_t count = Endpoint_BytesInEndpoint();
+			if (count > len)
+				count = len;
+			len -= count;
+			Stats_AddTime(&Stats.UsbWaitTicks, waited);
+
+			if (loopback) {
+				I2C_WriteLoopback(count);
+			} else if (!I2C_FinishStart()) {
+				Stats_BusEvent(STATS_BUS_Resume);
+				AddrStats_Written(count);
+				I2C_WritePacket(count);
+				// SCL is held low after the last byte until the next packet is in
+				if (len)
+					Stats_BusEvent(STATS_BUS_Hold);
 			}
 			Endpoint_ClearOUT();
+			Stats_Count(&Stats.UsbPackets);
+			Probe_Toggle(PROBE_ENDPOINT);
+			waited = Stats_Timestamp();
 		}
 	}
-	while (!skip && !(TWCR & (1 << TWINT)));
+	uint8_t skip = I2C_FinishStart();
+	if (!skip && !loopback)
+		skip = !I2C_WaitTWINT();
 
+	waited = Stats_Timestamp();
 	while (!Endpoint_IsINReady()) {
 		uint8_t USB_DeviceState_LCL = USB_DeviceState;
 
+		Watchdog_Kick();
 		if (USB_DeviceState_LCL == DEVICE_STATE_Unattached)
 			return ENDPOINT_RWCSTREAM_DeviceDisconnected;
 		else if (USB_DeviceState_LCL == DEVICE_STATE_Suspended)
 			return ENDPOINT_RWCSTREAM_BusSuspended;
 	}
-	Endpoint_ClearIN();
+	Stats_AddTime(&Stats.UsbWaitTicks, waited);
+	if (stall_on_error && skip)
+		Control_Stall();
+	else
+		Endpoint_ClearIN();
 
 	return 0;
 }
 
-static void I2C_Read_StartNext(uint8_t nack_last_byte, uint16_t remaining_bytes)
+// Sends count bytes clocked in by the TWI engine, copying them to cache_data too unless that is NULL.
+// @return cache_data advanced past the bytes copied
+static inline uint8_t* I2C_ReadPacket(uint8_t count, uint8_t* cache_data) ATTR_ALWAYS_INLINE;
+static inline uint8_t* I2C_ReadPacket(uint8_t count, uint8_t* cache_data)
 {
-	if (nack_last_byte && remaining_bytes == 1)
-		TWCR = (1 << TWINT) | (1 << TWEN);
-	else
-		TWCR = (1 << TWINT) | (1 << TWEN) | (1 << TWEA);
+	while (count--) {
+		uint8_t value = 0;
+
+		// If the engine gave up on a bus fault or a stuck clock, the rest reads as zeros
+		if (!TWIEngine_WaitFor(TWI_EVENT_RxData)) {
+			I2C_Status = STATUS_STRETCH_TIMEOUT;
+			LED_on();
+		}
+		if (!RingBuffer_IsEmpty(&TWIEngine_RxRing)) {
+			value = RingBuffer_Remove(&TWIEngine_RxRing);
+			TWIEngine_Kick();
+		}
+		if (cache_data)
+			*cache_data++ = value;
+
+		Endpoint_Write_8(value);
+	}
+
+	return cache_data;
+}
+
+// Sends count bytes from data, which is the register cache or the loopback buffer. Without a target it is NULL and
+// zeros go out instead.
+static inline void I2C_ReadCopy(uint8_t count, const uint8_t* data) ATTR_ALWAYS_INLINE;
+static inline void I2C_ReadCopy(uint8_t count, const uint8_t* data)
+{
+	if (!data) {
+		while (count--)
+			Endpoint_Write_8(0);
+	} else {
+		while (count--)
+			Endpoint_Write_8(*data++);
+	}
 }
 
 // Adapted from Endpoint_Write_Control_Stream_LE with I2C access sprinkled in
+// The TWI engine clocks the data into its RX ring, so reception carries on while the host collects the previous
+// packet and the bus only has to wait once the ring is full.
+// I2C accesses are skipped and zeros returned if there is no addressed target.
+// Unlike Endpoint_Write_Control_Stream_LE we always return exactly wLength bytes, so the data stage never needs
+// to be terminated by a zero length packet, whether wLength is a multiple of the endpoint size or not.
 // @param nack_last_byte Respond to the last incoming byte with NACK instead of ACK
-// @param skip Omit I2C accesses, just drain the stream.
-uint8_t I2C_Read(uint8_t nack_last_byte, uint8_t skip)
+// @param append_status Send I2C_Status as the last byte of the data stage instead of another data byte.
+// @param cached Data to send instead of touching the bus, from the register cache or the prefetch buffer, or NULL
+// @param cache_data Where the data read is copied to as well, an empty register cache entry, or NULL
+uint8_t ATTR_HOT_PATH I2C_Read(uint8_t nack_last_byte, uint8_t append_status, const uint8_t* cached,
+                               uint8_t* cache_data)
 {
+	const uint8_t loopback = I2C_Options & OPTION_LOOPBACK;
+	const uint8_t skip = I2C_FinishStart();
 	uint16_t len = USB_ControlRequest.wLength;
-	uint8_t last_full = false;
+	uint16_t i2c_len = (append_status && len) ? len - 1 : len;
+	uint16_t waited = Stats_Timestamp();
 
 	if (!len)
 		Endpoint_ClearIN();
-	else if (!skip)
-		I2C_Read_StartNext(nack_last_byte, len);
+	else if (!skip && !loopback && !cached)
+		TWIEngine_Read(i2c_len, nack_last_byte);
 
-	while (len || last_full) {
+	while (len) {
 		uint8_t USB_DeviceState_LCL = USB_DeviceState;
 
 		if (USB_DeviceState_LCL == DEVICE_STATE_Unattached)
@@ -192,29 +555,42 @@ uint8_t I2C_Read(uint8_t nack_last_byte, uint8_t skip)
 			break;
 
 		if (Endpoint_IsINReady()) {
-			uint8_t nbytes = Endpoint_BytesInEndpoint();
-			while (len && (nbytes < USB_Device_ControlEndpointSize)) {
-				len--;
-
-				uint8_t value = 0;
-				if (!skip) {
-					while (!(TWCR & (1 << TWINT)));
-					value = TWDR;
-					if (len)
-						I2C_Read_StartNext(nack_last_byte, len);
-				}
+			uint8_t count = USB_Device_ControlEndpointSize - Endpoint_BytesInEndpoint();
+			if (count > len)
+				count = len;
+			len -= count;
+			Stats_AddTime(&Stats.UsbWaitTicks, waited);
+
+			// The data bytes of this packet, then the status byte if that's what is left
+			uint8_t data = (count > i2c_len) ? i2c_len : count;
+			i2c_len -= data;
 
-				Endpoint_Write_8(value);
-				nbytes++;
+			if (cached) {
+				I2C_ReadCopy(data, cached);
+				cached += data;
+			} else if (loopback) {
+				while (data--)
+					Endpoint_Write_8(Loopback_Buffer[Loopback_Index++ % LOOPBACK_SIZE]);
+			} else if (skip) {
+				I2C_ReadCopy(data, NULL);
+			} else {
+				cache_data = I2C_ReadPacket(data, cache_data);
 			}
-			last_full = (nbytes == USB_Device_ControlEndpointSize);
+
+			if (count != data)
+				Endpoint_Write_8(I2C_Status);
 			Endpoint_ClearIN();
+			Stats_Count(&Stats.UsbPackets);
+			Probe_Toggle(PROBE_ENDPOINT);
+			waited = Stats_Timestamp();
 		}
 	}
 
+	waited = Stats_Timestamp();
 	while (!Endpoint_IsOUTReceived()) {
 		uint8_t USB_DeviceState_LCL = USB_DeviceState;
 
+		Watchdog_Kick();
 		if (USB_DeviceState_LCL == DEVICE_STATE_Unattached)
 		  return ENDPOINT_RWCSTREAM_DeviceDisconnected;
 		else if (USB_DeviceState_LCL == DEVICE_STATE_Suspended)
@@ -222,98 +598,1045 @@ uint8_t I2C_Read(uint8_t nack_last_byte, uint8_t skip)
 		else if (Endpoint_IsSETUPReceived())
 		  return ENDPOINT_RWCSTREAM_HostAborted;
 	}
+	Stats_AddTime(&Stats.UsbWaitTicks, waited);
 	Endpoint_ClearOUT();
 
 	return 0;
 }
 
+/** Probes all non-reserved addresses and sets a bit in the bitmap for each one that ACKs. Read probes also clock in
+ *  (and NACK) one byte, for targets that don't like being addressed for a write. The caller owns the bus.
+ *  @return false if the bus could not be used at all
+ */
+bool I2C_Scan(uint8_t* const bitmap, const uint8_t read)
+{
+	bool ok = true;
+
+	memset(bitmap, 0, SCAN_BITMAP_SIZE);
+
+	for (uint8_t address = SCAN_FIRST_ADDRESS; address <= SCAN_LAST_ADDRESS; address++) {
+		TWIBus_WaitStop();
+
+		TWIEngine_Start((address << 1) | read);
+		const uint8_t result = TWIEngine_Wait(I2C_StartTimeoutMs);
+
+		// No use trying the other addresses on a stuck or busy bus
+		if ((result != TWI_ERROR_NoError) && (result != TWI_ERROR_SlaveNotReady)) {
+			ok = false;
+			break;
+		}
+
+		// A NACKed address has already been followed by a STOP from the engine
+		if (result == TWI_ERROR_SlaveNotReady)
+			continue;
+
+		bitmap[address >> 3] |= (1 << (address & 7));
+
+		if (read) {
+			TWIEngine_Read(1, true);
+			TWIEngine_Wait(I2C_StartTimeoutMs);
+		}
+		TWIBus_Stop();
+	}
+
+	TWIBus_WaitStop();
+	TWIEngine_Reset();
+	return ok;
+}
+
+// Common tail of all requests doing bus I/O: clean up after an aborted data stage, then send the STOP if asked
+// to and we are still holding the bus. A data stage the host cut short (error is an ENDPOINT_RWCSTREAM_* code)
+// ends a transaction we hold as well, the host won't carry on with it; leaving the bus held would only make the
+// next START wait for its timeout.
+static void I2C_EndRequest(uint8_t stop, const uint8_t error, const uint16_t request_start)
+{
+	if (error) {
+		Stats_Count(&Stats.HostAborts);
+		Trace_Add(TRACE_ABORT, error);
+		if (I2C_BusOwner == BUS_OWNER_CONTROL)
+			stop = true;
+	}
+
+	// The host may have bailed out before we got around to collecting the START, or in the middle of a read,
+	// which then ends with a NACKed byte
+	const uint8_t skip_and_exit = I2C_FinishStart();
+	if (TWIEngine_IsBusy())
+		TWIEngine_Cancel();
+
+	// A write the host walked away from may still have a byte on its way
+	if (stop && !skip_and_exit && !(I2C_Options & OPTION_LOOPBACK) && I2C_WaitTWINT()) {
+		TWIBus_Stop();
+	}
+	if (stop && (I2C_BusOwner == BUS_OWNER_CONTROL))
+		I2C_ReleaseBus();
+
+	Stats_RequestDone(request_start);
+}
+
+// Carries out a control request doing bus I/O, whose SETUP packet has already been cleared by the USB interrupt
+static void I2C_ControlJob(void)
+{
+	Trace_Add(TRACE_REQUEST, USB_ControlRequest.bRequest);
+
+	switch (USB_ControlRequest.bRequest) {
+		case CMD_I2C_IO:
+		case CMD_I2C_IO | CMD_I2C_IO_BEGIN:
+		case CMD_I2C_IO | CMD_I2C_IO_END:
+		case CMD_I2C_IO | CMD_I2C_IO_BEGIN | CMD_I2C_IO_END:
+		{
+			const uint16_t request_start = Stats_Timestamp();
+			const uint8_t start = USB_ControlRequest.bRequest & CMD_I2C_IO_BEGIN;
+
+			Stats_BootStamp(&Stats.BootFirstIoTicks);
+			const uint8_t stop = USB_ControlRequest.bRequest & CMD_I2C_IO_END;
+			const uint8_t read = USB_ControlRequest.wValue & I2C_M_RD;
+
+			if (start && (I2C_Options & OPTION_LOOPBACK)) {
+				// Pretend everybody is home; every START rewinds the buffer so a read returns what the last write wrote
+				Loopback_Index = 0;
+				I2C_Status = STATUS_ADDRESS_ACK;
+			} else if (start) {
+				if (!I2C_ClaimBus(BUS_OWNER_CONTROL)) {
+					// The bulk path is mid-transaction and cannot make progress until we return to the main loop
+					I2C_Status = STATUS_BUS_BUSY;
+				} else if (USB_ControlRequest.wValue & I2C_M_TEN) {
+					I2C_LaunchStart(TWI_ENGINE_TEN(USB_ControlRequest.wIndex & 0x3FF, read));
+				} else {
+					// wIndex is the 7-bit address like in struct i2c_msg
+					I2C_LaunchStart((USB_ControlRequest.wIndex << 1) | read);
+				}
+			}
+
+			// In case of error we complete the request but skip the I2C accesses
+			const uint8_t inline_status = I2C_Options & OPTION_INLINE_STATUS;
+			const uint16_t transfer_start = Stats_Timestamp();
+			uint8_t error;
+			if (read) {
+				Probe_On(PROBE_READ);
+				error = I2C_Read(stop, inline_status, NULL, NULL);
+				Probe_Off(PROBE_READ);
+			} else {
+				Probe_On(PROBE_WRITE);
+				error = I2C_Write(inline_status);
+				Probe_Off(PROBE_WRITE);
+			}
+			Stats_AddTime(&Stats.TransferTicks, transfer_start);
+
+			I2C_EndRequest(stop, error, request_start);
+			Stats_LatencyDone(read ? STATS_LATENCY_IoRead : STATS_LATENCY_IoWrite, Control_JobStart);
+		}
+		break;
+
+		case CMD_I2C_REGREAD:
+		{
+			// Register read in one go: wIndex low byte is the 7-bit address and the high byte the pointer width
+			// (0 or 1 for one byte, 2 for a 16-bit pointer), wValue the pointer and wLength the read length
+			const uint16_t request_start = Stats_Timestamp();
+			const uint8_t address = USB_ControlRequest.wIndex & 0x7F;
+			const uint8_t reg_len = (USB_ControlRequest.wIndex >> 8) > 1 ? 2 : 1;
+			const uint8_t inline_status = I2C_Options & OPTION_INLINE_STATUS;
+			const uint16_t read_len = USB_ControlRequest.wLength - (inline_status && USB_ControlRequest.wLength);
+
+			// A range in the register cache never gets prefetched, it doesn't need to be
+			RegCache_Entry_t* cache = NULL;
+			const uint8_t* cached = NULL;
+			if (!(I2C_Options & OPTION_LOOPBACK)) {
+				cache = RegCache_Lookup(address, USB_ControlRequest.wValue, read_len);
+				if (!cache)
+					cached = Prefetch_Lookup(address, reg_len, USB_ControlRequest.wValue, read_len);
+				else if (cache->Valid)
+					cached = cache->Data;
+			}
+
+			if (I2C_Options & OPTION_LOOPBACK) {
+				Loopback_Index = USB_ControlRequest.wValue;
+				I2C_Status = STATUS_ADDRESS_ACK;
+			} else if (cached) {
+				// Answered from RAM, the bus is left alone
+				I2C_Status = STATUS_ADDRESS_ACK;
+			} else if (!I2C_ClaimBus(BUS_OWNER_CONTROL)) {
+				I2C_Status = STATUS_BUS_BUSY;
+			} else {
+				// The pointer write is short, so unlike CMD_I2C_IO there's no point overlapping it with USB
+				I2C_LaunchStart(address << 1);
+				if (!I2C_FinishStart() && I2C_WriteRegister(USB_ControlRequest.wValue, reg_len))
+					I2C_LaunchStart((address << 1) | I2C_M_RD);
+			}
+
+			const uint16_t transfer_start = Stats_Timestamp();
+			Probe_On(PROBE_READ);
+			const uint8_t error = I2C_Read(true, inline_status, cached, (cache && !cached) ? cache->Data : NULL);
+			Probe_Off(PROBE_READ);
+			Stats_AddTime(&Stats.TransferTicks, transfer_start);
+
+			// A complete read from a target that answered fills a cache entry waiting for its data, or has the
+			// block after it read ahead
+			if (!error && (I2C_Status == STATUS_ADDRESS_ACK) && !(I2C_Options & OPTION_LOOPBACK)) {
+				if (cache)
+					cache->Valid = true;
+				else
+					Prefetch_Done(address, reg_len, USB_ControlRequest.wValue, read_len);
+			}
+
+			I2C_EndRequest(!cached, error, request_start);
+			Stats_LatencyDone(STATS_LATENCY_IoRead, Control_JobStart);
+		}
+		break;
+
+		case CMD_SCAN:
+		{
+			uint8_t bitmap[SCAN_BITMAP_SIZE];
+
+			// STALL the data stage if the bus isn't free
+			if ((I2C_BusOwner == BUS_OWNER_CONTROL) || !I2C_ClaimBus(BUS_OWNER_CONTROL)) {
+				Control_Stall();
+				break;
+			}
+
+			const bool ok = I2C_Scan(bitmap, USB_ControlRequest.wValue & I2C_M_RD);
+			I2C_ReleaseBus();
+			if (!ok) {
+				Control_Stall();
+				break;
+			}
+
+			Endpoint_Write_Control_Stream_LE(bitmap, sizeof(bitmap));
+			Endpoint_ClearOUT();
+			Stats_LatencyDone(STATS_LATENCY_Scan, Control_JobStart);
+		}
+		break;
+
+		case CMD_RECOVER_BUS:
+		{
+			// A CMD_I2C_IO transaction the host never finished is what this is for, so it doesn't count as busy
+			uint8_t response[2] = {BUS_RECOVERY_BUSY, 0};
+
+			if ((I2C_BusOwner == BUS_OWNER_CONTROL) || I2C_ClaimBus(BUS_OWNER_CONTROL)) {
+				I2C_FinishStart();
+				response[0] = BusRecovery_Run(&response[1]);
+				I2C_Status = STATUS_IDLE;
+				I2C_ReleaseBus();
+			}
+
+			Endpoint_Write_Control_Stream_LE(response, MIN(sizeof(response), USB_ControlRequest.wLength));
+			Endpoint_ClearOUT();
+		}
+		break;
+
+#if SPEED_SCAN_SUPPORT
+		case CMD_SPEED_SCAN:
+		{
+			// wIndex low byte is the 7-bit address plus SPEED_SCAN_STORE and the high byte the register, wValue
+			// low byte the read length and the high byte the rounds per speed
+			uint8_t response[SPEED_SCAN_RESPONSE] = {SPEED_SCAN_BUSY};
+			uint8_t len = SPEED_SCAN_HEADER;
+
+			if ((I2C_BusOwner != BUS_OWNER_CONTROL) && I2C_ClaimBus(BUS_OWNER_CONTROL)) {
+				len = SpeedScan_Run(USB_ControlRequest.wIndex & 0xFF, USB_ControlRequest.wIndex >> 8,
+				                    USB_ControlRequest.wValue & 0xFF, USB_ControlRequest.wValue >> 8, response);
+				I2C_ReleaseBus();
+			}
+
+			Endpoint_Write_Control_Stream_LE(response, MIN(len, USB_ControlRequest.wLength));
+			Endpoint_ClearOUT();
+		}
+		break;
+#endif
+
+#if SCRIPT_SUPPORT
+		case CMD_SET_SCRIPT:
+			// Only the EEPROM slots end up here, see below
+			Script_Receive(USB_ControlRequest.wIndex, USB_ControlRequest.wLength);
+			Endpoint_ClearIN();
+			break;
+#endif
+
+		case CMD_START_BOOTLOADER:
+			// Doesn't return; from the main loop so the detach doesn't happen with the interrupt halfway through
+			Endpoint_ClearStatusStage();
+			Bootloader_Start();
+			break;
+
+		case CMD_CANCEL:
+		{
+			Bulk_Cancel_t report;
+
+			Bulk_Cancel(&report);
+			Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+			Endpoint_Write_Control_Stream_LE(&report, MIN(sizeof(report), USB_ControlRequest.wLength));
+			Endpoint_ClearOUT();
+		}
+		break;
+
+		case CMD_SAVE_SETTINGS:
+			Settings_Save(USB_ControlRequest.wValue);
+			Endpoint_ClearStatusStage();
+			break;
+
+		case CMD_SET_LABEL:
+		{
+			uint8_t label[LABEL_MAX_LENGTH];
+
+			Endpoint_Read_Control_Stream_LE(label, USB_ControlRequest.wLength);
+			Label_Set(label, USB_ControlRequest.wLength);
+			Endpoint_ClearIN();
+		}
+		break;
+
+#if SCRIPT_SUPPORT
+		case CMD_RUN_SCRIPT:
+		{
+			// wIndex is the slot, wValue the time limit in milliseconds
+			const uint16_t request_start = Stats_Timestamp();
+			uint8_t* const result = Arena_Alloc(SCRIPT_RESULT_BUFFER);
+			uint8_t len = SCRIPT_RESULT_HEADER;
+
+			if ((I2C_BusOwner == BUS_OWNER_CONTROL) || !I2C_ClaimBus(BUS_OWNER_CONTROL)) {
+				result[0] = SCRIPT_STATUS_BUS_BUSY;
+				result[1] = 0;
+			} else {
+				len = Script_Run(USB_ControlRequest.wIndex, USB_ControlRequest.wValue, result);
+				I2C_ReleaseBus();
+			}
+
+			Endpoint_Write_Control_Stream_LE(result, MIN(len, USB_ControlRequest.wLength));
+			Endpoint_ClearOUT();
+			Stats_RequestDone(request_start);
+		}
+		break;
+#endif
+	}
+
+	Trace_Add(TRACE_REQUEST_END, I2C_Status);
+}
+
+// Starts the vendor interface over in the given alternate setting. The settings share the endpoint addresses, so
+// the endpoints stay configured; they lose whatever is left in them and restart at DATA0 as SET_INTERFACE demands.
+// The jobs feeding them are dropped, and the polling job stored in EEPROM starts along with the bulk setting.
+static void I2C_SelectAltSetting(const uint8_t alt)
+{
+	static const uint8_t endpoints[] = {VENDOR_IN_EPADDR, VENDOR_OUT_EPADDR, VENDOR_EVENT_EPADDR,
+	                                    #if ISO_SUPPORT
+	                                    VENDOR_POLL_EPADDR,
+	                                    #endif
+	                                   };
+
+	I2C_AltSetting = alt;
+
+	for (uint8_t i = 0; i < sizeof(endpoints); i++) {
+		Endpoint_ResetEndpoint(endpoints[i]);
+		Endpoint_SelectEndpoint(endpoints[i]);
+		Endpoint_ClearStall();
+		Endpoint_ResetDataToggle();
+	}
+
+	Poll_Clear();
+	Events_Clear();
+	Alert_SetMode(0, 0);
+	Sync_SetMode(SYNC_MODE_OFF);
+	Fifo_Clear();
+	Sniff_Stop();
+	Emu_Stop();
+	Notify_SetEnabled(false);
+	SPIBridge_Stop();
+	Uart_Stop();
+
+	if (I2C_IsBulkActive())
+		Settings_Load(SETTINGS_POLL);
+}
+
 /** Event handler for the USB_ControlRequest event. This is used to catch and process control requests sent to
  *  the device from the USB host before passing along unhandled control requests to the library for processing
  *  internally.
  */
 void EVENT_USB_Device_ControlRequest(void)
 {
+	// Any new request supersedes a job the main loop hasn't picked up yet
+	Control_JobPending = false;
+	Bulk_RequestCancel(false);
+
+	// Windows asks for the descriptor set advertised in the BOS descriptor through a vendor request
+	if ((USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_VENDOR | REQREC_DEVICE))
+	 && (USB_ControlRequest.bRequest == MSOS20_VENDOR_CODE) && (USB_ControlRequest.wIndex == MSOS20_DESCRIPTOR_INDEX)) {
+		Endpoint_ClearSETUP();
+		Endpoint_Write_Control_PStream_LE(&MSOS20_DescriptorSet, sizeof(MSOS20_DescriptorSet));
+		Endpoint_ClearOUT();
+		return;
+	}
+
+	#if CDC_SUPPORT
+	Console_ProcessControlRequest();
+	#endif
+	#if HID_SUPPORT
+	HIDTransport_ProcessControlRequest();
+	#endif
+
+	// LUFA leaves the interface requests to us; without a handler it would stall them
+	if ((USB_ControlRequest.bRequest == REQ_SetInterface) && (USB_DeviceState == DEVICE_STATE_Configured)
+	 && (USB_ControlRequest.bmRequestType == (REQDIR_HOSTTODEVICE | REQTYPE_STANDARD | REQREC_INTERFACE))
+	 && (USB_ControlRequest.wIndex == INTERFACE_ID_Vendor)
+	 && (USB_ControlRequest.wValue <= (HID_SUPPORT ? VENDOR_ALT_CONTROL : ISO_SUPPORT ? VENDOR_ALT_ISO : VENDOR_ALT_BULK))) {
+		Endpoint_ClearSETUP();
+		I2C_SelectAltSetting(USB_ControlRequest.wValue);
+		Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+		Endpoint_ClearStatusStage();
+		return;
+	}
+
+	if ((USB_ControlRequest.bRequest == REQ_GetInterface) && (USB_DeviceState == DEVICE_STATE_Configured)
+	 && (USB_ControlRequest.bmRequestType == (REQDIR_DEVICETOHOST | REQTYPE_STANDARD | REQREC_INTERFACE))
+	 && (USB_ControlRequest.wIndex == INTERFACE_ID_Vendor)) {
+		const uint8_t alt = I2C_AltSetting;
+		Endpoint_ClearSETUP();
+		Endpoint_Write_Control_Stream_LE(&alt, sizeof(alt));
+		Endpoint_ClearOUT();
+		return;
+	}
+
 	if (((USB_ControlRequest.bmRequestType & CONTROL_REQTYPE_TYPE) != REQTYPE_CLASS)
 	 || ((USB_ControlRequest.bmRequestType & CONTROL_REQTYPE_RECIPIENT) != REQREC_DEVICE))
 		return;
 
+	// Whatever could change what a host remembers from CMD_GET_CONFIG counts, even if it ends up stalled
+	switch (USB_ControlRequest.bRequest) {
+		case CMD_SET_STRETCH:
+		case CMD_SET_TARGET:
+		case CMD_SET_RETRY:
+		case CMD_SET_ALERT:
+		case CMD_SET_NOTIFY:
+		case CMD_SET_CACHE:
+		case CMD_SET_SCRIPT:
+		case CMD_SAVE_SETTINGS:
+		case CMD_SET_LABEL:
+		case CMD_SET_MUX:
+		case CMD_SPEED_SCAN:
+		case CMD_SET_ADAPT:
+		case CMD_SET_WAKEUP:
+		case CMD_SET_SCHED:
+		case CMD_SET_SYNC:
+			I2C_ConfigGeneration++;
+			break;
+	}
+
 	switch (USB_ControlRequest.bRequest) {
+		case CMD_ECHO:
+			Endpoint_ClearSETUP();
+			Endpoint_Write_Control_Stream_LE(&USB_ControlRequest.wValue, sizeof(USB_ControlRequest.wValue));
+			Endpoint_ClearOUT();
+			break;
+
+		case CMD_GET_FUNC:
+			Endpoint_ClearSETUP();
+			Endpoint_Write_Control_PStream_LE(&I2C_FuncInfo, sizeof(I2C_FuncInfo));
+			Endpoint_ClearOUT();
+			break;
+
+		case CMD_SET_DELAY:
+			// The stock drivers express the bus speed as a delay in microseconds, 10 us meaning 100 kHz
+			Endpoint_ClearSETUP();
+			TWI_Disable();
+			SetupI2CSpeed(USB_ControlRequest.wValue ? (1000 / USB_ControlRequest.wValue) : 1000);
+			Endpoint_ClearStatusStage();
+			break;
+
 		case CMD_SET_BAUDRATE:
 			Endpoint_ClearSETUP();
 			TWI_Disable();
 			SetupI2CSpeed(USB_ControlRequest.wValue);
-			PORTE ^= 1 << 6;
 			Endpoint_ClearStatusStage();
 			break;
 
 		case CMD_GET_STATUS:
 			Endpoint_ClearSETUP();
-			while (!Endpoint_IsINReady());
+			while (!Endpoint_IsINReady())
+				Watchdog_Kick();
 			Endpoint_Write_8(I2C_Status);
 			Endpoint_ClearIN();
-			PORTE &= ~(1 << 6);
 			while (!Endpoint_IsOUTReceived())
+				Watchdog_Kick();
 			Endpoint_ClearOUT();
 			break;
 
-		case CMD_I2C_IO:
-		case CMD_I2C_IO | CMD_I2C_IO_BEGIN:
-		case CMD_I2C_IO | CMD_I2C_IO_END:
-		case CMD_I2C_IO | CMD_I2C_IO_BEGIN | CMD_I2C_IO_END:
-		{
+		case CMD_GET_BAUDRATE:
 			Endpoint_ClearSETUP();
-			const uint8_t start = USB_ControlRequest.bRequest & CMD_I2C_IO_BEGIN;
-			const uint8_t stop = USB_ControlRequest.bRequest & CMD_I2C_IO_END;
-			const uint8_t read = USB_ControlRequest.wValue & I2C_M_RD;
+			Endpoint_Write_Control_Stream_LE(&I2C_Speed, sizeof(I2C_Speed));
+			Endpoint_ClearOUT();
+			break;
+
+		case CMD_GET_STATS:
+			Endpoint_ClearSETUP();
+			Stats.BusSpeedKHz   = F_CPU / 1000 / (16 + (uint16_t)TWBR * (2 << ((TWSR & 0x03) << 1)));
+			Stats.SpeedLimitKHz = SpeedAdapt_LimitKHz();
+			Stats_UpdateLoads();
+			Watchdog_FillStats();
+			Endpoint_Write_Control_Stream_LE(&Stats, sizeof(Stats));
+			Endpoint_ClearOUT();
+			if (USB_ControlRequest.wValue)
+				Stats_Reset();
+			break;
+
+#if STATS_SUPPORT
+		case CMD_GET_LATENCY:
+			Endpoint_ClearSETUP();
+			Endpoint_Write_Control_Stream_LE(&Stats_Latency, MIN(sizeof(Stats_Latency), USB_ControlRequest.wLength));
+			Endpoint_ClearOUT();
+			if (USB_ControlRequest.wValue)
+				Stats_LatencyReset();
+			break;
+#endif
+
+#if STATS_SUPPORT
+		case CMD_GET_ADDR_STATS:
+			Endpoint_ClearSETUP();
+			Endpoint_Write_Control_Stream_LE(&AddrStats, MIN(sizeof(AddrStats), USB_ControlRequest.wLength));
+			Endpoint_ClearOUT();
+			if (USB_ControlRequest.wValue)
+				AddrStats_Reset();
+			break;
+#endif
+
+		case CMD_GET_MEMORY:
+			Endpoint_ClearSETUP();
+			StackMonitor_Send(USB_ControlRequest.wValue);
+			Endpoint_ClearOUT();
+			break;
+
+		case CMD_SET_STRETCH:
+			// wValue is the longest clock stretch in milliseconds, 0 restores the default
+			Endpoint_ClearSETUP();
+			if (!USB_ControlRequest.wValue)
+				TargetConfig_Default.StretchTimeoutMs = I2C_STRETCH_TIMEOUT_MS;
+			else
+				TargetConfig_Default.StretchTimeoutMs = MIN(USB_ControlRequest.wValue, UINT8_MAX);
+			Endpoint_ClearStatusStage();
+			break;
+
+		case CMD_SET_TARGET:
+			// wIndex is the 7-bit address. Without a data stage the entry is removed, or all of them for
+			// wIndex 0xFF. Leaving a malformed request alone makes LUFA stall it.
+			if (!USB_ControlRequest.wLength) {
+				Endpoint_ClearSETUP();
+				if (USB_ControlRequest.wIndex == TARGET_CONFIG_UNUSED)
+					TargetConfig_Clear();
+				else
+					TargetConfig_Remove(USB_ControlRequest.wIndex);
+				Endpoint_ClearStatusStage();
+			} else if (((USB_ControlRequest.wLength == TARGET_CONFIG_SIZE) ||
+			            (USB_ControlRequest.wLength == TARGET_CONFIG_SIZE_FLAGS)) && (USB_ControlRequest.wIndex < 0x80)) {
+				uint8_t data[TARGET_CONFIG_SIZE_FLAGS] = {0};
+
+				Endpoint_ClearSETUP();
+				Endpoint_Read_Control_Stream_LE(data, USB_ControlRequest.wLength);
+				if (TargetConfig_Set(USB_ControlRequest.wIndex, data))
+					Endpoint_ClearIN();
+				else
+					Control_Stall();
+			}
+			break;
 
-			if (start) {
- 				if (TWI_StartTransmission(USB_ControlRequest.wIndex, 25)) {
-					I2C_Status = STATUS_ADDRESS_NAK;
-					LED_on();
+#if SPEED_ADAPT_SUPPORT
+		case CMD_SET_ADAPT:
+			// wValue is the number of faulted transactions in a row that lower the speed, 0 turns the policy off,
+			// and wIndex the number of clean ones that raise it again
+			Endpoint_ClearSETUP();
+			SpeedAdapt_SetPolicy(MIN(USB_ControlRequest.wValue, UINT8_MAX), USB_ControlRequest.wIndex);
+			Endpoint_ClearStatusStage();
+			break;
+#endif
+
+#if MUX_SUPPORT
+		case CMD_SET_MUX:
+			// wIndex is the mux index, wValue the 7-bit mux address in the low byte and the route the mux sits on
+			// in the high byte. wIndex 0xFF forgets all muxes. No data stage; a bad entry is stalled.
+			if (!USB_ControlRequest.wLength) {
+				Endpoint_ClearSETUP();
+				if (USB_ControlRequest.wIndex == MUX_UNUSED) {
+					Mux_Clear();
+					Endpoint_ClearStatusStage();
+				} else if (Mux_Set(USB_ControlRequest.wIndex, USB_ControlRequest.wValue & 0xFF,
+				                   USB_ControlRequest.wValue >> 8)) {
+					Endpoint_ClearStatusStage();
 				} else {
-					I2C_Status = STATUS_ADDRESS_ACK;
-					LED_off();
+					Control_Stall();
 				}
 			}
+			break;
+#endif
 
-			// In case of error we complete the request but skip the I2C accesses
-			const uint8_t skip_and_exit = (I2C_Status == STATUS_ADDRESS_NAK);
-			if (read)
-				I2C_Read(stop, skip_and_exit);
+		case CMD_SET_CACHE:
+		{
+			// wIndex low byte is the 7-bit address and the high byte the length, wValue the register. A data stage
+			// of that length fills the entry, without one the next CMD_I2C_REGREAD of that range does. A length of
+			// 0 removes the entry, address 0xFF all of them.
+			const uint8_t address = USB_ControlRequest.wIndex & 0xFF;
+			const uint8_t length  = USB_ControlRequest.wIndex >> 8;
+
+			if ((address == REGCACHE_UNUSED) || !length) {
+				Endpoint_ClearSETUP();
+				if (address == REGCACHE_UNUSED)
+					RegCache_Clear();
+				else
+					RegCache_Remove(address, USB_ControlRequest.wValue);
+				Endpoint_ClearStatusStage();
+			} else if (!USB_ControlRequest.wLength && (address < 0x80)) {
+				Endpoint_ClearSETUP();
+				if (RegCache_Set(address, USB_ControlRequest.wValue, length, NULL))
+					Endpoint_ClearStatusStage();
+				else
+					Control_Stall();
+			} else if ((USB_ControlRequest.wLength == length) && (length <= REGCACHE_MAX_LENGTH) && (address < 0x80)) {
+				uint8_t data[REGCACHE_MAX_LENGTH];
+
+				Endpoint_ClearSETUP();
+				Endpoint_Read_Control_Stream_LE(data, length);
+				if (RegCache_Set(address, USB_ControlRequest.wValue, length, data))
+					Endpoint_ClearIN();
+				else
+					Control_Stall();
+			}
+		}
+		break;
+
+		case CMD_SET_RETRY:
+			// wValue is the number of retries for a NACKed address, wIndex the backoff in microseconds
+			Endpoint_ClearSETUP();
+			TargetConfig_SetRetries(MIN(USB_ControlRequest.wValue, UINT8_MAX), USB_ControlRequest.wIndex);
+			Endpoint_ClearStatusStage();
+			break;
+
+		case CMD_SET_EVENTS:
+			// wValue is the mask of event types to report on the event endpoint
+			Endpoint_ClearSETUP();
+			Events_SetMask(USB_ControlRequest.wValue);
+			Endpoint_ClearStatusStage();
+			break;
+
+		case CMD_SET_ALERT:
+			// wValue low byte holds the ALERT_MODE_* bits, the high byte the status register to read
+			Endpoint_ClearSETUP();
+			Alert_SetMode(USB_ControlRequest.wValue & 0xFF, USB_ControlRequest.wValue >> 8);
+			Endpoint_ClearStatusStage();
+			break;
+
+		case CMD_SET_NOTIFY:
+			// wValue 1 listens for SMBus Host Notify at 0x08 while the bus is free, 0 stops
+			Endpoint_ClearSETUP();
+			if (USB_ControlRequest.wValue > 1) {
+				Control_Stall();
+			} else {
+				Notify_SetEnabled(USB_ControlRequest.wValue);
+				Endpoint_ClearStatusStage();
+			}
+			break;
+
+		case CMD_SET_SCHED:
+			// wIndex is the SCHED_* service and wValue its weight in packets per turn, 0 for the default
+			Endpoint_ClearSETUP();
+			if ((USB_ControlRequest.wIndex >= SCHED_SERVICES) || (USB_ControlRequest.wValue > UINT8_MAX)) {
+				Control_Stall();
+			} else {
+				Sched_Weights[USB_ControlRequest.wIndex] = USB_ControlRequest.wValue ? USB_ControlRequest.wValue :
+				                                                                       SCHED_DEFAULT_WEIGHT;
+				Endpoint_ClearStatusStage();
+			}
+			break;
+
+		case CMD_SET_SYNC:
+			// wValue is a SYNC_MODE_* value
+			Endpoint_ClearSETUP();
+			if ((USB_ControlRequest.wValue > UINT8_MAX) || !Sync_SetMode(USB_ControlRequest.wValue))
+				Control_Stall();
 			else
-				I2C_Write(skip_and_exit);
+				Endpoint_ClearStatusStage();
+			break;
+
+		case CMD_SET_WAKEUP:
+			// wValue holds the WAKEUP_* bits, unknown ones are stalled
+			Endpoint_ClearSETUP();
+			if (USB_ControlRequest.wValue & ~WAKEUP_MODES) {
+				Control_Stall();
+			} else {
+				Wakeup_SetMode(USB_ControlRequest.wValue);
+				Endpoint_ClearStatusStage();
+			}
+			break;
+
+#if CLOCK_METER_SUPPORT
+		case CMD_CLOCK_METER:
+			Endpoint_ClearSETUP();
+			ClockMeter_Send(USB_ControlRequest.wValue);
+			Endpoint_ClearOUT();
+			break;
+#endif
+
+#if TRACE_SUPPORT
+		case CMD_GET_TRACE:
+			Endpoint_ClearSETUP();
+			Trace_Send();
+			Endpoint_ClearOUT();
+			if (USB_ControlRequest.wValue)
+				Trace_Reset();
+			break;
+#endif
 
-			if (stop && !skip_and_exit) {
-				TWI_StopTransmission();
+		case CMD_SET_OPTIONS:
+			Endpoint_ClearSETUP();
+			I2C_Options = USB_ControlRequest.wValue;
+			Endpoint_ClearStatusStage();
+			break;
+
+		case CMD_GET_CONFIG:
+		{
+			I2C_Config_t config;
+			uint32_t     crc = CRC32_INIT;
+
+			Endpoint_ClearSETUP();
+			if (USB_ControlRequest.wIndex & CONFIG_SET_OPTIONS)
+				I2C_Options = USB_ControlRequest.wValue;
+
+			for (uint8_t i = 0; i < sizeof(I2C_FuncInfo); i++)
+				crc = CRC32_Update(crc, pgm_read_byte((const uint8_t*)&I2C_FuncInfo + i));
+			config.FuncCrc    = crc ^ CRC32_INIT;
+			config.BootId     = I2C_BootId;
+			config.Generation = I2C_ConfigGeneration;
+			config.Speed      = I2C_Speed;
+			config.Options    = I2C_Options;
+			config.Flags      = Settings_Stored(&config.StoredCrc) ? CONFIG_FLAG_STORED : 0;
+			Endpoint_Write_Control_Stream_LE(&config, sizeof(config));
+			Endpoint_ClearOUT();
+		}
+		break;
+
+		case CMD_I2C_IO:
+		case CMD_I2C_IO | CMD_I2C_IO_BEGIN:
+		case CMD_I2C_IO | CMD_I2C_IO_END:
+		case CMD_I2C_IO | CMD_I2C_IO_BEGIN | CMD_I2C_IO_END:
+		case CMD_I2C_REGREAD:
+		case CMD_SCAN:
+		case CMD_RECOVER_BUS:
+#if SPEED_SCAN_SUPPORT
+		case CMD_SPEED_SCAN:
+#endif
+		case CMD_START_BOOTLOADER:
+			// Carried out by Control_Task() from the main loop
+			Endpoint_ClearSETUP();
+			Control_JobStart   = Stats_LatencyStart();
+			Control_JobPending = true;
+			break;
+
+		case CMD_CANCEL:
+			// The bulk command in progress gives up right away, so the main loop soon gets to the job
+			Endpoint_ClearSETUP();
+			Bulk_RequestCancel(true);
+			Control_JobPending = true;
+			break;
+
+#if SCRIPT_SUPPORT
+		case CMD_SET_SCRIPT:
+			// wIndex is the slot; the RAM script is stored right away, EEPROM writes take too long for the interrupt
+			if (!Script_IsValidSlot(USB_ControlRequest.wIndex) || (USB_ControlRequest.wLength > SCRIPT_SIZE))
+				break;
+
+			Endpoint_ClearSETUP();
+			if (USB_ControlRequest.wIndex == SCRIPT_SLOT_RAM) {
+				Script_Receive(SCRIPT_SLOT_RAM, USB_ControlRequest.wLength);
+				Endpoint_ClearIN();
+			} else {
+				Control_JobPending = true;
 			}
+			break;
+
+		case CMD_RUN_SCRIPT:
+			if (!Script_IsValidSlot(USB_ControlRequest.wIndex))
+				break;
+
+			Endpoint_ClearSETUP();
+			Control_JobPending = true;
+			break;
+#endif
+
+		case CMD_SAVE_SETTINGS:
+			// wValue is SETTINGS_SAVE or SETTINGS_ERASE; the EEPROM writes are left to the main loop
+			Endpoint_ClearSETUP();
+			Control_JobPending = true;
+			break;
+
+		case CMD_SET_LABEL:
+			// The data stage is the new label, none to remove it; stored from the main loop like the settings
+			if (USB_ControlRequest.wLength > LABEL_MAX_LENGTH)
+				break;
+
+			Endpoint_ClearSETUP();
+			Control_JobPending = true;
+			break;
+
+		case CMD_GET_LABEL:
+		{
+			uint8_t label[LABEL_MAX_LENGTH];
+			const uint8_t length = Label_Get(label);
+
+			Endpoint_ClearSETUP();
+			Endpoint_Write_Control_Stream_LE(label, MIN(length, USB_ControlRequest.wLength));
+			Endpoint_ClearOUT();
 		}
 		break;
 	}
 }
 
+/** Carries out the bus I/O request accepted by the USB interrupt, if any. This runs from the main loop so that
+ *  a long transfer doesn't hold off the other USB interrupts. The SETUP interrupt stays off meanwhile: a new SETUP
+ *  packet aborts the data stage loops as it always did, and LUFA only processes it once the job is done.
+ */
+static void Control_Task(void)
+{
+	if (!Control_JobPending)
+		return;
+
+	GlobalInterruptDisable();
+
+	// A request that arrived after this one but hasn't been processed yet supersedes it, too
+	Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+	const bool run = !Endpoint_IsSETUPReceived();
+	Control_JobPending = false;
+	if (run)
+		USB_INT_Disable(USB_INT_RXSTPI);
+
+	GlobalInterruptEnable();
+
+	if (run) {
+		Arena_Reset();
+		I2C_ControlJob();
+
+		GlobalInterruptDisable();
+		Endpoint_SelectEndpoint(ENDPOINT_CONTROLEP);
+		USB_INT_Enable(USB_INT_RXSTPI);
+		GlobalInterruptEnable();
+	}
+}
+
+/** Lets a pending bus I/O request go ahead of the background work in progress. The bulk commands, the poll engine
+ *  and the other jobs call this between two of their transactions, so a request from the host waits for at most
+ *  one of those rather than for a whole burst. Only runs the request while nobody holds the bus, so an open or
+ *  locked bulk transaction finishes first as always; the caller must not have anything in the arena, as the
+ *  request starts with an empty one, and must select its endpoint again afterwards.
+ */
+void Control_Preempt(void)
+{
+	if (Control_JobPending && (I2C_BusOwner == BUS_OWNER_NONE))
+		Control_Task();
+}
+
 /** Event handler for the USB_ConfigurationChanged event. This is fired when the host set the current configuration
  *  of the USB device after enumeration - the device endpoints are configured.
  */
 void EVENT_USB_Device_ConfigurationChanged(void)
 {
-	Endpoint_ConfigureEndpoint(VENDOR_IN_EPADDR,  EP_TYPE_BULK, VENDOR_IO_EPSIZE, 1);
-	Endpoint_ConfigureEndpoint(VENDOR_OUT_EPADDR, EP_TYPE_BULK, VENDOR_IO_EPSIZE, 1);
+	Stats_BootStamp(&Stats.BootConfigTicks);
+	// The host's enumeration timing jitters by far more than a tick; 0 stands for not configured yet
+	if (!I2C_BootId)
+		I2C_BootId = Timebase_Now() | 1;
+
+	#if HID_SUPPORT
+	HIDTransport_ConfigureEndpoints();
+	#else
+	Endpoint_ConfigureEndpoint(VENDOR_IN_EPADDR,  EP_TYPE_BULK, VENDOR_IO_EPSIZE, VENDOR_IO_EPBANKS);
+	Endpoint_ConfigureEndpoint(VENDOR_OUT_EPADDR, EP_TYPE_BULK, VENDOR_IO_EPSIZE, VENDOR_IO_EPBANKS);
+	Endpoint_ConfigureEndpoint(VENDOR_EVENT_EPADDR, EP_TYPE_INTERRUPT, VENDOR_EVENT_EPSIZE, 1);
+	#endif
+	#if ISO_SUPPORT
+	Endpoint_ConfigureEndpoint(VENDOR_POLL_EPADDR, EP_TYPE_ISOCHRONOUS, VENDOR_POLL_EPSIZE, 2);
+	#endif
+	#if CDC_SUPPORT
+	Console_ConfigureEndpoints();
+	#endif
+
+	// A bus reset during the suspend doesn't necessarily come with a wakeup event
+	I2C_PowerUp();
+
+	// The bulk side stays off until the host selects it, except in the HID build
+	I2C_AltSetting = VENDOR_ALT_CONTROL;
+	Poll_Clear();
+	Events_Clear();
+	RegCache_Clear();
+	Prefetch_Clear();
+	memset(Sched_Weights, SCHED_DEFAULT_WEIGHT, sizeof(Sched_Weights));
+	Mux_Clear();
+	Alert_SetMode(0, 0);
+	Sync_SetMode(SYNC_MODE_OFF);
+	Fifo_Clear();
+	Sniff_Stop();
+	Emu_Stop();
+	Notify_SetEnabled(false);
+	SPIBridge_Stop();
+	Uart_Stop();
+	if (CLOCK_METER_SUPPORT)
+		ClockMeter_Stop();
+	if (I2C_IsBulkActive())
+		Settings_Load(SETTINGS_POLL);
+	USB_Device_EnableSOFEvents();
+}
+
+/** Event handler for the USB_StartOfFrame event, fired once per millisecond. Drives the frame timestamps,
+ *  and wakes up the main loop from idle sleep so that anything that interrupts don't tell us about gets done.
+ */
+void EVENT_USB_Device_StartOfFrame(void)
+{
+	Timebase_StartOfFrame();
+	Stats_Frame();
+
+	if (Idle_Frames != UINT8_MAX)
+		Idle_Frames++;
+}
+
+/** Event handler for the USB_Suspend event. Gates the TWI clock, unless a transaction was left open across the
+ *  suspend; in that case the TWI keeps its state so the host can finish the transaction after the resume.
+ */
+void EVENT_USB_Device_Suspend(void)
+{
+	I2C_PowerDown();
+	Wakeup_Suspend();
+
+	// Nothing kicks the watchdog while the CPU sleeps through the suspend
+	Watchdog_Disarm();
+}
+
+/** Event handler for the USB_WakeUp event, fired on any bus activity after a suspend. */
+void EVENT_USB_Device_WakeUp(void)
+{
+	I2C_PowerUp();
+	Watchdog_Arm();
+	Wakeup_Resume();
+}
+
+// While suspended: the polling round of WAKEUP_POLL, with the TWI powered up for it, and the remote wakeup
+static void Suspend_Task(void)
+{
+	if (Wakeup_PollDue()) {
+		I2C_PowerUp();
+		if (I2C_ClaimBus(BUS_OWNER_POLL)) {
+			if (Poll_CheckThresholds())
+				Wakeup_Raise(WAKEUP_POLL);
+			I2C_ReleaseBus();
+		}
+		I2C_PowerDown();
+	}
+
+	Wakeup_Task();
 }
 
+#if IDLE_SLEEP
+// Arm the selected data endpoint's interrupt for the next OUT packet, or for a free IN bank; the USB interrupt
+// disarms it again when it fires (see LUFA/LOCAL_PATCHES.txt) and only serves to end the sleep
+static inline void Idle_ArmWake(const bool in)
+{
+	UEIENX |= (in ? (1 << TXINE) : (1 << RXOUTE));
+}
+
+// Sleep until the next interrupt unless bulk data is waiting, or for good while suspended. The check and the sleep
+// must not be separated by an interrupt, or the wakeup it was supposed to give would be lost until the next one.
+static void Idle_Sleep(void)
+{
+	GlobalInterruptDisable();
+
+	bool idle = (USB_DeviceState == DEVICE_STATE_Suspended) && !Wakeup_IsDue();
+	if (Control_JobPending) {
+		idle = false;
+	} else if (USB_DeviceState == DEVICE_STATE_Configured) {
+		idle = true;
+
+		// The next packet, or an IN bank the host just collected, wakes us up right away instead of at the next
+		// frame. The USB interrupt disarms these again and leaves the endpoints to the tasks.
+		if (I2C_IsBulkActive()) {
+			Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
+			idle = !Endpoint_IsOUTReceived();
+			Idle_ArmWake(false);
+
+			Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
+			if (!Endpoint_IsINReady())
+				Idle_ArmWake(true);
+		}
+
+		#if CDC_SUPPORT
+		Endpoint_SelectEndpoint(CDC_RX_EPADDR);
+		idle = idle && !Endpoint_IsOUTReceived();
+		Idle_ArmWake(false);
+		#endif
+	}
+
+	if (idle) {
+		sleep_enable();
+		GlobalInterruptEnable();
+		sleep_cpu();
+		sleep_disable();
+	}
+
+	GlobalInterruptEnable();
+}
+#endif
+
 /** Configures the board hardware and chip peripherals for the demo's functionality. */
 void SetupHardware(void)
 {
-	/* Disable watchdog if enabled by bootloader/fuses */
-	MCUSR &= ~(1 << WDRF);
-	wdt_disable();
+	/* Take over the watchdog from the bootloader/fuses */
+	Watchdog_Init();
 
 	/* Disable clock division */
 	clock_prescale_set(clock_div_1);
 
+	/* Gate the clocks of the peripherals we don't use */
+	power_adc_disable();
+	power_spi_disable();
+	power_timer0_disable();
+	power_timer3_disable();
+	power_usart1_disable();
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
 	/* Hardware Initialization */
 	LED_Init();
+	Probe_Init();
+	Timebase_Init();
+	Stats_BootStart();
+	Descriptors_Init();
+	I2C_Status = STATUS_IDLE;
+
+	/* Attach right away, the host debounces the connection for 100 ms and the rest of the init runs meanwhile */
 	USB_Init();
+	Stats_BootStamp(&Stats.BootAttachTicks);
+	TargetConfig_Clear();
 	SetupI2CSpeed(100);
+	Settings_Load(SETTINGS_BUS);
+	// A hang that took the second watchdog timeout may well have left the bus held
+	if (BusRecovery_IsStuck()) {
+		uint8_t pulses;
+		BusRecovery_Run(&pulses);
+	}
+	// Generation 0 is the configuration the adapter powers up with, stored or not
+	I2C_ConfigGeneration = 0;
+	TWIEngine_Reset();
+	SoftI2C_Init();
+	SPIBridge_Init();
+	Alert_Init();
+	Fifo_Init();
+	Stats_Reset();
+	AddrStats_Reset();
+	Trace_Reset();
+	Stats_BootStamp(&Stats.BootReadyTicks);
+}
+
+// Starts the turn of a service, adding its weight to its budget. Credit doesn't pile up while a service is idle,
+// only an overrun carries over into the next turns.
+// @return false if the service is still paying off an overrun and has to skip this turn
+static bool Sched_Turn(const uint8_t service)
+{
+	const uint8_t weight = Sched_Weights[service];
+	int16_t deficit = Sched_Deficit[service] + weight;
+
+	if (deficit > weight)
+		deficit = weight;
+	Sched_Deficit[service] = deficit;
+	Sched_Current = service;
+
+	return deficit > 0;
 }
 
 /** Main program entry point. This routine configures the hardware required by the application, then
@@ -326,20 +1649,48 @@ int main(void)
 
 	for (;;)
 	{
-		USB_USBTask();
+		// Control requests and all device state changes are handled in the USB interrupts, thanks to
+		// INTERRUPT_CONTROL_ENDPOINT; USB_USBTask() would only poll for SETUP packets the interrupt takes care of.
+		// The requests doing bus I/O are handed back to us, though.
+		Control_Task();
+		Watchdog_Task();
 
-		uint8_t ReceivedData[VENDOR_IO_EPSIZE];
-		memset(ReceivedData, 0x00, sizeof(ReceivedData));
+		if (USB_DeviceState != DEVICE_STATE_Configured) {
+			// Nothing happens while suspended until the host wakes us up again, unless we wake it up
+			if (USB_DeviceState == DEVICE_STATE_Suspended)
+				Suspend_Task();
+			#if IDLE_SLEEP
+			Idle_Sleep();
+			#endif
+			continue;
+		}
 
-		Endpoint_SelectEndpoint(VENDOR_OUT_EPADDR);
-		if (Endpoint_IsOUTReceived())
-		{
-			Endpoint_Read_Stream_LE(ReceivedData, VENDOR_IO_EPSIZE, NULL);
-			Endpoint_ClearOUT();
+		// Each task checks for its own work first and returns right away if there is none. Those sharing the bulk
+		// endpoints only get their turn while within their budget, so none of them can crowd out the others.
+		if (Sched_Turn(SCHED_SVC_BULK) && Bulk_Task())
+			Idle_Frames = 0;
+		if (Sched_Turn(SCHED_SVC_POLL))
+			Poll_Task();
+		Prefetch_Task();
+		Alert_Task();
+		if (Sched_Turn(SCHED_SVC_FIFO))
+			Fifo_Task();
+		if (Sched_Turn(SCHED_SVC_SNIFF))
+			Sniff_Task();
+		Emu_Task();
+		Notify_Task();
+		if (Sched_Turn(SCHED_SVC_UART))
+			Uart_Task();
+		Events_Task();
+		#if CDC_SUPPORT
+		Console_Task();
+		#endif
 
-			Endpoint_SelectEndpoint(VENDOR_IN_EPADDR);
-			Endpoint_Write_Stream_LE(ReceivedData, VENDOR_IO_EPSIZE, NULL);
-			Endpoint_ClearIN();
-		}
+		// Everything else is driven by interrupts or happens at most once per frame, so once the bulk
+		// endpoint has gone quiet the CPU may as well wait for the next interrupt
+		#if IDLE_SLEEP
+		if (Idle_Frames >= IDLE_SLEEP_FRAMES)
+			Idle_Sleep();
+		#endif
 	}
 }
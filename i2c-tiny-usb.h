@@ -0,0 +1,379 @@
+/*
+ * I2C-Tiny-USB clone for ATmegaXU4
+ *
+ * Author: Joachim Fenkes <github@dojoe.net>
+ */
+
+/*
+  Copyright 2021  Joachim Fenkes <github@dojoe.net>
+
+  Permission to use, copy, modify, distribute, and sell this
+  software and its documentation for any purpose is hereby granted
+  without fee, provided that the above copyright notice appear in
+  all copies and that both that the copyright notice and this
+  permission notice and warranty disclaimer appear in supporting
+  documentation, and that the name of the author not be used in
+  advertising or publicity pertaining to distribution of the
+  software without specific, written prior permission.
+
+  The author disclaims all warranties with regard to this
+  software, including all implied warranties of merchantability
+  and fitness.  In no event shall the author be liable for any
+  special, indirect or consequential damages or any damages
+  whatsoever resulting from loss of use, data or profits, whether
+  in an action of contract, negligence or other tortious action,
+  arising out of or in connection with the use or performance of
+  this software.
+*/
+
+/** \file
+ *
+ *  Header file for i2c-tiny-usb.c.
+ */
+
+#ifndef _I2C_TINY_USB_H_
+#define _I2C_TINY_USB_H_
+
+	/* Includes: */
+		#include <avr/io.h>
+		#include <avr/wdt.h>
+		#include <avr/power.h>
+		#include <avr/sleep.h>
+		#include <avr/interrupt.h>
+		#include <avr/pgmspace.h>
+
+		#include "Descriptors.h"
+		#include "Config/AppConfig.h"
+
+		#include <LUFA/Drivers/USB/USB.h>
+		#include <LUFA/Platform/Platform.h>
+		#include <LUFA/Drivers/Peripheral/TWI.h>
+
+	/* Preprocessor Checks: */
+		// The I2C code drives the AVR8 TWI registers directly, and the rest of the firmware leans on Timer1 and the
+		// AVR8 USB controller registers too; the XMEGA TWI has a different register set and bus state machine.
+		#if (ARCH != ARCH_AVR8) || !defined(TWCR)
+			#error This firmware only supports AVR8 USB parts with hardware TWI (ATmega32U4/32U6, AT90USB64x/128x).
+		#endif
+
+		// About 26 KB of flash with the optional modules off, the 16U4 has 12 KB below its bootloader
+		#if defined(__AVR_ATmega16U4__)
+			#error The ATmega16U4 is too small for this firmware, it needs a part with at least 32 KB of flash.
+		#endif
+
+	/* Macros: */
+		// Control request codes, compatible with the original I2C-Tiny-USB
+		#define CMD_ECHO             0
+		#define CMD_GET_FUNC         1
+		#define CMD_SET_DELAY        2
+		#define CMD_GET_STATUS       3
+		#define CMD_I2C_IO           4
+		#define CMD_I2C_IO_BEGIN     1
+		#define CMD_I2C_IO_END       2
+		#define CMD_START_BOOTLOADER 0x10
+		#define CMD_SET_BAUDRATE     0x11
+		#define CMD_SET_OPTIONS      0x12
+		#define CMD_GET_BAUDRATE     0x13
+		#define CMD_GET_STATS        0x14
+		#define CMD_SCAN             0x15
+		#define CMD_SET_STRETCH      0x16
+		#define CMD_SET_TARGET       0x17
+		#define CMD_SET_RETRY        0x18
+		#define CMD_I2C_REGREAD      0x19
+		#define CMD_SET_EVENTS       0x1A
+		#define CMD_SET_ALERT        0x1B
+		#define CMD_GET_TRACE        0x1C
+		#define CMD_SET_CACHE        0x1D
+		#define CMD_SET_SCRIPT       0x1E
+		#define CMD_RUN_SCRIPT       0x1F
+		#define CMD_SAVE_SETTINGS    0x20
+		#define CMD_SET_LABEL        0x21
+		#define CMD_GET_LABEL        0x22
+		#define CMD_RECOVER_BUS      0x23
+		#define CMD_SET_MUX          0x24
+		#define CMD_SPEED_SCAN       0x25
+		#define CMD_SET_ADAPT        0x26
+		#define CMD_CLOCK_METER      0x27
+		#define CMD_GET_MEMORY       0x28
+		#define CMD_GET_LATENCY      0x29
+		#define CMD_GET_ADDR_STATS   0x2A
+		#define CMD_GET_CONFIG       0x2B
+		#define CMD_SET_WAKEUP       0x2C
+		#define CMD_CANCEL           0x2D
+		#define CMD_SET_NOTIFY       0x2E
+		#define CMD_SET_SCHED        0x2F
+		#define CMD_SET_SYNC         0x30
+
+		// wIndex bits for CMD_GET_CONFIG
+		#define CONFIG_SET_OPTIONS   (1 << 0) // Set the options to wValue before reporting them, as CMD_SET_OPTIONS does
+
+		// Flags in the CMD_GET_CONFIG response
+		#define CONFIG_FLAG_STORED   (1 << 0) // Valid settings are stored in EEPROM, see CMD_SAVE_SETTINGS
+
+		// Option bits for CMD_SET_OPTIONS, all off after reset
+		#define OPTION_INLINE_STATUS (1 << 0) // Append I2C_Status to reads, STALL the status stage of NAKed writes
+		#define OPTION_LOOPBACK      (1 << 1) // Leave the bus alone, reads return what was written since the last START
+		#define OPTION_PREFETCH      (1 << 2) // Read the block after each CMD_I2C_REGREAD ahead while the bus is idle
+		#define OPTION_QUIET         (1 << 3) // Mask the interrupts the bus doesn't need around timed STARTs
+
+		// Mode bits for CMD_SET_ALERT, all off after reset
+		#define ALERT_MODE_ENABLE    (1 << 0) // Watch the alert line and report alerts as events
+		#define ALERT_MODE_ARA       (1 << 1) // Find the alerting target through an Alert Response Address read
+		#define ALERT_MODE_STATUS    (1 << 2) // Follow up with a read of the alerting target's status register
+
+		// Modes of the SYNC line for CMD_SET_SYNC, off after reset
+		#define SYNC_MODE_OFF        0 // Pin left alone
+		#define SYNC_MODE_INPUT      1 // Follow the edges of another adapter's SYNC output
+		#define SYNC_MODE_OUTPUT     2 // Trigger master, drive the line and toggle it for each armed batch
+
+		// Size of the loopback buffer; a power of two up to 256 so the index wraps around for free
+		#define LOOPBACK_SIZE        256
+
+		// Marks the functions running the per-byte transfer loops, compiled for speed with SPEED_HOT_PATHS
+		#if SPEED_HOT_PATHS
+			#define ATTR_HOT_PATH    __attribute__ ((optimize("O2")))
+		#else
+			#define ATTR_HOT_PATH
+		#endif
+
+		#define I2C_M_RD   1
+		#define I2C_M_TEN  0x0010
+
+
+		// Linux I2C_FUNC_* bits reported in the first word of the CMD_GET_FUNC response
+		#define I2C_FUNC_I2C         0x00000001
+		#define I2C_FUNC_10BIT_ADDR  0x00000002
+		#define I2C_FUNC_SMBUS_EMUL  0x0EFF0008
+
+		// Firmware extensions reported in the second word of the CMD_GET_FUNC response
+		#define FUNC_EXT_INLINE_STATUS (1UL << 0) // OPTION_INLINE_STATUS
+		#define FUNC_EXT_LOOPBACK      (1UL << 1) // OPTION_LOOPBACK
+		#define FUNC_EXT_GET_BAUDRATE  (1UL << 2) // CMD_GET_BAUDRATE
+		#define FUNC_EXT_STATS         (1UL << 3) // CMD_GET_STATS
+		#define FUNC_EXT_BULK          (1UL << 4) // Bulk protocol
+		#define FUNC_EXT_BATCH         (1UL << 5) // BULK_OP_BATCH
+		#define FUNC_EXT_POLL          (1UL << 6) // BULK_OP_POLL
+		#define FUNC_EXT_SCAN          (1UL << 7) // CMD_SCAN
+		#define FUNC_EXT_SMBUS         (1UL << 8) // BULK_OP_SMBUS
+		#define FUNC_EXT_SOFTI2C       (1UL << 9) // BULK_OP_CHANNEL, channel count in bits 24-26
+		#define FUNC_EXT_STRETCH       (1UL << 10) // CMD_SET_STRETCH
+		#define FUNC_EXT_TARGET        (1UL << 11) // CMD_SET_TARGET
+		#define FUNC_EXT_RETRY         (1UL << 12) // CMD_SET_RETRY
+		#define FUNC_EXT_REGREAD       (1UL << 13) // CMD_I2C_REGREAD
+		#define FUNC_EXT_EVENTS        (1UL << 14) // CMD_SET_EVENTS and the event endpoint
+		#define FUNC_EXT_ALERT         (1UL << 15) // CMD_SET_ALERT
+		#define FUNC_EXT_TRACE         (1UL << 16) // CMD_GET_TRACE, only with TRACE_SUPPORT
+		#define FUNC_EXT_CACHE         (1UL << 17) // CMD_SET_CACHE
+		#define FUNC_EXT_REGWRITE      (1UL << 18) // BULK_OP_REGWRITE and TARGET_FLAG_AUTOINC
+		#define FUNC_EXT_READ_LONG     (1UL << 19) // BULK_OP_READ_LONG
+		#define FUNC_EXT_FIFO          (1UL << 20) // BULK_OP_FIFO
+		#define FUNC_EXT_SCRIPT        (1UL << 21) // CMD_SET_SCRIPT and CMD_RUN_SCRIPT
+		#define FUNC_EXT_SETTINGS      (1UL << 22) // CMD_SAVE_SETTINGS
+		#define FUNC_EXT_LABEL         (1UL << 23) // CMD_SET_LABEL, CMD_GET_LABEL and the interface string
+		#define FUNC_EXT_ALT_BULK      (1UL << 27) // The bulk and event endpoints need alternate setting 1
+		#define FUNC_EXT_HID           (1UL << 28) // The bulk protocol runs over HID reports, see BULK_OP_FLUSH
+		#define FUNC_EXT_BATCH_DETAIL  (1UL << 29) // BATCH_FLAG_DETAIL
+		#define FUNC_EXT_RECOVER_BUS   (1UL << 30) // CMD_RECOVER_BUS
+		#define FUNC_EXT_BUS_LOCK      (1UL << 31) // BULK_OP_LOCK
+
+		// More firmware extensions, reported in the second extension word once the first one ran full
+		#define FUNC_EXT2_REGUPDATE    (1UL << 0)  // BULK_OP_REGUPDATE
+		#define FUNC_EXT2_MULTIWRITE   (1UL << 1)  // BULK_OP_MULTIWRITE
+		#define FUNC_EXT2_GATHER       (1UL << 2)  // BULK_OP_GATHER
+		#define FUNC_EXT2_MUX          (1UL << 3)  // CMD_SET_MUX and BULK_OP_ROUTE
+		#define FUNC_EXT2_STREAM       (1UL << 4)  // BULK_OP_STREAM
+		#define FUNC_EXT2_BATCH_AT     (1UL << 5)  // BATCH_FLAG_AT
+		#define FUNC_EXT2_POLL_FILTER  (1UL << 6)  // BULK_OP_POLL_FILTER
+		#define FUNC_EXT2_POLL_REDUCE  (1UL << 7)  // BULK_OP_POLL_REDUCE
+		#define FUNC_EXT2_POLL_COMPACT (1UL << 8)  // POLL_COMPACT
+		#define FUNC_EXT2_CHECKSUM     (1UL << 9)  // BULK_OP_CHECKSUM
+		#define FUNC_EXT2_PROGRAM      (1UL << 10) // BULK_OP_PROGRAM
+		#define FUNC_EXT2_SNIFF        (1UL << 11) // BULK_OP_SNIFF
+		#define FUNC_EXT2_EMULATE      (1UL << 12) // BULK_OP_EMULATE, BULK_OP_EMU_WRITE, BULK_OP_EMU_READ
+		#define FUNC_EXT2_TEN_BIT      (1UL << 13) // I2C_M_TEN in CMD_I2C_IO, BATCH_FLAG_TEN
+		#define FUNC_EXT2_SPI          (1UL << 14) // BULK_OP_SPI, bits 28-30 hold the number of chip select lines
+		#define FUNC_EXT2_UART         (1UL << 15) // BULK_OP_UART, BULK_OP_UART_WRITE
+		#define FUNC_EXT2_GPIO         (1UL << 16) // BULK_OP_GPIO, BATCH_FLAG_GPIO
+		#define FUNC_EXT2_SPEED_SCAN   (1UL << 17) // CMD_SPEED_SCAN
+		#define FUNC_EXT2_ADAPT        (1UL << 18) // CMD_SET_ADAPT and the speed fields of CMD_GET_STATS
+		#define FUNC_EXT2_CLOCK_METER  (1UL << 19) // CMD_CLOCK_METER, only with CLOCK_METER_SUPPORT
+		#define FUNC_EXT2_BOOTLOADER   (1UL << 20) // CMD_START_BOOTLOADER
+		#define FUNC_EXT2_MEMORY       (1UL << 21) // CMD_GET_MEMORY
+		#define FUNC_EXT2_LATENCY      (1UL << 22) // CMD_GET_LATENCY, only with STATS_SUPPORT
+		#define FUNC_EXT2_ADDR_STATS   (1UL << 23) // CMD_GET_ADDR_STATS, only with STATS_SUPPORT
+		#define FUNC_EXT2_CONFIG       (1UL << 24) // CMD_GET_CONFIG
+		#define FUNC_EXT2_WAKEUP       (1UL << 25) // CMD_SET_WAKEUP and remote wakeup
+		#define FUNC_EXT2_VERIFY       (1UL << 26) // BULK_REGWRITE_VERIFY
+		#define FUNC_EXT2_ON_FAIL      (1UL << 27) // BATCH_ON_FAIL segment policies
+		#define FUNC_EXT2_CANCEL       (1UL << 31) // CMD_CANCEL; bits 28 to 30 are taken by FUNC_EXT2_SPI_CS
+
+		// Third extension word, for those that no longer fit into the second one
+		#define FUNC_EXT3_DEADLINE     (1UL << 0) // BULK_OP_DEADLINE
+		#define FUNC_EXT3_TAG          (1UL << 1) // BULK_OP_TAG
+		#define FUNC_EXT3_WRITE_LONG   (1UL << 2) // BULK_OP_WRITE_LONG
+		#define FUNC_EXT3_HOST_NOTIFY  (1UL << 3) // CMD_SET_NOTIFY and the HOST_NOTIFY events
+		#define FUNC_EXT3_PMBUS        (1UL << 4) // POLL_PMBUS entries
+		#define FUNC_EXT3_EEPROM_BLOCKS (1UL << 5) // BULK_OP_EEPROM_READ and EEPROM_FMT_BLOCKS addressing
+		#define FUNC_EXT3_SCATTER      (1UL << 6) // BULK_OP_SCATTER
+		#define FUNC_EXT3_PREFETCH     (1UL << 7) // OPTION_PREFETCH
+		#define FUNC_EXT3_POST         (1UL << 8) // BULK_OP_POST, BULK_OP_POST_STATUS and the POST_FAILED events
+		#define FUNC_EXT3_SCHED        (1UL << 9) // CMD_SET_SCHED
+		#define FUNC_EXT3_SYNC         (1UL << 10) // CMD_SET_SYNC, BULK_OP_SYNC and POLL_SYNC
+		#define FUNC_EXT3_QUIET        (1UL << 11) // OPTION_QUIET and the timed START fields of CMD_GET_STATS
+		#define FUNC_EXT3_ISO          (1UL << 12) // VENDOR_ALT_ISO with the poll records on an isochronous endpoint
+		#define FUNC_EXT3_STAMPS       (1UL << 13) // Bulk STAMPS command
+		#define FUNC_EXT3_EMU_RANGE    (1UL << 14) // BULK_OP_EMU_RANGE and BULK_OP_EMU_PROFILE
+		#define FUNC_EXT3_EEPROM_GANG  (1UL << 15) // BULK_OP_EEPROM_WRITE on bit-banged channels
+
+		#define STATUS_IDLE 0
+		#define STATUS_ADDRESS_ACK 1
+		#define STATUS_ADDRESS_NAK 2
+		#define STATUS_BUS_BUSY    3
+		#define STATUS_PEC_ERROR   4 // BULK_OP_SMBUS only: PEC mismatch
+		#define STATUS_COUNT_ERROR 5 // BULK_OP_SMBUS: block count of 0 or larger than asked for, BULK_OP_SPI: no such chip select,
+		                             // BULK_OP_EMU_RANGE: more address bits than EMU_MAX_ADDRESS_BITS,
+		                             // BULK_OP_EEPROM_WRITE: memory address width other than 1 or 2
+		#define STATUS_STRETCH_TIMEOUT 6 // The target held SCL low for longer than I2C_StretchTimeoutMs
+		#define STATUS_VERIFY_ERROR    7 // BULK_OP_REGWRITE with BULK_REGWRITE_VERIFY: a register read back differently
+		#define STATUS_EXPIRED         8 // BULK_OP_BATCH: the segment was skipped past the BULK_OP_DEADLINE
+
+		// Status of the last transaction, a STATUS_* value, checked and set for every segment; an I/O register
+		// takes a single IN or OUT where SRAM takes LDS or STS
+		#define I2C_Status GPIOR2
+
+		// Which protocol currently holds the bus between START and STOP
+		#define BUS_OWNER_NONE    0
+		#define BUS_OWNER_CONTROL 1
+		#define BUS_OWNER_BULK    2
+		#define BUS_OWNER_POLL    3
+		#define BUS_OWNER_ALERT   4
+		#define BUS_OWNER_FIFO    5
+		#define BUS_OWNER_CONSOLE 6
+		#define BUS_OWNER_SNIFF   7
+		#define BUS_OWNER_EMU     8
+		#define BUS_OWNER_PREFETCH 9
+
+		// Main loop services taking turns at the bulk endpoints, the wIndex values of CMD_SET_SCHED. Each turn a
+		// service is given its weight in packets of VENDOR_IO_EPSIZE bytes, both directions counting, and skips
+		// turns once it has used more than that until it has paid off the excess.
+		#define SCHED_SVC_BULK    0 // Bulk commands and their responses
+		#define SCHED_SVC_POLL    1 // Polling job samples
+		#define SCHED_SVC_FIFO    2 // FIFO drain records
+		#define SCHED_SVC_SNIFF   3 // Bus sniffer records
+		#define SCHED_SVC_UART    4 // UART bridge records
+		#define SCHED_SERVICES    5
+
+		// Packets per turn of every service after the device is configured
+		#define SCHED_DEFAULT_WEIGHT 8
+
+		// Most packets a service can fall behind by, so one READ_LONG of a megabyte doesn't lock its service out
+		// for thousands of turns afterwards
+		#define SCHED_MAX_DEBT    64
+
+		// Timeout for bus capture and address ACK, in milliseconds
+		#define I2C_START_TIMEOUT_MS 25
+
+		// Default for the longest the target may hold SCL low during a byte, in milliseconds
+		#define I2C_STRETCH_TIMEOUT_MS 25
+
+		// Range of non-reserved 7-bit addresses probed by CMD_SCAN
+		#define SCAN_FIRST_ADDRESS   0x08
+		#define SCAN_LAST_ADDRESS    0x77
+		#define SCAN_BITMAP_SIZE     16
+
+	/* Type Defines: */
+		/** Type define for the CMD_GET_FUNC response. Stock drivers only read the first word, hosts that know about
+		 *  this firmware ask for the whole structure to find out which fast paths are available.
+		 */
+		typedef struct
+		{
+			uint32_t Functionality; /**< Linux I2C_FUNC_* bits as expected by the stock drivers */
+			uint32_t Extensions;    /**< FUNC_EXT_* bits */
+			uint16_t MaxSpeedKHz;   /**< Fastest bus speed CMD_SET_BAUDRATE can set at this F_CPU */
+			uint16_t CommandBuffer; /**< Bulk command bytes taken in before the OUT endpoint NAKs, the host's credits */
+			uint32_t Extensions2;   /**< FUNC_EXT2_* bits */
+			uint32_t Extensions3;   /**< FUNC_EXT3_* bits */
+		} I2C_FuncInfo_t;
+
+		/** Type define for the CMD_GET_CONFIG response. A host that remembers it can tell from the first three
+		 *  fields whether the firmware, and the settings it applied last time, are still the same.
+		 */
+		typedef struct
+		{
+			uint32_t FuncCrc;       /**< CRC-32 of the CMD_GET_FUNC response, which changes with the build */
+			uint16_t BootId;        /**< Timer reading at the first SET_CONFIGURATION, new after every power-up */
+			uint16_t Generation;    /**< Counts the requests that changed the configuration since the stored one was loaded */
+			uint32_t Speed;         /**< Default bus speed in Hz as reported by CMD_GET_BAUDRATE */
+			uint8_t  Options;       /**< OPTION_* bits */
+			uint8_t  Flags;         /**< CONFIG_FLAG_* bits */
+			uint8_t  StoredCrc;     /**< CRC-8 of the stored settings, with CONFIG_FLAG_STORED */
+		} I2C_Config_t;
+
+	/* External Variables: */
+		extern uint8_t I2C_BusOwner;
+		extern uint8_t I2C_Options;
+		extern uint32_t I2C_Speed;
+		extern uint8_t I2C_StartTimeoutMs;
+		extern uint8_t I2C_StretchTimeoutMs;
+		extern volatile uint8_t I2C_AltSetting;
+		extern uint16_t I2C_ConfigGeneration;
+		extern uint8_t Sched_Current;
+		extern int16_t Sched_Deficit[SCHED_SERVICES];
+
+	/* Inline Functions: */
+		/** Tells the tasks serving the bulk and event endpoints whether the host has them, i.e. the device is
+		 *  configured and the vendor interface is in \ref VENDOR_ALT_BULK or \ref VENDOR_ALT_ISO. The HID build has them
+		 *  right away.
+		 */
+		static inline bool I2C_IsBulkActive(void) ATTR_ALWAYS_INLINE;
+		static inline bool I2C_IsBulkActive(void)
+		{
+			return (USB_DeviceState == DEVICE_STATE_Configured) && (HID_SUPPORT || (I2C_AltSetting != VENDOR_ALT_CONTROL));
+		}
+
+		/** Charges a packet sent or received on the bulk endpoints to the service whose turn it is. */
+		static inline void Sched_Charge(void) ATTR_ALWAYS_INLINE;
+		static inline void Sched_Charge(void)
+		{
+			int16_t* const deficit = &Sched_Deficit[Sched_Current];
+
+			if (*deficit > -SCHED_MAX_DEBT)
+				(*deficit)--;
+		}
+
+		/** Whether the service whose turn it is may go on with another packet. */
+		static inline bool Sched_HasBudget(void) ATTR_ALWAYS_INLINE;
+		static inline bool Sched_HasBudget(void)
+		{
+			return Sched_Deficit[Sched_Current] > 0;
+		}
+
+		/** Sends off the selected vendor IN bank. The HID build pads it to a full report first, HID hosts only
+		 *  take reports of the size given in the report descriptor.
+		 */
+		static inline void I2C_ClearVendorIN(void) ATTR_ALWAYS_INLINE;
+		static inline void I2C_ClearVendorIN(void)
+		{
+			if (HID_SUPPORT) {
+				while (Endpoint_BytesInEndpoint() < VENDOR_IO_EPSIZE)
+					Endpoint_Write_8(VENDOR_REPORT_PAD);
+			}
+
+			Endpoint_ClearIN();
+			Sched_Charge();
+		}
+
+	/* Function Prototypes: */
+		void SetupHardware(void);
+		uint32_t I2C_CalcSpeed(uint16_t khz, uint8_t* prescaler_out, uint8_t* bit_rate_out);
+		uint32_t SetupI2CSpeed(uint16_t khz);
+		bool I2C_ClaimBus(uint8_t owner);
+		void I2C_ReleaseBus(void);
+		bool I2C_Scan(uint8_t* const bitmap, const uint8_t read);
+		void Control_Preempt(void);
+
+		void EVENT_USB_Device_ControlRequest(void);
+		void EVENT_USB_Device_ConfigurationChanged(void);
+		void EVENT_USB_Device_StartOfFrame(void);
+
+#endif